@@ -0,0 +1,1598 @@
+/*
+    File:       vecLib/LinearAlgebra/LinearAlgebra_portable.h
+
+    Contains:   Portable LinearAlgebra objects with a fusing evaluator
+
+    This header implements the la_object_t interfaces of base.h,
+    object.h, matrix.h, vector.h, splat.h, arithmetic.h, norms.h and
+    linear_systems.h in namespace vdsp, with their names, parameter
+    lists, status codes and dimension rules, for the hosts that
+    vDSP_portable.h serves.
+
+    As in LinearAlgebra, objects are lazy.  la_sum, la_matrix_product and
+    the rest check their operands and record them, and elements are only
+    computed when la_matrix_to_float_buffer and friends, or a norm, ask
+    for them.  The evaluator then looks at the whole expression rather
+    than at one node at a time:
+
+        Sums, differences, elementwise products and scalings, nested to
+        any depth, run as one pass over the result that streams their
+        leaves in chunks small enough for L1.  Only the result is stored.
+
+        Transposes, slices, rows, columns and diagonals are never copied.
+        They fold into the strides with which a pass or a matrix product
+        reads the buffers underneath, and a transposed or sliced product
+        becomes a product of transposed or sliced operands.
+
+        Chains of matrix products are regrouped, as associativity allows,
+        into the order with the fewest multiplies.  Each product runs on
+        the packed, cache-blocked GEMM of cblas_portable.h, on as many
+        threads as cblas_set_num_threads() allows.  A product that is a
+        term of an elementwise expression is written straight into the
+        destination, which the pass then updates in place.
+
+    What does not fuse, such as a product operand that is itself an
+    expression, is stored once in a temporary freed at the end of the
+    evaluation.  la_evaluation_profile() reports what evaluations on the
+    calling thread have cost: passes, products, temporaries and their
+    size, and bytes read and written.  la_select_evaluation() switches
+    to eager evaluation, node by node through temporaries, as a baseline
+    to measure against.
+
+    la_solve() is the one operation that does not wait: it evaluates its
+    operands and solves when called, so that its status can say whether
+    the matrix was singular.  Square systems go through the solvers of
+    clapack_portable.h, which factor in single precision and refine the
+    solution with double precision residuals, to the precision of the
+    objects, falling back to a double precision factorization when
+    refinement does not converge.  As in LinearAlgebra, a symmetric
+    matrix with a positive diagonal is tried with Cholesky first and LU
+    after.  A zero pivot makes the result LA_SINGULAR_ERROR, and pivots
+    that span more than 1/(n*eps) give the solution the status
+    LA_WARNING_POORLY_CONDITIONED.  Other systems get the least-squares
+    solution, or the one of least norm, from a Householder QR in double
+    precision.
+
+    Arithmetic is in the precision of the objects.  Multiplies and adds
+    are never fused, and the order of every sum depends only on shapes,
+    so every instruction set and every thread count returns the same
+    bits.  Fused and eager evaluation agree too, except where a chain of
+    products is regrouped.  Hints are accepted and ignored.
+*/
+#ifndef __LA_PORTABLE__
+#define __LA_PORTABLE__
+
+#if defined(__cplusplus)
+
+#include <vecLib/cblas_portable.h>
+#include <vecLib/clapack_portable.h>
+#include <vecLib/vDSP_portable.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#if !defined(__LA_BASE_HEADER__)
+#define LA_DEFAULT_ATTRIBUTES           (0)
+#define LA_ATTRIBUTE_ENABLE_LOGGING     (1U << 0)
+typedef unsigned long la_attribute_t;
+
+#define LA_SUCCESS                       (0)
+#define LA_WARNING_POORLY_CONDITIONED    (1000)
+#define LA_INTERNAL_ERROR                (-1000)
+#define LA_INVALID_PARAMETER_ERROR       (-1001)
+#define LA_DIMENSION_MISMATCH_ERROR      (-1002)
+#define LA_PRECISION_MISMATCH_ERROR      (-1003)
+#define LA_SINGULAR_ERROR                (-1004)
+#define LA_SLICE_OUT_OF_BOUNDS_ERROR     (-1005)
+typedef long la_status_t;
+
+#define LA_SCALAR_TYPE_FLOAT  (0x8000)
+#define LA_SCALAR_TYPE_DOUBLE (0x4000)
+typedef unsigned int la_scalar_type_t;
+
+typedef unsigned long la_count_t;
+typedef long la_index_t;
+
+typedef void (*la_deallocator_t)(void *ptr);
+#endif
+
+#if !defined(__LA_OBJECT_HEADER__)
+typedef struct la_s *la_object_t;
+#endif
+
+#if !defined(__LA_MATRIX_HEADER__)
+#define LA_NO_HINT                       (0U)
+#define LA_SHAPE_DIAGONAL                (1U << 0)
+#define LA_SHAPE_LOWER_TRIANGULAR        (1U << 1)
+#define LA_SHAPE_UPPER_TRIANGULAR        (1U << 2)
+#define LA_FEATURE_SYMMETRIC             (1U << 16)
+#define LA_FEATURE_POSITIVE_DEFINITE     (1U << 17)
+#define LA_FEATURE_DIAGONALLY_DOMINANT   (1U << 18)
+typedef unsigned long la_hint_t;
+#endif
+
+#if !defined(__LA_VECTOR_HEADER__)
+#define la_vector_from_float_buffer(buffer, vector_length, buffer_stride, attributes) \
+    la_matrix_from_float_buffer(buffer, vector_length, 1, buffer_stride, LA_NO_HINT, attributes)
+#define la_vector_from_double_buffer(buffer, vector_length, buffer_stride, attributes) \
+    la_matrix_from_double_buffer(buffer, vector_length, 1, buffer_stride, LA_NO_HINT, attributes)
+#define la_vector_from_float_buffer_nocopy(buffer, vector_length, deallocator, attributes) \
+    la_matrix_from_float_buffer_nocopy(buffer, vector_length, 1, 1, LA_NO_HINT, deallocator, attributes)
+#define la_vector_from_double_buffer_nocopy(buffer, vector_length, deallocator, attributes) \
+    la_matrix_from_double_buffer_nocopy(buffer, vector_length, 1, 1, LA_NO_HINT, deallocator, attributes)
+#define la_vector_reverse(vector) \
+    la_vector_slice(vector, la_vector_length(vector)-1, -1, la_vector_length(vector))
+#endif
+
+#if !defined(__LA_NORMS_HEADER__)
+#define LA_L1_NORM 1
+#define LA_L2_NORM 2
+#define LA_LINF_NORM 3
+typedef unsigned long la_norm_t;
+#endif
+
+namespace vdsp {
+
+// How objects are evaluated, in all threads.
+enum class la_evaluation : int {
+    fused,      // whole expressions at once
+    eager,      // node by node, each into a temporary
+};
+
+// What the evaluations on one thread have cost.
+struct la_profile {
+    unsigned long   evaluations;        // objects whose elements were asked for
+    unsigned long   passes;             // elementwise passes over a result
+    unsigned long   products;           // matrix products
+    unsigned long   temporaries;        // intermediate results stored
+    unsigned long   temporary_bytes;
+    unsigned long   bytes_read;         // from buffers and temporaries
+    unsigned long   bytes_written;      // to results and temporaries
+    double          flops;
+};
+
+namespace detail {
+
+enum class la_kind : int {
+    error,
+    buffer,             // data, rows ld apart
+    splat,              // value
+    element,            // element index[0], index[1] of arg[0], as a splat
+    identity,
+    diagonal,           // arg[0] along diagonal index[0], zeros elsewhere
+    sum,
+    difference,
+    product,            // elementwise
+    scale,              // arg[0] * value
+    view,               // arg[0] through view
+    matrix_product,
+};
+
+// Element (i, j) of an object seen through a view is element
+// (r0 + i*rr + j*rc, c0 + i*cr + j*cc) of the object underneath.  Slices,
+// transposes, rows, columns and diagonals are all views.
+struct la_view {
+    la_index_t r0, c0, rr, rc, cr, cc;
+};
+
+inline constexpr la_view la_plain_view = { 0, 0, 1, 0, 0, 1 };
+
+} // namespace detail
+} // namespace vdsp
+
+// An la_object_t.  Splats have no dimensions until an operation or
+// la_matrix_from_splat() gives them some.
+struct la_s {
+    std::atomic<long>       refs;
+    vdsp::detail::la_kind   kind;
+    la_scalar_type_t        type;
+    la_status_t             status;
+    la_attribute_t          attributes;
+    la_count_t              rows, cols;
+    la_s*                   arg[2];
+    double                  value;
+    la_index_t              index[2];
+    vdsp::detail::la_view   view;
+    void*                   data;
+    la_index_t              ld;
+    la_deallocator_t        deallocator;    // nocopy buffers
+    bool                    owned;          // data allocated here
+};
+
+namespace vdsp {
+namespace detail {
+
+template <class T>
+inline constexpr la_scalar_type_t la_type = sizeof(T) == sizeof(float) ? LA_SCALAR_TYPE_FLOAT : LA_SCALAR_TYPE_DOUBLE;
+
+inline la_s* la_node(la_kind kind, la_scalar_type_t type, la_count_t rows, la_count_t cols,
+                     la_attribute_t attributes)
+{
+    la_s* x = new la_s();
+    x->refs.store(1, std::memory_order_relaxed);
+    x->kind = kind;
+    x->type = type;
+    x->status = LA_SUCCESS;
+    x->attributes = attributes;
+    x->rows = rows;
+    x->cols = cols;
+    x->view = la_plain_view;
+    return x;
+}
+
+inline la_s* la_retained(la_s* x)
+{
+    x->refs.fetch_add(1, std::memory_order_relaxed);
+    return x;
+}
+
+// Releases x, and then its operands, along the left operand without
+// recursion, so that long chains of sums do not run out of stack.
+inline void la_drop(la_s* x)
+{
+    while (x && x->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        la_drop(x->arg[1]);
+        if (x->owned)
+            free(x->data);
+        else if (x->deallocator && x->data)
+            x->deallocator(x->data);
+        la_s* next = x->arg[0];
+        delete x;
+        x = next;
+    }
+}
+
+inline const char* la_status_name(la_status_t s)
+{
+    switch (s) {
+    case LA_INVALID_PARAMETER_ERROR:
+        return "invalid parameter";
+    case LA_DIMENSION_MISMATCH_ERROR:
+        return "dimension mismatch";
+    case LA_PRECISION_MISMATCH_ERROR:
+        return "precision mismatch";
+    case LA_SINGULAR_ERROR:
+        return "singular";
+    case LA_SLICE_OUT_OF_BOUNDS_ERROR:
+        return "slice out of bounds";
+    default:
+        return "internal error";
+    }
+}
+
+inline la_s* la_error(la_status_t status, la_attribute_t attributes, const char* what)
+{
+    if (attributes & LA_ATTRIBUTE_ENABLE_LOGGING)
+        fprintf(stderr, "LinearAlgebra: %s: %s\n", what, la_status_name(status));
+    la_s* x = la_node(la_kind::error, 0, 0, 0, attributes);
+    x->status = status;
+    return x;
+}
+
+// The first operand with an error, retained, as the result of an
+// operation on it: errors propagate without being reported again.
+inline la_s* la_failed(la_s* a, la_s* b = nullptr)
+{
+    if (a->status < 0)
+        return la_retained(a);
+    if (b && b->status < 0)
+        return la_retained(b);
+    return nullptr;
+}
+
+inline bool la_is_splat(const la_s* x)
+{
+    return (x->kind == la_kind::splat || x->kind == la_kind::element) && x->rows == 0;
+}
+
+inline bool la_is_vector(const la_s* x) { return x->rows == 1 || x->cols == 1; }
+
+inline la_count_t la_length(const la_s* x) { return x->rows == 1 ? x->cols : x->rows; }
+
+// w seen through v.
+inline la_view la_compose(const la_view& w, const la_view& v)
+{
+    return { w.r0 + v.r0 * w.rr + v.c0 * w.rc, w.c0 + v.r0 * w.cr + v.c0 * w.cc,
+             v.rr * w.rr + v.cr * w.rc,         v.rc * w.rr + v.cc * w.rc,
+             v.rr * w.cr + v.cr * w.cc,         v.rc * w.cr + v.cc * w.cc };
+}
+
+// Rows of the result come from rows underneath, columns from columns.
+inline bool la_aligned(const la_view& v) { return v.rc == 0 && v.cr == 0; }
+
+// Rows come from columns and columns from rows.
+inline bool la_swapped(const la_view& v) { return v.rr == 0 && v.cc == 0; }
+
+inline bool la_plain(const la_view& v)
+{
+    return v.r0 == 0 && v.c0 == 0 && v.rr == 1 && v.rc == 0 && v.cr == 0 && v.cc == 1;
+}
+
+// An identity matrix seen through v is still one.
+inline bool la_keeps_identity(const la_view& v)
+{
+    return v.r0 == v.c0 && ((v.rr == 1 && v.cc == 1 && la_aligned(v)) || (v.rc == 1 && v.cr == 1 && la_swapped(v)));
+}
+
+// Whether a rows x cols view through v stays inside x.
+inline bool la_inside(const la_s* x, const la_view& v, la_count_t rows, la_count_t cols)
+{
+    const la_index_t i = (la_index_t)rows - 1, j = (la_index_t)cols - 1;
+    for (la_index_t r : { v.r0, v.r0 + i * v.rr, v.r0 + j * v.rc, v.r0 + i * v.rr + j * v.rc })
+        if (r < 0 || r >= (la_index_t)x->rows)
+            return false;
+    for (la_index_t c : { v.c0, v.c0 + i * v.cr, v.c0 + j * v.cc, v.c0 + i * v.cr + j * v.cc })
+        if (c < 0 || c >= (la_index_t)x->cols)
+            return false;
+    return true;
+}
+
+inline la_s* la_unary(la_kind kind, la_s* a, la_count_t rows, la_count_t cols)
+{
+    la_s* x = la_node(kind, a->type, rows, cols, a->attributes);
+    x->arg[0] = la_retained(a);
+    return x;
+}
+
+// a through v, as a rows x cols object.  Views of views compose.
+inline la_s* la_viewed(la_s* a, const la_view& v, la_count_t rows, la_count_t cols)
+{
+    la_view w = v;
+    la_s* x = a;
+    if (a->kind == la_kind::view) {
+        w = la_compose(a->view, v);
+        x = a->arg[0];
+    }
+    la_s* y = la_unary(la_kind::view, x, rows, cols);
+    y->attributes = a->attributes;
+    y->view = w;
+    return y;
+}
+
+inline la_s* la_transposed(la_s* a) { return la_viewed(a, { 0, 0, 0, 1, 1, 0 }, a->cols, a->rows); }
+
+// A rows x cols matrix from the splat s.
+inline la_s* la_sized(la_s* s, la_count_t rows, la_count_t cols)
+{
+    la_s* x = la_node(s->kind, s->type, rows, cols, s->attributes);
+    x->value = s->value;
+    x->index[0] = s->index[0];
+    x->index[1] = s->index[1];
+    if (s->arg[0])
+        x->arg[0] = la_retained(s->arg[0]);
+    return x;
+}
+
+// Takes over the references to l and r.
+inline la_s* la_binary(la_kind kind, la_s* l, la_s* r, la_count_t rows, la_count_t cols)
+{
+    la_s* x = la_node(kind, l->type, rows, cols, l->attributes | r->attributes);
+    x->arg[0] = l;
+    x->arg[1] = r;
+    return x;
+}
+
+inline la_s* la_elementwise(la_kind kind, la_s* a, la_s* b, const char* what)
+{
+    if (la_s* e = la_failed(a, b))
+        return e;
+    const la_attribute_t attributes = a->attributes | b->attributes;
+    if (la_is_splat(a) && la_is_splat(b))
+        return la_error(LA_INVALID_PARAMETER_ERROR, attributes, what);
+    if (a->type != b->type)
+        return la_error(LA_PRECISION_MISMATCH_ERROR, attributes, what);
+    la_s* l = la_is_splat(a) ? la_sized(a, b->rows, b->cols) : la_retained(a);
+    la_s* r = la_is_splat(b) ? la_sized(b, a->rows, a->cols) : la_retained(b);
+    if (l->rows != r->rows || l->cols != r->cols) {
+        // A 1 x n operand against an n x 1 one is read as n x 1.
+        la_s** row = l->rows == 1 && r->cols == 1 ? &l : r->rows == 1 && l->cols == 1 ? &r : nullptr;
+        if (!row || la_length(l) != la_length(r)) {
+            la_drop(l);
+            la_drop(r);
+            return la_error(LA_DIMENSION_MISMATCH_ERROR, attributes, what);
+        }
+        la_s* t = la_transposed(*row);
+        la_drop(*row);
+        *row = t;
+    }
+    return la_binary(kind, l, r, l->rows, l->cols);
+}
+
+template <class T>
+inline la_s* la_copy(const T* buffer, la_count_t rows, la_count_t cols, la_count_t ld, la_attribute_t attributes,
+                     const char* what)
+{
+    if (!buffer || !rows || !cols || ld < cols)
+        return la_error(LA_INVALID_PARAMETER_ERROR, attributes, what);
+    T* data = (T*)malloc(rows * cols * sizeof(T));
+    if (!data)
+        return la_error(LA_INTERNAL_ERROR, attributes, what);
+    for (la_count_t i = 0; i < rows; i++)
+        memcpy(data + i * cols, buffer + i * ld, cols * sizeof(T));
+    la_s* x = la_node(la_kind::buffer, la_type<T>, rows, cols, attributes);
+    x->data = data;
+    x->ld = (la_index_t)cols;
+    x->owned = true;
+    return x;
+}
+
+template <class T>
+inline la_s* la_wrap(T* buffer, la_count_t rows, la_count_t cols, la_count_t ld, la_deallocator_t deallocator,
+                     la_attribute_t attributes, const char* what)
+{
+    if (!buffer || !rows || !cols || ld < cols)
+        return la_error(LA_INVALID_PARAMETER_ERROR, attributes, what);
+    la_s* x = la_node(la_kind::buffer, la_type<T>, rows, cols, attributes);
+    x->data = buffer;
+    x->ld = (la_index_t)ld;
+    x->deallocator = deallocator;
+    return x;
+}
+
+// Element (i, j) at p[i*si + j*sj].
+template <class T>
+struct la_operand {
+    const T*    p;
+    la_index_t  si, sj;
+};
+
+// The operand s through v.
+template <class T>
+inline la_operand<T> la_through(const la_operand<T>& s, const la_view& v)
+{
+    return { s.p + v.r0 * s.si + v.c0 * s.sj, v.rr * s.si + v.cr * s.sj, v.rc * s.si + v.cc * s.sj };
+}
+
+// An elementwise expression compiles to a program for a stack machine
+// whose registers are chunks of a row of the result.
+enum class la_opcode : int { load, constant, eye, add, subtract, multiply, scale };
+
+template <class T>
+struct la_op {
+    la_opcode   code;
+    const T*    p;          // load: element (i, j) at p[i*si + j*sj]
+    la_index_t  si, sj;     // eye: 1 where o + i*si + j*sj is 0
+    la_index_t  o;
+    T           c;          // constant, scale
+};
+
+inline constexpr int la_stack = 6, la_ops = 48;
+inline constexpr la_count_t la_chunk = 128, la_band = 64;
+
+template <class T>
+struct la_program {
+    la_op<T>    ops[la_ops];
+    int         n = 0, sp = 0;
+
+    void push(const la_op<T>& op)
+    {
+        ops[n++] = op;
+        sp++;
+    }
+
+    void load(const la_operand<T>& s) { push({ la_opcode::load, s.p, s.si, s.sj, 0, 0 }); }
+    void constant(T c) { push({ la_opcode::constant, nullptr, 0, 0, 0, c }); }
+    void eye(const la_view& v) { push({ la_opcode::eye, nullptr, v.rr - v.cr, v.rc - v.cc, v.r0 - v.c0, 0 }); }
+
+    void apply(la_opcode code, T c = 0)
+    {
+        ops[n++] = { code, nullptr, 0, 0, 0, c };
+        if (code != la_opcode::scale)
+            sp--;
+    }
+};
+
+template <class T>
+struct la_pass_call {
+    const la_op<T>* ops;
+    int             n;
+    T*              y;          // element (i, j) at y[i*yi + j*yj]
+    la_index_t      yi, yj;
+    la_count_t      rows, cols; // cols along the chunks
+    bool            across;     // chunk columns outermost
+};
+
+template <class T, int B>
+__VDSP_INLINE void la_step(const la_pass_call<T>& k, la_count_t i, la_count_t j,
+                           typename simd<T, B>::vector (&r)[la_stack][la_chunk / simd<T, B>::width])
+{
+    typedef typename simd<T, B>::vector V;
+    constexpr la_count_t nv = la_chunk / simd<T, B>::width;
+    const la_count_t c = std::min(la_chunk, k.cols - j);
+    T lanes[la_chunk];
+    int sp = 0;
+    for (int o = 0; o < k.n; o++) {
+        const la_op<T>& op = k.ops[o];
+        switch (op.code) {
+        case la_opcode::load: {
+            const T* p = op.p + (la_index_t)i * op.si + (la_index_t)j * op.sj;
+            if (op.sj == 1 && c == la_chunk) {
+                memcpy(r[sp], p, sizeof(r[sp]));
+            } else {
+                for (la_count_t l = 0; l < c; l++)
+                    lanes[l] = p[(la_index_t)l * op.sj];
+                for (la_count_t l = c; l < la_chunk; l++)
+                    lanes[l] = 0;
+                memcpy(r[sp], lanes, sizeof(r[sp]));
+            }
+            sp++;
+            break;
+        }
+        case la_opcode::constant:
+            for (la_count_t u = 0; u < nv; u++)
+                splat(r[sp][u], op.c);
+            sp++;
+            break;
+        case la_opcode::eye: {
+            const la_index_t d = op.o + (la_index_t)i * op.si + (la_index_t)j * op.sj;
+            for (la_count_t l = 0; l < la_chunk; l++)
+                lanes[l] = l < c && d + (la_index_t)l * op.sj == 0 ? 1 : 0;
+            memcpy(r[sp], lanes, sizeof(r[sp]));
+            sp++;
+            break;
+        }
+        case la_opcode::add:
+            sp--;
+            for (la_count_t u = 0; u < nv; u++)
+                r[sp - 1][u] = r[sp - 1][u] + r[sp][u];
+            break;
+        case la_opcode::subtract:
+            sp--;
+            for (la_count_t u = 0; u < nv; u++)
+                r[sp - 1][u] = r[sp - 1][u] - r[sp][u];
+            break;
+        case la_opcode::multiply:
+            sp--;
+            for (la_count_t u = 0; u < nv; u++)
+                r[sp - 1][u] = r[sp - 1][u] * r[sp][u];
+            break;
+        case la_opcode::scale: {
+            V s;
+            splat(s, op.c);
+            for (la_count_t u = 0; u < nv; u++)
+                r[sp - 1][u] = r[sp - 1][u] * s;
+            break;
+        }
+        }
+    }
+    T* y = k.y + (la_index_t)i * k.yi + (la_index_t)j * k.yj;
+    if (k.yj == 1 && c == la_chunk) {
+        memcpy(y, r[0], sizeof(r[0]));
+    } else {
+        memcpy(lanes, r[0], sizeof(lanes));
+        for (la_count_t l = 0; l < c; l++)
+            y[(la_index_t)l * k.yj] = lanes[l];
+    }
+}
+
+// Row by row, or, when an operand is read across its rows, in bands of
+// la_band rows, chunk column by chunk column within a band: consecutive
+// rows of the result then read neighbouring elements of the same cache
+// lines of that operand, and a band touches few enough pages for the TLB.
+template <class T, int B>
+__VDSP_INLINE void la_pass(const la_pass_call<T>& k)
+{
+    typename simd<T, B>::vector r[la_stack][la_chunk / simd<T, B>::width];
+    if (k.across) {
+        for (la_count_t b = 0; b < k.rows; b += la_band)
+            for (la_count_t j = 0; j < k.cols; j += la_chunk)
+                for (la_count_t i = b; i < std::min(b + la_band, k.rows); i++)
+                    la_step<T, B>(k, i, j, r);
+    } else {
+        for (la_count_t i = 0; i < k.rows; i++)
+            for (la_count_t j = 0; j < k.cols; j += la_chunk)
+                la_step<T, B>(k, i, j, r);
+    }
+}
+
+template <int B, class T>
+__VDSP_INLINE void la_run(const la_pass_call<T>& k) { la_pass<T, B>(k); }
+
+template <class K>
+__VDSP_NOCONTRACT void la_run_baseline(const K& k) { la_run<16>(k); }
+
+#if defined(__VDSP_X86_DISPATCH)
+template <class K>
+__attribute__((target("avx2"))) __VDSP_NOCONTRACT void la_run_avx2(const K& k) { la_run<32>(k); }
+
+template <class K>
+__attribute__((target("avx512f"))) __VDSP_NOCONTRACT void la_run_avx512(const K& k) { la_run<64>(k); }
+#endif
+
+template <class K>
+inline void la_dispatch(const K& k)
+{
+    switch ((isa)active().load(std::memory_order_relaxed)) {
+#if defined(__VDSP_X86_DISPATCH)
+    case isa::avx512:
+        return la_run_avx512(k);
+    case isa::avx2:
+        return la_run_avx2(k);
+#endif
+    default:
+        return la_run_baseline(k);
+    }
+}
+
+inline std::atomic<int>& la_mode()
+{
+    static std::atomic<int> slot((int)la_evaluation::fused);
+    return slot;
+}
+
+inline la_profile& la_counters()
+{
+    static thread_local la_profile profile = {};
+    return profile;
+}
+
+// One factor of a chain of matrix products: x through v, rows x cols.
+struct la_factor {
+    const la_s* x;
+    la_view     v;
+    la_count_t  rows, cols;
+};
+
+// One evaluation.  It owns the temporaries, which live until it ends.
+template <class T>
+struct la_evaluator {
+    la_profile&                         profile = la_counters();
+    const bool                          fused = la_mode().load(std::memory_order_relaxed) == (int)la_evaluation::fused;
+    std::vector<std::unique_ptr<T[]>>   temporaries;
+    std::deque<T>                       scalars;
+
+    T* temporary(la_count_t n)
+    {
+        temporaries.emplace_back(new T[n]);
+        profile.temporaries++;
+        profile.temporary_bytes += n * sizeof(T);
+        return temporaries.back().get();
+    }
+
+    const T* scalar(T v)
+    {
+        scalars.push_back(v);
+        return &scalars.back();
+    }
+
+    // Whether a kernel produces x through v without a pass: products
+    // through views that keep rows and columns apart, and diagonal
+    // matrices as they are.
+    static bool direct(const la_s* x, const la_view& v)
+    {
+        if (x->kind == la_kind::matrix_product)
+            return la_aligned(v) || la_swapped(v);
+        return x->kind == la_kind::diagonal && la_plain(v);
+    }
+
+    static bool elementwise(const la_s* x)
+    {
+        return x->kind != la_kind::matrix_product && x->kind != la_kind::diagonal && x->kind != la_kind::error;
+    }
+
+    T element(const la_s* x)
+    {
+        T* none = nullptr;
+        const la_operand<T> s = source(x->arg[0], { x->index[0], x->index[1], 0, 0, 0, 0 }, 1, 1, none, 0);
+        return *s.p;
+    }
+
+    // x through v as an operand: buffers in place, anything else stored
+    // first, into slot if it is set and x fits the destination there.
+    la_operand<T> source(const la_s* x, const la_view& v, la_count_t rows, la_count_t cols, T*& slot, la_index_t ld)
+    {
+        switch (x->kind) {
+        case la_kind::buffer:
+            return la_through<T>({ (const T*)x->data, x->ld, 1 }, v);
+        case la_kind::splat:
+            return { scalar((T)x->value), 0, 0 };
+        case la_kind::element:
+            return { scalar(element(x)), 0, 0 };
+        case la_kind::view:
+            if (fused)
+                return source(x->arg[0], la_compose(x->view, v), rows, cols, slot, ld);
+            break;
+        default:
+            break;
+        }
+        if (direct(x, v) || elementwise(x)) {
+            T* y = slot;
+            if (y) {
+                slot = nullptr;
+            } else {
+                y = temporary(rows * cols);
+                ld = (la_index_t)cols;
+            }
+            into(x, v, rows, cols, y, ld);
+            return { y, ld, 1 };
+        }
+        T* y = temporary(x->rows * x->cols);
+        into(x, la_plain_view, x->rows, x->cols, y, (la_index_t)x->cols);
+        return la_through<T>({ y, (la_index_t)x->cols, 1 }, v);
+    }
+
+    // Appends x through v to p, in at most budget ops, and returns how
+    // many it took.  Operands that do not fit, and in eager evaluation
+    // all but the leaves, become loads of their stored results.
+    int compile(la_program<T>& p, const la_s* x, const la_view& v, la_count_t rows, la_count_t cols, T*& slot,
+                la_index_t ld, int budget, bool top)
+    {
+        switch (x->kind) {
+        case la_kind::buffer:
+            p.load(la_through<T>({ (const T*)x->data, x->ld, 1 }, v));
+            return 1;
+        case la_kind::splat:
+            p.constant((T)x->value);
+            return 1;
+        case la_kind::element:
+            p.constant(element(x));
+            return 1;
+        case la_kind::identity:
+            p.eye(v);
+            return 1;
+        default:
+            break;
+        }
+        if (fused || top) {
+            switch (x->kind) {
+            case la_kind::view:
+                return compile(p, x->arg[0], la_compose(x->view, v), rows, cols, slot, ld, budget, false);
+            case la_kind::scale:
+                if (budget >= 2) {
+                    const int u = compile(p, x->arg[0], v, rows, cols, slot, ld, budget - 1, false);
+                    p.apply(la_opcode::scale, (T)x->value);
+                    return u + 1;
+                }
+                break;
+            case la_kind::sum:
+            case la_kind::difference:
+            case la_kind::product:
+                if (budget >= 3 && p.sp + 2 <= la_stack) {
+                    int u = compile(p, x->arg[0], v, rows, cols, slot, ld, budget - 2, false);
+                    u += compile(p, x->arg[1], v, rows, cols, slot, ld, budget - 1 - u, false);
+                    p.apply(x->kind == la_kind::sum ? la_opcode::add
+                            : x->kind == la_kind::difference ? la_opcode::subtract : la_opcode::multiply);
+                    return u + 1;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        p.load(source(x, v, rows, cols, slot, ld));
+        return 1;
+    }
+
+    void pass(la_program<T>& p, la_count_t rows, la_count_t cols, T* y, la_index_t ld)
+    {
+        const la_op<T>& first = p.ops[0];
+        if (p.n == 1 && first.code == la_opcode::load && first.p == y && first.si == ld && first.sj == 1)
+            return;
+        la_pass_call<T> k = { p.ops, p.n, y, ld, 1, rows, cols, false };
+        // Chunks run along the rows, unless the columns are longer and
+        // the rows short, or more of the operands are contiguous down
+        // the columns.
+        int down = (ld == 1) - 1;
+        for (int o = 0; o < p.n; o++) {
+            const la_op<T>& op = p.ops[o];
+            if (op.code == la_opcode::load) {
+                down += (op.si == 1) - (op.sj == 1);
+                profile.bytes_read += (op.si || op.sj ? rows * cols : 1) * sizeof(T);
+            }
+        }
+        if ((cols < 16 && rows > cols) || (down > 0 && rows >= 16)) {
+            for (int o = 0; o < p.n; o++)
+                std::swap(p.ops[o].si, p.ops[o].sj);
+            std::swap(k.yi, k.yj);
+            std::swap(k.rows, k.cols);
+        }
+        for (int o = 0; o < p.n; o++)
+            k.across |= p.ops[o].code == la_opcode::load && p.ops[o].sj != 0 && p.ops[o].sj != 1;
+        profile.passes++;
+        profile.bytes_written += rows * cols * sizeof(T);
+        la_dispatch(k);
+    }
+
+    void gemm(const la_operand<T>& a, const la_operand<T>& b, T* c, la_index_t ldc, la_count_t m, la_count_t n,
+              la_count_t k)
+    {
+        const blas_gemm_call<T> g = { { a.p, a.si, a.sj }, { b.p, b.si, b.sj }, c, ldc, (long)m, (long)n, (long)k,
+                                      1, 0, blas_block<T>(m, n, k) };
+        profile.products++;
+        profile.flops += 2.0 * m * n * k;
+        if (g.blocks.kc == 0) {
+            profile.bytes_read += (m * k + k * n) * sizeof(T);
+            profile.bytes_written += m * n * sizeof(T);
+        } else {
+            const la_count_t panels = (n + g.blocks.nc - 1) / g.blocks.nc, steps = (k + g.blocks.kc - 1) / g.blocks.kc;
+            profile.bytes_read += (m * k * panels + k * n + m * n * (steps - 1)) * sizeof(T);
+            profile.bytes_written += m * n * steps * sizeof(T);
+        }
+        blas_gemm(g);
+    }
+
+    // Collects the factors of the product x through v, seeing through
+    // views and nested products, and dropping identities.
+    void flatten(std::vector<la_factor>& f, const la_s* x, const la_view& v, la_count_t rows, la_count_t cols)
+    {
+        const la_s* a = x->arg[0];
+        const la_s* b = x->arg[1];
+        const la_count_t k = a->cols;
+        la_factor l = { a, { v.r0, 0, v.rr, 0, 0, 1 }, rows, k }, r = { b, { 0, v.c0, 1, 0, 0, v.cc }, k, cols };
+        if (!la_aligned(v)) {
+            // (A B)' = B' A'
+            l = { b, { 0, v.c0, 0, 1, v.cr, 0 }, rows, k };
+            r = { a, { v.r0, 0, 0, v.rc, 1, 0 }, k, cols };
+        }
+        const size_t before = f.size();
+        for (la_factor s : { l, r }) {
+            while (fused && s.x->kind == la_kind::view) {
+                s.v = la_compose(s.x->view, s.v);
+                s.x = s.x->arg[0];
+            }
+            if (fused && s.x->kind == la_kind::matrix_product && direct(s.x, s.v))
+                flatten(f, s.x, s.v, s.rows, s.cols);
+            else if (!(fused && s.x->kind == la_kind::identity && la_keeps_identity(s.v)))
+                f.push_back(s);
+        }
+        if (f.size() == before)
+            f.push_back(l);
+    }
+
+    la_operand<T> side(const std::vector<la_factor>& f, const std::vector<size_t>& split, size_t i, size_t j)
+    {
+        if (i == j) {
+            T* none = nullptr;
+            return source(f[i].x, f[i].v, f[i].rows, f[i].cols, none, 0);
+        }
+        T* t = temporary(f[i].rows * f[j].cols);
+        multiply(f, split, i, j, t, (la_index_t)f[j].cols);
+        return { t, (la_index_t)f[j].cols, 1 };
+    }
+
+    void multiply(const std::vector<la_factor>& f, const std::vector<size_t>& split, size_t i, size_t j, T* y,
+                  la_index_t ld)
+    {
+        const size_t s = split[i * f.size() + j];
+        const la_operand<T> a = side(f, split, i, s), b = side(f, split, s + 1, j);
+        gemm(a, b, y, ld, f[i].rows, f[j].cols, f[s].cols);
+    }
+
+    // A chain of products, grouped for the fewest multiplies; left to
+    // right in eager evaluation.
+    void chain(const la_s* x, const la_view& v, la_count_t rows, la_count_t cols, T* y, la_index_t ld)
+    {
+        std::vector<la_factor> f;
+        flatten(f, x, v, rows, cols);
+        const size_t n = f.size();
+        if (n == 1)
+            return into(f[0].x, f[0].v, rows, cols, y, ld);
+        std::vector<size_t> split(n * n);
+        std::vector<double> cost(n * n);
+        for (size_t len = 1; len < n; len++) {
+            for (size_t i = 0; i + len < n; i++) {
+                const size_t j = i + len;
+                split[i * n + j] = j - 1;
+                if (!fused)
+                    continue;
+                double best = HUGE_VAL;
+                for (size_t s = i; s < j; s++) {
+                    const double c = cost[i * n + s] + cost[(s + 1) * n + j] + (double)f[i].rows * f[s].cols * f[j].cols;
+                    if (c < best) {
+                        best = c;
+                        split[i * n + j] = s;
+                    }
+                }
+                cost[i * n + j] = best;
+            }
+        }
+        multiply(f, split, 0, n - 1, y, ld);
+    }
+
+    void diagonal(const la_s* x, T* y, la_index_t ld)
+    {
+        const la_s* a = x->arg[0];
+        const la_index_t d = x->index[0];
+        for (la_count_t i = 0; i < x->rows; i++)
+            for (la_count_t j = 0; j < x->cols; j++)
+                y[(la_index_t)i * ld + (la_index_t)j] = 0;
+        T* none = nullptr;
+        const la_operand<T> s = source(a, la_plain_view, a->rows, a->cols, none, 0);
+        const la_index_t step = a->rows == 1 ? s.sj : s.si, r0 = std::max<la_index_t>(0, -d), c0 = std::max<la_index_t>(0, d);
+        for (la_count_t l = 0; l < la_length(a); l++)
+            y[(r0 + (la_index_t)l) * ld + c0 + (la_index_t)l] = s.p[(la_index_t)l * step];
+        profile.bytes_read += la_length(a) * sizeof(T);
+        profile.bytes_written += x->rows * x->cols * sizeof(T);
+    }
+
+    // Stores x through v, a rows x cols object, at y, rows ld apart.
+    void into(const la_s* x, la_view v, la_count_t rows, la_count_t cols, T* y, la_index_t ld)
+    {
+        while (fused && x->kind == la_kind::view) {
+            v = la_compose(x->view, v);
+            x = x->arg[0];
+        }
+        if (x->kind == la_kind::matrix_product && direct(x, v))
+            return chain(x, v, rows, cols, y, ld);
+        if (x->kind == la_kind::diagonal && direct(x, v))
+            return diagonal(x, y, ld);
+        la_program<T> p;
+        T* slot = y;
+        compile(p, x, v, rows, cols, slot, ld, la_ops, true);
+        pass(p, rows, cols, y, ld);
+    }
+};
+
+template <class T>
+inline la_status_t la_store(T* buffer, la_index_t ld, la_s* x, const la_view& v, la_count_t rows, la_count_t cols)
+{
+    if (x->status < 0) {
+        for (la_count_t i = 0; i < rows; i++)
+            for (la_count_t j = 0; j < cols; j++)
+                buffer[(la_index_t)i * ld + (la_index_t)j] = NAN;
+        return x->status;
+    }
+    if (x->type != la_type<T>)
+        return LA_PRECISION_MISMATCH_ERROR;
+    la_evaluator<T> e;
+    e.profile.evaluations++;
+    e.into(x, v, rows, cols, buffer, ld);
+    return x->status;
+}
+
+template <class T>
+inline double la_norm(la_s* x, la_norm_t norm)
+{
+    la_evaluator<T> e;
+    e.profile.evaluations++;
+    T* none = nullptr;
+    const la_operand<T> s = e.source(x, la_plain_view, x->rows, x->cols, none, 0);
+    double big = 0, sum = 0;
+    for (la_count_t i = 0; i < x->rows; i++) {
+        for (la_count_t j = 0; j < x->cols; j++) {
+            const double a = fabs((double)s.p[(la_index_t)i * s.si + (la_index_t)j * s.sj]);
+            big = a > big || isnan(a) ? a : big;
+            sum += a;
+        }
+    }
+    if (norm == LA_L1_NORM || isnan(big))
+        return norm == LA_L1_NORM ? sum : big;
+    if (norm == LA_LINF_NORM || big == 0 || isinf(big))
+        return big;
+    // Scaled by the largest magnitude, so that the squares neither
+    // overflow nor underflow.
+    sum = 0;
+    for (la_count_t i = 0; i < x->rows; i++) {
+        for (la_count_t j = 0; j < x->cols; j++) {
+            const double a = (double)s.p[(la_index_t)i * s.si + (la_index_t)j * s.sj] / big;
+            sum += a * a;
+        }
+    }
+    return big * sqrt(sum);
+}
+
+template <class T>
+inline la_s* la_normalized(la_s* x, la_norm_t norm)
+{
+    T* data = (T*)malloc(x->rows * x->cols * sizeof(T));
+    if (!data)
+        return la_error(LA_INTERNAL_ERROR, x->attributes, "la_normalized_vector");
+    la_store(data, (la_index_t)x->cols, x, la_plain_view, x->rows, x->cols);
+    la_s* b = la_node(la_kind::buffer, x->type, x->rows, x->cols, x->attributes);
+    b->data = data;
+    b->ld = (la_index_t)x->cols;
+    b->owned = true;
+    const double n = la_norm<T>(b, norm);
+    la_s* y = la_unary(la_kind::scale, b, x->rows, x->cols);
+    y->value = n > 0 ? 1 / n : 0;
+    la_drop(b);
+    return y;
+}
+
+// x, evaluated and widened to double precision, rows x->cols apart.
+template <class T>
+inline std::vector<double> la_widened(la_s* x)
+{
+    std::vector<T> t(x->rows * x->cols);
+    la_store(t.data(), (la_index_t)x->cols, x, la_plain_view, x->rows, x->cols);
+    return std::vector<double>(t.begin(), t.end());
+}
+
+// Whether the diagonal of the factors in m spans more than 1/(n*eps):
+// a poorly conditioned matrix, at the precision of the objects.  Squared
+// for Cholesky factors.
+template <class T>
+inline bool la_poorly_conditioned(const lapack_matrix<T>& m, long n, bool cholesky, double eps)
+{
+    double least = HUGE_VAL, most = 0;
+    for (long i = 0; i < n; i++) {
+        const double d = cholesky ? (double)m(i, i) * m(i, i) : fabs((double)m(i, i));
+        least = std::min(least, d);
+        most = std::max(most, d);
+    }
+    return least <= most * (double)n * eps;
+}
+
+// Solves a*x = b for the n x n row-major a and n x r row-major b, into
+// x.  a is overwritten.  The factored matrix is a seen column-major,
+// which is a', so LU solves with its transpose; a symmetric a is its own
+// transpose.  Conditioning is judged from the single precision factors
+// if refinement converged, and from the double precision ones if not.
+inline la_status_t la_square(std::vector<double>& a, const std::vector<double>& b, std::vector<double>& x, long n,
+                             long r, double eps)
+{
+    const lapack_matrix<double> m = { a.data(), 1, n }, bm = { (double*)b.data(), r, 1 }, xm = { x.data(), r, 1 };
+    std::vector<__CLPK_integer> ipiv(n);
+    std::vector<double> work(n * r), diagonal(n);
+    std::vector<float> swork(n * (n + r));
+    const lapack_matrix<float> sm = { swork.data(), 1, n };
+    long iter;
+    bool symmetric = true;
+    for (long i = 0; i < n && symmetric; i++) {
+        symmetric = m(i, i) > 0;
+        for (long j = 0; j < i && symmetric; j++)
+            symmetric = m(i, j) == m(j, i);
+    }
+    if (symmetric) {
+        for (long i = 0; i < n; i++)
+            diagonal[i] = m(i, i);
+        if (lapack_refine(true, false, n, r, m, ipiv.data(), bm, xm, work.data(), swork.data(), eps, iter) == 0)
+            return (iter < 0 ? la_poorly_conditioned(m, n, true, eps) : la_poorly_conditioned(sm, n, true, eps))
+                   ? LA_WARNING_POORLY_CONDITIONED : LA_SUCCESS;
+        // Not positive definite.  Cholesky only wrote the lower triangle,
+        // and the upper one still holds it.
+        for (long j = 0; j < n; j++) {
+            m(j, j) = diagonal[j];
+            for (long i = j + 1; i < n; i++)
+                m(i, j) = m(j, i);
+        }
+    }
+    if (lapack_refine(false, true, n, r, m, ipiv.data(), bm, xm, work.data(), swork.data(), eps, iter) != 0)
+        return LA_SINGULAR_ERROR;
+    return (iter < 0 ? la_poorly_conditioned(m, n, false, eps) : la_poorly_conditioned(sm, n, false, eps))
+           ? LA_WARNING_POORLY_CONDITIONED : LA_SUCCESS;
+}
+
+// Householder QR of the m x n column-major q, m >= n, in place: R on and
+// above the diagonal, the reflection I - v*v'/h[k] of column k below it,
+// with v[k] in v0[k].  Returns false if a column is dependent on those
+// before it.
+inline bool la_qr(double* q, long m, long n, std::vector<double>& v0, std::vector<double>& h)
+{
+    for (long k = 0; k < n; k++) {
+        double* c = q + k * m;
+        double norm = 0;
+        for (long i = k; i < m; i++)
+            norm = hypot(norm, c[i]);
+        if (norm == 0)
+            return false;
+        const double alpha = c[k] >= 0 ? -norm : norm;
+        v0[k] = c[k] - alpha;
+        h[k] = norm * norm - alpha * c[k];
+        c[k] = alpha;
+        for (long j = k + 1; j < n; j++) {
+            double* d = q + j * m;
+            double s = v0[k] * d[k];
+            for (long i = k + 1; i < m; i++)
+                s += c[i] * d[i];
+            s /= h[k];
+            d[k] -= s * v0[k];
+            for (long i = k + 1; i < m; i++)
+                d[i] -= s * c[i];
+        }
+    }
+    return true;
+}
+
+// y = (I - v*v'/h[k]) y, for the reflection of column k of la_qr.
+inline void la_reflect(const double* q, long m, long k, const std::vector<double>& v0, const std::vector<double>& h,
+                       double* y)
+{
+    const double* c = q + k * m;
+    double s = v0[k] * y[k];
+    for (long i = k + 1; i < m; i++)
+        s += c[i] * y[i];
+    s /= h[k];
+    y[k] -= s * v0[k];
+    for (long i = k + 1; i < m; i++)
+        y[i] -= s * c[i];
+}
+
+// The least-squares solution of a*x = b for an m x n row-major a of full
+// rank with m > n, or the solution of least norm with m < n, into the n x
+// r row-major x.  a, and for m > n b, are overwritten.
+inline bool la_least_squares(std::vector<double>& a, std::vector<double>& b, std::vector<double>& x, long m, long n,
+                             long r)
+{
+    const long k = std::min(m, n), rows = std::max(m, n);
+    std::vector<double> v0(k), h(k), y(rows);
+    // A row-major a is a' column-major, which is what m < n factors.
+    std::vector<double> t;
+    double* q = a.data();
+    if (m > n) {
+        t.resize(m * n);
+        for (long i = 0; i < m; i++)
+            for (long j = 0; j < n; j++)
+                t[i + j * m] = a[i * n + j];
+        q = t.data();
+    }
+    if (!la_qr(q, rows, k, v0, h))
+        return false;
+    for (long c = 0; c < r; c++) {
+        if (m > n) {
+            // R x = Q'b.
+            for (long i = 0; i < m; i++)
+                y[i] = b[i * r + c];
+            for (long l = 0; l < n; l++)
+                la_reflect(q, m, l, v0, h, y.data());
+            for (long i = n - 1; i >= 0; i--) {
+                double s = y[i];
+                for (long j = i + 1; j < n; j++)
+                    s -= q[i + j * m] * y[j];
+                y[i] = s / q[i + i * m];
+            }
+        } else {
+            // x = Q [y; 0], with R'y = b.
+            for (long i = 0; i < m; i++) {
+                double s = b[i * r + c];
+                for (long j = 0; j < i; j++)
+                    s -= q[j + i * n] * y[j];
+                y[i] = s / q[i + i * n];
+            }
+            std::fill(y.begin() + m, y.end(), 0.0);
+            for (long l = m - 1; l >= 0; l--)
+                la_reflect(q, n, l, v0, h, y.data());
+        }
+        for (long i = 0; i < n; i++)
+            x[i * r + c] = y[i];
+    }
+    return true;
+}
+
+// The solution of a*x = b, as a new buffer; a row if row.
+template <class T>
+inline la_s* la_solved(la_s* a, la_s* b, bool row, la_attribute_t attributes)
+{
+    const long m = (long)a->rows, n = (long)a->cols, r = (long)b->cols;
+    std::vector<double> ad = la_widened<T>(a), bd = la_widened<T>(b), xd(n * r);
+    const double eps = sizeof(T) == sizeof(float) ? 0x1p-24 : 0x1p-53;
+    la_status_t status = LA_SUCCESS;
+    if (m == n)
+        status = la_square(ad, bd, xd, n, r, eps);
+    else if (!la_least_squares(ad, bd, xd, m, n, r))
+        status = LA_SINGULAR_ERROR;
+    if (status < 0)
+        return la_error(status, attributes, "la_solve");
+    T* data = (T*)malloc(n * r * sizeof(T));
+    if (!data)
+        return la_error(LA_INTERNAL_ERROR, attributes, "la_solve");
+    for (long i = 0; i < n * r; i++)
+        data[i] = (T)xd[i];
+    la_s* x = la_node(la_kind::buffer, la_type<T>, row ? 1 : n, row ? n : r, attributes);
+    x->data = data;
+    x->ld = (la_index_t)x->cols;
+    x->owned = true;
+    x->status = status;
+    return x;
+}
+
+} // namespace detail
+
+// The evaluation objects get, until la_select_evaluation() changes it.
+inline la_evaluation la_active_evaluation()
+{
+    return (la_evaluation)detail::la_mode().load(std::memory_order_relaxed);
+}
+
+// Evaluates objects as e from now on, in all threads.
+inline void la_select_evaluation(la_evaluation e) { detail::la_mode().store((int)e, std::memory_order_relaxed); }
+
+// What the evaluations on the calling thread have cost since it started,
+// or since it last called la_reset_evaluation_profile().
+inline la_profile la_evaluation_profile() { return detail::la_counters(); }
+
+inline void la_reset_evaluation_profile() { detail::la_counters() = la_profile(); }
+
+inline la_object_t la_retain(la_object_t object) { return detail::la_retained(object); }
+
+inline void la_release(la_object_t object) { detail::la_drop(object); }
+
+inline void la_add_attributes(la_object_t object, la_attribute_t attributes) { object->attributes |= attributes; }
+
+inline void la_remove_attributes(la_object_t object, la_attribute_t attributes) { object->attributes &= ~attributes; }
+
+inline la_status_t la_status(la_object_t object) { return object->status; }
+
+// Copies the matrix out of buffer.
+inline la_object_t la_matrix_from_float_buffer(const float *buffer, la_count_t matrix_rows, la_count_t matrix_cols,
+                                               la_count_t matrix_row_stride, la_hint_t matrix_hint,
+                                               la_attribute_t attributes)
+{
+    (void)matrix_hint;
+    return detail::la_copy(buffer, matrix_rows, matrix_cols, matrix_row_stride, attributes,
+                           "la_matrix_from_float_buffer");
+}
+
+inline la_object_t la_matrix_from_double_buffer(const double *buffer, la_count_t matrix_rows, la_count_t matrix_cols,
+                                                la_count_t matrix_row_stride, la_hint_t matrix_hint,
+                                                la_attribute_t attributes)
+{
+    (void)matrix_hint;
+    return detail::la_copy(buffer, matrix_rows, matrix_cols, matrix_row_stride, attributes,
+                           "la_matrix_from_double_buffer");
+}
+
+// Reads the matrix from buffer, which it passes to deallocator, if not
+// null, once the object is released.
+inline la_object_t la_matrix_from_float_buffer_nocopy(float *buffer, la_count_t matrix_rows, la_count_t matrix_cols,
+                                                      la_count_t matrix_row_stride, la_hint_t matrix_hint,
+                                                      la_deallocator_t deallocator, la_attribute_t attributes)
+{
+    (void)matrix_hint;
+    return detail::la_wrap(buffer, matrix_rows, matrix_cols, matrix_row_stride, deallocator, attributes,
+                           "la_matrix_from_float_buffer_nocopy");
+}
+
+inline la_object_t la_matrix_from_double_buffer_nocopy(double *buffer, la_count_t matrix_rows, la_count_t matrix_cols,
+                                                       la_count_t matrix_row_stride, la_hint_t matrix_hint,
+                                                       la_deallocator_t deallocator, la_attribute_t attributes)
+{
+    (void)matrix_hint;
+    return detail::la_wrap(buffer, matrix_rows, matrix_cols, matrix_row_stride, deallocator, attributes,
+                           "la_matrix_from_double_buffer_nocopy");
+}
+
+// Evaluates matrix into buffer, rows buffer_row_stride apart.
+inline la_status_t la_matrix_to_float_buffer(float *buffer, la_count_t buffer_row_stride, la_object_t matrix)
+{
+    if (detail::la_is_splat(matrix))
+        return LA_INVALID_PARAMETER_ERROR;
+    return detail::la_store(buffer, (la_index_t)buffer_row_stride, matrix, detail::la_plain_view, matrix->rows,
+                            matrix->cols);
+}
+
+inline la_status_t la_matrix_to_double_buffer(double *buffer, la_count_t buffer_row_stride, la_object_t matrix)
+{
+    if (detail::la_is_splat(matrix))
+        return LA_INVALID_PARAMETER_ERROR;
+    return detail::la_store(buffer, (la_index_t)buffer_row_stride, matrix, detail::la_plain_view, matrix->rows,
+                            matrix->cols);
+}
+
+inline la_count_t la_matrix_rows(la_object_t matrix) { return matrix->status < 0 ? 0 : matrix->rows; }
+
+inline la_count_t la_matrix_cols(la_object_t matrix) { return matrix->status < 0 ? 0 : matrix->cols; }
+
+inline la_object_t la_matrix_slice(la_object_t matrix, la_index_t matrix_first_row, la_index_t matrix_first_col,
+                                   la_index_t matrix_row_stride, la_index_t matrix_col_stride, la_count_t slice_rows,
+                                   la_count_t slice_cols)
+{
+    if (la_object_t e = detail::la_failed(matrix))
+        return e;
+    if (detail::la_is_splat(matrix) || !slice_rows || !slice_cols)
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, matrix->attributes, "la_matrix_slice");
+    const detail::la_view v = { matrix_first_row, matrix_first_col, matrix_row_stride, 0, 0, matrix_col_stride };
+    if (!detail::la_inside(matrix, v, slice_rows, slice_cols))
+        return detail::la_error(LA_SLICE_OUT_OF_BOUNDS_ERROR, matrix->attributes, "la_matrix_slice");
+    return detail::la_viewed(matrix, v, slice_rows, slice_cols);
+}
+
+inline la_object_t la_identity_matrix(la_count_t matrix_size, la_scalar_type_t scalar_type, la_attribute_t attributes)
+{
+    if (!matrix_size || (scalar_type != LA_SCALAR_TYPE_FLOAT && scalar_type != LA_SCALAR_TYPE_DOUBLE))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, attributes, "la_identity_matrix");
+    return detail::la_node(detail::la_kind::identity, scalar_type, matrix_size, matrix_size, attributes);
+}
+
+inline la_object_t la_diagonal_matrix_from_vector(la_object_t vector, la_index_t matrix_diagonal)
+{
+    if (la_object_t e = detail::la_failed(vector))
+        return e;
+    if (detail::la_is_splat(vector) || !detail::la_is_vector(vector))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, vector->attributes, "la_diagonal_matrix_from_vector");
+    const la_count_t n = detail::la_length(vector) + (la_count_t)labs(matrix_diagonal);
+    la_object_t x = detail::la_unary(detail::la_kind::diagonal, vector, n, n);
+    x->index[0] = matrix_diagonal;
+    return x;
+}
+
+inline la_object_t la_vector_from_matrix_row(la_object_t matrix, la_count_t matrix_row)
+{
+    if (la_object_t e = detail::la_failed(matrix))
+        return e;
+    if (detail::la_is_splat(matrix) || matrix_row >= matrix->rows)
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, matrix->attributes, "la_vector_from_matrix_row");
+    return detail::la_viewed(matrix, { (la_index_t)matrix_row, 0, 0, 0, 0, 1 }, 1, matrix->cols);
+}
+
+inline la_object_t la_vector_from_matrix_col(la_object_t matrix, la_count_t matrix_col)
+{
+    if (la_object_t e = detail::la_failed(matrix))
+        return e;
+    if (detail::la_is_splat(matrix) || matrix_col >= matrix->cols)
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, matrix->attributes, "la_vector_from_matrix_col");
+    return detail::la_viewed(matrix, { 0, (la_index_t)matrix_col, 1, 0, 0, 0 }, matrix->rows, 1);
+}
+
+inline la_object_t la_vector_from_matrix_diagonal(la_object_t matrix, la_index_t matrix_diagonal)
+{
+    if (la_object_t e = detail::la_failed(matrix))
+        return e;
+    const la_index_t rows = (la_index_t)matrix->rows, cols = (la_index_t)matrix->cols, d = matrix_diagonal;
+    if (detail::la_is_splat(matrix) || (d < 0 && -d > rows - 1) || (d > 0 && d > cols - 1))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, matrix->attributes, "la_vector_from_matrix_diagonal");
+    const la_index_t r0 = std::max<la_index_t>(0, -d), c0 = std::max<la_index_t>(0, d);
+    return detail::la_viewed(matrix, { r0, c0, 1, 0, 1, 0 }, (la_count_t)std::min(rows - r0, cols - c0), 1);
+}
+
+// Evaluates vector into buffer, element i at buffer[i*buffer_stride].
+inline la_status_t la_vector_to_float_buffer(float *buffer, la_index_t buffer_stride, la_object_t vector)
+{
+    if (vector->status >= 0 && (detail::la_is_splat(vector) || !detail::la_is_vector(vector)))
+        return LA_INVALID_PARAMETER_ERROR;
+    const detail::la_view v = vector->rows == 1 ? detail::la_view{ 0, 0, 0, 0, 1, 0 } : detail::la_plain_view;
+    return detail::la_store(buffer, buffer_stride, vector, v, detail::la_length(vector), 1);
+}
+
+inline la_status_t la_vector_to_double_buffer(double *buffer, la_index_t buffer_stride, la_object_t vector)
+{
+    if (vector->status >= 0 && (detail::la_is_splat(vector) || !detail::la_is_vector(vector)))
+        return LA_INVALID_PARAMETER_ERROR;
+    const detail::la_view v = vector->rows == 1 ? detail::la_view{ 0, 0, 0, 0, 1, 0 } : detail::la_plain_view;
+    return detail::la_store(buffer, buffer_stride, vector, v, detail::la_length(vector), 1);
+}
+
+inline la_count_t la_vector_length(la_object_t vector)
+{
+    if (vector->status < 0 || !detail::la_is_vector(vector))
+        return 0;
+    return detail::la_length(vector);
+}
+
+inline la_object_t la_vector_slice(la_object_t vector, la_index_t vector_first, la_index_t vector_stride,
+                                   la_count_t slice_length)
+{
+    if (la_object_t e = detail::la_failed(vector))
+        return e;
+    if (detail::la_is_splat(vector) || !detail::la_is_vector(vector) || !slice_length)
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, vector->attributes, "la_vector_slice");
+    const la_index_t last = vector_first + ((la_index_t)slice_length - 1) * vector_stride;
+    const la_index_t n = (la_index_t)detail::la_length(vector);
+    if (vector_first < 0 || vector_first >= n || last < 0 || last >= n)
+        return detail::la_error(LA_SLICE_OUT_OF_BOUNDS_ERROR, vector->attributes, "la_vector_slice");
+    if (vector->rows == 1)
+        return detail::la_viewed(vector, { 0, vector_first, 0, 0, 0, vector_stride }, 1, slice_length);
+    return detail::la_viewed(vector, { vector_first, 0, vector_stride, 0, 0, 0 }, slice_length, 1);
+}
+
+inline la_object_t la_splat_from_float(float scalar_value, la_attribute_t attributes)
+{
+    la_object_t x = detail::la_node(detail::la_kind::splat, LA_SCALAR_TYPE_FLOAT, 0, 0, attributes);
+    x->value = scalar_value;
+    return x;
+}
+
+inline la_object_t la_splat_from_double(double scalar_value, la_attribute_t attributes)
+{
+    la_object_t x = detail::la_node(detail::la_kind::splat, LA_SCALAR_TYPE_DOUBLE, 0, 0, attributes);
+    x->value = scalar_value;
+    return x;
+}
+
+inline la_object_t la_splat_from_matrix_element(la_object_t matrix, la_index_t matrix_row, la_index_t matrix_col)
+{
+    if (la_object_t e = detail::la_failed(matrix))
+        return e;
+    if (detail::la_is_splat(matrix))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, matrix->attributes, "la_splat_from_matrix_element");
+    if (matrix_row < 0 || matrix_row >= (la_index_t)matrix->rows || matrix_col < 0 ||
+        matrix_col >= (la_index_t)matrix->cols)
+        return detail::la_error(LA_SLICE_OUT_OF_BOUNDS_ERROR, matrix->attributes, "la_splat_from_matrix_element");
+    la_object_t x = detail::la_unary(detail::la_kind::element, matrix, 0, 0);
+    x->index[0] = matrix_row;
+    x->index[1] = matrix_col;
+    return x;
+}
+
+inline la_object_t la_splat_from_vector_element(la_object_t vector, la_index_t vector_index)
+{
+    if (la_object_t e = detail::la_failed(vector))
+        return e;
+    if (detail::la_is_splat(vector) || !detail::la_is_vector(vector))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, vector->attributes, "la_splat_from_vector_element");
+    if (vector->rows == 1)
+        return la_splat_from_matrix_element(vector, 0, vector_index);
+    return la_splat_from_matrix_element(vector, vector_index, 0);
+}
+
+inline la_object_t la_matrix_from_splat(la_object_t splat, la_count_t matrix_rows, la_count_t matrix_cols)
+{
+    if (la_object_t e = detail::la_failed(splat))
+        return e;
+    if (!detail::la_is_splat(splat) || !matrix_rows || !matrix_cols)
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, splat->attributes, "la_matrix_from_splat");
+    return detail::la_sized(splat, matrix_rows, matrix_cols);
+}
+
+inline la_object_t la_vector_from_splat(la_object_t splat, la_count_t vector_length)
+{
+    return la_matrix_from_splat(splat, vector_length, 1);
+}
+
+inline la_object_t la_transpose(la_object_t matrix)
+{
+    if (la_object_t e = detail::la_failed(matrix))
+        return e;
+    if (detail::la_is_splat(matrix))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, matrix->attributes, "la_transpose");
+    return detail::la_transposed(matrix);
+}
+
+inline la_object_t la_scale_with_float(la_object_t matrix, float scalar)
+{
+    if (la_object_t e = detail::la_failed(matrix))
+        return e;
+    if (detail::la_is_splat(matrix))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, matrix->attributes, "la_scale_with_float");
+    if (matrix->type != LA_SCALAR_TYPE_FLOAT)
+        return detail::la_error(LA_PRECISION_MISMATCH_ERROR, matrix->attributes, "la_scale_with_float");
+    la_object_t x = detail::la_unary(detail::la_kind::scale, matrix, matrix->rows, matrix->cols);
+    x->value = scalar;
+    return x;
+}
+
+inline la_object_t la_scale_with_double(la_object_t matrix, double scalar)
+{
+    if (la_object_t e = detail::la_failed(matrix))
+        return e;
+    if (detail::la_is_splat(matrix))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, matrix->attributes, "la_scale_with_double");
+    if (matrix->type != LA_SCALAR_TYPE_DOUBLE)
+        return detail::la_error(LA_PRECISION_MISMATCH_ERROR, matrix->attributes, "la_scale_with_double");
+    la_object_t x = detail::la_unary(detail::la_kind::scale, matrix, matrix->rows, matrix->cols);
+    x->value = scalar;
+    return x;
+}
+
+inline la_object_t la_sum(la_object_t obj_left, la_object_t obj_right)
+{
+    return detail::la_elementwise(detail::la_kind::sum, obj_left, obj_right, "la_sum");
+}
+
+inline la_object_t la_difference(la_object_t obj_left, la_object_t obj_right)
+{
+    return detail::la_elementwise(detail::la_kind::difference, obj_left, obj_right, "la_difference");
+}
+
+inline la_object_t la_elementwise_product(la_object_t obj_left, la_object_t obj_right)
+{
+    return detail::la_elementwise(detail::la_kind::product, obj_left, obj_right, "la_elementwise_product");
+}
+
+// A 1 x 1 matrix.
+inline la_object_t la_inner_product(la_object_t vector_left, la_object_t vector_right)
+{
+    if (la_object_t e = detail::la_failed(vector_left, vector_right))
+        return e;
+    const la_attribute_t attributes = vector_left->attributes | vector_right->attributes;
+    const bool sl = detail::la_is_splat(vector_left), sr = detail::la_is_splat(vector_right);
+    if ((sl && sr) || (!sl && !detail::la_is_vector(vector_left)) || (!sr && !detail::la_is_vector(vector_right)))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, attributes, "la_inner_product");
+    if (vector_left->type != vector_right->type)
+        return detail::la_error(LA_PRECISION_MISMATCH_ERROR, attributes, "la_inner_product");
+    if (!sl && !sr && detail::la_length(vector_left) != detail::la_length(vector_right))
+        return detail::la_error(LA_DIMENSION_MISMATCH_ERROR, attributes, "la_inner_product");
+    la_object_t l = sl ? detail::la_sized(vector_left, 1, detail::la_length(vector_right))
+                    : vector_left->rows == 1 ? detail::la_retained(vector_left) : detail::la_transposed(vector_left);
+    la_object_t r = sr ? detail::la_sized(vector_right, detail::la_length(vector_left), 1)
+                    : vector_right->cols == 1 ? detail::la_retained(vector_right) : detail::la_transposed(vector_right);
+    return detail::la_binary(detail::la_kind::matrix_product, l, r, 1, 1);
+}
+
+// A length(vector_left) x length(vector_right) matrix.
+inline la_object_t la_outer_product(la_object_t vector_left, la_object_t vector_right)
+{
+    if (la_object_t e = detail::la_failed(vector_left, vector_right))
+        return e;
+    const la_attribute_t attributes = vector_left->attributes | vector_right->attributes;
+    if (detail::la_is_splat(vector_left) || detail::la_is_splat(vector_right) ||
+        !detail::la_is_vector(vector_left) || !detail::la_is_vector(vector_right))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, attributes, "la_outer_product");
+    if (vector_left->type != vector_right->type)
+        return detail::la_error(LA_PRECISION_MISMATCH_ERROR, attributes, "la_outer_product");
+    la_object_t l = vector_left->cols == 1 ? detail::la_retained(vector_left) : detail::la_transposed(vector_left);
+    la_object_t r = vector_right->rows == 1 ? detail::la_retained(vector_right) : detail::la_transposed(vector_right);
+    return detail::la_binary(detail::la_kind::matrix_product, l, r, l->rows, r->cols);
+}
+
+inline la_object_t la_matrix_product(la_object_t matrix_left, la_object_t matrix_right)
+{
+    if (la_object_t e = detail::la_failed(matrix_left, matrix_right))
+        return e;
+    const la_attribute_t attributes = matrix_left->attributes | matrix_right->attributes;
+    const bool sl = detail::la_is_splat(matrix_left), sr = detail::la_is_splat(matrix_right);
+    if (sl && sr)
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, attributes, "la_matrix_product");
+    if (matrix_left->type != matrix_right->type)
+        return detail::la_error(LA_PRECISION_MISMATCH_ERROR, attributes, "la_matrix_product");
+    la_object_t l = sl ? detail::la_sized(matrix_left, 1, matrix_right->rows) : detail::la_retained(matrix_left);
+    la_object_t r = sr ? detail::la_sized(matrix_right, matrix_left->cols, 1) : detail::la_retained(matrix_right);
+    la_object_t t = nullptr;
+    if (l->cols == r->rows) {
+    } else if (l->cols == 1 && l->rows == r->rows) {
+        t = detail::la_transposed(l);
+        detail::la_drop(l);
+        l = t;
+    } else if (r->rows == 1 && l->cols == r->cols) {
+        t = detail::la_transposed(r);
+        detail::la_drop(r);
+        r = t;
+    } else {
+        detail::la_drop(l);
+        detail::la_drop(r);
+        return detail::la_error(LA_DIMENSION_MISMATCH_ERROR, attributes, "la_matrix_product");
+    }
+    return detail::la_binary(detail::la_kind::matrix_product, l, r, l->rows, r->cols);
+}
+
+// The norm of vector, or of a matrix taken as one long vector.
+inline double la_norm_as_double(la_object_t vector, la_norm_t vector_norm)
+{
+    if (vector->status < 0 || detail::la_is_splat(vector) || vector_norm < LA_L1_NORM || vector_norm > LA_LINF_NORM)
+        return NAN;
+    if (vector->type == LA_SCALAR_TYPE_DOUBLE)
+        return detail::la_norm<double>(vector, vector_norm);
+    return detail::la_norm<float>(vector, vector_norm);
+}
+
+inline float la_norm_as_float(la_object_t vector, la_norm_t vector_norm)
+{
+    return (float)la_norm_as_double(vector, vector_norm);
+}
+
+// vector scaled to norm 1; a zero vector stays zero.  The elements of
+// vector are evaluated here, once, for the norm.
+inline la_object_t la_normalized_vector(la_object_t vector, la_norm_t vector_norm)
+{
+    if (la_object_t e = detail::la_failed(vector))
+        return e;
+    if (detail::la_is_splat(vector) || vector_norm < LA_L1_NORM || vector_norm > LA_LINF_NORM)
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, vector->attributes, "la_normalized_vector");
+    if (vector->type == LA_SCALAR_TYPE_DOUBLE)
+        return detail::la_normalized<double>(vector, vector_norm);
+    return detail::la_normalized<float>(vector, vector_norm);
+}
+
+// The solution X of matrix_system * X = obj_rhs, as in linear_systems.h,
+// evaluated now.  A row vector obj_rhs is solved as a column, and its
+// solution is a row.
+inline la_object_t la_solve(la_object_t matrix_system, la_object_t obj_rhs)
+{
+    if (la_object_t e = detail::la_failed(matrix_system, obj_rhs))
+        return e;
+    const la_attribute_t attributes = matrix_system->attributes | obj_rhs->attributes;
+    if (detail::la_is_splat(matrix_system) || detail::la_is_splat(obj_rhs))
+        return detail::la_error(LA_INVALID_PARAMETER_ERROR, attributes, "la_solve");
+    if (matrix_system->type != obj_rhs->type)
+        return detail::la_error(LA_PRECISION_MISMATCH_ERROR, attributes, "la_solve");
+    const bool row = obj_rhs->rows == 1 && matrix_system->rows != 1 && obj_rhs->cols == matrix_system->rows;
+    if (!row && obj_rhs->rows != matrix_system->rows)
+        return detail::la_error(LA_DIMENSION_MISMATCH_ERROR, attributes, "la_solve");
+    la_object_t b = row ? detail::la_transposed(obj_rhs) : detail::la_retained(obj_rhs);
+    la_object_t x = matrix_system->type == LA_SCALAR_TYPE_DOUBLE
+                    ? detail::la_solved<double>(matrix_system, b, row, attributes)
+                    : detail::la_solved<float>(matrix_system, b, row, attributes);
+    detail::la_drop(b);
+    return x;
+}
+
+} // namespace vdsp
+
+#endif /* __cplusplus */
+
+#endif /* __LA_PORTABLE__ */
@@ -0,0 +1,4572 @@
+/*
+    File:       vecLib/Sparse/Solve_portable.h
+
+    Contains:   Portable supernodal sparse Cholesky with a tree-parallel factorization,
+                batched iterative solves, and SIMD sparse matrix formats
+
+    This header implements the Cholesky factorization of Sparse/Solve.h
+    in C++, for the hosts that vDSP_portable.h serves, in namespace vdsp
+    and with the types, names, parameter lists and status codes of
+    Solve.h:
+
+        SparseFactor        the symbolic factorization of a structure,
+                            the numeric factorization of a matrix against
+                            it, or both at once
+        SparseRefactor      a new matrix with the same structure,
+                            factored in the storage of the old one
+        SparseSolve         X = A^-1 * B, for vectors and matrices, in
+                            place or not
+        SparseRetain        SparseCleanup
+
+    for SparseMatrix_Double and SparseMatrix_Float of any block size,
+    symmetric and given by either triangle.
+
+    The symbolic factorization orders the graph of the blocks by nested
+    dissection, postorders the elimination tree, counts the columns of
+    L without forming it, and merges columns with the same structure
+    into supernodes, relaxed so that chains of small ones merge at the
+    cost of a few explicit zeros.  It then records all that numeric
+    factorization needs: where each value of A lands in L, which
+    earlier supernodes update each supernode and through which of
+    their rows, and how the tree splits into subtrees for the threads.
+    SparseRefactor goes straight to the numbers, in the factor storage
+    and workspace of the first factorization.
+
+    Each supernode is a dense block of L, stored by columns.  It gathers
+    its updates from the supernodes below it in a fixed order, each a
+    GEMM into a small buffer scattered into place, then factors its
+    diagonal block and solves for the rest with the recursive kernels
+    of clapack_portable.h.  Disjoint subtrees, cut from the tree so that
+    none has more than a quarter of a thread's share of the work, run
+    concurrently on the cblas_portable.h thread pool with their own
+    buffers; the supernodes above them run in order, each with
+    multithreaded products.  A supernode only reads the ones below it
+    and only writes itself, so nothing is locked, and every instruction
+    set and every thread count return the same bits.
+
+    SparseOrderDefault, SparseOrderAMD and SparseOrderMetis all give the
+    nested dissection, which also yields the wide trees the threads
+    need; SparseOrderUser takes the order of the blocks given, or none.
+    The cut into subtrees is made for cblas_get_num_threads() at the
+    time of the symbolic factorization.  Numeric options and the
+    malloc and free callbacks are accepted and not used, and LDL^T, QR,
+    ignored rows and columns, subfactors and transposed factorizations
+    are not provided.  Errors go to the reportError callback, or to
+    stderr, and return a status of SparseParameterError.
+
+    The iterative methods of Solve.h are here too:
+    SparseConjugateGradient, SparseGMRES (GMRES, FGMRES and DQGMRES) and
+    SparseLSMR, passed to SparseSolve with a matrix, a callback operator
+    or std::function, and SparsePreconditionerDiagonal,
+    SparsePreconditionerDiagScaling or a preconditioner of the caller's;
+    and SparseMultiply and SparseMultiplyAdd.  SparseIterate and
+    SparseGetStateSize step all three, and keep X current after every
+    step, so the closing call with iteration < 0 only returns B - A*X:
+    GMRES moves X along the direction vectors of DQGMRES, restarting
+    from the true residual every nvec steps, and FGMRES steps as GMRES
+    does, for the preconditioner does not change between steps.  Each
+    solves many columns of B at once: the columns are held interleaved,
+    entry i of column c at i*nrhs + c, so that one pass of the matrix
+    multiplies all of them and the preconditioner is applied to all of
+    them in one call.  Each column still sums in the order of its own
+    solve, so a batch returns the bits of the columns solved one by one;
+    a column that converges or breaks down is dropped from the blocks
+    and left as it is.  The extension SparseBlockConjugateGradient is
+    block CG proper, its search space shared by the columns, which takes
+    fewer iterations the more of them there are; columns that become
+    dependent are dropped from the block by a pivoted Cholesky of its
+    Gram matrix.  It is the only block Krylov method here, and
+    SparseIterate has no step for it: GMRES and LSMR run their columns
+    in lockstep, each in a Krylov space of its own.  SparseSolve takes
+    the columns in groups of equal width that keep their vectors within
+    about L2, past which a batch streams from memory what single columns
+    find in cache; block CG takes them all.
+
+    SparseConvertFromCoordinate builds a SparseMatrix_Double or _Float
+    from triplets, as Solve.h does.  The extension SparseConvertToFormat
+    copies a matrix into a SparseFormattedMatrix_Double or _Float, whose
+    rows are held in one of two formats that SparseMultiply and
+    SparseMultiplyAdd stream with vectors: SELL-C-sigma, rows sorted by
+    length within windows of sigma and stored by columns in chunks of C,
+    one row to a lane; and blocked CSR, rows of r x r dense blocks.
+    SparseFormatAutomatic picks the one that streams the fewest bytes,
+    judged from the row lengths and the fill of the blocks, and keeps
+    CSC for matrices whose rows are too short for a vector.  Symmetric
+    and triangular matrices are expanded to the rows they stand for.
+    Each row sums in the same order for every instruction set and
+    thread count.
+*/
+#ifndef __SPARSE_SOLVE_PORTABLE__
+#define __SPARSE_SOLVE_PORTABLE__
+
+#if defined(__cplusplus)
+
+#include <vecLib/clapack_portable.h>
+
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <queue>
+#include <utility>
+#include <vector>
+
+// As in Sparse/Solve.h, which only declares them for compilers with
+// overloadable C functions.
+#if !defined(SPARSE_PUBLIC_INTERFACE)
+typedef enum : unsigned int {
+  SparseOrdinary       = 0,
+  SparseTriangular     = 1,
+  SparseUnitTriangular = 2,
+  SparseSymmetric      = 3,
+} SparseKind_t;
+
+typedef enum : unsigned char {
+  SparseUpperTriangle = 0,
+  SparseLowerTriangle = 1
+} SparseTriangle_t;
+
+typedef struct {
+  bool            transpose: 1;
+  SparseTriangle_t triangle: 1;
+  SparseKind_t         kind: 2;
+  unsigned int    _reserved: 11;
+  bool   _allocatedBySparse: 1;
+} SparseAttributes_t;
+
+typedef struct {
+  int rowCount;
+  int columnCount;
+  long *columnStarts;
+  int *rowIndices;
+  SparseAttributes_t attributes;
+  uint8_t blockSize;
+} SparseMatrixStructure;
+
+typedef struct {
+  SparseMatrixStructure structure;
+  double *data;
+} SparseMatrix_Double;
+
+typedef struct {
+  SparseMatrixStructure structure;
+  float *data;
+} SparseMatrix_Float;
+
+typedef struct {
+  int count;
+  double *data;
+} DenseVector_Double;
+
+typedef struct {
+  int count;
+  float *data;
+} DenseVector_Float;
+
+typedef struct {
+  int rowCount;
+  int columnCount;
+  int columnStride;
+  SparseAttributes_t attributes;
+  double *data;
+} DenseMatrix_Double;
+
+typedef struct {
+  int rowCount;
+  int columnCount;
+  int columnStride;
+  SparseAttributes_t attributes;
+  float *data;
+} DenseMatrix_Float;
+
+typedef enum : int {
+  SparseStatusOK            =  0,
+  SparseFactorizationFailed = -1,
+  SparseMatrixIsSingular    = -2,
+  SparseInternalError       = -3,
+  SparseParameterError      = -4,
+  SparseStatusReleased      = -INT_MAX,
+} SparseStatus_t;
+
+typedef enum : uint8_t {
+  SparseFactorizationCholesky = 0,
+  SparseFactorizationLDLT = 1,
+  SparseFactorizationLDLTUnpivoted = 2,
+  SparseFactorizationLDLTSBK = 3,
+  SparseFactorizationLDLTTPP = 4,
+  SparseFactorizationQR = 40,
+  SparseFactorizationCholeskyAtA = 41
+} SparseFactorization_t;
+
+typedef enum : uint32_t {
+  SparseDefaultControl = 0
+} SparseControl_t;
+
+typedef enum : uint8_t {
+  SparseOrderDefault = 0,
+  SparseOrderUser = 1,
+  SparseOrderAMD = 2,
+  SparseOrderMetis = 3,
+  SparseOrderCOLAMD = 4,
+} SparseOrder_t;
+
+typedef enum : uint8_t {
+  SparseScalingDefault = 0,
+  SparseScalingUser = 1,
+  SparseScalingEquilibriationInf = 2,
+} SparseScaling_t;
+
+typedef struct {
+  SparseControl_t control;
+  SparseOrder_t orderMethod;
+  int * order;
+  int * ignoreRowsAndColumns;
+  void * (* malloc)(size_t size);
+  void (* free)(void * pointer);
+  void (* reportError)(const char *message);
+} SparseSymbolicFactorOptions;
+
+typedef struct {
+  SparseControl_t control;
+  SparseScaling_t scalingMethod;
+  void * scaling;
+  double pivotTolerance;
+  double zeroTolerance;
+} SparseNumericFactorOptions;
+
+typedef struct {
+  SparseStatus_t status;
+  int rowCount;
+  int columnCount;
+  SparseAttributes_t attributes;
+  uint8_t blockSize;
+  SparseFactorization_t type;
+  void * factorization;
+  size_t workspaceSize_Float;
+  size_t workspaceSize_Double;
+  size_t factorSize_Float;
+  size_t factorSize_Double;
+} SparseOpaqueSymbolicFactorization;
+
+typedef struct {
+  SparseStatus_t status;
+  SparseAttributes_t attributes;
+  SparseOpaqueSymbolicFactorization symbolicFactorization;
+  bool userFactorStorage;
+  void * numericFactorization;
+  size_t solveWorkspaceRequiredStatic;
+  size_t solveWorkspaceRequiredPerRHS;
+} SparseOpaqueFactorization_Double;
+
+typedef struct {
+  SparseStatus_t status;
+  SparseAttributes_t attributes;
+  SparseOpaqueSymbolicFactorization symbolicFactorization;
+  bool userFactorStorage;
+  void * numericFactorization;
+  size_t solveWorkspaceRequiredStatic;
+  size_t solveWorkspaceRequiredPerRHS;
+} SparseOpaqueFactorization_Float;
+
+typedef enum : int {
+  SparsePreconditionerNone = 0,
+  SparsePreconditionerUser = 1,
+  SparsePreconditionerDiagonal = 2,
+  SparsePreconditionerDiagScaling = 3
+} SparsePreconditioner_t;
+
+typedef struct {
+  SparsePreconditioner_t type;
+  void *mem;
+  void (*apply) (void*, enum CBLAS_TRANSPOSE trans, DenseMatrix_Double X, DenseMatrix_Double Y);
+} SparseOpaquePreconditioner_Double;
+
+typedef struct {
+  SparsePreconditioner_t type;
+  void *mem;
+  void (*apply) (void*, enum CBLAS_TRANSPOSE trans, DenseMatrix_Float X, DenseMatrix_Float);
+} SparseOpaquePreconditioner_Float;
+
+typedef enum : int {
+  SparseIterativeConverged = 0,
+  SparseIterativeMaxIterations = 1,
+  SparseIterativeParameterError = -1,
+  SparseIterativeIllConditioned = -2,
+  SparseIterativeInternalError = -99,
+} SparseIterativeStatus_t;
+
+struct _SparseIterativeMethodBaseOptions {
+  void (* reportError)(const char *message);
+};
+
+typedef struct {
+  void (* reportError)(const char *message);
+  int maxIterations;
+  double atol;
+  double rtol;
+  void (* reportStatus)(const char *message);
+} SparseCGOptions;
+
+typedef enum : uint8_t {
+  SparseVariantDQGMRES = 0,
+  SparseVariantGMRES = 1,
+  SparseVariantFGMRES = 2
+} SparseGMRESVariant_t;
+
+typedef struct {
+  void (* reportError)(const char *message);
+  SparseGMRESVariant_t variant;
+  int nvec;
+  int maxIterations;
+  double atol;
+  double rtol;
+  void (* reportStatus)(const char *message);
+} SparseGMRESOptions;
+
+typedef enum : int {
+  SparseLSMRCTDefault = 0,
+  SparseLSMRCTFongSaunders = 1,
+} SparseLSMRConvergenceTest_t;
+
+typedef struct {
+  void (* reportError)(const char *message);
+  double lambda;
+  int nvec;
+  SparseLSMRConvergenceTest_t convergenceTest;
+  double atol;
+  double rtol;
+  double btol;
+  double conditionLimit;
+  int maxIterations;
+  void (* reportStatus)(const char *message);
+} SparseLSMROptions;
+
+typedef struct {
+  int method;
+  union {
+    struct _SparseIterativeMethodBaseOptions base;
+    SparseCGOptions cg;
+    SparseGMRESOptions gmres;
+    SparseLSMROptions lsmr;
+    char padding[256];
+  } options;
+} SparseIterativeMethod;
+
+typedef enum : int {
+  _SparseMethodCG = 0,
+  _SparseMethodGMRES = 1,
+  _SparseMethodLSMR = 2,
+} _SparseIterativeMethod;
+#endif
+
+namespace vdsp {
+
+// An extension: the storage formats of SparseConvertToFormat, for
+// SparseMultiply and SparseMultiplyAdd.
+typedef enum : int {
+    SparseFormatAutomatic = 0,      // chosen from the lengths of the rows
+    SparseFormatCSC = 1,            // the columns of blocks of SparseMatrix
+    SparseFormatSELL = 2,           // SELL-C-sigma
+    SparseFormatBlockedCSR = 3,     // rows of dense square blocks
+} SparseFormat_t;
+
+// op(A), for the transpose A had, in one of those formats.  height and
+// width are C and sigma for SELL, and the sides of the blocks otherwise;
+// valueCount counts padding and explicit zeros too.
+typedef struct {
+    SparseFormat_t format;
+    int rowCount;
+    int columnCount;
+    int height;
+    int width;
+    long valueCount;
+    void *storage;
+} SparseFormattedMatrix_Double;
+
+typedef struct {
+    SparseFormat_t format;
+    int rowCount;
+    int columnCount;
+    int height;
+    int width;
+    long valueCount;
+    void *storage;
+} SparseFormattedMatrix_Float;
+
+namespace detail {
+
+inline void sparse_error(void (*report)(const char*), const char* format, ...)
+{
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof message, format, args);
+    va_end(args);
+    if (report)
+        report(message);
+    else
+        fputs(message, stderr);
+}
+
+inline bool sparse_stored(const SparseMatrixStructure& a, long i, long j)
+{
+    return a.attributes.triangle == SparseLowerTriangle ? i >= j : i <= j;
+}
+
+// The graph of the blocks of a symmetric structure: both triangles,
+// neither the diagonal nor duplicates.
+struct sparse_graph {
+    std::vector<long> start;
+    std::vector<int> adjacent;
+};
+
+inline sparse_graph sparse_block_graph(const SparseMatrixStructure& a)
+{
+    const long n = a.columnCount;
+    sparse_graph g;
+    g.start.assign(n + 1, 0);
+    for (long j = 0; j < n; j++)
+        for (long p = a.columnStarts[j]; p < a.columnStarts[j + 1]; p++) {
+            const long i = a.rowIndices[p];
+            if (i >= 0 && i < n && i != j && sparse_stored(a, i, j)) {
+                g.start[i + 1]++;
+                g.start[j + 1]++;
+            }
+        }
+    std::partial_sum(g.start.begin(), g.start.end(), g.start.begin());
+    g.adjacent.resize(g.start[n]);
+    std::vector<long> at(g.start.begin(), g.start.end() - 1);
+    for (long j = 0; j < n; j++)
+        for (long p = a.columnStarts[j]; p < a.columnStarts[j + 1]; p++) {
+            const long i = a.rowIndices[p];
+            if (i >= 0 && i < n && i != j && sparse_stored(a, i, j)) {
+                g.adjacent[at[i]++] = (int)j;
+                g.adjacent[at[j]++] = (int)i;
+            }
+        }
+    int* adjacent = g.adjacent.data();
+    long out = 0, begin = 0;
+    for (long v = 0; v < n; v++) {
+        const long end = g.start[v + 1];
+        std::sort(adjacent + begin, adjacent + end);
+        g.start[v] = out;
+        for (long q = begin; q < end; q++)
+            if (q == begin || adjacent[q] != adjacent[q - 1])
+                adjacent[out++] = adjacent[q];
+        begin = end;
+    }
+    g.start[n] = out;
+    g.adjacent.resize(out);
+    return g;
+}
+
+// Nested dissection of g by level structures; order[k] is the vertex
+// eliminated k-th.  Each piece of the graph is searched breadth first
+// from a pseudo-peripheral vertex.  A piece that is not connected
+// splits into its components; one of fewer than 64 vertices, or of
+// three levels or fewer, takes the reverse of its search order; any
+// other is cut at its narrowest level that leaves neither side more
+// than three times the other.  The sides come first and the cut last,
+// less those of its vertices with no neighbour beyond it.
+inline std::vector<int> sparse_dissect(const sparse_graph& g)
+{
+    const long n = (long)g.start.size() - 1;
+    std::vector<int> order(n), piece(n, 0), level(n, -1), queue(n);
+    std::vector<char> side(n);
+    std::vector<long> width;
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<std::pair<long, long>> pending{ { 0, n } };
+    auto degree = [&](int v) { return g.start[v + 1] - g.start[v]; };
+    // Appends the vertices of piece lo reached from root to the queue.
+    auto search = [&](long lo, int root, long tail, long& depth) {
+        long head = tail;
+        queue[tail++] = root;
+        level[root] = 0;
+        depth = 0;
+        while (head < tail) {
+            const int v = queue[head++];
+            for (long p = g.start[v]; p < g.start[v + 1]; p++) {
+                const int u = g.adjacent[p];
+                if (piece[u] == lo && level[u] < 0) {
+                    level[u] = depth = level[v] + 1;
+                    queue[tail++] = u;
+                }
+            }
+        }
+        return tail;
+    };
+    while (!pending.empty()) {
+        const long lo = pending.back().first, hi = pending.back().second, size = hi - lo;
+        pending.pop_back();
+        long depth = 0, reached = 0, deepest = -1;
+        for (int root = order[lo], sweep = 0;; sweep++) {
+            reached = search(lo, root, 0, depth);
+            if (reached < size || depth <= deepest || sweep == 4)
+                break;
+            deepest = depth;
+            for (long q = reached - 1; q >= 0 && level[queue[q]] == depth; q--)
+                if (q == reached - 1 || degree(queue[q]) < degree(root))
+                    root = queue[q];
+            for (long q = 0; q < reached; q++)
+                level[queue[q]] = -1;
+        }
+        if (reached < size) {
+            for (long k = lo, tail = reached; k < hi; k++)
+                if (level[order[k]] < 0) {
+                    const long from = tail;
+                    tail = search(lo, order[k], tail, depth);
+                    pending.push_back({ lo + from, lo + tail });
+                }
+            pending.push_back({ lo, lo + reached });
+            std::copy(queue.begin(), queue.begin() + size, order.begin() + lo);
+            for (size_t c = pending.size() - 1; c < pending.size(); c--) {
+                const long from = pending[c].first;
+                if (from < lo || from >= hi)
+                    break;
+                for (long k = from; k < pending[c].second; k++)
+                    piece[order[k]] = (int)from;
+            }
+        } else if (size < 64 || depth < 3) {
+            for (long q = 0; q < size; q++) {
+                order[lo + q] = queue[size - 1 - q];
+                piece[queue[q]] = -1;
+            }
+        } else {
+            width.assign(depth + 1, 0);
+            for (long q = 0; q < size; q++)
+                width[level[queue[q]]]++;
+            long cut = 0, median = 0;
+            for (long l = 1, before = width[0]; l < depth; before += width[l], l++) {
+                const long after = size - before - width[l];
+                if (std::max(before, after) <= 3 * std::min(before, after) && (cut == 0 || width[l] < width[cut]))
+                    cut = l;
+                if (median == 0 && 2 * (before + width[l]) >= size)
+                    median = l;
+            }
+            if (cut == 0)
+                cut = median ? median : depth / 2;
+            long count[3] = { 0, 0, 0 };
+            for (long q = 0; q < size; q++) {
+                const int v = queue[q];
+                side[v] = level[v] < cut ? 0 : level[v] > cut ? 1 : 0;
+                if (level[v] == cut)
+                    for (long p = g.start[v]; p < g.start[v + 1]; p++)
+                        if (piece[g.adjacent[p]] == lo && level[g.adjacent[p]] == cut + 1) {
+                            side[v] = 2;
+                            break;
+                        }
+                count[(int)side[v]]++;
+            }
+            long at[3] = { lo, lo + count[0], lo + count[0] + count[1] };
+            for (long q = 0; q < size; q++) {
+                const int v = queue[q];
+                order[at[(int)side[v]]++] = v;
+                piece[v] = side[v] == 0 ? (int)lo : side[v] == 1 ? (int)(lo + count[0]) : -1;
+            }
+            if (count[0])
+                pending.push_back({ lo, lo + count[0] });
+            if (count[1])
+                pending.push_back({ lo + count[0], lo + count[0] + count[1] });
+        }
+        for (long q = 0; q < size; q++)
+            level[queue[q]] = -1;
+    }
+    return order;
+}
+
+// Supernode `from` updates a later one through its rows first to last,
+// which are columns of the later one, and all the rows after them.
+struct sparse_update {
+    long from, first, last;
+};
+
+// Everything about a factorization that follows from the structure of
+// A.  Columns are numbered in elimination order.
+struct sparse_symbolic {
+    std::atomic<long> references{ 1 };
+    SparseSymbolicFactorOptions options;
+    long n = 0, entries = 0, values = 0, below = 0, buffer = 0, slots = 1;
+    std::vector<int> permutation;       // column of A eliminated k-th
+    std::vector<long> first;            // supernode s has columns first[s] to first[s + 1] - 1
+    std::vector<long> rowStart;         // and rows rows[rowStart[s]] to rows[rowStart[s + 1] - 1],
+    std::vector<int> rows;              // its own columns first
+    std::vector<long> valueStart;       // stored by columns from values[valueStart[s]]
+    std::vector<long> updateStart;      // updates[updateStart[s]] on, by increasing from
+    std::vector<sparse_update> updates;
+    std::vector<long> assemblyStart;    // values of A added into supernode s:
+    std::vector<long> source, target;   // data[source[q]] to its values at target[q]
+    std::vector<std::pair<long, long>> tasks;  // subtrees, first and last supernode, heaviest first
+    std::vector<long> top;              // the supernodes above them, in order
+};
+
+inline void sparse_release(sparse_symbolic* f)
+{
+    if (f && f->references.fetch_sub(1) == 1)
+        delete f;
+}
+
+template <class T>
+inline long sparse_slot_bytes(const sparse_symbolic& f)
+{
+    return ((f.n * (long)sizeof(int) + 15) & ~15L) + ((f.buffer * (long)sizeof(T) + 15) & ~15L);
+}
+
+// One value of A in the lower triangle of the permuted matrix.
+struct sparse_entry {
+    int row, column;
+    long source;
+};
+
+// Sorts entries into buckets by key, returning where each bucket starts.
+template <class K>
+inline std::vector<long> sparse_buckets(std::vector<sparse_entry>& e, long n, const K& key)
+{
+    std::vector<long> start(n + 1, 0);
+    for (const sparse_entry& x : e)
+        start[key(x) + 1]++;
+    std::partial_sum(start.begin(), start.end(), start.begin());
+    std::vector<sparse_entry> sorted(e.size());
+    std::vector<long> at(start.begin(), start.end() - 1);
+    for (const sparse_entry& x : e)
+        sorted[at[key(x)]++] = x;
+    e.swap(sorted);
+    return start;
+}
+
+// The symbolic factorization of a, eliminating its blocks in order.
+inline sparse_symbolic* sparse_analyse(const SparseMatrixStructure& a, const std::vector<int>& order, int threads)
+{
+    const long nb = a.columnCount, bs = a.blockSize, n = nb * bs, bb = bs * bs;
+    const bool lower = a.attributes.triangle == SparseLowerTriangle;
+    sparse_symbolic* f = new sparse_symbolic;
+    f->n = n;
+    f->entries = a.columnStarts[nb] * bb;
+    std::vector<int> position(n);
+    for (long k = 0; k < nb; k++)
+        for (long r = 0; r < bs; r++)
+            position[order[k] * bs + r] = (int)(k * bs + r);
+    std::vector<sparse_entry> e;
+    e.reserve(f->entries);
+    for (long j = 0; j < nb; j++)
+        for (long p = a.columnStarts[j]; p < a.columnStarts[j + 1]; p++) {
+            const long i = a.rowIndices[p];
+            if (i < 0 || i >= nb || !sparse_stored(a, i, j))
+                continue;
+            for (long c = 0; c < bs; c++)
+                for (long r = 0; r < bs; r++) {
+                    if (i == j && (lower ? r < c : r > c))
+                        continue;
+                    const int x = position[i * bs + r], y = position[j * bs + c];
+                    e.push_back({ std::max(x, y), std::min(x, y), p * bb + r + c * bs });
+                }
+        }
+
+    // The elimination tree, by rows, and its postorder.
+    std::vector<long> parent(n, -1), ancestor(n, -1);
+    {
+        const std::vector<long> start = sparse_buckets(e, n, [](const sparse_entry& x) { return x.row; });
+        for (long i = 0; i < n; i++)
+            for (long q = start[i]; q < start[i + 1]; q++)
+                for (long r = e[q].column; r != -1 && r != i;) {
+                    const long next = ancestor[r];
+                    ancestor[r] = i;
+                    if (next == -1)
+                        parent[r] = i;
+                    r = next;
+                }
+    }
+    std::vector<long> child(n + 1, 0), children(n), post;
+    post.reserve(n);
+    for (long j = 0; j < n; j++)
+        if (parent[j] != -1)
+            child[parent[j] + 1]++;
+    std::partial_sum(child.begin(), child.end(), child.begin());
+    {
+        std::vector<long> at(child.begin(), child.end() - 1);
+        for (long j = 0; j < n; j++)
+            if (parent[j] != -1)
+                children[at[parent[j]]++] = j;
+        std::vector<std::pair<long, long>> stack;
+        for (long root = 0; root < n; root++) {
+            if (parent[root] != -1)
+                continue;
+            stack.push_back({ root, child[root] });
+            while (!stack.empty()) {
+                std::pair<long, long>& top = stack.back();
+                if (top.second < child[top.first + 1]) {
+                    const long c = children[top.second++];
+                    stack.push_back({ c, child[c] });
+                } else {
+                    post.push_back(top.first);
+                    stack.pop_back();
+                }
+            }
+        }
+    }
+    std::vector<int> relabel(n);
+    for (long k = 0; k < n; k++)
+        relabel[post[k]] = (int)k;
+    f->permutation.resize(n);
+    for (long j = 0; j < n; j++)
+        f->permutation[relabel[position[j]]] = (int)j;
+    {
+        std::vector<long> p(n, -1);
+        for (long j = 0; j < n; j++)
+            if (parent[j] != -1)
+                p[relabel[j]] = relabel[parent[j]];
+        parent.swap(p);
+    }
+    for (sparse_entry& x : e) {
+        x.row = relabel[x.row];
+        x.column = relabel[x.column];
+    }
+    const std::vector<long> columnStart = sparse_buckets(e, n, [](const sparse_entry& x) { return x.column; });
+
+    // Column counts of L from the row subtrees, without forming L.
+    std::vector<long> count(n), leafFirst(n, -1), maxFirst(n, -1), previous(n, -1), kids(n, 0);
+    for (long k = 0; k < n; k++) {
+        count[k] = leafFirst[k] == -1;
+        for (long j = k; j != -1 && leafFirst[j] == -1; j = parent[j])
+            leafFirst[j] = k;
+    }
+    std::iota(ancestor.begin(), ancestor.end(), 0);
+    for (long j = 0; j < n; j++) {
+        if (parent[j] != -1) {
+            count[parent[j]]--;
+            kids[parent[j]]++;
+        }
+        for (long q = columnStart[j]; q < columnStart[j + 1]; q++) {
+            const long i = e[q].row;
+            if (i <= j || leafFirst[j] <= maxFirst[i])
+                continue;
+            maxFirst[i] = leafFirst[j];
+            const long last = previous[i];
+            previous[i] = j;
+            count[j]++;
+            if (last == -1)
+                continue;
+            long root = last;
+            while (root != ancestor[root])
+                root = ancestor[root];
+            for (long s = last; s != root;) {
+                const long next = ancestor[s];
+                ancestor[s] = root;
+                s = next;
+            }
+            count[root]--;
+        }
+        if (parent[j] != -1)
+            ancestor[j] = parent[j];
+    }
+    for (long j = 0; j < n; j++)
+        if (parent[j] != -1)
+            count[parent[j]] += count[j];
+
+    // Fundamental supernodes, then chains of last children merged into
+    // their parents while the explicit zeros stay few.
+    std::vector<long> fundamental;
+    for (long j = 0; j < n; j++)
+        if (j == 0 || parent[j - 1] != j || kids[j] != 1 || count[j - 1] != count[j] + 1)
+            fundamental.push_back(j);
+    const long nf = (long)fundamental.size();
+    fundamental.push_back(n);
+    std::vector<long> group(nf), groupFirst(nf), height(nf), actual(nf), snode(n);
+    for (long s = 0; s < nf; s++)
+        for (long j = fundamental[s]; j < fundamental[s + 1]; j++)
+            snode[j] = s;
+    for (long s = nf - 1; s >= 0; s--) {
+        const long f0 = fundamental[s], l0 = fundamental[s + 1] - 1;
+        long real = 0;
+        for (long j = f0; j <= l0; j++)
+            real += count[j];
+        group[s] = s;
+        groupFirst[s] = f0;
+        height[s] = count[f0];
+        actual[s] = real;
+        if (parent[l0] == -1)
+            continue;
+        const long g = group[snode[parent[l0]]];
+        if (parent[l0] != groupFirst[g] || l0 + 1 != groupFirst[g])
+            continue;
+        const long gl = fundamental[g + 1] - 1;
+        const double nc = (double)(gl - f0 + 1), h = (double)(l0 - f0 + 1 + height[g]);
+        const double stored = nc * h - nc * (nc - 1) / 2, zeros = (stored - (double)(real + actual[g])) / stored;
+        if (nc <= 4 || (nc <= 16 && zeros < 0.8) || (nc <= 48 && zeros < 0.1) || zeros < 0.05) {
+            group[s] = g;
+            groupFirst[g] = f0;
+            height[g] = (long)h;
+            actual[g] += real;
+        }
+    }
+    f->first.clear();
+    for (long s = 0; s < nf; s++)
+        if (group[s] == s)
+            f->first.push_back(groupFirst[s]);
+    std::sort(f->first.begin(), f->first.end());
+    const long ns = (long)f->first.size();
+    f->first.push_back(n);
+    for (long s = 0; s < ns; s++)
+        for (long j = f->first[s]; j < f->first[s + 1]; j++)
+            snode[j] = s;
+    std::vector<long> sparent(ns, -1);
+    for (long s = 0; s < ns; s++)
+        if (parent[f->first[s + 1] - 1] != -1)
+            sparent[s] = snode[parent[f->first[s + 1] - 1]];
+
+    // Rows of each supernode: its columns, then the union of those of A
+    // and of its children below them.
+    std::vector<long> sc(ns + 1, 0), schildren(ns);
+    for (long s = 0; s < ns; s++)
+        if (sparent[s] != -1)
+            sc[sparent[s] + 1]++;
+    std::partial_sum(sc.begin(), sc.end(), sc.begin());
+    {
+        std::vector<long> at(sc.begin(), sc.end() - 1);
+        for (long s = 0; s < ns; s++)
+            if (sparent[s] != -1)
+                schildren[at[sparent[s]]++] = s;
+    }
+    std::vector<long> mark(n, -1);
+    f->rowStart.assign(1, 0);
+    f->valueStart.assign(1, 0);
+    for (long s = 0; s < ns; s++) {
+        const long c0 = f->first[s], c1 = f->first[s + 1];
+        for (long j = c0; j < c1; j++) {
+            f->rows.push_back((int)j);
+            mark[j] = s;
+        }
+        const size_t from = f->rows.size();
+        for (long j = c0; j < c1; j++)
+            for (long q = columnStart[j]; q < columnStart[j + 1]; q++)
+                if (mark[e[q].row] != s) {
+                    mark[e[q].row] = s;
+                    f->rows.push_back(e[q].row);
+                }
+        for (long q = sc[s]; q < sc[s + 1]; q++) {
+            const long c = schildren[q];
+            for (long p = f->rowStart[c] + (f->first[c + 1] - f->first[c]); p < f->rowStart[c + 1]; p++) {
+                const int i = f->rows[p];
+                if (i >= c1 && mark[i] != s) {
+                    mark[i] = s;
+                    f->rows.push_back(i);
+                }
+            }
+        }
+        std::sort(f->rows.begin() + from, f->rows.end());
+        const long h = (long)f->rows.size() - f->rowStart[s];
+        f->rowStart.push_back((long)f->rows.size());
+        f->valueStart.push_back(f->valueStart[s] + h * (c1 - c0));
+        f->below = std::max(f->below, h - (c1 - c0));
+    }
+    f->values = f->valueStart[ns];
+
+    // Updates, grouped by the supernode they go to.
+    f->updateStart.assign(ns + 1, 0);
+    for (int pass = 0; pass < 2; pass++) {
+        std::vector<long> at(f->updateStart.begin(), f->updateStart.end() - 1);
+        for (long d = 0; d < ns; d++) {
+            const long h = f->rowStart[d + 1] - f->rowStart[d];
+            const int* rows = f->rows.data() + f->rowStart[d];
+            for (long p = f->first[d + 1] - f->first[d]; p < h;) {
+                const long t = snode[rows[p]];
+                long q = p;
+                while (q < h && rows[q] < f->first[t + 1])
+                    q++;
+                if (pass == 0) {
+                    f->updateStart[t + 1]++;
+                } else {
+                    f->updates[at[t]++] = { d, p, q };
+                    f->buffer = std::max(f->buffer, (h - p) * (q - p));
+                }
+                p = q;
+            }
+        }
+        if (pass == 0) {
+            std::partial_sum(f->updateStart.begin(), f->updateStart.end(), f->updateStart.begin());
+            f->updates.resize(f->updateStart[ns]);
+        }
+    }
+
+    // Where each value of A goes.
+    f->assemblyStart.assign(ns + 1, 0);
+    for (const sparse_entry& x : e)
+        f->assemblyStart[snode[x.column] + 1]++;
+    std::partial_sum(f->assemblyStart.begin(), f->assemblyStart.end(), f->assemblyStart.begin());
+    f->source.resize(e.size());
+    f->target.resize(e.size());
+    {
+        std::vector<long> at(f->assemblyStart.begin(), f->assemblyStart.end() - 1);
+        for (const sparse_entry& x : e) {
+            const long s = snode[x.column], c0 = f->first[s], nc = f->first[s + 1] - c0;
+            const int* rows = f->rows.data() + f->rowStart[s];
+            const long h = f->rowStart[s + 1] - f->rowStart[s];
+            const long i = x.row < c0 + nc ? x.row - c0 : std::lower_bound(rows + nc, rows + h, x.row) - rows;
+            f->source[at[s]] = x.source;
+            f->target[at[s]++] = i + (x.column - c0) * h;
+        }
+    }
+
+    // Subtrees for the threads: the heaviest is split until none has
+    // more than a quarter of a thread's share of the work.
+    std::vector<double> work(ns);
+    std::vector<long> lowest(ns);
+    double total = 0;
+    for (long s = 0; s < ns; s++) {
+        const double nc = (double)(f->first[s + 1] - f->first[s]), h = (double)(f->rowStart[s + 1] - f->rowStart[s]);
+        work[s] += nc * h * h - nc * nc * h + nc * nc * nc / 3 + h;
+        lowest[s] = sc[s] < sc[s + 1] ? lowest[schildren[sc[s]]] : s;
+        if (sparent[s] != -1)
+            work[sparent[s]] += work[s];
+        else
+            total += work[s];
+    }
+    f->slots = std::max(1, threads);
+    const double limit = total / (4.0 * f->slots);
+    std::priority_queue<std::pair<double, long>> heap;
+    for (long s = 0; s < ns; s++)
+        if (sparent[s] == -1)
+            heap.push({ work[s], s });
+    while (f->slots > 1 && !heap.empty() && heap.top().first > limit) {
+        const long s = heap.top().second;
+        heap.pop();
+        f->top.push_back(s);
+        for (long q = sc[s]; q < sc[s + 1]; q++)
+            heap.push({ work[schildren[q]], schildren[q] });
+    }
+    for (; !heap.empty(); heap.pop())
+        f->tasks.push_back({ lowest[heap.top().second], heap.top().second });
+    std::sort(f->top.begin(), f->top.end());
+    return f;
+}
+
+// Assembles, updates and factors supernode s.  Returns 0, or the
+// 1-based column at which L is not positive definite.
+template <class T>
+__VDSP_NOCONTRACT long sparse_supernode(const sparse_symbolic& f, T* l, const T* a, long s, int* map, T* buffer)
+{
+    const long c0 = f.first[s], nc = f.first[s + 1] - c0, h = f.rowStart[s + 1] - f.rowStart[s];
+    const int* rows = f.rows.data() + f.rowStart[s];
+    T* v = l + f.valueStart[s];
+    std::fill(v, v + h * nc, T(0));
+    for (long q = f.assemblyStart[s]; q < f.assemblyStart[s + 1]; q++)
+        v[f.target[q]] += a[f.source[q]];
+    for (long i = 0; i < h; i++)
+        map[rows[i]] = (int)i;
+    for (long u = f.updateStart[s]; u < f.updateStart[s + 1]; u++) {
+        const sparse_update& up = f.updates[u];
+        const long hd = f.rowStart[up.from + 1] - f.rowStart[up.from], nd = f.first[up.from + 1] - f.first[up.from];
+        const long m = hd - up.first, k = up.last - up.first;
+        const int* from = f.rows.data() + f.rowStart[up.from] + up.first;
+        const lapack_matrix<T> d{ l + f.valueStart[up.from] + up.first, 1, hd };
+        if (m * k * nd <= 2048) {
+            for (long j = 0; j < k; j++) {
+                T* column = v + (from[j] - c0) * h;
+                for (long i = j; i < m; i++) {
+                    T x = 0;
+                    for (long t = 0; t < nd; t++)
+                        x += d(i, t) * d(j, t);
+                    column[map[from[i]]] -= x;
+                }
+            }
+            continue;
+        }
+        std::fill(buffer, buffer + m * k, T(0));
+        lapack_update(lapack_matrix<T>{ buffer, k, 1 }, d, d.t(), m, k, nd);
+        for (long i = 0; i < m; i++) {
+            T* row = v + map[from[i]];
+            for (long j = 0, last = std::min(i + 1, k); j < last; j++)
+                row[(from[j] - c0) * h] += buffer[i * k + j];
+        }
+    }
+    const lapack_matrix<T> ls{ v, 1, h };
+    if (const long info = lapack_potrf(ls, nc))
+        return c0 + info;
+    lapack_trsm(ls, ls.at(nc, 0).t(), nc, h - nc, true, false);
+    return 0;
+}
+
+// Factors A into l: the subtrees on the pool, each task with a slot of
+// the workspace, then the supernodes above them in order.
+template <class T>
+inline SparseStatus_t sparse_factor(const sparse_symbolic& f, T* l, const T* a, unsigned char* workspace)
+{
+    const long bytes = sparse_slot_bytes<T>(f), mapBytes = (f.n * (long)sizeof(int) + 15) & ~15L;
+    const int threads = (int)std::min<long>(blas_threads().load(std::memory_order_relaxed), f.slots);
+    std::atomic<bool> failed{ false };
+    std::mutex hold;
+    std::vector<long> free(f.slots);
+    std::iota(free.begin(), free.end(), 0L);
+    blas_pool::shared().run((long)f.tasks.size(), threads, [&](long t) {
+        long slot;
+        {
+            std::lock_guard<std::mutex> take(hold);
+            slot = free.back();
+            free.pop_back();
+        }
+        unsigned char* w = workspace + slot * bytes;
+        for (long s = f.tasks[t].first; s <= f.tasks[t].second && !failed.load(std::memory_order_relaxed); s++)
+            if (sparse_supernode(f, l, a, s, (int*)w, (T*)(w + mapBytes)))
+                failed.store(true);
+        std::lock_guard<std::mutex> give(hold);
+        free.push_back(slot);
+    });
+    for (size_t q = 0; q < f.top.size() && !failed.load(); q++)
+        if (sparse_supernode(f, l, a, f.top[q], (int*)workspace, (T*)(workspace + mapBytes)))
+            failed.store(true);
+    return failed.load() ? SparseFactorizationFailed : SparseStatusOK;
+}
+
+// X = A^-1 * B for the n x r B and X, through y, n x r by rows, and g,
+// below x r: L*Y = P*B down the supernodes, then L'*P*X = Y back up.
+template <class T>
+inline void sparse_solve(const sparse_symbolic& f, const T* l, const lapack_matrix<T>& b, const lapack_matrix<T>& x,
+                         long r, T* y, T* g)
+{
+    const long n = f.n, ns = (long)f.first.size() - 1;
+    for (long k = 0; k < n; k++)
+        for (long j = 0; j < r; j++)
+            y[k * r + j] = b(f.permutation[k], j);
+    for (long s = 0; s < ns; s++) {
+        const long c0 = f.first[s], nc = f.first[s + 1] - c0, h = f.rowStart[s + 1] - f.rowStart[s];
+        const int* rows = f.rows.data() + f.rowStart[s] + nc;
+        const lapack_matrix<T> ls{ const_cast<T*>(l) + f.valueStart[s], 1, h }, ys{ y + c0 * r, r, 1 };
+        lapack_trsm(ls, ys, nc, r, true, false);
+        if (h == nc)
+            continue;
+        std::fill(g, g + (h - nc) * r, T(0));
+        lapack_update(lapack_matrix<T>{ g, r, 1 }, ls.at(nc, 0), ys, h - nc, r, nc);
+        for (long i = 0; i < h - nc; i++)
+            for (long j = 0; j < r; j++)
+                y[rows[i] * r + j] += g[i * r + j];
+    }
+    for (long s = ns - 1; s >= 0; s--) {
+        const long c0 = f.first[s], nc = f.first[s + 1] - c0, h = f.rowStart[s + 1] - f.rowStart[s];
+        const int* rows = f.rows.data() + f.rowStart[s] + nc;
+        const lapack_matrix<T> ls{ const_cast<T*>(l) + f.valueStart[s], 1, h }, ys{ y + c0 * r, r, 1 };
+        if (h > nc) {
+            for (long i = 0; i < h - nc; i++)
+                std::copy(y + rows[i] * r, y + rows[i] * r + r, g + i * r);
+            lapack_update(ys, ls.at(nc, 0).t(), lapack_matrix<T>{ g, r, 1 }, nc, r, h - nc);
+        }
+        lapack_trsm(ls.t(), ys, nc, r, false, false);
+    }
+    for (long k = 0; k < n; k++)
+        for (long j = 0; j < r; j++)
+            x(f.permutation[k], j) = y[k * r + j];
+}
+
+template <class T>
+struct sparse_numeric {
+    std::vector<T> owned;                       // unless the caller gave storage
+    T* values = nullptr;
+    std::vector<unsigned char> workspace;       // kept for SparseRefactor
+};
+
+template <class T>
+struct sparse_types;
+
+template <>
+struct sparse_types<double> {
+    typedef SparseMatrix_Double matrix;
+    typedef DenseMatrix_Double dense;
+    typedef DenseVector_Double vector;
+    typedef SparseOpaqueFactorization_Double factorization;
+    typedef SparseOpaquePreconditioner_Double preconditioner;
+    typedef SparseFormattedMatrix_Double formatted;
+};
+
+template <>
+struct sparse_types<float> {
+    typedef SparseMatrix_Float matrix;
+    typedef DenseMatrix_Float dense;
+    typedef DenseVector_Float vector;
+    typedef SparseOpaqueFactorization_Float factorization;
+    typedef SparseOpaquePreconditioner_Float preconditioner;
+    typedef SparseFormattedMatrix_Float formatted;
+};
+
+inline SparseSymbolicFactorOptions sparse_default_options()
+{
+    SparseSymbolicFactorOptions o = {};
+    o.control = SparseDefaultControl;
+    o.orderMethod = SparseOrderDefault;
+    o.malloc = malloc;
+    o.free = free;
+    return o;
+}
+
+inline SparseOpaqueSymbolicFactorization sparse_symbolic_entry(SparseFactorization_t type,
+                                                               const SparseMatrixStructure& a,
+                                                               const SparseSymbolicFactorOptions& options)
+{
+    SparseOpaqueSymbolicFactorization result = {};
+    result.status = SparseParameterError;
+    auto bad = [&](const char* message) {
+        sparse_error(options.reportError, "%s", message);
+        return result;
+    };
+    if (a.rowCount <= 0 || a.columnCount <= 0 || a.blockSize == 0)
+        return bad("Matrix.rowCount, Matrix.columnCount and Matrix.blockSize must be > 0.\n");
+    if (type != SparseFactorizationCholesky)
+        return bad("Only SparseFactorizationCholesky is provided.\n");
+    if (a.attributes.kind != SparseSymmetric)
+        return bad("Requested symmetric factorization of unsymmetric matrix.\n");
+    if (a.rowCount != a.columnCount)
+        return bad("Matrix purports to be symmetric, but rowCount != columnCount.\n");
+    if ((long)a.columnCount * a.blockSize > INT_MAX)
+        return bad("Matrix has more than INT_MAX rows.\n");
+    if (options.orderMethod > SparseOrderCOLAMD)
+        return bad("options.orderMethod is not a SparseOrder_t.\n");
+    if (options.orderMethod == SparseOrderCOLAMD)
+        return bad("SparseOrderCOLAMD is not valid for symmetric factorizations.\n");
+    if (options.ignoreRowsAndColumns)
+        return bad("options.ignoreRowsAndColumns is not supported.\n");
+    const long nb = a.columnCount;
+    std::vector<int> order(nb);
+    if (options.orderMethod != SparseOrderUser) {
+        order = sparse_dissect(sparse_block_graph(a));
+        if (options.order)
+            std::copy(order.begin(), order.end(), options.order);
+    } else if (options.order) {
+        std::vector<char> seen(nb, 0);
+        for (long k = 0; k < nb; k++) {
+            const int v = options.order[k];
+            if (v < 0 || v >= nb || seen[v])
+                return bad("options.order is not a permutation of the block columns.\n");
+            seen[v] = 1;
+            order[k] = v;
+        }
+    } else {
+        std::iota(order.begin(), order.end(), 0);
+    }
+    sparse_symbolic* f = sparse_analyse(a, order, blas_threads().load(std::memory_order_relaxed));
+    f->options = options;
+    result.status = SparseStatusOK;
+    result.rowCount = a.rowCount;
+    result.columnCount = a.columnCount;
+    result.attributes = a.attributes;
+    result.blockSize = a.blockSize;
+    result.type = type;
+    result.factorization = f;
+    result.workspaceSize_Float = (size_t)(f->slots * sparse_slot_bytes<float>(*f));
+    result.workspaceSize_Double = (size_t)(f->slots * sparse_slot_bytes<double>(*f));
+    result.factorSize_Float = (size_t)f->values * sizeof(float);
+    result.factorSize_Double = (size_t)f->values * sizeof(double);
+    return result;
+}
+
+template <class T>
+inline bool sparse_matches(const SparseOpaqueSymbolicFactorization& sf,
+                           const typename sparse_types<T>::matrix& a)
+{
+    const sparse_symbolic& f = *(const sparse_symbolic*)sf.factorization;
+    return a.structure.rowCount == sf.rowCount && a.structure.columnCount == sf.columnCount &&
+           a.structure.blockSize == sf.blockSize &&
+           a.structure.columnStarts[a.structure.columnCount] * a.structure.blockSize * a.structure.blockSize == f.entries;
+}
+
+template <class T>
+inline typename sparse_types<T>::factorization sparse_factor_entry(const SparseOpaqueSymbolicFactorization& sf,
+                                                                   const typename sparse_types<T>::matrix& a,
+                                                                   void* storage, void* workspace)
+{
+    typename sparse_types<T>::factorization result = {};
+    result.status = SparseParameterError;
+    result.symbolicFactorization = sf;
+    result.symbolicFactorization.factorization = nullptr;
+    if (sf.status != SparseStatusOK || !sf.factorization) {
+        sparse_error(nullptr, "SymbolicFactor does not hold a completed symbolic factorization.\n");
+        return result;
+    }
+    sparse_symbolic& f = *(sparse_symbolic*)sf.factorization;
+    if (!sparse_matches<T>(sf, a)) {
+        sparse_error(f.options.reportError, "Matrix does not match that used for symbolic factorization stored in "
+                                            "SymbolicFactor.\n");
+        return result;
+    }
+    f.references.fetch_add(1);
+    result.symbolicFactorization = sf;
+    sparse_numeric<T>* numeric = new sparse_numeric<T>;
+    if (storage) {
+        numeric->values = (T*)storage;
+    } else {
+        numeric->owned.resize(f.values);
+        numeric->values = numeric->owned.data();
+    }
+    if (!workspace) {
+        numeric->workspace.resize(f.slots * sparse_slot_bytes<T>(f));
+        workspace = numeric->workspace.data();
+    }
+    result.attributes = a.structure.attributes;
+    result.attributes.transpose = false;
+    result.userFactorStorage = storage != nullptr;
+    result.numericFactorization = numeric;
+    result.solveWorkspaceRequiredStatic = 0;
+    result.solveWorkspaceRequiredPerRHS = (size_t)(f.n + f.below) * sizeof(T);
+    result.status = sparse_factor<T>(f, numeric->values, a.data, (unsigned char*)workspace);
+    return result;
+}
+
+template <class T>
+inline typename sparse_types<T>::factorization sparse_factor_entry(SparseFactorization_t type,
+                                                                   const typename sparse_types<T>::matrix& a,
+                                                                   const SparseSymbolicFactorOptions& options)
+{
+    SparseOpaqueSymbolicFactorization sf = sparse_symbolic_entry(type, a.structure, options);
+    if (sf.status != SparseStatusOK) {
+        typename sparse_types<T>::factorization result = {};
+        result.status = sf.status;
+        result.symbolicFactorization = sf;
+        return result;
+    }
+    typename sparse_types<T>::factorization result = sparse_factor_entry<T>(sf, a, nullptr, nullptr);
+    sparse_release((sparse_symbolic*)sf.factorization);
+    return result;
+}
+
+template <class T>
+inline void sparse_refactor_entry(const typename sparse_types<T>::matrix& a,
+                                  typename sparse_types<T>::factorization* factorization, void* workspace)
+{
+    if (!factorization || factorization->symbolicFactorization.status != SparseStatusOK ||
+        !factorization->symbolicFactorization.factorization || !factorization->numericFactorization) {
+        sparse_error(nullptr, "Factorization does not hold a matrix factorization.\n");
+        return;
+    }
+    const sparse_symbolic& f = *(const sparse_symbolic*)factorization->symbolicFactorization.factorization;
+    if (!sparse_matches<T>(factorization->symbolicFactorization, a)) {
+        sparse_error(f.options.reportError, "Matrix does not match that used for symbolic factorization stored in "
+                                            "Factorization.\n");
+        factorization->status = SparseParameterError;
+        return;
+    }
+    sparse_numeric<T>& numeric = *(sparse_numeric<T>*)factorization->numericFactorization;
+    if (!workspace) {
+        numeric.workspace.resize(f.slots * sparse_slot_bytes<T>(f));
+        workspace = numeric.workspace.data();
+    }
+    factorization->status = sparse_factor<T>(f, numeric.values, a.data, (unsigned char*)workspace);
+}
+
+// The solve entries take B and X as views of n x r matrices.
+template <class T>
+inline void sparse_solve_entry(const typename sparse_types<T>::factorization& factored, const lapack_matrix<T>& b,
+                               const lapack_matrix<T>& x, long r, void* workspace)
+{
+    const sparse_symbolic& f = *(const sparse_symbolic*)factored.symbolicFactorization.factorization;
+    const sparse_numeric<T>& numeric = *(const sparse_numeric<T>*)factored.numericFactorization;
+    std::vector<T> own;
+    T* y = (T*)workspace;
+    if (!y) {
+        own.resize((f.n + f.below) * r);
+        y = own.data();
+    }
+    sparse_solve<T>(f, numeric.values, b, x, r, y, y + f.n * r);
+}
+
+template <class T>
+inline bool sparse_solvable(const typename sparse_types<T>::factorization& factored)
+{
+    if (factored.symbolicFactorization.status == SparseStatusOK && factored.symbolicFactorization.factorization &&
+        factored.status == SparseStatusOK && factored.numericFactorization)
+        return true;
+    sparse_error(factored.symbolicFactorization.factorization
+                     ? ((const sparse_symbolic*)factored.symbolicFactorization.factorization)->options.reportError
+                     : nullptr,
+                 "Factored does not hold a completed matrix factorization.\n");
+    return false;
+}
+
+template <class T>
+inline lapack_matrix<T> sparse_view(const typename sparse_types<T>::dense& m)
+{
+    return m.attributes.transpose ? lapack_matrix<T>{ m.data, m.columnStride, 1 }
+                                  : lapack_matrix<T>{ m.data, 1, m.columnStride };
+}
+
+template <class T>
+inline void sparse_solve_dense(const typename sparse_types<T>::factorization& factored,
+                               const typename sparse_types<T>::dense& b, const typename sparse_types<T>::dense& x,
+                               void* workspace)
+{
+    if (!sparse_solvable<T>(factored))
+        return;
+    const sparse_symbolic& f = *(const sparse_symbolic*)factored.symbolicFactorization.factorization;
+    void (*report)(const char*) = f.options.reportError;
+    const long bn = b.attributes.transpose ? b.columnCount : b.rowCount;
+    const long br = b.attributes.transpose ? b.rowCount : b.columnCount;
+    const long xn = x.attributes.transpose ? x.columnCount : x.rowCount;
+    const long xr = x.attributes.transpose ? x.rowCount : x.columnCount;
+    if (b.columnStride < b.rowCount || x.columnStride < x.rowCount)
+        return sparse_error(report, "columnStride must be at least rowCount.\n");
+    if (bn != f.n || xn != f.n || br != xr || br <= 0)
+        return sparse_error(report, "B (%ldx%ld) and X (%ldx%ld) do not match the %ld x %ld factorization.\n", bn, br,
+                            xn, xr, f.n, f.n);
+    sparse_solve_entry<T>(factored, sparse_view<T>(b), sparse_view<T>(x), br, workspace);
+}
+
+template <class T>
+inline void sparse_solve_vector(const typename sparse_types<T>::factorization& factored,
+                                const typename sparse_types<T>::vector& b, const typename sparse_types<T>::vector& x,
+                                void* workspace)
+{
+    if (!sparse_solvable<T>(factored))
+        return;
+    const sparse_symbolic& f = *(const sparse_symbolic*)factored.symbolicFactorization.factorization;
+    if (b.count != f.n || x.count != f.n)
+        return sparse_error(f.options.reportError, "b (%d) and x (%d) do not match the %ld x %ld factorization.\n",
+                            b.count, x.count, f.n, f.n);
+    sparse_solve_entry<T>(factored, lapack_matrix<T>{ b.data, 1, 1 }, lapack_matrix<T>{ x.data, 1, 1 }, 1,
+                          workspace);
+}
+
+} // namespace detail
+
+inline SparseOpaqueSymbolicFactorization SparseFactor(SparseFactorization_t __type, SparseMatrixStructure __Matrix,
+                                                      SparseSymbolicFactorOptions __sfoptions)
+{
+    return detail::sparse_symbolic_entry(__type, __Matrix, __sfoptions);
+}
+
+inline SparseOpaqueSymbolicFactorization SparseFactor(SparseFactorization_t __type, SparseMatrixStructure __Matrix)
+{
+    return detail::sparse_symbolic_entry(__type, __Matrix, detail::sparse_default_options());
+}
+
+inline SparseOpaqueFactorization_Double SparseFactor(SparseFactorization_t __type, SparseMatrix_Double __Matrix)
+{
+    return detail::sparse_factor_entry<double>(__type, __Matrix, detail::sparse_default_options());
+}
+
+inline SparseOpaqueFactorization_Float SparseFactor(SparseFactorization_t __type, SparseMatrix_Float __Matrix)
+{
+    return detail::sparse_factor_entry<float>(__type, __Matrix, detail::sparse_default_options());
+}
+
+inline SparseOpaqueFactorization_Double SparseFactor(SparseFactorization_t __type, SparseMatrix_Double __Matrix,
+                                                     SparseSymbolicFactorOptions __sfoptions,
+                                                     SparseNumericFactorOptions __nfoptions)
+{
+    (void)__nfoptions;
+    return detail::sparse_factor_entry<double>(__type, __Matrix, __sfoptions);
+}
+
+inline SparseOpaqueFactorization_Float SparseFactor(SparseFactorization_t __type, SparseMatrix_Float __Matrix,
+                                                    SparseSymbolicFactorOptions __sfoptions,
+                                                    SparseNumericFactorOptions __nfoptions)
+{
+    (void)__nfoptions;
+    return detail::sparse_factor_entry<float>(__type, __Matrix, __sfoptions);
+}
+
+inline SparseOpaqueFactorization_Double SparseFactor(SparseOpaqueSymbolicFactorization __SymbolicFactor,
+                                                     SparseMatrix_Double __Matrix)
+{
+    return detail::sparse_factor_entry<double>(__SymbolicFactor, __Matrix, nullptr, nullptr);
+}
+
+inline SparseOpaqueFactorization_Float SparseFactor(SparseOpaqueSymbolicFactorization __SymbolicFactor,
+                                                    SparseMatrix_Float __Matrix)
+{
+    return detail::sparse_factor_entry<float>(__SymbolicFactor, __Matrix, nullptr, nullptr);
+}
+
+inline SparseOpaqueFactorization_Double SparseFactor(SparseOpaqueSymbolicFactorization __SymbolicFactor,
+                                                     SparseMatrix_Double __Matrix,
+                                                     SparseNumericFactorOptions __nfoptions)
+{
+    (void)__nfoptions;
+    return detail::sparse_factor_entry<double>(__SymbolicFactor, __Matrix, nullptr, nullptr);
+}
+
+inline SparseOpaqueFactorization_Float SparseFactor(SparseOpaqueSymbolicFactorization __SymbolicFactor,
+                                                    SparseMatrix_Float __Matrix,
+                                                    SparseNumericFactorOptions __nfoptions)
+{
+    (void)__nfoptions;
+    return detail::sparse_factor_entry<float>(__SymbolicFactor, __Matrix, nullptr, nullptr);
+}
+
+// factorStorage holds factorSize_Double bytes of L, and workspace
+// workspaceSize_Double bytes for the duration of the call.
+inline SparseOpaqueFactorization_Double SparseFactor(SparseOpaqueSymbolicFactorization __SymbolicFactor,
+                                                     SparseMatrix_Double __Matrix,
+                                                     SparseNumericFactorOptions __nfoptions, void *__factorStorage,
+                                                     void *__workspace)
+{
+    (void)__nfoptions;
+    return detail::sparse_factor_entry<double>(__SymbolicFactor, __Matrix, __factorStorage, __workspace);
+}
+
+inline SparseOpaqueFactorization_Float SparseFactor(SparseOpaqueSymbolicFactorization __SymbolicFactor,
+                                                    SparseMatrix_Float __Matrix,
+                                                    SparseNumericFactorOptions __nfoptions, void *__factorStorage,
+                                                    void *__workspace)
+{
+    (void)__nfoptions;
+    return detail::sparse_factor_entry<float>(__SymbolicFactor, __Matrix, __factorStorage, __workspace);
+}
+
+inline void SparseRefactor(SparseMatrix_Double __Matrix, SparseOpaqueFactorization_Double *__Factorization)
+{
+    detail::sparse_refactor_entry<double>(__Matrix, __Factorization, nullptr);
+}
+
+inline void SparseRefactor(SparseMatrix_Float __Matrix, SparseOpaqueFactorization_Float *__Factorization)
+{
+    detail::sparse_refactor_entry<float>(__Matrix, __Factorization, nullptr);
+}
+
+inline void SparseRefactor(SparseMatrix_Double __Matrix, SparseOpaqueFactorization_Double *__Factorization,
+                           SparseNumericFactorOptions __nfoptions)
+{
+    (void)__nfoptions;
+    detail::sparse_refactor_entry<double>(__Matrix, __Factorization, nullptr);
+}
+
+inline void SparseRefactor(SparseMatrix_Float __Matrix, SparseOpaqueFactorization_Float *__Factorization,
+                           SparseNumericFactorOptions __nfoptions)
+{
+    (void)__nfoptions;
+    detail::sparse_refactor_entry<float>(__Matrix, __Factorization, nullptr);
+}
+
+inline void SparseRefactor(SparseMatrix_Double __Matrix, SparseOpaqueFactorization_Double *__Factorization,
+                           void *__workspace)
+{
+    detail::sparse_refactor_entry<double>(__Matrix, __Factorization, __workspace);
+}
+
+inline void SparseRefactor(SparseMatrix_Float __Matrix, SparseOpaqueFactorization_Float *__Factorization,
+                           void *__workspace)
+{
+    detail::sparse_refactor_entry<float>(__Matrix, __Factorization, __workspace);
+}
+
+inline void SparseRefactor(SparseMatrix_Double __Matrix, SparseOpaqueFactorization_Double *__Factorization,
+                           SparseNumericFactorOptions __nfoptions, void *__workspace)
+{
+    (void)__nfoptions;
+    detail::sparse_refactor_entry<double>(__Matrix, __Factorization, __workspace);
+}
+
+inline void SparseRefactor(SparseMatrix_Float __Matrix, SparseOpaqueFactorization_Float *__Factorization,
+                           SparseNumericFactorOptions __nfoptions, void *__workspace)
+{
+    (void)__nfoptions;
+    detail::sparse_refactor_entry<float>(__Matrix, __Factorization, __workspace);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Double __Factored, DenseMatrix_Double __XB)
+{
+    detail::sparse_solve_dense<double>(__Factored, __XB, __XB, nullptr);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Float __Factored, DenseMatrix_Float __XB)
+{
+    detail::sparse_solve_dense<float>(__Factored, __XB, __XB, nullptr);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Double __Factored, DenseMatrix_Double __B, DenseMatrix_Double __X)
+{
+    detail::sparse_solve_dense<double>(__Factored, __B, __X, nullptr);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Float __Factored, DenseMatrix_Float __B, DenseMatrix_Float __X)
+{
+    detail::sparse_solve_dense<float>(__Factored, __B, __X, nullptr);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Double __Factored, DenseVector_Double __xb)
+{
+    detail::sparse_solve_vector<double>(__Factored, __xb, __xb, nullptr);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Float __Factored, DenseVector_Float __xb)
+{
+    detail::sparse_solve_vector<float>(__Factored, __xb, __xb, nullptr);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Double __Factored, DenseVector_Double __b, DenseVector_Double __x)
+{
+    detail::sparse_solve_vector<double>(__Factored, __b, __x, nullptr);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Float __Factored, DenseVector_Float __b, DenseVector_Float __x)
+{
+    detail::sparse_solve_vector<float>(__Factored, __b, __x, nullptr);
+}
+
+// workspace holds solveWorkspaceRequiredStatic + nrhs *
+// solveWorkspaceRequiredPerRHS bytes.
+inline void SparseSolve(SparseOpaqueFactorization_Double __Factored, DenseMatrix_Double __XB, void *__workspace)
+{
+    detail::sparse_solve_dense<double>(__Factored, __XB, __XB, __workspace);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Float __Factored, DenseMatrix_Float __XB, void *__workspace)
+{
+    detail::sparse_solve_dense<float>(__Factored, __XB, __XB, __workspace);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Double __Factored, DenseMatrix_Double __B, DenseMatrix_Double __X,
+                        void *__workspace)
+{
+    detail::sparse_solve_dense<double>(__Factored, __B, __X, __workspace);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Float __Factored, DenseMatrix_Float __B, DenseMatrix_Float __X,
+                        void *__workspace)
+{
+    detail::sparse_solve_dense<float>(__Factored, __B, __X, __workspace);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Double __Factored, DenseVector_Double __xb, void *__workspace)
+{
+    detail::sparse_solve_vector<double>(__Factored, __xb, __xb, __workspace);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Float __Factored, DenseVector_Float __xb, void *__workspace)
+{
+    detail::sparse_solve_vector<float>(__Factored, __xb, __xb, __workspace);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Double __Factored, DenseVector_Double __b, DenseVector_Double __x,
+                        void *__workspace)
+{
+    detail::sparse_solve_vector<double>(__Factored, __b, __x, __workspace);
+}
+
+inline void SparseSolve(SparseOpaqueFactorization_Float __Factored, DenseVector_Float __b, DenseVector_Float __x,
+                        void *__workspace)
+{
+    detail::sparse_solve_vector<float>(__Factored, __b, __x, __workspace);
+}
+
+inline SparseOpaqueSymbolicFactorization SparseRetain(SparseOpaqueSymbolicFactorization __SymbolicFactor)
+{
+    if (__SymbolicFactor.status != SparseStatusOK || !__SymbolicFactor.factorization) {
+        detail::sparse_error(nullptr, "Can only retain valid symbolic factorizations.\n");
+        __SymbolicFactor.status = SparseParameterError;
+        return __SymbolicFactor;
+    }
+    ((detail::sparse_symbolic*)__SymbolicFactor.factorization)->references.fetch_add(1);
+    return __SymbolicFactor;
+}
+
+inline void SparseCleanup(SparseOpaqueSymbolicFactorization __toFree)
+{
+    detail::sparse_release((detail::sparse_symbolic*)__toFree.factorization);
+}
+
+inline void SparseCleanup(SparseOpaqueFactorization_Double __toFree)
+{
+    delete (detail::sparse_numeric<double>*)__toFree.numericFactorization;
+    detail::sparse_release((detail::sparse_symbolic*)__toFree.symbolicFactorization.factorization);
+}
+
+inline void SparseCleanup(SparseOpaqueFactorization_Float __toFree)
+{
+    delete (detail::sparse_numeric<float>*)__toFree.numericFactorization;
+    detail::sparse_release((detail::sparse_symbolic*)__toFree.symbolicFactorization.factorization);
+}
+
+namespace detail {
+
+// The iterative methods keep a block of k vectors interleaved, entry i
+// of vector c at i*k + c, so that a product with A meets all k at each
+// entry of A in one contiguous run, and so do the dot products and
+// updates of the methods.  Each column sums in the order it would
+// alone: a batch gives exactly what the same solves one at a time do.
+
+template <class T>
+__VDSP_NOCONTRACT void sparse_madd(T* y, T a, const T* x, long k)
+{
+    long q = 0;
+    // Fours loaded before stored, which vectorise though x and y may
+    // alias as far as the compiler knows.
+    for (; q + 4 <= k; q += 4) {
+        const T x0 = x[q], x1 = x[q + 1], x2 = x[q + 2], x3 = x[q + 3];
+        const T y0 = y[q] + a * x0, y1 = y[q + 1] + a * x1, y2 = y[q + 2] + a * x2, y3 = y[q + 3] + a * x3;
+        y[q] = y0;
+        y[q + 1] = y1;
+        y[q + 2] = y2;
+        y[q + 3] = y3;
+    }
+    for (; q < k; q++)
+        y[q] += a * x[q];
+}
+
+// The same for a matrix of single entries, ordinary or symmetric, and one
+// or two columns, with the entries of y that column j alone touches kept in
+// registers.
+template <int W, class T>
+__VDSP_NOCONTRACT void sparse_multiply(const SparseMatrixStructure& s, const T* data, bool trans, T alpha,
+                                       const T* x, T* y)
+{
+    const bool lower = s.attributes.triangle == SparseLowerTriangle, symmetric = s.attributes.kind == SparseSymmetric;
+    // Column j scatters x(j,:) into y when op(A) is A, and gathers into
+    // y(j,:) when it is A'; symmetric does both.  Only the side in use is
+    // read: past the shorter side of a rectangular A the other is not there.
+    const bool scatter = symmetric || !trans, gather = symmetric || trans;
+    const int* ri = s.rowIndices;
+    for (long j = 0; j < s.columnCount; j++) {
+        T xj[W], sum[W];
+        for (int c = 0; c < W; c++) {
+            xj[c] = scatter ? x[j * W + c] : T(0);
+            sum[c] = gather ? y[j * W + c] : T(0);
+        }
+        for (long p = s.columnStarts[j]; p < s.columnStarts[j + 1]; p++) {
+            const long i = ri[p];
+            if (symmetric && (lower ? i < j : i > j))
+                continue;
+            const T e = alpha * data[p];
+            if (symmetric && i != j)
+                for (int c = 0; c < W; c++)
+                    y[i * W + c] += e * xj[c];
+            if (gather)
+                for (int c = 0; c < W; c++)
+                    sum[c] += e * x[i * W + c];
+            else
+                for (int c = 0; c < W; c++)
+                    y[i * W + c] += e * xj[c];
+        }
+        if (gather)
+            std::copy(sum, sum + W, y + j * W);
+    }
+}
+
+// y += alpha*op(A)*x for k interleaved columns, where op(A) is A, or A'
+// when trans, as A's own transpose, kind and triangle make it.
+template <class T>
+__VDSP_NOCONTRACT void sparse_multiply(const SparseMatrixStructure& s, const T* data, bool trans, T alpha, long k,
+                                       const T* x, T* y)
+{
+    const long bs = s.blockSize, bb = bs * bs;
+    const SparseKind_t kind = s.attributes.kind;
+    const bool lower = s.attributes.triangle == SparseLowerTriangle, ordinary = kind == SparseOrdinary;
+    const bool symmetric = kind == SparseSymmetric;
+    const int* ri = s.rowIndices;
+    trans = trans != (bool)s.attributes.transpose;
+    if (bs == 1 && (ordinary || symmetric) && k <= 2) {
+        if (k == 1)
+            sparse_multiply<1>(s, data, trans, alpha, x, y);
+        else
+            sparse_multiply<2>(s, data, trans, alpha, x, y);
+        return;
+    }
+    if (bs == 1 && (ordinary || symmetric)) {
+        for (long j = 0; j < s.columnCount; j++)
+            for (long p = s.columnStarts[j]; p < s.columnStarts[j + 1]; p++) {
+                const long i = ri[p];
+                if (symmetric && (lower ? i < j : i > j))
+                    continue;
+                const T e = alpha * data[p];
+                if (symmetric && i != j)
+                    sparse_madd(y + i * k, e, x + j * k, k);
+                if (symmetric || trans)
+                    sparse_madd(y + j * k, e, x + i * k, k);
+                else
+                    sparse_madd(y + i * k, e, x + j * k, k);
+            }
+        return;
+    }
+    for (long j = 0; j < s.columnCount; j++)
+        for (long p = s.columnStarts[j]; p < s.columnStarts[j + 1]; p++) {
+            const long i = ri[p];
+            if (!ordinary && !sparse_stored(s, i, j))
+                continue;
+            const T* a = data + p * bb;
+            for (long c = 0; c < bs; c++)
+                for (long r = 0; r < bs; r++) {
+                    const long u = i * bs + r, v = j * bs + c;
+                    if ((!ordinary && i == j && (lower ? r < c : r > c)) || (kind == SparseUnitTriangular && u == v))
+                        continue;
+                    const T e = alpha * a[r + c * bs];
+                    if (symmetric) {
+                        if (u != v)
+                            sparse_madd(y + u * k, e, x + v * k, k);
+                        sparse_madd(y + v * k, e, x + u * k, k);
+                    } else if (trans) {
+                        sparse_madd(y + v * k, e, x + u * k, k);
+                    } else {
+                        sparse_madd(y + u * k, e, x + v * k, k);
+                    }
+                }
+        }
+    if (kind == SparseUnitTriangular)
+        for (long i = 0; i < s.columnCount * bs * k; i++)
+            y[i] += alpha * x[i];
+}
+
+// Rows and columns of op(A), in scalars.
+inline long sparse_rows(const SparseMatrixStructure& s, bool trans)
+{
+    return (long)s.blockSize * (trans != (bool)s.attributes.transpose ? s.columnCount : s.rowCount);
+}
+
+// The n x k matrix a view holds, interleaved: a itself when it already
+// is, else a copy in buffer.
+template <class T>
+inline T* sparse_interleave(const lapack_matrix<T>& a, long n, long k, std::vector<T>& buffer, bool copy)
+{
+    if (k == 1 ? a.si == 1 : a.sj == 1 && a.si == k)
+        return a.p;
+    buffer.resize(n * k);
+    if (copy)
+        for (long i = 0; i < n; i++)
+            for (long q = 0; q < k; q++)
+                buffer[i * k + q] = a(i, q);
+    return buffer.data();
+}
+
+template <class T>
+inline void sparse_multiply_entry(const typename sparse_types<T>::matrix& a, T alpha, bool accumulate,
+                                  const typename sparse_types<T>::dense& x, const typename sparse_types<T>::dense& y)
+{
+    const long m = sparse_rows(a.structure, false), n = sparse_rows(a.structure, true);
+    const long xn = x.attributes.transpose ? x.columnCount : x.rowCount;
+    const long xr = x.attributes.transpose ? x.rowCount : x.columnCount;
+    const long ym = y.attributes.transpose ? y.columnCount : y.rowCount;
+    const long yr = y.attributes.transpose ? y.rowCount : y.columnCount;
+    if (xn != n || ym != m || xr != yr) {
+        sparse_error(nullptr, "Dimensions of A (%ldx%ld), X (%ldx%ld) and Y (%ldx%ld) do not match.\n", m, n, xn, xr, ym,
+                     yr);
+        return;
+    }
+    const lapack_matrix<T> xv = sparse_view<T>(x), yv = sparse_view<T>(y);
+    std::vector<T> xb, yb;
+    const T* xi = sparse_interleave(xv, n, xr, xb, true);
+    T* yi = sparse_interleave(yv, m, yr, yb, accumulate);
+    if (!accumulate)
+        std::fill(yi, yi + m * yr, T(0));
+    sparse_multiply<T>(a.structure, a.data, false, alpha, xr, xi, yi);
+    if (yi != yv.p)
+        for (long i = 0; i < m; i++)
+            for (long q = 0; q < yr; q++)
+                yv(i, q) = yi[i * yr + q];
+}
+
+// The preconditioners made by SparseCreatePreconditioner: D*X, for the
+// inverse diagonal of A, or of the column norms of A.
+template <class T>
+struct sparse_diagonal {
+    std::vector<T> d;
+};
+
+template <class T>
+inline void sparse_diagonal_apply(void* mem, enum CBLAS_TRANSPOSE, typename sparse_types<T>::dense x,
+                                  typename sparse_types<T>::dense y)
+{
+    const std::vector<T>& d = ((const sparse_diagonal<T>*)mem)->d;
+    const lapack_matrix<T> xv = sparse_view<T>(x), yv = sparse_view<T>(y);
+    for (long j = 0, r = x.attributes.transpose ? x.rowCount : x.columnCount; j < r; j++)
+        for (long i = 0; i < (long)d.size(); i++)
+            yv(i, j) = d[i] * xv(i, j);
+}
+
+template <class T>
+inline typename sparse_types<T>::preconditioner sparse_create_preconditioner(SparsePreconditioner_t type,
+                                                                             const typename sparse_types<T>::matrix& a)
+{
+    typename sparse_types<T>::preconditioner result = {};
+    result.type = SparsePreconditionerNone;
+    const SparseMatrixStructure& s = a.structure;
+    const long m = sparse_rows(s, false), n = sparse_rows(s, true), bs = s.blockSize;
+    if (m <= 0 || n <= 0) {
+        sparse_error(nullptr, "Bad matrix dimensions %ldx%ld\n", m, n);
+        return result;
+    }
+    if (type != SparsePreconditionerDiagonal && type != SparsePreconditionerDiagScaling) {
+        sparse_error(nullptr, "Only SparsePreconditionerDiagonal and SparsePreconditionerDiagScaling can be created.\n");
+        return result;
+    }
+    if (type == SparsePreconditionerDiagonal && m != n) {
+        sparse_error(nullptr, "SparsePreconditionerDiagonal requires a square matrix, not %ldx%ld.\n", m, n);
+        return result;
+    }
+    const SparseKind_t kind = s.attributes.kind;
+    const bool lower = s.attributes.triangle == SparseLowerTriangle, ordinary = kind == SparseOrdinary;
+    const bool trans = s.attributes.transpose;
+    std::vector<double> sum(n, kind == SparseUnitTriangular ? 1.0 : 0.0);
+    for (long j = 0; j < s.columnCount; j++)
+        for (long p = s.columnStarts[j]; p < s.columnStarts[j + 1]; p++) {
+            const long i = s.rowIndices[p];
+            if (!ordinary && !sparse_stored(s, i, j))
+                continue;
+            for (long c = 0; c < bs; c++)
+                for (long r = 0; r < bs; r++) {
+                    const long u = i * bs + r, v = j * bs + c;
+                    if ((!ordinary && i == j && (lower ? r < c : r > c)) || (kind == SparseUnitTriangular && u == v))
+                        continue;
+                    const double e = a.data[p * bs * bs + r + c * bs];
+                    if (type == SparsePreconditionerDiagonal) {
+                        if (u == v)
+                            sum[u] += e;
+                        continue;
+                    }
+                    sum[trans ? u : v] += e * e;
+                    if (kind == SparseSymmetric && u != v)
+                        sum[trans ? v : u] += e * e;
+                }
+        }
+    sparse_diagonal<T>* d = new sparse_diagonal<T>;
+    d->d.resize(n);
+    for (long i = 0; i < n; i++) {
+        const double e = type == SparsePreconditionerDiagonal ? sum[i] : sqrt(sum[i]);
+        d->d[i] = e == 0 ? T(1) : T(1 / e);
+    }
+    result.type = type;
+    result.mem = d;
+    result.apply = &sparse_diagonal_apply<T>;
+    return result;
+}
+
+
+// op(A) for the iterative methods, m x n, and its preconditioner, n x n,
+// each applied to k interleaved columns at once.  The callbacks of the
+// caller see the columns gathered into one column-major matrix.
+template <class T>
+struct sparse_operator {
+    long m, n;
+    std::function<void(bool accumulate, bool trans, long k, const T* x, T* y)> multiply;
+    std::function<void(bool trans, long k, const T* x, T* y)> precondition;
+};
+
+template <class T>
+inline sparse_operator<T> sparse_matrix_operator(const typename sparse_types<T>::matrix& a)
+{
+    sparse_operator<T> op;
+    const long m = op.m = sparse_rows(a.structure, false), n = op.n = sparse_rows(a.structure, true);
+    op.multiply = [a, m, n](bool accumulate, bool trans, long k, const T* x, T* y) {
+        if (!accumulate)
+            std::fill(y, y + (trans ? n : m) * k, T(0));
+        sparse_multiply<T>(a.structure, a.data, trans, T(1), k, x, y);
+    };
+    return op;
+}
+
+template <class T>
+inline typename sparse_types<T>::dense sparse_gather(std::vector<T>& buffer, long n, long k, const T* x)
+{
+    buffer.resize(n * k);
+    for (long i = 0; i < n; i++)
+        for (long q = 0; q < k; q++)
+            buffer[q * n + i] = x[i * k + q];
+    typename sparse_types<T>::dense d = {};
+    d.rowCount = (int)n;
+    d.columnCount = (int)k;
+    d.columnStride = (int)n;
+    d.data = buffer.data();
+    return d;
+}
+
+template <class T>
+inline void sparse_scatter(const std::vector<T>& buffer, long n, long k, T* y)
+{
+    for (long i = 0; i < n; i++)
+        for (long q = 0; q < k; q++)
+            y[i * k + q] = buffer[q * n + i];
+}
+
+template <class T>
+inline sparse_operator<T> sparse_callback_operator(
+    long m, long n,
+    const std::function<void(bool, enum CBLAS_TRANSPOSE, typename sparse_types<T>::dense,
+                             typename sparse_types<T>::dense)>& apply)
+{
+    sparse_operator<T> op;
+    op.m = m;
+    op.n = n;
+    op.multiply = [m, n, apply](bool accumulate, bool trans, long k, const T* x, T* y) {
+        std::vector<T> in, out;
+        const typename sparse_types<T>::dense xd = sparse_gather<T>(in, trans ? m : n, k, x);
+        const typename sparse_types<T>::dense yd = sparse_gather<T>(out, trans ? n : m, k, y);
+        apply(accumulate, trans ? CblasTrans : CblasNoTrans, xd, yd);
+        sparse_scatter<T>(out, trans ? n : m, k, y);
+    };
+    return op;
+}
+
+template <class T>
+inline sparse_operator<T> sparse_callback_operator(
+    long m, long n,
+    const std::function<void(bool, enum CBLAS_TRANSPOSE, typename sparse_types<T>::vector,
+                             typename sparse_types<T>::vector)>& apply)
+{
+    sparse_operator<T> op;
+    op.m = m;
+    op.n = n;
+    op.multiply = [m, n, apply](bool accumulate, bool trans, long k, const T* x, T* y) {
+        std::vector<T> in, out;
+        for (long q = 0; q < k; q++) {
+            in.resize(trans ? m : n);
+            for (long i = 0; i < (trans ? m : n); i++)
+                in[i] = x[i * k + q];
+            out.resize(trans ? n : m);
+            for (long i = 0; i < (trans ? n : m); i++)
+                out[i] = y[i * k + q];
+            apply(accumulate, trans ? CblasTrans : CblasNoTrans,
+                  typename sparse_types<T>::vector{ (int)(trans ? m : n), in.data() },
+                  typename sparse_types<T>::vector{ (int)(trans ? n : m), out.data() });
+            for (long i = 0; i < (trans ? n : m); i++)
+                y[i * k + q] = out[i];
+        }
+    };
+    return op;
+}
+
+template <class T>
+inline void sparse_set_preconditioner(sparse_operator<T>& op, const typename sparse_types<T>::preconditioner& p)
+{
+    const long n = op.n;
+    if (p.apply == &sparse_diagonal_apply<T>) {
+        const sparse_diagonal<T>* d = (const sparse_diagonal<T>*)p.mem;
+        op.precondition = [d, n](bool, long k, const T* x, T* y) {
+            for (long i = 0; i < n; i++)
+                for (long q = 0; q < k; q++)
+                    y[i * k + q] = d->d[i] * x[i * k + q];
+        };
+        return;
+    }
+    op.precondition = [p, n](bool trans, long k, const T* x, T* y) {
+        std::vector<T> in, out(n * k);
+        const typename sparse_types<T>::dense xd = sparse_gather<T>(in, n, k, x);
+        typename sparse_types<T>::dense yd = xd;
+        yd.data = out.data();
+        p.apply(p.mem, trans ? CblasTrans : CblasNoTrans, xd, yd);
+        sparse_scatter<T>(out, n, k, y);
+    };
+}
+
+// s[c] = x(:,c)'*y(:,c) for W of k interleaved columns of length n, in
+// double, their sums in registers.
+template <int W, class T>
+__VDSP_NOCONTRACT void sparse_dots(const T* x, const T* y, long n, long k, double* s)
+{
+    double sum[W] = {};
+    for (long i = 0; i < n; i++)
+        for (int c = 0; c < W; c++)
+            sum[c] += (double)x[i * k + c] * (double)y[i * k + c];
+    std::copy(sum, sum + W, s);
+}
+
+template <class T>
+inline void sparse_dots(const T* x, const T* y, long n, long k, double* s)
+{
+    long c = 0;
+    for (; c + 8 <= k; c += 8)
+        sparse_dots<8>(x + c, y + c, n, k, s + c);
+    for (; c + 4 <= k; c += 4)
+        sparse_dots<4>(x + c, y + c, n, k, s + c);
+    for (; c + 2 <= k; c += 2)
+        sparse_dots<2>(x + c, y + c, n, k, s + c);
+    for (; c < k; c++)
+        sparse_dots<1>(x + c, y + c, n, k, s + c);
+}
+
+template <class T>
+inline void sparse_norms(const T* x, long n, long k, double* s)
+{
+    sparse_dots(x, x, n, k, s);
+    for (long c = 0; c < k; c++)
+        s[c] = sqrt(s[c]);
+}
+
+// y(:,c) += a[c]*x(:,c).
+template <class T>
+__VDSP_NOCONTRACT void sparse_axpys(T* y, const T* a, const T* x, long n, long k)
+{
+    if (k == 1) {
+        const T a0 = *a;
+        for (long i = 0; i < n; i++)
+            y[i] += a0 * x[i];
+        return;
+    }
+    for (long i = 0; i < n; i++) {
+        T* yi = y + i * k;
+        const T* xi = x + i * k;
+        long c = 0;
+        for (; c + 4 <= k; c += 4) {
+            const T y0 = yi[c] + a[c] * xi[c], y1 = yi[c + 1] + a[c + 1] * xi[c + 1];
+            const T y2 = yi[c + 2] + a[c + 2] * xi[c + 2], y3 = yi[c + 3] + a[c + 3] * xi[c + 3];
+            yi[c] = y0;
+            yi[c + 1] = y1;
+            yi[c + 2] = y2;
+            yi[c + 3] = y3;
+        }
+        for (; c < k; c++)
+            yi[c] += a[c] * xi[c];
+    }
+}
+
+// The step of CG for W of k columns in one pass: x += a*p, r -= a*q,
+// and s = r'r after.
+template <int W, class T>
+__VDSP_NOCONTRACT void sparse_cg_update(T* x, T* r, const T* p, const T* q, const T* a, long n, long k, double* s)
+{
+    double sum[W] = {};
+    T ac[W];
+    std::copy(a, a + W, ac);
+    for (long i = 0; i < n; i++)
+        for (int c = 0; c < W; c++) {
+            const long e = i * k + c;
+            x[e] += ac[c] * p[e];
+            r[e] -= ac[c] * q[e];
+            sum[c] += (double)r[e] * (double)r[e];
+        }
+    std::copy(sum, sum + W, s);
+}
+
+template <class T>
+inline void sparse_cg_update(T* x, T* r, const T* p, const T* q, const T* a, long n, long k, double* s)
+{
+    long c = 0;
+    for (; c + 8 <= k; c += 8)
+        sparse_cg_update<8>(x + c, r + c, p + c, q + c, a + c, n, k, s + c);
+    for (; c + 4 <= k; c += 4)
+        sparse_cg_update<4>(x + c, r + c, p + c, q + c, a + c, n, k, s + c);
+    for (; c + 2 <= k; c += 2)
+        sparse_cg_update<2>(x + c, r + c, p + c, q + c, a + c, n, k, s + c);
+    for (; c < k; c++)
+        sparse_cg_update<1>(x + c, r + c, p + c, q + c, a + c, n, k, s + c);
+}
+
+// x(:,c) /= s[c] where s[c] is not zero.
+template <class T>
+__VDSP_NOCONTRACT void sparse_divide(T* x, const double* s, long n, long k)
+{
+    for (long i = 0; i < n; i++)
+        for (long c = 0; c < k; c++)
+            if (s[c] != 0)
+                x[i * k + c] /= (T)s[c];
+}
+
+// Narrows a block of k interleaved columns of length n, in place, to the
+// columns keep lists, in order.
+template <class T>
+inline void sparse_narrow(T* block, long n, long k, const std::vector<long>& keep)
+{
+    const long w = (long)keep.size();
+    if (w < k)
+        for (long i = 0; i < n; i++)
+            for (long t = 0; t < w; t++)
+                block[i * w + t] = block[i * k + keep[t]];
+}
+
+// The same for per-column data, in chunks of size each.
+template <class V>
+inline void sparse_narrow(std::vector<V>& v, long size, const std::vector<long>& keep)
+{
+    for (size_t t = 0; t < keep.size(); t++)
+        std::copy(v.begin() + keep[t] * size, v.begin() + keep[t] * size + size, v.begin() + t * size);
+    v.resize(keep.size() * size);
+}
+
+// Column t of the k-wide block from into column c of the r-wide block to.
+template <class T>
+inline void sparse_put(T* to, long r, long c, const T* from, long k, long t, long n)
+{
+    for (long i = 0; i < n; i++)
+        to[i * r + c] = from[i * k + t];
+}
+
+template <class T>
+inline double sparse_rtol(double rtol)
+{
+    return rtol == 0 ? sqrt((double)std::numeric_limits<T>::epsilon()) : std::max(rtol, 0.0);
+}
+
+inline void sparse_progress(void (*report)(const char*), int iteration, double residual)
+{
+    if (!report || iteration % 10)
+        return;
+    char message[64];
+    snprintf(message, sizeof message, "Iteration %d: residual %.6e\n", iteration, residual);
+    report(message);
+}
+
+// C = alpha*A*B + beta*C, for an m x k A and a k x n B.
+template <class T>
+inline void sparse_gemm(const lapack_matrix<T>& c, const lapack_matrix<T>& a, const lapack_matrix<T>& b, long m,
+                        long n, long k, T alpha, T beta)
+{
+    if (m == 0 || n == 0)
+        return;
+    if (k == 0) {
+        for (long j = 0; j < n; j++)
+            for (long i = 0; i < m; i++)
+                c(i, j) = beta == 0 ? T(0) : beta * c(i, j);
+        return;
+    }
+    if (c.sj == 1)
+        return blas_gemm(blas_gemm_call<T>{ a, b, c.p, c.si, m, n, k, alpha, beta, blas_block<T>(m, n, k) });
+    blas_gemm(blas_gemm_call<T>{ b.t(), a.t(), c.p, c.sj, n, m, k, alpha, beta, blas_block<T>(n, m, k) });
+}
+
+// R = B - A*X for k columns, and their norms.
+template <class T>
+__VDSP_NOCONTRACT void sparse_residual(const sparse_operator<T>& op, long k, const T* b, const T* x, T* r,
+                                       double* norm)
+{
+    op.multiply(false, false, k, x, r);
+    for (long i = 0; i < op.m * k; i++)
+        r[i] = b[i] - r[i];
+    sparse_norms(r, op.m, k, norm);
+}
+
+// Conjugate gradients on r right-hand sides in step, n x r interleaved:
+// one product with A and one application of the preconditioner a step
+// for all the columns still going.  Those that converge or break down
+// leave every block at once, so no work is spent on them.
+template <class T>
+__VDSP_NOCONTRACT SparseIterativeStatus_t sparse_cg(const SparseCGOptions& o, const sparse_operator<T>& op, long r,
+                                                     const T* b, T* x)
+{
+    const long n = op.n;
+    const int limit = o.maxIterations > 0 ? o.maxIterations : 100;
+    const double rtol = sparse_rtol<T>(o.rtol);
+    const bool pre = (bool)op.precondition;
+    long k = r;
+    std::vector<T> xv(x, x + n * r), rv(n * r), pv(n * r), qv(n * r), zv(pre ? n * r : 0), a(r);
+    T *X = xv.data(), *R = rv.data(), *P = pv.data(), *Q = qv.data(), *Z = pre ? zv.data() : R;
+    std::vector<double> rz(r), norm(r), tol(r), d(r);
+    std::vector<long> map(r);
+    std::iota(map.begin(), map.end(), 0L);
+    std::vector<char> broken(r, 0);
+    bool failed = false;
+    sparse_residual(op, k, b, X, R, norm.data());
+    if (pre)
+        op.precondition(false, k, R, Z);
+    std::copy(Z, Z + n * k, P);
+    sparse_dots(R, Z, n, k, rz.data());
+    for (long c = 0; c < r; c++)
+        tol[c] = rtol * norm[c] + o.atol;
+    double first = norm[0];
+    for (int it = 0;; it++) {
+        std::vector<long> keep;
+        for (long t = 0; t < k; t++)
+            if (norm[t] > tol[t] && !broken[t]) {
+                keep.push_back(t);
+            } else {
+                failed = failed || broken[t];
+                sparse_put(x, r, map[t], X, k, t, n);
+            }
+        if ((long)keep.size() < k) {
+            for (T* block : { X, R, P, Q })
+                sparse_narrow(block, n, k, keep);
+            if (pre)
+                sparse_narrow(Z, n, k, keep);
+            sparse_narrow(rz, 1, keep);
+            sparse_narrow(norm, 1, keep);
+            sparse_narrow(tol, 1, keep);
+            sparse_narrow(map, 1, keep);
+            sparse_narrow(broken, 1, keep);
+            k = (long)keep.size();
+        }
+        if (k && !map[0])
+            first = norm[0];
+        sparse_progress(o.reportStatus, it, first);
+        if (k == 0 || it == limit)
+            break;
+        op.multiply(false, false, k, P, Q);
+        sparse_dots(P, Q, n, k, d.data());
+        for (long t = 0; t < k; t++) {
+            broken[t] = !(d[t] > 0);
+            a[t] = broken[t] ? T(0) : (T)(rz[t] / d[t]);
+        }
+        sparse_cg_update(X, R, P, Q, a.data(), n, k, d.data());
+        for (long t = 0; t < k; t++)
+            norm[t] = sqrt(d[t]);
+        if (pre) {
+            op.precondition(false, k, R, Z);
+            sparse_dots(R, Z, n, k, d.data());
+        }
+        for (long t = 0; t < k; t++) {
+            a[t] = (T)(d[t] / rz[t]);
+            rz[t] = d[t];
+        }
+        for (long i = 0; i < n; i++)
+            for (long t = 0; t < k; t++)
+                P[i * k + t] = Z[i * k + t] + a[t] * P[i * k + t];
+    }
+    for (long t = 0; t < k; t++)
+        sparse_put(x, r, map[t], X, k, t, n);
+    if (failed)
+        return SparseIterativeIllConditioned;
+    return k == 0 ? SparseIterativeConverged : SparseIterativeMaxIterations;
+}
+
+// Block conjugate gradients: the r right-hand sides share one Krylov
+// space, so each step minimises over all their search directions at
+// once.  The directions are made A-orthonormal each step by a Cholesky
+// factorization of P'AP, pivoted, that drops any direction nearly in
+// the span of those before it; they come back as needed from the next
+// residuals, so the block neither breaks down as columns converge nor
+// carries dependent directions.
+template <class T>
+__VDSP_NOCONTRACT SparseIterativeStatus_t sparse_block_cg(const SparseCGOptions& o, const sparse_operator<T>& op,
+                                                          long r, const T* b, T* x)
+{
+    const long n = op.n;
+    const int limit = o.maxIterations > 0 ? o.maxIterations : 100;
+    const double rtol = sparse_rtol<T>(o.rtol), drop = sqrt((double)std::numeric_limits<T>::epsilon());
+    const bool pre = (bool)op.precondition;
+    std::vector<T> rv(n * r), pv(n * r), qv(n * r), zv(pre ? n * r : 0), p2(n * r), q2(n * r), small(r * r);
+    std::vector<T> coefficients(r * r);
+    T *R = rv.data(), *P = pv.data(), *Q = qv.data(), *Z = pre ? zv.data() : R;
+    std::vector<double> norm(r), tol(r), g(r * r), scale(r);
+    std::vector<long> perm(r);
+    sparse_residual(op, r, b, x, R, norm.data());
+    for (long c = 0; c < r; c++)
+        tol[c] = rtol * norm[c] + o.atol;
+    if (pre)
+        op.precondition(false, r, R, Z);
+    std::copy(Z, Z + n * r, P);
+    // n x r interleaved blocks are row-major matrices.
+    auto block = [r](T* p) { return lapack_matrix<T>{ p, r, 1 }; };
+    for (int it = 0;; it++) {
+        bool done = true;
+        for (long c = 0; c < r; c++)
+            done = done && norm[c] <= tol[c];
+        sparse_progress(o.reportStatus, it, norm[0]);
+        if (done)
+            return SparseIterativeConverged;
+        if (it == limit)
+            return SparseIterativeMaxIterations;
+        op.multiply(false, false, r, P, Q);
+        sparse_gemm(lapack_matrix<T>{ small.data(), 1, r }, block(P).t(), block(Q), r, r, n, T(1), T(0));
+        // Pivoted Cholesky of D^-1/2 * P'AP * D^-1/2, stopping at the
+        // first pivot below drop.
+        for (long c = 0; c < r; c++) {
+            const double d = small[c + c * r];
+            if (d < 0)
+                return SparseIterativeIllConditioned;
+            scale[c] = d > 0 ? 1 / sqrt(d) : 0;
+            perm[c] = c;
+        }
+        for (long j = 0; j < r; j++)
+            for (long i = 0; i < r; i++)
+                g[i + j * r] = 0.5 * ((double)small[i + j * r] + (double)small[j + i * r]) * scale[i] * scale[j];
+        long k = 0;
+        for (; k < r; k++) {
+            long best = k;
+            for (long i = k + 1; i < r; i++)
+                if (g[i + i * r] > g[best + best * r])
+                    best = i;
+            if (!(g[best + best * r] > drop))
+                break;
+            std::swap(perm[k], perm[best]);
+            for (long i = 0; i < r; i++)
+                std::swap(g[i + k * r], g[i + best * r]);
+            for (long j = 0; j < r; j++)
+                std::swap(g[k + j * r], g[best + j * r]);
+            const double l = sqrt(g[k + k * r]);
+            g[k + k * r] = l;
+            for (long i = k + 1; i < r; i++)
+                g[i + k * r] /= l;
+            // Both triangles, for the swaps of later pivots.
+            for (long j = k + 1; j < r; j++)
+                for (long i = k + 1; i < r; i++)
+                    g[i + j * r] -= g[i + k * r] * g[j + k * r];
+        }
+        if (k == 0)
+            return SparseIterativeIllConditioned;
+        // P2 = P(:, kept) * D^-1/2 * L^-T, Q2 likewise: A-orthonormal.
+        for (long i = 0; i < n; i++)
+            for (long t = 0; t < k; t++) {
+                p2[i * k + t] = P[i * r + perm[t]] * (T)scale[perm[t]];
+                q2[i * k + t] = Q[i * r + perm[t]] * (T)scale[perm[t]];
+            }
+        for (long t = 0; t < k; t++)
+            for (long i = 0; i < k; i++)
+                small[i + t * k] = i >= t ? (T)g[i + t * r] : T(0);
+        const lapack_matrix<T> l{ small.data(), 1, k }, pk{ p2.data(), k, 1 }, qk{ q2.data(), k, 1 };
+        lapack_trsm(l, pk.t(), k, n, true, false);
+        lapack_trsm(l, qk.t(), k, n, true, false);
+        // alpha = P2'R; X += P2*alpha; R -= Q2*alpha.
+        const lapack_matrix<T> c{ coefficients.data(), 1, k };
+        sparse_gemm(c, pk.t(), block(R), k, r, n, T(1), T(0));
+        sparse_gemm(block(x), pk, c, n, r, k, T(1), T(1));
+        sparse_gemm(block(R), qk, c, n, r, k, T(-1), T(1));
+        sparse_norms(R, n, r, norm.data());
+        if (pre)
+            op.precondition(false, r, R, Z);
+        // P = Z - P2*(Q2'Z), A-conjugate to the directions just taken.
+        sparse_gemm(c, qk.t(), block(Z), k, r, n, T(1), T(0));
+        std::copy(Z, Z + n * r, P);
+        sparse_gemm(block(P), pk, c, n, r, k, T(-1), T(1));
+    }
+}
+
+// A Givens rotation taking (a, b) to (h, 0).
+inline void sparse_rotation(double a, double b, double& c, double& s, double& h)
+{
+    h = hypot(a, b);
+    c = h == 0 ? 1 : a / h;
+    s = h == 0 ? 0 : b / h;
+}
+
+// Restarted GMRES, flexible or not, right-preconditioned, on r
+// right-hand sides in step.  A column leaves a cycle as soon as its
+// estimated residual converges, with its solution brought up to date;
+// the others restart together from their true residuals, and a column
+// stays only as long as its true residual has not converged.
+template <class T>
+__VDSP_NOCONTRACT SparseIterativeStatus_t sparse_gmres(const SparseGMRESOptions& o, const sparse_operator<T>& op,
+                                                        long r, const T* b, T* x)
+{
+    const long n = op.n, m = o.nvec > 0 ? o.nvec : 16;
+    const int limit = o.maxIterations > 0 ? o.maxIterations : 100;
+    const double rtol = sparse_rtol<T>(o.rtol);
+    const bool pre = (bool)op.precondition, flexible = pre && o.variant == SparseVariantFGMRES;
+    long k = r;
+    std::vector<T> xv(x, x + n * r), bv(b, b + n * r), w(n * r), vv((m + 1) * n * r), zv(flexible ? m * n * r : 0);
+    std::vector<T> a(r);
+    T *X = xv.data(), *B = bv.data(), *W = w.data();
+    auto V = [&](long i) { return vv.data() + i * n * r; };
+    auto Z = [&](long i) { return zv.data() + i * n * r; };
+    std::vector<double> norm(r), tol(r), d(r);
+    std::vector<long> map(r);
+    std::iota(map.begin(), map.end(), 0L);
+    std::vector<char> dead(r, 0);
+    bool failed = false;
+    double first = 0;
+    int it = 0;
+    for (bool start = true;; start = false) {
+        sparse_residual(op, k, B, X, W, norm.data());
+        if (start)
+            for (long t = 0; t < k; t++)
+                tol[t] = rtol * norm[t] + o.atol;
+        std::vector<long> keep;
+        for (long t = 0; t < k; t++)
+            if (norm[t] > tol[t] && !dead[t]) {
+                keep.push_back(t);
+            } else {
+                failed = failed || dead[t];
+                sparse_put(x, r, map[t], X, k, t, n);
+            }
+        if (k && !map[0])
+            first = norm[0];
+        if ((long)keep.size() < k) {
+            for (T* block : { X, B, W })
+                sparse_narrow(block, n, k, keep);
+            sparse_narrow(norm, 1, keep);
+            sparse_narrow(tol, 1, keep);
+            sparse_narrow(map, 1, keep);
+            sparse_narrow(dead, 1, keep);
+            k = (long)keep.size();
+        }
+        if (k == 0 || it >= limit)
+            break;
+        // A cycle over the c columns of cycle, columns of the k above.
+        long c = k;
+        std::vector<long> cycle(k);
+        std::iota(cycle.begin(), cycle.end(), 0L);
+        std::vector<double> h(c * (m + 1) * m), cs(c * m), sn(c * m), g(c * (m + 1), 0.0), next(c);
+        auto H = [&](long t, long i, long j) -> double& { return h[(t * m + j) * (m + 1) + i]; };
+        for (long i = 0; i < n; i++)
+            for (long t = 0; t < c; t++)
+                V(0)[i * c + t] = W[i * c + t] / (T)norm[t];
+        for (long t = 0; t < c; t++)
+            g[t * (m + 1)] = norm[t];
+        // Brings the solutions of the columns listed up to date with
+        // their first steps[t] steps.
+        auto finish = [&](const std::vector<long>& list, const std::vector<long>& steps) {
+            const long f = (long)list.size();
+            if (!f)
+                return;
+            std::vector<T> u(n * f, T(0)), mu;
+            for (long q = 0; q < f; q++) {
+                const long t = list[q], s = steps[q];
+                double* y = &g[t * (m + 1)];
+                for (long i = s - 1; i >= 0; i--) {
+                    for (long j = i + 1; j < s; j++)
+                        y[i] -= H(t, i, j) * y[j];
+                    y[i] /= H(t, i, i);
+                }
+                for (long l = 0; l < s; l++) {
+                    const T* base = flexible ? Z(l) : V(l);
+                    for (long i = 0; i < n; i++)
+                        u[i * f + q] += (T)y[l] * base[i * c + t];
+                }
+            }
+            if (pre && !flexible) {
+                mu.resize(n * f);
+                op.precondition(false, f, u.data(), mu.data());
+                u.swap(mu);
+            }
+            for (long q = 0; q < f; q++)
+                for (long i = 0; i < n; i++)
+                    X[i * k + cycle[list[q]]] += u[i * f + q];
+        };
+        long j = 0;
+        for (; j < m && it < limit && c > 0; j++, it++) {
+            sparse_progress(o.reportStatus, it, first);
+            const T* in = V(j);
+            if (pre) {
+                T* z = flexible ? Z(j) : W;
+                op.precondition(false, c, V(j), z);
+                in = z;
+            }
+            T* vn = V(j + 1);
+            op.multiply(false, false, c, in, vn);
+            for (long i = 0; i <= j; i++) {
+                sparse_dots(vn, V(i), n, c, d.data());
+                for (long t = 0; t < c; t++) {
+                    H(t, i, j) = d[t];
+                    a[t] = (T)-d[t];
+                }
+                sparse_axpys(vn, a.data(), V(i), n, c);
+            }
+            sparse_norms(vn, n, c, next.data());
+            sparse_divide(vn, next.data(), n, c);
+            std::vector<long> keep, done, steps;
+            for (long t = 0; t < c; t++) {
+                for (long i = 0; i < j; i++) {
+                    const double e = H(t, i, j), f = H(t, i + 1, j);
+                    H(t, i, j) = cs[t * m + i] * e + sn[t * m + i] * f;
+                    H(t, i + 1, j) = -sn[t * m + i] * e + cs[t * m + i] * f;
+                }
+                double hj;
+                sparse_rotation(H(t, j, j), next[t], cs[t * m + j], sn[t * m + j], hj);
+                H(t, j, j) = hj;
+                double* gt = &g[t * (m + 1)];
+                gt[j + 1] = -sn[t * m + j] * gt[j];
+                gt[j] = cs[t * m + j] * gt[j];
+                if (!cycle[t])
+                    first = fabs(gt[j + 1]);
+                if (hj == 0) {
+                    dead[cycle[t]] = 1;
+                    done.push_back(t);
+                    steps.push_back(j);
+                } else if (fabs(gt[j + 1]) <= tol[cycle[t]] || next[t] == 0) {
+                    done.push_back(t);
+                    steps.push_back(j + 1);
+                } else {
+                    keep.push_back(t);
+                }
+            }
+            finish(done, steps);
+            if ((long)keep.size() < c) {
+                for (long i = 0; i <= j + 1; i++)
+                    sparse_narrow(V(i), n, c, keep);
+                for (long i = 0; flexible && i <= j; i++)
+                    sparse_narrow(Z(i), n, c, keep);
+                sparse_narrow(h, (m + 1) * m, keep);
+                sparse_narrow(cs, m, keep);
+                sparse_narrow(sn, m, keep);
+                sparse_narrow(g, m + 1, keep);
+                sparse_narrow(cycle, 1, keep);
+                c = (long)keep.size();
+            }
+        }
+        std::vector<long> rest(c);
+        std::iota(rest.begin(), rest.end(), 0L);
+        finish(rest, std::vector<long>(c, j));
+    }
+    for (long t = 0; t < k; t++)
+        sparse_put(x, r, map[t], X, k, t, n);
+    if (failed)
+        return SparseIterativeIllConditioned;
+    return k == 0 ? SparseIterativeConverged : SparseIterativeMaxIterations;
+}
+
+// DQGMRES: GMRES orthogonalising each new vector against only the last
+// nvec, with the solution updated every step through as many direction
+// vectors, so that it never restarts.  Flexible.
+template <class T>
+__VDSP_NOCONTRACT SparseIterativeStatus_t sparse_dqgmres(const SparseGMRESOptions& o, const sparse_operator<T>& op,
+                                                          long r, const T* b, T* x)
+{
+    const long n = op.n, nv = o.nvec > 0 ? o.nvec : 16;
+    const int limit = o.maxIterations > 0 ? o.maxIterations : 100;
+    const double rtol = sparse_rtol<T>(o.rtol);
+    const bool pre = (bool)op.precondition;
+    long k = r;
+    std::vector<T> xv(x, x + n * r), vv((nv + 1) * n * r), pv(nv * n * r), zv(n * r), a(r);
+    T *X = xv.data(), *Z = zv.data();
+    auto V = [&](long i) { return vv.data() + (i % (nv + 1)) * n * r; };
+    auto P = [&](long i) { return pv.data() + (i % nv) * n * r; };
+    std::vector<double> cs(r * nv), sn(r * nv), gamma(r), norm(r), tol(r), h(r * (nv + 2)), d(r), hs(r), step(r);
+    std::vector<long> map(r);
+    std::iota(map.begin(), map.end(), 0L);
+    std::vector<char> dead(r, 0);
+    bool failed = false;
+    sparse_residual(op, k, b, X, V(0), norm.data());
+    for (long t = 0; t < r; t++) {
+        tol[t] = rtol * norm[t] + o.atol;
+        gamma[t] = norm[t];
+    }
+    sparse_divide(V(0), norm.data(), n, k);
+    double first = norm[0];
+    for (long s = 0;; s++) {
+        std::vector<long> keep;
+        for (long t = 0; t < k; t++)
+            if (norm[t] > tol[t] && !dead[t]) {
+                keep.push_back(t);
+            } else {
+                failed = failed || dead[t];
+                sparse_put(x, r, map[t], X, k, t, n);
+            }
+        if ((long)keep.size() < k) {
+            for (long i = 0; i <= nv; i++)
+                sparse_narrow(vv.data() + i * n * r, n, k, keep);
+            for (long i = 0; i < nv; i++)
+                sparse_narrow(pv.data() + i * n * r, n, k, keep);
+            sparse_narrow(X, n, k, keep);
+            for (std::vector<double>* v : { &cs, &sn })
+                sparse_narrow(*v, nv, keep);
+            for (std::vector<double>* v : { &gamma, &norm, &tol })
+                sparse_narrow(*v, 1, keep);
+            sparse_narrow(map, 1, keep);
+            sparse_narrow(dead, 1, keep);
+            k = (long)keep.size();
+        }
+        if (k && !map[0])
+            first = norm[0];
+        sparse_progress(o.reportStatus, (int)s, first);
+        if (k == 0 || s == limit)
+            break;
+        if (pre)
+            op.precondition(false, k, V(s), Z);
+        else
+            std::copy(V(s), V(s) + n * k, Z);
+        T* w = V(s + 1);
+        op.multiply(false, false, k, Z, w);
+        // h[t*(nv + 2) + i - lo] is row i of column s of the Hessenberg
+        // matrix of column t.
+        const long lo = std::max(0L, s - nv), ld = nv + 2;
+        std::fill(h.begin(), h.end(), 0.0);
+        for (long i = std::max(0L, s - nv + 1); i <= s; i++) {
+            sparse_dots(w, V(i), n, k, d.data());
+            for (long t = 0; t < k; t++) {
+                h[t * ld + i - lo] = d[t];
+                a[t] = (T)-d[t];
+            }
+            sparse_axpys(w, a.data(), V(i), n, k);
+        }
+        sparse_norms(w, n, k, d.data());
+        sparse_divide(w, d.data(), n, k);
+        for (long t = 0; t < k; t++) {
+            double* ht = &h[t * ld];
+            ht[s + 1 - lo] = d[t];
+            for (long i = lo; i < s; i++) {
+                const double e = ht[i - lo], f = ht[i + 1 - lo], ci = cs[t * nv + i % nv], si = sn[t * nv + i % nv];
+                ht[i - lo] = ci * e + si * f;
+                ht[i + 1 - lo] = -si * e + ci * f;
+            }
+            double cc, ss;
+            sparse_rotation(ht[s - lo], d[t], cc, ss, hs[t]);
+            // A column that breaks down takes no step, and leaves.
+            dead[t] = hs[t] == 0;
+            if (dead[t]) {
+                hs[t] = 1;
+                step[t] = 0;
+                continue;
+            }
+            cs[t * nv + s % nv] = cc;
+            sn[t * nv + s % nv] = ss;
+            step[t] = cc * gamma[t];
+            gamma[t] = -ss * gamma[t];
+            norm[t] = fabs(gamma[t]);
+        }
+        // p_s = (z - sum h_i p_i) / h_s, built in z, for p_s takes the
+        // place of p_(s - nv).
+        for (long i = lo; i < s; i++) {
+            for (long t = 0; t < k; t++)
+                a[t] = (T)-h[t * ld + i - lo];
+            sparse_axpys(Z, a.data(), P(i), n, k);
+        }
+        sparse_divide(Z, hs.data(), n, k);
+        std::copy(Z, Z + n * k, P(s));
+        for (long t = 0; t < k; t++)
+            a[t] = (T)step[t];
+        sparse_axpys(X, a.data(), P(s), n, k);
+    }
+    for (long t = 0; t < k; t++)
+        sparse_put(x, r, map[t], X, k, t, n);
+    if (failed)
+        return SparseIterativeIllConditioned;
+    return k == 0 ? SparseIterativeConverged : SparseIterativeMaxIterations;
+}
+
+// The plane rotation of LSMR: c*a + s*b = h, -s*a + c*b = 0.
+inline void sparse_sym_ortho(double a, double b, double& c, double& s, double& h)
+{
+    if (b == 0) {
+        c = a < 0 ? -1 : 1;
+        s = 0;
+        h = fabs(a);
+    } else if (a == 0) {
+        c = 0;
+        s = b < 0 ? -1 : 1;
+        h = fabs(b);
+    } else if (fabs(b) > fabs(a)) {
+        const double t = a / b;
+        s = (b < 0 ? -1 : 1) / sqrt(1 + t * t);
+        c = s * t;
+        h = b / s;
+    } else {
+        const double t = b / a;
+        c = (a < 0 ? -1 : 1) / sqrt(1 + t * t);
+        s = c * t;
+        h = a / c;
+    }
+}
+
+// The scalars of LSMR for one right-hand side.
+struct sparse_lsmr_state {
+    double alpha, beta, alphabar, zetabar, rho, rhobar, cbar, sbar, zeta;
+    double betadd, betad, rhodold, tautildeold, thetatilde, d;
+    double normA2, maxrbar, minrbar, normb, normar0;
+};
+
+// LSMR of Fong and Saunders, right-preconditioned, on r right-hand sides
+// in step: min || b - A*M*y || with x = x0 + M*y.  Each step takes one
+// product with A and one with A' for all the columns still going.
+template <class T>
+__VDSP_NOCONTRACT SparseIterativeStatus_t sparse_lsmr(const SparseLSMROptions& o, const sparse_operator<T>& op,
+                                                       long r, const T* b, T* x)
+{
+    const long m = op.m, n = op.n;
+    const int limit = o.maxIterations > 0 ? o.maxIterations : (int)std::min<long>(4 * n, INT_MAX);
+    const double eps = std::numeric_limits<T>::epsilon(), damp = o.lambda;
+    const bool fong = o.convergenceTest == SparseLSMRCTFongSaunders, pre = (bool)op.precondition;
+    const double rtol = sparse_rtol<T>(o.rtol), atol = fong && o.atol == 0 ? eps : o.atol;
+    const double btol = o.btol == 0 ? eps : o.btol, conlim = o.conditionLimit == 0 ? 1 / eps : o.conditionLimit;
+    long k = r;
+    std::vector<T> xv(x, x + n * r), uv(m * r), vv(n * r), hv(n * r), hbar(n * r, T(0)), yv(n * r, T(0)), tv(n * r);
+    std::vector<T> old(n * r), fh(r), fy(r), fv(r);
+    T *X = xv.data(), *U = uv.data(), *V = vv.data(), *Hv = hv.data(), *Hb = hbar.data(), *Y = yv.data();
+    T* Tm = tv.data();
+    std::vector<sparse_lsmr_state> st(r);
+    std::vector<double> d(r), e(r), cond(r);
+    std::vector<long> map(r);
+    std::iota(map.begin(), map.end(), 0L);
+    std::vector<char> going(r);
+    // V = M'*A'*U, by way of Tm.
+    auto back = [&]() {
+        op.multiply(false, true, k, U, pre ? Tm : V);
+        if (pre)
+            op.precondition(true, k, Tm, V);
+    };
+    sparse_residual(op, k, b, X, U, d.data());
+    sparse_divide(U, d.data(), m, k);
+    back();
+    sparse_norms(V, n, k, e.data());
+    sparse_divide(V, e.data(), n, k);
+    for (long t = 0; t < r; t++) {
+        sparse_lsmr_state& s = st[t];
+        s.beta = d[t];
+        s.alpha = e[t];
+        s.alphabar = s.alpha;
+        s.zetabar = s.alpha * s.beta;
+        s.rho = s.rhobar = s.cbar = 1;
+        s.sbar = s.zeta = 0;
+        s.betadd = s.beta;
+        s.betad = 0;
+        s.rhodold = 1;
+        s.tautildeold = s.thetatilde = s.d = 0;
+        s.normA2 = s.alpha * s.alpha;
+        s.maxrbar = 0;
+        s.minrbar = 1e100;
+        s.normb = s.beta;
+        s.normar0 = s.alpha * s.beta;
+        going[t] = s.normar0 != 0;
+    }
+    std::copy(V, V + n * r, Hv);
+    // Columns leave with x = x0 + M*y.
+    auto retire = [&](const std::vector<long>& done) {
+        const long f = (long)done.size();
+        std::vector<T> yd(n * f), my(pre ? n * f : 0);
+        for (long i = 0; i < n; i++)
+            for (long q = 0; q < f; q++)
+                yd[i * f + q] = Y[i * k + done[q]];
+        if (pre)
+            op.precondition(false, f, yd.data(), my.data());
+        const T* c = pre ? my.data() : yd.data();
+        for (long q = 0; q < f; q++)
+            for (long i = 0; i < n; i++)
+                x[i * r + map[done[q]]] = X[i * k + done[q]] + c[i * f + q];
+    };
+    double first = fabs(st[0].zetabar);
+    for (int it = 0;; it++) {
+        std::vector<long> keep, done;
+        for (long t = 0; t < k; t++)
+            (going[t] ? keep : done).push_back(t);
+        if (!done.empty()) {
+            retire(done);
+            for (T* block : { X, V, Hv, Hb, Y })
+                sparse_narrow(block, n, k, keep);
+            sparse_narrow(U, m, k, keep);
+            sparse_narrow(st, 1, keep);
+            sparse_narrow(map, 1, keep);
+            sparse_narrow(going, 1, keep);
+            k = (long)keep.size();
+        }
+        if (k && !map[0])
+            first = fabs(st[0].zetabar);
+        sparse_progress(o.reportStatus, it, first);
+        if (k == 0)
+            break;
+        if (it == limit) {
+            std::vector<long> all(k);
+            std::iota(all.begin(), all.end(), 0L);
+            retire(all);
+            break;
+        }
+        // u = A*M*v - alpha*u
+        for (long i = 0; i < m; i++)
+            for (long t = 0; t < k; t++)
+                U[i * k + t] *= (T)-st[t].alpha;
+        if (pre)
+            op.precondition(false, k, V, Tm);
+        op.multiply(true, false, k, pre ? Tm : V, U);
+        sparse_norms(U, m, k, d.data());
+        sparse_divide(U, d.data(), m, k);
+        // v = M'*A'*u - beta*v, where beta is not zero.
+        std::copy(V, V + n * k, old.data());
+        back();
+        for (long t = 0; t < k; t++) {
+            st[t].beta = d[t];
+            fv[t] = (T)-d[t];
+        }
+        sparse_axpys(V, fv.data(), old.data(), n, k);
+        for (long i = 0; i < n; i++)
+            for (long t = 0; t < k; t++)
+                if (st[t].beta == 0)
+                    V[i * k + t] = old[i * k + t];
+        sparse_norms(V, n, k, e.data());
+        for (long t = 0; t < k; t++)
+            if (st[t].beta == 0)
+                e[t] = 0;
+        sparse_divide(V, e.data(), n, k);
+        for (long t = 0; t < k; t++) {
+            sparse_lsmr_state& s = st[t];
+            if (s.beta != 0)
+                s.alpha = e[t];
+            double chat, shat, alphahat, c1, s1;
+            sparse_sym_ortho(s.alphabar, damp, chat, shat, alphahat);
+            const double rhoold = s.rho;
+            sparse_sym_ortho(alphahat, s.beta, c1, s1, s.rho);
+            const double thetanew = s1 * s.alpha;
+            s.alphabar = c1 * s.alpha;
+            const double rhobarold = s.rhobar, zetaold = s.zeta, thetabar = s.sbar * s.rho, rhotemp = s.cbar * s.rho;
+            sparse_sym_ortho(s.cbar * s.rho, thetanew, s.cbar, s.sbar, s.rhobar);
+            s.zeta = s.cbar * s.zetabar;
+            s.zetabar = -s.sbar * s.zetabar;
+            fh[t] = (T)(thetabar * s.rho / (rhoold * rhobarold));
+            fy[t] = (T)(s.zeta / (s.rho * s.rhobar));
+            fv[t] = (T)(thetanew / s.rho);
+            // Estimates of ||r|| and ||A||, and of cond(A).
+            const double betaacute = chat * s.betadd, betacheck = -shat * s.betadd;
+            const double betahat = c1 * betaacute;
+            s.betadd = -s1 * betaacute;
+            const double thetatildeold = s.thetatilde;
+            double ctildeold, stildeold, rhotildeold;
+            sparse_sym_ortho(s.rhodold, thetabar, ctildeold, stildeold, rhotildeold);
+            s.thetatilde = stildeold * s.rhobar;
+            s.rhodold = ctildeold * s.rhobar;
+            s.betad = -stildeold * s.betad + ctildeold * betahat;
+            s.tautildeold = (zetaold - thetatildeold * s.tautildeold) / rhotildeold;
+            const double taud = (s.zeta - s.thetatilde * s.tautildeold) / s.rhodold;
+            s.d += betacheck * betacheck;
+            d[t] = sqrt(s.d + (s.betad - taud) * (s.betad - taud) + s.betadd * s.betadd);
+            s.normA2 += s.beta * s.beta;
+            e[t] = sqrt(s.normA2);
+            s.normA2 += s.alpha * s.alpha;
+            s.maxrbar = std::max(s.maxrbar, rhobarold);
+            if (it > 0)
+                s.minrbar = std::min(s.minrbar, rhobarold);
+            cond[t] = std::max(s.maxrbar, rhotemp) / std::min(s.minrbar, rhotemp);
+        }
+        for (long i = 0; i < n; i++)
+            for (long t = 0; t < k; t++) {
+                T& hb = Hb[i * k + t];
+                T& h = Hv[i * k + t];
+                hb = h - fh[t] * hb;
+                Y[i * k + t] += fy[t] * hb;
+                h = V[i * k + t] - fv[t] * h;
+            }
+        std::vector<double> normx(k);
+        if (fong)
+            sparse_norms(Y, n, k, normx.data());
+        for (long t = 0; t < k; t++) {
+            const sparse_lsmr_state& s = st[t];
+            const double normr = d[t], normA = e[t], normar = fabs(s.zetabar);
+            bool stop;
+            if (fong) {
+                const double condA = cond[t];
+                const double test1 = normr / s.normb, test2 = normr > 0 ? normar / (normA * normr) : 0,
+                             test3 = 1 / condA, t1 = test1 / (1 + normA * normx[t] / s.normb);
+                stop = 1 + test3 <= 1 || 1 + test2 <= 1 || 1 + t1 <= 1 || test3 <= 1 / conlim || test2 <= atol ||
+                       test1 <= btol + atol * normA * normx[t] / s.normb;
+            } else {
+                stop = normar <= rtol * s.normar0 + atol;
+            }
+            going[t] = !stop && s.alpha * s.beta != 0;
+        }
+    }
+    return k == 0 ? SparseIterativeConverged : SparseIterativeMaxIterations;
+}
+
+// The method that SparseBlockConjugateGradient() returns.
+const int sparse_method_block_cg = 16;
+
+template <class T>
+inline SparseIterativeStatus_t sparse_iterative_entry(const SparseIterativeMethod& method, const sparse_operator<T>& op,
+                                                      const lapack_matrix<T>& b, long bm, long br,
+                                                      const lapack_matrix<T>& x, long xn, long xr)
+{
+    void (*report)(const char*) = method.options.base.reportError;
+    if (op.m <= 0 || op.n <= 0) {
+        sparse_error(report, "Bad matrix dimensions %ldx%ld\n", op.m, op.n);
+        return SparseIterativeParameterError;
+    }
+    if (xr != br) {
+        sparse_error(report, "Dimensions of X (%ldx%ld) and B (%ldx%ld) do not match.\n", xn, xr, bm, br);
+        return SparseIterativeParameterError;
+    }
+    if (xn != op.n || bm != op.m) {
+        sparse_error(report, "Dimensions of A (%ldx%ld), X (%ldx%ld) and B (%ldx%ld) do not match.\n", op.m, op.n, xn,
+                     xr, bm, br);
+        return SparseIterativeParameterError;
+    }
+    if (method.method != _SparseMethodLSMR && op.m != op.n) {
+        sparse_error(report, "CG and GMRES need a square matrix, not %ldx%ld.\n", op.m, op.n);
+        return SparseIterativeParameterError;
+    }
+    switch (method.method) {
+    case _SparseMethodCG:
+    case sparse_method_block_cg:
+    case _SparseMethodGMRES:
+    case _SparseMethodLSMR:
+        break;
+    default:
+        sparse_error(report, "Unknown iterative method %d.\n", method.method);
+        return SparseIterativeParameterError;
+    }
+    // The columns go as many at a time as keep eight of their vectors
+    // within 2MB, about L2, in groups of equal width: past that a batch
+    // streams from memory what one column at a time finds in cache.
+    // Block CG shares its search space among all of them and takes them
+    // whole.  Columns do not depend on each other, so the grouping does
+    // not change their bits.
+    const long m = op.m, n = op.n, r = br;
+    long w = r;
+    if (r > 0 && method.method != sparse_method_block_cg) {
+        const long most = std::max<long>(1, 2097152 / (8 * std::max(m, n) * (long)sizeof(T))),
+                   steps = (r + most - 1) / most;
+        w = (r + steps - 1) / steps;
+    }
+    std::vector<T> bp(m * w), xp(n * w);
+    SparseIterativeStatus_t status = SparseIterativeConverged;
+    for (long c0 = 0; c0 < r; c0 += w) {
+        const long k = std::min(w, r - c0);
+        for (long i = 0; i < m; i++)
+            for (long j = 0; j < k; j++)
+                bp[i * k + j] = b(i, c0 + j);
+        for (long i = 0; i < n; i++)
+            for (long j = 0; j < k; j++)
+                xp[i * k + j] = x(i, c0 + j);
+        SparseIterativeStatus_t s;
+        if (method.method == _SparseMethodCG)
+            s = sparse_cg<T>(method.options.cg, op, k, bp.data(), xp.data());
+        else if (method.method == sparse_method_block_cg)
+            s = sparse_block_cg<T>(method.options.cg, op, k, bp.data(), xp.data());
+        else if (method.method == _SparseMethodLSMR)
+            s = sparse_lsmr<T>(method.options.lsmr, op, k, bp.data(), xp.data());
+        else if (method.options.gmres.variant == SparseVariantDQGMRES)
+            s = sparse_dqgmres<T>(method.options.gmres, op, k, bp.data(), xp.data());
+        else
+            s = sparse_gmres<T>(method.options.gmres, op, k, bp.data(), xp.data());
+        for (long i = 0; i < n; i++)
+            for (long j = 0; j < k; j++)
+                x(i, c0 + j) = xp[i * k + j];
+        if (s != SparseIterativeConverged && (status == SparseIterativeConverged || s < status))
+            status = s;
+    }
+    return status;
+}
+
+template <class T>
+inline SparseIterativeStatus_t sparse_iterative_dense(const SparseIterativeMethod& method, const sparse_operator<T>& op,
+                                                      const typename sparse_types<T>::dense& b,
+                                                      const typename sparse_types<T>::dense& x)
+{
+    return sparse_iterative_entry<T>(method, op, sparse_view<T>(b), b.attributes.transpose ? b.columnCount : b.rowCount,
+                                     b.attributes.transpose ? b.rowCount : b.columnCount, sparse_view<T>(x),
+                                     x.attributes.transpose ? x.columnCount : x.rowCount,
+                                     x.attributes.transpose ? x.rowCount : x.columnCount);
+}
+
+template <class T>
+inline SparseIterativeStatus_t sparse_iterative_vector(const SparseIterativeMethod& method, const sparse_operator<T>& op,
+                                                       const typename sparse_types<T>::vector& b,
+                                                       const typename sparse_types<T>::vector& x)
+{
+    return sparse_iterative_entry<T>(method, op, lapack_matrix<T>{ b.data, 1, b.count }, b.count, 1,
+                                     lapack_matrix<T>{ x.data, 1, x.count }, x.count, 1);
+}
+
+template <class T>
+inline SparseIterativeStatus_t sparse_iterative_created(const SparseIterativeMethod& method,
+                                                        const typename sparse_types<T>::matrix& a,
+                                                        SparsePreconditioner_t type,
+                                                        const typename sparse_types<T>::dense* b,
+                                                        const typename sparse_types<T>::dense* x,
+                                                        const typename sparse_types<T>::vector* bv,
+                                                        const typename sparse_types<T>::vector* xv)
+{
+    if (type != SparsePreconditionerDiagonal && type != SparsePreconditionerDiagScaling) {
+        sparse_error(method.options.base.reportError,
+                     "Invalid preconditioner type for this call: for no preconditioner, omit the parameter. "
+                     "User-supplied preconditioners must supply apply() method.\n");
+        return SparseIterativeParameterError;
+    }
+    typename sparse_types<T>::preconditioner p = sparse_create_preconditioner<T>(type, a);
+    if (p.type == SparsePreconditionerNone)
+        return SparseIterativeInternalError;
+    sparse_operator<T> op = sparse_matrix_operator<T>(a);
+    sparse_set_preconditioner<T>(op, p);
+    const SparseIterativeStatus_t status =
+        b ? sparse_iterative_dense<T>(method, op, *b, *x) : sparse_iterative_vector<T>(method, op, *bv, *xv);
+    delete (sparse_diagonal<T>*)p.mem;
+    return status;
+}
+
+// The bytes of state ahead of the vectors: count doubles, padded to 16.
+inline size_t sparse_state_head(long count)
+{
+    return (size_t)((count * (long)sizeof(double) + 15) & ~15L);
+}
+
+// The vectors GMRES keeps for SparseIterate().
+inline long sparse_gmres_window(const SparseGMRESOptions& o)
+{
+    return o.nvec > 0 ? o.nvec : 16;
+}
+
+// The state of SparseIterate(), its blocks n x nrhs interleaved after
+// the scalars.  CG: r*z for each column, then the residuals, the search
+// directions, and A times them.  GMRES: gamma and the cosines and sines
+// of the last nvec rotations of each column, then nvec + 1 basis
+// vectors, nvec direction vectors and M*v.  LSMR: the scalars of each
+// column and its last theta/rho, then u, m x nrhs, and v, M*h, M*hbar and
+// two more for the products.
+template <class T>
+inline size_t sparse_state_size(const SparseIterativeMethod& method, long m, long n, long r)
+{
+    const long w = sparse_gmres_window(method.options.gmres);
+    switch (method.method) {
+    case _SparseMethodCG:
+        return sparse_state_head(r) + 3 * (size_t)(n * r) * sizeof(T);
+    case _SparseMethodGMRES:
+        return sparse_state_head(r * (2 * w + 1)) + (size_t)((2 * w + 2) * n * r) * sizeof(T);
+    case _SparseMethodLSMR:
+        return sparse_state_head(r * (long)(sizeof(sparse_lsmr_state) / sizeof(double) + 1)) +
+               (size_t)((m + 5 * n) * r) * sizeof(T);
+    case sparse_method_block_cg:
+        sparse_error(method.options.base.reportError, "SparseIterate() has no step for block CG.\n");
+        return 0;
+    default:
+        sparse_error(method.options.base.reportError, "Unknown iterative method %d.\n", method.method);
+        return 0;
+    }
+}
+
+// One step of CG for the columns not converged; the converged ones are
+// left as they are.
+template <class T>
+__VDSP_NOCONTRACT void sparse_iterate_cg(int iteration, const bool* converged, void* state,
+                                         const sparse_operator<T>& op, const lapack_matrix<T>& rv,
+                                         const lapack_matrix<T>& xv, long r)
+{
+    const long n = op.n;
+    double* rz = (double*)state;
+    T* R = (T*)((char*)state + sparse_state_head(r));
+    T *P = R + n * r, *Q = P + n * r;
+    std::vector<T> a(r);
+    std::vector<double> d(r);
+    // Z = M*R, in Q, and the directions P = Z + beta*P.
+    auto directions = [&](bool start) {
+        const T* z = R;
+        if (op.precondition) {
+            op.precondition(false, r, R, Q);
+            z = Q;
+        }
+        sparse_dots(R, z, n, r, d.data());
+        for (long c = 0; c < r; c++)
+            if (!converged[c]) {
+                a[c] = start ? T(0) : (T)(d[c] / rz[c]);
+                rz[c] = d[c];
+            }
+        for (long i = 0; i < n; i++)
+            for (long c = 0; c < r; c++)
+                if (!converged[c])
+                    P[i * r + c] = z[i * r + c] + a[c] * P[i * r + c];
+    };
+    if (iteration == 0) {
+        for (long i = 0; i < n; i++)
+            for (long c = 0; c < r; c++)
+                R[i * r + c] = rv(i, c);
+        std::fill(P, P + n * r, T(0));
+        directions(true);
+    }
+    op.multiply(false, false, r, P, Q);
+    sparse_dots(P, Q, n, r, d.data());
+    for (long c = 0; c < r; c++)
+        a[c] = converged[c] || !(d[c] > 0) ? T(0) : (T)(rz[c] / d[c]);
+    for (long i = 0; i < n; i++)
+        for (long c = 0; c < r; c++)
+            xv(i, c) += a[c] * P[i * r + c];
+    for (long c = 0; c < r; c++)
+        a[c] = -a[c];
+    sparse_axpys(R, a.data(), Q, n, r);
+    directions(false);
+    sparse_norms(R, n, r, d.data());
+    for (long c = 0; c < r; c++)
+        if (!converged[c])
+            rv(0, c) = (T)d[c];
+}
+
+// One step of GMRES, taken as DQGMRES takes it: the step adds a direction
+// vector p = (M*v - sum h*p) / h to the last nvec, and x moves along it,
+// so that X is current after every step.  DQGMRES orthogonalises each v
+// against the last nvec and never restarts; GMRES and FGMRES against all
+// since the last restart, which comes every nvec steps from the true
+// residual.  The preconditioner does not change from step to step, so
+// FGMRES steps as GMRES does.
+template <class T>
+__VDSP_NOCONTRACT void sparse_iterate_gmres(const SparseGMRESOptions& o, int iteration, const bool* converged,
+                                            void* state, const sparse_operator<T>& op, const lapack_matrix<T>& bv,
+                                            const lapack_matrix<T>& rv, const lapack_matrix<T>& xv, long r)
+{
+    const long n = op.n, nv = sparse_gmres_window(o);
+    const long s = o.variant == SparseVariantDQGMRES ? iteration : iteration % nv;
+    double *gamma = (double*)state, *cs = gamma + r, *sn = cs + r * nv;
+    T* base = (T*)((char*)state + sparse_state_head(r * (2 * nv + 1)));
+    auto V = [&](long i) { return base + (i % (nv + 1)) * n * r; };
+    auto P = [&](long i) { return base + (nv + 1 + i % nv) * n * r; };
+    T* Z = base + (2 * nv + 1) * n * r;
+    std::vector<T> a(r);
+    std::vector<double> h(r * (nv + 2)), d(r), hs(r), step(r);
+    if (s == 0) {
+        T* v = V(0);
+        if (iteration == 0) {
+            for (long i = 0; i < n; i++)
+                for (long c = 0; c < r; c++)
+                    v[i * r + c] = rv(i, c);
+        } else {
+            for (long i = 0; i < n; i++)
+                for (long c = 0; c < r; c++)
+                    Z[i * r + c] = xv(i, c);
+            op.multiply(false, false, r, Z, v);
+            for (long i = 0; i < n; i++)
+                for (long c = 0; c < r; c++)
+                    v[i * r + c] = bv(i, c) - v[i * r + c];
+        }
+        sparse_norms(v, n, r, gamma);
+        sparse_divide(v, gamma, n, r);
+    }
+    if (op.precondition)
+        op.precondition(false, r, V(s), Z);
+    else
+        std::copy(V(s), V(s) + n * r, Z);
+    T* w = V(s + 1);
+    op.multiply(false, false, r, Z, w);
+    const long lo = std::max(0L, s - nv), ld = nv + 2;
+    for (long i = std::max(0L, s - nv + 1); i <= s; i++) {
+        sparse_dots(w, V(i), n, r, d.data());
+        for (long t = 0; t < r; t++) {
+            h[t * ld + i - lo] = d[t];
+            a[t] = (T)-d[t];
+        }
+        sparse_axpys(w, a.data(), V(i), n, r);
+    }
+    sparse_norms(w, n, r, d.data());
+    sparse_divide(w, d.data(), n, r);
+    for (long t = 0; t < r; t++) {
+        double* ht = &h[t * ld];
+        ht[s + 1 - lo] = d[t];
+        for (long i = lo; i < s; i++) {
+            const double e = ht[i - lo], f = ht[i + 1 - lo], ci = cs[t * nv + i % nv], si = sn[t * nv + i % nv];
+            ht[i - lo] = ci * e + si * f;
+            ht[i + 1 - lo] = -si * e + ci * f;
+        }
+        double& cc = cs[t * nv + s % nv];
+        double& ss = sn[t * nv + s % nv];
+        sparse_rotation(ht[s - lo], d[t], cc, ss, hs[t]);
+        // A column that breaks down takes no step.
+        if (hs[t] == 0) {
+            hs[t] = 1;
+            step[t] = 0;
+            continue;
+        }
+        step[t] = cc * gamma[t];
+        gamma[t] = -ss * gamma[t];
+    }
+    for (long i = lo; i < s; i++) {
+        for (long t = 0; t < r; t++)
+            a[t] = (T)-h[t * ld + i - lo];
+        sparse_axpys(Z, a.data(), P(i), n, r);
+    }
+    sparse_divide(Z, hs.data(), n, r);
+    std::copy(Z, Z + n * r, P(s));
+    for (long i = 0; i < n; i++)
+        for (long c = 0; c < r; c++)
+            if (!converged[c])
+                xv(i, c) += (T)step[c] * Z[i * r + c];
+    for (long c = 0; c < r; c++)
+        if (!converged[c])
+            rv(0, c) = (T)fabs(gamma[c]);
+}
+
+// One step of LSMR.  Where sparse_lsmr() keeps h and hbar and brings x
+// up to date with M*y as columns leave, this keeps M*h and M*hbar, from
+// the M*v that the product with A takes anyway, and moves X every step.
+template <class T>
+__VDSP_NOCONTRACT void sparse_iterate_lsmr(const SparseLSMROptions& o, int iteration, const bool* converged,
+                                           void* state, const sparse_operator<T>& op, const lapack_matrix<T>& rv,
+                                           const lapack_matrix<T>& xv, long r)
+{
+    const long m = op.m, n = op.n;
+    const double damp = o.lambda;
+    const bool pre = (bool)op.precondition;
+    sparse_lsmr_state* st = (sparse_lsmr_state*)state;
+    double* fvold = (double*)(st + r);
+    T* U = (T*)((char*)state + sparse_state_head(r * (long)(sizeof(sparse_lsmr_state) / sizeof(double) + 1)));
+    T *V = U + m * r, *Mh = V + n * r, *Mhb = Mh + n * r, *W = Mhb + n * r, *W2 = W + n * r;
+    std::vector<T> fh(r), fy(r);
+    std::vector<double> d(r), e(r), cond(r);
+    // to = M'*A'*U, by way of W2.
+    auto back = [&](T* to) {
+        op.multiply(false, true, r, U, pre ? W2 : to);
+        if (pre)
+            op.precondition(true, r, W2, to);
+    };
+    if (iteration == 0) {
+        for (long i = 0; i < m; i++)
+            for (long c = 0; c < r; c++)
+                U[i * r + c] = rv(i, c);
+        sparse_norms(U, m, r, d.data());
+        sparse_divide(U, d.data(), m, r);
+        back(V);
+        sparse_norms(V, n, r, e.data());
+        sparse_divide(V, e.data(), n, r);
+        for (long t = 0; t < r; t++) {
+            sparse_lsmr_state& s = st[t];
+            s.beta = d[t];
+            s.alpha = e[t];
+            s.alphabar = s.alpha;
+            s.zetabar = s.alpha * s.beta;
+            s.rho = s.rhobar = s.cbar = 1;
+            s.sbar = s.zeta = 0;
+            s.betadd = s.beta;
+            s.betad = 0;
+            s.rhodold = 1;
+            s.tautildeold = s.thetatilde = s.d = 0;
+            s.normA2 = s.alpha * s.alpha;
+            s.maxrbar = 0;
+            s.minrbar = 1e100;
+            s.normb = s.beta;
+            s.normar0 = s.alpha * s.beta;
+            fvold[t] = 0;
+        }
+        std::fill(Mh, Mh + n * r, T(0));
+        std::fill(Mhb, Mhb + n * r, T(0));
+    }
+    // M*h = M*v - theta/rho*M*h, for the h of this step; then
+    // u = A*M*v - alpha*u.
+    const T* mv = V;
+    if (pre) {
+        op.precondition(false, r, V, W);
+        mv = W;
+    }
+    for (long i = 0; i < n; i++)
+        for (long t = 0; t < r; t++)
+            Mh[i * r + t] = mv[i * r + t] - (T)fvold[t] * Mh[i * r + t];
+    for (long i = 0; i < m; i++)
+        for (long t = 0; t < r; t++)
+            U[i * r + t] *= (T)-st[t].alpha;
+    op.multiply(true, false, r, mv, U);
+    sparse_norms(U, m, r, d.data());
+    sparse_divide(U, d.data(), m, r);
+    // v = M'*A'*u - beta*v, where beta is not zero.
+    back(W);
+    for (long t = 0; t < r; t++)
+        st[t].beta = d[t];
+    for (long i = 0; i < n; i++)
+        for (long t = 0; t < r; t++)
+            if (st[t].beta != 0)
+                V[i * r + t] = W[i * r + t] - (T)st[t].beta * V[i * r + t];
+    sparse_norms(V, n, r, e.data());
+    for (long t = 0; t < r; t++)
+        if (st[t].beta == 0)
+            e[t] = 0;
+    sparse_divide(V, e.data(), n, r);
+    for (long t = 0; t < r; t++) {
+        sparse_lsmr_state& s = st[t];
+        if (s.beta != 0)
+            s.alpha = e[t];
+        double chat, shat, alphahat, c1, s1;
+        sparse_sym_ortho(s.alphabar, damp, chat, shat, alphahat);
+        const double rhoold = s.rho;
+        sparse_sym_ortho(alphahat, s.beta, c1, s1, s.rho);
+        const double thetanew = s1 * s.alpha;
+        s.alphabar = c1 * s.alpha;
+        const double rhobarold = s.rhobar, zetaold = s.zeta, thetabar = s.sbar * s.rho, rhotemp = s.cbar * s.rho;
+        sparse_sym_ortho(s.cbar * s.rho, thetanew, s.cbar, s.sbar, s.rhobar);
+        s.zeta = s.cbar * s.zetabar;
+        s.zetabar = -s.sbar * s.zetabar;
+        fh[t] = (T)(thetabar * s.rho / (rhoold * rhobarold));
+        fy[t] = converged[t] ? T(0) : (T)(s.zeta / (s.rho * s.rhobar));
+        fvold[t] = thetanew / s.rho;
+        const double betaacute = chat * s.betadd, betacheck = -shat * s.betadd;
+        const double betahat = c1 * betaacute;
+        s.betadd = -s1 * betaacute;
+        const double thetatildeold = s.thetatilde;
+        double ctildeold, stildeold, rhotildeold;
+        sparse_sym_ortho(s.rhodold, thetabar, ctildeold, stildeold, rhotildeold);
+        s.thetatilde = stildeold * s.rhobar;
+        s.rhodold = ctildeold * s.rhobar;
+        s.betad = -stildeold * s.betad + ctildeold * betahat;
+        s.tautildeold = (zetaold - thetatildeold * s.tautildeold) / rhotildeold;
+        const double taud = (s.zeta - s.thetatilde * s.tautildeold) / s.rhodold;
+        s.d += betacheck * betacheck;
+        d[t] = sqrt(s.d + (s.betad - taud) * (s.betad - taud) + s.betadd * s.betadd);
+        s.normA2 += s.beta * s.beta;
+        e[t] = sqrt(s.normA2);
+        s.normA2 += s.alpha * s.alpha;
+        s.maxrbar = std::max(s.maxrbar, rhobarold);
+        if (iteration > 0)
+            s.minrbar = std::min(s.minrbar, rhobarold);
+        cond[t] = std::max(s.maxrbar, rhotemp) / std::min(s.minrbar, rhotemp);
+    }
+    for (long i = 0; i < n; i++)
+        for (long t = 0; t < r; t++) {
+            T& hb = Mhb[i * r + t];
+            hb = Mh[i * r + t] - fh[t] * hb;
+            xv(i, t) += fy[t] * hb;
+        }
+    // ||A'r||, ||r||, ||A|| and cond(A), as many as R has rows for.
+    for (long c = 0; c < r; c++)
+        if (!converged[c]) {
+            const double out[4] = { fabs(st[c].zetabar), d[c], e[c], cond[c] };
+            for (long i = 0; i < std::min(m, 4L); i++)
+                rv(i, c) = (T)out[i];
+        }
+}
+
+// One step of the method for the columns not converged.  X is current
+// after every step, so a call with iteration < 0 only returns the true
+// residuals B - A*X.  Block CG has no step here: R becomes NaN, so that a
+// caller's loop on the residuals ends rather than spins.
+template <class T>
+__VDSP_NOCONTRACT void sparse_iterate(const SparseIterativeMethod& method, int iteration, const bool* converged,
+                                      void* state, const sparse_operator<T>& op,
+                                      const typename sparse_types<T>::dense& b,
+                                      const typename sparse_types<T>::dense& rd,
+                                      const typename sparse_types<T>::dense& xd)
+{
+    const long m = op.m, n = op.n, r = xd.attributes.transpose ? xd.rowCount : xd.columnCount;
+    const lapack_matrix<T> bv = sparse_view<T>(b), rv = sparse_view<T>(rd), xv = sparse_view<T>(xd);
+    if (!sparse_state_size<T>(method, m, n, 1)) {
+        const long rm = rd.attributes.transpose ? rd.columnCount : rd.rowCount,
+                   rn = rd.attributes.transpose ? rd.rowCount : rd.columnCount;
+        for (long c = 0; c < rn; c++)
+            for (long i = 0; i < rm; i++)
+                rv(i, c) = std::numeric_limits<T>::quiet_NaN();
+        return;
+    }
+    if (iteration < 0) {
+        std::vector<T> xs(n * r), ax(m * r);
+        for (long i = 0; i < n; i++)
+            for (long c = 0; c < r; c++)
+                xs[i * r + c] = xv(i, c);
+        op.multiply(false, false, r, xs.data(), ax.data());
+        for (long i = 0; i < m; i++)
+            for (long c = 0; c < r; c++)
+                rv(i, c) = bv(i, c) - ax[i * r + c];
+        return;
+    }
+    if (method.method == _SparseMethodCG)
+        sparse_iterate_cg<T>(iteration, converged, state, op, rv, xv, r);
+    else if (method.method == _SparseMethodGMRES)
+        sparse_iterate_gmres<T>(method.options.gmres, iteration, converged, state, op, bv, rv, xv, r);
+    else
+        sparse_iterate_lsmr<T>(method.options.lsmr, iteration, converged, state, op, rv, xv, r);
+}
+
+// SparseConvertFromCoordinate, into storage laid out as Solve.h lays it:
+// columnStarts, rowIndices, then data on a 16 byte boundary.  The entries
+// are sorted by column and by row within each, in two stable counting
+// sorts, so that duplicates meet and sum in the order given.
+template <class T>
+inline typename sparse_types<T>::matrix sparse_from_coordinate(int rowCount, int columnCount, long blockCount,
+                                                               uint8_t blockSize, SparseAttributes_t attributes,
+                                                               const int* row, const int* column, const T* data,
+                                                               char* storage)
+{
+    const long bs = blockSize, bb = bs * bs;
+    const SparseKind_t kind = attributes.kind;
+    const bool lower = attributes.triangle == SparseLowerTriangle;
+    std::vector<int> ri, ci;
+    std::vector<long> from, count(std::max(rowCount, columnCount) + 1), order;
+    std::vector<bool> flipped;
+    for (long q = 0; q < blockCount; q++) {
+        long i = row[q], j = column[q];
+        if (i < 0 || i >= rowCount || j < 0 || j >= columnCount)
+            continue;
+        const bool wrong = kind != SparseOrdinary && (lower ? i < j : i > j);
+        if (wrong && kind != SparseSymmetric)
+            continue;
+        if (wrong)
+            std::swap(i, j);
+        ri.push_back((int)i);
+        ci.push_back((int)j);
+        from.push_back(q);
+        flipped.push_back(wrong);
+    }
+    const long e = (long)ri.size();
+    std::vector<long> byRow(e);
+    order.resize(e);
+    for (long q = 0; q < e; q++)
+        count[ri[q] + 1]++;
+    std::partial_sum(count.begin(), count.end(), count.begin());
+    for (long q = 0; q < e; q++)
+        byRow[count[ri[q]]++] = q;
+    std::fill(count.begin(), count.end(), 0);
+    for (long q = 0; q < e; q++)
+        count[ci[q] + 1]++;
+    std::partial_sum(count.begin(), count.end(), count.begin());
+    for (long q : byRow)
+        order[count[ci[q]]++] = q;
+
+    typename sparse_types<T>::matrix a = {};
+    long* starts = (long*)storage;
+    int* indices = (int*)(starts + columnCount + 1);
+    T* values = (T*)(((uintptr_t)(indices + e) + 15) & ~(uintptr_t)15);
+    long out = -1;
+    std::fill(starts, starts + columnCount + 1, 0);
+    for (long k = 0; k < e; k++) {
+        const long q = order[k];
+        const bool same = out >= 0 && indices[out] == ri[q] && (k == 0 || ci[order[k - 1]] == ci[q]);
+        if (!same) {
+            indices[++out] = ri[q];
+            starts[ci[q] + 1]++;
+            std::fill(values + out * bb, values + (out + 1) * bb, T(0));
+        }
+        const T* b = data + from[q] * bb;
+        T* v = values + out * bb;
+        for (long c = 0; c < bs; c++)
+            for (long r = 0; r < bs; r++)
+                v[r + c * bs] += flipped[q] ? b[c + r * bs] : b[r + c * bs];
+    }
+    std::partial_sum(starts, starts + columnCount + 1, starts);
+    a.structure.rowCount = rowCount;
+    a.structure.columnCount = columnCount;
+    a.structure.columnStarts = starts;
+    a.structure.rowIndices = indices;
+    a.structure.attributes = attributes;
+    a.structure.attributes._allocatedBySparse = false;
+    a.structure.blockSize = blockSize;
+    a.data = values;
+    return a;
+}
+
+// Bytes of storage SparseConvertFromCoordinate asks for.
+template <class T>
+inline size_t sparse_coordinate_size(int columnCount, long blockCount, uint8_t blockSize)
+{
+    return 48 + (columnCount + 1) * sizeof(long) + blockCount * sizeof(int) +
+           blockCount * blockSize * blockSize * sizeof(T);
+}
+
+template <class T>
+inline bool sparse_coordinate_check(int rowCount, int columnCount, long blockCount, SparseAttributes_t attributes)
+{
+    if (rowCount < 0)
+        sparse_error(nullptr, "rowCount (%d) must be non-negative.\n", rowCount);
+    else if (columnCount < 0)
+        sparse_error(nullptr, "columnCount (%d) must be non-negative.\n", columnCount);
+    else if (blockCount < 0)
+        sparse_error(nullptr, "blockCount (%ld) must be non-negative.\n", blockCount);
+    else if (attributes.kind != SparseOrdinary && rowCount != columnCount)
+        sparse_error(nullptr, "attributes.kind must be SparseOrdinary if matrix is not square.\n");
+    else
+        return true;
+    return false;
+}
+
+// SparseFormattedMatrix: op(A) laid out for SIMD.
+//
+// SELL-C-sigma sorts the rows by length, longest first, within windows
+// of sigma rows, and cuts them into chunks of C, C values making 64
+// bytes: one AVX-512 vector, two AVX2 ones or four SSE or NEON ones.  A
+// chunk holds the first entries of its rows side by side, then the
+// second, and so on, padded to its longest row, so that a vector of
+// rows takes one entry each at a time; the entries past the chunk's
+// shortest row are summed one row at a time, and the padding never
+// read.  sigma is the narrowest window, in powers of four times C, that
+// pads within 5% of sorting all the rows at once.  Blocked CSR holds
+// block rows of r x r dense blocks, each by columns, for matrices made
+// of them: A's own blocks, or blocks found in its rows.
+//
+// Each row of y sums its entries in the order of their columns, a lane
+// to a row, so that neither the instruction set nor the number of
+// threads changes a bit of it; a format may differ from another in the
+// last bits.  The padding of blocked CSR is skipped against an x that is
+// Inf or NaN, so that no format makes a NaN that A's own entries do not.
+// The products are y = alpha*(A*x) and y += alpha*(A*x).
+template <class T>
+struct sparse_formatted {
+    SparseFormat_t format;
+    long m, n, height, width;
+    // CSC: A.  SELL: chunk c in slots starts[c] to starts[c+1], of rows
+    // row[c*C + l] with length[c*C + l] entries, row -1 past the last.
+    // Blocked CSR: block row b of blocks starts[b] to starts[b+1], in
+    // block columns indices[], their values in values[p*r*r], and
+    // filled[] true for those that hold an entry of A, not padding, or
+    // empty if every one does.
+    std::vector<long> starts;
+    std::vector<int> indices, row, length;
+    std::vector<T> values;
+    std::vector<bool> filled;
+    SparseMatrixStructure structure;
+};
+
+// The rows of op(A) in scalars, each in the order of its columns: the
+// entries sparse_multiply uses, the stored triangle of a symmetric
+// matrix mirrored and a unit diagonal made explicit.
+template <class T>
+struct sparse_csr {
+    long m, n;
+    std::vector<long> start;
+    std::vector<int> column;
+    std::vector<T> value;
+};
+
+template <class T>
+inline sparse_csr<T> sparse_expand(const SparseMatrixStructure& s, const T* data)
+{
+    const long bs = s.blockSize, bb = bs * bs;
+    const SparseKind_t kind = s.attributes.kind;
+    const bool ordinary = kind == SparseOrdinary, lower = s.attributes.triangle == SparseLowerTriangle;
+    const bool trans = s.attributes.transpose;
+    sparse_csr<T> a;
+    a.m = sparse_rows(s, false);
+    a.n = sparse_rows(s, true);
+    // Each entry (u, v, e) of op(A) goes to f, in the order of A's columns.
+    auto visit = [&](auto&& f) {
+        for (long j = 0; j < s.columnCount; j++)
+            for (long p = s.columnStarts[j]; p < s.columnStarts[j + 1]; p++) {
+                const long i = s.rowIndices[p];
+                if (!ordinary && !sparse_stored(s, i, j))
+                    continue;
+                for (long c = 0; c < bs; c++)
+                    for (long r = 0; r < bs; r++) {
+                        const long u = i * bs + r, v = j * bs + c;
+                        if ((!ordinary && i == j && (lower ? r < c : r > c)) ||
+                            (kind == SparseUnitTriangular && u == v))
+                            continue;
+                        const T e = data[p * bb + r + c * bs];
+                        if (kind == SparseSymmetric) {
+                            f(u, v, e);
+                            if (u != v)
+                                f(v, u, e);
+                        } else if (trans) {
+                            f(v, u, e);
+                        } else {
+                            f(u, v, e);
+                        }
+                    }
+            }
+        if (kind == SparseUnitTriangular)
+            for (long u = 0; u < a.m; u++)
+                f(u, u, T(1));
+    };
+    // Rows in the order visited already run in the order of their
+    // columns when A's rows do in each column; any other is sorted.
+    a.start.assign(a.m + 1, 0);
+    visit([&](long u, long, T) { a.start[u + 1]++; });
+    std::partial_sum(a.start.begin(), a.start.end(), a.start.begin());
+    std::vector<long> at(a.start.begin(), a.start.end() - 1);
+    a.column.resize(a.start[a.m]);
+    a.value.resize(a.start[a.m]);
+    visit([&](long u, long v, T e) {
+        a.column[at[u]] = (int)v;
+        a.value[at[u]++] = e;
+    });
+    std::vector<std::pair<int, T>> entries;
+    for (long u = 0; u < a.m; u++) {
+        const long p0 = a.start[u], p1 = a.start[u + 1];
+        if (std::is_sorted(a.column.begin() + p0, a.column.begin() + p1))
+            continue;
+        entries.clear();
+        for (long p = p0; p < p1; p++)
+            entries.emplace_back(a.column[p], a.value[p]);
+        std::stable_sort(entries.begin(), entries.end(),
+                         [](const std::pair<int, T>& x, const std::pair<int, T>& y) { return x.first < y.first; });
+        for (long p = p0; p < p1; p++) {
+            a.column[p] = entries[p - p0].first;
+            a.value[p] = entries[p - p0].second;
+        }
+    }
+    return a;
+}
+
+template <class T>
+constexpr long sparse_chunk_height()
+{
+    return 64 / sizeof(T);
+}
+
+// The rows of a in the order of SELL-C-sigma, and the slots they take.
+template <class T>
+inline long sparse_sell_order(const sparse_csr<T>& a, long sigma, std::vector<int>& row)
+{
+    const long C = sparse_chunk_height<T>();
+    auto length = [&](long i) { return a.start[i + 1] - a.start[i]; };
+    row.resize(a.m);
+    std::iota(row.begin(), row.end(), 0);
+    for (long w = 0; w < a.m; w += sigma)
+        std::stable_sort(row.begin() + w, row.begin() + std::min(a.m, w + sigma),
+                         [&](int p, int q) { return length(p) > length(q); });
+    long slots = 0;
+    for (long c = 0; c < a.m; c += C)
+        slots += C * length(row[c]);
+    return slots;
+}
+
+// The slots of SELL-C-sigma with all the rows sorted at once, the
+// fewest it takes, from the counts of rows of each length.
+template <class T>
+inline long sparse_sell_slots(const sparse_csr<T>& a, long C)
+{
+    long longest = 0;
+    for (long i = 0; i < a.m; i++)
+        longest = std::max(longest, a.start[i + 1] - a.start[i]);
+    std::vector<long> count(longest + 1, 0);
+    for (long i = 0; i < a.m; i++)
+        count[a.start[i + 1] - a.start[i]]++;
+    long slots = 0, seen = 0;
+    for (long l = longest; l >= 0; l--) {
+        // Rows seen to seen + count[l] - 1 have length l; those at
+        // multiples of C head chunks.
+        const long heads = (seen + count[l] + C - 1) / C - (seen + C - 1) / C;
+        slots += heads * C * l;
+        seen += count[l];
+    }
+    return slots;
+}
+
+template <class T>
+inline void sparse_build_sell(const sparse_csr<T>& a, sparse_formatted<T>& f)
+{
+    const long C = sparse_chunk_height<T>(), chunks = (a.m + C - 1) / C;
+    std::vector<int> order;
+    const long best = sparse_sell_slots(a, C);
+    long sigma = C;
+    while (sparse_sell_order(a, sigma, order) > best + best / 20 && sigma < a.m)
+        sigma *= 4;
+    f.format = SparseFormatSELL;
+    f.height = C;
+    f.width = sigma;
+    f.row.assign(chunks * C, -1);
+    f.length.assign(chunks * C, 0);
+    f.starts.assign(chunks + 1, 0);
+    for (long q = 0; q < a.m; q++) {
+        f.row[q] = order[q];
+        f.length[q] = (int)(a.start[order[q] + 1] - a.start[order[q]]);
+    }
+    for (long c = 0; c < chunks; c++)
+        f.starts[c + 1] = f.starts[c] + C * f.length[c * C];
+    f.indices.assign(f.starts[chunks], 0);
+    f.values.assign(f.starts[chunks], T(0));
+    for (long c = 0; c < chunks; c++)
+        for (long l = 0; l < C; l++) {
+            const long i = f.row[c * C + l];
+            for (long j = 0; j < f.length[c * C + l]; j++) {
+                f.indices[f.starts[c] + j * C + l] = a.column[a.start[i] + j];
+                f.values[f.starts[c] + j * C + l] = a.value[a.start[i] + j];
+            }
+        }
+}
+
+// The r x r blocks that cover every step-th block row of a, counted, or
+// with f, built, step then being 1.
+template <class T>
+inline long sparse_build_blocks(const sparse_csr<T>& a, long r, sparse_formatted<T>* f, long step = 1)
+{
+    const long rows = (a.m + r - 1) / r, columns = (a.n + r - 1) / r;
+    std::vector<long> slot(columns, -1);
+    std::vector<int> touched;
+    long blocks = 0;
+    if (f) {
+        f->format = SparseFormatBlockedCSR;
+        f->height = f->width = r;
+        f->starts.assign(rows + 1, 0);
+        f->indices.clear();
+        f->values.clear();
+        f->filled.clear();
+    }
+    for (long b = 0; b < rows; b += step) {
+        touched.clear();
+        for (long i = b * r; i < std::min(a.m, (b + 1) * r); i++)
+            for (long p = a.start[i]; p < a.start[i + 1]; p++) {
+                const int c = a.column[p] / (int)r;
+                if (slot[c] < 0) {
+                    slot[c] = 0;
+                    touched.push_back(c);
+                }
+            }
+        blocks += (long)touched.size();
+        if (f) {
+            std::sort(touched.begin(), touched.end());
+            for (int c : touched) {
+                slot[c] = (long)f->indices.size();
+                f->indices.push_back(c);
+            }
+            f->starts[b + 1] = (long)f->indices.size();
+            f->values.resize(f->indices.size() * r * r, T(0));
+            f->filled.resize(f->values.size(), false);
+            for (long i = b * r; i < std::min(a.m, (b + 1) * r); i++)
+                for (long p = a.start[i]; p < a.start[i + 1]; p++) {
+                    const long c = a.column[p] / r, e = (slot[c] * r + a.column[p] - c * r) * r + i - b * r;
+                    f->values[e] += a.value[p];
+                    f->filled[e] = true;
+                }
+        }
+        for (int c : touched)
+            slot[c] = -1;
+    }
+    if (f && std::find(f->filled.begin(), f->filled.end(), false) == f->filled.end())
+        f->filled.clear();
+    return blocks;
+}
+
+// The side of blocks, 2, 3 or 4, that holds a in the fewest bytes, and
+// those bytes.  Large matrices are judged by the fill of a sample of
+// block rows, every 16th, scaled by the entries the sample covers.
+template <class T>
+inline long sparse_block_side(const sparse_csr<T>& a, double& bytes)
+{
+    const long entries = a.start[a.m];
+    long side = 0;
+    for (long r = 2; r <= 4; r++) {
+        const long step = a.m >= 1024 * r ? 16 : 1;
+        long sampled = 0;
+        for (long b = 0; b * r < a.m; b += step)
+            sampled += a.start[std::min(a.m, (b + 1) * r)] - a.start[b * r];
+        const double blocks = sampled ? (double)sparse_build_blocks<T>(a, r, nullptr, step) * entries / sampled : 0;
+        const double b = blocks * (r * r * sizeof(T) + sizeof(int));
+        if (!side || b < bytes) {
+            bytes = b;
+            side = r;
+        }
+    }
+    return side;
+}
+
+// The format SparseFormatAutomatic picks, by the bytes of matrix each
+// streams: A's own blocks when it has them; else the blocks that hold
+// its rows in the fewest bytes, if fewer than the rows of SELL take,
+// padding included; and CSC when the rows are too short or too few for
+// a vector of them to pay.
+template <class T>
+inline SparseFormat_t sparse_choose_format(const SparseMatrixStructure& s, const sparse_csr<T>& a, long& side)
+{
+    side = s.blockSize;
+    if (side > 1)
+        return SparseFormatBlockedCSR;
+    const long C = sparse_chunk_height<T>();
+    if (a.m < C || a.start[a.m] < 2 * a.m)
+        return SparseFormatCSC;
+    const double sell = (double)sparse_sell_slots(a, C) * (sizeof(T) + sizeof(int));
+    double blocked;
+    side = sparse_block_side(a, blocked);
+    return blocked < sell ? SparseFormatBlockedCSR : SparseFormatSELL;
+}
+
+template <class T>
+inline typename sparse_types<T>::formatted sparse_convert_format(SparseFormat_t format,
+                                                                 const typename sparse_types<T>::matrix& a)
+{
+    typename sparse_types<T>::formatted result = {};
+    if (format < SparseFormatAutomatic || format > SparseFormatBlockedCSR) {
+        sparse_error(nullptr, "Unknown format %d.\n", (int)format);
+        return result;
+    }
+    const SparseMatrixStructure& s = a.structure;
+    sparse_formatted<T>* f = new sparse_formatted<T>();
+    f->m = sparse_rows(s, false);
+    f->n = sparse_rows(s, true);
+    long side = s.blockSize;
+    if (format != SparseFormatCSC) {
+        const sparse_csr<T> rows = sparse_expand<T>(s, a.data);
+        if (format == SparseFormatAutomatic)
+            format = sparse_choose_format<T>(s, rows, side);
+        if (format == SparseFormatSELL)
+            sparse_build_sell<T>(rows, *f);
+        else if (format == SparseFormatBlockedCSR) {
+            double bytes;
+            sparse_build_blocks<T>(rows, side > 1 ? side : sparse_block_side(rows, bytes), f);
+        }
+    }
+    if (format == SparseFormatCSC) {
+        const long e = s.columnStarts[s.columnCount];
+        f->format = SparseFormatCSC;
+        f->height = f->width = s.blockSize;
+        f->starts.assign(s.columnStarts, s.columnStarts + s.columnCount + 1);
+        f->indices.assign(s.rowIndices, s.rowIndices + e);
+        f->values.assign(a.data, a.data + e * s.blockSize * s.blockSize);
+        f->structure = s;
+        f->structure.columnStarts = f->starts.data();
+        f->structure.rowIndices = f->indices.data();
+    }
+    result.format = f->format;
+    result.rowCount = (int)f->m;
+    result.columnCount = (int)f->n;
+    result.height = (int)f->height;
+    result.width = (int)f->width;
+    result.valueCount = (long)f->values.size();
+    result.storage = f;
+    return result;
+}
+
+// One product of a SELL or blocked CSR matrix, over chunks or block rows
+// first to last.
+template <class T>
+struct sparse_product {
+    const sparse_formatted<T>* f;
+    const T* x;
+    T* y;
+    T alpha;
+    bool accumulate, finite;
+    long first, last;
+};
+
+template <class T>
+__VDSP_INLINE void sparse_row_result(const sparse_product<T>& k, long i, T sum)
+{
+    k.y[i] = k.accumulate ? k.y[i] + k.alpha * sum : k.alpha * sum;
+}
+
+template <class T, int B>
+__VDSP_INLINE void sparse_sell_kernel(const sparse_product<T>& k)
+{
+    __VDSP_EXACT
+    typedef typename simd<T, B>::vector V;
+    constexpr long w = simd<T, B>::width, C = sparse_chunk_height<T>(), v = C / w;
+    const sparse_formatted<T>& f = *k.f;
+    for (long c = k.first; c < k.last; c++) {
+        const T* a = f.values.data() + f.starts[c];
+        const int* col = f.indices.data() + f.starts[c];
+        const int* length = f.length.data() + c * C;
+        const long whole = length[C - 1];
+        V acc[v];
+#pragma GCC unroll 8
+        for (long l = 0; l < v; l++)
+            acc[l] = V{};
+        for (long j = 0; j < whole; j++, a += C, col += C)
+#pragma GCC unroll 8
+            for (long l = 0; l < v; l++) {
+                V e, x;
+#pragma GCC unroll 16
+                for (long q = 0; q < w; q++)
+                    x[q] = k.x[col[l * w + q]];
+                load<true>(e, a + l * w, 1);
+                acc[l] = acc[l] + e * x;
+            }
+        T sum[C];
+        memcpy(sum, acc, sizeof(sum));
+        for (long l = 0; l < C && f.row[c * C + l] >= 0; l++) {
+            for (long j = 0; j < length[l] - whole; j++)
+                sum[l] = sum[l] + a[j * C + l] * k.x[col[j * C + l]];
+            sparse_row_result(k, f.row[c * C + l], sum[l]);
+        }
+    }
+}
+
+// Block rows of R x R blocks, R of 0 for f.height.
+template <class T, long R>
+__VDSP_INLINE void sparse_blocks_kernel(const sparse_product<T>& k)
+{
+    __VDSP_EXACT
+    const sparse_formatted<T>& f = *k.f;
+    const long r = R ? R : f.height;
+    T sum[R ? R : 255];
+    for (long b = k.first; b < k.last; b++) {
+        for (long i = 0; i < r; i++)
+            sum[i] = 0;
+        for (long p = f.starts[b]; p < f.starts[b + 1]; p++) {
+            const T* a = f.values.data() + p * r * r;
+            const long j0 = (long)f.indices[p] * r, span = std::min(r, f.n - j0);
+            for (long j = 0; j < span; j++) {
+                const T x = k.x[j0 + j];
+#pragma GCC unroll 4
+                for (long i = 0; i < r; i++)
+                    sum[i] = sum[i] + a[j * r + i] * x;
+            }
+        }
+        for (long i = 0, h = std::min(r, f.m - b * r); i < h; i++)
+            sparse_row_result(k, b * r + i, sum[i]);
+    }
+}
+
+// Block rows with the padding left out, for an x that is Inf or NaN
+// somewhere: 0 times either is NaN, which A's own entries do not make.
+template <class T>
+__VDSP_NOCONTRACT void sparse_blocks_filled(const sparse_product<T>& k)
+{
+    const sparse_formatted<T>& f = *k.f;
+    const long r = f.height;
+    T sum[255];
+    for (long b = k.first; b < k.last; b++) {
+        for (long i = 0; i < r; i++)
+            sum[i] = 0;
+        for (long p = f.starts[b]; p < f.starts[b + 1]; p++) {
+            const T* a = f.values.data() + p * r * r;
+            const long j0 = (long)f.indices[p] * r, span = std::min(r, f.n - j0);
+            for (long j = 0; j < span; j++)
+                for (long i = 0; i < r; i++)
+                    if (f.filled[(p * r + j) * r + i])
+                        sum[i] = sum[i] + a[j * r + i] * k.x[j0 + j];
+        }
+        for (long i = 0, h = std::min(r, f.m - b * r); i < h; i++)
+            sparse_row_result(k, b * r + i, sum[i]);
+    }
+}
+
+template <int B, class T>
+__VDSP_INLINE void sparse_run(const sparse_product<T>& k)
+{
+    if (k.f->format == SparseFormatSELL)
+        return sparse_sell_kernel<T, B>(k);
+    if (!k.finite)
+        return sparse_blocks_filled(k);
+    switch (k.f->height) {
+    case 2:
+        return sparse_blocks_kernel<T, 2>(k);
+    case 3:
+        return sparse_blocks_kernel<T, 3>(k);
+    case 4:
+        return sparse_blocks_kernel<T, 4>(k);
+    default:
+        return sparse_blocks_kernel<T, 0>(k);
+    }
+}
+
+template <class T>
+__VDSP_NOCONTRACT void sparse_run_baseline(const sparse_product<T>& k) { sparse_run<16>(k); }
+
+#if defined(__VDSP_X86_DISPATCH)
+template <class T>
+__attribute__((target("avx2"))) __VDSP_NOCONTRACT void sparse_run_avx2(const sparse_product<T>& k) { sparse_run<32>(k); }
+
+template <class T>
+__attribute__((target("avx512f"))) __VDSP_NOCONTRACT void sparse_run_avx512(const sparse_product<T>& k) { sparse_run<64>(k); }
+#endif
+
+template <class T>
+inline void sparse_dispatch(const sparse_product<T>& k)
+{
+    switch ((isa)active().load(std::memory_order_relaxed)) {
+#if defined(__VDSP_X86_DISPATCH)
+    case isa::avx512:
+        return sparse_run_avx512(k);
+    case isa::avx2:
+        return sparse_run_avx2(k);
+#endif
+    default:
+        return sparse_run_baseline(k);
+    }
+}
+
+// y = alpha*(A*x), or y += it, split into pieces of whole chunks or
+// block rows for the threads.
+template <class T>
+inline void sparse_product_run(const sparse_formatted<T>& f, T alpha, bool accumulate, const T* x, T* y)
+{
+    const long units = (long)f.starts.size() - 1;
+    const long pieces = blas_pieces((double)f.values.size(), units);
+    // Padding meets an Inf or NaN of x only if x has one.
+    bool finite = true;
+    if (!f.filled.empty())
+        for (long j = 0; j < f.n; j++)
+            finite &= x[j] - x[j] == 0;
+    sparse_product<T> k = { &f, x, y, alpha, accumulate, finite, 0, units };
+    if (pieces == 1)
+        return sparse_dispatch(k);
+    const long size = (units + pieces - 1) / pieces;
+    blas_pool::shared().run((units + size - 1) / size, (int)pieces, [&](long t) {
+        sparse_product<T> s = k;
+        s.first = t * size;
+        s.last = std::min(units, s.first + size);
+        sparse_dispatch(s);
+    });
+}
+
+template <class T>
+inline void sparse_formatted_entry(const typename sparse_types<T>::formatted& a, T alpha, bool accumulate,
+                                   const typename sparse_types<T>::dense& x, const typename sparse_types<T>::dense& y)
+{
+    if (!a.storage)
+        return sparse_error(nullptr, "A does not hold a formatted matrix.\n");
+    const sparse_formatted<T>& f = *(const sparse_formatted<T>*)a.storage;
+    if (f.format == SparseFormatCSC)
+        return sparse_multiply_entry<T>(typename sparse_types<T>::matrix{ f.structure, (T*)f.values.data() }, alpha,
+                                        accumulate, x, y);
+    const long xn = x.attributes.transpose ? x.columnCount : x.rowCount;
+    const long xr = x.attributes.transpose ? x.rowCount : x.columnCount;
+    const long ym = y.attributes.transpose ? y.columnCount : y.rowCount;
+    const long yr = y.attributes.transpose ? y.rowCount : y.columnCount;
+    if (xn != f.n || ym != f.m || xr != yr)
+        return sparse_error(nullptr, "Dimensions of A (%ldx%ld), X (%ldx%ld) and Y (%ldx%ld) do not match.\n", f.m,
+                            f.n, xn, xr, ym, yr);
+    const lapack_matrix<T> xv = sparse_view<T>(x), yv = sparse_view<T>(y);
+    std::vector<T> xb, yb;
+    for (long q = 0; q < xr; q++) {
+        const T* xq = xv.p + q * xv.sj;
+        T* yq = yv.p + q * yv.sj;
+        if (xv.si != 1) {
+            xb.resize(f.n);
+            for (long i = 0; i < f.n; i++)
+                xb[i] = xv(i, q);
+            xq = xb.data();
+        }
+        if (yv.si != 1) {
+            yb.resize(f.m);
+            for (long i = 0; accumulate && i < f.m; i++)
+                yb[i] = yv(i, q);
+            yq = yb.data();
+        }
+        sparse_product_run<T>(f, alpha, accumulate, xq, yq);
+        if (yv.si != 1)
+            for (long i = 0; i < f.m; i++)
+                yv(i, q) = yb[i];
+    }
+}
+
+} // namespace detail
+
+inline SparseIterativeMethod SparseConjugateGradient(SparseCGOptions __options)
+{
+    SparseIterativeMethod method = {};
+    method.method = _SparseMethodCG;
+    method.options.cg = __options;
+    return method;
+}
+
+inline SparseIterativeMethod SparseConjugateGradient(void)
+{
+    return SparseConjugateGradient(SparseCGOptions{});
+}
+
+// Block CG: all right-hand sides search one shared Krylov space; not in
+// the Apple interface.  Takes the options of CG.
+inline SparseIterativeMethod SparseBlockConjugateGradient(SparseCGOptions __options)
+{
+    SparseIterativeMethod method = {};
+    method.method = detail::sparse_method_block_cg;
+    method.options.cg = __options;
+    return method;
+}
+
+inline SparseIterativeMethod SparseBlockConjugateGradient(void)
+{
+    return SparseBlockConjugateGradient(SparseCGOptions{});
+}
+
+inline SparseIterativeMethod SparseGMRES(SparseGMRESOptions __options)
+{
+    SparseIterativeMethod method = {};
+    method.method = _SparseMethodGMRES;
+    method.options.gmres = __options;
+    return method;
+}
+
+inline SparseIterativeMethod SparseGMRES(void)
+{
+    return SparseGMRES(SparseGMRESOptions{});
+}
+
+// nvec is ignored: LSMR keeps no more vectors however many it is given.
+inline SparseIterativeMethod SparseLSMR(SparseLSMROptions __options)
+{
+    SparseIterativeMethod method = {};
+    method.method = _SparseMethodLSMR;
+    method.options.lsmr = __options;
+    return method;
+}
+
+inline SparseIterativeMethod SparseLSMR(void)
+{
+    return SparseLSMR(SparseLSMROptions{});
+}
+
+inline void SparseMultiply(SparseMatrix_Double __A, DenseMatrix_Double __X, DenseMatrix_Double __Y)
+{
+    detail::sparse_multiply_entry<double>(__A, 1, false, __X, __Y);
+}
+
+inline void SparseMultiply(double __alpha, SparseMatrix_Double __A, DenseMatrix_Double __X, DenseMatrix_Double __Y)
+{
+    detail::sparse_multiply_entry<double>(__A, __alpha, false, __X, __Y);
+}
+
+inline void SparseMultiplyAdd(SparseMatrix_Double __A, DenseMatrix_Double __X, DenseMatrix_Double __Y)
+{
+    detail::sparse_multiply_entry<double>(__A, 1, true, __X, __Y);
+}
+
+inline void SparseMultiplyAdd(double __alpha, SparseMatrix_Double __A, DenseMatrix_Double __X, DenseMatrix_Double __Y)
+{
+    detail::sparse_multiply_entry<double>(__A, __alpha, true, __X, __Y);
+}
+
+inline void SparseMultiply(SparseMatrix_Double __A, DenseVector_Double __x, DenseVector_Double __y)
+{
+    SparseMultiply(__A, DenseMatrix_Double{ __x.count, 1, __x.count, {}, __x.data }, DenseMatrix_Double{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiply(double __alpha, SparseMatrix_Double __A, DenseVector_Double __x, DenseVector_Double __y)
+{
+    SparseMultiply(__alpha, __A, DenseMatrix_Double{ __x.count, 1, __x.count, {}, __x.data },
+                   DenseMatrix_Double{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiplyAdd(SparseMatrix_Double __A, DenseVector_Double __x, DenseVector_Double __y)
+{
+    SparseMultiplyAdd(__A, DenseMatrix_Double{ __x.count, 1, __x.count, {}, __x.data },
+                      DenseMatrix_Double{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiplyAdd(double __alpha, SparseMatrix_Double __A, DenseVector_Double __x, DenseVector_Double __y)
+{
+    SparseMultiplyAdd(__alpha, __A, DenseMatrix_Double{ __x.count, 1, __x.count, {}, __x.data },
+                      DenseMatrix_Double{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline SparseMatrix_Double SparseGetTranspose(SparseMatrix_Double __A)
+{
+    __A.structure.attributes.transpose = !__A.structure.attributes.transpose;
+    return __A;
+}
+
+inline SparseOpaquePreconditioner_Double SparseCreatePreconditioner(SparsePreconditioner_t __type, SparseMatrix_Double __A)
+{
+    return detail::sparse_create_preconditioner<double>(__type, __A);
+}
+
+inline void SparseCleanup(SparseOpaquePreconditioner_Double __Opaque)
+{
+    if (__Opaque.apply == &detail::sparse_diagonal_apply<double>)
+        delete (detail::sparse_diagonal<double>*)__Opaque.mem;
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Double __A, DenseMatrix_Double __B, DenseMatrix_Double __X)
+{
+    return detail::sparse_iterative_dense<double>(__method, detail::sparse_matrix_operator<double>(__A), __B, __X);
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Double __A, DenseVector_Double __b, DenseVector_Double __x)
+{
+    return detail::sparse_iterative_vector<double>(__method, detail::sparse_matrix_operator<double>(__A), __b, __x);
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Double __A, DenseMatrix_Double __B, DenseMatrix_Double __X,
+                                           SparsePreconditioner_t __Preconditioner)
+{
+    return detail::sparse_iterative_created<double>(__method, __A, __Preconditioner, &__B, &__X, nullptr, nullptr);
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Double __A, DenseVector_Double __b, DenseVector_Double __x,
+                                           SparsePreconditioner_t __Preconditioner)
+{
+    return detail::sparse_iterative_created<double>(__method, __A, __Preconditioner, nullptr, nullptr, &__b, &__x);
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Double __A, DenseMatrix_Double __B, DenseMatrix_Double __X,
+                                           SparseOpaquePreconditioner_Double __Preconditioner)
+{
+    detail::sparse_operator<double> op = detail::sparse_matrix_operator<double>(__A);
+    detail::sparse_set_preconditioner<double>(op, __Preconditioner);
+    return detail::sparse_iterative_dense<double>(__method, op, __B, __X);
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Double __A, DenseVector_Double __b, DenseVector_Double __x,
+                                           SparseOpaquePreconditioner_Double __Preconditioner)
+{
+    detail::sparse_operator<double> op = detail::sparse_matrix_operator<double>(__A);
+    detail::sparse_set_preconditioner<double>(op, __Preconditioner);
+    return detail::sparse_iterative_vector<double>(__method, op, __b, __x);
+}
+
+// The operator forms: ApplyOperator(accumulate, trans, X, Y) sets Y, or
+// adds to it when accumulate, op(A)*X for A of the size of B by X.
+inline SparseIterativeStatus_t SparseSolve(
+    SparseIterativeMethod __method,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseMatrix_Double __X, DenseMatrix_Double __Y)> __ApplyOperator,
+    DenseMatrix_Double __B, DenseMatrix_Double __X)
+{
+    const long m = __B.attributes.transpose ? __B.columnCount : __B.rowCount;
+    const long n = __X.attributes.transpose ? __X.columnCount : __X.rowCount;
+    return detail::sparse_iterative_dense<double>(__method, detail::sparse_callback_operator<double>(m, n, __ApplyOperator),
+                                               __B, __X);
+}
+
+inline SparseIterativeStatus_t SparseSolve(
+    SparseIterativeMethod __method,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseVector_Double __x, DenseVector_Double __y)> __ApplyOperator,
+    DenseVector_Double __b, DenseVector_Double __x)
+{
+    return detail::sparse_iterative_vector<double>(
+        __method, detail::sparse_callback_operator<double>(__b.count, __x.count, __ApplyOperator), __b, __x);
+}
+
+inline SparseIterativeStatus_t SparseSolve(
+    SparseIterativeMethod __method,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseMatrix_Double __X, DenseMatrix_Double __Y)> __ApplyOperator,
+    DenseMatrix_Double __B, DenseMatrix_Double __X, SparseOpaquePreconditioner_Double __Preconditioner)
+{
+    const long m = __B.attributes.transpose ? __B.columnCount : __B.rowCount;
+    const long n = __X.attributes.transpose ? __X.columnCount : __X.rowCount;
+    detail::sparse_operator<double> op = detail::sparse_callback_operator<double>(m, n, __ApplyOperator);
+    detail::sparse_set_preconditioner<double>(op, __Preconditioner);
+    return detail::sparse_iterative_dense<double>(__method, op, __B, __X);
+}
+
+inline SparseIterativeStatus_t SparseSolve(
+    SparseIterativeMethod __method,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseVector_Double __x, DenseVector_Double __y)> __ApplyOperator,
+    DenseVector_Double __b, DenseVector_Double __x, SparseOpaquePreconditioner_Double __Preconditioner)
+{
+    detail::sparse_operator<double> op = detail::sparse_callback_operator<double>(__b.count, __x.count, __ApplyOperator);
+    detail::sparse_set_preconditioner<double>(op, __Preconditioner);
+    return detail::sparse_iterative_vector<double>(__method, op, __b, __x);
+}
+
+inline size_t SparseGetStateSize_Double(SparseIterativeMethod __method, bool __preconditioner, int __m, int __n,
+                                      int __nrhs)
+{
+    (void)__preconditioner;
+    return detail::sparse_state_size<double>(__method, __m, __n, __nrhs);
+}
+
+inline void SparseIterate(
+    SparseIterativeMethod __method, int __iteration, const bool* __converged, void* __state,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseMatrix_Double __X, DenseMatrix_Double __Y)> __ApplyOperator,
+    DenseMatrix_Double __B, DenseMatrix_Double __R, DenseMatrix_Double __X)
+{
+    const long m = __B.attributes.transpose ? __B.columnCount : __B.rowCount,
+               n = __X.attributes.transpose ? __X.columnCount : __X.rowCount;
+    detail::sparse_iterate<double>(__method, __iteration, __converged, __state,
+                                detail::sparse_callback_operator<double>(m, n, __ApplyOperator), __B, __R, __X);
+}
+
+inline void SparseIterate(
+    SparseIterativeMethod __method, int __iteration, const bool* __converged, void* __state,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseMatrix_Double __X, DenseMatrix_Double __Y)> __ApplyOperator,
+    DenseMatrix_Double __B, DenseMatrix_Double __R, DenseMatrix_Double __X, SparseOpaquePreconditioner_Double __Preconditioner)
+{
+    const long m = __B.attributes.transpose ? __B.columnCount : __B.rowCount,
+               n = __X.attributes.transpose ? __X.columnCount : __X.rowCount;
+    detail::sparse_operator<double> op = detail::sparse_callback_operator<double>(m, n, __ApplyOperator);
+    detail::sparse_set_preconditioner<double>(op, __Preconditioner);
+    detail::sparse_iterate<double>(__method, __iteration, __converged, __state, op, __B, __R, __X);
+}
+
+inline void SparseMultiply(SparseMatrix_Float __A, DenseMatrix_Float __X, DenseMatrix_Float __Y)
+{
+    detail::sparse_multiply_entry<float>(__A, 1, false, __X, __Y);
+}
+
+inline void SparseMultiply(float __alpha, SparseMatrix_Float __A, DenseMatrix_Float __X, DenseMatrix_Float __Y)
+{
+    detail::sparse_multiply_entry<float>(__A, __alpha, false, __X, __Y);
+}
+
+inline void SparseMultiplyAdd(SparseMatrix_Float __A, DenseMatrix_Float __X, DenseMatrix_Float __Y)
+{
+    detail::sparse_multiply_entry<float>(__A, 1, true, __X, __Y);
+}
+
+inline void SparseMultiplyAdd(float __alpha, SparseMatrix_Float __A, DenseMatrix_Float __X, DenseMatrix_Float __Y)
+{
+    detail::sparse_multiply_entry<float>(__A, __alpha, true, __X, __Y);
+}
+
+inline void SparseMultiply(SparseMatrix_Float __A, DenseVector_Float __x, DenseVector_Float __y)
+{
+    SparseMultiply(__A, DenseMatrix_Float{ __x.count, 1, __x.count, {}, __x.data }, DenseMatrix_Float{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiply(float __alpha, SparseMatrix_Float __A, DenseVector_Float __x, DenseVector_Float __y)
+{
+    SparseMultiply(__alpha, __A, DenseMatrix_Float{ __x.count, 1, __x.count, {}, __x.data },
+                   DenseMatrix_Float{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiplyAdd(SparseMatrix_Float __A, DenseVector_Float __x, DenseVector_Float __y)
+{
+    SparseMultiplyAdd(__A, DenseMatrix_Float{ __x.count, 1, __x.count, {}, __x.data },
+                      DenseMatrix_Float{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiplyAdd(float __alpha, SparseMatrix_Float __A, DenseVector_Float __x, DenseVector_Float __y)
+{
+    SparseMultiplyAdd(__alpha, __A, DenseMatrix_Float{ __x.count, 1, __x.count, {}, __x.data },
+                      DenseMatrix_Float{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline SparseMatrix_Float SparseGetTranspose(SparseMatrix_Float __A)
+{
+    __A.structure.attributes.transpose = !__A.structure.attributes.transpose;
+    return __A;
+}
+
+inline SparseOpaquePreconditioner_Float SparseCreatePreconditioner(SparsePreconditioner_t __type, SparseMatrix_Float __A)
+{
+    return detail::sparse_create_preconditioner<float>(__type, __A);
+}
+
+inline void SparseCleanup(SparseOpaquePreconditioner_Float __Opaque)
+{
+    if (__Opaque.apply == &detail::sparse_diagonal_apply<float>)
+        delete (detail::sparse_diagonal<float>*)__Opaque.mem;
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Float __A, DenseMatrix_Float __B, DenseMatrix_Float __X)
+{
+    return detail::sparse_iterative_dense<float>(__method, detail::sparse_matrix_operator<float>(__A), __B, __X);
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Float __A, DenseVector_Float __b, DenseVector_Float __x)
+{
+    return detail::sparse_iterative_vector<float>(__method, detail::sparse_matrix_operator<float>(__A), __b, __x);
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Float __A, DenseMatrix_Float __B, DenseMatrix_Float __X,
+                                           SparsePreconditioner_t __Preconditioner)
+{
+    return detail::sparse_iterative_created<float>(__method, __A, __Preconditioner, &__B, &__X, nullptr, nullptr);
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Float __A, DenseVector_Float __b, DenseVector_Float __x,
+                                           SparsePreconditioner_t __Preconditioner)
+{
+    return detail::sparse_iterative_created<float>(__method, __A, __Preconditioner, nullptr, nullptr, &__b, &__x);
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Float __A, DenseMatrix_Float __B, DenseMatrix_Float __X,
+                                           SparseOpaquePreconditioner_Float __Preconditioner)
+{
+    detail::sparse_operator<float> op = detail::sparse_matrix_operator<float>(__A);
+    detail::sparse_set_preconditioner<float>(op, __Preconditioner);
+    return detail::sparse_iterative_dense<float>(__method, op, __B, __X);
+}
+
+inline SparseIterativeStatus_t SparseSolve(SparseIterativeMethod __method, SparseMatrix_Float __A, DenseVector_Float __b, DenseVector_Float __x,
+                                           SparseOpaquePreconditioner_Float __Preconditioner)
+{
+    detail::sparse_operator<float> op = detail::sparse_matrix_operator<float>(__A);
+    detail::sparse_set_preconditioner<float>(op, __Preconditioner);
+    return detail::sparse_iterative_vector<float>(__method, op, __b, __x);
+}
+
+// The operator forms: ApplyOperator(accumulate, trans, X, Y) sets Y, or
+// adds to it when accumulate, op(A)*X for A of the size of B by X.
+inline SparseIterativeStatus_t SparseSolve(
+    SparseIterativeMethod __method,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseMatrix_Float __X, DenseMatrix_Float __Y)> __ApplyOperator,
+    DenseMatrix_Float __B, DenseMatrix_Float __X)
+{
+    const long m = __B.attributes.transpose ? __B.columnCount : __B.rowCount;
+    const long n = __X.attributes.transpose ? __X.columnCount : __X.rowCount;
+    return detail::sparse_iterative_dense<float>(__method, detail::sparse_callback_operator<float>(m, n, __ApplyOperator),
+                                               __B, __X);
+}
+
+inline SparseIterativeStatus_t SparseSolve(
+    SparseIterativeMethod __method,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseVector_Float __x, DenseVector_Float __y)> __ApplyOperator,
+    DenseVector_Float __b, DenseVector_Float __x)
+{
+    return detail::sparse_iterative_vector<float>(
+        __method, detail::sparse_callback_operator<float>(__b.count, __x.count, __ApplyOperator), __b, __x);
+}
+
+inline SparseIterativeStatus_t SparseSolve(
+    SparseIterativeMethod __method,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseMatrix_Float __X, DenseMatrix_Float __Y)> __ApplyOperator,
+    DenseMatrix_Float __B, DenseMatrix_Float __X, SparseOpaquePreconditioner_Float __Preconditioner)
+{
+    const long m = __B.attributes.transpose ? __B.columnCount : __B.rowCount;
+    const long n = __X.attributes.transpose ? __X.columnCount : __X.rowCount;
+    detail::sparse_operator<float> op = detail::sparse_callback_operator<float>(m, n, __ApplyOperator);
+    detail::sparse_set_preconditioner<float>(op, __Preconditioner);
+    return detail::sparse_iterative_dense<float>(__method, op, __B, __X);
+}
+
+inline SparseIterativeStatus_t SparseSolve(
+    SparseIterativeMethod __method,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseVector_Float __x, DenseVector_Float __y)> __ApplyOperator,
+    DenseVector_Float __b, DenseVector_Float __x, SparseOpaquePreconditioner_Float __Preconditioner)
+{
+    detail::sparse_operator<float> op = detail::sparse_callback_operator<float>(__b.count, __x.count, __ApplyOperator);
+    detail::sparse_set_preconditioner<float>(op, __Preconditioner);
+    return detail::sparse_iterative_vector<float>(__method, op, __b, __x);
+}
+
+inline size_t SparseGetStateSize_Float(SparseIterativeMethod __method, bool __preconditioner, int __m, int __n,
+                                      int __nrhs)
+{
+    (void)__preconditioner;
+    return detail::sparse_state_size<float>(__method, __m, __n, __nrhs);
+}
+
+inline void SparseIterate(
+    SparseIterativeMethod __method, int __iteration, const bool* __converged, void* __state,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseMatrix_Float __X, DenseMatrix_Float __Y)> __ApplyOperator,
+    DenseMatrix_Float __B, DenseMatrix_Float __R, DenseMatrix_Float __X)
+{
+    const long m = __B.attributes.transpose ? __B.columnCount : __B.rowCount,
+               n = __X.attributes.transpose ? __X.columnCount : __X.rowCount;
+    detail::sparse_iterate<float>(__method, __iteration, __converged, __state,
+                                detail::sparse_callback_operator<float>(m, n, __ApplyOperator), __B, __R, __X);
+}
+
+inline void SparseIterate(
+    SparseIterativeMethod __method, int __iteration, const bool* __converged, void* __state,
+    std::function<void(bool __accumulate, enum CBLAS_TRANSPOSE __trans, DenseMatrix_Float __X, DenseMatrix_Float __Y)> __ApplyOperator,
+    DenseMatrix_Float __B, DenseMatrix_Float __R, DenseMatrix_Float __X, SparseOpaquePreconditioner_Float __Preconditioner)
+{
+    const long m = __B.attributes.transpose ? __B.columnCount : __B.rowCount,
+               n = __X.attributes.transpose ? __X.columnCount : __X.rowCount;
+    detail::sparse_operator<float> op = detail::sparse_callback_operator<float>(m, n, __ApplyOperator);
+    detail::sparse_set_preconditioner<float>(op, __Preconditioner);
+    detail::sparse_iterate<float>(__method, __iteration, __converged, __state, op, __B, __R, __X);
+}
+
+inline SparseMatrix_Double SparseConvertFromCoordinate(int __rowCount, int __columnCount, long __blockCount,
+                                               uint8_t __blockSize, SparseAttributes_t __attributes, const int* __row,
+                                               const int* __column, const double* __data)
+{
+    if (!detail::sparse_coordinate_check<double>(__rowCount, __columnCount, __blockCount, __attributes))
+        return SparseMatrix_Double{};
+    char* storage = (char*)malloc(detail::sparse_coordinate_size<double>(__columnCount, __blockCount, __blockSize));
+    if (!storage) {
+        detail::sparse_error(nullptr, "Failed to allocate storage for result.\n");
+        return SparseMatrix_Double{};
+    }
+    SparseMatrix_Double result = detail::sparse_from_coordinate<double>(__rowCount, __columnCount, __blockCount, __blockSize,
+                                                                   __attributes, __row, __column, __data, storage);
+    result.structure.attributes._allocatedBySparse = true;
+    return result;
+}
+
+inline SparseMatrix_Double SparseConvertFromCoordinate(int __rowCount, int __columnCount, long __blockCount,
+                                               uint8_t __blockSize, SparseAttributes_t __attributes, const int* __row,
+                                               const int* __column, const double* __data, void* __storage,
+                                               void* __workspace)
+{
+    (void)__workspace;
+    if (!detail::sparse_coordinate_check<double>(__rowCount, __columnCount, __blockCount, __attributes))
+        return SparseMatrix_Double{};
+    return detail::sparse_from_coordinate<double>(__rowCount, __columnCount, __blockCount, __blockSize, __attributes,
+                                                __row, __column, __data, (char*)__storage);
+}
+
+inline void SparseCleanup(SparseMatrix_Double __Matrix)
+{
+    if (!__Matrix.structure.attributes._allocatedBySparse)
+        return detail::sparse_error(
+            nullptr, "Attempting to call SparseCleanup on a matrix that was not allocated by the Sparse library.\n");
+    free(__Matrix.structure.columnStarts);
+}
+
+inline SparseFormattedMatrix_Double SparseConvertToFormat(SparseFormat_t __format, SparseMatrix_Double __A)
+{
+    return detail::sparse_convert_format<double>(__format, __A);
+}
+
+inline SparseFormattedMatrix_Double SparseConvertToFormat(SparseFormat_t __format, int __rowCount, int __columnCount,
+                                                   long __blockCount, uint8_t __blockSize,
+                                                   SparseAttributes_t __attributes, const int* __row,
+                                                   const int* __column, const double* __data)
+{
+    if (!detail::sparse_coordinate_check<double>(__rowCount, __columnCount, __blockCount, __attributes))
+        return SparseFormattedMatrix_Double{};
+    std::vector<char> storage(detail::sparse_coordinate_size<double>(__columnCount, __blockCount, __blockSize));
+    return detail::sparse_convert_format<double>(
+        __format, detail::sparse_from_coordinate<double>(__rowCount, __columnCount, __blockCount, __blockSize,
+                                                     __attributes, __row, __column, __data, storage.data()));
+}
+
+inline void SparseCleanup(SparseFormattedMatrix_Double __A)
+{
+    delete (detail::sparse_formatted<double>*)__A.storage;
+}
+
+inline void SparseMultiply(SparseFormattedMatrix_Double __A, DenseMatrix_Double __X, DenseMatrix_Double __Y)
+{
+    detail::sparse_formatted_entry<double>(__A, 1, false, __X, __Y);
+}
+
+inline void SparseMultiply(double __alpha, SparseFormattedMatrix_Double __A, DenseMatrix_Double __X, DenseMatrix_Double __Y)
+{
+    detail::sparse_formatted_entry<double>(__A, __alpha, false, __X, __Y);
+}
+
+inline void SparseMultiplyAdd(SparseFormattedMatrix_Double __A, DenseMatrix_Double __X, DenseMatrix_Double __Y)
+{
+    detail::sparse_formatted_entry<double>(__A, 1, true, __X, __Y);
+}
+
+inline void SparseMultiplyAdd(double __alpha, SparseFormattedMatrix_Double __A, DenseMatrix_Double __X, DenseMatrix_Double __Y)
+{
+    detail::sparse_formatted_entry<double>(__A, __alpha, true, __X, __Y);
+}
+
+inline void SparseMultiply(SparseFormattedMatrix_Double __A, DenseVector_Double __x, DenseVector_Double __y)
+{
+    SparseMultiply(__A, DenseMatrix_Double{ __x.count, 1, __x.count, {}, __x.data }, DenseMatrix_Double{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiply(double __alpha, SparseFormattedMatrix_Double __A, DenseVector_Double __x, DenseVector_Double __y)
+{
+    SparseMultiply(__alpha, __A, DenseMatrix_Double{ __x.count, 1, __x.count, {}, __x.data },
+                   DenseMatrix_Double{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiplyAdd(SparseFormattedMatrix_Double __A, DenseVector_Double __x, DenseVector_Double __y)
+{
+    SparseMultiplyAdd(__A, DenseMatrix_Double{ __x.count, 1, __x.count, {}, __x.data },
+                      DenseMatrix_Double{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiplyAdd(double __alpha, SparseFormattedMatrix_Double __A, DenseVector_Double __x, DenseVector_Double __y)
+{
+    SparseMultiplyAdd(__alpha, __A, DenseMatrix_Double{ __x.count, 1, __x.count, {}, __x.data },
+                      DenseMatrix_Double{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline SparseMatrix_Float SparseConvertFromCoordinate(int __rowCount, int __columnCount, long __blockCount,
+                                               uint8_t __blockSize, SparseAttributes_t __attributes, const int* __row,
+                                               const int* __column, const float* __data)
+{
+    if (!detail::sparse_coordinate_check<float>(__rowCount, __columnCount, __blockCount, __attributes))
+        return SparseMatrix_Float{};
+    char* storage = (char*)malloc(detail::sparse_coordinate_size<float>(__columnCount, __blockCount, __blockSize));
+    if (!storage) {
+        detail::sparse_error(nullptr, "Failed to allocate storage for result.\n");
+        return SparseMatrix_Float{};
+    }
+    SparseMatrix_Float result = detail::sparse_from_coordinate<float>(__rowCount, __columnCount, __blockCount, __blockSize,
+                                                                   __attributes, __row, __column, __data, storage);
+    result.structure.attributes._allocatedBySparse = true;
+    return result;
+}
+
+inline SparseMatrix_Float SparseConvertFromCoordinate(int __rowCount, int __columnCount, long __blockCount,
+                                               uint8_t __blockSize, SparseAttributes_t __attributes, const int* __row,
+                                               const int* __column, const float* __data, void* __storage,
+                                               void* __workspace)
+{
+    (void)__workspace;
+    if (!detail::sparse_coordinate_check<float>(__rowCount, __columnCount, __blockCount, __attributes))
+        return SparseMatrix_Float{};
+    return detail::sparse_from_coordinate<float>(__rowCount, __columnCount, __blockCount, __blockSize, __attributes,
+                                                __row, __column, __data, (char*)__storage);
+}
+
+inline void SparseCleanup(SparseMatrix_Float __Matrix)
+{
+    if (!__Matrix.structure.attributes._allocatedBySparse)
+        return detail::sparse_error(
+            nullptr, "Attempting to call SparseCleanup on a matrix that was not allocated by the Sparse library.\n");
+    free(__Matrix.structure.columnStarts);
+}
+
+inline SparseFormattedMatrix_Float SparseConvertToFormat(SparseFormat_t __format, SparseMatrix_Float __A)
+{
+    return detail::sparse_convert_format<float>(__format, __A);
+}
+
+inline SparseFormattedMatrix_Float SparseConvertToFormat(SparseFormat_t __format, int __rowCount, int __columnCount,
+                                                   long __blockCount, uint8_t __blockSize,
+                                                   SparseAttributes_t __attributes, const int* __row,
+                                                   const int* __column, const float* __data)
+{
+    if (!detail::sparse_coordinate_check<float>(__rowCount, __columnCount, __blockCount, __attributes))
+        return SparseFormattedMatrix_Float{};
+    std::vector<char> storage(detail::sparse_coordinate_size<float>(__columnCount, __blockCount, __blockSize));
+    return detail::sparse_convert_format<float>(
+        __format, detail::sparse_from_coordinate<float>(__rowCount, __columnCount, __blockCount, __blockSize,
+                                                     __attributes, __row, __column, __data, storage.data()));
+}
+
+inline void SparseCleanup(SparseFormattedMatrix_Float __A)
+{
+    delete (detail::sparse_formatted<float>*)__A.storage;
+}
+
+inline void SparseMultiply(SparseFormattedMatrix_Float __A, DenseMatrix_Float __X, DenseMatrix_Float __Y)
+{
+    detail::sparse_formatted_entry<float>(__A, 1, false, __X, __Y);
+}
+
+inline void SparseMultiply(float __alpha, SparseFormattedMatrix_Float __A, DenseMatrix_Float __X, DenseMatrix_Float __Y)
+{
+    detail::sparse_formatted_entry<float>(__A, __alpha, false, __X, __Y);
+}
+
+inline void SparseMultiplyAdd(SparseFormattedMatrix_Float __A, DenseMatrix_Float __X, DenseMatrix_Float __Y)
+{
+    detail::sparse_formatted_entry<float>(__A, 1, true, __X, __Y);
+}
+
+inline void SparseMultiplyAdd(float __alpha, SparseFormattedMatrix_Float __A, DenseMatrix_Float __X, DenseMatrix_Float __Y)
+{
+    detail::sparse_formatted_entry<float>(__A, __alpha, true, __X, __Y);
+}
+
+inline void SparseMultiply(SparseFormattedMatrix_Float __A, DenseVector_Float __x, DenseVector_Float __y)
+{
+    SparseMultiply(__A, DenseMatrix_Float{ __x.count, 1, __x.count, {}, __x.data }, DenseMatrix_Float{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiply(float __alpha, SparseFormattedMatrix_Float __A, DenseVector_Float __x, DenseVector_Float __y)
+{
+    SparseMultiply(__alpha, __A, DenseMatrix_Float{ __x.count, 1, __x.count, {}, __x.data },
+                   DenseMatrix_Float{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiplyAdd(SparseFormattedMatrix_Float __A, DenseVector_Float __x, DenseVector_Float __y)
+{
+    SparseMultiplyAdd(__A, DenseMatrix_Float{ __x.count, 1, __x.count, {}, __x.data },
+                      DenseMatrix_Float{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+inline void SparseMultiplyAdd(float __alpha, SparseFormattedMatrix_Float __A, DenseVector_Float __x, DenseVector_Float __y)
+{
+    SparseMultiplyAdd(__alpha, __A, DenseMatrix_Float{ __x.count, 1, __x.count, {}, __x.data },
+                      DenseMatrix_Float{ __y.count, 1, __y.count, {}, __y.data });
+}
+
+} // namespace vdsp
+
+#endif /* __cplusplus */
+
+#endif /* __SPARSE_SOLVE_PORTABLE__ */
@@ -0,0 +1,1003 @@
+/*
+    File:       vecLib/cblas_portable.h
+
+    Contains:   Portable, multithreaded GEMM and GEMV with a batched API
+
+    This header implements the general matrix products of cblas.h in C++,
+    for hosts without Accelerate, and for callers that need to say how
+    many threads a product may use:
+
+        cblas_sgemm  cblas_dgemm    C = alpha*op(A)*op(B) + beta*C
+        cblas_sgemv  cblas_dgemv    Y = alpha*op(A)*X + beta*Y
+
+    They keep the names, parameter lists and argument checks of cblas.h,
+    in namespace vdsp.  Two batched forms run many products of one shape
+    in a single call, the operands of successive products either a fixed
+    stride apart or given by arrays of pointers:
+
+        cblas_sgemm_batch_strided   cblas_dgemm_batch_strided
+        cblas_sgemm_batch           cblas_dgemm_batch
+
+    GEMM packs op(A) into mc x kc blocks and op(B) into kc x nc panels,
+    about the size of L2 and of the outer caches, each laid out in the
+    order the register tile reads it.  The tile holds mr rows by two
+    vectors of C in registers, mr being 4, 6 or 8 for 16, 32 or 64 byte
+    vectors, and runs once down kc; when C is narrower than that, it
+    holds the narrowest vector that covers a row.  Small products read
+    op(A) in place and skip the blocking, and products with a single
+    row or column are not packed at all.  Transposes and
+    column-major order only change the strides the packing reads.
+
+    GEMV runs dot products along the rows of op(A) when its rows are
+    contiguous, and otherwise updates a block of Y held in registers one
+    column at a time.  X and Y are copied to contiguous scratch when
+    their increments are not 1.
+
+    Large products are split over a pool of threads: into pieces of rows
+    or columns of C, of rows of Y, or of the products of a batch.  The
+    calling thread works on one piece.  cblas_set_num_threads() sets the
+    number of threads for all calls, 0 meaning one per hardware thread,
+    which is the default unless VECLIB_MAXIMUM_THREADS says otherwise.
+    A piece is at least 2^18 multiply-adds, so small calls stay on the
+    calling thread.  Calls made while another call is using the pool,
+    including from inside it, run on their own thread.
+
+    Every instruction set and every thread count return the same bits.
+    The panel depth kc follows from the shape alone, each element of C
+    is summed over its panel in order, starting at zero, and no split
+    cuts a sum.  GEMV's dot products use the interleaved partial sums of
+    vdsp::vDSP_dotpr, and its column updates sum in order.  Multiplies
+    and adds are never fused.
+
+    The other BLAS routines, and the complex types, are not provided.
+    LinearAlgebra_portable.h runs its products on this GEMM.
+*/
+#ifndef __CBLAS_PORTABLE__
+#define __CBLAS_PORTABLE__
+
+#if defined(__cplusplus)
+
+#include <vecLib/vDSP_portable.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// As in cblas.h, which may or may not have been included first.
+#ifndef CBLAS_ENUM_DEFINED_H
+#define CBLAS_ENUM_DEFINED_H
+  enum CBLAS_ORDER {CblasRowMajor=101, CblasColMajor=102 };
+  enum CBLAS_TRANSPOSE {CblasNoTrans=111, CblasTrans=112, CblasConjTrans=113,
+    AtlasConj=114};
+  enum CBLAS_UPLO  {CblasUpper=121, CblasLower=122};
+  enum CBLAS_DIAG  {CblasNonUnit=131, CblasUnit=132};
+  enum CBLAS_SIDE  {CblasLeft=141, CblasRight=142};
+#endif  /* CBLAS_ENUM_DEFINED_H */
+
+namespace vdsp {
+namespace detail {
+
+// Element (i, j) of a matrix operand is p[i*si + j*sj].
+template <class T>
+struct blas_operand {
+    const T*    p;
+    long        si, sj;
+};
+
+// The panels of a blocked product: op(A) in mc x kc blocks, op(B) in
+// kc x nc panels.  kc fixes the order of the sums, so it follows from the
+// shape alone, and not from the instruction set or the thread count.
+// kc == 0 sums each element over all of k at once, for products too
+// small or too thin for blocking to pay.
+struct blas_blocking {
+    long        kc, mc, nc;
+};
+
+template <class T>
+inline blas_blocking blas_block(long m, long n, long k)
+{
+    if (m == 1 || n == 1 || m * n * k <= 32768)
+        return { 0, 0, 0 };
+    const long most = 1024 / sizeof(T), steps = (k + most - 1) / most, kc = (k + steps - 1) / steps;
+    return { kc, std::max<long>(24, 131072 / (kc * (long)sizeof(T)) / 24 * 24),
+             std::max<long>(64, 1048576 / (kc * (long)sizeof(T)) / 64 * 64) };
+}
+
+template <class T>
+struct blas_gemm_call {
+    blas_operand<T> a, b;       // m x k, k x n
+    T*              c;          // element (i, j) at c[i*ldc + j]
+    long            ldc;
+    long            m, n, k;
+    T               alpha, beta;
+    blas_blocking   blocks;
+};
+
+// Where the operands of product i of a batch are: list[i], or base
+// advanced by i strides.
+template <class T>
+struct blas_items {
+    T*              base;
+    T* const*       list;
+    long            stride;
+
+    T* operator[](long i) const { return list ? list[i] : base + i * stride; }
+};
+
+// Products first to first + count of a batch, all shaped like g.
+template <class T>
+struct blas_batch_call {
+    blas_gemm_call<T>       g;
+    blas_items<const T>     a, b;
+    blas_items<T>           c;
+    long                    first, count;
+};
+
+// y = alpha*a*x + beta*y, for an m x n operand a and contiguous x and y.
+template <class T>
+struct blas_gemv_call {
+    blas_operand<T> a;
+    const T*        x;
+    T*              y;
+    long            m, n;
+    T               alpha, beta;
+};
+
+template <class T>
+__VDSP_INLINE T blas_result(T c, T s, T alpha, T beta)
+{
+    __VDSP_EXACT
+    return beta == 0 ? alpha * s : beta * c + alpha * s;
+}
+
+// Rows of the register tile.
+template <int B>
+inline constexpr long blas_mr = B == 16 ? 4 : B == 32 ? 6 : 8;
+
+// An mr x kc block a, element (r, p) at a[r*ar + p*ap], and a kc x nr
+// panel b, row p at b + p*bs, nr being H vectors, make the m x n corner
+// of C: c = alpha*a*b + beta*c if first, and c += alpha*a*b after that.
+// Packed blocks are padded to mr rows; Direct ones, read in place, are
+// not, and rows past m repeat the last.
+template <class T, int B, int H, bool Direct>
+__VDSP_INLINE void blas_tile(T* c, long ldc, const T* a, long ar, long ap, const T* b, long bs, long kc, long m,
+                             long n, T alpha, T beta, bool first)
+{
+    __VDSP_EXACT
+    typedef typename simd<T, B>::vector V;
+    constexpr long w = simd<T, B>::width, mr = blas_mr<B>, nr = H * w;
+    V acc[mr][H];
+    long at[mr];
+#pragma GCC unroll 8
+    for (long r = 0; r < mr; r++) {
+        at[r] = (Direct ? std::min(r, m - 1) : r) * ar;
+        for (long h = 0; h < H; h++)
+            acc[r][h] = V{};
+    }
+    for (long p = 0; p < kc; p++) {
+        V bv[H];
+#pragma GCC unroll 2
+        for (long h = 0; h < H; h++)
+            load<true>(bv[h], b + p * bs + h * w, 1);
+#pragma GCC unroll 8
+        for (long r = 0; r < mr; r++) {
+            V x;
+            splat(x, a[at[r] + p * ap]);
+#pragma GCC unroll 2
+            for (long h = 0; h < H; h++)
+                acc[r][h] = acc[r][h] + x * bv[h];
+        }
+    }
+    if (m == mr && n == nr) {
+        V av, bv;
+        splat(av, alpha);
+        splat(bv, beta);
+#pragma GCC unroll 8
+        for (long r = 0; r < mr; r++) {
+#pragma GCC unroll 2
+            for (long h = 0; h < H; h++) {
+                T* q = c + r * ldc + h * w;
+                V v = av * acc[r][h];
+                if (!first || beta != 0) {
+                    V o;
+                    load<true>(o, q, 1);
+                    v = first ? bv * o + v : o + v;
+                }
+                store<true>(q, 1, v);
+            }
+        }
+    } else {
+        T row[nr];
+        for (long r = 0; r < m; r++) {
+            for (long h = 0; h < H; h++)
+                store<true>(row + h * w, 1, acc[r][h]);
+            T* q = c + r * ldc;
+            for (long j = 0; j < n; j++)
+                q[j] = first ? blas_result(q[j], row[j], alpha, beta) : q[j] + alpha * row[j];
+        }
+    }
+}
+
+template <class T>
+inline T* blas_scratch(long n, int which)
+{
+    static thread_local std::vector<T> buffer[3];
+    if ((long)buffer[which].size() < n)
+        buffer[which].resize(n);
+    return buffer[which].data();
+}
+
+// The blocked product, on tiles H vectors of B bytes wide.
+template <class T, int B, int H>
+__VDSP_INLINE void blas_packed(const blas_gemm_call<T>& g)
+{
+    constexpr long mr = blas_mr<B>, nr = H * simd<T, B>::width;
+    const long kc = g.blocks.kc, mc = g.blocks.mc, nc = g.blocks.nc;
+    T* ap = blas_scratch<T>((std::min(mc, g.m) + mr - 1) / mr * mr * kc, 0);
+    T* bp = blas_scratch<T>((std::min(nc, g.n) + nr - 1) / nr * nr * kc, 1);
+    const blas_operand<T>& a = g.a;
+    const blas_operand<T>& b = g.b;
+    for (long jc = 0; jc < g.n; jc += nc) {
+        const long nb = std::min(nc, g.n - jc);
+        for (long pc = 0; pc < g.k; pc += kc) {
+            const long kb = std::min(kc, g.k - pc);
+            // B into kb x nr slivers, zero padded; along its rows in memory.
+            for (long t = 0; t < nb; t += nr) {
+                T* q = bp + t * kb;
+                const T* s = b.p + pc * b.si + (jc + t) * b.sj;
+                const long e = std::min(nr, nb - t);
+                if (labs(b.si) < labs(b.sj)) {
+                    for (long u = 0; u < nr; u++)
+                        for (long p = 0; p < kb; p++)
+                            q[p * nr + u] = u < e ? s[p * b.si + u * b.sj] : 0;
+                } else {
+                    for (long p = 0; p < kb; p++)
+                        for (long u = 0; u < nr; u++)
+                            q[p * nr + u] = u < e ? s[p * b.si + u * b.sj] : 0;
+                }
+            }
+            for (long ic = 0; ic < g.m; ic += mc) {
+                const long mb = std::min(mc, g.m - ic);
+                // A into mr x kb slivers, zero padded.
+                for (long s = 0; s < mb; s += mr) {
+                    T* q = ap + s * kb;
+                    const T* o = a.p + (ic + s) * a.si + pc * a.sj;
+                    const long e = std::min(mr, mb - s);
+                    if (labs(a.si) < labs(a.sj)) {
+                        for (long p = 0; p < kb; p++)
+                            for (long u = 0; u < mr; u++)
+                                q[p * mr + u] = u < e ? o[u * a.si + p * a.sj] : 0;
+                    } else {
+                        for (long u = 0; u < mr; u++)
+                            for (long p = 0; p < kb; p++)
+                                q[p * mr + u] = u < e ? o[u * a.si + p * a.sj] : 0;
+                    }
+                }
+                for (long t = 0; t < nb; t += nr)
+                    for (long s = 0; s < mb; s += mr)
+                        blas_tile<T, B, H, false>(g.c + (ic + s) * g.ldc + jc + t, g.ldc, ap + s * kb, 1, mr,
+                                                  bp + t * kb, nr, kb, std::min(mr, mb - s), std::min(nr, nb - t),
+                                                  g.alpha, g.beta, pc == 0);
+            }
+        }
+    }
+}
+
+// A small product in one panel.  op(A) is read in place, and so is
+// op(B) when whole tiles cover its rows; otherwise it is packed.
+template <class T, int B, int H>
+__VDSP_INLINE void blas_small(const blas_gemm_call<T>& g)
+{
+    constexpr long mr = blas_mr<B>, nr = H * simd<T, B>::width;
+    const bool direct = g.b.sj == 1 && g.n % nr == 0;
+    const T* bp = g.b.p;
+    long bs = g.b.si, bt = 1;
+    if (!direct) {
+        T* q = blas_scratch<T>((g.n + nr - 1) / nr * nr * g.k, 1);
+        for (long t = 0; t < g.n; t += nr)
+            for (long p = 0; p < g.k; p++)
+                for (long u = 0; u < nr; u++)
+                    q[t * g.k + p * nr + u] = t + u < g.n ? g.b.p[p * g.b.si + (t + u) * g.b.sj] : 0;
+        bp = q;
+        bs = nr;
+        bt = g.k;
+    }
+    for (long t = 0; t < g.n; t += nr)
+        for (long i = 0; i < g.m; i += mr)
+            blas_tile<T, B, H, true>(g.c + i * g.ldc + t, g.ldc, g.a.p + i * g.a.si, g.a.si, g.a.sj, bp + t * bt, bs,
+                                     g.k, std::min(mr, g.m - i), std::min(nr, g.n - t), g.alpha, g.beta, true);
+}
+
+// A single row or column of C, each element summed over all of k.
+template <class T, int B>
+__VDSP_INLINE void blas_thin(const blas_gemm_call<T>& g)
+{
+    __VDSP_EXACT
+    typedef typename simd<T, B>::vector V;
+    constexpr long w = simd<T, B>::width;
+    if (g.m == 1 && g.b.sj == 1) {
+        T* acc = blas_scratch<T>(g.n, 2);
+        for (long j = 0; j < g.n; j++)
+            acc[j] = 0;
+        for (long p = 0; p < g.k; p++) {
+            const T x = g.a.p[p * g.a.sj];
+            const T* b = g.b.p + p * g.b.si;
+            V xv;
+            splat(xv, x);
+            long j = 0;
+            for (; j + w <= g.n; j += w) {
+                V cv, bv;
+                load<true>(cv, acc + j, 1);
+                load<true>(bv, b + j, 1);
+                cv = cv + xv * bv;
+                store<true>(acc + j, 1, cv);
+            }
+            for (; j < g.n; j++)
+                acc[j] = acc[j] + x * b[j];
+        }
+        for (long j = 0; j < g.n; j++)
+            g.c[j] = blas_result(g.c[j], acc[j], g.alpha, g.beta);
+        return;
+    }
+    for (long i = 0; i < g.m; i++) {
+        for (long j = 0; j < g.n; j++) {
+            const T* a = g.a.p + i * g.a.si;
+            const T* b = g.b.p + j * g.b.sj;
+            T s = 0;
+            for (long p = 0; p < g.k; p++)
+                s = s + a[p * g.a.sj] * b[p * g.b.si];
+            T* c = g.c + i * g.ldc + j;
+            *c = blas_result(*c, s, g.alpha, g.beta);
+        }
+    }
+}
+
+// Products with a single row or column take blas_thin.  Others run on
+// the narrowest tile that covers a row of C, up to two full vectors.
+template <class T, int B>
+__VDSP_INLINE void blas_gemm_kernel(const blas_gemm_call<T>& g)
+{
+    constexpr long w = simd<T, 16>::width;
+    constexpr int B32 = B >= 32 ? 32 : B;
+    if (g.m == 0 || g.n == 0)
+        return;
+    if (g.blocks.kc != 0) {
+        if (g.n <= w)
+            return blas_packed<T, 16, 1>(g);
+        if (B >= 32 && g.n <= 2 * w)
+            return blas_packed<T, B32, 1>(g);
+        if (B >= 64 && g.n <= 4 * w)
+            return blas_packed<T, B, 1>(g);
+        return blas_packed<T, B, 2>(g);
+    }
+    if (g.m == 1 || g.n == 1)
+        return blas_thin<T, B>(g);
+    if (g.n <= w)
+        return blas_small<T, 16, 1>(g);
+    if (B >= 32 && g.n <= 2 * w)
+        return blas_small<T, B32, 1>(g);
+    if (B >= 64 && g.n <= 4 * w)
+        return blas_small<T, B, 1>(g);
+    blas_small<T, B, 2>(g);
+}
+
+template <class T, int B>
+__VDSP_INLINE void blas_batch_kernel(const blas_batch_call<T>& k)
+{
+    blas_gemm_call<T> g = k.g;
+    for (long i = k.first; i < k.first + k.count; i++) {
+        g.a.p = k.a[i];
+        g.b.p = k.b[i];
+        g.c = k.c[i];
+        blas_gemm_kernel<T, B>(g);
+    }
+}
+
+// Rows of a along contiguous x: 128 bytes of partial sums per row,
+// reduced pairwise, then the remaining columns in order, as
+// vDSP_dotpr sums.  Several rows at once keep the adds independent.
+template <class T, int B>
+__VDSP_INLINE void blas_gemv_rows(const blas_gemv_call<T>& k)
+{
+    __VDSP_EXACT
+    typedef typename simd<T, B>::vector V;
+    constexpr long w = simd<T, B>::width, lanes = 2 * 64 / sizeof(T), v = lanes / w, rows = B / 16;
+    const long whole = k.n / lanes * lanes;
+    T part[lanes];
+    long i = 0;
+    for (; i < k.m; i += rows) {
+        const long h = std::min(rows, k.m - i);
+        V acc[rows][v];
+#pragma GCC unroll 4
+        for (long r = 0; r < rows; r++)
+            for (long l = 0; l < v; l++)
+                acc[r][l] = V{};
+        for (long j = 0; j < whole; j += lanes) {
+#pragma GCC unroll 4
+            for (long r = 0; r < rows; r++) {
+                const T* a = k.a.p + std::min(i + r, k.m - 1) * k.a.si + j;
+#pragma GCC unroll 8
+                for (long l = 0; l < v; l++) {
+                    V x, y;
+                    load<true>(x, a + l * w, 1);
+                    load<true>(y, k.x + j + l * w, 1);
+                    acc[r][l] = acc[r][l] + x * y;
+                }
+            }
+        }
+        for (long r = 0; r < h; r++) {
+            memcpy(part, acc[r], sizeof(part));
+            for (long s = lanes / 2; s > 0; s /= 2)
+                for (long l = 0; l < s; l++)
+                    part[l] = part[l] + part[l + s];
+            const T* a = k.a.p + (i + r) * k.a.si;
+            T s = part[0];
+            for (long j = whole; j < k.n; j++)
+                s = s + a[j] * k.x[j];
+            k.y[i + r] = blas_result(k.y[i + r], s, k.alpha, k.beta);
+        }
+    }
+}
+
+// Columns of a with contiguous rows, 16 at a time, each into four
+// vectors of sums held in registers across them.  Each element of y is
+// summed over the columns in order.
+template <class T, int B>
+__VDSP_INLINE void blas_gemv_columns(const blas_gemv_call<T>& k)
+{
+    __VDSP_EXACT
+    typedef typename simd<T, B>::vector V;
+    constexpr long w = simd<T, B>::width, h = 4 * w, step = 16;
+    const long whole = k.m / h * h;
+    T* sum = blas_scratch<T>(k.m, 2);
+    for (long i = 0; i < k.m; i++)
+        sum[i] = 0;
+    for (long jc = 0; jc < k.n; jc += step) {
+        const long e = std::min(step, k.n - jc);
+        for (long i = 0; i < whole; i += h) {
+            V acc[4];
+#pragma GCC unroll 4
+            for (long l = 0; l < 4; l++)
+                load<true>(acc[l], sum + i + l * w, 1);
+            for (long j = jc; j < jc + e; j++) {
+                const T* a = k.a.p + j * k.a.sj + i;
+                V x;
+                splat(x, k.x[j]);
+#pragma GCC unroll 4
+                for (long l = 0; l < 4; l++) {
+                    V y;
+                    load<true>(y, a + l * w, 1);
+                    acc[l] = acc[l] + x * y;
+                }
+            }
+#pragma GCC unroll 4
+            for (long l = 0; l < 4; l++)
+                store<true>(sum + i + l * w, 1, acc[l]);
+        }
+        for (long i = whole; i < k.m; i++)
+            for (long j = jc; j < jc + e; j++)
+                sum[i] = sum[i] + k.a.p[i * k.a.si + j * k.a.sj] * k.x[j];
+    }
+    for (long i = 0; i < k.m; i++)
+        k.y[i] = blas_result(k.y[i], sum[i], k.alpha, k.beta);
+}
+
+template <class T, int B>
+__VDSP_INLINE void blas_gemv_kernel(const blas_gemv_call<T>& k)
+{
+    if (k.a.sj == 1)
+        blas_gemv_rows<T, B>(k);
+    else
+        blas_gemv_columns<T, B>(k);
+}
+
+template <int B, class T>
+__VDSP_INLINE void blas_run(const blas_gemm_call<T>& g) { blas_gemm_kernel<T, B>(g); }
+
+template <int B, class T>
+__VDSP_INLINE void blas_run(const blas_batch_call<T>& k) { blas_batch_kernel<T, B>(k); }
+
+template <int B, class T>
+__VDSP_INLINE void blas_run(const blas_gemv_call<T>& k) { blas_gemv_kernel<T, B>(k); }
+
+template <class K>
+__VDSP_NOCONTRACT void blas_run_baseline(const K& k) { blas_run<16>(k); }
+
+#if defined(__VDSP_X86_DISPATCH)
+template <class K>
+__attribute__((target("avx2"))) __VDSP_NOCONTRACT void blas_run_avx2(const K& k) { blas_run<32>(k); }
+
+template <class K>
+__attribute__((target("avx512f"))) __VDSP_NOCONTRACT void blas_run_avx512(const K& k) { blas_run<64>(k); }
+#endif
+
+template <class K>
+inline void blas_dispatch(const K& k)
+{
+    switch ((isa)active().load(std::memory_order_relaxed)) {
+#if defined(__VDSP_X86_DISPATCH)
+    case isa::avx512:
+        return blas_run_avx512(k);
+    case isa::avx2:
+        return blas_run_avx2(k);
+#endif
+    default:
+        return blas_run_baseline(k);
+    }
+}
+
+inline int blas_hardware_threads()
+{
+    const unsigned n = std::thread::hardware_concurrency();
+    return n ? (int)n : 1;
+}
+
+inline std::atomic<int>& blas_threads()
+{
+    static std::atomic<int> slot([] {
+        const char* e = getenv("VECLIB_MAXIMUM_THREADS");
+        const int n = e ? atoi(e) : 0;
+        return n > 0 ? n : blas_hardware_threads();
+    }());
+    return slot;
+}
+
+// Fork-join over a lazily grown set of workers.  run() hands out tasks
+// 0 to count - 1 to at most `threads` threads, itself included, and
+// returns when all are done.  One run uses the pool at a time; a run
+// that finds it busy, or that is made from inside a task, does its tasks
+// itself, so nested calls and calls from several threads at once never
+// wait on each other.  A nested run never touches `busy`, which its own
+// thread may already hold.
+class blas_pool {
+public:
+    static blas_pool& shared()
+    {
+        static blas_pool pool;
+        return pool;
+    }
+
+    ~blas_pool()
+    {
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            stop = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers)
+            t.join();
+    }
+
+    template <class F>
+    void run(long count, int threads, const F& f)
+    {
+        if (threads <= 1 || count <= 1 || in_task() || !busy.try_lock()) {
+            for (long t = 0; t < count; t++)
+                f(t);
+            return;
+        }
+        std::lock_guard<std::mutex> owner(busy, std::adopt_lock);
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            while ((long)workers.size() < threads - 1)
+                workers.emplace_back([this] { work(); });
+            job = &f;
+            entry = [](const void* j, long t) { (*(const F*)j)(t); };
+            tasks = count;
+            next.store(0);
+            left.store(count);
+            seats = (int)std::min<long>(threads, count) - 1;
+        }
+        wake.notify_all();
+        in_task() = true;
+        drain(&f, entry);
+        in_task() = false;
+        std::unique_lock<std::mutex> hold(lock);
+        done.wait(hold, [this] { return left.load() == 0 && inside == 0; });
+        job = nullptr;
+        seats = 0;
+    }
+
+private:
+    std::mutex busy, lock;
+    std::condition_variable wake, done;
+    std::vector<std::thread> workers;
+    const void* job = nullptr;
+    void (*entry)(const void*, long) = nullptr;
+    long tasks = 0;
+    std::atomic<long> next{0}, left{0};
+    int seats = 0, inside = 0;
+    bool stop = false;
+
+    // Set on workers, and on the caller while it drains its own run.
+    static bool& in_task()
+    {
+        static thread_local bool inside_pool = false;
+        return inside_pool;
+    }
+
+    void drain(const void* j, void (*e)(const void*, long))
+    {
+        for (long t; (t = next.fetch_add(1)) < tasks;) {
+            e(j, t);
+            left.fetch_sub(1);
+        }
+    }
+
+    void work()
+    {
+        in_task() = true;
+        std::unique_lock<std::mutex> hold(lock);
+        for (;;) {
+            wake.wait(hold, [this] { return stop || (job && seats > 0); });
+            if (stop)
+                return;
+            seats--;
+            inside++;
+            const void* j = job;
+            void (*e)(const void*, long) = entry;
+            hold.unlock();
+            drain(j, e);
+            hold.lock();
+            if (--inside == 0 && left.load() == 0)
+                done.notify_all();
+        }
+    }
+};
+
+// How many pieces work of the given size, in multiply-adds, splits into.
+inline long blas_pieces(double work, long most)
+{
+    const int threads = blas_threads().load(std::memory_order_relaxed);
+    return std::max<long>(1, std::min<long>({ (long)threads, most, (long)(work / 262144) }));
+}
+
+// Runs g, split into pieces of whole tiles along the longer side of C.
+template <class T>
+inline void blas_gemm(const blas_gemm_call<T>& g)
+{
+    const bool rows = g.m >= g.n;
+    const long side = rows ? g.m : g.n, unit = rows ? 24 : 64;
+    const long pieces = blas_pieces((double)g.m * g.n * g.k, (side + unit - 1) / unit);
+    if (pieces == 1)
+        return blas_dispatch(g);
+    const long step = (side + pieces - 1) / pieces, size = (step + unit - 1) / unit * unit;
+    blas_pool::shared().run((side + size - 1) / size, (int)pieces, [&](long t) {
+        blas_gemm_call<T> s = g;
+        const long at = t * size, span = std::min(size, side - at);
+        if (rows) {
+            s.a.p += at * g.a.si;
+            s.c += at * g.ldc;
+            s.m = span;
+        } else {
+            s.b.p += at * g.b.sj;
+            s.c += at;
+            s.n = span;
+        }
+        blas_dispatch(s);
+    });
+}
+
+template <class T>
+inline void blas_batch(const blas_batch_call<T>& k)
+{
+    const blas_gemm_call<T>& g = k.g;
+    const long pieces = blas_pieces((double)g.m * g.n * g.k * k.count, k.count);
+    if (pieces == 1)
+        return blas_dispatch(k);
+    const long size = (k.count + pieces - 1) / pieces;
+    blas_pool::shared().run((k.count + size - 1) / size, (int)pieces, [&](long t) {
+        blas_batch_call<T> s = k;
+        s.first = k.first + t * size;
+        s.count = std::min(size, k.count - t * size);
+        blas_dispatch(s);
+    });
+}
+
+template <class T>
+inline void blas_gemv(const blas_gemv_call<T>& k)
+{
+    const long pieces = blas_pieces((double)k.m * k.n, (k.m + 63) / 64);
+    if (pieces == 1)
+        return blas_dispatch(k);
+    const long size = ((k.m + pieces - 1) / pieces + 63) / 64 * 64;
+    blas_pool::shared().run((k.m + size - 1) / size, (int)pieces, [&](long t) {
+        blas_gemv_call<T> s = k;
+        s.a.p += t * size * k.a.si;
+        s.y += t * size;
+        s.m = std::min(size, k.m - t * size);
+        blas_dispatch(s);
+    });
+}
+
+inline void blas_xerbla(int p, const char* routine)
+{
+    fprintf(stderr, "On entry to %s, parameter number %d had an illegal value\n", routine, p);
+}
+
+inline bool blas_transpose(CBLAS_TRANSPOSE t)
+{
+    return t == CblasTrans || t == CblasConjTrans;
+}
+
+// op(X) of a matrix stored with leading dimension ld, in the given order.
+template <class T>
+inline blas_operand<T> blas_op(const T* p, int ld, CBLAS_ORDER order, CBLAS_TRANSPOSE t)
+{
+    const bool across = (order == CblasRowMajor) != blas_transpose(t);
+    return across ? blas_operand<T>{ p, ld, 1 } : blas_operand<T>{ p, 1, ld };
+}
+
+// Parameter numbers that xerbla reports for the leading dimensions and
+// the batch count, which sit at different places in each GEMM entry point.
+struct blas_gemm_params {
+    int lda, ldb, ldc, count;
+};
+
+// Checks the arguments of a GEMM as cblas does, and sets up the product
+// in row-major terms: a column-major C is the row-major C', and
+// C' = op(B)'*op(A)'.  Returns false if there is nothing to multiply.
+template <class T>
+inline bool blas_gemm_setup(blas_gemm_call<T>& g, const char* routine, const blas_gemm_params& params,
+                            CBLAS_ORDER order, CBLAS_TRANSPOSE ta, CBLAS_TRANSPOSE tb, int m, int n, int k, T alpha,
+                            const T* a, int lda, const T* b, int ldb, T beta, T* c, int ldc)
+{
+    const bool row = order == CblasRowMajor;
+    int p = 0;
+    if (order != CblasRowMajor && order != CblasColMajor)
+        p = 1;
+    else if (ta < CblasNoTrans || ta > CblasConjTrans)
+        p = 2;
+    else if (tb < CblasNoTrans || tb > CblasConjTrans)
+        p = 3;
+    else if (m < 0)
+        p = 4;
+    else if (n < 0)
+        p = 5;
+    else if (k < 0)
+        p = 6;
+    else if (lda < std::max(1, row != blas_transpose(ta) ? k : m))
+        p = params.lda;
+    else if (ldb < std::max(1, row != blas_transpose(tb) ? n : k))
+        p = params.ldb;
+    else if (ldc < std::max(1, row ? n : m))
+        p = params.ldc;
+    if (p) {
+        blas_xerbla(p, routine);
+        return false;
+    }
+    if (m == 0 || n == 0)
+        return false;
+    g.m = row ? m : n;
+    g.n = row ? n : m;
+    g.k = k;
+    g.a = blas_op(a, lda, order, ta);
+    g.b = blas_op(b, ldb, order, tb);
+    if (!row) {
+        std::swap(g.a, g.b);
+        std::swap(g.a.si, g.a.sj);
+        std::swap(g.b.si, g.b.sj);
+    }
+    g.c = c;
+    g.ldc = ldc;
+    g.alpha = alpha;
+    g.beta = beta;
+    g.blocks = blas_block<T>(g.m, g.n, g.k);
+    return true;
+}
+
+// C = beta*C, for alpha == 0 or k == 0, when a product adds nothing.
+template <class T>
+inline void blas_scale(const blas_gemm_call<T>& g, T* c)
+{
+    if (g.beta == 1)
+        return;
+    for (long i = 0; i < g.m; i++)
+        for (long j = 0; j < g.n; j++)
+            c[i * g.ldc + j] = g.beta == 0 ? 0 : g.beta * c[i * g.ldc + j];
+}
+
+template <class T>
+inline void blas_gemm_entry(const char* routine, CBLAS_ORDER order, CBLAS_TRANSPOSE ta, CBLAS_TRANSPOSE tb, int m,
+                            int n, int k, T alpha, const T* a, int lda, const T* b, int ldb, T beta, T* c, int ldc)
+{
+    blas_gemm_call<T> g;
+    if (!blas_gemm_setup(g, routine, { 9, 11, 14, 0 }, order, ta, tb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc))
+        return;
+    if (alpha == 0 || k == 0)
+        return blas_scale(g, c);
+    blas_gemm(g);
+}
+
+template <class T>
+inline void blas_batch_entry(const char* routine, CBLAS_ORDER order, CBLAS_TRANSPOSE ta, CBLAS_TRANSPOSE tb, int m,
+                             int n, int k, T alpha, blas_items<const T> a, int lda, blas_items<const T> b, int ldb,
+                             T beta, blas_items<T> c, int ldc, int count, const blas_gemm_params& params)
+{
+    blas_batch_call<T> s = { {}, a, b, c, 0, count };
+    if (count < 0)
+        return blas_xerbla(params.count, routine);
+    if (count == 0 || !blas_gemm_setup(s.g, routine, params, order, ta, tb, m, n, k, alpha, a.base, lda, b.base,
+                                       ldb, beta, c.base, ldc))
+        return;
+    if (order == CblasColMajor)
+        std::swap(s.a, s.b);
+    if (alpha == 0 || k == 0) {
+        for (long i = 0; i < count; i++)
+            blas_scale(s.g, s.c[i]);
+        return;
+    }
+    blas_batch(s);
+}
+
+template <class T>
+inline void blas_gemv_entry(const char* routine, CBLAS_ORDER order, CBLAS_TRANSPOSE t, int m, int n, T alpha,
+                            const T* a, int lda, const T* x, int incx, T beta, T* y, int incy)
+{
+    int p = 0;
+    if (order != CblasRowMajor && order != CblasColMajor)
+        p = 1;
+    else if (t < CblasNoTrans || t > CblasConjTrans)
+        p = 2;
+    else if (m < 0)
+        p = 3;
+    else if (n < 0)
+        p = 4;
+    else if (lda < std::max(1, order == CblasRowMajor ? n : m))
+        p = 7;
+    else if (incx == 0)
+        p = 9;
+    else if (incy == 0)
+        p = 12;
+    if (p)
+        return blas_xerbla(p, routine);
+    const bool flip = blas_transpose(t);
+    const long rows = flip ? n : m, cols = flip ? m : n;
+    if (rows == 0 || cols == 0 || (alpha == 0 && beta == 1))
+        return;
+    // Negative increments walk the vectors from their far end.
+    const T* xs = incx > 0 ? x : x - (cols - 1) * incx;
+    T* ys = incy > 0 ? y : y - (rows - 1) * incy;
+    blas_gemv_call<T> k = { blas_op(a, lda, order, t), xs, ys, rows, cols, alpha, beta };
+    if (alpha == 0) {
+        for (long i = 0; i < rows; i++)
+            ys[i * incy] = beta == 0 ? 0 : beta * ys[i * incy];
+        return;
+    }
+    if (incx != 1) {
+        T* q = blas_scratch<T>(cols, 0);
+        for (long j = 0; j < cols; j++)
+            q[j] = xs[j * incx];
+        k.x = q;
+    }
+    if (incy != 1) {
+        T* q = blas_scratch<T>(rows, 1);
+        for (long i = 0; i < rows; i++)
+            q[i] = ys[i * incy];
+        k.y = q;
+    }
+    blas_gemv(k);
+    if (incy != 1)
+        for (long i = 0; i < rows; i++)
+            ys[i * incy] = k.y[i];
+}
+
+} // namespace detail
+
+// Sets the number of threads the routines may use, 0 meaning one per
+// hardware thread.  Takes effect from the next call, in all threads.
+inline void cblas_set_num_threads(int __n)
+{
+    detail::blas_threads().store(__n > 0 ? __n : detail::blas_hardware_threads(), std::memory_order_relaxed);
+}
+
+// The number of threads the routines may use.
+inline int cblas_get_num_threads() { return detail::blas_threads().load(std::memory_order_relaxed); }
+
+inline void cblas_sgemv(const enum CBLAS_ORDER __Order,
+                        const enum CBLAS_TRANSPOSE __TransA, const int __M, const int __N,
+                        const float __alpha, const float *__A, const int __lda,
+                        const float *__X, const int __incX, const float __beta, float *__Y,
+                        const int __incY)
+{
+    detail::blas_gemv_entry("cblas_sgemv", __Order, __TransA, __M, __N, __alpha, __A, __lda, __X, __incX, __beta,
+                            __Y, __incY);
+}
+
+inline void cblas_dgemv(const enum CBLAS_ORDER __Order,
+                        const enum CBLAS_TRANSPOSE __TransA, const int __M, const int __N,
+                        const double __alpha, const double *__A, const int __lda,
+                        const double *__X, const int __incX, const double __beta, double *__Y,
+                        const int __incY)
+{
+    detail::blas_gemv_entry("cblas_dgemv", __Order, __TransA, __M, __N, __alpha, __A, __lda, __X, __incX, __beta,
+                            __Y, __incY);
+}
+
+inline void cblas_sgemm(const enum CBLAS_ORDER __Order,
+                        const enum CBLAS_TRANSPOSE __TransA,
+                        const enum CBLAS_TRANSPOSE __TransB, const int __M, const int __N,
+                        const int __K, const float __alpha, const float *__A, const int __lda,
+                        const float *__B, const int __ldb, const float __beta, float *__C,
+                        const int __ldc)
+{
+    detail::blas_gemm_entry("cblas_sgemm", __Order, __TransA, __TransB, __M, __N, __K, __alpha, __A, __lda, __B,
+                            __ldb, __beta, __C, __ldc);
+}
+
+inline void cblas_dgemm(const enum CBLAS_ORDER __Order,
+                        const enum CBLAS_TRANSPOSE __TransA,
+                        const enum CBLAS_TRANSPOSE __TransB, const int __M, const int __N,
+                        const int __K, const double __alpha, const double *__A,
+                        const int __lda, const double *__B, const int __ldb,
+                        const double __beta, double *__C, const int __ldc)
+{
+    detail::blas_gemm_entry("cblas_dgemm", __Order, __TransA, __TransB, __M, __N, __K, __alpha, __A, __lda, __B,
+                            __ldb, __beta, __C, __ldc);
+}
+
+// __BatchCount products of one shape, the operands of product i at
+// __A + i*__strideA, __B + i*__strideB and __C + i*__strideC.
+inline void cblas_sgemm_batch_strided(const enum CBLAS_ORDER __Order,
+                                      const enum CBLAS_TRANSPOSE __TransA,
+                                      const enum CBLAS_TRANSPOSE __TransB, const int __M, const int __N,
+                                      const int __K, const float __alpha, const float *__A, const int __lda,
+                                      const int __strideA, const float *__B, const int __ldb,
+                                      const int __strideB, const float __beta, float *__C, const int __ldc,
+                                      const int __strideC, const int __BatchCount)
+{
+    detail::blas_batch_entry<float>("cblas_sgemm_batch_strided", __Order, __TransA, __TransB, __M, __N, __K,
+                                    __alpha, { __A, nullptr, __strideA }, __lda, { __B, nullptr, __strideB }, __ldb,
+                                    __beta, { __C, nullptr, __strideC }, __ldc, __BatchCount, { 9, 12, 16, 18 });
+}
+
+inline void cblas_dgemm_batch_strided(const enum CBLAS_ORDER __Order,
+                                      const enum CBLAS_TRANSPOSE __TransA,
+                                      const enum CBLAS_TRANSPOSE __TransB, const int __M, const int __N,
+                                      const int __K, const double __alpha, const double *__A, const int __lda,
+                                      const int __strideA, const double *__B, const int __ldb,
+                                      const int __strideB, const double __beta, double *__C, const int __ldc,
+                                      const int __strideC, const int __BatchCount)
+{
+    detail::blas_batch_entry<double>("cblas_dgemm_batch_strided", __Order, __TransA, __TransB, __M, __N, __K,
+                                     __alpha, { __A, nullptr, __strideA }, __lda, { __B, nullptr, __strideB }, __ldb,
+                                     __beta, { __C, nullptr, __strideC }, __ldc, __BatchCount, { 9, 12, 16, 18 });
+}
+
+// __BatchCount products of one shape, the operands of product i at
+// __A[i], __B[i] and __C[i].
+inline void cblas_sgemm_batch(const enum CBLAS_ORDER __Order,
+                              const enum CBLAS_TRANSPOSE __TransA,
+                              const enum CBLAS_TRANSPOSE __TransB, const int __M, const int __N,
+                              const int __K, const float __alpha, const float *const *__A, const int __lda,
+                              const float *const *__B, const int __ldb, const float __beta,
+                              float *const *__C, const int __ldc, const int __BatchCount)
+{
+    detail::blas_batch_entry<float>("cblas_sgemm_batch", __Order, __TransA, __TransB, __M, __N, __K, __alpha,
+                                    { nullptr, __A, 0 }, __lda, { nullptr, __B, 0 }, __ldb, __beta,
+                                    { nullptr, __C, 0 }, __ldc, __BatchCount, { 9, 11, 14, 15 });
+}
+
+inline void cblas_dgemm_batch(const enum CBLAS_ORDER __Order,
+                              const enum CBLAS_TRANSPOSE __TransA,
+                              const enum CBLAS_TRANSPOSE __TransB, const int __M, const int __N,
+                              const int __K, const double __alpha, const double *const *__A, const int __lda,
+                              const double *const *__B, const int __ldb, const double __beta,
+                              double *const *__C, const int __ldc, const int __BatchCount)
+{
+    detail::blas_batch_entry<double>("cblas_dgemm_batch", __Order, __TransA, __TransB, __M, __N, __K, __alpha,
+                                     { nullptr, __A, 0 }, __lda, { nullptr, __B, 0 }, __ldb, __beta,
+                                     { nullptr, __C, 0 }, __ldc, __BatchCount, { 9, 11, 14, 15 });
+}
+
+} // namespace vdsp
+
+#endif /* __cplusplus */
+
+#endif /* __CBLAS_PORTABLE__ */
@@ -0,0 +1,704 @@
+/*
+    File:       vecLib/clapack_portable.h
+
+    Contains:   Portable LU and Cholesky solvers with mixed-precision refinement
+
+    This header implements the dense linear solvers of clapack.h in C++,
+    for hosts without Accelerate, together with the two drivers that
+    factor in single precision and refine the solution to double:
+
+        sgetrf_  dgetrf_    A = P*L*U, with partial pivoting
+        sgetrs_  dgetrs_    op(A)*X = B, from the factors of sgetrf_
+        sgesv_   dgesv_     both
+        spotrf_  dpotrf_    A = L*L' or U'*U, for positive definite A
+        spotrs_  dpotrs_    A*X = B, from the factors of spotrf_
+        sposv_   dposv_     both
+        dsgesv_  dsposv_    dgesv_ and dposv_, factoring in single precision
+
+    They keep the names, parameter lists, argument checks and column-major
+    storage of clapack.h, in namespace vdsp.
+
+    The factorizations are recursive.  Each factors the left half of its
+    columns, updates the right half with a triangular solve and a matrix
+    product, and factors what remains, so that nearly all the arithmetic
+    is in products.  Those run on the GEMM and GEMV of cblas_portable.h,
+    on as many threads as cblas_set_num_threads() allows.  The columns at
+    the bottom of the recursion are eliminated with vDSP_vsma.
+
+    dsgesv_ and dsposv_ do what LAPACK's do.  They round A and B to single
+    precision, factor and solve there, and then, up to 30 times, compute
+    the residual R = B - A*X in double precision, solve for a correction
+    with the single precision factors and add it to X.  They stop when
+    every column of R is within sqrt(n)*eps*|A|*|X|, in the infinity norm
+    and with eps = 2^-53, and ITER is the number of corrections.  If A or
+    B overflow single precision (ITER -2), the single precision factors
+    do not exist (-3) or the corrections do not converge (-31), they solve
+    the system again as dgesv_ and dposv_ would, in A.  Single precision
+    factors take half the time and a quarter of the memory traffic of
+    double, and for condition numbers up to about 10^6 they reach the
+    same accuracy in two or three corrections.
+
+    Every instruction set and every thread count return the same bits:
+    the recursion follows from the shape, products are bit-reproducible,
+    and multiplies and adds are never fused.
+
+    la_solve() in LinearAlgebra_portable.h solves square systems with
+    these routines.  The other LAPACK routines, and the complex types,
+    are not provided.
+*/
+#ifndef __CLAPACK_PORTABLE__
+#define __CLAPACK_PORTABLE__
+
+#if defined(__cplusplus)
+
+#include <vecLib/cblas_portable.h>
+#include <vecLib/vDSP_portable.h>
+
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+#include <initializer_list>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// As in clapack.h, which may or may not have been included first.
+#ifndef __CLAPACK_H
+#if defined(__LP64__) /* In LP64 match sizes with the 32 bit ABI */
+    typedef int 		__CLPK_integer;
+    typedef float 		__CLPK_real;
+    typedef double 		__CLPK_doublereal;
+#else
+    typedef long int 	__CLPK_integer;
+    typedef float 		__CLPK_real;
+    typedef double 		__CLPK_doublereal;
+#endif
+#endif  /* __CLAPACK_H */
+
+namespace vdsp {
+namespace detail {
+
+// Element (i, j) of a matrix is p[i*si + j*sj].  Column-major matrices
+// have si == 1, and their transposes sj == 1.
+template <class T>
+struct lapack_matrix {
+    T*      p;
+    long    si, sj;
+
+    T& operator()(long i, long j) const { return p[i * si + j * sj]; }
+    lapack_matrix at(long i, long j) const { return { p + i * si + j * sj, si, sj }; }
+    lapack_matrix t() const { return { p, sj, si }; }
+    operator blas_operand<T>() const { return { p, si, sj }; }
+};
+
+// C -= A*B, for an m x k A and a k x n B.  A C with contiguous rows is
+// a product as it is, and one with contiguous columns is C' -= B'*A';
+// a single contiguous column is a matrix-vector product.
+template <class T>
+inline void lapack_update(const lapack_matrix<T>& c, const lapack_matrix<T>& a, const lapack_matrix<T>& b, long m,
+                          long n, long k)
+{
+    if (m == 0 || n == 0 || k == 0)
+        return;
+    if (n == 1 && c.si == 1 && b.si == 1)
+        return blas_gemv(blas_gemv_call<T>{ a, b.p, c.p, m, k, -1, 1 });
+    if (c.sj == 1)
+        return blas_gemm(blas_gemm_call<T>{ a, b, c.p, c.si, m, n, k, -1, 1, blas_block<T>(m, n, k) });
+    blas_gemm(blas_gemm_call<T>{ b.t(), a.t(), c.p, c.sj, n, m, k, -1, 1, blas_block<T>(n, m, k) });
+}
+
+inline void lapack_axpy(const float* x, long ix, float s, float* y, long iy, long n)
+{
+    vDSP_vsma(x, ix, &s, y, iy, y, iy, (vDSP_Length)n);
+}
+
+inline void lapack_axpy(const double* x, long ix, double s, double* y, long iy, long n)
+{
+    vDSP_vsmaD(x, ix, &s, y, iy, y, iy, (vDSP_Length)n);
+}
+
+// Interchanges rows i and ipiv[i] - 1 of the n columns of a, for i from
+// first up to last, or back down from last.  Columns go 32 at a time,
+// so that the rows of a block stay in cache across the interchanges.
+template <class T>
+inline void lapack_swap(const lapack_matrix<T>& a, long n, const __CLPK_integer* ipiv, long first, long last, bool back)
+{
+    for (long j0 = 0; j0 < n; j0 += 32) {
+        const long j1 = std::min(n, j0 + 32);
+        for (long s = 0; s < last - first; s++) {
+            const long i = back ? last - 1 - s : first + s, p = ipiv[i] - 1;
+            if (p != i)
+                for (long j = j0; j < j1; j++)
+                    std::swap(a(i, j), a(p, j));
+        }
+    }
+}
+
+// B = T^-1 * B, for an n x n triangular T, with ones on its diagonal if
+// unit, and an n x r B.  Halves T, down to blocks of 16 rows solved by
+// substitution.
+template <class T>
+__VDSP_NOCONTRACT void lapack_trsm(const lapack_matrix<T>& t, const lapack_matrix<T>& b, long n, long r, bool lower,
+                                   bool unit)
+{
+    if (n <= 16) {
+        for (long j = 0; j < r; j++) {
+            for (long s = 0; s < n; s++) {
+                const long i = lower ? s : n - 1 - s;
+                T x = b(i, j);
+                for (long l = lower ? 0 : i + 1; l < (lower ? i : n); l++)
+                    x -= t(i, l) * b(l, j);
+                b(i, j) = unit ? x : x / t(i, i);
+            }
+        }
+        return;
+    }
+    const long n1 = n / 2, n2 = n - n1;
+    if (lower) {
+        lapack_trsm(t, b, n1, r, lower, unit);
+        lapack_update(b.at(n1, 0), t.at(n1, 0), b, n2, r, n1);
+        lapack_trsm(t.at(n1, n1), b.at(n1, 0), n2, r, lower, unit);
+    } else {
+        lapack_trsm(t.at(n1, n1), b.at(n1, 0), n2, r, lower, unit);
+        lapack_update(b, t.at(0, n1), b.at(n1, 0), n1, r, n2);
+        lapack_trsm(t, b, n1, r, lower, unit);
+    }
+}
+
+// The lower triangle of C -= A*A', for an n x n C and an n x k A.  Blocks
+// of up to 64 on the diagonal are multiplied whole into a temporary, and
+// only their lower triangles subtracted, so the upper triangle of C is
+// not touched.
+template <class T>
+inline void lapack_syrk(const lapack_matrix<T>& c, const lapack_matrix<T>& a, long n, long k)
+{
+    if (n <= 64) {
+        std::vector<T> w(n * n);
+        blas_gemm(blas_gemm_call<T>{ a, a.t(), w.data(), n, n, n, k, 1, 0, blas_block<T>(n, n, k) });
+        for (long j = 0; j < n; j++)
+            for (long i = j; i < n; i++)
+                c(i, j) -= w[i * n + j];
+        return;
+    }
+    const long n1 = n / 2, n2 = n - n1;
+    lapack_syrk(c, a, n1, k);
+    lapack_update(c.at(n1, 0), a.at(n1, 0), a.t(), n2, n1, k);
+    lapack_syrk(c.at(n1, n1), a.at(n1, 0), n2, k);
+}
+
+// Factors the m x n column-major a in place into P*L*U, with the rows
+// interchanged as ipiv says, 1-based as in LAPACK.  Returns the 1-based
+// index of the first zero pivot, or 0; the factorization goes on past
+// one, as dgetrf_'s does.
+template <class T>
+inline long lapack_getrf(const lapack_matrix<T>& a, long m, long n, __CLPK_integer* ipiv)
+{
+    const long mn = std::min(m, n);
+    long info = 0;
+    if (mn <= 8) {
+        for (long j = 0; j < mn; j++) {
+            long p = j;
+            for (long i = j + 1; i < m; i++)
+                if (fabs(a(i, j)) > fabs(a(p, j)))
+                    p = i;
+            ipiv[j] = (__CLPK_integer)(p + 1);
+            const T d = a(p, j);
+            if (d != 0) {
+                if (p != j)
+                    for (long l = 0; l < n; l++)
+                        std::swap(a(j, l), a(p, l));
+                if (fabs(d) >= std::numeric_limits<T>::min()) {
+                    const T s = 1 / d;
+                    for (long i = j + 1; i < m; i++)
+                        a(i, j) *= s;
+                } else {
+                    for (long i = j + 1; i < m; i++)
+                        a(i, j) /= d;
+                }
+            } else if (info == 0) {
+                info = j + 1;
+            }
+            for (long l = j + 1; l < n; l++)
+                lapack_axpy(&a(j + 1, j), a.si, -a(j, l), &a(j + 1, l), a.si, m - j - 1);
+        }
+        return info;
+    }
+    const long n1 = mn / 2, n2 = n - n1;
+    info = lapack_getrf(a, m, n1, ipiv);
+    lapack_swap(a.at(0, n1), n2, ipiv, 0, n1, false);
+    lapack_trsm(a, a.at(0, n1), n1, n2, true, true);
+    lapack_update(a.at(n1, n1), a.at(n1, 0), a.at(0, n1), m - n1, n2, n1);
+    const long rest = lapack_getrf(a.at(n1, n1), m - n1, n2, ipiv + n1);
+    if (info == 0 && rest != 0)
+        info = rest + n1;
+    for (long i = n1; i < mn; i++)
+        ipiv[i] += (__CLPK_integer)n1;
+    lapack_swap(a, n1, ipiv, n1, mn, false);
+    return info;
+}
+
+// Factors the lower triangle of the n x n a in place into L*L'.  Returns
+// the 1-based order of the first leading minor that is not positive
+// definite, or 0, and leaves that diagonal element unrooted, as
+// dpotrf_ does.
+template <class T>
+__VDSP_NOCONTRACT long lapack_potrf(const lapack_matrix<T>& a, long n)
+{
+    if (n <= 16) {
+        for (long j = 0; j < n; j++) {
+            T d = a(j, j);
+            for (long l = 0; l < j; l++)
+                d -= a(j, l) * a(j, l);
+            if (!(d > 0)) {
+                a(j, j) = d;
+                return j + 1;
+            }
+            d = sqrt(d);
+            a(j, j) = d;
+            for (long i = j + 1; i < n; i++) {
+                T x = a(i, j);
+                for (long l = 0; l < j; l++)
+                    x -= a(i, l) * a(j, l);
+                a(i, j) = x / d;
+            }
+        }
+        return 0;
+    }
+    const long n1 = n / 2, n2 = n - n1;
+    if (const long info = lapack_potrf(a, n1))
+        return info;
+    // L21 = A21 * L11'^-1, solved as L11 * L21' = A21'.
+    lapack_trsm(a, a.at(n1, 0).t(), n1, n2, true, false);
+    lapack_syrk(a.at(n1, n1), a.at(n1, 0), n2, n1);
+    const long info = lapack_potrf(a.at(n1, n1), n2);
+    return info ? info + n1 : 0;
+}
+
+// Solves op(A)*X = B in place of the n x r B, from the factors of
+// lapack_getrf; op(A) is A' when trans.
+template <class T>
+inline void lapack_getrs(bool trans, const lapack_matrix<T>& a, long n, const __CLPK_integer* ipiv,
+                         const lapack_matrix<T>& b, long r)
+{
+    if (!trans) {
+        lapack_swap(b, r, ipiv, 0, n, false);
+        lapack_trsm(a, b, n, r, true, true);
+        lapack_trsm(a, b, n, r, false, false);
+    } else {
+        lapack_trsm(a.t(), b, n, r, true, false);
+        lapack_trsm(a.t(), b, n, r, false, true);
+        lapack_swap(b, r, ipiv, 0, n, true);
+    }
+}
+
+// Solves A*X = B in place of B, from the factor L of lapack_potrf.
+template <class T>
+inline void lapack_potrs(const lapack_matrix<T>& l, long n, const lapack_matrix<T>& b, long r)
+{
+    lapack_trsm(l, b, n, r, true, false);
+    lapack_trsm(l.t(), b, n, r, false, false);
+}
+
+// The matrix an uplo of 'L' or 'U' picks out, as a lower triangle.
+template <class T>
+inline lapack_matrix<T> lapack_lower(char uplo, T* a, long lda)
+{
+    return uplo == 'U' || uplo == 'u' ? lapack_matrix<T>{ a, lda, 1 } : lapack_matrix<T>{ a, 1, lda };
+}
+
+// R -= A*X for a symmetric n x n A given by its lower triangle, a block
+// of 256 columns of A at a time: above the diagonal block as transposed
+// rows of the triangle, the block itself completed in a temporary, and
+// below it as it is.
+inline void lapack_symm(const lapack_matrix<double>& r, const lapack_matrix<double>& a, const lapack_matrix<double>& x,
+                        long n, long k)
+{
+    constexpr long nb = 256;
+    std::vector<double> d(std::min(n, nb) * std::min(n, nb));
+    for (long j = 0; j < n; j += nb) {
+        const long w = std::min(nb, n - j);
+        const lapack_matrix<double> block = { d.data(), 1, w };
+        for (long q = 0; q < w; q++)
+            for (long p = 0; p < w; p++)
+                block(p, q) = p >= q ? a(j + p, j + q) : a(j + q, j + p);
+        lapack_update(r, a.at(j, 0).t(), x.at(j, 0), j, k, w);
+        lapack_update(r.at(j, 0), block, x.at(j, 0), w, k, w);
+        lapack_update(r.at(j + w, 0), a.at(j + w, j), x.at(j, 0), n - j - w, k, w);
+    }
+}
+
+// The infinity norm of op(A), or of the symmetric A whose lower triangle
+// a is.
+inline double lapack_norm(const lapack_matrix<double>& a, long n, bool symmetric)
+{
+    std::vector<double> sums(n);
+    for (long j = 0; j < n; j++) {
+        for (long i = symmetric ? j : 0; i < n; i++) {
+            const double v = fabs(a(i, j));
+            sums[i] += v;
+            if (symmetric && i != j)
+                sums[j] += v;
+        }
+    }
+    double most = 0;
+    for (long i = 0; i < n; i++)
+        most = sums[i] > most || isnan(sums[i]) ? sums[i] : most;
+    return most;
+}
+
+// y = x rounded to single precision, or false if an element overflows.
+// Only the lower triangle when lower.
+inline bool lapack_narrow(const lapack_matrix<float>& y, const lapack_matrix<double>& x, long m, long n, bool lower)
+{
+    for (long j = 0; j < n; j++) {
+        for (long i = lower ? j : 0; i < m; i++) {
+            const double v = x(i, j);
+            if (v < -FLT_MAX || v > FLT_MAX)
+                return false;
+            y(i, j) = (float)v;
+        }
+    }
+    return true;
+}
+
+// Whether every column of the residual r is within cte times the same
+// column of x, in the infinity norm.  NaNs do not converge.
+inline bool lapack_converged(const lapack_matrix<double>& r, const lapack_matrix<double>& x, long n, long k, double cte)
+{
+    for (long j = 0; j < k; j++) {
+        double rn = 0, xn = 0;
+        for (long i = 0; i < n; i++) {
+            rn = std::max(rn, fabs(r(i, j)));
+            xn = std::max(xn, fabs(x(i, j)));
+            if (isnan(r(i, j)))
+                return false;
+        }
+        if (!(rn <= xn * cte))
+            return false;
+    }
+    return true;
+}
+
+// Solves op(A)*X = B for the n x n column-major a, or for the symmetric
+// positive definite one whose lower triangle it is if spd, factoring in
+// single precision and refining in double, as dsgesv_ and dsposv_ do.
+// work holds n x r doubles and swork n x (n + r) floats.  Refinement
+// stops within eps of the double precision residual.  Returns the info
+// of the double precision factorization, if it came to that.
+inline long lapack_refine(bool spd, bool trans, long n, long r, const lapack_matrix<double>& a, __CLPK_integer* ipiv,
+                          const lapack_matrix<double>& b, const lapack_matrix<double>& x, double* work, float* swork,
+                          double eps, long& iter)
+{
+    constexpr long most = 30;
+    const lapack_matrix<float> sa = { swork, 1, n }, sx = { swork + n * n, 1, n };
+    const lapack_matrix<double> res = { work, 1, n }, op = trans ? a.t() : a;
+    iter = -2;
+    if (lapack_narrow(sa, a, n, n, spd) && lapack_narrow(sx, b, n, r, false)) {
+        iter = -3;
+        if ((spd ? lapack_potrf(sa, n) : lapack_getrf(sa, n, n, ipiv)) == 0) {
+            const double cte = lapack_norm(op, n, spd) * eps * sqrt((double)n);
+            for (long step = 0;; step++) {
+                if (spd)
+                    lapack_potrs(sa, n, sx, r);
+                else
+                    lapack_getrs(trans, sa, n, ipiv, sx, r);
+                for (long j = 0; j < r; j++) {
+                    for (long i = 0; i < n; i++) {
+                        x(i, j) = step ? x(i, j) + (double)sx(i, j) : (double)sx(i, j);
+                        res(i, j) = b(i, j);
+                    }
+                }
+                if (spd)
+                    lapack_symm(res, a, x, n, r);
+                else
+                    lapack_update(res, op, x, n, r, n);
+                if (lapack_converged(res, x, n, r, cte)) {
+                    iter = step;
+                    return 0;
+                }
+                iter = -most - 1;
+                if (step == most)
+                    break;
+                if (!lapack_narrow(sx, res, n, r, false)) {
+                    iter = -2;
+                    break;
+                }
+            }
+        }
+    }
+    for (long j = 0; j < r; j++)
+        for (long i = 0; i < n; i++)
+            x(i, j) = b(i, j);
+    const long info = spd ? lapack_potrf(a, n) : lapack_getrf(a, n, n, ipiv);
+    if (info == 0) {
+        if (spd)
+            lapack_potrs(a, n, x, r);
+        else
+            lapack_getrs(trans, a, n, ipiv, x, r);
+    }
+    return info;
+}
+
+// The number of the first parameter whose condition fails, or 0.
+inline long lapack_check(std::initializer_list<std::pair<bool, long>> checks)
+{
+    for (const auto& c : checks)
+        if (!c.first)
+            return c.second;
+    return 0;
+}
+
+inline bool lapack_is(char c, char upper) { return c == upper || c == upper + 'a' - 'A'; }
+
+inline bool lapack_uplo(const char* uplo) { return lapack_is(*uplo, 'U') || lapack_is(*uplo, 'L'); }
+
+inline bool lapack_trans(const char* t) { return lapack_is(*t, 'N') || lapack_is(*t, 'T') || lapack_is(*t, 'C'); }
+
+// Reports parameter p of routine, as LAPACK's xerbla does, and returns
+// its info.
+inline long lapack_bad(long p, const char* routine)
+{
+    blas_xerbla((int)p, routine);
+    return -p;
+}
+
+template <class T>
+inline void lapack_getrf_entry(const char* routine, __CLPK_integer* m, __CLPK_integer* n, T* a, __CLPK_integer* lda,
+                               __CLPK_integer* ipiv, __CLPK_integer* info)
+{
+    if (const long p = lapack_check({ { *m >= 0, 1 }, { *n >= 0, 2 }, { *lda >= std::max<__CLPK_integer>(1, *m), 4 } })) {
+        *info = (__CLPK_integer)lapack_bad(p, routine);
+        return;
+    }
+    *info = 0;
+    if (*m != 0 && *n != 0)
+        *info = (__CLPK_integer)lapack_getrf<T>({ a, 1, *lda }, *m, *n, ipiv);
+}
+
+template <class T>
+inline void lapack_getrs_entry(const char* routine, char* trans, __CLPK_integer* n, __CLPK_integer* nrhs, T* a,
+                               __CLPK_integer* lda, __CLPK_integer* ipiv, T* b, __CLPK_integer* ldb,
+                               __CLPK_integer* info)
+{
+    const __CLPK_integer least = std::max<__CLPK_integer>(1, *n);
+    if (const long p = lapack_check({ { lapack_trans(trans), 1 }, { *n >= 0, 2 }, { *nrhs >= 0, 3 },
+                                      { *lda >= least, 5 }, { *ldb >= least, 8 } })) {
+        *info = (__CLPK_integer)lapack_bad(p, routine);
+        return;
+    }
+    *info = 0;
+    if (*n != 0 && *nrhs != 0)
+        lapack_getrs<T>(!lapack_is(*trans, 'N'), { a, 1, *lda }, *n, ipiv, { b, 1, *ldb }, *nrhs);
+}
+
+template <class T>
+inline void lapack_gesv_entry(const char* routine, __CLPK_integer* n, __CLPK_integer* nrhs, T* a, __CLPK_integer* lda,
+                              __CLPK_integer* ipiv, T* b, __CLPK_integer* ldb, __CLPK_integer* info)
+{
+    const __CLPK_integer least = std::max<__CLPK_integer>(1, *n);
+    if (const long p = lapack_check({ { *n >= 0, 1 }, { *nrhs >= 0, 2 }, { *lda >= least, 4 }, { *ldb >= least, 7 } })) {
+        *info = (__CLPK_integer)lapack_bad(p, routine);
+        return;
+    }
+    *info = 0;
+    if (*n == 0)
+        return;
+    *info = (__CLPK_integer)lapack_getrf<T>({ a, 1, *lda }, *n, *n, ipiv);
+    if (*info == 0 && *nrhs != 0)
+        lapack_getrs<T>(false, { a, 1, *lda }, *n, ipiv, { b, 1, *ldb }, *nrhs);
+}
+
+template <class T>
+inline void lapack_potrf_entry(const char* routine, char* uplo, __CLPK_integer* n, T* a, __CLPK_integer* lda,
+                               __CLPK_integer* info)
+{
+    if (const long p = lapack_check({ { lapack_uplo(uplo), 1 }, { *n >= 0, 2 },
+                                      { *lda >= std::max<__CLPK_integer>(1, *n), 4 } })) {
+        *info = (__CLPK_integer)lapack_bad(p, routine);
+        return;
+    }
+    *info = 0;
+    if (*n != 0)
+        *info = (__CLPK_integer)lapack_potrf(lapack_lower(*uplo, a, *lda), *n);
+}
+
+template <class T>
+inline void lapack_potrs_entry(const char* routine, char* uplo, __CLPK_integer* n, __CLPK_integer* nrhs, T* a,
+                               __CLPK_integer* lda, T* b, __CLPK_integer* ldb, __CLPK_integer* info, bool factor)
+{
+    const __CLPK_integer least = std::max<__CLPK_integer>(1, *n);
+    if (const long p = lapack_check({ { lapack_uplo(uplo), 1 }, { *n >= 0, 2 }, { *nrhs >= 0, 3 },
+                                      { *lda >= least, 5 }, { *ldb >= least, 7 } })) {
+        *info = (__CLPK_integer)lapack_bad(p, routine);
+        return;
+    }
+    *info = 0;
+    if (*n == 0)
+        return;
+    const lapack_matrix<T> l = lapack_lower(*uplo, a, *lda);
+    if (factor)
+        *info = (__CLPK_integer)lapack_potrf(l, *n);
+    if (*info == 0 && *nrhs != 0)
+        lapack_potrs<T>(l, *n, { b, 1, *ldb }, *nrhs);
+}
+
+inline void lapack_refine_entry(const char* routine, char* uplo, __CLPK_integer* n, __CLPK_integer* nrhs, double* a,
+                                __CLPK_integer* lda, __CLPK_integer* ipiv, double* b, __CLPK_integer* ldb, double* x,
+                                __CLPK_integer* ldx, double* work, float* swork, __CLPK_integer* iter,
+                                __CLPK_integer* info)
+{
+    // dsposv_'s parameters up to lda are one further on; it has no ipiv.
+    const long o = uplo ? 1 : 0;
+    const __CLPK_integer least = std::max<__CLPK_integer>(1, *n);
+    *iter = 0;
+    if (const long p = lapack_check({ { !uplo || lapack_uplo(uplo), 1 }, { *n >= 0, 1 + o }, { *nrhs >= 0, 2 + o },
+                                      { *lda >= least, 4 + o }, { *ldb >= least, 7 }, { *ldx >= least, 9 } })) {
+        *info = (__CLPK_integer)lapack_bad(p, routine);
+        return;
+    }
+    *info = 0;
+    if (*n == 0)
+        return;
+    long steps = 0;
+    const lapack_matrix<double> m = uplo ? lapack_lower(*uplo, a, *lda) : lapack_matrix<double>{ a, 1, *lda };
+    *info = (__CLPK_integer)lapack_refine(uplo != nullptr, false, *n, *nrhs, m, ipiv, { b, 1, *ldb }, { x, 1, *ldx },
+                                          work, swork, 0x1p-53, steps);
+    *iter = (__CLPK_integer)steps;
+}
+
+} // namespace detail
+
+inline int sgetrf_(__CLPK_integer *__m, __CLPK_integer *__n, __CLPK_real *__a,
+        __CLPK_integer *__lda, __CLPK_integer *__ipiv,
+        __CLPK_integer *__info)
+{
+    detail::lapack_getrf_entry("SGETRF", __m, __n, __a, __lda, __ipiv, __info);
+    return 0;
+}
+
+inline int dgetrf_(__CLPK_integer *__m, __CLPK_integer *__n, __CLPK_doublereal *__a,
+        __CLPK_integer *__lda, __CLPK_integer *__ipiv,
+        __CLPK_integer *__info)
+{
+    detail::lapack_getrf_entry("DGETRF", __m, __n, __a, __lda, __ipiv, __info);
+    return 0;
+}
+
+inline int sgetrs_(char *__trans, __CLPK_integer *__n, __CLPK_integer *__nrhs,
+        __CLPK_real *__a, __CLPK_integer *__lda, __CLPK_integer *__ipiv,
+        __CLPK_real *__b, __CLPK_integer *__ldb,
+        __CLPK_integer *__info)
+{
+    detail::lapack_getrs_entry("SGETRS", __trans, __n, __nrhs, __a, __lda, __ipiv, __b, __ldb, __info);
+    return 0;
+}
+
+inline int dgetrs_(char *__trans, __CLPK_integer *__n, __CLPK_integer *__nrhs,
+        __CLPK_doublereal *__a, __CLPK_integer *__lda, __CLPK_integer *__ipiv,
+        __CLPK_doublereal *__b, __CLPK_integer *__ldb,
+        __CLPK_integer *__info)
+{
+    detail::lapack_getrs_entry("DGETRS", __trans, __n, __nrhs, __a, __lda, __ipiv, __b, __ldb, __info);
+    return 0;
+}
+
+inline int sgesv_(__CLPK_integer *__n, __CLPK_integer *__nrhs, __CLPK_real *__a,
+        __CLPK_integer *__lda, __CLPK_integer *__ipiv, __CLPK_real *__b,
+        __CLPK_integer *__ldb,
+        __CLPK_integer *__info)
+{
+    detail::lapack_gesv_entry("SGESV", __n, __nrhs, __a, __lda, __ipiv, __b, __ldb, __info);
+    return 0;
+}
+
+inline int dgesv_(__CLPK_integer *__n, __CLPK_integer *__nrhs, __CLPK_doublereal *__a,
+        __CLPK_integer *__lda, __CLPK_integer *__ipiv, __CLPK_doublereal *__b,
+        __CLPK_integer *__ldb,
+        __CLPK_integer *__info)
+{
+    detail::lapack_gesv_entry("DGESV", __n, __nrhs, __a, __lda, __ipiv, __b, __ldb, __info);
+    return 0;
+}
+
+inline int spotrf_(char *__uplo, __CLPK_integer *__n, __CLPK_real *__a,
+        __CLPK_integer *__lda,
+        __CLPK_integer *__info)
+{
+    detail::lapack_potrf_entry("SPOTRF", __uplo, __n, __a, __lda, __info);
+    return 0;
+}
+
+inline int dpotrf_(char *__uplo, __CLPK_integer *__n, __CLPK_doublereal *__a,
+        __CLPK_integer *__lda,
+        __CLPK_integer *__info)
+{
+    detail::lapack_potrf_entry("DPOTRF", __uplo, __n, __a, __lda, __info);
+    return 0;
+}
+
+inline int spotrs_(char *__uplo, __CLPK_integer *__n, __CLPK_integer *__nrhs,
+        __CLPK_real *__a, __CLPK_integer *__lda, __CLPK_real *__b,
+        __CLPK_integer *__ldb,
+        __CLPK_integer *__info)
+{
+    detail::lapack_potrs_entry("SPOTRS", __uplo, __n, __nrhs, __a, __lda, __b, __ldb, __info, false);
+    return 0;
+}
+
+inline int dpotrs_(char *__uplo, __CLPK_integer *__n, __CLPK_integer *__nrhs,
+        __CLPK_doublereal *__a, __CLPK_integer *__lda, __CLPK_doublereal *__b,
+        __CLPK_integer *__ldb,
+        __CLPK_integer *__info)
+{
+    detail::lapack_potrs_entry("DPOTRS", __uplo, __n, __nrhs, __a, __lda, __b, __ldb, __info, false);
+    return 0;
+}
+
+inline int sposv_(char *__uplo, __CLPK_integer *__n, __CLPK_integer *__nrhs,
+        __CLPK_real *__a, __CLPK_integer *__lda, __CLPK_real *__b,
+        __CLPK_integer *__ldb,
+        __CLPK_integer *__info)
+{
+    detail::lapack_potrs_entry("SPOSV", __uplo, __n, __nrhs, __a, __lda, __b, __ldb, __info, true);
+    return 0;
+}
+
+inline int dposv_(char *__uplo, __CLPK_integer *__n, __CLPK_integer *__nrhs,
+        __CLPK_doublereal *__a, __CLPK_integer *__lda, __CLPK_doublereal *__b,
+        __CLPK_integer *__ldb,
+        __CLPK_integer *__info)
+{
+    detail::lapack_potrs_entry("DPOSV", __uplo, __n, __nrhs, __a, __lda, __b, __ldb, __info, true);
+    return 0;
+}
+
+// X = A^-1 * B, factoring A in single precision.  A is left unchanged
+// unless ITER < 0, when it holds the double precision factors.
+inline int dsgesv_(__CLPK_integer *__n, __CLPK_integer *__nrhs, __CLPK_doublereal *__a,
+        __CLPK_integer *__lda, __CLPK_integer *__ipiv, __CLPK_doublereal *__b,
+        __CLPK_integer *__ldb, __CLPK_doublereal *__x, __CLPK_integer *__ldx,
+        __CLPK_doublereal *__work, __CLPK_real *__swork, __CLPK_integer *__iter,
+        __CLPK_integer *__info)
+{
+    detail::lapack_refine_entry("DSGESV", nullptr, __n, __nrhs, __a, __lda, __ipiv, __b, __ldb, __x, __ldx, __work,
+                                __swork, __iter, __info);
+    return 0;
+}
+
+inline int dsposv_(char *__uplo, __CLPK_integer *__n, __CLPK_integer *__nrhs,
+        __CLPK_doublereal *__a, __CLPK_integer *__lda, __CLPK_doublereal *__b,
+        __CLPK_integer *__ldb, __CLPK_doublereal *__x, __CLPK_integer *__ldx,
+        __CLPK_doublereal *__work, __CLPK_real *__swork, __CLPK_integer *__iter,
+        __CLPK_integer *__info)
+{
+    detail::lapack_refine_entry("DSPOSV", __uplo, __n, __nrhs, __a, __lda, nullptr, __b, __ldb, __x, __ldx, __work,
+                                __swork, __iter, __info);
+    return 0;
+}
+
+} // namespace vdsp
+
+#endif /* __cplusplus */
+
+#endif /* __CLAPACK_PORTABLE__ */
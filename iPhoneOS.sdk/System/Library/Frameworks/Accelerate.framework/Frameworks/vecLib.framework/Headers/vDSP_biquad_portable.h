@@ -0,0 +1,465 @@
+/*
+    File:       vecLib/vDSP_biquad_portable.h
+
+    Contains:   Multi-channel, block-streaming biquad cascade engine
+
+    biquad_bank<T> runs the same cascade structure as vDSP_biquadm, with
+    S sections and C channels, each channel having its own coefficients.
+    It adds what real-time audio paths with many channels need:
+
+        The filter runs SIMD across channels, with several vectors of
+        channels in flight at once to hide the latency of the
+        recursion.  Each block is cut into tiles of 32 frames, and every
+        section runs over a tile before the next one starts.
+
+        Channels may be planar, one pointer per channel with a stride,
+        as for vDSP_biquadm, or interleaved, frame by frame.
+
+        Coefficient updates are lock free.  set_targets() may be called
+        from any thread while another thread is inside process().  It
+        publishes a complete coefficient set through a triple buffer,
+        which process() picks up at the start of its next block and ramps
+        to, linearly and per sample, over the number of samples given.
+        The stable (a1, a2) pairs form a convex triangle, so a ramp
+        between two stable filters stays stable.
+
+        process() never allocates, locks or waits.  All memory is taken
+        by the constructor.
+
+    The state is that of Direct Form I, as vDSP_biquad's Delay array
+    holds it: the last two samples into and out of each section.  A
+    coefficient change therefore never disturbs the state.  Like
+    vDSP_biquadm, one bank must not be processed from two threads at
+    once.
+
+    Coefficients are given in double, five per section (B0, B1, B2, A1,
+    A2) as for vDSP_biquad_CreateSetup, with the sections of channel 0
+    first, then those of channel 1, and so on.  Each section computes
+
+        y[n] = B0*x[n] + B1*x[n-1] + B2*x[n-2] - A1*y[n-1] - A2*y[n-2]
+
+    in that order, without fused multiply-adds, so every instruction set
+    produces the same output bit for bit.  Denormals are left to the
+    caller.  Audio threads usually enable flush-to-zero.
+
+    vDSP_biquadm_CreateSetup, vDSP_biquadm, vDSP_biquadm_DestroySetup,
+    vDSP_biquadm_CopyState, vDSP_biquadm_ResetState and
+    vDSP_biquadm_SetCoefficientsDouble/Single (with the D variants where
+    vDSP has them) are provided in namespace vdsp on top of it.
+*/
+#ifndef __VDSP_BIQUAD_PORTABLE__
+#define __VDSP_BIQUAD_PORTABLE__
+
+#if defined(__cplusplus)
+
+#include <vecLib/vDSP_portable.h>
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace vdsp {
+
+template <class T> class biquad_bank;
+
+namespace detail {
+
+// Frames [t0, t0 + n) of one process() call, in either channel layout.
+// ramp is set when the coefficients step after every frame.
+template <class T>
+struct biquad_call {
+    biquad_bank<T>*  bank;
+    const T* const*  x;         // planar: per-channel pointers
+    vDSP_Stride      ix;
+    T* const*        y;
+    vDSP_Stride      iy;
+    const T*         xi;        // interleaved: frame-major
+    T*               yi;
+    vDSP_Length      t0;
+    vDSP_Length      n;
+    bool             ramp;
+};
+
+static constexpr vDSP_Length biquad_tile = 32;
+
+} // namespace detail
+
+template <class T>
+class biquad_bank {
+public:
+    // Coefficients as described above.  Throws std::bad_alloc.
+    biquad_bank(const double* coeffs, vDSP_Length sections, vDSP_Length channels)
+        : _sections(sections), _channels(channels),
+          _pad((channels + lanes - 1) / lanes * lanes),
+          _cur(sections * 5 * _pad), _step(sections * 5 * _pad),
+          _state((sections + 1) * 2 * _pad), _master(sections * 5 * _pad),
+          _remaining(0), _front(0), _back(2), _middle(1)
+    {
+        for (slot& s : _slots)
+            s.coef.resize(sections * 5 * _pad);
+        write(_master.data(), coeffs, 0, 0, sections, channels);
+        for (slot& s : _slots)
+            s.coef = _master;
+        _cur = _master;
+    }
+
+    biquad_bank(const biquad_bank&) = delete;
+    biquad_bank& operator=(const biquad_bank&) = delete;
+
+    vDSP_Length sections() const { return _sections; }
+    vDSP_Length channels() const { return _channels; }
+
+    // Planar: channel c reads x[c][n*ix] and writes y[c][n*iy].  y may
+    // equal x.
+    void process(const T* const* x, vDSP_Stride ix, T* const* y, vDSP_Stride iy, vDSP_Length n)
+    {
+        run({ this, x, ix, y, iy, nullptr, nullptr, 0, n, false });
+    }
+
+    // Interleaved: channel c of frame n at x[n*channels() + c].  y may
+    // equal x.
+    void process_interleaved(const T* x, T* y, vDSP_Length n)
+    {
+        run({ this, nullptr, 0, nullptr, 0, x, y, 0, n, false });
+    }
+
+    // Sets sections [start_section, start_section + nsections) of channels
+    // [start_channel, start_channel + nchannels) from coeffs, laid out as
+    // for the constructor but for that range only, and ramps every channel
+    // from where it is to its new target over ramp samples (0 jumps).
+    // Lock free for process(); concurrent callers serialize among
+    // themselves.
+    void set_targets(const double* coeffs, vDSP_Length start_section, vDSP_Length start_channel,
+                     vDSP_Length nsections, vDSP_Length nchannels, vDSP_Length ramp)
+    {
+        if (start_section + nsections > _sections || start_channel + nchannels > _channels)
+            return;
+        std::lock_guard<std::mutex> hold(_writers);
+        write(_master.data(), coeffs, start_section, start_channel, nsections, nchannels);
+        slot& s = _slots[_back];
+        s.coef = _master;       // same size: copies without allocating
+        s.ramp = ramp;
+        _back = _middle.exchange(_back | fresh, std::memory_order_acq_rel) & 3;
+    }
+
+    // True while process() is still ramping to the last targets it took.
+    // For the processing thread.
+    bool ramping() const { return _remaining != 0; }
+
+    // Zeroes the delay values.  Not safe against a concurrent process().
+    void reset_state()
+    {
+        for (T& v : _state)
+            v = 0;
+    }
+
+    // Copies the delay values of a bank of the same shape.
+    void copy_state(const biquad_bank& src)
+    {
+        if (src._sections == _sections && src._channels == _channels)
+            _state = src._state;
+    }
+
+    // Read by the kernels.
+    vDSP_Length pad() const { return _pad; }
+    T* coefficients() { return _cur.data(); }
+    T* steps() { return _step.data(); }
+    T* state() { return _state.data(); }
+
+private:
+    static constexpr vDSP_Length lanes = 64 / sizeof(T);
+    static constexpr unsigned fresh = 4;
+
+    struct slot {
+        std::vector<T> coef;
+        vDSP_Length    ramp = 0;
+    };
+
+    vDSP_Length            _sections, _channels, _pad;
+    std::vector<T>         _cur, _step;     // [section][B0..A2][channel]
+    std::vector<T>         _state;          // [row][x[n-2], x[n-1]][channel]
+    std::vector<T>         _master;         // latest targets, writers only
+    vDSP_Length            _remaining;
+    slot                   _slots[3];
+    unsigned               _front, _back;   // owned by process(), set_targets()
+    std::atomic<unsigned>  _middle;         // slot index | fresh
+    std::mutex             _writers;
+
+    void write(T* dst, const double* coeffs, vDSP_Length s0, vDSP_Length c0, vDSP_Length ns, vDSP_Length nc)
+    {
+        for (vDSP_Length c = 0; c < nc; c++)
+            for (vDSP_Length s = 0; s < ns; s++)
+                for (vDSP_Length k = 0; k < 5; k++)
+                    dst[((s0 + s) * 5 + k) * _pad + c0 + c] = (T)coeffs[(c * ns + s) * 5 + k];
+    }
+
+    // Takes the newest published targets, if any, and sets up the ramp.
+    void poll()
+    {
+        if (!(_middle.load(std::memory_order_relaxed) & fresh))
+            return;
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & 3;
+        const slot& s = _slots[_front];
+        const vDSP_Length count = _cur.size();
+        if (s.ramp == 0) {
+            for (vDSP_Length i = 0; i < count; i++)
+                _cur[i] = s.coef[i];
+            _remaining = 0;
+            return;
+        }
+        const T r = (T)1 / (T)s.ramp;
+        for (vDSP_Length i = 0; i < count; i++)
+            _step[i] = (s.coef[i] - _cur[i]) * r;
+        _remaining = s.ramp;
+    }
+
+    void run(detail::biquad_call<T> k);
+};
+
+namespace detail {
+
+// Runs every section over len frames of the tile, G vectors of channels
+// starting at channel c0.  tile holds frame t, vector g at
+// tile[(t*G + g) * w].  Ramp advances the coefficients by their steps
+// after each frame.
+template <class T, int B, unsigned G, bool Ramp>
+__VDSP_INLINE void biquad_sections(biquad_bank<T>& bank, T* tile, vDSP_Length len, vDSP_Length c0)
+{
+    typedef typename simd<T, B>::vector V;
+    constexpr vDSP_Length w = simd<T, B>::width;
+    const vDSP_Length pad = bank.pad(), S = bank.sections();
+    T *coef = bank.coefficients(), *step = bank.steps(), *state = bank.state();
+
+    for (vDSP_Length s = 0; s < S; s++) {
+        V c[5][G], d[5][G], x1[G], x2[G], y1[G], y2[G];
+        T* cs = coef + s * 5 * pad + c0;
+        T* ds = step + s * 5 * pad + c0;
+        T* xs = state + s * 2 * pad + c0;
+        T* ys = xs + 2 * pad;
+        for (unsigned g = 0; g < G; g++) {
+            for (unsigned k = 0; k < 5; k++) {
+                load<true>(c[k][g], cs + k * pad + g * w, 1);
+                if constexpr (Ramp)
+                    load<true>(d[k][g], ds + k * pad + g * w, 1);
+            }
+            load<true>(x2[g], xs + g * w, 1);
+            load<true>(x1[g], xs + pad + g * w, 1);
+            load<true>(y2[g], ys + g * w, 1);
+            load<true>(y1[g], ys + pad + g * w, 1);
+        }
+        for (vDSP_Length t = 0; t < len; t++) {
+            for (unsigned g = 0; g < G; g++) {
+                V x, y;
+                load<true>(x, tile + (t * G + g) * w, 1);
+                y = c[0][g] * x + c[1][g] * x1[g] + c[2][g] * x2[g] - c[3][g] * y1[g] - c[4][g] * y2[g];
+                x2[g] = x1[g];
+                x1[g] = x;
+                y2[g] = y1[g];
+                y1[g] = y;
+                store<true>(tile + (t * G + g) * w, 1, y);
+                if constexpr (Ramp) {
+                    for (unsigned k = 0; k < 5; k++)
+                        c[k][g] += d[k][g];
+                }
+            }
+        }
+        // Row s now ends with this tile's inputs; row s + 1 is the next
+        // section's input and keeps its start-of-tile values until that
+        // section has run, except after the last section.
+        for (unsigned g = 0; g < G; g++) {
+            store<true>(xs + g * w, 1, x2[g]);
+            store<true>(xs + pad + g * w, 1, x1[g]);
+            if (s + 1 == S) {
+                store<true>(ys + g * w, 1, y2[g]);
+                store<true>(ys + pad + g * w, 1, y1[g]);
+            }
+            if constexpr (Ramp) {
+                for (unsigned k = 0; k < 5; k++)
+                    store<true>(cs + k * pad + g * w, 1, c[k][g]);
+            }
+        }
+    }
+}
+
+template <class T, int B, unsigned G>
+__VDSP_INLINE void biquad_group(const biquad_call<T>& k, vDSP_Length t0, vDSP_Length len, vDSP_Length c0)
+{
+    constexpr vDSP_Length w = simd<T, B>::width, span = G * w;
+    const vDSP_Length C = k.bank->channels();
+    const vDSP_Length live = C - c0 < span ? C - c0 : span;
+    alignas(64) T tile[biquad_tile * span];
+
+    if (k.xi) {
+        for (vDSP_Length t = 0; t < len; t++) {
+            memcpy(tile + t * span, k.xi + (t0 + t) * C + c0, live * sizeof(T));
+            for (vDSP_Length c = live; c < span; c++)
+                tile[t * span + c] = 0;
+        }
+    } else {
+        for (vDSP_Length c = 0; c < live; c++) {
+            const T* x = k.x[c0 + c] + (vDSP_Stride)t0 * k.ix;
+            for (vDSP_Length t = 0; t < len; t++)
+                tile[t * span + c] = x[(vDSP_Stride)t * k.ix];
+        }
+        for (vDSP_Length t = 0; t < len; t++)
+            for (vDSP_Length c = live; c < span; c++)
+                tile[t * span + c] = 0;
+    }
+
+    if (k.ramp)
+        biquad_sections<T, B, G, true>(*k.bank, tile, len, c0);
+    else
+        biquad_sections<T, B, G, false>(*k.bank, tile, len, c0);
+
+    if (k.yi) {
+        for (vDSP_Length t = 0; t < len; t++)
+            memcpy(k.yi + (t0 + t) * C + c0, tile + t * span, live * sizeof(T));
+    } else {
+        for (vDSP_Length c = 0; c < live; c++) {
+            T* y = k.y[c0 + c] + (vDSP_Stride)t0 * k.iy;
+            for (vDSP_Length t = 0; t < len; t++)
+                y[(vDSP_Stride)t * k.iy] = tile[t * span + c];
+        }
+    }
+}
+
+template <class T, int B>
+__VDSP_INLINE void biquad_run(const biquad_call<T>& k)
+{
+    constexpr vDSP_Length w = simd<T, B>::width;
+    const vDSP_Length C = k.bank->channels();
+    for (vDSP_Length t0 = k.t0; t0 < k.t0 + k.n; t0 += biquad_tile) {
+        const vDSP_Length len = k.t0 + k.n - t0 < biquad_tile ? k.t0 + k.n - t0 : biquad_tile;
+        vDSP_Length c0 = 0;
+        for (; c0 + 3 * w < C; c0 += 4 * w)
+            biquad_group<T, B, 4>(k, t0, len, c0);
+        for (; c0 + w < C; c0 += 2 * w)
+            biquad_group<T, B, 2>(k, t0, len, c0);
+        for (; c0 < C; c0 += w)
+            biquad_group<T, B, 1>(k, t0, len, c0);
+    }
+}
+
+template <class T>
+__VDSP_NOCONTRACT void biquad_baseline(const biquad_call<T>& k) { biquad_run<T, 16>(k); }
+
+#if defined(__VDSP_X86_DISPATCH)
+template <class T>
+__attribute__((target("avx2"))) __VDSP_NOCONTRACT void biquad_avx2(const biquad_call<T>& k) { biquad_run<T, 32>(k); }
+
+template <class T>
+__attribute__((target("avx512f"))) __VDSP_NOCONTRACT void biquad_avx512(const biquad_call<T>& k) { biquad_run<T, 64>(k); }
+#endif
+
+template <class T>
+inline void dispatch(const biquad_call<T>& k)
+{
+    switch ((isa)active().load(std::memory_order_relaxed)) {
+#if defined(__VDSP_X86_DISPATCH)
+    case isa::avx512:
+        return biquad_avx512(k);
+    case isa::avx2:
+        return biquad_avx2(k);
+#endif
+    default:
+        return biquad_baseline(k);
+    }
+}
+
+} // namespace detail
+
+// Splits the block where a ramp ends, so that the kernels either step
+// the coefficients after every frame or not at all.
+template <class T>
+inline void biquad_bank<T>::run(detail::biquad_call<T> k)
+{
+    poll();
+    const vDSP_Length n = k.n;
+    for (vDSP_Length t0 = 0; t0 < n;) {
+        k.t0 = t0;
+        k.n = _remaining && _remaining < n - t0 ? _remaining : n - t0;
+        k.ramp = _remaining != 0;
+        detail::dispatch(k);
+        t0 += k.n;
+        if (k.ramp && (_remaining -= k.n) == 0)
+            _cur = _slots[_front].coef;     // land exactly on the targets
+    }
+}
+
+typedef biquad_bank<float>*  vDSP_biquadm_Setup;
+typedef biquad_bank<double>* vDSP_biquadm_SetupD;
+
+inline vDSP_biquadm_Setup vDSP_biquadm_CreateSetup(const double *__coeffs, vDSP_Length __M, vDSP_Length __N)
+{
+    if (!__M || !__N)
+        return nullptr;
+    try {
+        return new biquad_bank<float>(__coeffs, __M, __N);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+inline vDSP_biquadm_SetupD vDSP_biquadm_CreateSetupD(const double *__coeffs, vDSP_Length __M, vDSP_Length __N)
+{
+    if (!__M || !__N)
+        return nullptr;
+    try {
+        return new biquad_bank<double>(__coeffs, __M, __N);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+inline void vDSP_biquadm_DestroySetup(vDSP_biquadm_Setup __setup) { delete __setup; }
+
+inline void vDSP_biquadm_DestroySetupD(vDSP_biquadm_SetupD __setup) { delete __setup; }
+
+inline void vDSP_biquadm(vDSP_biquadm_Setup __Setup, const float **__X, vDSP_Stride __IX,
+                         float **__Y, vDSP_Stride __IY, vDSP_Length __N)
+{
+    __Setup->process(__X, __IX, __Y, __IY, __N);
+}
+
+inline void vDSP_biquadmD(vDSP_biquadm_SetupD __Setup, const double **__X, vDSP_Stride __IX,
+                          double **__Y, vDSP_Stride __IY, vDSP_Length __N)
+{
+    __Setup->process(__X, __IX, __Y, __IY, __N);
+}
+
+inline void vDSP_biquadm_CopyState(vDSP_biquadm_Setup __dest, const biquad_bank<float> *__src)
+{
+    __dest->copy_state(*__src);
+}
+
+inline void vDSP_biquadm_CopyStateD(vDSP_biquadm_SetupD __dest, const biquad_bank<double> *__src)
+{
+    __dest->copy_state(*__src);
+}
+
+inline void vDSP_biquadm_ResetState(vDSP_biquadm_Setup __setup) { __setup->reset_state(); }
+
+inline void vDSP_biquadm_ResetStateD(vDSP_biquadm_SetupD __setup) { __setup->reset_state(); }
+
+// Immediate coefficient changes, taken at the start of the next block.
+inline void vDSP_biquadm_SetCoefficientsDouble(vDSP_biquadm_Setup __setup, const double *__coeffs,
+                                               vDSP_Length __start_sec, vDSP_Length __start_chn,
+                                               vDSP_Length __nsec, vDSP_Length __nchn)
+{
+    __setup->set_targets(__coeffs, __start_sec, __start_chn, __nsec, __nchn, 0);
+}
+
+inline void vDSP_biquadm_SetCoefficientsSingle(vDSP_biquadm_Setup __setup, const float *__coeffs,
+                                               vDSP_Length __start_sec, vDSP_Length __start_chn,
+                                               vDSP_Length __nsec, vDSP_Length __nchn)
+{
+    const std::vector<double> d(__coeffs, __coeffs + 5 * __nsec * __nchn);
+    __setup->set_targets(d.data(), __start_sec, __start_chn, __nsec, __nchn, 0);
+}
+
+} // namespace vdsp
+
+#endif /* __cplusplus */
+
+#endif /* __VDSP_BIQUAD_PORTABLE__ */
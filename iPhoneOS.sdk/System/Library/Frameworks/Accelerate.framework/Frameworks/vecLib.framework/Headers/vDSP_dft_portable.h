@@ -0,0 +1,1037 @@
+/*
+    File:       vecLib/vDSP_dft_portable.h
+
+    Contains:   Portable DFT engine behind the vDSP_DFT interfaces
+
+    This header implements vDSP_DFT_CreateSetup, vDSP_DFT_zop_CreateSetup,
+    vDSP_DFT_zrop_CreateSetup, vDSP_DFT_Execute, vDSP_DFT_zop and
+    vDSP_DFT_DestroySetup (and their D variants) in namespace vdsp, with
+    the exact vDSP.h parameter lists and data layouts, for the hosts that
+    vDSP_portable.h serves.  Unlike vDSP, it accepts any length:
+
+        Lengths whose prime factors are all 2, 3, 5, 7, 11 or 13 run as a
+        mixed-radix Stockham FFT, one pass per factor (radix 4 where it
+        can).
+
+        Other primes p run through Rader's algorithm, as a cyclic
+        convolution of length p - 1, when p - 1 has only those factors.
+
+        Everything else runs through Bluestein's algorithm, as a
+        convolution of the next 2**a * 3**b * 5**c length >= 2N - 1.
+
+    Plans are immutable and kept in a global cache, one per precision,
+    keyed by length and direction.  Every setup, and every Rader or
+    Bluestein sub-transform, of the same length and direction shares one
+    plan.  The cache is thread safe, so setups may be created from any
+    thread, and any number of threads may execute the same plan at once.
+    The Previous argument of the setup routines is accepted and ignored,
+    since sharing already happens through the cache.  dft<T>::purge()
+    drops the plans no setup still uses.
+
+    Execution does not allocate after the first call in a thread: it
+    takes its scratch space from a per-thread buffer that only grows.
+
+    The passes use split-complex vectors and are compiled for each
+    instruction set that vDSP_portable.h dispatches to.  A single
+    transform is vectorized across independent butterflies within each
+    pass.  dftm_zop() and dftm_zopD(), which take the arguments of
+    vDSP_fftm_zop, transform M signals at once and vectorize across
+    signals, so every pass runs at full vector width.
+*/
+#ifndef __VDSP_DFT_PORTABLE__
+#define __VDSP_DFT_PORTABLE__
+
+#if defined(__cplusplus)
+
+#include <vecLib/vDSP_portable.h>
+
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#if !defined(__VDSP__)
+typedef struct DSPSplitComplex {
+    float  *realp;
+    float  *imagp;
+} DSPSplitComplex;
+typedef struct DSPDoubleSplitComplex {
+    double *realp;
+    double *imagp;
+} DSPDoubleSplitComplex;
+
+enum vDSP_DFT_Direction : int { vDSP_DFT_FORWARD = +1, vDSP_DFT_INVERSE = -1 };
+#endif
+
+#define __VDSP_FFT_INLINE   inline __attribute__((always_inline))
+
+namespace vdsp {
+
+template <class T> class dft;
+
+namespace detail {
+
+// One pass of the Stockham FFT.  It combines radix transforms of length l
+// into transforms of length l * radix; s = N / (l * radix) of those
+// remain independent.  Input element k + s*q + s*radix*j, scaled by the
+// twiddle w^(q*j), is input q of the butterfly whose output p is stored at
+// k + s*j + s*l*p.
+template <class T>
+struct fft_pass {
+    unsigned       radix;
+    vDSP_Length    l;
+    vDSP_Length    s;
+    T              sign;
+    std::vector<T> wr, wi;  // w^(q*j) at (q - 1) * l + j
+    std::vector<T> cr, ci;  // odd radix: cos and sign * sin of 2*pi*k/radix
+};
+
+enum class fft_kind : int { trivial, mixed, rader, bluestein };
+
+template <class T>
+struct fft_plan {
+    fft_kind                      kind;
+    vDSP_Length                   n;
+    int                           sign;     // -1 forward, +1 inverse
+    std::vector<fft_pass<T>>      passes;   // mixed
+    std::shared_ptr<const dft<T>> sub;      // rader, bluestein: forward transform of length m
+    vDSP_Length                   m;
+    std::vector<vDSP_Length>      gather;   // rader: g^q mod n
+    std::vector<vDSP_Length>      scatter;  // rader: g^-q mod n
+    std::vector<T>                kr, ki;   // rader, bluestein: transformed kernel, scaled by 1/m
+    std::vector<T>                chr, chi; // bluestein: chirp e^(sign*pi*i*j*j/n)
+    vDSP_Length                   scratch;  // elements of T one transform needs, sub-plans included
+};
+
+// One execution, in a shape single, strided and batched transforms fit.
+template <class T>
+struct fft_call {
+    const fft_plan<T>* plan;
+    const T*           ir;
+    const T*           ii;
+    vDSP_Stride        is;
+    vDSP_Stride        ims;
+    T*                 xr;
+    T*                 xi;
+    vDSP_Stride        os;
+    vDSP_Stride        oms;
+    vDSP_Length        count;
+    T*                 scratch;     // nullptr at the top level
+};
+
+// How a pass reads and writes its elements.  scalar_view moves one
+// element; run_view moves w consecutive elements of one transform;
+// batch_view moves element i of w transforms stored interleaved.
+template <class T>
+struct scalar_view {
+    typedef T elem;
+    static constexpr vDSP_Length step = 1;
+    static __VDSP_FFT_INLINE void load(T& e, const T* p, vDSP_Length i) { e = p[i]; }
+    static __VDSP_FFT_INLINE void store(T* p, vDSP_Length i, const T& e) { p[i] = e; }
+    static __VDSP_FFT_INLINE void scatter(T* p, vDSP_Length i, vDSP_Stride, const T& e) { p[i] = e; }
+};
+
+template <class T, int B>
+struct run_view {
+    typedef typename simd<T, B>::vector elem;
+    static constexpr vDSP_Length step = simd<T, B>::width;
+    static __VDSP_FFT_INLINE void load(elem& e, const T* p, vDSP_Length i) { memcpy(&e, p + i, sizeof(e)); }
+    static __VDSP_FFT_INLINE void store(T* p, vDSP_Length i, const elem& e) { memcpy(p + i, &e, sizeof(e)); }
+    static __VDSP_FFT_INLINE void scatter(T* p, vDSP_Length i, vDSP_Stride st, const elem& e) { vdsp::detail::store<false>(p + i, st, e); }
+};
+
+template <class T, int B>
+struct batch_view {
+    typedef typename simd<T, B>::vector elem;
+    static constexpr vDSP_Length step = 1;
+    static constexpr vDSP_Length lanes = simd<T, B>::width;
+    static __VDSP_FFT_INLINE void load(elem& e, const T* p, vDSP_Length i) { memcpy(&e, p + i * lanes, sizeof(e)); }
+    static __VDSP_FFT_INLINE void store(T* p, vDSP_Length i, const elem& e) { memcpy(p + i * lanes, &e, sizeof(e)); }
+    static __VDSP_FFT_INLINE void scatter(T* p, vDSP_Length i, vDSP_Stride, const elem& e) { store(p, i, e); }
+};
+
+template <class E, class W>
+__VDSP_FFT_INLINE void rotate(E& re, E& im, const W& wr, const W& wi)
+{
+    E t = re * wr - im * wi;
+    im = re * wi + im * wr;
+    re = t;
+}
+
+// The constants of a radix-R butterfly, copied out of the pass so that
+// stores to the output, which may alias them as far as the compiler can
+// tell, do not force reloads.
+template <class T, unsigned R>
+struct radix_roots {
+    T sign, cr[R], ci[R];
+    __VDSP_FFT_INLINE explicit radix_roots(const fft_pass<T>& ps) : sign(ps.sign)
+    {
+        for (unsigned k = 0; k < R; k++) {
+            cr[k] = R % 2 ? ps.cr[k] : 0;
+            ci[k] = R % 2 ? ps.ci[k] : 0;
+        }
+    }
+};
+
+// In-place radix-R DFT of re[0..R), im[0..R).
+template <unsigned R, class E, class T>
+__VDSP_FFT_INLINE void butterfly(E* re, E* im, const radix_roots<T, R>& rt)
+{
+    if constexpr (R == 2) {
+        E tr = re[0] - re[1], ti = im[0] - im[1];
+        re[0] += re[1];
+        im[0] += im[1];
+        re[1] = tr;
+        im[1] = ti;
+    } else if constexpr (R == 4) {
+        const T s = rt.sign;
+        E t0r = re[0] + re[2], t0i = im[0] + im[2];
+        E t1r = re[0] - re[2], t1i = im[0] - im[2];
+        E t2r = re[1] + re[3], t2i = im[1] + im[3];
+        E t3r = re[1] - re[3], t3i = im[1] - im[3];
+        E ur = -s * t3i, ui = s * t3r;     // w * t3, w = sign * i
+        re[0] = t0r + t2r;
+        im[0] = t0i + t2i;
+        re[2] = t0r - t2r;
+        im[2] = t0i - t2i;
+        re[1] = t1r + ur;
+        im[1] = t1i + ui;
+        re[3] = t1r - ur;
+        im[3] = t1i - ui;
+    } else {
+        // Odd radix: pair inputs q and R - q, whose twiddles are conjugate.
+        constexpr unsigned h = (R - 1) / 2;
+        E sr[h], si[h], dr[h], di[h], br[R], bi[R];
+        br[0] = re[0];
+        bi[0] = im[0];
+        for (unsigned q = 1; q <= h; q++) {
+            sr[q - 1] = re[q] + re[R - q];
+            si[q - 1] = im[q] + im[R - q];
+            dr[q - 1] = re[q] - re[R - q];
+            di[q - 1] = im[q] - im[R - q];
+            br[0] += sr[q - 1];
+            bi[0] += si[q - 1];
+        }
+        for (unsigned p = 1; p <= h; p++) {
+            E xr = re[0], xi = im[0], yr = {}, yi = {};
+            for (unsigned q = 1; q <= h; q++) {
+                const T c = rt.cr[p * q % R], s = rt.ci[p * q % R];
+                xr += c * sr[q - 1];
+                xi += c * si[q - 1];
+                yr += s * dr[q - 1];
+                yi += s * di[q - 1];
+            }
+            br[p] = xr - yi;
+            bi[p] = xi + yr;
+            br[R - p] = xr + yi;
+            bi[R - p] = xi - yr;
+        }
+        for (unsigned p = 0; p < R; p++) {
+            re[p] = br[p];
+            im[p] = bi[p];
+        }
+    }
+}
+
+// Butterflies k0 <= k < k1 of every group j, View::step at a time.  If
+// turn is set, the output is stored transposed for the pass_j passes that
+// follow: element k + s*m at k*l*R + m.
+template <class View, unsigned R, class T>
+__VDSP_FFT_INLINE void pass_k(const fft_pass<T>& ps, const T* yr, const T* yi, T* zr, T* zi,
+                              vDSP_Length k0, vDSP_Length k1, bool turn)
+{
+    typedef typename View::elem E;
+    const vDSP_Length l = ps.l, s = ps.s;
+    const radix_roots<T, R> rt(ps);
+    for (vDSP_Length j = 0; j < l; j++) {
+        T wr[R], wi[R];
+        for (unsigned q = 1; q < R; q++) {
+            wr[q] = ps.wr[(q - 1) * l + j];
+            wi[q] = ps.wi[(q - 1) * l + j];
+        }
+        for (vDSP_Length k = k0; k < k1; k += View::step) {
+            E ar[R], ai[R];
+            for (unsigned q = 0; q < R; q++) {
+                View::load(ar[q], yr, k + s * q + s * R * j);
+                View::load(ai[q], yi, k + s * q + s * R * j);
+            }
+            if (j != 0) {
+                for (unsigned q = 1; q < R; q++)
+                    rotate(ar[q], ai[q], wr[q], wi[q]);
+            }
+            butterfly<R>(ar, ai, rt);
+            for (unsigned p = 0; p < R; p++) {
+                if (turn) {
+                    View::scatter(zr, k * l * R + j + l * p, (vDSP_Stride)(l * R), ar[p]);
+                    View::scatter(zi, k * l * R + j + l * p, (vDSP_Stride)(l * R), ai[p]);
+                } else {
+                    View::store(zr, k + s * j + s * l * p, ar[p]);
+                    View::store(zi, k + s * j + s * l * p, ai[p]);
+                }
+            }
+        }
+    }
+}
+
+// The late passes, where s is narrower than a vector.  They keep the data
+// transposed, element k + s*m at k*(N/s) + m, so that groups j are
+// consecutive on both sides and vectorize: input q of butterfly (k, j) is
+// at (k + s*q)*l + j, and output p goes to k*l*R + j + l*p.  With s = 1
+// after the last pass, that is the natural order again.
+template <class T, int B, unsigned R>
+__VDSP_FFT_INLINE void pass_j(const fft_pass<T>& ps, const T* yr, const T* yi, T* zr, T* zi)
+{
+    typedef typename simd<T, B>::vector V;
+    constexpr vDSP_Length w = simd<T, B>::width;
+    const vDSP_Length l = ps.l, s = ps.s, lv = l - l % w;
+    const radix_roots<T, R> rt(ps);
+    const T *twr = ps.wr.data(), *twi = ps.wi.data();
+    for (vDSP_Length k = 0; k < s; k++) {
+        for (vDSP_Length j = 0; j < lv; j += w) {
+            V ar[R], ai[R], wr, wi;
+            for (unsigned q = 0; q < R; q++) {
+                load<true>(ar[q], yr + (k + s * q) * l + j, 1);
+                load<true>(ai[q], yi + (k + s * q) * l + j, 1);
+            }
+            for (unsigned q = 1; q < R; q++) {
+                load<true>(wr, twr + (q - 1) * l + j, 1);
+                load<true>(wi, twi + (q - 1) * l + j, 1);
+                rotate(ar[q], ai[q], wr, wi);
+            }
+            butterfly<R>(ar, ai, rt);
+            for (unsigned p = 0; p < R; p++) {
+                store<true>(zr + k * l * R + j + l * p, 1, ar[p]);
+                store<true>(zi + k * l * R + j + l * p, 1, ai[p]);
+            }
+        }
+        for (vDSP_Length j = lv; j < l; j++) {
+            T ar[R], ai[R];
+            for (unsigned q = 0; q < R; q++) {
+                ar[q] = yr[(k + s * q) * l + j];
+                ai[q] = yi[(k + s * q) * l + j];
+            }
+            for (unsigned q = 1; q < R; q++)
+                rotate(ar[q], ai[q], twr[(q - 1) * l + j], twi[(q - 1) * l + j]);
+            butterfly<R>(ar, ai, rt);
+            for (unsigned p = 0; p < R; p++) {
+                zr[k * l * R + j + l * p] = ar[p];
+                zi[k * l * R + j + l * p] = ai[p];
+            }
+        }
+    }
+}
+
+template <class T, int B, unsigned R>
+__VDSP_FFT_INLINE void run_pass(const fft_pass<T>& ps, const T* yr, const T* yi, T* zr, T* zi,
+                                bool batch, bool turn)
+{
+    constexpr vDSP_Length w = simd<T, B>::width;
+    if (batch) {
+        pass_k<batch_view<T, B>, R>(ps, yr, yi, zr, zi, 0, ps.s, false);
+    } else if (ps.s >= w) {
+        const vDSP_Length kv = ps.s - ps.s % w;
+        pass_k<run_view<T, B>, R>(ps, yr, yi, zr, zi, 0, kv, turn);
+        if (kv < ps.s)
+            pass_k<scalar_view<T>, R>(ps, yr, yi, zr, zi, kv, ps.s, turn);
+    } else {
+        pass_j<T, B, R>(ps, yr, yi, zr, zi);
+    }
+}
+
+template <class T, int B>
+__VDSP_FFT_INLINE void run_pass(const fft_pass<T>& ps, const T* yr, const T* yi, T* zr, T* zi,
+                                bool batch, bool turn)
+{
+    switch (ps.radix) {
+    case 2:  return run_pass<T, B, 2>(ps, yr, yi, zr, zi, batch, turn);
+    case 3:  return run_pass<T, B, 3>(ps, yr, yi, zr, zi, batch, turn);
+    case 4:  return run_pass<T, B, 4>(ps, yr, yi, zr, zi, batch, turn);
+    case 5:  return run_pass<T, B, 5>(ps, yr, yi, zr, zi, batch, turn);
+    case 7:  return run_pass<T, B, 7>(ps, yr, yi, zr, zi, batch, turn);
+    case 11: return run_pass<T, B, 11>(ps, yr, yi, zr, zi, batch, turn);
+    case 13: return run_pass<T, B, 13>(ps, yr, yi, zr, zi, batch, turn);
+    }
+}
+
+// Runs the passes of a mixed plan, ping-ponging between two scratch
+// buffers of 2 * n * lanes elements so that only the last pass writes the
+// output.  That keeps in-place calls safe: a one-pass plan is a single
+// butterfly, which reads all its inputs before it writes.
+template <class T, int B>
+__VDSP_FFT_INLINE void run_mixed(const fft_plan<T>& p, const T* ir, const T* ii, T* xr, T* xi,
+                                 T* scratch, bool batch)
+{
+    const vDSP_Length n = p.n * (batch ? simd<T, B>::width : 1);
+    const T *yr = ir, *yi = ii;
+    for (size_t t = 0; t < p.passes.size(); t++) {
+        T *zr = xr, *zi = xi;
+        if (t + 1 < p.passes.size()) {
+            zr = scratch + (t & 1) * 2 * n;
+            zi = zr + n;
+        }
+        const bool turn = t + 1 < p.passes.size() && p.passes[t + 1].s < simd<T, B>::width;
+        run_pass<T, B>(p.passes[t], yr, yi, zr, zi, batch, turn);
+        yr = zr;
+        yi = zi;
+    }
+}
+
+template <class T>
+using fft_entry = void (*)(const fft_call<T>&);
+
+template <class T>
+inline T* thread_scratch(vDSP_Length n)
+{
+    static thread_local std::vector<T> buffer;
+    if (buffer.size() < n)
+        buffer.resize(n);
+    return buffer.data();
+}
+
+// One contiguous transform, in place or not.  Rader and Bluestein plans
+// call back into self for their sub-transform, so that it runs on the same
+// instruction set.
+template <class T, int B>
+__VDSP_FFT_INLINE void transform(const fft_plan<T>& p, const T* ir, const T* ii, T* xr, T* xi,
+                                 T* scratch, fft_entry<T> self)
+{
+    switch (p.kind) {
+    case fft_kind::trivial:
+        xr[0] = ir[0];
+        xi[0] = ii[0];
+        return;
+    case fft_kind::mixed:
+        return run_mixed<T, B>(p, ir, ii, xr, xi, scratch, false);
+    case fft_kind::rader:
+    case fft_kind::bluestein:
+        break;
+    }
+
+    const vDSP_Length n = p.n, m = p.m;
+    T *ur = scratch, *ui = scratch + m;
+    T x0r = ir[0], x0i = ii[0], sr = 0, si = 0;
+    if (p.kind == fft_kind::rader) {
+        for (vDSP_Length q = 0; q < m; q++) {
+            ur[q] = ir[p.gather[q]];
+            ui[q] = ii[p.gather[q]];
+            sr += ur[q];
+            si += ui[q];
+        }
+    } else {
+        for (vDSP_Length j = 0; j < n; j++) {
+            ur[j] = ir[j];
+            ui[j] = ii[j];
+            rotate(ur[j], ui[j], p.chr[j], p.chi[j]);
+        }
+        for (vDSP_Length j = n; j < m; j++)
+            ur[j] = ui[j] = 0;
+    }
+
+    // Cyclic convolution with the kernel, through the forward
+    // sub-transform twice: conj(F(conj(F(u) * K))) = m * (u conv k).
+    fft_call<T> sub = { &p.sub->plan(), ur, ui, 1, 0, ur, ui, 1, 0, 1, scratch + 2 * m };
+    self(sub);
+    for (vDSP_Length q = 0; q < m; q++) {
+        rotate(ur[q], ui[q], p.kr[q], p.ki[q]);
+        ui[q] = -ui[q];
+    }
+    self(sub);
+
+    if (p.kind == fft_kind::rader) {
+        for (vDSP_Length q = 0; q < m; q++) {
+            xr[p.scatter[q]] = x0r + ur[q];
+            xi[p.scatter[q]] = x0i - ui[q];
+        }
+        xr[0] = x0r + sr;
+        xi[0] = x0i + si;
+    } else {
+        for (vDSP_Length k = 0; k < n; k++) {
+            T vr = ur[k], vi = -ui[k];
+            rotate(vr, vi, p.chr[k], p.chi[k]);
+            xr[k] = vr;
+            xi[k] = vi;
+        }
+    }
+}
+
+template <class T, int B>
+__VDSP_FFT_INLINE void execute(const fft_call<T>& c, fft_entry<T> self)
+{
+    const fft_plan<T>& p = *c.plan;
+    const vDSP_Length n = p.n;
+    constexpr vDSP_Length w = simd<T, B>::width;
+    const bool unit = c.is == 1 && c.os == 1;
+    // Across signals is faster where a single transform has few full
+    // vectors to work on: short lengths, and lengths with a scalar tail.
+    const bool batch = p.kind == fft_kind::mixed && c.count >= w && (n <= 8 * w || n % w != 0);
+
+    T* scratch = c.scratch;
+    if (!scratch) {
+        vDSP_Length need = p.scratch + (unit ? 0 : 4 * n);
+        if (batch && need < 6 * n * w)
+            need = 6 * n * w;
+        scratch = thread_scratch<T>(need);
+    }
+
+    vDSP_Length m = 0;
+    if (batch) {
+        // w signals at a time, interleaved so that each element is one
+        // vector with a lane per signal.
+        T *br = scratch + 4 * n * w, *bi = br + n * w;
+        for (; m + w <= c.count; m += w) {
+            for (vDSP_Length l = 0; l < w; l++) {
+                const T *sr = c.ir + (vDSP_Stride)(m + l) * c.ims, *si = c.ii + (vDSP_Stride)(m + l) * c.ims;
+                for (vDSP_Length j = 0; j < n; j++) {
+                    br[j * w + l] = sr[(vDSP_Stride)j * c.is];
+                    bi[j * w + l] = si[(vDSP_Stride)j * c.is];
+                }
+            }
+            run_mixed<T, B>(p, br, bi, br, bi, scratch, true);
+            for (vDSP_Length l = 0; l < w; l++) {
+                T *dr = c.xr + (vDSP_Stride)(m + l) * c.oms, *di = c.xi + (vDSP_Stride)(m + l) * c.oms;
+                for (vDSP_Length j = 0; j < n; j++) {
+                    dr[(vDSP_Stride)j * c.os] = br[j * w + l];
+                    di[(vDSP_Stride)j * c.os] = bi[j * w + l];
+                }
+            }
+        }
+    }
+    for (; m < c.count; m++) {
+        const T *sr = c.ir + (vDSP_Stride)m * c.ims, *si = c.ii + (vDSP_Stride)m * c.ims;
+        T *dr = c.xr + (vDSP_Stride)m * c.oms, *di = c.xi + (vDSP_Stride)m * c.oms;
+        if (unit) {
+            transform<T, B>(p, sr, si, dr, di, scratch, self);
+            continue;
+        }
+        T *tr = scratch + p.scratch, *ti = tr + n;
+        for (vDSP_Length j = 0; j < n; j++) {
+            tr[j] = sr[(vDSP_Stride)j * c.is];
+            ti[j] = si[(vDSP_Stride)j * c.is];
+        }
+        transform<T, B>(p, tr, ti, tr, ti, scratch, self);
+        for (vDSP_Length j = 0; j < n; j++) {
+            dr[(vDSP_Stride)j * c.os] = tr[j];
+            di[(vDSP_Stride)j * c.os] = ti[j];
+        }
+    }
+}
+
+template <class T>
+void execute_baseline(const fft_call<T>& c) { execute<T, 16>(c, &execute_baseline<T>); }
+
+#if defined(__VDSP_X86_DISPATCH)
+template <class T>
+__attribute__((target("avx2"))) void execute_avx2(const fft_call<T>& c) { execute<T, 32>(c, &execute_avx2<T>); }
+
+template <class T>
+__attribute__((target("avx512f"))) void execute_avx512(const fft_call<T>& c) { execute<T, 64>(c, &execute_avx512<T>); }
+#endif
+
+template <class T>
+inline void dispatch(const fft_call<T>& c)
+{
+    switch ((isa)active().load(std::memory_order_relaxed)) {
+#if defined(__VDSP_X86_DISPATCH)
+    case isa::avx512:
+        return execute_avx512(c);
+    case isa::avx2:
+        return execute_avx2(c);
+#endif
+    default:
+        return execute_baseline(c);
+    }
+}
+
+// w^k for w = e^(sign*2*pi*i/n), computed in double from k mod n so that
+// float plans get correctly rounded twiddles.
+template <class T>
+inline void root(vDSP_Length k, vDSP_Length n, int sign, T& re, T& im)
+{
+    const double a = 2 * M_PI * (double)(k % n) / (double)n;
+    re = (T)cos(a);
+    im = (T)(sign * sin(a));
+}
+
+inline bool factor(vDSP_Length n, std::vector<unsigned>& radices)
+{
+    static const unsigned odd[] = { 3, 5, 7, 11, 13 };
+    while (n % 4 == 0) {
+        radices.push_back(4);
+        n /= 4;
+    }
+    if (n % 2 == 0) {
+        radices.push_back(2);
+        n /= 2;
+    }
+    for (unsigned r : odd) {
+        while (n % r == 0) {
+            radices.push_back(r);
+            n /= r;
+        }
+    }
+    return n == 1;
+}
+
+inline bool smooth(vDSP_Length n)
+{
+    std::vector<unsigned> radices;
+    return factor(n, radices);
+}
+
+inline bool prime(vDSP_Length n)
+{
+    if (n < 2)
+        return false;
+    for (vDSP_Length d = 2; d * d <= n; d++)
+        if (n % d == 0)
+            return false;
+    return true;
+}
+
+inline vDSP_Length power_mod(vDSP_Length b, vDSP_Length e, vDSP_Length n)
+{
+    uint64_t r = 1, x = b % n;
+    for (; e; e >>= 1, x = x * x % n)
+        if (e & 1)
+            r = r * x % n;
+    return (vDSP_Length)r;
+}
+
+inline vDSP_Length primitive_root(vDSP_Length p)
+{
+    std::vector<vDSP_Length> factors;
+    vDSP_Length t = p - 1;
+    for (vDSP_Length d = 2; d * d <= t; d++) {
+        if (t % d == 0) {
+            factors.push_back(d);
+            while (t % d == 0)
+                t /= d;
+        }
+    }
+    if (t > 1)
+        factors.push_back(t);
+    for (vDSP_Length g = 2;; g++) {
+        bool ok = true;
+        for (vDSP_Length f : factors)
+            ok = ok && power_mod(g, (p - 1) / f, p) != 1;
+        if (ok)
+            return g;
+    }
+}
+
+// The smallest 2**a * 3**b * 5**c >= n.
+inline vDSP_Length next_smooth(vDSP_Length n)
+{
+    vDSP_Length best = 1;
+    while (best < n)
+        best *= 2;
+    for (vDSP_Length p5 = 1; p5 < best; p5 *= 5)
+        for (vDSP_Length p35 = p5; p35 < best; p35 *= 3) {
+            vDSP_Length v = p35;
+            while (v < n)
+                v *= 2;
+            if (v < best)
+                best = v;
+        }
+    return best;
+}
+
+template <class T>
+struct plan_cache {
+    std::mutex                                                  lock;
+    std::unordered_map<uint64_t, std::shared_ptr<const dft<T>>> plans;
+};
+
+template <class T>
+inline plan_cache<T>& cache()
+{
+    static plan_cache<T> c;
+    return c;
+}
+
+} // namespace detail
+
+// A DFT of one length and direction, shared through the plan cache.
+template <class T>
+class dft {
+public:
+    // The plan for a complex transform of length n, from the cache or
+    // built and cached now.  nullptr if n is 0 or memory runs out.
+    static std::shared_ptr<const dft> get(vDSP_Length n, vDSP_DFT_Direction direction)
+    {
+        if (n == 0)
+            return nullptr;
+        detail::plan_cache<T>& c = detail::cache<T>();
+        const uint64_t key = ((uint64_t)n << 1) | (direction == vDSP_DFT_INVERSE);
+        {
+            std::lock_guard<std::mutex> hold(c.lock);
+            auto it = c.plans.find(key);
+            if (it != c.plans.end())
+                return it->second;
+        }
+        // Build without the lock: Rader and Bluestein plans get their
+        // sub-plans from the cache.  If two threads race, the first one
+        // cached wins.
+        std::shared_ptr<dft> d;
+        try {
+            d.reset(new dft());
+            if (!d->build(n, direction == vDSP_DFT_INVERSE ? +1 : -1))
+                return nullptr;
+            std::lock_guard<std::mutex> hold(c.lock);
+            return c.plans.emplace(key, std::move(d)).first->second;
+        } catch (const std::bad_alloc&) {
+            return nullptr;
+        }
+    }
+
+    // Drops the cached plans that no setup or other plan still holds.
+    static void purge()
+    {
+        detail::plan_cache<T>& c = detail::cache<T>();
+        std::lock_guard<std::mutex> hold(c.lock);
+        // Plans hold their sub-plans, so repeat until nothing is dropped.
+        for (bool dropped = true; dropped;) {
+            dropped = false;
+            for (auto it = c.plans.begin(); it != c.plans.end();) {
+                if (it->second.use_count() == 1) {
+                    it = c.plans.erase(it);
+                    dropped = true;
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    vDSP_Length length() const { return _plan.n; }
+    vDSP_DFT_Direction direction() const { return _plan.sign > 0 ? vDSP_DFT_INVERSE : vDSP_DFT_FORWARD; }
+
+    // "mixed-radix", "rader", "bluestein" or "trivial".
+    const char* algorithm() const
+    {
+        switch (_plan.kind) {
+        case detail::fft_kind::mixed:     return "mixed-radix";
+        case detail::fft_kind::rader:     return "rader";
+        case detail::fft_kind::bluestein: return "bluestein";
+        default:                          return "trivial";
+        }
+    }
+
+    const detail::fft_plan<T>& plan() const { return _plan; }
+
+    // H[k] = sum(h[j] * e^(S*2*pi*i*j*k/N)), with vDSP_DFT_zop's layout.
+    // Out may equal in.
+    void execute(const T* ir, const T* ii, vDSP_Stride is, T* xr, T* xi, vDSP_Stride os) const
+    {
+        detail::dispatch<T>({ &_plan, ir, ii, is, 0, xr, xi, os, 0, 1, nullptr });
+    }
+
+    void execute(const T* ir, const T* ii, T* xr, T* xi) const { execute(ir, ii, 1, xr, xi, 1); }
+
+    // count transforms, signal m at ir + m * ims and output m at xr + m * oms,
+    // as vDSP_fftm_zop lays them out.
+    void execute(const T* ir, const T* ii, vDSP_Stride is, vDSP_Stride ims,
+                 T* xr, T* xi, vDSP_Stride os, vDSP_Stride oms, vDSP_Length count) const
+    {
+        detail::dispatch<T>({ &_plan, ir, ii, is, ims, xr, xi, os, oms, count, nullptr });
+    }
+
+private:
+    detail::fft_plan<T> _plan;
+
+    bool build(vDSP_Length n, int sign)
+    {
+        detail::fft_plan<T>& p = _plan;
+        p.n = n;
+        p.sign = sign;
+        p.m = 0;
+        p.scratch = 0;
+
+        std::vector<unsigned> radices;
+        if (n == 1) {
+            p.kind = detail::fft_kind::trivial;
+        } else if (detail::factor(n, radices)) {
+            p.kind = detail::fft_kind::mixed;
+            p.scratch = 4 * n;
+            vDSP_Length l = 1;
+            for (unsigned r : radices) {
+                detail::fft_pass<T> ps;
+                ps.radix = r;
+                ps.l = l;
+                ps.s = n / (l * r);
+                ps.sign = (T)sign;
+                ps.wr.resize((r - 1) * l);
+                ps.wi.resize((r - 1) * l);
+                for (unsigned q = 1; q < r; q++)
+                    for (vDSP_Length j = 0; j < l; j++)
+                        detail::root(q * j, l * r, sign, ps.wr[(q - 1) * l + j], ps.wi[(q - 1) * l + j]);
+                if (r % 2) {
+                    ps.cr.resize(r);
+                    ps.ci.resize(r);
+                    for (unsigned k = 0; k < r; k++)
+                        detail::root(k, r, sign, ps.cr[k], ps.ci[k]);
+                }
+                p.passes.push_back(std::move(ps));
+                l *= r;
+            }
+        } else {
+            const bool rader = detail::prime(n) && detail::smooth(n - 1);
+            p.kind = rader ? detail::fft_kind::rader : detail::fft_kind::bluestein;
+            p.m = rader ? n - 1 : detail::next_smooth(2 * n - 1);
+            p.sub = get(p.m, vDSP_DFT_FORWARD);
+            if (!p.sub)
+                return false;
+            p.scratch = 2 * p.m + p.sub->plan().scratch;
+
+            // The convolution kernel: Rader's w^(g^-q), or the conjugate
+            // chirp wrapped around for Bluestein.
+            std::vector<T> kr(p.m), ki(p.m);
+            if (rader) {
+                const vDSP_Length g = detail::primitive_root(n), gi = detail::power_mod(g, n - 2, n);
+                p.gather.resize(p.m);
+                p.scatter.resize(p.m);
+                for (vDSP_Length q = 0, a = 1, b = 1; q < p.m; q++, a = a * g % n, b = b * gi % n) {
+                    p.gather[q] = a;
+                    p.scatter[q] = b;
+                    detail::root(b, n, sign, kr[q], ki[q]);
+                }
+            } else {
+                p.chr.resize(n);
+                p.chi.resize(n);
+                for (vDSP_Length j = 0; j < n; j++) {
+                    detail::root((vDSP_Length)((uint64_t)j * j % (2 * n)), 2 * n, sign, p.chr[j], p.chi[j]);
+                    kr[j] = p.chr[j];
+                    ki[j] = -p.chi[j];
+                    if (j) {
+                        kr[p.m - j] = kr[j];
+                        ki[p.m - j] = ki[j];
+                    }
+                }
+            }
+            p.sub->execute(kr.data(), ki.data(), kr.data(), ki.data());
+            for (vDSP_Length q = 0; q < p.m; q++) {
+                kr[q] /= (T)p.m;
+                ki[q] /= (T)p.m;
+            }
+            p.kr = std::move(kr);
+            p.ki = std::move(ki);
+        }
+        return true;
+    }
+};
+
+namespace detail {
+
+// What a vDSP_DFT_Setup points to.  zrop setups hold the complex plan of
+// half the length, plus the twiddles that split and merge the real
+// spectrum.
+template <class T>
+struct dft_setup {
+    std::shared_ptr<const dft<T>> forward, inverse;
+    vDSP_Length                   length;
+    int                           direction;    // -1 forward, +1 inverse, 0 for vDSP_DFT_CreateSetup
+    bool                          real;
+    std::vector<T>                rr, ri;       // e^(S*2*pi*i*k/N), k < N/2
+};
+
+template <class T>
+inline dft_setup<T>* create_setup(vDSP_Length n, int direction, bool real)
+{
+    if (n == 0 || (real && n % 2))
+        return nullptr;
+    try {
+        std::unique_ptr<dft_setup<T>> s(new dft_setup<T>());
+        s->length = n;
+        s->direction = direction;
+        s->real = real;
+        const vDSP_Length c = real ? n / 2 : n;
+        if (direction >= 0 && !(s->inverse = dft<T>::get(c, vDSP_DFT_INVERSE)))
+            return nullptr;
+        if (direction <= 0 && !(s->forward = dft<T>::get(c, vDSP_DFT_FORWARD)))
+            return nullptr;
+        if (real) {
+            s->rr.resize(c);
+            s->ri.resize(c);
+            for (vDSP_Length k = 0; k < c; k++)
+                root(k, n, direction, s->rr[k], s->ri[k]);
+        }
+        return s.release();
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+// vDSP_DFT_zrop: the real sequence h, packed as z[j] = h[2j] + i*h[2j+1],
+// goes through a complex DFT of length N/2; the spectrum is then split
+// into the halves of even and odd samples and merged.
+template <class T>
+inline void execute_real(const dft_setup<T>& s, const T* ir, const T* ii, T* xr, T* xi)
+{
+    const vDSP_Length h = s.length / 2;
+    if (s.direction < 0) {
+        s.forward->execute(ir, ii, xr, xi);
+        const T z0r = xr[0], z0i = xi[0];
+        for (vDSP_Length k = 1; k <= h / 2; k++) {
+            const vDSP_Length k2 = h - k;
+            const T ar = xr[k], ai = xi[k], br = xr[k2], bi = xi[k2];
+            // out[k] = (Z[k] + conj(Z[h-k])) - i * W^k * (Z[k] - conj(Z[h-k]))
+            T dr = ar - br, di = ai + bi;
+            rotate(dr, di, s.rr[k], s.ri[k]);
+            xr[k] = ar + br + di;
+            xi[k] = ai - bi - dr;
+            if (k2 != k) {
+                T er = br - ar, ei = bi + ai;
+                rotate(er, ei, s.rr[k2], s.ri[k2]);
+                xr[k2] = br + ar + ei;
+                xi[k2] = bi - ai - er;
+            }
+        }
+        xr[0] = 2 * (z0r + z0i);
+        xi[0] = 2 * (z0r - z0i);
+    } else {
+        const T h0 = ir[0], hn = ii[0];
+        for (vDSP_Length k = 1; k <= h / 2; k++) {
+            const vDSP_Length k2 = h - k;
+            const T ar = ir[k], ai = ii[k], br = ir[k2], bi = ii[k2];
+            // Z[k] = (H[k] + conj(H[h-k])) + i * W^-k * (H[k] - conj(H[h-k]))
+            T dr = ar - br, di = ai + bi;
+            rotate(dr, di, s.rr[k], s.ri[k]);
+            T er = br - ar, ei = bi + ai;
+            rotate(er, ei, s.rr[k2], s.ri[k2]);
+            xr[k] = ar + br - di;
+            xi[k] = ai - bi + dr;
+            xr[k2] = br + ar - ei;
+            xi[k2] = bi - ai + er;
+        }
+        xr[0] = h0 + hn;
+        xi[0] = h0 - hn;
+        s.inverse->execute(xr, xi, xr, xi);
+    }
+}
+
+template <class T>
+inline void execute_setup(const dft_setup<T>* s, const T* ir, const T* ii, vDSP_Stride is,
+                          T* xr, T* xi, vDSP_Stride os, int direction)
+{
+    if (!s)
+        return;
+    if (s->real)
+        return execute_real(*s, ir, ii, xr, xi);
+    const dft<T>* d = (direction > 0 ? s->inverse : s->forward).get();
+    std::shared_ptr<const dft<T>> other;
+    if (!d) {
+        // A zop setup used in its other direction.
+        other = dft<T>::get(s->length, direction > 0 ? vDSP_DFT_INVERSE : vDSP_DFT_FORWARD);
+        if (!(d = other.get()))
+            return;
+    }
+    d->execute(ir, ii, is, xr, xi, os);
+}
+
+} // namespace detail
+
+typedef detail::dft_setup<float>*  vDSP_DFT_Setup;
+typedef detail::dft_setup<double>* vDSP_DFT_SetupD;
+
+// Creates a setup for vDSP_DFT_zop, in either direction.
+inline vDSP_DFT_Setup vDSP_DFT_CreateSetup(vDSP_DFT_Setup __Previous, vDSP_Length __Length)
+{
+    (void)__Previous;
+    return detail::create_setup<float>(__Length, 0, false);
+}
+
+inline vDSP_DFT_SetupD vDSP_DFT_CreateSetupD(vDSP_DFT_SetupD __Previous, vDSP_Length __Length)
+{
+    (void)__Previous;
+    return detail::create_setup<double>(__Length, 0, false);
+}
+
+// Creates a setup for a complex-to-complex vDSP_DFT_Execute of any length.
+inline vDSP_DFT_Setup vDSP_DFT_zop_CreateSetup(vDSP_DFT_Setup __Previous, vDSP_Length __Length,
+                                               vDSP_DFT_Direction __Direction)
+{
+    (void)__Previous;
+    return detail::create_setup<float>(__Length, __Direction > 0 ? -1 : +1, false);
+}
+
+inline vDSP_DFT_SetupD vDSP_DFT_zop_CreateSetupD(vDSP_DFT_SetupD __Previous, vDSP_Length __Length,
+                                                 vDSP_DFT_Direction __Direction)
+{
+    (void)__Previous;
+    return detail::create_setup<double>(__Length, __Direction > 0 ? -1 : +1, false);
+}
+
+// Creates a setup for a real-to-complex (forward) or complex-to-real
+// (inverse) vDSP_DFT_Execute.  Length must be even.
+inline vDSP_DFT_Setup vDSP_DFT_zrop_CreateSetup(vDSP_DFT_Setup __Previous, vDSP_Length __Length,
+                                                vDSP_DFT_Direction __Direction)
+{
+    (void)__Previous;
+    return detail::create_setup<float>(__Length, __Direction > 0 ? -1 : +1, true);
+}
+
+inline vDSP_DFT_SetupD vDSP_DFT_zrop_CreateSetupD(vDSP_DFT_SetupD __Previous, vDSP_Length __Length,
+                                                  vDSP_DFT_Direction __Direction)
+{
+    (void)__Previous;
+    return detail::create_setup<double>(__Length, __Direction > 0 ? -1 : +1, true);
+}
+
+inline void vDSP_DFT_DestroySetup(vDSP_DFT_Setup __Setup) { delete __Setup; }
+
+inline void vDSP_DFT_DestroySetupD(vDSP_DFT_SetupD __Setup) { delete __Setup; }
+
+// Executes a zop or zrop setup.  Or may equal Ir and Oi may equal Ii.
+inline void vDSP_DFT_Execute(const vDSP_DFT_Setup __Setup, const float *__Ir, const float *__Ii,
+                             float *__Or, float *__Oi)
+{
+    detail::execute_setup(__Setup, __Ir, __Ii, 1, __Or, __Oi, 1, __Setup ? __Setup->direction : 0);
+}
+
+inline void vDSP_DFT_ExecuteD(const vDSP_DFT_SetupD __Setup, const double *__Ir, const double *__Ii,
+                              double *__Or, double *__Oi)
+{
+    detail::execute_setup(__Setup, __Ir, __Ii, 1, __Or, __Oi, 1, __Setup ? __Setup->direction : 0);
+}
+
+// Executes a complex setup with strides, in the direction given.
+inline void vDSP_DFT_zop(const vDSP_DFT_Setup __Setup, const float *__Ir, const float *__Ii, vDSP_Stride __Is,
+                         float *__Or, float *__Oi, vDSP_Stride __Os, vDSP_DFT_Direction __Direction)
+{
+    detail::execute_setup(__Setup, __Ir, __Ii, __Is, __Or, __Oi, __Os, __Direction > 0 ? -1 : +1);
+}
+
+inline void vDSP_DFT_zopD(const vDSP_DFT_SetupD __Setup, const double *__Ir, const double *__Ii, vDSP_Stride __Is,
+                          double *__Or, double *__Oi, vDSP_Stride __Os, vDSP_DFT_Direction __Direction)
+{
+    detail::execute_setup(__Setup, __Ir, __Ii, __Is, __Or, __Oi, __Os, __Direction > 0 ? -1 : +1);
+}
+
+// M complex transforms with a zop setup, laid out as for vDSP_fftm_zop:
+// element j of signal m at A->realp[m*IMA + j*IA], and likewise for C.
+inline void dftm_zop(const vDSP_DFT_Setup __Setup, const DSPSplitComplex *__A, vDSP_Stride __IA, vDSP_Stride __IMA,
+                     const DSPSplitComplex *__C, vDSP_Stride __IC, vDSP_Stride __IMC, vDSP_Length __M)
+{
+    if (!__Setup || __Setup->real)
+        return;
+    const dft<float>* d = (__Setup->direction > 0 ? __Setup->inverse : __Setup->forward).get();
+    d->execute(__A->realp, __A->imagp, __IA, __IMA, __C->realp, __C->imagp, __IC, __IMC, __M);
+}
+
+inline void dftm_zopD(const vDSP_DFT_SetupD __Setup, const DSPDoubleSplitComplex *__A, vDSP_Stride __IA,
+                      vDSP_Stride __IMA, const DSPDoubleSplitComplex *__C, vDSP_Stride __IC, vDSP_Stride __IMC,
+                      vDSP_Length __M)
+{
+    if (!__Setup || __Setup->real)
+        return;
+    const dft<double>* d = (__Setup->direction > 0 ? __Setup->inverse : __Setup->forward).get();
+    d->execute(__A->realp, __A->imagp, __IA, __IMA, __C->realp, __C->imagp, __IC, __IMC, __M);
+}
+
+} // namespace vdsp
+
+#endif /* __cplusplus */
+
+#endif /* __VDSP_DFT_PORTABLE__ */
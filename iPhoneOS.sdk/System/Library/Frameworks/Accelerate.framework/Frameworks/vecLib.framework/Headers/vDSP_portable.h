@@ -0,0 +1,672 @@
+/*
+    File:       vecLib/vDSP_portable.h
+
+    Contains:   Portable SIMD implementations of the core vDSP kernels
+
+    This header implements a subset of vDSP in C++ so that code written
+    against vDSP.h can be built, tested and benchmarked on hosts that do
+    not have Accelerate, such as Linux CI machines.  It is not a
+    replacement for vDSP on Apple platforms.
+
+    The routines live in namespace vdsp and keep the exact names and
+    parameter lists of their vDSP.h counterparts, strides included:
+
+        vDSP_vadd   vDSP_vaddD      C[n] = A[n] + B[n]
+        vDSP_vmul   vDSP_vmulD      C[n] = A[n] * B[n]
+        vDSP_vsma   vDSP_vsmaD      D[n] = A[n] * B[0] + C[n]
+        vDSP_dotpr  vDSP_dotprD     C[0] = sum(A[n] * B[n])
+        vDSP_conv   vDSP_convD      C[n] = sum(A[n+p] * F[p], 0 <= p < P)
+        vDSP_desamp vDSP_desampD    C[n] = sum(A[n*DF+p] * F[p], 0 <= p < P)
+        vDSP_maxv   vDSP_maxvD      C[0] = max(A[n])
+        vDSP_minv   vDSP_minvD      C[0] = min(A[n])
+        vDSP_vclip  vDSP_vclipD     D[n] = min(max(A[n], B[0]), C[0])
+
+    A caller that only uses these routines can switch between the real
+    vDSP and this one with "using namespace vdsp;".
+
+    The kernels are written once with GCC/Clang vector extensions and
+    compiled for each instruction set in the same translation unit: the
+    compiler's baseline (SSE2 on x86-64, NEON on arm64), plus AVX2 and
+    AVX-512F on x86.  The best one the CPU supports is picked the first
+    time a routine is called; select_isa() overrides that, which is what
+    the conformance tests and benchmarks use to compare backends.
+
+    Every backend returns bit-identical results for the same inputs:
+
+        vadd, vmul, vsma, vclip, conv and desamp are bit-exact with the
+        scalar pseudocode above.  Multiplies and adds are never fused,
+        and each output's sum runs over p in order, starting at zero.
+
+        dotpr sums into 32 (float) or 16 (double) interleaved partial
+        sums, reduced pairwise, then adds the remaining elements in
+        order.  The layout does not depend on the vector width, so every
+        backend rounds the same way.  The error bound is that of pairwise
+        summation, and it is usually tighter than vDSP's.
+
+        maxv and minv ignore NaNs and return -INFINITY and +INFINITY for
+        N == 0, as vDSP does.
+*/
+#ifndef __VDSP_PORTABLE__
+#define __VDSP_PORTABLE__
+
+#if defined(__cplusplus)
+
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(__VDSP__)
+typedef unsigned long vDSP_Length;
+#if defined __arm64__ && !defined __LP64__
+typedef long long     vDSP_Stride;
+#else
+typedef long          vDSP_Stride;
+#endif
+#endif
+
+#if defined(__clang__)
+#define __VDSP_NOCONTRACT
+#define __VDSP_EXACT        _Pragma("clang fp contract(off)")
+#else
+#define __VDSP_NOCONTRACT   __attribute__((optimize("fp-contract=off")))
+#define __VDSP_EXACT
+#endif
+
+#define __VDSP_INLINE       inline __attribute__((always_inline)) __VDSP_NOCONTRACT
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define __VDSP_X86_DISPATCH 1
+#endif
+
+namespace vdsp {
+
+// Instruction sets the kernels are compiled for.  baseline is whatever the
+// compiler targets by default: SSE2 on x86-64, NEON on arm64.
+enum class isa : int {
+    baseline,
+    avx2,
+    avx512,
+};
+
+namespace detail {
+
+template <class T, int Bytes>
+struct simd {
+    typedef T vector __attribute__((vector_size(Bytes)));
+    static constexpr vDSP_Length width = Bytes / sizeof(T);
+};
+
+// Vectors wider than the baseline target are only ever passed by
+// reference between these helpers.  Passing them by value outside a
+// function compiled for their width draws an ABI warning from GCC, even
+// when the call is inlined.
+template <bool Unit, class V, class T>
+__VDSP_INLINE void load(V& v, const T* p, vDSP_Stride s)
+{
+    if constexpr (Unit) {
+        memcpy(&v, p, sizeof(v));
+    } else {
+        T lanes[sizeof(V) / sizeof(T)];
+        for (unsigned l = 0; l < sizeof(V) / sizeof(T); l++)
+            lanes[l] = p[(vDSP_Stride)l * s];
+        memcpy(&v, lanes, sizeof(v));
+    }
+}
+
+template <bool Unit, class V, class T>
+__VDSP_INLINE void store(T* p, vDSP_Stride s, const V& v)
+{
+    if constexpr (Unit) {
+        memcpy(p, &v, sizeof(v));
+    } else {
+        for (unsigned l = 0; l < sizeof(V) / sizeof(T); l++)
+            p[(vDSP_Stride)l * s] = v[l];
+    }
+}
+
+template <class V, class T>
+__VDSP_INLINE void splat(V& v, T x)
+{
+    T lanes[sizeof(V) / sizeof(T)];
+    for (unsigned l = 0; l < sizeof(V) / sizeof(T); l++)
+        lanes[l] = x;
+    memcpy(&v, lanes, sizeof(v));
+}
+
+template <class T>
+__VDSP_INLINE const T* at(const T* p, vDSP_Length i, vDSP_Stride s) { return p + (vDSP_Stride)i * s; }
+
+template <class T>
+__VDSP_INLINE T* at(T* p, vDSP_Length i, vDSP_Stride s) { return p + (vDSP_Stride)i * s; }
+
+enum class op : int {
+    vadd, vmul, vsma, vclip, dotpr, conv, desamp, maxv, minv,
+};
+
+// One call of a public routine, in a shape every operation fits.  The
+// per-instruction-set entry points take this, so each instruction set is
+// one function rather than one per routine.
+template <class T>
+struct call {
+    op          code;
+    const T*    a;
+    vDSP_Stride ia;
+    const T*    b;
+    vDSP_Stride ib;
+    const T*    s0;
+    const T*    s1;
+    T*          c;
+    vDSP_Stride ic;
+    vDSP_Length n;
+    vDSP_Length p;
+};
+
+// Elementwise operations, d = f(a, b), for both scalars and vectors.
+struct add_op {
+    template <class X> __VDSP_INLINE void operator()(X& d, const X& a, const X& b) const { d = a + b; }
+};
+
+struct mul_op {
+    template <class X> __VDSP_INLINE void operator()(X& d, const X& a, const X& b) const { d = a * b; }
+};
+
+template <class T>
+struct sma_op {
+    T s;
+    template <class X> __VDSP_INLINE void operator()(X& d, const X& a, const X& c) const
+    {
+        __VDSP_EXACT
+        d = a * s + c;
+    }
+};
+
+template <class T>
+struct clip_op {
+    T lo, hi;
+    __VDSP_INLINE void operator()(T& d, const T& a, const T&) const
+    {
+        d = a;
+        if (d < lo) d = lo;
+        if (hi < d) d = hi;
+    }
+    template <class V> __VDSP_INLINE void operator()(V& d, const V& a, const V&) const
+    {
+        V l, h;
+        splat(l, lo);
+        splat(h, hi);
+        d = a < l ? l : a;
+        d = h < d ? h : d;
+    }
+};
+
+// C[n] = f(A[n], B[n]).  Elementwise, so the vector width does not change
+// the result.  Strided vectors are left to the scalar loop: gathering
+// lanes one at a time is slower than not vectorizing at all.
+template <class T, int B, bool Unit, class F>
+__VDSP_INLINE void map(const call<T>& k, F f)
+{
+    typedef typename simd<T, B>::vector V;
+    constexpr vDSP_Length w = simd<T, B>::width;
+    vDSP_Length i = 0;
+    if constexpr (Unit) {
+        for (; i + 2 * w <= k.n; i += 2 * w) {
+            V x0, y0, x1, y1;
+            load<true>(x0, k.a + i, 1);
+            load<true>(y0, k.b + i, 1);
+            load<true>(x1, k.a + i + w, 1);
+            load<true>(y1, k.b + i + w, 1);
+            f(x0, x0, y0);
+            f(x1, x1, y1);
+            store<true>(k.c + i, 1, x0);
+            store<true>(k.c + i + w, 1, x1);
+        }
+        for (; i + w <= k.n; i += w) {
+            V x0, y0;
+            load<true>(x0, k.a + i, 1);
+            load<true>(y0, k.b + i, 1);
+            f(x0, x0, y0);
+            store<true>(k.c + i, 1, x0);
+        }
+    }
+    const T *a = at(k.a, i, k.ia), *b = at(k.b, i, k.ib);
+    T* c = at(k.c, i, k.ic);
+    for (; i < k.n; i++, a += k.ia, b += k.ib, c += k.ic)
+        f(*c, *a, *b);
+}
+
+// C[n*sc] = sum(A[n*so + p*st] * F[p*sf], 0 <= p < P), vectorized across
+// outputs so each output's sum still runs over p in order.  conv is
+// so == st == IA; desamp is so == DF, st == 1.
+template <class T, int B, bool Unit>
+__VDSP_INLINE void fir(const T* a, vDSP_Stride so, vDSP_Stride st, const T* f, vDSP_Stride sf,
+                       T* c, vDSP_Stride sc, vDSP_Length n, vDSP_Length p)
+{
+    __VDSP_EXACT
+    typedef typename simd<T, B>::vector V;
+    constexpr vDSP_Length w = simd<T, B>::width;
+    const vDSP_Stride sw = (vDSP_Stride)w * so;
+    vDSP_Length i = 0;
+    for (; i + 4 * w <= n; i += 4 * w) {
+        V s0 = {}, s1 = {}, s2 = {}, s3 = {}, h, x0, x1, x2, x3;
+        const T* x = at(a, i, so);
+        for (vDSP_Length j = 0; j < p; j++, x += st) {
+            splat(h, *at(f, j, sf));
+            load<Unit>(x0, x, so);
+            load<Unit>(x1, x + sw, so);
+            load<Unit>(x2, x + 2 * sw, so);
+            load<Unit>(x3, x + 3 * sw, so);
+            s0 += x0 * h;
+            s1 += x1 * h;
+            s2 += x2 * h;
+            s3 += x3 * h;
+        }
+        store<Unit>(at(c, i, sc), sc, s0);
+        store<Unit>(at(c, i + w, sc), sc, s1);
+        store<Unit>(at(c, i + 2 * w, sc), sc, s2);
+        store<Unit>(at(c, i + 3 * w, sc), sc, s3);
+    }
+    for (; i + w <= n; i += w) {
+        V s0 = {}, h, x0;
+        const T* x = at(a, i, so);
+        for (vDSP_Length j = 0; j < p; j++, x += st) {
+            splat(h, *at(f, j, sf));
+            load<Unit>(x0, x, so);
+            s0 += x0 * h;
+        }
+        store<Unit>(at(c, i, sc), sc, s0);
+    }
+    for (; i < n; i++) {
+        T s = 0;
+        const T* x = at(a, i, so);
+        for (vDSP_Length j = 0; j < p; j++, x += st)
+            s += *x * *at(f, j, sf);
+        *at(c, i, sc) = s;
+    }
+}
+
+// desamp for DF > 1.  Each block of outputs first copies its input
+// window into a stack buffer, one row per phase p % DF, so that the inputs
+// tap p needs for consecutive outputs are contiguous.  The sums still run
+// over p in order.  Windows too large for the buffer go through fir().
+template <class T, int B>
+__VDSP_INLINE void decimate(const T* a, vDSP_Stride df, const T* f, T* c, vDSP_Length n, vDSP_Length p)
+{
+    __VDSP_EXACT
+    typedef typename simd<T, B>::vector V;
+    constexpr vDSP_Length w = simd<T, B>::width, span = 4 * w, capacity = 16384 / sizeof(T);
+    const vDSP_Length d = (vDSP_Length)df, row = span + (p + d - 1) / d;
+    vDSP_Length i = 0;
+    if (d * row <= capacity) {
+        T buf[capacity];
+        for (; i + span <= n; i += span) {
+            const T* x = a + i * d;
+            const vDSP_Length window = (span - 1) * d + p;
+            for (vDSP_Length m = 0, r = 0, q = 0; m < window; m++) {
+                buf[r * row + q] = x[m];
+                if (++r == d) {
+                    r = 0;
+                    q++;
+                }
+            }
+            V s0 = {}, s1 = {}, s2 = {}, s3 = {}, h, x0, x1, x2, x3;
+            for (vDSP_Length j = 0, r = 0, q = 0; j < p; j++) {
+                const T* y = buf + r * row + q;
+                splat(h, f[j]);
+                load<true>(x0, y, 1);
+                load<true>(x1, y + w, 1);
+                load<true>(x2, y + 2 * w, 1);
+                load<true>(x3, y + 3 * w, 1);
+                s0 += x0 * h;
+                s1 += x1 * h;
+                s2 += x2 * h;
+                s3 += x3 * h;
+                if (++r == d) {
+                    r = 0;
+                    q++;
+                }
+            }
+            store<true>(c + i, 1, s0);
+            store<true>(c + i + w, 1, s1);
+            store<true>(c + i + 2 * w, 1, s2);
+            store<true>(c + i + 3 * w, 1, s3);
+        }
+    }
+    fir<T, B, false>(a + i * d, df, 1, f, 1, c + i, 1, n - i, p);
+}
+
+// The reductions keep 2 * 64 bytes of partial results, lane l of a block
+// accumulating elements i + l, whatever the instruction set.  Backends
+// with narrower vectors hold the lanes in several registers.  Either way
+// the partials combine identically: lane l with lane l + 64 bytes, then
+// pairwise, lane l with lane l + width/2.
+template <class T, int B, bool Unit, class F>
+__VDSP_INLINE T reduce(const call<T>& k, F f, T init, vDSP_Length& i)
+{
+    typedef typename simd<T, B>::vector V;
+    constexpr vDSP_Length w = simd<T, B>::width, lanes = 2 * 64 / sizeof(T), r = lanes / w;
+    T part[lanes];
+    if constexpr (Unit) {
+        V acc[r], x, y = {};
+        for (vDSP_Length j = 0; j < r; j++)
+            splat(acc[j], init);
+        for (; i + lanes <= k.n; i += lanes) {
+            for (vDSP_Length j = 0; j < r; j++) {
+                load<true>(x, k.a + i + j * w, 1);
+                if constexpr (F::binary) load<true>(y, k.b + i + j * w, 1);
+                f(acc[j], x, y);
+            }
+        }
+        memcpy(part, acc, sizeof(part));
+    } else {
+        for (vDSP_Length l = 0; l < lanes; l++)
+            part[l] = init;
+        for (; i + lanes <= k.n; i += lanes)
+            for (vDSP_Length l = 0; l < lanes; l++)
+                f(part[l], *at(k.a, i + l, k.ia), F::binary ? *at(k.b, i + l, k.ib) : T());
+    }
+    for (vDSP_Length h = lanes / 2; h > 0; h /= 2)
+        for (vDSP_Length l = 0; l < h; l++)
+            f.combine(part[l], part[l + h]);
+    return part[0];
+}
+
+struct dot_op {
+    static constexpr bool binary = true;
+    template <class X> __VDSP_INLINE void operator()(X& s, const X& a, const X& b) const
+    {
+        __VDSP_EXACT
+        s += a * b;
+    }
+    template <class T> __VDSP_INLINE void combine(T& s, const T& t) const { s += t; }
+};
+
+template <bool Max>
+struct pick_op {
+    static constexpr bool binary = false;
+    template <class X> __VDSP_INLINE void operator()(X& m, const X& x, const X&) const
+    {
+        if constexpr (Max) m = x > m ? x : m;
+        else m = x < m ? x : m;
+    }
+    template <class T> __VDSP_INLINE void combine(T& m, const T& x) const { (*this)(m, x, x); }
+};
+
+template <class T, int B, bool Unit>
+__VDSP_INLINE T dotpr(const call<T>& k)
+{
+    __VDSP_EXACT
+    vDSP_Length i = 0;
+    T s = reduce<T, B, Unit>(k, dot_op(), T(), i);
+    for (; i < k.n; i++)
+        s += *at(k.a, i, k.ia) * *at(k.b, i, k.ib);
+    return s;
+}
+
+template <class T, int B, bool Unit, bool Max>
+__VDSP_INLINE T extremum(const call<T>& k)
+{
+    const pick_op<Max> pick;
+    vDSP_Length i = 0;
+    T m = reduce<T, B, Unit>(k, pick, Max ? (T)-INFINITY : (T)INFINITY, i);
+    for (; i < k.n; i++)
+        pick(m, *at(k.a, i, k.ia), m);
+    return m;
+}
+
+template <class T, int B>
+__VDSP_INLINE void run(const call<T>& k)
+{
+    const bool unit_a = k.ia == 1;
+    const bool unit_ab = unit_a && k.ib == 1;
+    const bool unit_abc = unit_ab && k.ic == 1;
+    switch (k.code) {
+    case op::vadd:
+        if (unit_abc) map<T, B, true>(k, add_op());
+        else map<T, B, false>(k, add_op());
+        break;
+    case op::vmul:
+        if (unit_abc) map<T, B, true>(k, mul_op());
+        else map<T, B, false>(k, mul_op());
+        break;
+    case op::vsma:
+        if (unit_abc) map<T, B, true>(k, sma_op<T>{*k.s0});
+        else map<T, B, false>(k, sma_op<T>{*k.s0});
+        break;
+    case op::vclip:
+        if (unit_abc) map<T, B, true>(k, clip_op<T>{*k.s0, *k.s1});
+        else map<T, B, false>(k, clip_op<T>{*k.s0, *k.s1});
+        break;
+    case op::dotpr:
+        *k.c = unit_ab ? dotpr<T, B, true>(k) : dotpr<T, B, false>(k);
+        break;
+    case op::conv:
+        if (unit_a && k.ic == 1) fir<T, B, true>(k.a, 1, 1, k.b, k.ib, k.c, 1, k.n, k.p);
+        else fir<T, B, false>(k.a, k.ia, k.ia, k.b, k.ib, k.c, k.ic, k.n, k.p);
+        break;
+    case op::desamp:
+        if (k.ia == 1) fir<T, B, true>(k.a, 1, 1, k.b, 1, k.c, 1, k.n, k.p);
+        else if (k.ia > 1) decimate<T, B>(k.a, k.ia, k.b, k.c, k.n, k.p);
+        else fir<T, B, false>(k.a, k.ia, 1, k.b, 1, k.c, 1, k.n, k.p);
+        break;
+    case op::maxv:
+        *k.c = unit_a ? extremum<T, B, true, true>(k) : extremum<T, B, false, true>(k);
+        break;
+    case op::minv:
+        *k.c = unit_a ? extremum<T, B, true, false>(k) : extremum<T, B, false, false>(k);
+        break;
+    }
+}
+
+template <class T>
+__VDSP_NOCONTRACT void run_baseline(const call<T>& k) { run<T, 16>(k); }
+
+#if defined(__VDSP_X86_DISPATCH)
+template <class T>
+__attribute__((target("avx2"))) __VDSP_NOCONTRACT void run_avx2(const call<T>& k) { run<T, 32>(k); }
+
+template <class T>
+__attribute__((target("avx512f"))) __VDSP_NOCONTRACT void run_avx512(const call<T>& k) { run<T, 64>(k); }
+#endif
+
+inline isa detect()
+{
+#if defined(__VDSP_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return isa::avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return isa::avx2;
+#endif
+    return isa::baseline;
+}
+
+inline std::atomic<int>& active()
+{
+    static std::atomic<int> slot((int)detect());
+    return slot;
+}
+
+template <class T>
+inline void dispatch(const call<T>& k)
+{
+    switch ((isa)active().load(std::memory_order_relaxed)) {
+#if defined(__VDSP_X86_DISPATCH)
+    case isa::avx512:
+        return run_avx512(k);
+    case isa::avx2:
+        return run_avx2(k);
+#endif
+    default:
+        return run_baseline(k);
+    }
+}
+
+} // namespace detail
+
+// Short name of an instruction set, for benchmark and test output.
+inline const char* isa_name(isa i)
+{
+    switch (i) {
+    case isa::avx2:
+        return "avx2";
+    case isa::avx512:
+        return "avx512";
+    default:
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+        return "neon";
+#elif defined(__SSE2__)
+        return "sse2";
+#else
+        return "generic";
+#endif
+    }
+}
+
+// True if the kernels for i are compiled in and this CPU can run them.
+inline bool isa_supported(isa i)
+{
+    if (i == isa::baseline)
+        return true;
+#if defined(__VDSP_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (i == isa::avx2)
+        return __builtin_cpu_supports("avx2");
+    if (i == isa::avx512)
+        return __builtin_cpu_supports("avx512f");
+#endif
+    return false;
+}
+
+// The instruction set the routines currently run on.
+inline isa active_isa() { return (isa)detail::active().load(std::memory_order_relaxed); }
+
+// Runs every routine on i from now on, in all threads.  Returns false,
+// and changes nothing, if i is not supported.
+inline bool select_isa(isa i)
+{
+    if (!isa_supported(i))
+        return false;
+    detail::active().store((int)i, std::memory_order_relaxed);
+    return true;
+}
+
+// Vector add.
+inline void vDSP_vadd(const float *__A, vDSP_Stride __IA, const float *__B, vDSP_Stride __IB,
+                      float *__C, vDSP_Stride __IC, vDSP_Length __N)
+{
+    detail::dispatch<float>({ detail::op::vadd, __A, __IA, __B, __IB, nullptr, nullptr, __C, __IC, __N, 0 });
+}
+
+inline void vDSP_vaddD(const double *__A, vDSP_Stride __IA, const double *__B, vDSP_Stride __IB,
+                       double *__C, vDSP_Stride __IC, vDSP_Length __N)
+{
+    detail::dispatch<double>({ detail::op::vadd, __A, __IA, __B, __IB, nullptr, nullptr, __C, __IC, __N, 0 });
+}
+
+// Vector multiply.
+inline void vDSP_vmul(const float *__A, vDSP_Stride __IA, const float *__B, vDSP_Stride __IB,
+                      float *__C, vDSP_Stride __IC, vDSP_Length __N)
+{
+    detail::dispatch<float>({ detail::op::vmul, __A, __IA, __B, __IB, nullptr, nullptr, __C, __IC, __N, 0 });
+}
+
+inline void vDSP_vmulD(const double *__A, vDSP_Stride __IA, const double *__B, vDSP_Stride __IB,
+                       double *__C, vDSP_Stride __IC, vDSP_Length __N)
+{
+    detail::dispatch<double>({ detail::op::vmul, __A, __IA, __B, __IB, nullptr, nullptr, __C, __IC, __N, 0 });
+}
+
+// Vector-scalar multiply and vector add.
+inline void vDSP_vsma(const float *__A, vDSP_Stride __IA, const float *__B, const float *__C,
+                      vDSP_Stride __IC, float *__D, vDSP_Stride __ID, vDSP_Length __N)
+{
+    detail::dispatch<float>({ detail::op::vsma, __A, __IA, __C, __IC, __B, nullptr, __D, __ID, __N, 0 });
+}
+
+inline void vDSP_vsmaD(const double *__A, vDSP_Stride __IA, const double *__B, const double *__C,
+                       vDSP_Stride __IC, double *__D, vDSP_Stride __ID, vDSP_Length __N)
+{
+    detail::dispatch<double>({ detail::op::vsma, __A, __IA, __C, __IC, __B, nullptr, __D, __ID, __N, 0 });
+}
+
+// Dot product.
+inline void vDSP_dotpr(const float *__A, vDSP_Stride __IA, const float *__B, vDSP_Stride __IB,
+                       float *__C, vDSP_Length __N)
+{
+    detail::dispatch<float>({ detail::op::dotpr, __A, __IA, __B, __IB, nullptr, nullptr, __C, 1, __N, 0 });
+}
+
+inline void vDSP_dotprD(const double *__A, vDSP_Stride __IA, const double *__B, vDSP_Stride __IB,
+                        double *__C, vDSP_Length __N)
+{
+    detail::dispatch<double>({ detail::op::dotpr, __A, __IA, __B, __IB, nullptr, nullptr, __C, 1, __N, 0 });
+}
+
+// Convolution or correlation.  Pass a negative IF, with F pointing at the
+// last filter element, for convolution.
+inline void vDSP_conv(const float *__A, vDSP_Stride __IA, const float *__F, vDSP_Stride __IF,
+                      float *__C, vDSP_Stride __IC, vDSP_Length __N, vDSP_Length __P)
+{
+    detail::dispatch<float>({ detail::op::conv, __A, __IA, __F, __IF, nullptr, nullptr, __C, __IC, __N, __P });
+}
+
+inline void vDSP_convD(const double *__A, vDSP_Stride __IA, const double *__F, vDSP_Stride __IF,
+                       double *__C, vDSP_Stride __IC, vDSP_Length __N, vDSP_Length __P)
+{
+    detail::dispatch<double>({ detail::op::conv, __A, __IA, __F, __IF, nullptr, nullptr, __C, __IC, __N, __P });
+}
+
+// Anti-aliasing down-sample with real filter.
+inline void vDSP_desamp(const float *__A, vDSP_Stride __DF, const float *__F, float *__C,
+                        vDSP_Length __N, vDSP_Length __P)
+{
+    detail::dispatch<float>({ detail::op::desamp, __A, __DF, __F, 1, nullptr, nullptr, __C, 1, __N, __P });
+}
+
+inline void vDSP_desampD(const double *__A, vDSP_Stride __DF, const double *__F, double *__C,
+                         vDSP_Length __N, vDSP_Length __P)
+{
+    detail::dispatch<double>({ detail::op::desamp, __A, __DF, __F, 1, nullptr, nullptr, __C, 1, __N, __P });
+}
+
+// Maximum value of vector.
+inline void vDSP_maxv(const float *__A, vDSP_Stride __IA, float *__C, vDSP_Length __N)
+{
+    detail::dispatch<float>({ detail::op::maxv, __A, __IA, nullptr, 0, nullptr, nullptr, __C, 1, __N, 0 });
+}
+
+inline void vDSP_maxvD(const double *__A, vDSP_Stride __IA, double *__C, vDSP_Length __N)
+{
+    detail::dispatch<double>({ detail::op::maxv, __A, __IA, nullptr, 0, nullptr, nullptr, __C, 1, __N, 0 });
+}
+
+// Minimum value of vector.
+inline void vDSP_minv(const float *__A, vDSP_Stride __IA, float *__C, vDSP_Length __N)
+{
+    detail::dispatch<float>({ detail::op::minv, __A, __IA, nullptr, 0, nullptr, nullptr, __C, 1, __N, 0 });
+}
+
+inline void vDSP_minvD(const double *__A, vDSP_Stride __IA, double *__C, vDSP_Length __N)
+{
+    detail::dispatch<double>({ detail::op::minv, __A, __IA, nullptr, 0, nullptr, nullptr, __C, 1, __N, 0 });
+}
+
+// Vector clip.
+inline void vDSP_vclip(const float *__A, vDSP_Stride __IA, const float *__B, const float *__C,
+                       float *__D, vDSP_Stride __ID, vDSP_Length __N)
+{
+    detail::dispatch<float>({ detail::op::vclip, __A, __IA, __A, __IA, __B, __C, __D, __ID, __N, 0 });
+}
+
+inline void vDSP_vclipD(const double *__A, vDSP_Stride __IA, const double *__B, const double *__C,
+                        double *__D, vDSP_Stride __ID, vDSP_Length __N)
+{
+    detail::dispatch<double>({ detail::op::vclip, __A, __IA, __A, __IA, __B, __C, __D, __ID, __N, 0 });
+}
+
+} // namespace vdsp
+
+#endif /* __cplusplus */
+
+#endif /* __VDSP_PORTABLE__ */
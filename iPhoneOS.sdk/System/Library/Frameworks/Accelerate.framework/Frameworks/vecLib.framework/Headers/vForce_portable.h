@@ -0,0 +1,912 @@
+/*
+    File:       vecLib/vForce_portable.h
+
+    Contains:   Portable SIMD vForce transcendentals with accuracy tiers
+
+    This header implements the single-precision vForce routines that
+    ML and audio code spends its time in, with the names and parameter
+    lists of vForce.h, in namespace vdsp:
+
+        vvexpf      y[i] = e**x[i]
+        vvexp2f     y[i] = 2**x[i]
+        vvlogf      y[i] = log(x[i])
+        vvlog2f     y[i] = log2(x[i])
+        vvsinf      y[i] = sin(x[i])
+        vvcosf      y[i] = cos(x[i])
+        vvsincosf   z[i] = sin(x[i]), y[i] = cos(x[i])
+        vvcosisinf  C[i] = cos(x[i]) + I*sin(x[i])
+        vvpowf      z[i] = x[i]**y[i]
+        vvrsqrtf    y[i] = 1/sqrt(x[i])
+        vvtanhf     y[i] = tanh(x[i])
+
+    vForce has one accuracy.  Here each routine comes in three tiers,
+    and callers trade accuracy for throughput:
+
+        accuracy::ulp1  At most 1 ulp from the exact result, over every
+                        float input.  The reduced argument and the
+                        polynomial are evaluated in double, then rounded
+                        once, so the error is barely above half an ulp.
+
+        accuracy::ulp4  At most 4 ulp, over every float input.  Float
+                        arithmetic throughout, except in vvpowf, which
+                        keeps double but with shorter polynomials.
+
+        accuracy::fast  A relative error below 2**-16, about 16 good
+                        bits, with the shortest polynomials that reach
+                        it.  vvpowf's error grows with the size of
+                        y*log2(x): 2**-16 * max(1, |y*log2(x)|).
+
+    The tier is process wide, like the instruction set: ulp1 until
+    select_accuracy() changes it.  Each routine also has an overload
+    taking the tier as a last argument, for callers that mix them.
+
+    Every tier keeps the special cases of vForce.h and C99 Annex F:
+    infinities, NaNs, signed zeros, subnormal inputs and results,
+    overflow and underflow, and the full table of vvpowf.  Arguments of
+    vvsinf and friends are reduced exactly at any magnitude; those above
+    2**20 (2**15 in the float tiers) take a slower path that extracts the
+    bits of 2/pi they need.
+
+    The kernels are compiled per instruction set and dispatched as in
+    vDSP_portable.h.  Multiplies and adds are never fused, so every
+    instruction set returns the same bits.
+*/
+#ifndef __VFORCE_PORTABLE__
+#define __VFORCE_PORTABLE__
+
+#if defined(__cplusplus)
+
+#include <vecLib/vDSP_portable.h>
+
+#include <complex>
+#include <type_traits>
+
+namespace vdsp {
+
+// Accuracy tiers of the vForce routines, most accurate first.
+enum class accuracy : int {
+    ulp1,
+    ulp4,
+    fast,
+};
+
+namespace detail {
+
+enum class vf : int { exp, exp2, log, log2, sin, cos, sincos, cosisin, pow, rsqrt, tanh };
+
+struct vf_call {
+    vf           op;
+    accuracy     tier;
+    float*       y;     // cosisin: cos and sin interleaved; sincos: cos
+    float*       z;     // sincos: sin
+    const float* x;
+    const float* e;     // pow: the exponent
+    vDSP_Length  n;
+};
+
+// The integer vector with as many lanes as the float vector F, and the
+// double and 64-bit vectors of the same size, with half as many.
+template <class F>
+struct vf_lanes {
+    typedef decltype(F() < F())                      I;
+    typedef typename simd<double, sizeof(F)>::vector D;
+    typedef decltype(D() < D())                      L;
+};
+
+// The double work runs on vectors of the native width, one half of the
+// float vector at a time: GCC splits wider vectors through memory, and
+// their comparisons into scalars.
+template <class W, class V>
+__VDSP_INLINE void vf_widen(W& lo, W& hi, const V& v)
+{
+    typedef typename std::decay<decltype(v[0])>::type T;
+    typedef typename simd<T, sizeof(V) / 2>::vector H;
+    H h[2];
+    memcpy(h, &v, sizeof(v));
+    lo = __builtin_convertvector(h[0], W);
+    hi = __builtin_convertvector(h[1], W);
+}
+
+template <class V, class W>
+__VDSP_INLINE void vf_narrow(V& v, const W& lo, const W& hi)
+{
+    typedef typename std::decay<decltype(v[0])>::type T;
+    typedef typename simd<T, sizeof(V) / 2>::vector H;
+    H h[2] = { __builtin_convertvector(lo, H), __builtin_convertvector(hi, H) };
+    memcpy(&v, h, sizeof(v));
+}
+
+template <class M>
+__VDSP_INLINE bool any(const M& m)
+{
+    auto r = m[0];
+    for (unsigned l = 1; l < sizeof(M) / sizeof(m[0]); l++)
+        r |= m[l];
+    return r != 0;
+}
+
+template <class F>
+__VDSP_INLINE void vf_abs(F& a, const F& v)
+{
+    typedef typename vf_lanes<F>::I I;
+    a = (F)((I)v & 0x7fffffff);
+}
+
+// a where m is set, b elsewhere.
+//
+// The masks are built with integer arithmetic, (b - c) >> 31 for the
+// lanes where b < c, rather than with comparisons: GCC cannot combine
+// comparison results made in these helpers, which have no target of
+// their own, once they are inlined into an AVX-512 function, and splits
+// such code into scalars.  b and c are the bits of non-negative floats,
+// whose integer order is the float order.
+template <class V, class M>
+__VDSP_INLINE void vf_select(V& v, const M& m, const V& a, const V& b)
+{
+    v = (V)(((M)a & m) | ((M)b & ~m));
+}
+
+template <class V, class T>
+__VDSP_INLINE void vf_clamp(V& v, T lo, T hi)
+{
+    V l = V{} + lo, h = V{} + hi;
+    v = v < l ? l : v;
+    v = v > h ? h : v;      // NaNs pass through both
+}
+
+inline constexpr double vf_inv_fact[] = {
+    1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320,
+    1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600, 1.0 / 6227020800.0,
+};
+
+// t = k*ln2 + r with |r| <= ln2/2, and s = 2**k.  |t| must stay below
+// 700 for s to be a normal double.
+template <class D>
+__VDSP_INLINE void exp_reduce(D& r, D& s, const D& t)
+{
+    typedef decltype(D() < D()) L;
+    D kk = t * 0x1.71547652b82fep0 + 0x1.8p52;
+    D k = kk - 0x1.8p52;
+    r = (t - k * 0x1.62e42feep-1) - k * 0x1.a39ef35793c76p-33;
+    s = (D)(((L)kk - 0x4338000000000000 + 1023) << 52);
+}
+
+// q = r + r**2/2! + ... + r**N/N!, the Taylor series of e**r - 1.
+template <int N, class D>
+__VDSP_INLINE void exp_series(D& q, const D& r)
+{
+    q = r * vf_inv_fact[N];
+#pragma GCC unroll 16
+    for (int j = N - 1; j >= 1; j--)
+        q = (q + vf_inv_fact[j]) * r;
+}
+
+// e**t in double, relative error 2**-37 for N = 9 and 2**-27 for N = 7.
+template <int N, class D>
+__VDSP_INLINE void exp_double(D& y, const D& t)
+{
+    D r, s, q;
+    exp_reduce(r, s, t);
+    exp_series<N>(q, r);
+    y = s + s * q;
+}
+
+// p * 2**k, where kk holds k in its low bits, as rounding to an integer
+// by adding 0x1.8p23 leaves it.  The two steps keep both factors normal
+// for k in [-151, 129], so that only the last multiply rounds, into a
+// subnormal or an infinity if it has to.
+template <class F>
+__VDSP_INLINE void exp_scale(F& y, const F& p, const F& kk)
+{
+    typedef typename vf_lanes<F>::I I;
+    I k = (I)kk - 0x4b400000;
+    I k1 = k >> 1;
+    y = p * (F)((k1 + 127) << 23) * (F)((k - k1 + 127) << 23);
+}
+
+// e**t in float for t in [-104, 89].
+template <accuracy A, class F>
+__VDSP_INLINE void exp_float(F& y, const F& t)
+{
+    F kk = t * 0x1.715476p0f + 0x1.8p23f;
+    F k = kk - 0x1.8p23f;
+    F r = (t - k * 0.693359375f) - k * -2.12194440e-4f;
+    F p;
+    if constexpr (A == accuracy::ulp4) {
+        F z = r * r;
+        p = (((((1.9875691500e-4f * r + 1.3981999507e-3f) * r + 8.3334519073e-3f) * r + 4.1665795894e-2f) * r
+              + 1.6666665459e-1f) * r + 5.0000001201e-1f) * z + r + 1.0f;
+    } else {
+        p = ((((0x1.5414dap-5f * r + 0x1.57ceb6p-3f) * r + 0x1.0003f4p-1f) * r + 0x1.fffba8p-1f) * r) + 1.0f;
+    }
+    exp_scale(y, p, kk);
+}
+
+template <accuracy A, class F>
+__VDSP_INLINE void exp_eval(F& y, const F& x)
+{
+    typedef typename vf_lanes<F>::D D;
+    F t = x;
+    vf_clamp(t, -104.0f, 89.0f);
+    if constexpr (A == accuracy::ulp1) {
+        D lo, hi;
+        vf_widen(lo, hi, t);
+        exp_double<9>(lo, lo);
+        exp_double<9>(hi, hi);
+        vf_narrow(y, lo, hi);
+    } else {
+        exp_float<A>(y, t);
+    }
+}
+
+template <accuracy A, class F>
+__VDSP_INLINE void exp2_eval(F& y, const F& x)
+{
+    typedef typename vf_lanes<F>::D D;
+    F t = x;
+    vf_clamp(t, -151.0f, 129.0f);
+    if constexpr (A == accuracy::ulp1) {
+        D lo, hi;
+        vf_widen(lo, hi, t);
+        exp_double<9>(lo, lo * 0x1.62e42fefa39efp-1);
+        exp_double<9>(hi, hi * 0x1.62e42fefa39efp-1);
+        vf_narrow(y, lo, hi);
+    } else {
+        F kk = t + 0x1.8p23f;
+        F r = t - (kk - 0x1.8p23f);
+        F p;
+        if constexpr (A == accuracy::ulp4)
+            p = (((((0x1.41fbbcp-13f * r + 0x1.5f3e52p-10f) * r + 0x1.3b2d4cp-7f) * r + 0x1.c6aee8p-5f) * r
+                  + 0x1.ebfbdcp-3f) * r + 0x1.62e43p-1f) * r + 1.0f;
+        else
+            p = (((0x1.3a02ccp-7f * r + 0x1.c9fc46p-5f) * r + 0x1.ec0378p-3f) * r + 0x1.62e12cp-1f) * r + 1.0f;
+        exp_scale(y, p, kk);
+    }
+}
+
+// x = 2**e * (1 + f) with 1 + f in [sqrt(1/2), sqrt(2)), for x > 0
+// and finite, subnormals included.  Other lanes get garbage.
+template <class F>
+__VDSP_INLINE void log_reduce(F& f, F& e, const F& x)
+{
+    typedef typename vf_lanes<F>::I I;
+    I tiny = (((I)x & 0x7fffffff) - 0x00800000) >> 31;
+    F xs;
+    vf_select(xs, tiny, x * 0x1p23f, x);
+    I ix = (I)xs - 0x3f3504f3;
+    f = (F)((ix & 0x7fffff) + 0x3f3504f3) - 1.0f;
+    e = __builtin_convertvector((ix >> 23) + (tiny & -23), F);
+}
+
+// log(1 + f) in double, as 2*atanh(s) with s = f/(2 + f), |s| < 0.172.
+// The series stops at s**(2N+1); its relative error is 2**-34 for N = 5
+// and 2**-44 for N = 7.
+template <int N, class D>
+__VDSP_INLINE void log1p_double(D& y, const D& f)
+{
+    D s = f / (f + 2.0);
+    D z = s * s;
+    D p = z * (1.0 / (2 * N + 1));
+#pragma GCC unroll 16
+    for (int j = N - 1; j >= 1; j--)
+        p = (p + 1.0 / (2 * j + 1)) * z;
+    y = (s + s * p) * 2.0;
+}
+
+// e + log(1 + f), or its base 2 version, in double.
+template <bool Two, class D>
+__VDSP_INLINE void log_double(D& y, const D& f, const D& e)
+{
+    D lf;
+    log1p_double<5>(lf, f);
+    if constexpr (Two)
+        y = e + lf * 0x1.71547652b82fep0;
+    else
+        y = e * 0x1.62e42feep-1 + (lf + e * 0x1.a39ef35793c76p-33);
+}
+
+// log(x) for x <= 0, NaN and infinity.
+template <class F>
+__VDSP_INLINE void log_special(F& y, const F& x)
+{
+    typedef typename vf_lanes<F>::I I;
+    I b = (I)x & 0x7fffffff, neg = (I)x >> 31, zero = (b - 1) >> 31;
+    F s;
+    vf_select(s, neg, F{} + NAN, x);            // +inf and NaN are their own log
+    vf_select(s, zero, F{} - INFINITY, s);
+    vf_select(y, ~neg & ~zero & ((b - 0x7f800000) >> 31), y, s);
+}
+
+template <accuracy A, bool Two, class F>
+__VDSP_INLINE void log_eval(F& y, const F& x)
+{
+    typedef typename vf_lanes<F>::D D;
+    F f, e;
+    log_reduce(f, e, x);
+    if constexpr (A == accuracy::ulp1) {
+        D flo, fhi, elo, ehi;
+        vf_widen(flo, fhi, f);
+        vf_widen(elo, ehi, e);
+        log_double<Two>(flo, flo, elo);
+        log_double<Two>(fhi, fhi, ehi);
+        vf_narrow(y, flo, fhi);
+    } else if constexpr (A == accuracy::ulp4) {
+        F z = f * f;
+        F p = ((((((((7.0376836292e-2f * f - 1.1514610310e-1f) * f + 1.1676998740e-1f) * f - 1.2420140846e-1f) * f
+                   + 1.4249322787e-1f) * f - 1.6668057665e-1f) * f + 2.0000714765e-1f) * f - 2.4999993993e-1f) * f
+                + 3.3333331174e-1f) * f * z;
+        if constexpr (Two)
+            y = (f + (p - 0.5f * z)) * 0x1.715476p0f + e;
+        else
+            y = f + ((p + e * -2.12194440e-4f) - 0.5f * z) + e * 0.693359375f;
+    } else {
+        if constexpr (Two)
+            y = (((((-0x1.a64778p-3f * f + 0x1.45d632p-2f) * f - 0x1.77499ap-2f) * f + 0x1.eb53ccp-2f) * f
+                  - 0x1.7141f6p-1f) * f + 0x1.7154e4p+0f) * f + e;
+        else
+            y = (((((-0x1.24b39cp-3f * f + 0x1.c3b4ap-3f) * f - 0x1.042126p-2f) * f + 0x1.548feap-2f) * f
+                  - 0x1.ffe65cp-2f) * f + 0x1.00004cp+0f) * f + e * 0x1.62e43p-1f;
+    }
+    log_special(y, x);
+}
+
+// Quadrant and reduced argument of |x| >= 2**20: x*2/pi = 4*m + q + r
+// with q in [0, 4) and |r| <= 1/2, from the 96 bits of 2/pi that matter
+// for x's exponent.  Returns q, and r*pi/2 in rr.
+inline int reduce_large(float x, double& rr)
+{
+    static const uint32_t two_over_pi[] = {
+        0xa2f9836e, 0x4e441529, 0xfc2757d1, 0xf534ddc0, 0xdb629599, 0x3c439041, 0xfe5163ab, 0xdebbc561,
+    };
+    uint32_t b;
+    memcpy(&b, &x, sizeof(b));
+    int e = (int)((b >> 23) & 0xff) - 150;      // |x| = m * 2**e
+    uint64_t m = (b & 0x7fffff) | 0x800000;
+
+    // Bit i of 2/pi, counting from 1 after the point, adds m * 2**(e-i),
+    // a multiple of 4 for i <= e - 2.  Take bits i0 .. i0+95 as y0:y1:y2.
+    int i0 = e > 2 ? e - 1 : 1, w = (i0 - 1) / 32, sh = (i0 - 1) % 32;
+    uint64_t y[3];
+    for (int j = 0; j < 3; j++)
+        y[j] = (uint32_t)((((uint64_t)two_over_pi[w + j] << 32) | two_over_pi[w + j + 1]) >> (32 - sh));
+
+    // m * y in three limbs, p0:p1:p2, with t = i0 + 95 - e fraction bits.
+    uint64_t p2 = m * y[2];
+    uint64_t p1 = m * y[1] + (p2 >> 32);
+    uint64_t p0 = m * y[0] + (p1 >> 32);
+    uint64_t lo = (p1 << 32) | (p2 & 0xffffffff);
+    int u = i0 + 31 - e;
+    int q = (int)(p0 >> u) & 3;
+    uint64_t frac = (lo >> u) | (p0 << (64 - u));
+
+    // Round to the nearest quadrant: the top bit of frac moves r into
+    // [-1/2, 1/2) and q on by one.
+    q = (q + (int)(frac >> 63)) & 3;
+    rr = (double)(int64_t)frac * 0x1.921fb54442d18p-64;
+    if (b >> 31) {
+        rr = -rr;
+        q = -q & 3;
+    }
+    return q;
+}
+
+// sin(x) and cos(x) from sin(r) and cos(r), x = q*pi/2 + r.
+template <class V, class M>
+__VDSP_INLINE void sincos_quadrant(V& s, V& c, const V& sr, const V& cr, const M& q)
+{
+    constexpr int top = 8 * sizeof(q[0]) - 2;
+    M odd = -(q & 1);
+    vf_select(s, odd, cr, sr);
+    vf_select(c, odd, sr, cr);
+    s = (V)((M)s ^ ((q & 2) << top));
+    c = (V)((M)c ^ (((q + 1) & 2) << top));
+}
+
+// Any x, in double, for the lanes of one half.  xl holds them as floats
+// when some lie in [2**20, inf), and is null otherwise.
+template <class D>
+__VDSP_INLINE void sincos_half(D& s, D& c, const D& x, const float* xl)
+{
+    typedef decltype(D() < D()) L;
+    D kk = x * 0x1.45f306dc9c883p-1 + 0x1.8p52;
+    D k = kk - 0x1.8p52;
+    D r = (x - k * 0x1.921fb544p0) - k * 0x1.0b4611a626331p-34;
+    L q = (L)kk;
+    if (xl) {
+        // Through arrays, so that q and r stay in registers otherwise.
+        constexpr unsigned w = sizeof(D) / sizeof(double);
+        double rl[w];
+        int64_t ql[w];
+        memcpy(rl, &r, sizeof(r));
+        memcpy(ql, &q, sizeof(q));
+        for (unsigned l = 0; l < w; l++)
+            if (fabsf(xl[l]) >= 0x1p20f && fabsf(xl[l]) < INFINITY)
+                ql[l] = reduce_large(xl[l], rl[l]);
+        memcpy(&r, rl, sizeof(r));
+        memcpy(&q, ql, sizeof(q));
+    }
+    D z = r * r;
+    D sr = r + r * z * ((((-vf_inv_fact[11] * z + vf_inv_fact[9]) * z - vf_inv_fact[7]) * z + vf_inv_fact[5]) * z
+                        - vf_inv_fact[3]);
+    D cr = ((((vf_inv_fact[12] * z - vf_inv_fact[10]) * z + vf_inv_fact[8]) * z - vf_inv_fact[6]) * z
+            + vf_inv_fact[4]) * z * z - 0.5 * z + 1.0;
+    sincos_quadrant(s, c, sr, cr, q);
+}
+
+// Any x, in double.
+template <class F>
+__VDSP_INLINE void sincos_double(F& s, F& c, const F& x)
+{
+    typedef typename vf_lanes<F>::I I;
+    typedef typename vf_lanes<F>::D D;
+    constexpr unsigned w = sizeof(F) / sizeof(float);
+    float xl[w];
+    const float* big = nullptr;
+    I b = (I)x & 0x7fffffff;
+    if (any(~((b - 0x49800000) >> 31) & ((b - 0x7f800000) >> 31))) {     // 2**20 <= |x| < inf
+        memcpy(xl, &x, sizeof(x));
+        big = xl;
+    }
+    D lo, hi, slo, shi, clo, chi;
+    vf_widen(lo, hi, x);
+    sincos_half(slo, clo, lo, big);
+    sincos_half(shi, chi, hi, big ? big + w / 2 : nullptr);
+    vf_narrow(s, slo, shi);
+    vf_narrow(c, clo, chi);
+}
+
+// |x| <= 32768, in float: pi/2 in four parts, the first three short
+// enough for k times them to be exact.
+template <accuracy A, class F>
+__VDSP_INLINE void sincos_float(F& s, F& c, const F& x)
+{
+    typedef typename vf_lanes<F>::I I;
+    F kk = x * 0x1.45f306p-1f + 0x1.8p23f;
+    F k = kk - 0x1.8p23f;
+    F r = (((x - k * 1.5703125f) - k * 4.8351287841796875e-4f) - k * 3.1385570764541625977e-7f)
+          - k * 6.0771006282766103811e-11f;
+    F z = r * r, sr, cr;
+    if constexpr (A == accuracy::ulp4) {
+        sr = r + r * z * ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f);
+        cr = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z - 0.5f * z
+             + 1.0f;
+    } else {
+        sr = r * ((0x1.0b0faep-7f * z - 0x1.553eep-3f) * z + 0x1.ffffcep-1f);
+        cr = (0x1.4aa5f6p-5f * z - 0x1.ffad9p-2f) * z + 0x1.fffe74p-1f;
+    }
+    sincos_quadrant(s, c, sr, cr, (I)kk);
+}
+
+template <accuracy A, class F>
+__VDSP_INLINE void sincos_eval(F& s, F& c, const F& x)
+{
+    typedef typename vf_lanes<F>::I I;
+    if constexpr (A == accuracy::ulp1) {
+        sincos_double(s, c, x);
+    } else {
+        // Lane by lane, so that every vector width takes the same path.
+        F sd, cd;
+        I big = ~((((I)x & 0x7fffffff) - 0x47000001) >> 31);      // |x| > 32768, inf and NaN
+        sincos_float<A>(s, c, x);
+        if (any(big)) {
+            sincos_double(sd, cd, x);
+            vf_select(s, big, sd, s);
+            vf_select(c, big, cd, c);
+        }
+    }
+    vf_select(s, (((I)x & 0x7fffffff) - 1) >> 31, x, s);      // sin(-0) = -0
+}
+
+// tanh(a) for a in [0, 10], in double, as (e**2a - 1)/(e**2a + 1) with
+// e**2a - 1 = 2**k*q + (2**k - 1), exact when k = 0, for small a.
+template <class D>
+__VDSP_INLINE void tanh_double(D& t, const D& a)
+{
+    D r, s, q;
+    exp_reduce(r, s, a * 2.0);
+    exp_series<10>(q, r);
+    D m = s * q + (s - 1.0);
+    t = m / (m + 2.0);
+}
+
+template <accuracy A, class F>
+__VDSP_INLINE void tanh_eval(F& y, const F& x)
+{
+    typedef typename vf_lanes<F>::I I;
+    typedef typename vf_lanes<F>::D D;
+    F ax, t;
+    vf_abs(ax, x);
+    vf_clamp(ax, 0.0f, 10.0f);      // tanh(x) rounds to 1 from 9.01
+    if constexpr (A == accuracy::ulp1) {
+        D lo, hi;
+        vf_widen(lo, hi, ax);
+        tanh_double(lo, lo);
+        tanh_double(hi, hi);
+        vf_narrow(t, lo, hi);
+    } else {
+        F z = ax * ax, ts, tl;
+        if constexpr (A == accuracy::ulp4)
+            ts = ((((-5.70498872745e-3f * z + 2.06390887954e-2f) * z - 5.37397155531e-2f) * z + 1.33314422036e-1f) * z
+                  - 3.33332819422e-1f) * z * ax + ax;
+        else
+            ts = (((-0x1.47ec7cp-5f * z + 0x1.0a8e94p-3f) * z - 0x1.55162ap-2f) * z + 0x1.ffff9ep-1f) * ax;
+        exp_float<A>(tl, ax + ax);
+        tl = 1.0f - 2.0f / (tl + 1.0f);
+        vf_select(t, ((I)ax - 0x3f200000) >> 31, ts, tl);        // |x| < 0.625
+    }
+    y = (F)((I)t | ((I)x & (int32_t)0x80000000));
+}
+
+// 1/sqrt(x) for normal x, in double.
+template <class D>
+__VDSP_INLINE void rsqrt_double(D& g, const D& x)
+{
+    typedef decltype(D() < D()) L;
+    D h = x * 0.5;
+    g = (D)(0x5fe6eb50c7b537a9 - ((L)x >> 1));
+#pragma GCC unroll 4
+    for (int j = 0; j < 4; j++)
+        g = g * (1.5 - h * g * g);
+}
+
+template <accuracy A, class F>
+__VDSP_INLINE void rsqrt_eval(F& y, const F& x)
+{
+    typedef typename vf_lanes<F>::I I;
+    typedef typename vf_lanes<F>::D D;
+    if constexpr (A == accuracy::ulp1) {
+        D lo, hi;
+        vf_widen(lo, hi, x);
+        rsqrt_double(lo, lo);
+        rsqrt_double(hi, hi);
+        vf_narrow(y, lo, hi);
+    } else {
+        I tiny = (((I)x & 0x7fffffff) - 0x00800000) >> 31;
+        F xs;
+        vf_select(xs, tiny, x * 0x1p24f, x);
+        F h = xs * 0.5f, g = (F)(0x5f375a86 - ((I)xs >> 1));
+#pragma GCC unroll 4
+        for (int j = 0; j < (A == accuracy::ulp4 ? 3 : 2); j++)
+            g = g * (1.5f - h * g * g);
+        vf_select(y, tiny, g * 0x1p12f, g);
+    }
+    I b = (I)x & 0x7fffffff, neg = (I)x >> 31, zero = (b - 1) >> 31;
+    F s;
+    vf_select(s, (b - 0x7f800001) >> 31, F{}, x);                // 1/sqrt(inf) = 0, NaN stays
+    vf_select(s, neg, F{} + NAN, s);
+    vf_select(s, zero, (F)((I)x | 0x7f800000), s);                 // 1/sqrt(-0) = -inf
+    vf_select(y, ~neg & ~zero & ((b - 0x7f800000) >> 31), y, s);
+}
+
+// |x|**y in double, from x = 2**e * (1 + f), or from ls, log|x| where
+// x is zero, infinite or NaN, in the lanes finite leaves clear.
+template <int N, class D, class L>
+__VDSP_INLINE void pow_double(D& m, const D& f, const D& e, const D& y, const D& ls, const L& finite)
+{
+    D l;
+    log1p_double<N>(l, f);
+    l = e * 0x1.62e42feep-1 + (l + e * 0x1.a39ef35793c76p-33);
+    vf_select(l, finite, l, ls);
+    D t = y * l;
+    vf_clamp(t, -110.0, 100.0);
+    exp_double<N + 2>(m, t);
+}
+
+// x**y for |x|, then the sign and special cases of C99 pow.
+template <accuracy A, class F>
+__VDSP_INLINE void pow_eval(F& z, const F& x, const F& y)
+{
+    typedef typename vf_lanes<F>::I I;
+    typedef typename vf_lanes<F>::D D;
+    typedef typename vf_lanes<F>::L L;
+    F ax, f, e, m, ls;
+    vf_abs(ax, x);
+    log_reduce(f, e, ax);
+
+    // log|x| is -inf at 0, and |x| itself at inf and NaN.
+    I bx = (I)ax, zero = (bx - 1) >> 31, finite = ~zero & ((bx - 0x7f800000) >> 31);
+    vf_select(ls, zero, F{} - INFINITY, ax);
+    if constexpr (A == accuracy::fast) {
+        F l = (((((-0x1.a64778p-3f * f + 0x1.45d632p-2f) * f - 0x1.77499ap-2f) * f + 0x1.eb53ccp-2f) * f
+                - 0x1.7141f6p-1f) * f + 0x1.7154e4p+0f) * f + e;
+        vf_select(l, finite, l, ls);
+        F t = y * l;
+        vf_clamp(t, -151.0f, 129.0f);
+        F kk = t + 0x1.8p23f;
+        F r = t - (kk - 0x1.8p23f);
+        F p = (((0x1.3a02ccp-7f * r + 0x1.c9fc46p-5f) * r + 0x1.ec0378p-3f) * r + 0x1.62e12cp-1f) * r + 1.0f;
+        exp_scale(m, p, kk);
+    } else {
+        // y*log|x| must be good to 2**-30 or so in absolute terms for
+        // values up to 104 to round right: the log series runs to
+        // 2**-44, relative.
+        constexpr int N = A == accuracy::ulp1 ? 7 : 5;
+        D flo, fhi, elo, ehi, ylo, yhi, slo, shi;
+        L klo, khi;
+        vf_widen(flo, fhi, f);
+        vf_widen(elo, ehi, e);
+        vf_widen(ylo, yhi, y);
+        vf_widen(slo, shi, ls);
+        vf_widen(klo, khi, finite);
+        pow_double<N>(flo, flo, elo, ylo, slo, klo);
+        pow_double<N>(fhi, fhi, ehi, yhi, shi, khi);
+        vf_narrow(m, flo, fhi);
+    }
+
+    // Floats of 2**24 and up are even integers.  y - trunc(y) is zero
+    // exactly for the others.
+    F ay, d;
+    vf_abs(ay, y);
+    I by = (I)ay, small = (by - 0x4b800000) >> 31, yi, one;
+    vf_select(d, small, y, F{});
+    yi = __builtin_convertvector(d, I);
+    vf_abs(d, y - __builtin_convertvector(yi, F));
+    I whole = ~small | (((I)d - 1) >> 31), neg = (I)x >> 31;
+    m = (F)((I)m ^ (neg & whole & (yi << 31)));                         // odd y keeps the sign of x
+    vf_select(m, neg & finite & ~whole, F{} + NAN, m);                  // x < 0, y not an integer
+    one = (((bx ^ 0x3f800000) - 1) >> 31) & (~neg | (((by ^ 0x7f800000) - 1) >> 31));
+    vf_select(z, ((by - 1) >> 31) | one, F{} + 1.0f, m);                 // y = 0, x = 1, x = -1 with y = +-inf
+}
+
+template <class F, vf Op, accuracy A>
+__VDSP_INLINE void vf_eval(F& y, F& z, const F& x, const F& e)
+{
+    if constexpr (Op == vf::exp)
+        exp_eval<A>(y, x);
+    else if constexpr (Op == vf::exp2)
+        exp2_eval<A>(y, x);
+    else if constexpr (Op == vf::log)
+        log_eval<A, false>(y, x);
+    else if constexpr (Op == vf::log2)
+        log_eval<A, true>(y, x);
+    else if constexpr (Op == vf::sin)
+        sincos_eval<A>(y, z, x);
+    else if constexpr (Op == vf::cos)
+        sincos_eval<A>(z, y, x);
+    else if constexpr (Op == vf::sincos || Op == vf::cosisin)
+        sincos_eval<A>(z, y, x);
+    else if constexpr (Op == vf::pow)
+        pow_eval<A>(y, x, e);
+    else if constexpr (Op == vf::rsqrt)
+        rsqrt_eval<A>(y, x);
+    else
+        tanh_eval<A>(y, x);
+}
+
+template <class F, vf Op>
+__VDSP_INLINE void vf_store(const vf_call& k, vDSP_Length i, const F& y, const F& z)
+{
+    constexpr unsigned w = sizeof(F) / sizeof(float);
+    if constexpr (Op == vf::cosisin) {
+        float lanes[2 * w];
+        for (unsigned l = 0; l < w; l++) {
+            lanes[2 * l] = y[l];
+            lanes[2 * l + 1] = z[l];
+        }
+        memcpy(k.y + 2 * i, lanes, sizeof(lanes));
+    } else {
+        memcpy(k.y + i, &y, sizeof(y));
+        if constexpr (Op == vf::sincos)
+            memcpy(k.z + i, &z, sizeof(z));
+    }
+}
+
+template <int B, vf Op, accuracy A>
+__VDSP_INLINE void vf_map(const vf_call& k)
+{
+    typedef typename simd<float, B>::vector F;
+    constexpr vDSP_Length w = simd<float, B>::width;
+    F x, e = F{} + 1.0f, y, z;
+    vDSP_Length i = 0;
+    for (; i + w <= k.n; i += w) {
+        memcpy(&x, k.x + i, sizeof(x));
+        if constexpr (Op == vf::pow)
+            memcpy(&e, k.e + i, sizeof(e));
+        vf_eval<F, Op, A>(y, z, x, e);
+        vf_store<F, Op>(k, i, y, z);
+    }
+    if (i < k.n) {
+        // The tail runs through the same kernel, padded with ones.
+        float lx[w], le[w], ly[2 * w], lz[w];
+        vDSP_Length n = k.n - i;
+        for (vDSP_Length l = 0; l < w; l++) {
+            lx[l] = l < n ? k.x[i + l] : 1.0f;
+            le[l] = l < n && Op == vf::pow ? k.e[i + l] : 1.0f;
+        }
+        memcpy(&x, lx, sizeof(x));
+        memcpy(&e, le, sizeof(e));
+        vf_eval<F, Op, A>(y, z, x, e);
+        vf_call t = { Op, A, ly, lz, nullptr, nullptr, w };
+        vf_store<F, Op>(t, 0, y, z);
+        memcpy(k.y + (Op == vf::cosisin ? 2 * i : i), ly, (Op == vf::cosisin ? 2 * n : n) * sizeof(float));
+        if constexpr (Op == vf::sincos)
+            memcpy(k.z + i, lz, n * sizeof(float));
+    }
+}
+
+template <int B, vf Op>
+__VDSP_INLINE void vf_tier(const vf_call& k)
+{
+    switch (k.tier) {
+    case accuracy::ulp4:
+        return vf_map<B, Op, accuracy::ulp4>(k);
+    case accuracy::fast:
+        return vf_map<B, Op, accuracy::fast>(k);
+    default:
+        return vf_map<B, Op, accuracy::ulp1>(k);
+    }
+}
+
+template <int B>
+__VDSP_INLINE void vf_run(const vf_call& k)
+{
+    switch (k.op) {
+    case vf::exp:
+        return vf_tier<B, vf::exp>(k);
+    case vf::exp2:
+        return vf_tier<B, vf::exp2>(k);
+    case vf::log:
+        return vf_tier<B, vf::log>(k);
+    case vf::log2:
+        return vf_tier<B, vf::log2>(k);
+    case vf::sin:
+        return vf_tier<B, vf::sin>(k);
+    case vf::cos:
+        return vf_tier<B, vf::cos>(k);
+    case vf::sincos:
+        return vf_tier<B, vf::sincos>(k);
+    case vf::cosisin:
+        return vf_tier<B, vf::cosisin>(k);
+    case vf::pow:
+        return vf_tier<B, vf::pow>(k);
+    case vf::rsqrt:
+        return vf_tier<B, vf::rsqrt>(k);
+    case vf::tanh:
+        return vf_tier<B, vf::tanh>(k);
+    }
+}
+
+inline __VDSP_NOCONTRACT void vf_baseline(const vf_call& k) { vf_run<16>(k); }
+
+#if defined(__VDSP_X86_DISPATCH)
+inline __attribute__((target("avx2"))) __VDSP_NOCONTRACT void vf_avx2(const vf_call& k) { vf_run<32>(k); }
+
+inline __attribute__((target("avx512f"))) __VDSP_NOCONTRACT void vf_avx512(const vf_call& k) { vf_run<64>(k); }
+#endif
+
+inline void dispatch(const vf_call& k)
+{
+    switch ((isa)active().load(std::memory_order_relaxed)) {
+#if defined(__VDSP_X86_DISPATCH)
+    case isa::avx512:
+        return vf_avx512(k);
+    case isa::avx2:
+        return vf_avx2(k);
+#endif
+    default:
+        return vf_baseline(k);
+    }
+}
+
+inline std::atomic<int>& tier()
+{
+    static std::atomic<int> slot((int)accuracy::ulp1);
+    return slot;
+}
+
+inline void vf_apply(vf op, accuracy a, float* y, float* z, const float* x, const float* e, const int* n)
+{
+    if (*n > 0)
+        dispatch({ op, a, y, z, x, e, (vDSP_Length)*n });
+}
+
+} // namespace detail
+
+// The tier the vForce routines without an accuracy argument run at.
+inline accuracy active_accuracy() { return (accuracy)detail::tier().load(std::memory_order_relaxed); }
+
+// Runs those routines at a from now on, in all threads.
+inline void select_accuracy(accuracy a) { detail::tier().store((int)a, std::memory_order_relaxed); }
+
+// e**x.
+inline void vvexpf(float *__y, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::exp, __a, __y, nullptr, __x, nullptr, __n);
+}
+
+inline void vvexpf(float *__y, const float *__x, const int *__n) { vvexpf(__y, __x, __n, active_accuracy()); }
+
+// 2**x.
+inline void vvexp2f(float *__y, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::exp2, __a, __y, nullptr, __x, nullptr, __n);
+}
+
+inline void vvexp2f(float *__y, const float *__x, const int *__n) { vvexp2f(__y, __x, __n, active_accuracy()); }
+
+// Natural logarithm.
+inline void vvlogf(float *__y, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::log, __a, __y, nullptr, __x, nullptr, __n);
+}
+
+inline void vvlogf(float *__y, const float *__x, const int *__n) { vvlogf(__y, __x, __n, active_accuracy()); }
+
+// Base 2 logarithm.
+inline void vvlog2f(float *__y, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::log2, __a, __y, nullptr, __x, nullptr, __n);
+}
+
+inline void vvlog2f(float *__y, const float *__x, const int *__n) { vvlog2f(__y, __x, __n, active_accuracy()); }
+
+// Sine, in radians.
+inline void vvsinf(float *__y, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::sin, __a, __y, nullptr, __x, nullptr, __n);
+}
+
+inline void vvsinf(float *__y, const float *__x, const int *__n) { vvsinf(__y, __x, __n, active_accuracy()); }
+
+// Cosine, in radians.
+inline void vvcosf(float *__y, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::cos, __a, __y, nullptr, __x, nullptr, __n);
+}
+
+inline void vvcosf(float *__y, const float *__x, const int *__n) { vvcosf(__y, __x, __n, active_accuracy()); }
+
+// Sine into z and cosine into y.
+inline void vvsincosf(float *__z, float *__y, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::sincos, __a, __y, __z, __x, nullptr, __n);
+}
+
+inline void vvsincosf(float *__z, float *__y, const float *__x, const int *__n)
+{
+    vvsincosf(__z, __y, __x, __n, active_accuracy());
+}
+
+// cos(x) + I*sin(x).
+inline void vvcosisinf(std::complex<float> *__C, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::cosisin, __a, reinterpret_cast<float*>(__C), nullptr, __x, nullptr, __n);
+}
+
+inline void vvcosisinf(std::complex<float> *__C, const float *__x, const int *__n)
+{
+    vvcosisinf(__C, __x, __n, active_accuracy());
+}
+
+// x raised to the power y, into z.  Note the order: exponent, then base.
+inline void vvpowf(float *__z, const float *__y, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::pow, __a, __z, nullptr, __x, __y, __n);
+}
+
+inline void vvpowf(float *__z, const float *__y, const float *__x, const int *__n)
+{
+    vvpowf(__z, __y, __x, __n, active_accuracy());
+}
+
+// 1/sqrt(x).
+inline void vvrsqrtf(float *__y, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::rsqrt, __a, __y, nullptr, __x, nullptr, __n);
+}
+
+inline void vvrsqrtf(float *__y, const float *__x, const int *__n) { vvrsqrtf(__y, __x, __n, active_accuracy()); }
+
+// Hyperbolic tangent.
+inline void vvtanhf(float *__y, const float *__x, const int *__n, accuracy __a)
+{
+    detail::vf_apply(detail::vf::tanh, __a, __y, nullptr, __x, nullptr, __n);
+}
+
+inline void vvtanhf(float *__y, const float *__x, const int *__n) { vvtanhf(__y, __x, __n, active_accuracy()); }
+
+} // namespace vdsp
+
+#endif /* __cplusplus */
+
+#endif /* __VFORCE_PORTABLE__ */
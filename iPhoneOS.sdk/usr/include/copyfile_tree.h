@@ -0,0 +1,671 @@
+/*
+ * copyfile_tree.h
+ *
+ * A parallel, clone-aware directory tree copier.
+ *
+ * copyfile(3) with COPYFILE_RECURSIVE walks and copies a hierarchy one file
+ * at a time.  darwin::tree_copier splits the same job into three pipelined
+ * phases:
+ *
+ *  walk       One thread traverses the source with fts(3), creates the
+ *             destination directories and symbolic links immediately, and
+ *             queues every regular file.
+ *
+ *  data       A pool of workers copies queued files.  Each file is first
+ *             cloned (clonefile(2) on Darwin, the FICLONE reflink ioctl on
+ *             Linux).  If the file system cannot clone, the file is sized
+ *             with ftruncate(2) and split into chunks that any worker may
+ *             copy; chunks skip holes with SEEK_DATA/SEEK_HOLE, so sparse
+ *             files stay sparse.  On Linux chunks use copy_file_range(2).
+ *
+ *  metadata   The worker that finishes a file's last chunk applies its mode,
+ *             times and (optionally) owner, and on Darwin its extended
+ *             attributes and ACL via fcopyfile(3).  Directory metadata is
+ *             applied deepest-first once every file has landed, so copying
+ *             into a directory never trips over its final permissions.
+ *
+ * When options::clone_tree is set and the source is a directory, a single
+ * clonefile(2) of the whole hierarchy is tried first.  If it succeeds the
+ * clone is walked once more to fill in the report, every regular file
+ * counting as cloned.
+ *
+ * Hard links are copied as independent files.  Special files are skipped
+ * and counted.
+ */
+
+#ifndef _COPYFILE_TREE_H_
+#define _COPYFILE_TREE_H_
+
+#if defined(__cplusplus)
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <copyfile.h>
+#include <sys/clonefile.h>
+#elif defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace darwin {
+
+/*!
+ * @abstract Counters and per-phase timings from one tree_copier::copy().
+ *
+ * @discussion
+ * wall_ns is elapsed time.  The *_ns phase fields are summed across every
+ * thread that worked in that phase, so data_ns may exceed wall_ns.
+ */
+struct tree_copy_report {
+	uint64_t files = 0;
+	uint64_t directories = 0;
+	uint64_t symlinks = 0;
+	uint64_t skipped = 0;		/* sockets, fifos, devices */
+	uint64_t files_cloned = 0;
+	uint64_t bytes_cloned = 0;
+	uint64_t bytes_copied = 0;	/* data actually moved */
+	uint64_t bytes_sparse = 0;	/* holes preserved, not written */
+	uint64_t chunks = 0;
+
+	uint64_t wall_ns = 0;
+	uint64_t walk_ns = 0;
+	uint64_t data_ns = 0;
+	uint64_t metadata_ns = 0;
+	uint64_t directory_metadata_ns = 0;
+
+	struct error {
+		std::string path;
+		int code;
+	};
+	std::vector<error> errors;
+
+	/*! @abstract Logical bytes per second: copied, cloned and sparse.     */
+	double throughput() const {
+		return wall_ns ? (double)(bytes_copied + bytes_cloned + bytes_sparse) * 1e9 / (double)wall_ns : 0.0;
+	}
+};
+
+class tree_copier {
+public:
+	struct options {
+		/*! Worker threads; 0 selects std::thread::hardware_concurrency(). */
+		unsigned threads = 0;
+		/*! Files larger than this are split into chunks of this size.    */
+		uint64_t chunk_size = 8ull << 20;
+		/*! Try clonefile(2)/FICLONE before copying data.                  */
+		bool clone = true;
+		/*! Try one clonefile(2) of the whole tree first (Darwin only).    */
+		bool clone_tree = false;
+		/*! Preserve uid/gid; failures with EPERM are ignored.             */
+		bool preserve_owner = false;
+		/*! Copy extended attributes and ACLs (Darwin only).               */
+		bool preserve_xattrs = true;
+		/*! Stop at the first error instead of copying what can be copied. */
+		bool stop_on_error = false;
+		/*! Maximum queued files before the walk waits for workers.         */
+		size_t max_queued = 4096;
+	};
+
+	tree_copier() = default;
+	explicit tree_copier(const options &opt) : opt_(opt) {}
+
+	/*!
+	 * @abstract Copies the hierarchy at src to dst.
+	 *
+	 * @discussion
+	 * dst must not exist unless src is a regular file.
+	 *
+	 * @result
+	 * 0 on success.  -1 if anything failed, with errno set to the first
+	 * error; every failure is listed in report.errors.
+	 */
+	int copy(const char *src, const char *dst, tree_copy_report &report) {
+		report = tree_copy_report();
+		run r(opt_, report);
+		uint64_t start = now_ns();
+		r.execute(src, dst);
+		report.wall_ns = now_ns() - start;
+		if (!report.errors.empty()) {
+			errno = report.errors.front().code;
+			return -1;
+		}
+		return 0;
+	}
+
+private:
+	options opt_;
+
+	static uint64_t now_ns() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+	}
+
+	struct file_ctx {
+		std::string src, dst;
+		struct stat st;
+		int in = -1, out = -1;
+		std::atomic<uint64_t> remaining{ 0 };
+		std::atomic<bool> failed{ false };
+		~file_ctx() {
+			if (in >= 0)
+				close(in);
+			if (out >= 0)
+				close(out);
+		}
+	};
+
+	struct job {
+		std::shared_ptr<file_ctx> file;
+		uint64_t offset;
+		uint64_t length;	/* 0: open/clone the file and plan chunks */
+	};
+
+	struct dir_meta {
+		std::string src, path;
+		struct stat st;
+	};
+
+	class run {
+	public:
+		run(const options &opt, tree_copy_report &rep) : opt_(opt), rep_(rep) {}
+
+		void execute(const char *src, const char *dst) {
+			struct stat st;
+			if (lstat(src, &st) < 0) {
+				fail(src, errno);
+				return;
+			}
+
+#if defined(__APPLE__)
+			if (opt_.clone_tree && S_ISDIR(st.st_mode)) {
+				uint64_t t = now_ns();
+				int r = clonefile(src, dst, CLONE_NOFOLLOW);
+				rep_.data_ns += now_ns() - t;
+				if (r == 0) {
+					t = now_ns();
+					count_cloned(dst);
+					rep_.walk_ns = now_ns() - t;
+					return;
+				}
+			}
+#endif
+
+			unsigned n = opt_.threads ? opt_.threads : std::thread::hardware_concurrency();
+			if (n == 0)
+				n = 1;
+			std::vector<std::thread> workers;
+			for (unsigned i = 0; i < n; i++)
+				workers.emplace_back(&run::work, this);
+
+			uint64_t t = now_ns();
+			walk(src, dst, st);
+			rep_.walk_ns = now_ns() - t;
+
+			{
+				std::lock_guard<std::mutex> g(mu_);
+				walking_ = false;
+			}
+			cv_.notify_all();
+			for (auto &w : workers)
+				w.join();
+
+			/* Deepest directories first, so parents are still writable. */
+			t = now_ns();
+			std::stable_sort(dirs_.begin(), dirs_.end(), [](const dir_meta &a, const dir_meta &b) {
+				return depth(a.path) > depth(b.path);
+			});
+			for (const dir_meta &d : dirs_) {
+#if defined(__APPLE__)
+				if (opt_.preserve_xattrs &&
+				    copyfile(d.src.c_str(), d.path.c_str(), nullptr, COPYFILE_XATTR | COPYFILE_ACL) < 0)
+					fail(d.path, errno);
+#endif
+				apply_path_meta(d.path.c_str(), d.st, false);
+			}
+			rep_.directory_metadata_ns = now_ns() - t;
+
+			rep_.data_ns = data_ns_.load();
+			rep_.metadata_ns = meta_ns_.load();
+			rep_.files_cloned += files_cloned_.load();
+			rep_.bytes_cloned = bytes_cloned_.load();
+			rep_.bytes_copied = bytes_copied_.load();
+			rep_.bytes_sparse = bytes_sparse_.load();
+			rep_.chunks = chunks_.load();
+		}
+
+	private:
+		const options &opt_;
+		tree_copy_report &rep_;
+
+		std::mutex mu_;
+		std::condition_variable cv_;		/* work available or walk finished */
+		std::condition_variable space_cv_;	/* queue drained below max_queued */
+		std::deque<job> queue_;
+		size_t files_queued_ = 0;
+		unsigned active_ = 0;			/* workers holding a job */
+		bool walking_ = true;
+		bool abort_ = false;
+
+		std::mutex err_mu_;
+		std::vector<dir_meta> dirs_;
+
+		std::atomic<uint64_t> data_ns_{ 0 }, meta_ns_{ 0 };
+		std::atomic<uint64_t> files_cloned_{ 0 }, bytes_cloned_{ 0 };
+		std::atomic<uint64_t> bytes_copied_{ 0 }, bytes_sparse_{ 0 }, chunks_{ 0 };
+
+		static size_t depth(const std::string &p) {
+			return (size_t)std::count(p.begin(), p.end(), '/');
+		}
+
+		void fail(const std::string &path, int code) {
+			std::lock_guard<std::mutex> g(err_mu_);
+			rep_.errors.push_back(tree_copy_report::error{ path, code });
+			if (opt_.stop_on_error) {
+				std::lock_guard<std::mutex> q(mu_);
+				abort_ = true;
+			}
+		}
+
+		bool aborted() {
+			std::lock_guard<std::mutex> g(mu_);
+			return abort_;
+		}
+
+		void enqueue_file(std::string src, std::string dst, const struct stat &st) {
+			auto f = std::make_shared<file_ctx>();
+			f->src = std::move(src);
+			f->dst = std::move(dst);
+			f->st = st;
+			std::unique_lock<std::mutex> g(mu_);
+			space_cv_.wait(g, [&] { return files_queued_ < opt_.max_queued || abort_; });
+			queue_.push_back(job{ std::move(f), 0, 0 });
+			files_queued_++;
+			g.unlock();
+			cv_.notify_one();
+		}
+
+		void walk(const char *src, const char *dst, const struct stat &root_st) {
+			if (!S_ISDIR(root_st.st_mode)) {
+				if (S_ISREG(root_st.st_mode)) {
+					rep_.files++;
+					enqueue_file(src, dst, root_st);
+				} else {
+					copy_other(src, dst, root_st);
+				}
+				return;
+			}
+
+			char *paths[] = { const_cast<char *>(src), nullptr };
+			FTS *fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, nullptr);
+			if (!fts) {
+				fail(src, errno);
+				return;
+			}
+			/*
+			 * Entries are named relative to src without its trailing
+			 * slashes, whatever fts keeps of them, and joined to dst with
+			 * exactly one.
+			 */
+			size_t root_len = strlen(src);
+			while (root_len > 1 && src[root_len - 1] == '/')
+				root_len--;
+			std::string base(dst);
+			while (base.size() > 1 && base.back() == '/')
+				base.pop_back();
+			FTSENT *e;
+			while ((e = fts_read(fts)) != nullptr) {
+				if (aborted())
+					break;
+				std::string to = base;
+				if (e->fts_level > 0) {
+					const char *rel = e->fts_path + std::min(root_len, (size_t)e->fts_pathlen);
+					while (*rel == '/')
+						rel++;
+					if (to.empty() || to.back() != '/')
+						to += '/';
+					to += rel;
+				}
+				switch (e->fts_info) {
+				case FTS_D:
+					/* Owner-writable until its metadata lands at the end. */
+					if (mkdir(to.c_str(), (e->fts_statp->st_mode & 07777) | S_IRWXU) < 0 &&
+					    !(errno == EEXIST && e->fts_level > 0)) {
+						fail(to, errno);
+						fts_set(fts, e, FTS_SKIP);
+						break;
+					}
+					rep_.directories++;
+					dirs_.push_back(dir_meta{ e->fts_path, to, *e->fts_statp });
+					break;
+				case FTS_F:
+					rep_.files++;
+					enqueue_file(e->fts_path, std::move(to), *e->fts_statp);
+					break;
+				case FTS_SL:
+				case FTS_SLNONE:
+				case FTS_DEFAULT:
+					copy_other(e->fts_path, to, *e->fts_statp);
+					break;
+				case FTS_DNR:
+				case FTS_ERR:
+				case FTS_NS:
+					fail(e->fts_path, e->fts_errno);
+					break;
+				default:
+					break;
+				}
+			}
+			fts_close(fts);
+		}
+
+		/* Fills in the counts for a hierarchy cloned in one call. */
+		void count_cloned(const char *dst) {
+			char *paths[] = { const_cast<char *>(dst), nullptr };
+			FTS *fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, nullptr);
+			if (!fts) {
+				fail(dst, errno);
+				return;
+			}
+			FTSENT *e;
+			while ((e = fts_read(fts)) != nullptr) {
+				switch (e->fts_info) {
+				case FTS_D:
+					rep_.directories++;
+					break;
+				case FTS_F:
+					rep_.files++;
+					rep_.files_cloned++;
+					rep_.bytes_cloned += (uint64_t)e->fts_statp->st_size;
+					break;
+				case FTS_SL:
+				case FTS_SLNONE:
+					rep_.symlinks++;
+					break;
+				case FTS_DNR:
+				case FTS_ERR:
+				case FTS_NS:
+					fail(e->fts_path, e->fts_errno);
+					break;
+				default:
+					break;
+				}
+			}
+			fts_close(fts);
+		}
+
+		void copy_other(const char *src, const std::string &dst, const struct stat &st) {
+			if (!S_ISLNK(st.st_mode)) {
+				rep_.skipped++;
+				return;
+			}
+			std::vector<char> target((size_t)st.st_size + 1 > 1024 ? (size_t)st.st_size + 1 : 1024);
+			ssize_t len = readlink(src, target.data(), target.size() - 1);
+			if (len < 0) {
+				fail(src, errno);
+				return;
+			}
+			target[(size_t)len] = '\0';
+			if (symlink(target.data(), dst.c_str()) < 0) {
+				fail(dst, errno);
+				return;
+			}
+			rep_.symlinks++;
+			apply_path_meta(dst.c_str(), st, true);
+		}
+
+		void apply_path_meta(const char *path, const struct stat &st, bool is_link) {
+			int flags = is_link ? AT_SYMLINK_NOFOLLOW : 0;
+			if (opt_.preserve_owner &&
+			    fchownat(AT_FDCWD, path, st.st_uid, st.st_gid, flags) < 0 && errno != EPERM)
+				fail(path, errno);
+			if (!is_link && chmod(path, st.st_mode & 07777) < 0)
+				fail(path, errno);
+			struct timespec times[2];
+#if defined(__APPLE__)
+			times[0] = st.st_atimespec;
+			times[1] = st.st_mtimespec;
+#else
+			times[0] = st.st_atim;
+			times[1] = st.st_mtim;
+#endif
+			if (utimensat(AT_FDCWD, path, times, flags) < 0 && !is_link)
+				fail(path, errno);
+		}
+
+		void work() {
+			for (;;) {
+				job j;
+				{
+					std::unique_lock<std::mutex> g(mu_);
+					/* A busy worker may still split a file into more chunks. */
+					cv_.wait(g, [&] { return !queue_.empty() || (!walking_ && active_ == 0) || abort_; });
+					if (queue_.empty() || abort_) {
+						cv_.notify_all();
+						space_cv_.notify_all();
+						return;
+					}
+					j = std::move(queue_.front());
+					queue_.pop_front();
+					active_++;
+					if (j.length == 0) {
+						files_queued_--;
+						space_cv_.notify_one();
+					}
+				}
+				uint64_t t = now_ns();
+				if (j.length == 0)
+					start_file(j.file);
+				else
+					copy_chunk(j);
+				data_ns_ += now_ns() - t;
+				j.file.reset();
+				{
+					std::lock_guard<std::mutex> g(mu_);
+					active_--;
+				}
+				cv_.notify_all();
+			}
+		}
+
+		void push_chunks(std::vector<job> &chunks) {
+			if (chunks.empty())
+				return;
+			{
+				std::lock_guard<std::mutex> g(mu_);
+				for (job &c : chunks)
+					queue_.push_back(std::move(c));
+			}
+			cv_.notify_all();
+		}
+
+		void start_file(const std::shared_ptr<file_ctx> &f) {
+			uint64_t size = (uint64_t)f->st.st_size;
+
+#if defined(__APPLE__)
+			if (opt_.clone && clonefile(f->src.c_str(), f->dst.c_str(), CLONE_NOFOLLOW) == 0) {
+				files_cloned_++;
+				bytes_cloned_ += size;
+				/* clonefile(2) already carried over mode, times and xattrs. */
+				if (opt_.preserve_owner && lchown(f->dst.c_str(), f->st.st_uid, f->st.st_gid) < 0 && errno != EPERM)
+					fail(f->dst, errno);
+				return;
+			}
+#endif
+
+			f->in = open(f->src.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+			if (f->in < 0) {
+				fail(f->src, errno);
+				return;
+			}
+			f->out = open(f->dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+			    (f->st.st_mode & 0777) | S_IWUSR);
+			if (f->out < 0) {
+				fail(f->dst, errno);
+				return;
+			}
+
+#if defined(__linux__) && defined(FICLONE)
+			if (opt_.clone && ioctl(f->out, FICLONE, f->in) == 0) {
+				files_cloned_++;
+				bytes_cloned_ += size;
+				finish_file(*f);
+				return;
+			}
+#endif
+
+			if (ftruncate(f->out, (off_t)size) < 0) {
+				fail(f->dst, errno);
+				return;
+			}
+			if (size == 0) {
+				finish_file(*f);
+				return;
+			}
+
+			uint64_t chunk = opt_.chunk_size ? opt_.chunk_size : size;
+			uint64_t count = (size + chunk - 1) / chunk;
+			f->remaining.store(count);
+			std::vector<job> rest;
+			for (uint64_t i = 1; i < count; i++) {
+				uint64_t off = i * chunk;
+				rest.push_back(job{ f, off, std::min(chunk, size - off) });
+			}
+			push_chunks(rest);
+			copy_chunk(job{ f, 0, std::min(chunk, size) });
+		}
+
+		void copy_chunk(const job &j) {
+			file_ctx &f = *j.file;
+			chunks_++;
+			if (!f.failed.load(std::memory_order_relaxed) && !copy_range(f, j.offset, j.offset + j.length)) {
+				f.failed.store(true);
+			}
+			if (f.remaining.fetch_sub(1) == 1 && !f.failed.load())
+				finish_file(f);
+		}
+
+		/* Copies the data regions of [begin, end); holes are left as holes. */
+		bool copy_range(file_ctx &f, uint64_t begin, uint64_t end) {
+			uint64_t pos = begin;
+			while (pos < end) {
+				uint64_t data = pos, hole = end;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+				off_t d = lseek(f.in, (off_t)pos, SEEK_DATA);
+				if (d < 0) {
+					if (errno == ENXIO) {
+						bytes_sparse_ += end - pos;	/* trailing hole */
+						return true;
+					}
+					d = (off_t)pos;		/* no hole support here */
+				}
+				data = (uint64_t)d;
+				if (data >= end) {
+					bytes_sparse_ += end - pos;
+					return true;
+				}
+				off_t h = lseek(f.in, (off_t)data, SEEK_HOLE);
+				hole = h < 0 ? end : std::min(end, (uint64_t)h);
+#endif
+				bytes_sparse_ += data - pos;
+				if (!copy_data(f, data, hole))
+					return false;
+				pos = hole;
+			}
+			return true;
+		}
+
+		bool copy_data(file_ctx &f, uint64_t begin, uint64_t end) {
+#if defined(__linux__)
+			while (begin < end) {
+				loff_t in_off = (loff_t)begin, out_off = (loff_t)begin;
+				ssize_t n = copy_file_range(f.in, &in_off, f.out, &out_off, (size_t)(end - begin), 0);
+				if (n <= 0)
+					break;		/* fall back to read/write below */
+				begin += (uint64_t)n;
+				bytes_copied_ += (uint64_t)n;
+			}
+#endif
+			static constexpr size_t buffer_size = 1 << 20;
+			std::unique_ptr<char[]> buf;
+			while (begin < end) {
+				if (!buf)
+					buf.reset(new char[buffer_size]);
+				size_t want = (size_t)std::min<uint64_t>(buffer_size, end - begin);
+				ssize_t n = pread(f.in, buf.get(), want, (off_t)begin);
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n <= 0) {
+					fail(f.src, n < 0 ? errno : EIO);
+					return false;
+				}
+				ssize_t off = 0;
+				while (off < n) {
+					ssize_t w = pwrite(f.out, buf.get() + off, (size_t)(n - off), (off_t)(begin + (uint64_t)off));
+					if (w < 0 && errno == EINTR)
+						continue;
+					if (w < 0) {
+						fail(f.dst, errno);
+						return false;
+					}
+					off += w;
+				}
+				begin += (uint64_t)n;
+				bytes_copied_ += (uint64_t)n;
+			}
+			return true;
+		}
+
+		void finish_file(file_ctx &f) {
+			uint64_t t = now_ns();
+#if defined(__APPLE__)
+			if (opt_.preserve_xattrs &&
+			    fcopyfile(f.in, f.out, nullptr, COPYFILE_XATTR | COPYFILE_ACL) < 0)
+				fail(f.dst, errno);
+#endif
+			if (opt_.preserve_owner && fchown(f.out, f.st.st_uid, f.st.st_gid) < 0 && errno != EPERM)
+				fail(f.dst, errno);
+			if (fchmod(f.out, f.st.st_mode & 07777) < 0)
+				fail(f.dst, errno);
+			struct timespec times[2];
+#if defined(__APPLE__)
+			times[0] = f.st.st_atimespec;
+			times[1] = f.st.st_mtimespec;
+#else
+			times[0] = f.st.st_atim;
+			times[1] = f.st.st_mtim;
+#endif
+			if (futimens(f.out, times) < 0)
+				fail(f.dst, errno);
+			/* Runs inside a data-phase job; move its time to this phase. */
+			uint64_t elapsed = now_ns() - t;
+			meta_ns_ += elapsed;
+			data_ns_ -= elapsed;
+		}
+	};
+};
+
+} /* namespace darwin */
+
+#endif /* __cplusplus */
+
+#endif /* _COPYFILE_TREE_H_ */
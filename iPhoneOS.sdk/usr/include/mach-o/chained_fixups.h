@@ -0,0 +1,628 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Decoder for the LC_DYLD_CHAINED_FIXUPS payload described in
+ * <mach-o/fixup-chains.h>.
+ *
+ * macho::chained_fixups validates the payload of a macho::image once (the
+ * starts tables and the imports table).  It can then:
+ *
+ *  - walk every chain serially, calling back once per fixup (for_each);
+ *  - decode all fixups into a macho::fixup_records structure-of-arrays
+ *    buffer, spreading pages across threads (decode);
+ *  - write the final pointer values into a copy of the image that is laid
+ *    out as it would be in memory, for a given load address (apply).
+ *
+ * Chains cannot be walked in parallel within a page, because each link
+ * gives the offset of the next.  Pages are independent, so decode() splits
+ * the work by page.  It makes one pass to count and validate the fixups on
+ * each page, then a second pass that writes every page straight into its
+ * own slot of the output arrays.  apply() works from the decoded arrays in
+ * fixed-size blocks: a branch-free pass over the SoA columns computes the
+ * values, then a scatter pass stores them.
+ *
+ * All pointer formats in fixup-chains.h are decoded.  Rebase targets are
+ * normalised to an offset from the image's preferred load address, whether
+ * the format stores a vmaddr or a runtime offset, so the records do not
+ * depend on the format.
+ */
+
+#ifndef __MACH_O_CHAINED_FIXUPS__
+#define __MACH_O_CHAINED_FIXUPS__
+
+#if defined(__cplusplus)
+
+#include <mach-o/image_view.h>
+#include <mach-o/fixup-chains.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace macho {
+
+// One decoded fixup.
+struct fixup {
+    enum : uint8_t {
+        rebase    = 0,      // target is an offset from the preferred load address
+        bind      = 1,      // target is an index into the imports table
+        value     = 2,      // DYLD_CHAINED_PTR_32 non-pointer; target is the raw value
+        kind_mask = 3,
+        ptr32     = 4,      // the location holds a 32-bit pointer
+        auth      = 8,      // arm64e authenticated pointer
+    };
+
+    uint64_t location;      // offset of the fixup from the preferred load address
+    uint64_t target;
+    int64_t  addend;        // binds only
+    uint16_t diversity;     // auth only
+    uint8_t  flags;
+    uint8_t  high8;         // top byte to set on rebased pointers
+    uint8_t  auth_bits;     // key (bits 0-1), address diversity (bit 2), cache level (bits 3-4)
+
+    unsigned kind() const { return flags & kind_mask; }
+    bool     is_auth() const { return (flags & auth) != 0; }
+    bool     is_32() const { return (flags & ptr32) != 0; }
+    unsigned key() const { return auth_bits & 3; }
+    bool     addr_div() const { return (auth_bits & 4) != 0; }
+    unsigned cache_level() const { return (auth_bits >> 3) & 3; }
+};
+
+// Structure-of-arrays storage for decoded fixups, in page order.
+struct fixup_records {
+    std::vector<uint64_t> location;
+    std::vector<uint64_t> target;
+    std::vector<int64_t>  addend;
+    std::vector<uint16_t> diversity;
+    std::vector<uint8_t>  flags;
+    std::vector<uint8_t>  high8;
+    std::vector<uint8_t>  auth_bits;
+
+    size_t size() const { return location.size(); }
+    bool   empty() const { return location.empty(); }
+
+    void resize(size_t n)
+    {
+        location.resize(n);
+        target.resize(n);
+        addend.resize(n);
+        diversity.resize(n);
+        flags.resize(n);
+        high8.resize(n);
+        auth_bits.resize(n);
+    }
+
+    void clear() { resize(0); }
+
+    void set(size_t i, const fixup& f)
+    {
+        location[i]  = f.location;
+        target[i]    = f.target;
+        addend[i]    = f.addend;
+        diversity[i] = f.diversity;
+        flags[i]     = f.flags;
+        high8[i]     = f.high8;
+        auth_bits[i] = f.auth_bits;
+    }
+
+    fixup operator[](size_t i) const
+    {
+        return fixup{ location[i], target[i], addend[i], diversity[i], flags[i], high8[i], auth_bits[i] };
+    }
+};
+
+// One entry of the imports table.
+struct chained_import {
+    int              lib_ordinal;   // dylib ordinal, or BIND_SPECIAL_DYLIB_*
+    bool             weak_import;
+    int64_t          addend;
+    std::string_view name;
+};
+
+class chained_fixups {
+public:
+    chained_fixups() = default;
+
+    // Validates the LC_DYLD_CHAINED_FIXUPS payload of img.  An image without
+    // the command opens successfully with no fixups.
+    static chained_fixups open(const image& img)
+    {
+        chained_fixups cf;
+        cf._status = cf.validate(img);
+        return cf;
+    }
+
+    bool     valid() const { return _status == status::ok; }
+    status   error() const { return _status; }
+    uint32_t imports_count() const { return _header ? _header->imports_count : 0; }
+    uint32_t imports_format() const { return _header ? _header->imports_format : 0; }
+
+    // Total number of pages that have at least one chain.
+    size_t page_count() const { return _pages.size(); }
+
+    // Returns an empty import (ordinal 0, no name) if i is out of range or
+    // the payload has no imports table.
+    chained_import import_at(uint32_t i) const
+    {
+        chained_import imp{ 0, false, 0, {} };
+        size_t         size = import_size();
+        if (!_header || size == 0 || i >= _header->imports_count ||
+            !_payload.contains(_header->imports_offset + (uint64_t)i * size, size))
+            return imp;
+        const uint8_t* base = _payload.data + _header->imports_offset;
+        uint64_t       name_offset;
+        switch (_header->imports_format) {
+        case DYLD_CHAINED_IMPORT: {
+            dyld_chained_import e;
+            memcpy(&e, base + i * sizeof(e), sizeof(e));
+            imp = chained_import{ special_ordinal(e.lib_ordinal, 8), e.weak_import != 0, 0, {} };
+            name_offset = e.name_offset;
+            break;
+        }
+        case DYLD_CHAINED_IMPORT_ADDEND: {
+            dyld_chained_import_addend e;
+            memcpy(&e, base + i * sizeof(e), sizeof(e));
+            imp = chained_import{ special_ordinal(e.lib_ordinal, 8), e.weak_import != 0, e.addend, {} };
+            name_offset = e.name_offset;
+            break;
+        }
+        default: {
+            dyld_chained_import_addend64 e;
+            memcpy(&e, base + i * sizeof(e), sizeof(e));
+            imp = chained_import{ special_ordinal((uint32_t)e.lib_ordinal, 16), e.weak_import != 0,
+                                  (int64_t)e.addend, {} };
+            name_offset = e.name_offset;
+            break;
+        }
+        }
+        uint64_t start = (uint64_t)_header->symbols_offset + name_offset;
+        if (start < _payload.size) {
+            const char* s = reinterpret_cast<const char*>(_payload.data + start);
+            imp.name = std::string_view(s, strnlen(s, _payload.size - start));
+        }
+        return imp;
+    }
+
+    // Calls fn(const fixup&) for every fixup, in page order.  Stops and
+    // returns the error if a chain is malformed.
+    template <typename Fn>
+    status for_each(Fn&& fn) const
+    {
+        for (const page_ref& p : _pages) {
+            status s = walk_page(p, fn);
+            if (s != status::ok)
+                return s;
+        }
+        return status::ok;
+    }
+
+    // Decodes every fixup into out, using up to threads workers (0 means
+    // one per core).  On error out is left empty.
+    status decode(fixup_records& out, unsigned threads = 0) const
+    {
+        out.clear();
+        if (_status != status::ok)
+            return _status;
+        size_t npages = _pages.size();
+        if (npages == 0)
+            return status::ok;
+
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        size_t nblocks = (npages + pages_per_block - 1) / pages_per_block;
+        if (threads > nblocks)
+            threads = (unsigned)nblocks;
+
+        // Pass 1: count and validate each page.
+        std::vector<uint32_t> counts(npages + 1, 0);
+        std::atomic<int>      failure{ (int)status::ok };
+        run_blocks(threads, npages, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                uint32_t n = 0;
+                status   s = walk_page(_pages[i], [&](const fixup&) { ++n; });
+                if (s != status::ok) {
+                    failure.store((int)s, std::memory_order_relaxed);
+                    return;
+                }
+                counts[i + 1] = n;
+            }
+        });
+        if (failure.load() != (int)status::ok)
+            return (status)failure.load();
+
+        for (size_t i = 0; i < npages; ++i)
+            counts[i + 1] += counts[i];
+        out.resize(counts[npages]);
+
+        // Pass 2: each page writes its own slice of the output.
+        run_blocks(threads, npages, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                size_t slot = counts[i];
+                walk_page(_pages[i], [&](const fixup& f) { out.set(slot++, f); });
+            }
+        });
+        return status::ok;
+    }
+
+    // Writes final pointer values into base, which holds the image laid out
+    // by vm offset (segment N at base + vmaddr(N) - preferred load address)
+    // and is size bytes long.  import_values[i] is the resolved address of
+    // import i, without addend: a bind stores it plus the import's addend
+    // from the imports table plus the fixup's own addend.  Authenticated
+    // pointers are signed when built with pointer authentication, and
+    // written unsigned otherwise.
+    status apply(const fixup_records& r, uint8_t* base, size_t size, uint64_t load_address,
+                 const uint64_t* import_values, size_t import_count) const
+    {
+        const size_t   n = r.size();
+        uint64_t       values[apply_block];
+        const int64_t* import_addend = _import_addends.empty() ? nullptr : _import_addends.data();
+        const size_t   import_addends = _import_addends.size();
+
+        for (size_t first = 0; first < n; first += apply_block) {
+            size_t count = std::min(apply_block, n - first);
+            const uint64_t* loc    = &r.location[first];
+            const uint64_t* target = &r.target[first];
+            const int64_t*  addend = &r.addend[first];
+            const uint8_t*  flags  = &r.flags[first];
+            const uint8_t*  high8  = &r.high8[first];
+
+            // Validate the block before touching memory.
+            for (size_t i = 0; i < count; ++i) {
+                size_t width = (flags[i] & fixup::ptr32) ? 4 : 8;
+                if (loc[i] > size || size - loc[i] < width)
+                    return status::truncated;
+                if ((flags[i] & fixup::kind_mask) == fixup::bind &&
+                    (target[i] >= import_count || (import_addend && target[i] >= import_addends)))
+                    return status::bad_load_command;
+            }
+
+            // Compute: every branch of the select is evaluated, so the loop
+            // has no data-dependent control flow.
+            for (size_t i = 0; i < count; ++i) {
+                unsigned kind    = flags[i] & fixup::kind_mask;
+                uint64_t rebased = (load_address + target[i]) | ((uint64_t)high8[i] << 56);
+                uint64_t ord     = kind == fixup::bind ? target[i] : 0;
+                uint64_t extra   = import_addend ? (uint64_t)import_addend[ord] : 0;
+                uint64_t bound   = (import_count ? import_values[ord] : 0) + extra + (uint64_t)addend[i];
+                uint64_t v       = kind == fixup::rebase ? rebased : target[i];
+                values[i]        = kind == fixup::bind ? bound : v;
+            }
+
+            // Store.
+            for (size_t i = 0; i < count; ++i) {
+                uint8_t* p = base + loc[i];
+                uint64_t v = values[i];
+                if (flags[i] & fixup::auth)
+                    v = sign(v, r[first + i], p);
+                if (flags[i] & fixup::ptr32) {
+                    uint32_t v32 = (uint32_t)v;
+                    memcpy(p, &v32, sizeof(v32));
+                } else {
+                    memcpy(p, &v, sizeof(v));
+                }
+            }
+        }
+        return status::ok;
+    }
+
+private:
+    struct segment_info {
+        const dyld_chained_starts_in_segment* starts;
+        uint64_t fileoff;       // of the segment in the image bytes
+        uint64_t filesize;
+    };
+
+    struct page_ref {
+        uint32_t segment;       // index into _segments
+        uint32_t page;
+    };
+
+    static constexpr size_t pages_per_block = 16;
+    static constexpr size_t apply_block     = 256;
+
+    span                               _payload;
+    span                               _bytes;
+    const dyld_chained_fixups_header*  _header = nullptr;
+    uint64_t                           _load_address = 0;
+    std::vector<segment_info>          _segments;
+    std::vector<page_ref>              _pages;
+    std::vector<int64_t>               _import_addends;  // empty unless an import has one
+    status                             _status = status::bad_magic;
+
+    size_t import_size() const
+    {
+        switch (_header ? _header->imports_format : 0) {
+        case DYLD_CHAINED_IMPORT:          return sizeof(dyld_chained_import);
+        case DYLD_CHAINED_IMPORT_ADDEND:   return sizeof(dyld_chained_import_addend);
+        case DYLD_CHAINED_IMPORT_ADDEND64: return sizeof(dyld_chained_import_addend64);
+        default:                           return 0;
+        }
+    }
+
+    static int special_ordinal(uint32_t raw, unsigned bits)
+    {
+        // The top three values of the field are the negative BIND_SPECIAL_DYLIB_* ordinals.
+        uint32_t max = (1u << bits) - 1;
+        return raw > max - 3 ? (int)raw - (int)max - 1 : (int)raw;
+    }
+
+    static unsigned stride(uint16_t format)
+    {
+        switch (format) {
+        case DYLD_CHAINED_PTR_ARM64E:
+        case DYLD_CHAINED_PTR_ARM64E_USERLAND:
+            return 8;
+        default:
+            return 4;
+        }
+    }
+
+    static bool is_32bit(uint16_t format)
+    {
+        return format == DYLD_CHAINED_PTR_32 || format == DYLD_CHAINED_PTR_32_CACHE ||
+               format == DYLD_CHAINED_PTR_32_FIRMWARE;
+    }
+
+    template <typename Body>
+    static void run_blocks(unsigned threads, size_t npages, Body body)
+    {
+        const size_t        nblocks = (npages + pages_per_block - 1) / pages_per_block;
+        std::atomic<size_t> next{ 0 };
+        auto worker = [&] {
+            for (;;) {
+                size_t b = next.fetch_add(1, std::memory_order_relaxed);
+                if (b >= nblocks)
+                    return;
+                body(b * pages_per_block, std::min((b + 1) * pages_per_block, npages));
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; ++i)
+            pool.emplace_back(worker);
+        worker();
+        for (std::thread& t : pool)
+            t.join();
+    }
+
+    // Decodes the pointer at raw into f and returns the next delta (in
+    // strides).  location is already set.
+    unsigned decode_pointer(uint16_t format, uint64_t raw, uint32_t max_valid_pointer, fixup& f) const
+    {
+        f.target = 0;
+        f.addend = 0;
+        f.diversity = 0;
+        f.flags = 0;
+        f.high8 = 0;
+        f.auth_bits = 0;
+
+        switch (format) {
+        case DYLD_CHAINED_PTR_ARM64E:
+        case DYLD_CHAINED_PTR_ARM64E_KERNEL:
+        case DYLD_CHAINED_PTR_ARM64E_USERLAND:
+        case DYLD_CHAINED_PTR_ARM64E_FIRMWARE: {
+            bool is_bind = (raw >> 62) & 1;
+            bool is_auth = (raw >> 63) & 1;
+            if (is_auth) {
+                f.flags     = fixup::auth;
+                f.diversity = (uint16_t)(raw >> 32);
+                f.auth_bits = (uint8_t)(((raw >> 49) & 3) | (((raw >> 48) & 1) << 2));
+                f.target    = is_bind ? (raw & 0xffff) : (raw & 0xffffffff);
+            } else if (is_bind) {
+                f.target = raw & 0xffff;
+                f.addend = (int64_t)(((raw >> 32) & 0x7ffff) << 45) >> 45;    // sign-extend 19 bits
+            } else {
+                f.target = raw & 0x7ffffffffffULL;
+                f.high8  = (uint8_t)(raw >> 43);
+                if (format == DYLD_CHAINED_PTR_ARM64E || format == DYLD_CHAINED_PTR_ARM64E_FIRMWARE)
+                    f.target -= _load_address;
+            }
+            f.flags |= is_bind ? fixup::bind : fixup::rebase;
+            return (unsigned)((raw >> 51) & 0x7ff);
+        }
+        case DYLD_CHAINED_PTR_64:
+        case DYLD_CHAINED_PTR_64_OFFSET:
+            if (raw >> 63) {
+                f.flags  = fixup::bind;
+                f.target = raw & 0xffffff;
+                f.addend = (int64_t)((raw >> 24) & 0xff);
+            } else {
+                f.flags  = fixup::rebase;
+                f.target = raw & 0xfffffffffULL;
+                f.high8  = (uint8_t)(raw >> 36);
+                if (format == DYLD_CHAINED_PTR_64)
+                    f.target -= _load_address;
+            }
+            return (unsigned)((raw >> 51) & 0xfff);
+        case DYLD_CHAINED_PTR_64_KERNEL_CACHE:
+            f.flags     = fixup::rebase | ((raw >> 63) ? fixup::auth : 0);
+            f.target    = raw & 0x3fffffff;
+            f.diversity = (uint16_t)(raw >> 32);
+            f.auth_bits = (uint8_t)(((raw >> 49) & 3) | (((raw >> 48) & 1) << 2) | (((raw >> 30) & 3) << 3));
+            return (unsigned)((raw >> 51) & 0xfff);
+        case DYLD_CHAINED_PTR_32: {
+            uint32_t v = (uint32_t)raw;
+            if (v >> 31) {
+                f.flags  = fixup::bind | fixup::ptr32;
+                f.target = v & 0xfffff;
+                f.addend = (v >> 20) & 0x3f;
+            } else {
+                uint32_t target = v & 0x3ffffff;
+                if (target > max_valid_pointer) {
+                    // A non-pointer value co-opted into the chain.
+                    uint32_t bias = (0x04000000 + max_valid_pointer) / 2;
+                    f.flags  = fixup::value | fixup::ptr32;
+                    f.target = target - bias;
+                } else {
+                    f.flags  = fixup::rebase | fixup::ptr32;
+                    f.target = target - _load_address;
+                }
+            }
+            return (v >> 26) & 0x1f;
+        }
+        case DYLD_CHAINED_PTR_32_CACHE:
+            f.flags  = fixup::rebase | fixup::ptr32;
+            f.target = (uint32_t)raw & 0x3fffffff;
+            return (uint32_t)raw >> 30;
+        default:    // DYLD_CHAINED_PTR_32_FIRMWARE
+            f.flags  = fixup::rebase | fixup::ptr32;
+            f.target = ((uint32_t)raw & 0x3ffffff) - _load_address;
+            return (uint32_t)raw >> 26;
+        }
+    }
+
+    template <typename Fn>
+    status walk_chain(const segment_info& seg, uint32_t page, uint32_t offset, Fn&& fn) const
+    {
+        const dyld_chained_starts_in_segment* s = seg.starts;
+        const uint16_t format   = s->pointer_format;
+        const unsigned step     = stride(format);
+        const unsigned width    = is_32bit(format) ? 4 : 8;
+        const uint64_t page_off = (uint64_t)page * s->page_size;
+
+        for (;;) {
+            uint64_t in_seg = page_off + offset;
+            if (offset + width > s->page_size || in_seg + width > seg.filesize)
+                return status::bad_load_command;
+            uint64_t raw = 0;
+            memcpy(&raw, _bytes.data + seg.fileoff + in_seg, width);
+
+            fixup    f;
+            unsigned next = decode_pointer(format, raw, s->max_valid_pointer, f);
+            f.location = s->segment_offset + in_seg;
+            if (f.kind() == fixup::bind && f.target >= _header->imports_count)
+                return status::bad_load_command;
+            fn(f);
+            if (next == 0)
+                return status::ok;
+            offset += next * step;
+        }
+    }
+
+    template <typename Fn>
+    status walk_page(const page_ref& p, Fn&& fn) const
+    {
+        const segment_info& seg   = _segments[p.segment];
+        const uint16_t*     start = seg.starts->page_start;
+        uint16_t            first = start[p.page];
+
+        if ((first & DYLD_CHAINED_PTR_START_MULTI) == 0)
+            return walk_chain(seg, p.page, first, fn);
+
+        // Overflow list of starts for this page, terminated by START_LAST.
+        uint32_t index = first & ~DYLD_CHAINED_PTR_START_MULTI;
+        for (;;) {
+            if (!overflow_in_range(seg, index))
+                return status::bad_load_command;
+            uint16_t e = start[index++];
+            status   st = walk_chain(seg, p.page, e & ~DYLD_CHAINED_PTR_START_LAST, fn);
+            if (st != status::ok)
+                return st;
+            if (e & DYLD_CHAINED_PTR_START_LAST)
+                return status::ok;
+        }
+    }
+
+    bool overflow_in_range(const segment_info& seg, uint32_t index) const
+    {
+        uint64_t at = (uint64_t)((const uint8_t*)&seg.starts->page_start[index] - (const uint8_t*)seg.starts);
+        return at + sizeof(uint16_t) <= seg.starts->size;
+    }
+
+    status validate(const image& img)
+    {
+        if (!img.valid())
+            return img.error();
+        _bytes        = img.bytes();
+        _load_address = img.preferred_load_address();
+
+        const linkedit_data_command* lc = img.command<linkedit_data_command>(LC_DYLD_CHAINED_FIXUPS);
+        if (!lc)
+            return status::ok;
+        _payload = _bytes.subspan(lc->dataoff, lc->datasize);
+        if (_payload.empty())
+            return status::truncated;
+        _header = _payload.at<dyld_chained_fixups_header>(0);
+        if (!_header)
+            return _payload.size < sizeof(dyld_chained_fixups_header) ? status::truncated : status::bad_alignment;
+        if (_header->fixups_version != 0 || _header->symbols_format != 0)
+            return status::unsupported;
+
+        size_t isize = import_size();
+        if (isize == 0)
+            return status::unsupported;
+        if (!_payload.contains(_header->imports_offset, (uint64_t)_header->imports_count * isize) ||
+            _header->symbols_offset > _payload.size)
+            return status::truncated;
+        if (_header->imports_format != DYLD_CHAINED_IMPORT) {
+            for (uint32_t i = 0; i < _header->imports_count; ++i) {
+                int64_t a = import_at(i).addend;
+                if (a != 0 && _import_addends.empty())
+                    _import_addends.resize(_header->imports_count, 0);
+                if (a != 0)
+                    _import_addends[i] = a;
+            }
+        }
+
+        const uint32_t* seg_count = _payload.at<uint32_t>(_header->starts_offset);
+        if (!seg_count || !_payload.contains(_header->starts_offset, 4 + (uint64_t)*seg_count * 4))
+            return status::truncated;
+
+        std::vector<segment_ref> segs;
+        for (segment_ref seg : img.segments())
+            segs.push_back(seg);
+        if (*seg_count > segs.size())
+            return status::bad_load_command;
+
+        const uint32_t* seg_info_offset = seg_count + 1;
+        for (uint32_t i = 0; i < *seg_count; ++i) {
+            if (seg_info_offset[i] == 0)
+                continue;
+            uint64_t at = (uint64_t)_header->starts_offset + seg_info_offset[i];
+            const dyld_chained_starts_in_segment* s = _payload.at<dyld_chained_starts_in_segment>(at);
+            if (!s)
+                return status::truncated;
+            if (s->size < offsetof(dyld_chained_starts_in_segment, page_start) + 2ull * s->page_count ||
+                !_payload.contains(at, s->size))
+                return status::truncated;
+            if (s->page_size == 0 || (s->page_size & (s->page_size - 1)) != 0 ||
+                s->pointer_format < DYLD_CHAINED_PTR_ARM64E || s->pointer_format > DYLD_CHAINED_PTR_ARM64E_FIRMWARE)
+                return status::bad_load_command;
+            if (!_bytes.contains(segs[i].fileoff(), segs[i].filesize()))
+                return status::truncated;
+
+            uint32_t index = (uint32_t)_segments.size();
+            _segments.push_back(segment_info{ s, segs[i].fileoff(), segs[i].filesize() });
+            for (uint32_t page = 0; page < s->page_count; ++page)
+                if (s->page_start[page] != DYLD_CHAINED_PTR_START_NONE)
+                    _pages.push_back(page_ref{ index, page });
+        }
+        return status::ok;
+    }
+
+    static uint64_t sign(uint64_t v, const fixup& f, void* location)
+    {
+#if defined(__has_feature)
+#if __has_feature(ptrauth_calls)
+        uint64_t disc = f.diversity;
+        if (f.addr_div())
+            disc = __builtin_ptrauth_blend_discriminator(location, disc);
+        switch (f.key()) {
+        case 0:  return (uint64_t)__builtin_ptrauth_sign_unauthenticated((void*)v, 0, disc);
+        case 1:  return (uint64_t)__builtin_ptrauth_sign_unauthenticated((void*)v, 1, disc);
+        case 2:  return (uint64_t)__builtin_ptrauth_sign_unauthenticated((void*)v, 2, disc);
+        default: return (uint64_t)__builtin_ptrauth_sign_unauthenticated((void*)v, 3, disc);
+        }
+#endif
+#endif
+        (void)f;
+        (void)location;
+        return v;
+    }
+};
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_CHAINED_FIXUPS__
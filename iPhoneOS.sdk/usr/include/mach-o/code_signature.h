@@ -0,0 +1,420 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Reader for the embedded code signature of a Mach-O image, and page hash
+ * verification.
+ *
+ * macho::code_signature parses the SuperBlob that LC_CODE_SIGNATURE points
+ * at: its slots (code directories, requirements, entitlements, CMS
+ * signature).  macho::code_directory is a bounds-checked view of one
+ * CodeDirectory blob, covering the fields up to version 0x20500 (scatter,
+ * team ID, 64-bit code limit, executable segment, runtime).  All blob
+ * fields are big-endian.
+ *
+ * hash_code_pages() recomputes the code slot hashes of an image: one hash
+ * per page of the file up to codeLimit.  Pages are handed out in blocks of
+ * 256 to worker threads, and each block is digested with sha256_batch(), so
+ * a worker hashes several pages at once in vector lanes.  verify() compares
+ * the result with the stored hashes.  When re-signing, the same output can
+ * be written into a new CodeDirectory.
+ *
+ * SHA-256 and truncated SHA-256 code directories are supported.  Images
+ * also signed with SHA-1 carry a SHA-256 directory in an alternate slot,
+ * which best_directory() picks.  Directories whose pages are described by
+ * scatter vectors, which current signing tools never emit, are reported as
+ * status::unsupported rather than hashed as contiguous pages.
+ *
+ * <kern/cs_blobs.h> is not part of this SDK, so the magic numbers and slot
+ * types needed here are defined below.
+ */
+
+#ifndef __MACH_O_CODE_SIGNATURE__
+#define __MACH_O_CODE_SIGNATURE__
+
+#if defined(__cplusplus)
+
+#include <mach-o/image_view.h>
+#include <mach-o/sha256.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace macho {
+
+enum : uint32_t {
+    cs_magic_requirements          = 0xfade0c01,
+    cs_magic_code_directory        = 0xfade0c02,
+    cs_magic_embedded_signature    = 0xfade0cc0,
+    cs_magic_embedded_entitlements = 0xfade7171,
+    cs_magic_blob_wrapper          = 0xfade0b01,
+};
+
+enum : uint32_t {
+    cs_slot_code_directory             = 0,
+    cs_slot_info                       = 1,
+    cs_slot_requirements               = 2,
+    cs_slot_resource_dir               = 3,
+    cs_slot_application                = 4,
+    cs_slot_entitlements               = 5,
+    cs_slot_der_entitlements           = 7,
+    cs_slot_alternate_code_directories = 0x1000,
+    cs_slot_alternate_code_directory_max = 5,
+    cs_slot_signature                  = 0x10000,
+};
+
+enum : uint8_t {
+    cs_hash_sha1             = 1,
+    cs_hash_sha256           = 2,
+    cs_hash_sha256_truncated = 3,
+    cs_hash_sha384           = 4,
+};
+
+namespace cs_detail {
+
+inline uint32_t be32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+inline uint64_t be64(const uint8_t* p) { return ((uint64_t)be32(p) << 32) | be32(p + 4); }
+
+constexpr size_t pages_per_block = 256;
+
+} // namespace cs_detail
+
+// Hashes the pages of code[0, code_limit) into out, hash_size bytes per
+// page.  page_shift is log2 of the page size; 0 hashes the whole range as
+// one page, as codesign does for pageSize 0.  Uses up to threads workers
+// (0 means one per CPU).
+inline status hash_code_pages(span code, uint64_t code_limit, unsigned page_shift, uint8_t hash_type,
+                              uint8_t* out, unsigned threads = 0)
+{
+    if (hash_type != cs_hash_sha256 && hash_type != cs_hash_sha256_truncated)
+        return status::unsupported;
+    if (code_limit > code.size || page_shift >= 32)
+        return status::truncated;
+    const size_t   hash_size = hash_type == cs_hash_sha256 ? 32 : 20;
+    const uint64_t page      = page_shift ? (1ULL << page_shift) : std::max<uint64_t>(code_limit, 1);
+    const size_t   npages    = (size_t)((code_limit + page - 1) / page);
+    const size_t   nblocks   = (npages + cs_detail::pages_per_block - 1) / cs_detail::pages_per_block;
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    if (threads > nblocks)
+        threads = (unsigned)std::max<size_t>(nblocks, 1);
+
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&] {
+        const void* data[cs_detail::pages_per_block];
+        size_t      len[cs_detail::pages_per_block];
+        uint8_t     md[cs_detail::pages_per_block][sha256::digest_length];
+        for (;;) {
+            size_t b = next.fetch_add(1, std::memory_order_relaxed);
+            if (b >= nblocks)
+                return;
+            size_t first = b * cs_detail::pages_per_block;
+            size_t n     = std::min(cs_detail::pages_per_block, npages - first);
+            for (size_t i = 0; i < n; ++i) {
+                uint64_t offset = (uint64_t)(first + i) * page;
+                data[i] = code.data + offset;
+                len[i]  = (size_t)std::min(page, code_limit - offset);
+            }
+            sha256_batch(data, len, n, md);
+            for (size_t i = 0; i < n; ++i)
+                memcpy(out + (first + i) * hash_size, md[i], hash_size);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& t : pool)
+        t.join();
+    return status::ok;
+}
+
+// One CodeDirectory blob.
+class code_directory {
+public:
+    code_directory() = default;
+
+    static code_directory open(span blob)
+    {
+        code_directory cd;
+        cd._status = cd.validate(blob);
+        return cd;
+    }
+
+    bool   valid() const { return _status == status::ok; }
+    status error() const { return _status; }
+    span   bytes() const { return _blob; }
+
+    uint32_t version() const { return field32(8); }
+    uint32_t flags() const { return field32(12); }
+    uint32_t special_slots() const { return field32(24); }
+    uint32_t code_slots() const { return field32(28); }
+    uint8_t  hash_size() const { return _blob.data[36]; }
+    uint8_t  hash_type() const { return _blob.data[37]; }
+    uint8_t  platform() const { return _blob.data[38]; }
+    unsigned page_shift() const { return _blob.data[39]; }
+
+    uint64_t code_limit() const
+    {
+        uint64_t limit64 = version() >= 0x20300 ? cs_detail::be64(_blob.data + 56) : 0;
+        return limit64 ? limit64 : field32(32);
+    }
+
+    std::string_view identifier() const { return string_at(field32(20)); }
+    std::string_view team_id() const { return version() >= 0x20200 ? string_at(field32(48)) : std::string_view(); }
+
+    uint64_t exec_segment_base() const { return version() >= 0x20400 ? cs_detail::be64(_blob.data + 64) : 0; }
+    uint64_t exec_segment_limit() const { return version() >= 0x20400 ? cs_detail::be64(_blob.data + 72) : 0; }
+    uint64_t exec_segment_flags() const { return version() >= 0x20400 ? cs_detail::be64(_blob.data + 80) : 0; }
+    uint32_t runtime() const { return version() >= 0x20500 ? field32(88) : 0; }
+    uint32_t scatter_offset() const { return version() >= 0x20100 ? field32(44) : 0; }
+
+    // Stored hash of code page i.
+    const uint8_t* code_hash(uint32_t i) const
+    {
+        return i < code_slots() ? _blob.data + field32(16) + (size_t)i * hash_size() : nullptr;
+    }
+
+    // Stored hash of special slot (cs_slot_info ... special_slots()).
+    const uint8_t* special_hash(uint32_t slot) const
+    {
+        return slot >= 1 && slot <= special_slots() ? _blob.data + field32(16) - (size_t)slot * hash_size() : nullptr;
+    }
+
+    bool hashes_supported() const
+    {
+        return (hash_type() == cs_hash_sha256 && hash_size() == 32) ||
+               (hash_type() == cs_hash_sha256_truncated && hash_size() == 20);
+    }
+
+    // Recomputes the code page hashes of code (the image's bytes) into out,
+    // code_slots() * hash_size() bytes.  Pages laid out by scatter vectors
+    // are not supported.
+    status hash_pages(span code, uint8_t* out, unsigned threads = 0) const
+    {
+        if (!hashes_supported() || scatter_offset() != 0)
+            return status::unsupported;
+        uint64_t limit = code_limit();
+        uint64_t pages = page_shift() ? (limit + (1ULL << page_shift()) - 1) >> page_shift() : (limit != 0);
+        if (pages != code_slots())
+            return status::bad_load_command;
+        return hash_code_pages(code, limit, page_shift(), hash_type(), out, threads);
+    }
+
+    // Checks every code page of code against its stored hash.  The numbers
+    // of pages that differ are left in mismatched.
+    status verify(span code, std::vector<uint32_t>& mismatched, unsigned threads = 0) const
+    {
+        mismatched.clear();
+        std::vector<uint8_t> hashes((size_t)code_slots() * hash_size());
+        status               s = hash_pages(code, hashes.data(), threads);
+        if (s != status::ok)
+            return s;
+        for (uint32_t i = 0; i < code_slots(); ++i)
+            if (memcmp(hashes.data() + (size_t)i * hash_size(), code_hash(i), hash_size()) != 0)
+                mismatched.push_back(i);
+        return status::ok;
+    }
+
+    // Checks a special slot's stored hash against the blob it covers.
+    bool verify_special_slot(uint32_t slot, span blob) const
+    {
+        const uint8_t* stored = special_hash(slot);
+        if (!stored || !hashes_supported())
+            return false;
+        uint8_t md[sha256::digest_length];
+        sha256_digest(blob.data, blob.size, md);
+        return memcmp(md, stored, hash_size()) == 0;
+    }
+
+private:
+    span   _blob;
+    status _status = status::truncated;
+
+    uint32_t field32(size_t offset) const { return cs_detail::be32(_blob.data + offset); }
+
+    std::string_view string_at(uint32_t offset) const
+    {
+        if (offset == 0 || offset >= _blob.size)
+            return std::string_view();
+        const char* s = reinterpret_cast<const char*>(_blob.data) + offset;
+        return std::string_view(s, strnlen(s, _blob.size - offset));
+    }
+
+    status validate(span blob)
+    {
+        _blob = blob;
+        if (blob.size < 44)
+            return status::truncated;
+        if (field32(0) != cs_magic_code_directory)
+            return status::bad_magic;
+        uint32_t length = field32(4);
+        if (length < 44 || length > blob.size)
+            return status::truncated;
+        _blob = blob.subspan(0, length);
+
+        uint32_t v      = version();
+        size_t   needed = v >= 0x20500 ? 92 : v >= 0x20400 ? 88 : v >= 0x20300 ? 64 : v >= 0x20200 ? 52 : v >= 0x20100 ? 48 : 44;
+        if (length < needed)
+            return status::truncated;
+
+        uint64_t hash_offset = field32(16);
+        uint64_t size        = hash_size();
+        if (size == 0 || page_shift() >= 32)
+            return status::bad_load_command;
+        if ((uint64_t)special_slots() * size > hash_offset)
+            return status::bad_load_command;
+        if (hash_offset + (uint64_t)code_slots() * size > length)
+            return status::truncated;
+        if (field32(20) >= length)
+            return status::bad_load_command;
+        return status::ok;
+    }
+};
+
+// The SuperBlob of an embedded signature.
+class code_signature {
+public:
+    code_signature() = default;
+
+    // The signature of img, from LC_CODE_SIGNATURE.
+    static code_signature open(const image& img)
+    {
+        if (!img.valid()) {
+            code_signature s;
+            s._status = img.error();
+            return s;
+        }
+        if (!img.find_command(LC_CODE_SIGNATURE).raw()) {
+            code_signature s;
+            s._status = status::unsupported;
+            return s;
+        }
+        span blob = img.linkedit_data(LC_CODE_SIGNATURE);
+        if (!blob.data) {
+            code_signature s;
+            s._status = status::truncated;
+            return s;
+        }
+        return open(blob);
+    }
+
+    static code_signature open(span superblob)
+    {
+        code_signature s;
+        s._status = s.validate(superblob);
+        return s;
+    }
+
+    bool   valid() const { return _status == status::ok; }
+    status error() const { return _status; }
+
+    uint32_t slot_count() const { return cs_detail::be32(_blob.data + 8); }
+    uint32_t slot_type(uint32_t i) const { return cs_detail::be32(_blob.data + 12 + 8 * i); }
+
+    // Bytes of slot i, or of the first slot of the given type.
+    span slot_at(uint32_t i) const
+    {
+        uint32_t offset = cs_detail::be32(_blob.data + 12 + 8 * i + 4);
+        return _blob.subspan(offset, cs_detail::be32(_blob.data + offset + 4));
+    }
+
+    span slot(uint32_t type) const
+    {
+        for (uint32_t i = 0; i < slot_count(); ++i)
+            if (slot_type(i) == type)
+                return slot_at(i);
+        return span();
+    }
+
+    // The primary code directory and the alternates.
+    std::vector<code_directory> directories() const
+    {
+        std::vector<code_directory> out;
+        for (uint32_t i = 0; i < slot_count(); ++i) {
+            uint32_t t = slot_type(i);
+            if (t == cs_slot_code_directory ||
+                (t >= cs_slot_alternate_code_directories &&
+                 t < cs_slot_alternate_code_directories + cs_slot_alternate_code_directory_max)) {
+                code_directory cd = code_directory::open(slot_at(i));
+                if (cd.valid())
+                    out.push_back(cd);
+            }
+        }
+        return out;
+    }
+
+    // The strongest directory whose hashes can be checked here: SHA-256,
+    // then truncated SHA-256.  Invalid if there is none.
+    code_directory best_directory() const
+    {
+        code_directory best;
+        for (const code_directory& cd : directories()) {
+            if (!cd.hashes_supported())
+                continue;
+            if (!best.valid() || (cd.hash_type() == cs_hash_sha256 && best.hash_type() != cs_hash_sha256))
+                best = cd;
+        }
+        return best;
+    }
+
+    // Checks the code pages of code (the image's bytes) and the special
+    // slots present (requirements, entitlements) against the best
+    // directory.  Mismatching code pages are listed in mismatched; a bad
+    // special slot is reported as status::bad_load_command.
+    status verify(span code, std::vector<uint32_t>& mismatched, unsigned threads = 0) const
+    {
+        mismatched.clear();
+        code_directory cd = best_directory();
+        if (!cd.valid())
+            return status::unsupported;
+        for (uint32_t type : { (uint32_t)cs_slot_requirements, (uint32_t)cs_slot_entitlements,
+                               (uint32_t)cs_slot_der_entitlements }) {
+            span blob = slot(type);
+            if (blob.data && cd.special_hash(type) && !cd.verify_special_slot(type, blob))
+                return status::bad_load_command;
+        }
+        return cd.verify(code, mismatched, threads);
+    }
+
+private:
+    span   _blob;
+    status _status = status::truncated;
+
+    status validate(span blob)
+    {
+        _blob = blob;
+        if (blob.size < 12)
+            return status::truncated;
+        if (cs_detail::be32(blob.data) != cs_magic_embedded_signature)
+            return status::bad_magic;
+        uint32_t length = cs_detail::be32(blob.data + 4);
+        if (length < 12 || length > blob.size)
+            return status::truncated;
+        _blob = blob.subspan(0, length);
+        uint32_t count = slot_count();
+        if ((uint64_t)count * 8 > length - 12)
+            return status::truncated;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t offset = cs_detail::be32(_blob.data + 12 + 8 * i + 4);
+            if (offset > length - 8 || offset < 12 + (uint64_t)count * 8)
+                return status::truncated;
+            uint32_t size = cs_detail::be32(_blob.data + offset + 4);
+            if (size < 8 || size > length - offset)
+                return status::truncated;
+        }
+        return status::ok;
+    }
+};
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_CODE_SIGNATURE__
@@ -0,0 +1,749 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Async-signal-safe arm64 stack unwinder driven by __TEXT,__unwind_info.
+ *
+ * macho::compact_unwinder decodes each image's __unwind_info (see
+ * <mach-o/compact_unwind_encoding.h>) once, when the image is added, into
+ * two flat arrays: function start offsets and their encodings.  Finding the
+ * encoding for a pc is then a branch-free binary search, with no paging
+ * through the two-level index.
+ *
+ * step() and unwind() take no locks, do not allocate and make no system
+ * calls, so they may be called from a signal handler (a sampling profiler's
+ * SIGPROF handler, say).  Every stack read is checked against the stack
+ * bounds passed in, and every read of unwind data against the section
+ * bounds.  A corrupt stack ends the walk early instead of faulting.
+ *
+ * Frames are unwound as follows:
+ *
+ *  UNWIND_ARM64_MODE_FRAME      restore fp/lr from [fp] and the saved
+ *                               register pairs just below it
+ *  UNWIND_ARM64_MODE_FRAMELESS  pop the encoded stack size and return to lr
+ *                               (only meaningful while lr is still live)
+ *  UNWIND_ARM64_MODE_DWARF      run the CFA program of the FDE in
+ *                               __eh_frame; only the DW_CFA_* rules that
+ *                               compilers emit for arm64 are supported
+ *  no entry                     follow the frame-pointer chain
+ *
+ * add_image() and remove_image() are not async-signal-safe.  They publish a
+ * new immutable snapshot of the image list with a single atomic store.
+ * Storage for snapshots and tables that have been replaced is kept until
+ * reclaim() is called (when no unwind can be in flight) or the unwinder is
+ * destroyed.
+ */
+
+#ifndef __MACH_O_COMPACT_UNWINDER__
+#define __MACH_O_COMPACT_UNWINDER__
+
+#if defined(__cplusplus)
+
+#include <mach-o/image_view.h>
+#include <mach-o/compact_unwind_encoding.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace macho {
+
+// Register state for one frame.  x[] holds x19..x28, d[] holds d8..d15.
+struct unwind_regs {
+    uint64_t pc = 0;
+    uint64_t sp = 0;
+    uint64_t fp = 0;
+    uint64_t lr = 0;
+    uint64_t x[10] = {};
+    uint64_t d[8]  = {};
+    bool     lr_valid = true;   // lr still holds this frame's return address
+};
+
+// Readable stack range, [low, high).
+struct stack_bounds {
+    uint64_t low;
+    uint64_t high;
+
+    bool read64(uint64_t addr, uint64_t& out) const
+    {
+        if ((addr & 7) != 0 || high < 8 || addr < low || addr > high - 8)
+            return false;
+        memcpy(&out, reinterpret_cast<const void*>((uintptr_t)addr), 8);
+        return true;
+    }
+};
+
+class compact_unwinder {
+public:
+    compact_unwinder() : _snapshot(nullptr) {}
+    compact_unwinder(const compact_unwinder&) = delete;
+    compact_unwinder& operator=(const compact_unwinder&) = delete;
+
+    // Adds an image loaded at base (the address of its mach_header) whose
+    // __TEXT ends at text_end.  eh_frame_addr is the runtime address of the
+    // first byte of eh_frame, used for pc-relative FDE pointers.  The
+    // section bytes must stay mapped until the image is removed.
+    bool add_image(uint64_t base, uint64_t text_end, span unwind_info, span eh_frame, uint64_t eh_frame_addr)
+    {
+        std::unique_ptr<table> t(new table());
+        t->base          = base;
+        t->end           = text_end;
+        t->eh_frame      = eh_frame;
+        t->eh_frame_addr = eh_frame_addr;
+        if (!unwind_info.empty() && !decode(unwind_info, *t))
+            return false;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        const table* raw = t.get();
+        _tables.push_back(std::move(t));
+        std::vector<const table*> list = current_list();
+        list.push_back(raw);
+        publish(std::move(list));
+        return true;
+    }
+
+    // Adds img, whose sections are read from its own bytes and whose
+    // runtime addresses are its vm addresses plus slide.
+    bool add_image(const image& img, uint64_t slide)
+    {
+        if (!img.valid())
+            return false;
+        segment_ref text;
+        if (!img.find_segment("__TEXT", text))
+            return false;
+        section_ref ui, eh;
+        span unwind_info, eh_frame;
+        uint64_t eh_addr = 0;
+        if (img.find_section("__TEXT", "__unwind_info", ui))
+            unwind_info = img.section_data(ui);
+        if (img.find_section("__TEXT", "__eh_frame", eh)) {
+            eh_frame = img.section_data(eh);
+            eh_addr  = eh.addr() + slide;
+        }
+        return add_image(text.vmaddr() + slide, text.vmaddr() + text.vmsize() + slide, unwind_info, eh_frame, eh_addr);
+    }
+
+    void remove_image(uint64_t base)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<const table*> list = current_list();
+        list.erase(std::remove_if(list.begin(), list.end(), [&](const table* t) { return t->base == base; }),
+                   list.end());
+        publish(std::move(list));
+        // The table itself stays in _tables until reclaim().
+        for (auto& t : _tables)
+            if (t && t->base == base)
+                t->retired = true;
+    }
+
+    // Frees replaced snapshots and removed tables.  Only call this when no
+    // step() or unwind() can be running.
+    void reclaim()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const snapshot* cur = _snapshot.load(std::memory_order_relaxed);
+        _snapshots.erase(std::remove_if(_snapshots.begin(), _snapshots.end(),
+                                        [&](const std::unique_ptr<snapshot>& s) { return s.get() != cur; }),
+                         _snapshots.end());
+        _tables.erase(std::remove_if(_tables.begin(), _tables.end(),
+                                     [](const std::unique_ptr<table>& t) { return t->retired; }),
+                      _tables.end());
+    }
+
+    // The encoding covering pc, or 0.  Sets function_start if found.
+    // Async-signal-safe.
+    compact_unwind_encoding_t encoding_for(uint64_t pc, uint64_t* function_start = nullptr) const
+    {
+        const table* t = find_table(pc);
+        if (!t)
+            return 0;
+        size_t i;
+        if (!t->lookup(pc, i))
+            return 0;
+        if (function_start)
+            *function_start = t->base + t->starts[i];
+        return t->encodings[i];
+    }
+
+    // Unwinds one frame in place.  top is true for the interrupted frame
+    // (whose pc is exact and whose lr may still be live).  Returns false at
+    // the end of the stack or if the frame cannot be unwound.
+    // Async-signal-safe.
+    bool step(unwind_regs& regs, const stack_bounds& stack, bool top) const
+    {
+        // Return addresses point after the call; look up the call itself.
+        uint64_t     pc = top ? regs.pc : regs.pc - 1;
+        const table* t  = find_table(pc);
+        size_t       i  = 0;
+        compact_unwind_encoding_t enc = 0;
+        if (t && t->lookup(pc, i))
+            enc = t->encodings[i];
+
+        switch (enc & UNWIND_ARM64_MODE_MASK) {
+        case UNWIND_ARM64_MODE_FRAME:
+            return step_frame(regs, stack, enc);
+        case UNWIND_ARM64_MODE_FRAMELESS:
+            return step_frameless(regs, stack, enc);
+        case UNWIND_ARM64_MODE_DWARF:
+            return step_dwarf(regs, stack, *t, enc & UNWIND_ARM64_DWARF_SECTION_OFFSET, pc);
+        default:
+            // No unwind info: assume a standard frame record.
+            return step_frame(regs, stack, UNWIND_ARM64_MODE_FRAME);
+        }
+    }
+
+    // Fills pcs with up to max return addresses, starting with regs.pc.
+    // Returns the number written.  Async-signal-safe.
+    size_t unwind(unwind_regs regs, const stack_bounds& stack, uint64_t* pcs, size_t max) const
+    {
+        size_t n = 0;
+        if (max == 0 || regs.pc == 0)
+            return 0;
+        pcs[n++] = regs.pc;
+        bool top = true;
+        while (n < max) {
+            uint64_t prev_sp = regs.sp;
+            if (!step(regs, stack, top))
+                break;
+            // The stack grows down, so each caller's sp must be higher.
+            if (regs.pc == 0 || regs.sp < prev_sp || (regs.sp == prev_sp && !top))
+                break;
+            pcs[n++] = regs.pc;
+            top = false;
+        }
+        return n;
+    }
+
+    size_t image_count() const
+    {
+        const snapshot* s = _snapshot.load(std::memory_order_acquire);
+        return s ? s->count : 0;
+    }
+
+private:
+    struct table {
+        uint64_t              base = 0, end = 0;
+        std::vector<uint32_t> starts;       // function offsets from base; last is the end sentinel
+        std::vector<uint32_t> encodings;
+        span                  eh_frame;
+        uint64_t              eh_frame_addr = 0;
+        bool                  retired = false;
+
+        // Index of the last start <= pc, if pc is inside a described range.
+        bool lookup(uint64_t pc, size_t& index) const
+        {
+            if (starts.size() < 2 || pc < base)
+                return false;
+            uint64_t off = pc - base;
+            if (off < starts.front() || off >= starts.back())
+                return false;
+            const uint32_t* p = starts.data();
+            size_t          n = starts.size() - 1;
+            while (n > 1) {
+                size_t half = n / 2;
+                p = (p[half] <= off) ? p + half : p;
+                n -= half;
+            }
+            index = (size_t)(p - starts.data());
+            return true;
+        }
+    };
+
+    struct snapshot {
+        size_t              count;
+        const table* const* tables;     // sorted by base
+        std::vector<const table*> storage;
+    };
+
+    std::mutex                              _mutex;
+    std::vector<std::unique_ptr<table>>     _tables;
+    std::vector<std::unique_ptr<snapshot>>  _snapshots;
+    std::atomic<const snapshot*>            _snapshot;
+
+    std::vector<const table*> current_list() const
+    {
+        const snapshot* s = _snapshot.load(std::memory_order_relaxed);
+        return s ? s->storage : std::vector<const table*>();
+    }
+
+    void publish(std::vector<const table*> list)
+    {
+        std::sort(list.begin(), list.end(), [](const table* a, const table* b) { return a->base < b->base; });
+        std::unique_ptr<snapshot> s(new snapshot());
+        s->storage = std::move(list);
+        s->count   = s->storage.size();
+        s->tables  = s->storage.data();
+        _snapshot.store(s.get(), std::memory_order_release);
+        _snapshots.push_back(std::move(s));
+    }
+
+    const table* find_table(uint64_t pc) const
+    {
+        const snapshot* s = _snapshot.load(std::memory_order_acquire);
+        if (!s || s->count == 0)
+            return nullptr;
+        size_t lo = 0, hi = s->count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (s->tables[mid]->base <= pc)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == 0)
+            return nullptr;
+        const table* t = s->tables[lo - 1];
+        return pc < t->end ? t : nullptr;
+    }
+
+    // Flattens the two-level index into t.starts/t.encodings.
+    static bool decode(span ui, table& t)
+    {
+        const unwind_info_section_header* h = ui.at<unwind_info_section_header>(0);
+        if (!h || h->version != UNWIND_SECTION_VERSION)
+            return false;
+        if ((h->commonEncodingsArraySectionOffset & 3) || (h->indexSectionOffset & 3))
+            return false;
+        if (!ui.contains(h->commonEncodingsArraySectionOffset, (uint64_t)h->commonEncodingsArrayCount * 4) ||
+            !ui.contains(h->indexSectionOffset, (uint64_t)h->indexCount * sizeof(unwind_info_section_header_index_entry)) ||
+            h->indexCount == 0)
+            return false;
+        const uint32_t* common = reinterpret_cast<const uint32_t*>(ui.data + h->commonEncodingsArraySectionOffset);
+        const unwind_info_section_header_index_entry* index =
+            reinterpret_cast<const unwind_info_section_header_index_entry*>(ui.data + h->indexSectionOffset);
+
+        auto emit = [&](uint32_t start, uint32_t enc) {
+            if (!t.starts.empty() && start < t.starts.back())
+                return false;
+            // Adjacent functions with one encoding share an entry, except
+            // DWARF entries, which carry per-function FDE offsets.
+            if (!t.encodings.empty() && t.encodings.back() == enc &&
+                (enc & UNWIND_ARM64_MODE_MASK) != UNWIND_ARM64_MODE_DWARF)
+                return true;
+            t.starts.push_back(start);
+            t.encodings.push_back(enc);
+            return true;
+        };
+
+        // The last index entry is a sentinel holding the end offset.
+        for (uint32_t i = 0; i + 1 < h->indexCount; ++i) {
+            uint32_t page = index[i].secondLevelPagesSectionOffset;
+            const uint32_t* kind = ui.at<uint32_t>(page);
+            if (!kind)
+                return false;
+            if (*kind == UNWIND_SECOND_LEVEL_REGULAR) {
+                const unwind_info_regular_second_level_page_header* ph =
+                    ui.at<unwind_info_regular_second_level_page_header>(page);
+                if (!ph)
+                    return false;
+                uint64_t entries = (uint64_t)page + ph->entryPageOffset;
+                if ((entries & 3) || !ui.contains(entries, (uint64_t)ph->entryCount * sizeof(unwind_info_regular_second_level_entry)))
+                    return false;
+                const unwind_info_regular_second_level_entry* e =
+                    reinterpret_cast<const unwind_info_regular_second_level_entry*>(ui.data + entries);
+                for (uint16_t j = 0; j < ph->entryCount; ++j)
+                    if (!emit(e[j].functionOffset, e[j].encoding))
+                        return false;
+            } else if (*kind == UNWIND_SECOND_LEVEL_COMPRESSED) {
+                const unwind_info_compressed_second_level_page_header* ph =
+                    ui.at<unwind_info_compressed_second_level_page_header>(page);
+                if (!ph)
+                    return false;
+                uint64_t entries = (uint64_t)page + ph->entryPageOffset;
+                uint64_t encs    = (uint64_t)page + ph->encodingsPageOffset;
+                if (!ui.contains(entries, (uint64_t)ph->entryCount * 4) ||
+                    !ui.contains(encs, (uint64_t)ph->encodingsCount * 4) || (entries & 3) || (encs & 3))
+                    return false;
+                const uint32_t* e     = reinterpret_cast<const uint32_t*>(ui.data + entries);
+                const uint32_t* local = reinterpret_cast<const uint32_t*>(ui.data + encs);
+                for (uint16_t j = 0; j < ph->entryCount; ++j) {
+                    uint32_t idx = UNWIND_INFO_COMPRESSED_ENTRY_ENCODING_INDEX(e[j]);
+                    uint32_t enc;
+                    if (idx < h->commonEncodingsArrayCount)
+                        enc = common[idx];
+                    else if (idx - h->commonEncodingsArrayCount < ph->encodingsCount)
+                        enc = local[idx - h->commonEncodingsArrayCount];
+                    else
+                        return false;
+                    if (!emit(index[i].functionOffset + UNWIND_INFO_COMPRESSED_ENTRY_FUNC_OFFSET(e[j]), enc))
+                        return false;
+                }
+            } else {
+                return false;
+            }
+        }
+        uint32_t end = index[h->indexCount - 1].functionOffset;
+        if (!t.starts.empty() && end < t.starts.back())
+            return false;
+        t.starts.push_back(end);
+        return true;
+    }
+
+    static uint64_t strip(uint64_t pc)
+    {
+#if defined(__has_feature)
+#if __has_feature(ptrauth_returns)
+        return (uint64_t)__builtin_ptrauth_strip((void*)pc, 0);
+#endif
+#endif
+        return pc;
+    }
+
+    // Restores saved x19..x28/d8..d15 pairs, stored downwards from loc.
+    static bool restore_pairs(unwind_regs& regs, const stack_bounds& stack, uint64_t loc, uint32_t enc)
+    {
+        for (unsigned pair = 0; pair < 5; ++pair) {
+            if (enc & (UNWIND_ARM64_FRAME_X19_X20_PAIR << pair)) {
+                if (!stack.read64(loc, regs.x[pair * 2]) || !stack.read64(loc - 8, regs.x[pair * 2 + 1]))
+                    return false;
+                loc -= 16;
+            }
+        }
+        for (unsigned pair = 0; pair < 4; ++pair) {
+            if (enc & (UNWIND_ARM64_FRAME_D8_D9_PAIR << pair)) {
+                if (!stack.read64(loc, regs.d[pair * 2]) || !stack.read64(loc - 8, regs.d[pair * 2 + 1]))
+                    return false;
+                loc -= 16;
+            }
+        }
+        return true;
+    }
+
+    static bool step_frame(unwind_regs& regs, const stack_bounds& stack, uint32_t enc)
+    {
+        uint64_t fp = regs.fp, saved_fp, saved_lr;
+        if (!stack.read64(fp, saved_fp) || !stack.read64(fp + 8, saved_lr))
+            return false;
+        if (!restore_pairs(regs, stack, fp - 8, enc))
+            return false;
+        regs.fp       = saved_fp;
+        regs.lr       = saved_lr;
+        regs.sp       = fp + 16;
+        regs.pc       = strip(saved_lr);
+        regs.lr_valid = false;
+        return true;
+    }
+
+    static bool step_frameless(unwind_regs& regs, const stack_bounds& stack, uint32_t enc)
+    {
+        if (!regs.lr_valid)
+            return false;
+        uint64_t size = (uint64_t)((enc & UNWIND_ARM64_FRAMELESS_STACK_SIZE_MASK) >> 12) * 16;
+        if (size && !restore_pairs(regs, stack, regs.sp + size - 8, enc))
+            return false;
+        regs.sp      += size;
+        regs.pc       = strip(regs.lr);
+        regs.lr_valid = false;
+        return true;
+    }
+
+    // --- DWARF CFA fallback ---------------------------------------------
+
+    enum { reg_fp = 29, reg_lr = 30, reg_sp = 31, reg_count = 32 };
+
+    struct cfa_rules {
+        uint32_t cfa_reg    = reg_sp;
+        int64_t  cfa_offset = 0;
+        int64_t  offset[reg_count];     // saved at CFA + offset
+        bool     saved[reg_count];
+        void clear() { for (int i = 0; i < reg_count; ++i) saved[i] = false; }
+    };
+
+    struct cie_info {
+        uint64_t       code_align = 1;
+        int64_t        data_align = 1;
+        uint8_t        fde_encoding = 0;    // DW_EH_PE_absptr
+        bool           has_augmentation_data = false;
+        const uint8_t* insns = nullptr;
+        const uint8_t* insns_end = nullptr;
+    };
+
+    struct reader {
+        const uint8_t* p;
+        const uint8_t* end;
+        uint64_t       addr_of_start;       // runtime address of eh_frame[0]
+        const uint8_t* start;
+        bool           ok = true;
+
+        uint8_t u8()
+        {
+            if (p >= end) {
+                ok = false;
+                return 0;
+            }
+            return *p++;
+        }
+        template <typename T>
+        T fixed()
+        {
+            T v = 0;
+            if ((size_t)(end - p) < sizeof(T)) {
+                ok = false;
+                return 0;
+            }
+            memcpy(&v, p, sizeof(T));
+            p += sizeof(T);
+            return v;
+        }
+        uint64_t uleb() { return read_uleb128(p, end, ok); }
+        int64_t  sleb() { return read_sleb128(p, end, ok); }
+
+        // Reads a DW_EH_PE_* encoded pointer.
+        uint64_t pointer(uint8_t enc)
+        {
+            uint64_t field = addr_of_start + (uint64_t)(p - start);
+            uint64_t v;
+            switch (enc & 0x0f) {
+            case 0x00: v = fixed<uint64_t>(); break;                       // absptr
+            case 0x01: v = uleb(); break;                                  // uleb128
+            case 0x02: v = fixed<uint16_t>(); break;                       // udata2
+            case 0x03: v = fixed<uint32_t>(); break;                       // udata4
+            case 0x04: v = fixed<uint64_t>(); break;                       // udata8
+            case 0x09: v = (uint64_t)sleb(); break;                        // sleb128
+            case 0x0a: v = (uint64_t)(int64_t)fixed<int16_t>(); break;     // sdata2
+            case 0x0b: v = (uint64_t)(int64_t)fixed<int32_t>(); break;     // sdata4
+            case 0x0c: v = (uint64_t)fixed<int64_t>(); break;              // sdata8
+            default:   ok = false; return 0;
+            }
+            switch (enc & 0x70) {
+            case 0x00: break;                   // absolute
+            case 0x10: v += field; break;       // pcrel
+            default:   ok = false; break;
+            }
+            return v;
+        }
+    };
+
+    static bool parse_cie(reader r, cie_info& cie)
+    {
+        uint32_t len32 = r.fixed<uint32_t>();
+        uint64_t len   = len32 == 0xffffffff ? r.fixed<uint64_t>() : len32;
+        if (!r.ok || len > (uint64_t)(r.end - r.p))
+            return false;
+        const uint8_t* end = r.p + len;
+        r.end = end;
+        if (r.fixed<uint32_t>() != 0)           // CIE id
+            return false;
+        uint8_t version = r.u8();
+        const char* aug = reinterpret_cast<const char*>(r.p);
+        size_t      aug_len = strnlen(aug, (size_t)(end - r.p));
+        if (aug_len == (size_t)(end - r.p))
+            return false;
+        r.p += aug_len + 1;
+        cie.code_align = r.uleb();
+        cie.data_align = r.sleb();
+        if (version == 1)
+            r.u8();
+        else
+            r.uleb();                           // return address register
+        if (aug_len && aug[0] == 'z') {
+            cie.has_augmentation_data = true;
+            uint64_t       alen = r.uleb();
+            const uint8_t* aend = r.p + alen;
+            if (!r.ok || alen > (uint64_t)(end - r.p))
+                return false;
+            for (size_t i = 1; i < aug_len; ++i) {
+                switch (aug[i]) {
+                case 'R': cie.fde_encoding = r.u8(); break;
+                case 'L': r.u8(); break;
+                case 'P': { uint8_t e = r.u8(); r.pointer(e); break; }
+                case 'S': break;
+                default:  return false;
+                }
+            }
+            r.p = aend;
+        }
+        cie.insns     = r.p;
+        cie.insns_end = end;
+        return r.ok;
+    }
+
+    // Executes CFA instructions until the location passes target.
+    static bool run_cfa(reader r, const cie_info& cie, uint64_t loc, uint64_t target, cfa_rules& rules,
+                        const cfa_rules& initial)
+    {
+        cfa_rules stack[4];
+        unsigned  depth = 0;
+        while (r.p < r.end && r.ok) {
+            uint8_t op  = r.u8();
+            uint8_t arg = op & 0x3f;
+            switch (op & 0xc0) {
+            case 0x40:                          // DW_CFA_advance_loc
+                loc += arg * cie.code_align;
+                if (loc > target)
+                    return true;
+                continue;
+            case 0x80:                          // DW_CFA_offset
+                if (arg >= reg_count)
+                    return false;
+                rules.saved[arg]  = true;
+                rules.offset[arg] = (int64_t)r.uleb() * cie.data_align;
+                continue;
+            case 0xc0:                          // DW_CFA_restore
+                if (arg >= reg_count)
+                    return false;
+                rules.saved[arg]  = initial.saved[arg];
+                rules.offset[arg] = initial.offset[arg];
+                continue;
+            }
+            uint64_t reg;
+            switch (op) {
+            case 0x00:                          // DW_CFA_nop
+                break;
+            case 0x02: loc += r.u8() * cie.code_align; if (loc > target) return true; break;
+            case 0x03: loc += r.fixed<uint16_t>() * cie.code_align; if (loc > target) return true; break;
+            case 0x04: loc += r.fixed<uint32_t>() * cie.code_align; if (loc > target) return true; break;
+            case 0x05:                          // DW_CFA_offset_extended
+            case 0x11:                          // DW_CFA_offset_extended_sf
+                reg = r.uleb();
+                if (reg >= reg_count)
+                    return false;
+                rules.saved[reg]  = true;
+                rules.offset[reg] = (op == 0x05 ? (int64_t)r.uleb() : r.sleb()) * cie.data_align;
+                break;
+            case 0x06:                          // DW_CFA_restore_extended
+                reg = r.uleb();
+                if (reg >= reg_count)
+                    return false;
+                rules.saved[reg]  = initial.saved[reg];
+                rules.offset[reg] = initial.offset[reg];
+                break;
+            case 0x07:                          // DW_CFA_undefined
+            case 0x08:                          // DW_CFA_same_value
+                reg = r.uleb();
+                if (reg >= reg_count)
+                    return false;
+                rules.saved[reg] = false;
+                break;
+            case 0x0a:                          // DW_CFA_remember_state
+                if (depth == 4)
+                    return false;
+                stack[depth++] = rules;
+                break;
+            case 0x0b:                          // DW_CFA_restore_state
+                if (depth == 0)
+                    return false;
+                rules = stack[--depth];
+                break;
+            case 0x0c:                          // DW_CFA_def_cfa
+                rules.cfa_reg    = (uint32_t)r.uleb();
+                rules.cfa_offset = (int64_t)r.uleb();
+                break;
+            case 0x12:                          // DW_CFA_def_cfa_sf
+                rules.cfa_reg    = (uint32_t)r.uleb();
+                rules.cfa_offset = r.sleb() * cie.data_align;
+                break;
+            case 0x0d:                          // DW_CFA_def_cfa_register
+                rules.cfa_reg = (uint32_t)r.uleb();
+                break;
+            case 0x0e:                          // DW_CFA_def_cfa_offset
+                rules.cfa_offset = (int64_t)r.uleb();
+                break;
+            case 0x13:                          // DW_CFA_def_cfa_offset_sf
+                rules.cfa_offset = r.sleb() * cie.data_align;
+                break;
+            case 0x2d:                          // DW_CFA_AARCH64_negate_ra_state
+                break;
+            case 0x2e:                          // DW_CFA_GNU_args_size
+                r.uleb();
+                break;
+            default:                            // expressions, register rules, set_loc
+                return false;
+            }
+        }
+        return r.ok;
+    }
+
+    static bool reg_value(const unwind_regs& regs, uint32_t reg, uint64_t& out)
+    {
+        if (reg >= 19 && reg <= 28)
+            out = regs.x[reg - 19];
+        else if (reg == reg_fp)
+            out = regs.fp;
+        else if (reg == reg_lr)
+            out = regs.lr;
+        else if (reg == reg_sp)
+            out = regs.sp;
+        else
+            return false;
+        return true;
+    }
+
+    static bool step_dwarf(unwind_regs& regs, const stack_bounds& stack, const table& t, uint32_t fde_offset,
+                           uint64_t pc)
+    {
+        span eh = t.eh_frame;
+        if (fde_offset >= eh.size)
+            return false;
+        reader r{ eh.data + fde_offset, eh.end(), t.eh_frame_addr, eh.data };
+        uint32_t len32 = r.fixed<uint32_t>();
+        if (len32 == 0xffffffff)
+            return false;                       // 64-bit DWARF is never emitted for Mach-O
+        if (!r.ok || len32 > (uint64_t)(r.end - r.p))
+            return false;
+        const uint8_t* fde_end = r.p + len32;
+        const uint8_t* id_at   = r.p;
+        uint32_t       cie_ptr = r.fixed<uint32_t>();
+        if (!r.ok || cie_ptr == 0 || cie_ptr > (uint64_t)(id_at - eh.data))
+            return false;
+
+        cie_info cie;
+        reader   cr{ id_at - cie_ptr, eh.end(), t.eh_frame_addr, eh.data };
+        if (!parse_cie(cr, cie))
+            return false;
+
+        r.end = fde_end;
+        uint64_t pc_begin = r.pointer(cie.fde_encoding);
+        uint64_t pc_range = r.pointer(cie.fde_encoding & 0x0f);
+        if (!r.ok || pc < pc_begin || pc - pc_begin >= pc_range)
+            return false;
+        if (cie.has_augmentation_data) {
+            uint64_t alen = r.uleb();
+            if (!r.ok || alen > (uint64_t)(r.end - r.p))
+                return false;
+            r.p += alen;
+        }
+
+        cfa_rules initial;
+        initial.clear();
+        reader ci{ cie.insns, cie.insns_end, t.eh_frame_addr, eh.data };
+        if (!run_cfa(ci, cie, 0, UINT64_MAX, initial, initial))
+            return false;
+        cfa_rules rules = initial;
+        if (!run_cfa(r, cie, pc_begin, pc, rules, initial))
+            return false;
+
+        uint64_t cfa;
+        if (!reg_value(regs, rules.cfa_reg, cfa))
+            return false;
+        cfa += (uint64_t)rules.cfa_offset;
+
+        unwind_regs next = regs;
+        for (uint32_t reg = 19; reg <= reg_lr; ++reg) {
+            if (!rules.saved[reg])
+                continue;
+            uint64_t v;
+            if (!stack.read64(cfa + (uint64_t)rules.offset[reg], v))
+                return false;
+            if (reg == reg_fp)
+                next.fp = v;
+            else if (reg == reg_lr)
+                next.lr = v;
+            else
+                next.x[reg - 19] = v;
+        }
+        if (!rules.saved[reg_lr] && !regs.lr_valid)
+            return false;
+        next.sp       = cfa;
+        next.pc       = strip(next.lr);
+        next.lr_valid = false;
+        regs = next;
+        return true;
+    }
+};
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_COMPACT_UNWINDER__
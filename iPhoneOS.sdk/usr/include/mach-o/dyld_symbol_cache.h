@@ -0,0 +1,315 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * In-process address-to-symbol cache kept current by dyld's image
+ * notifications.
+ *
+ * dladdr() takes dyld's global lock and scans the symbol table of the
+ * containing image on every call.  macho::dyld_symbol_cache does that work
+ * once per image instead.  When an image is added, its nlist table is read
+ * in place from the mapped __LINKEDIT segment (found with getsegmentdata()),
+ * and its defined symbols are sorted by address.  The result is published
+ * as part of an immutable snapshot with one atomic store.  lookup() only
+ * loads that pointer and does two binary searches: one over the mapped
+ * segments of every image, one over the symbols of the image found.  It
+ * takes no lock and never allocates, so any number of threads may
+ * symbolise concurrently with images being loaded.
+ *
+ * dyld_symbol_cache::shared() registers with
+ * _dyld_register_func_for_add_image() and
+ * _dyld_register_func_for_remove_image() the first time it is called.  dyld
+ * then reports every image already loaded and each one loaded later.
+ * Separate instances can be fed by hand with add() (for example, from
+ * images mapped off disk with <mach-o/image_view.h>), which also keeps the
+ * cache usable on platforms without dyld.
+ *
+ * Like dladdr(), a lookup reports the nearest preceding symbol.  Images in
+ * the shared cache have had their local symbols moved out of __LINKEDIT, so
+ * their addresses resolve to the nearest exported symbol.
+ *
+ * Snapshots and image tables that are no longer current are kept until
+ * reclaim() is called at a point where no lookup can be in flight.
+ * Images are rarely unloaded, so this costs little.
+ */
+
+#ifndef __MACH_O_DYLD_SYMBOL_CACHE__
+#define __MACH_O_DYLD_SYMBOL_CACHE__
+
+#if defined(__cplusplus)
+
+#include <mach-o/image_view.h>
+#include <mach-o/symbol_index.h>
+
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#include <mach-o/getsect.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace macho {
+
+struct cached_symbol {
+    const void*      image = nullptr;   // mach_header of the containing image
+    std::string_view image_name;        // install name; empty for the main executable
+    uint64_t         slide = 0;
+    std::string_view name;              // empty if no symbol precedes the address
+    uint64_t         address = 0;       // slid address of the symbol
+};
+
+class dyld_symbol_cache {
+public:
+    dyld_symbol_cache() : _snapshot(nullptr) {}
+    dyld_symbol_cache(const dyld_symbol_cache&) = delete;
+    dyld_symbol_cache& operator=(const dyld_symbol_cache&) = delete;
+
+    // The process-wide cache, fed by dyld.  Apple platforms only.
+    static dyld_symbol_cache& shared()
+    {
+        dyld_symbol_cache& cache = instance();
+#if defined(__APPLE__)
+        // dyld calls added() for every image already loaded before the
+        // registration returns, so the cache must exist by then and the
+        // callbacks must not come back through here.
+        static std::once_flag registered;
+        std::call_once(registered, [] {
+            _dyld_register_func_for_add_image(&added);
+            _dyld_register_func_for_remove_image(&removed);
+        });
+#endif
+        return cache;
+    }
+
+    // Indexes an image mapped by dyld at mh, with the given slide.
+    bool add(const void* mh, intptr_t slide)
+    {
+        const mach_header* h = static_cast<const mach_header*>(mh);
+        size_t hsize = h->magic == MH_MAGIC_64 ? sizeof(mach_header_64) : sizeof(mach_header);
+        image  hdr   = image::open(span(mh, hsize + h->sizeofcmds));
+        if (!hdr.valid())
+            return false;
+
+        std::unique_ptr<entry> e(new entry());
+        e->header     = mh;
+        e->slide      = (uint64_t)slide;
+        e->image_name = hdr.install_name();
+
+        const symtab_command* st = hdr.command<symtab_command>(LC_SYMTAB);
+        segment_ref linkedit;
+        if (st && hdr.find_segment("__LINKEDIT", linkedit)) {
+            uint64_t le_addr = linkedit.vmaddr() + (uint64_t)slide;
+#if defined(__APPLE__)
+#if __LP64__
+            typedef mach_header_64 native_header;
+#else
+            typedef mach_header native_header;
+#endif
+            unsigned long size = 0;
+            if (uint8_t* p = getsegmentdata(static_cast<const native_header*>(mh), "__LINKEDIT", &size))
+                le_addr = (uint64_t)(uintptr_t)p;
+#endif
+            // symoff/stroff are file offsets; __LINKEDIT maps fileoff to le_addr.
+            uint64_t base = le_addr - linkedit.fileoff();
+            e->table = symbol_table::from_memory(reinterpret_cast<const void*>((uintptr_t)(base + st->symoff)),
+                                                 st->nsyms,
+                                                 reinterpret_cast<const char*>((uintptr_t)(base + st->stroff)),
+                                                 st->strsize, hdr.is64());
+        }
+        build(*e, hdr, (uint64_t)slide);
+        insert(std::move(e), hdr);
+        return true;
+    }
+
+    // Indexes an image read from a file (img) as if loaded with slide.
+    // key identifies it for remove(); img's bytes must outlive the cache.
+    bool add(const image& img, uint64_t slide, const void* key)
+    {
+        if (!img.valid())
+            return false;
+        std::unique_ptr<entry> e(new entry());
+        e->header     = key;
+        e->slide      = slide;
+        e->image_name = img.install_name();
+        e->table      = symbol_table::open(img);
+        if (!e->table.valid())
+            return false;
+        build(*e, img, slide);
+        insert(std::move(e), img);
+        return true;
+    }
+
+    void remove(const void* mh)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        snapshot next = current();
+        next.images.erase(std::remove_if(next.images.begin(), next.images.end(),
+                                         [&](const entry* e) { return e->header == mh; }),
+                          next.images.end());
+        next.ranges.erase(std::remove_if(next.ranges.begin(), next.ranges.end(),
+                                         [&](const range& r) { return r.image->header == mh; }),
+                          next.ranges.end());
+        publish(std::move(next));
+        for (auto& e : _entries)
+            if (e->header == mh)
+                e->retired = true;
+    }
+
+    // Symbolises address.  Returns false if no indexed image contains it.
+    // Lock-free.
+    bool lookup(uint64_t address, cached_symbol& out) const
+    {
+        const snapshot* s = _snapshot.load(std::memory_order_acquire);
+        if (!s || s->ranges.empty())
+            return false;
+
+        auto it = std::upper_bound(s->ranges.begin(), s->ranges.end(), address,
+                                   [](uint64_t a, const range& r) { return a < r.lo; });
+        if (it == s->ranges.begin() || address >= (it - 1)->hi)
+            return false;
+        const entry* e = (it - 1)->image;
+
+        out = cached_symbol();
+        out.image      = e->header;
+        out.image_name = e->image_name;
+        out.slide      = e->slide;
+
+        size_t n = e->addresses.size();
+        if (n == 0 || address < e->addresses[0])
+            return true;
+        const uint64_t* base = e->addresses.data();
+        while (n > 1) {
+            size_t half = n / 2;
+            base = (base[half] <= address) ? base + half : base;
+            n -= half;
+        }
+        size_t i    = (size_t)(base - e->addresses.data());
+        out.address = *base;
+        out.name    = e->table.name(e->symbols[i]);
+        return true;
+    }
+
+    size_t image_count() const
+    {
+        const snapshot* s = _snapshot.load(std::memory_order_acquire);
+        return s ? s->images.size() : 0;
+    }
+
+    // Frees superseded snapshots and removed images.  Only call this when
+    // no lookup() can be running.
+    void reclaim()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const snapshot* cur = _snapshot.load(std::memory_order_relaxed);
+        _snapshots.erase(std::remove_if(_snapshots.begin(), _snapshots.end(),
+                                        [&](const std::unique_ptr<snapshot>& s) { return s.get() != cur; }),
+                         _snapshots.end());
+        _entries.erase(std::remove_if(_entries.begin(), _entries.end(),
+                                      [](const std::unique_ptr<entry>& e) { return e->retired; }),
+                       _entries.end());
+    }
+
+private:
+    struct entry {
+        const void*           header = nullptr;
+        uint64_t              slide  = 0;
+        std::string_view      image_name;
+        symbol_table          table;
+        std::vector<uint64_t> addresses;    // slid, sorted
+        std::vector<uint32_t> symbols;
+        bool                  retired = false;
+    };
+
+    struct range {
+        uint64_t     lo, hi;    // one mapped segment, slid
+        const entry* image;
+    };
+
+    struct snapshot {
+        std::vector<const entry*> images;
+        std::vector<range>        ranges;   // sorted by lo
+    };
+
+    std::mutex                             _mutex;
+    std::vector<std::unique_ptr<entry>>    _entries;
+    std::vector<std::unique_ptr<snapshot>> _snapshots;
+    std::atomic<const snapshot*>           _snapshot;
+
+    static dyld_symbol_cache& instance()
+    {
+        static dyld_symbol_cache* cache = new dyld_symbol_cache();
+        return *cache;
+    }
+
+#if defined(__APPLE__)
+    static void added(const struct mach_header* mh, intptr_t slide) { instance().add(mh, slide); }
+    static void removed(const struct mach_header* mh, intptr_t) { instance().remove(mh); }
+#endif
+
+    // The image's segments, sorted, without __PAGEZERO and __LINKEDIT.  Every
+    // image in the shared cache shares one __LINKEDIT, so a single min/max
+    // range per image would nest them.
+    static std::vector<range> segment_ranges(const entry& e, const image& hdr, uint64_t slide)
+    {
+        std::vector<range> out;
+        for (segment_ref seg : hdr.segments()) {
+            if (seg.vmsize() == 0 || (seg.initprot() == 0 && seg.maxprot() == 0) || seg.name() == "__LINKEDIT")
+                continue;
+            out.push_back(range{ seg.vmaddr() + slide, seg.vmaddr() + seg.vmsize() + slide, &e });
+        }
+        std::sort(out.begin(), out.end(), [](const range& a, const range& b) { return a.lo < b.lo; });
+        return out;
+    }
+
+    static void build(entry& e, const image& hdr, uint64_t slide)
+    {
+        std::vector<std::pair<uint64_t, uint32_t>> sorted;
+        for (uint32_t i = 0; i < e.table.size(); ++i)
+            if (e.table.has_address(i))
+                sorted.emplace_back(e.table.value(i) + slide, i);
+        std::sort(sorted.begin(), sorted.end());
+        e.addresses.reserve(sorted.size());
+        e.symbols.reserve(sorted.size());
+        for (const auto& s : sorted) {
+            e.addresses.push_back(s.first);
+            e.symbols.push_back(s.second);
+        }
+    }
+
+    void insert(std::unique_ptr<entry> e, const image& hdr)
+    {
+        std::vector<range> added = segment_ranges(*e, hdr, e->slide);
+        std::lock_guard<std::mutex> lock(_mutex);
+        snapshot next = current();
+        if (!added.empty()) {
+            next.images.push_back(e.get());
+            size_t mid = next.ranges.size();
+            next.ranges.insert(next.ranges.end(), added.begin(), added.end());
+            std::inplace_merge(next.ranges.begin(), next.ranges.begin() + (ptrdiff_t)mid, next.ranges.end(),
+                               [](const range& a, const range& b) { return a.lo < b.lo; });
+        }
+        _entries.push_back(std::move(e));
+        publish(std::move(next));
+    }
+
+    snapshot current() const
+    {
+        const snapshot* s = _snapshot.load(std::memory_order_relaxed);
+        return s ? *s : snapshot();
+    }
+
+    void publish(snapshot next)
+    {
+        std::unique_ptr<snapshot> s(new snapshot(std::move(next)));
+        _snapshot.store(s.get(), std::memory_order_release);
+        _snapshots.push_back(std::move(s));
+    }
+};
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_DYLD_SYMBOL_CACHE__
@@ -0,0 +1,477 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Reader and writer for the export trie referenced by LC_DYLD_EXPORTS_TRIE
+ * (or the export_off/export_size fields of LC_DYLD_INFO).  The encoding is
+ * the one described in <mach-o/loader.h> alongside EXPORT_SYMBOL_FLAGS_*.
+ *
+ * macho::export_trie is a view over the trie bytes.  Exact lookups and
+ * prefix checks cost O(depth) edge compares and never allocate.  Prefix
+ * enumeration keeps one growable name buffer and an explicit stack.  Every
+ * read is bounds-checked, and a walk visits at most as many nodes as the
+ * trie has bytes, so a cyclic or truncated trie cannot hang or overrun.
+ *
+ * macho::export_trie_builder writes the same format from a list of
+ * (name, export_info) pairs.  These can come from an image's own exports or
+ * from a .tbd stub (see <mach-o/tbd.h>), so SDK stubs and real binaries can
+ * be checked against one index format.
+ */
+
+#ifndef __MACH_O_EXPORT_TRIE__
+#define __MACH_O_EXPORT_TRIE__
+
+#if defined(__cplusplus)
+
+#include <mach-o/image_view.h>
+#include <mach-o/tbd.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace macho {
+
+// The terminal payload of one exported symbol.
+struct export_info {
+    uint64_t         flags   = 0;   // EXPORT_SYMBOL_FLAGS_*
+    uint64_t         address = 0;   // offset from the mach_header (stub for STUB_AND_RESOLVER)
+    uint64_t         other   = 0;   // resolver offset (STUB_AND_RESOLVER) or dylib ordinal (REEXPORT)
+    std::string_view import_name;   // REEXPORT only; empty when re-exported under the same name
+
+    bool     reexport() const { return (flags & EXPORT_SYMBOL_FLAGS_REEXPORT) != 0; }
+    bool     weak() const { return (flags & EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION) != 0; }
+    bool     resolver() const { return (flags & EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER) != 0; }
+    unsigned kind() const { return (unsigned)(flags & EXPORT_SYMBOL_FLAGS_KIND_MASK); }
+};
+
+class export_trie {
+public:
+    export_trie() = default;
+    explicit export_trie(span bytes) : _trie(bytes) {}
+
+    // The export trie of img, from LC_DYLD_EXPORTS_TRIE or LC_DYLD_INFO(_ONLY).
+    static export_trie open(const image& img)
+    {
+        span s = img.linkedit_data(LC_DYLD_EXPORTS_TRIE);
+        if (s.empty()) {
+            const dyld_info_command* info = img.command<dyld_info_command>(LC_DYLD_INFO_ONLY);
+            if (!info)
+                info = img.command<dyld_info_command>(LC_DYLD_INFO);
+            if (info)
+                s = img.bytes().subspan(info->export_off, info->export_size);
+        }
+        return export_trie(s);
+    }
+
+    bool empty() const { return _trie.empty(); }
+    span bytes() const { return _trie; }
+
+    // Exact lookup.  Returns false if name is not exported or the trie is
+    // malformed along the way.
+    bool find(std::string_view name, export_info& out) const
+    {
+        uint64_t node = 0;
+        if (!descend(name, node, nullptr))
+            return false;
+        return read_terminal(node, out);
+    }
+
+    bool contains(std::string_view name) const
+    {
+        export_info info;
+        return find(name, info);
+    }
+
+    // True if any exported symbol starts with prefix.
+    bool has_prefix(std::string_view prefix) const
+    {
+        uint64_t node = 0;
+        return !_trie.empty() && descend(prefix, node, nullptr, true);
+    }
+
+    // Calls fn(std::string_view name, const export_info&) for every export
+    // starting with prefix, in trie order.  Returns false if the trie is
+    // malformed (entries seen before the error have been reported).
+    template <typename Fn>
+    bool for_each(std::string_view prefix, Fn&& fn) const
+    {
+        if (_trie.empty())
+            return true;
+        uint64_t    node = 0;
+        std::string name;
+        if (!descend(prefix, node, &name, true))
+            return true;
+
+        // Each frame records where its parent's name ends and the edge
+        // leading to it; edges point into the trie bytes, so nothing is copied
+        // until the frame is visited.
+        struct frame {
+            uint64_t         node;
+            size_t           parent_len;
+            std::string_view edge;
+        };
+        std::vector<frame> stack;
+        stack.push_back(frame{ node, name.size(), std::string_view() });
+        size_t budget = _trie.size;
+
+        while (!stack.empty()) {
+            frame f = stack.back();
+            stack.pop_back();
+            if (budget-- == 0)
+                return false;
+            name.resize(f.parent_len);
+            name.append(f.edge.data(), f.edge.size());
+
+            const uint8_t* p   = _trie.data + f.node;
+            const uint8_t* end = _trie.end();
+            bool           ok  = true;
+            uint64_t terminal_size = read_uleb128(p, end, ok);
+            if (!ok || terminal_size >= (uint64_t)(end - p))
+                return false;
+            if (terminal_size != 0) {
+                export_info info;
+                if (!read_terminal(f.node, info))
+                    return false;
+                fn(std::string_view(name), info);
+            }
+            p += terminal_size;
+            uint8_t children = *p++;
+
+            // Pushed in reverse so children are visited in stored order.
+            size_t first = stack.size();
+            for (uint8_t i = 0; i < children; ++i) {
+                const char* edge = reinterpret_cast<const char*>(p);
+                size_t      len  = strnlen(edge, (size_t)(end - p));
+                if (len == 0 || len == (size_t)(end - p))
+                    return false;
+                p += len + 1;
+                uint64_t child = read_uleb128(p, end, ok);
+                if (!ok || child >= _trie.size)
+                    return false;
+                stack.push_back(frame{ child, name.size(), std::string_view(edge, len) });
+            }
+            std::reverse(stack.begin() + first, stack.end());
+        }
+        return true;
+    }
+
+    // Number of exported symbols.
+    size_t count() const
+    {
+        size_t n = 0;
+        for_each(std::string_view(), [&](std::string_view, const export_info&) { ++n; });
+        return n;
+    }
+
+private:
+    span _trie;
+
+    // Walks edges matching name from the root.  On success node is the
+    // offset of the node reached.  With partial set, name may end inside an
+    // edge (a prefix match); the rest of that edge is then appended to
+    // consumed, if given.
+    bool descend(std::string_view name, uint64_t& node, std::string* consumed, bool partial = false) const
+    {
+        const uint8_t* end    = _trie.end();
+        size_t         budget = _trie.size;
+        node = 0;
+        if (_trie.empty())
+            return false;
+        if (consumed)
+            consumed->assign(name.data(), 0);
+
+        while (!name.empty()) {
+            if (budget-- == 0 || node >= _trie.size)
+                return false;
+            const uint8_t* p  = _trie.data + node;
+            bool           ok = true;
+            uint64_t terminal_size = read_uleb128(p, end, ok);
+            if (!ok || terminal_size >= (uint64_t)(end - p))
+                return false;
+            p += terminal_size;
+            uint8_t children = *p++;
+
+            bool found = false;
+            for (uint8_t i = 0; i < children; ++i) {
+                const char* edge = reinterpret_cast<const char*>(p);
+                size_t      len  = strnlen(edge, (size_t)(end - p));
+                if (len == 0 || len == (size_t)(end - p))
+                    return false;
+                p += len + 1;
+                uint64_t child = read_uleb128(p, end, ok);
+                if (!ok)
+                    return false;
+
+                std::string_view e(edge, len);
+                if (e[0] != name[0])
+                    continue;
+                if (name.size() >= len && name.compare(0, len, e) == 0) {
+                    if (consumed)
+                        consumed->append(edge, len);
+                    name.remove_prefix(len);
+                    node  = child;
+                    found = true;
+                    break;
+                }
+                if (partial && name.size() < len && e.compare(0, name.size(), name) == 0) {
+                    if (consumed)
+                        consumed->append(edge, len);
+                    node = child;
+                    return child < _trie.size;
+                }
+                return false;   // edges from one node never share a first byte
+            }
+            if (!found)
+                return false;
+        }
+        return node < _trie.size;
+    }
+
+    bool read_terminal(uint64_t node, export_info& out) const
+    {
+        if (node >= _trie.size)
+            return false;
+        const uint8_t* p   = _trie.data + node;
+        const uint8_t* end = _trie.end();
+        bool           ok  = true;
+        uint64_t terminal_size = read_uleb128(p, end, ok);
+        if (!ok || terminal_size == 0 || terminal_size > (uint64_t)(end - p))
+            return false;
+        const uint8_t* tend = p + terminal_size;
+
+        out = export_info();
+        out.flags = read_uleb128(p, tend, ok);
+        if (out.flags & EXPORT_SYMBOL_FLAGS_REEXPORT) {
+            out.other = read_uleb128(p, tend, ok);
+            if (!ok || p >= tend)
+                return false;
+            const char* s = reinterpret_cast<const char*>(p);
+            out.import_name = std::string_view(s, strnlen(s, (size_t)(tend - p)));
+        } else {
+            out.address = read_uleb128(p, tend, ok);
+            if (out.flags & EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER)
+                out.other = read_uleb128(p, tend, ok);
+        }
+        return ok;
+    }
+};
+
+inline size_t uleb128_size(uint64_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+inline void append_uleb128(std::vector<uint8_t>& out, uint64_t v)
+{
+    do {
+        uint8_t byte = v & 0x7f;
+        v >>= 7;
+        if (v != 0)
+            byte |= 0x80;
+        out.push_back(byte);
+    } while (v != 0);
+}
+
+// Builds an export trie.  Names are kept sorted, so the output does not
+// depend on the order entries were added in; a name added twice keeps its
+// last info.
+class export_trie_builder {
+public:
+    void add(std::string_view name, const export_info& info)
+    {
+        _entries.push_back(entry{ std::string(name), info, std::string(info.import_name) });
+    }
+
+    // Adds every export of a .tbd document.  Stubs carry no addresses, so
+    // each symbol gets address 0 and the flags recorded in the stub.
+    void add(const tbd_document& doc)
+    {
+        for (const tbd_symbol& sym : doc.exports) {
+            export_info info;
+            info.flags = sym.flags;
+            add(sym.name, info);
+        }
+    }
+
+    size_t size() const { return _entries.size(); }
+
+    // Serialises the trie, padded to 8 bytes as ld64 does.
+    std::vector<uint8_t> build()
+    {
+        std::stable_sort(_entries.begin(), _entries.end(),
+                         [](const entry& a, const entry& b) { return a.name < b.name; });
+        std::vector<entry> unique;
+        for (entry& e : _entries) {
+            if (!unique.empty() && unique.back().name == e.name)
+                unique.back() = std::move(e);
+            else
+                unique.push_back(std::move(e));
+        }
+        _entries = std::move(unique);
+
+        _nodes.assign(1, node());
+        for (size_t i = 0; i < _entries.size(); ++i)
+            insert(i);
+
+        std::vector<uint32_t> order;
+        preorder(order);
+
+        // Node sizes depend on the ULEB128 size of child offsets, so iterate
+        // until the layout stops moving.  Offsets only grow, so this converges.
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            uint64_t offset = 0;
+            for (uint32_t n : order) {
+                if (_nodes[n].offset != offset) {
+                    _nodes[n].offset = offset;
+                    changed = true;
+                }
+                offset += node_size(_nodes[n]);
+            }
+        }
+
+        std::vector<uint8_t> out;
+        for (uint32_t n : order) {
+            const node& nd = _nodes[n];
+            if (nd.entry < 0) {
+                out.push_back(0);
+            } else {
+                size_t tsize = terminal_size(_entries[(size_t)nd.entry]);
+                append_uleb128(out, tsize);
+                append_terminal(out, _entries[(size_t)nd.entry]);
+            }
+            out.push_back((uint8_t)nd.edges.size());
+            for (const edge& e : nd.edges) {
+                out.insert(out.end(), e.label.begin(), e.label.end());
+                out.push_back(0);
+                append_uleb128(out, _nodes[e.child].offset);
+            }
+        }
+        while (out.size() % 8)
+            out.push_back(0);
+        return out;
+    }
+
+private:
+    struct entry {
+        std::string name;
+        export_info info;
+        std::string import_name;    // owns the string info.import_name pointed at
+    };
+    struct edge {
+        std::string label;
+        uint32_t    child;
+    };
+    struct node {
+        std::vector<edge> edges;
+        long              entry  = -1;
+        uint64_t          offset = 0;
+    };
+
+    std::vector<entry> _entries;
+    std::vector<node>  _nodes;
+
+    void insert(size_t index)
+    {
+        std::string_view rest = _entries[index].name;
+        uint32_t         n    = 0;
+        for (;;) {
+            if (rest.empty()) {
+                _nodes[n].entry = (long)index;
+                return;
+            }
+            size_t e = 0;
+            while (e < _nodes[n].edges.size() && _nodes[n].edges[e].label[0] != rest[0])
+                ++e;
+            if (e == _nodes[n].edges.size()) {
+                uint32_t leaf = (uint32_t)_nodes.size();
+                _nodes.emplace_back();
+                _nodes[leaf].entry = (long)index;
+                _nodes[n].edges.push_back(edge{ std::string(rest), leaf });
+                return;
+            }
+            const std::string& label  = _nodes[n].edges[e].label;
+            size_t             common = 1;
+            while (common < label.size() && common < rest.size() && label[common] == rest[common])
+                ++common;
+            if (common < label.size()) {
+                // Split the edge at the first mismatch.
+                uint32_t mid = (uint32_t)_nodes.size();
+                _nodes.emplace_back();
+                edge& split = _nodes[n].edges[e];
+                _nodes[mid].edges.push_back(edge{ split.label.substr(common), split.child });
+                split.label.resize(common);
+                split.child = mid;
+            }
+            n = _nodes[n].edges[e].child;
+            rest.remove_prefix(common);
+        }
+    }
+
+    void preorder(std::vector<uint32_t>& order) const
+    {
+        std::vector<uint32_t> stack(1, 0);
+        while (!stack.empty()) {
+            uint32_t n = stack.back();
+            stack.pop_back();
+            order.push_back(n);
+            for (size_t i = _nodes[n].edges.size(); i-- > 0;)
+                stack.push_back(_nodes[n].edges[i].child);
+        }
+    }
+
+    static size_t terminal_size(const entry& e)
+    {
+        const export_info& info = e.info;
+        size_t n = uleb128_size(info.flags);
+        if (info.flags & EXPORT_SYMBOL_FLAGS_REEXPORT) {
+            n += uleb128_size(info.other) + e.import_name.size() + 1;
+        } else {
+            n += uleb128_size(info.address);
+            if (info.flags & EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER)
+                n += uleb128_size(info.other);
+        }
+        return n;
+    }
+
+    static void append_terminal(std::vector<uint8_t>& out, const entry& e)
+    {
+        const export_info& info = e.info;
+        append_uleb128(out, info.flags);
+        if (info.flags & EXPORT_SYMBOL_FLAGS_REEXPORT) {
+            append_uleb128(out, info.other);
+            out.insert(out.end(), e.import_name.begin(), e.import_name.end());
+            out.push_back(0);
+        } else {
+            append_uleb128(out, info.address);
+            if (info.flags & EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER)
+                append_uleb128(out, info.other);
+        }
+    }
+
+    size_t node_size(const node& nd) const
+    {
+        size_t n = 1;   // child count
+        if (nd.entry < 0) {
+            n += 1;
+        } else {
+            size_t tsize = terminal_size(_entries[(size_t)nd.entry]);
+            n += uleb128_size(tsize) + tsize;
+        }
+        for (const edge& e : nd.edges)
+            n += e.label.size() + 1 + uleb128_size(_nodes[e.child].offset);
+        return n;
+    }
+};
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_EXPORT_TRIE__
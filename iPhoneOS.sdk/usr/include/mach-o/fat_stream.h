@@ -0,0 +1,434 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Streaming thin, split and merge of universal (fat) files, with per-slice
+ * SHA-256 digests.
+ *
+ * macho::fat_file works on a whole file already in memory.  The functions
+ * here read only the fat header up front.  They then copy each slice between
+ * file descriptors in fixed-size chunks with pread()/pwrite(), so memory use
+ * does not grow with file size.  Each chunk is also fed to the slice's
+ * macho::sha256 as it is copied, so digests cost no extra pass over the
+ * data.  Slices are independent, and each goes to its own worker thread.
+ *
+ * Alignment is preserved.  A slice taken from a fat file keeps its align
+ * field.  A thin file gets the alignment lipo uses: 2^14 for ARM and ARM64
+ * (16KB pages), 2^12 otherwise.  Merged files get the gaps between slices
+ * by extending the file with ftruncate(), so the padding reads as zeros and
+ * can stay a hole, as <mach-o/fat.h> permits.  The 64-bit fat format is
+ * chosen only when some offset or size does not fit in 32 bits.
+ */
+
+#ifndef __MACH_O_FAT_STREAM__
+#define __MACH_O_FAT_STREAM__
+
+#if defined(__cplusplus)
+
+#include <mach-o/image_view.h>
+#include <mach-o/sha256.h>
+
+#include <errno.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace macho {
+
+struct slice_digest {
+    fat_slice slice;                            // where the slice is in the file hashed or written
+    uint8_t   digest[sha256::digest_length];
+};
+
+namespace fat_stream_detail {
+
+constexpr size_t chunk_size = 1 << 20;
+
+inline bool read_fully(int fd, void* buf, size_t len, uint64_t offset)
+{
+    uint8_t* p = static_cast<uint8_t*>(buf);
+    while (len) {
+        ssize_t n = ::pread(fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+inline bool write_fully(int fd, const void* buf, size_t len, uint64_t offset)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(buf);
+    while (len) {
+        ssize_t n = ::pwrite(fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+// Copies size bytes from in to out (if out >= 0), hashing them into md (if
+// not null).
+inline bool copy_range(int in, uint64_t in_offset, int out, uint64_t out_offset, uint64_t size, uint8_t* md)
+{
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[chunk_size]);
+    sha256                     h;
+    while (size) {
+        size_t n = (size_t)std::min<uint64_t>(size, chunk_size);
+        if (!read_fully(in, buf.get(), n, in_offset))
+            return false;
+        if (out >= 0 && !write_fully(out, buf.get(), n, out_offset))
+            return false;
+        if (md)
+            h.update(buf.get(), n);
+        in_offset += n;
+        out_offset += n;
+        size -= n;
+    }
+    if (md)
+        h.final(md);
+    return true;
+}
+
+// Calls fn(i) for i in [0, n) on up to threads workers; returns false if
+// any call did.
+template <typename Fn>
+inline bool run(unsigned threads, size_t n, Fn&& fn)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    if (threads > n)
+        threads = (unsigned)std::max<size_t>(n, 1);
+    std::atomic<size_t> next{ 0 };
+    std::atomic<bool>   ok{ true };
+    auto worker = [&] {
+        for (;;) {
+            size_t i = next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= n)
+                return;
+            if (!fn(i))
+                ok.store(false, std::memory_order_relaxed);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& t : pool)
+        t.join();
+    return ok.load();
+}
+
+inline uint32_t default_align(cpu_type_t cputype)
+{
+    return (cputype == CPU_TYPE_ARM || cputype == CPU_TYPE_ARM64 || cputype == CPU_TYPE_ARM64_32) ? 14 : 12;
+}
+
+inline uint64_t align_up(uint64_t v, uint32_t align) { return (v + (1ULL << align) - 1) & ~((1ULL << align) - 1); }
+
+} // namespace fat_stream_detail
+
+// The fat header of a file opened for streaming.  A thin Mach-O is
+// presented as a single slice, as with fat_file.
+class fat_stream {
+public:
+    fat_stream() = default;
+    fat_stream(const fat_stream&) = delete;
+    fat_stream& operator=(const fat_stream&) = delete;
+    ~fat_stream() { close(); }
+
+    status open(const char* path)
+    {
+        close();
+        _fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (_fd < 0)
+            return status::io_error;
+        struct stat st;
+        if (::fstat(_fd, &st) != 0)
+            return fail(status::io_error);
+        _size = (uint64_t)st.st_size;
+
+        fat_header h;
+        if (_size < sizeof(h) || !fat_stream_detail::read_fully(_fd, &h, sizeof(h), 0))
+            return fail(status::truncated);
+
+        if (h.magic == FAT_CIGAM || h.magic == FAT_CIGAM_64) {
+            _fat = true;
+            bool     is64  = h.magic == FAT_CIGAM_64;
+            uint32_t count = fat_file::be32(h.nfat_arch);
+            size_t   entry = is64 ? sizeof(fat_arch_64) : sizeof(fat_arch);
+            if ((uint64_t)count * entry > _size - sizeof(h))
+                return fail(status::truncated);
+            std::vector<uint8_t> table((size_t)count * entry);
+            if (count && !fat_stream_detail::read_fully(_fd, table.data(), table.size(), sizeof(h)))
+                return fail(status::io_error);
+            for (uint32_t i = 0; i < count; ++i) {
+                fat_slice s;
+                if (is64) {
+                    fat_arch_64 a;
+                    memcpy(&a, table.data() + i * entry, sizeof(a));
+                    s = fat_slice{ (cpu_type_t)fat_file::be32(a.cputype), (cpu_subtype_t)fat_file::be32(a.cpusubtype),
+                                   fat_file::be64(a.offset), fat_file::be64(a.size), fat_file::be32(a.align) };
+                } else {
+                    fat_arch a;
+                    memcpy(&a, table.data() + i * entry, sizeof(a));
+                    s = fat_slice{ (cpu_type_t)fat_file::be32(a.cputype), (cpu_subtype_t)fat_file::be32(a.cpusubtype),
+                                   fat_file::be32(a.offset), fat_file::be32(a.size), fat_file::be32(a.align) };
+                }
+                if (s.offset > _size || s.size > _size - s.offset)
+                    return fail(status::truncated);
+                if (s.align > 30)
+                    return fail(status::bad_load_command);
+                _slices.push_back(s);
+            }
+            return status::ok;
+        }
+        if (h.magic == FAT_MAGIC || h.magic == FAT_MAGIC_64)
+            return fail(status::unsupported);
+
+        mach_header mh;
+        if (_size < sizeof(mh) || !fat_stream_detail::read_fully(_fd, &mh, sizeof(mh), 0))
+            return fail(status::truncated);
+        if (mh.magic != MH_MAGIC && mh.magic != MH_MAGIC_64)
+            return fail(status::bad_magic);
+        _slices.push_back(fat_slice{ mh.cputype, mh.cpusubtype, 0, _size, fat_stream_detail::default_align(mh.cputype) });
+        return status::ok;
+    }
+
+    void close()
+    {
+        if (_fd >= 0)
+            ::close(_fd);
+        _fd   = -1;
+        _size = 0;
+        _fat  = false;
+        _slices.clear();
+    }
+
+    int      fd() const { return _fd; }
+    uint64_t file_size() const { return _size; }
+    bool     is_fat() const { return _fat; }
+    const std::vector<fat_slice>& slices() const { return _slices; }
+
+    // Index of the slice for cputype (and cpusubtype, ignoring capability
+    // bits, unless it is CPU_SUBTYPE_MULTIPLE), or -1.
+    int find(cpu_type_t cputype, cpu_subtype_t cpusubtype = CPU_SUBTYPE_MULTIPLE) const
+    {
+        for (size_t i = 0; i < _slices.size(); ++i) {
+            const fat_slice& s = _slices[i];
+            if (s.cputype != cputype)
+                continue;
+            if (cpusubtype == CPU_SUBTYPE_MULTIPLE ||
+                ((s.cpusubtype ^ cpusubtype) & ~(cpu_subtype_t)CPU_SUBTYPE_MASK) == 0)
+                return (int)i;
+        }
+        return -1;
+    }
+
+    // Hashes every slice, one worker per slice (threads = 0: one per CPU).
+    status hash(std::vector<slice_digest>& out, unsigned threads = 0) const
+    {
+        out.resize(_slices.size());
+        bool ok = fat_stream_detail::run(threads, _slices.size(), [&](size_t i) {
+            out[i].slice = _slices[i];
+            return fat_stream_detail::copy_range(_fd, _slices[i].offset, -1, 0, _slices[i].size, out[i].digest);
+        });
+        return ok ? status::ok : status::io_error;
+    }
+
+private:
+    int                    _fd   = -1;
+    uint64_t               _size = 0;
+    bool                   _fat  = false;
+    std::vector<fat_slice> _slices;
+
+    status fail(status s)
+    {
+        close();
+        return s;
+    }
+};
+
+namespace fat_stream_detail {
+
+struct output {
+    int         fd = -1;
+    std::string path;
+
+    status create(const char* p)
+    {
+        path = p;
+        fd   = ::open(p, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+        return fd < 0 ? status::io_error : status::ok;
+    }
+
+    // Closes the file, removing it unless s is ok.
+    status finish(status s)
+    {
+        if (fd >= 0 && ::close(fd) != 0 && s == status::ok)
+            s = status::io_error;
+        fd = -1;
+        if (s != status::ok && !path.empty())
+            ::unlink(path.c_str());
+        return s;
+    }
+};
+
+} // namespace fat_stream_detail
+
+// Writes one slice of in (by cputype/cpusubtype) to out as a thin file.
+// digest, if given, receives the slice's SHA-256.
+inline status fat_thin(const char* in, const char* out, cpu_type_t cputype,
+                       cpu_subtype_t cpusubtype = CPU_SUBTYPE_MULTIPLE, slice_digest* digest = nullptr)
+{
+    fat_stream src;
+    status     s = src.open(in);
+    if (s != status::ok)
+        return s;
+    int i = src.find(cputype, cpusubtype);
+    if (i < 0)
+        return status::unsupported;
+    const fat_slice& slice = src.slices()[i];
+
+    fat_stream_detail::output dst;
+    if ((s = dst.create(out)) != status::ok)
+        return s;
+    bool ok = fat_stream_detail::copy_range(src.fd(), slice.offset, dst.fd, 0, slice.size,
+                                            digest ? digest->digest : nullptr);
+    if (digest)
+        digest->slice = fat_slice{ slice.cputype, slice.cpusubtype, 0, slice.size, slice.align };
+    return dst.finish(ok ? status::ok : status::io_error);
+}
+
+// Writes every slice of in to its own thin file, named by
+// path_for(const fat_slice&) -> std::string.  digests, if given, receives
+// each slice's SHA-256 in the order of the fat header.
+template <typename PathFn>
+inline status fat_split(const char* in, PathFn&& path_for, std::vector<slice_digest>* digests = nullptr,
+                        unsigned threads = 0)
+{
+    fat_stream src;
+    status     s = src.open(in);
+    if (s != status::ok)
+        return s;
+    const std::vector<fat_slice>& slices = src.slices();
+    std::vector<std::string>      paths;
+    for (const fat_slice& slice : slices)
+        paths.push_back(path_for(slice));
+    if (digests)
+        digests->resize(slices.size());
+
+    std::vector<status> result(slices.size(), status::ok);
+    fat_stream_detail::run(threads, slices.size(), [&](size_t i) {
+        fat_stream_detail::output dst;
+        status                    r = dst.create(paths[i].c_str());
+        if (r == status::ok) {
+            bool ok = fat_stream_detail::copy_range(src.fd(), slices[i].offset, dst.fd, 0, slices[i].size,
+                                                    digests ? (*digests)[i].digest : nullptr);
+            r = ok ? status::ok : status::io_error;
+        }
+        if (digests)
+            (*digests)[i].slice = fat_slice{ slices[i].cputype, slices[i].cpusubtype, 0, slices[i].size, slices[i].align };
+        result[i] = dst.finish(r);
+        return result[i] == status::ok;
+    });
+    for (status r : result)
+        if (r != status::ok)
+            return r;
+    return status::ok;
+}
+
+// Writes a fat file holding every slice of every input (thin or fat), in
+// order.  Two slices with the same cputype and cpusubtype are an error.
+// digests, if given, receives each slice's placement and SHA-256.
+inline status fat_merge(const std::vector<std::string>& inputs, const char* out,
+                        std::vector<slice_digest>* digests = nullptr, unsigned threads = 0)
+{
+    using namespace fat_stream_detail;
+
+    std::vector<std::unique_ptr<fat_stream>> sources;
+    struct piece {
+        const fat_stream* src;
+        fat_slice         from;
+        fat_slice         to;
+    };
+    std::vector<piece> pieces;
+    for (const std::string& path : inputs) {
+        sources.emplace_back(new fat_stream());
+        status s = sources.back()->open(path.c_str());
+        if (s != status::ok)
+            return s;
+        for (const fat_slice& slice : sources.back()->slices()) {
+            for (const piece& p : pieces)
+                if (p.from.cputype == slice.cputype && p.from.cpusubtype == slice.cpusubtype)
+                    return status::bad_load_command;
+            pieces.push_back(piece{ sources.back().get(), slice, slice });
+        }
+    }
+    if (pieces.empty())
+        return status::truncated;
+
+    // Lay out the slices, choosing the 64-bit header only if needed.
+    auto layout = [&](bool is64) {
+        uint64_t offset = sizeof(fat_header) + pieces.size() * (is64 ? sizeof(fat_arch_64) : sizeof(fat_arch));
+        for (piece& p : pieces) {
+            p.to.offset = align_up(offset, p.to.align);
+            offset      = p.to.offset + p.to.size;
+        }
+        return offset;
+    };
+    uint64_t end  = layout(false);
+    bool     is64 = end > UINT32_MAX;
+    if (is64)
+        end = layout(true);
+
+    std::vector<uint8_t> header(sizeof(fat_header) + pieces.size() * (is64 ? sizeof(fat_arch_64) : sizeof(fat_arch)));
+    fat_header h{ fat_file::be32(is64 ? FAT_MAGIC_64 : FAT_MAGIC), fat_file::be32((uint32_t)pieces.size()) };
+    memcpy(header.data(), &h, sizeof(h));
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        const fat_slice& t = pieces[i].to;
+        if (is64) {
+            fat_arch_64 a{ (cpu_type_t)fat_file::be32(t.cputype), (cpu_subtype_t)fat_file::be32(t.cpusubtype),
+                           fat_file::be64(t.offset), fat_file::be64(t.size), fat_file::be32(t.align), 0 };
+            memcpy(header.data() + sizeof(h) + i * sizeof(a), &a, sizeof(a));
+        } else {
+            fat_arch a{ (cpu_type_t)fat_file::be32(t.cputype), (cpu_subtype_t)fat_file::be32(t.cpusubtype),
+                        fat_file::be32((uint32_t)t.offset), fat_file::be32((uint32_t)t.size), fat_file::be32(t.align) };
+            memcpy(header.data() + sizeof(h) + i * sizeof(a), &a, sizeof(a));
+        }
+    }
+
+    output dst;
+    status s = dst.create(out);
+    if (s != status::ok)
+        return s;
+    if (::ftruncate(dst.fd, (off_t)end) != 0 || !write_fully(dst.fd, header.data(), header.size(), 0))
+        return dst.finish(status::io_error);
+    if (digests)
+        digests->resize(pieces.size());
+    bool ok = run(threads, pieces.size(), [&](size_t i) {
+        const piece& p = pieces[i];
+        if (digests)
+            (*digests)[i].slice = p.to;
+        return copy_range(p.src->fd(), p.from.offset, dst.fd, p.to.offset, p.from.size,
+                          digests ? (*digests)[i].digest : nullptr);
+    });
+    return dst.finish(ok ? status::ok : status::io_error);
+}
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_FAT_STREAM__
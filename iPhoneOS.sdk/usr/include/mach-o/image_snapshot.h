@@ -0,0 +1,568 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Offline reader for the image list of a stopped process, and a batch
+ * symbolicator built on it.
+ *
+ * macho::memory_snapshot is the address space of a process as captured in
+ * a file.  It is either an MH_CORE core file, whose LC_SEGMENT commands map
+ * addresses to file offsets, or raw memory dumps added region by region.
+ *
+ * macho::image_snapshot reads the dyld_all_image_infos structure (see
+ * <mach-o/dyld_images.h>) out of a memory_snapshot.  It follows infoArray
+ * and uuidArray and reads each image's mach_header and load commands where
+ * they were captured.  From these it rebuilds the loaded-image map: load
+ * address, slide, address range, UUID and path of every image.  The target's
+ * pointer size comes from the snapshot rather than the host, so a 64-bit
+ * tool can read a 32-bit process and the reverse.  If the address of
+ * dyld_all_image_infos is not known, find_all_image_infos() locates it by
+ * its dyldAllImageInfosAddress field, which points to the structure itself
+ * (version 9 and later).
+ *
+ * macho::snapshot_symbolicator matches local copies of images (such as
+ * dSYMs or unstripped binaries) to the loaded images by UUID.  It indexes
+ * each one once at that image's slide with macho::symbol_index, then
+ * symbolicates arrays of program counters across threads.  Every lookup is
+ * a read of the shared index, so thousands of backtraces cost one indexing
+ * pass plus two binary searches per frame.
+ */
+
+#ifndef __MACH_O_IMAGE_SNAPSHOT__
+#define __MACH_O_IMAGE_SNAPSHOT__
+
+#if defined(__cplusplus)
+
+#include <mach-o/image_view.h>
+#include <mach-o/symbol_index.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace macho {
+
+// A process address space captured in a file.
+class memory_snapshot {
+public:
+    struct region {
+        uint64_t address;
+        span     bytes;
+    };
+
+    memory_snapshot() = default;
+
+    // Maps the LC_SEGMENT/LC_SEGMENT_64 commands of an MH_CORE file.  The
+    // bytes must outlive the snapshot.
+    static memory_snapshot open_core(span bytes)
+    {
+        memory_snapshot m;
+        image core = image::open(bytes);
+        if (!core.valid()) {
+            m._status = core.error();
+            return m;
+        }
+        if (core.filetype() != MH_CORE) {
+            m._status = status::unsupported;
+            return m;
+        }
+        m._pointer_size = core.is64() ? 8 : 4;
+        for (segment_ref seg : core.segments()) {
+            uint64_t size = std::min(seg.filesize(), seg.vmsize());
+            if (size == 0)
+                continue;
+            if (seg.fileoff() > bytes.size || size > bytes.size - seg.fileoff()) {
+                m._status = status::truncated;
+                return m;
+            }
+            m.add_region(seg.vmaddr(), bytes.subspan(seg.fileoff(), size));
+        }
+        m._status = status::ok;
+        return m;
+    }
+
+    // An empty snapshot of a process with the given pointer size (4 or 8),
+    // to be filled with add_region().
+    explicit memory_snapshot(unsigned pointer_size) : _pointer_size(pointer_size), _status(status::ok) {}
+
+    void add_region(uint64_t address, span bytes)
+    {
+        region r{ address, bytes };
+        auto   it = std::upper_bound(_regions.begin(), _regions.end(), address,
+                                     [](uint64_t a, const region& x) { return a < x.address; });
+        _regions.insert(it, r);
+    }
+
+    bool     valid() const { return _status == status::ok; }
+    status   error() const { return _status; }
+    unsigned pointer_size() const { return _pointer_size; }
+    const std::vector<region>& regions() const { return _regions; }
+
+    // The size bytes at address, or an empty span if they were not all
+    // captured in one region.
+    span read(uint64_t address, uint64_t size) const
+    {
+        auto it = std::upper_bound(_regions.begin(), _regions.end(), address,
+                                   [](uint64_t a, const region& x) { return a < x.address; });
+        if (it == _regions.begin())
+            return span();
+        const region& r      = *(it - 1);
+        uint64_t      offset = address - r.address;
+        if (offset > r.bytes.size || size > r.bytes.size - offset)
+            return span();
+        return r.bytes.subspan(offset, size);
+    }
+
+    bool read_u32(uint64_t address, uint32_t& out) const
+    {
+        span s = read(address, 4);
+        if (!s.data)
+            return false;
+        memcpy(&out, s.data, 4);
+        return true;
+    }
+
+    bool read_u64(uint64_t address, uint64_t& out) const
+    {
+        span s = read(address, 8);
+        if (!s.data)
+            return false;
+        memcpy(&out, s.data, 8);
+        return true;
+    }
+
+    // Reads a target pointer (or uintptr_t), zero-extended.
+    bool read_pointer(uint64_t address, uint64_t& out) const
+    {
+        if (_pointer_size == 8)
+            return read_u64(address, out);
+        uint32_t v;
+        if (!read_u32(address, v))
+            return false;
+        out = v;
+        return true;
+    }
+
+    // The NUL-terminated string at address, up to max bytes.  Empty if
+    // unreadable.
+    std::string_view read_string(uint64_t address, size_t max = 1024) const
+    {
+        auto it = std::upper_bound(_regions.begin(), _regions.end(), address,
+                                   [](uint64_t a, const region& x) { return a < x.address; });
+        if (address == 0 || it == _regions.begin())
+            return std::string_view();
+        const region& r      = *(it - 1);
+        uint64_t      offset = address - r.address;
+        if (offset >= r.bytes.size)
+            return std::string_view();
+        const char* s = reinterpret_cast<const char*>(r.bytes.data + offset);
+        size_t      n = strnlen(s, (size_t)std::min<uint64_t>(max, r.bytes.size - offset));
+        return std::string_view(s, n);
+    }
+
+private:
+    std::vector<region> _regions;   // sorted by address
+    unsigned            _pointer_size = 8;
+    status              _status = status::truncated;
+};
+
+// Calls fn(lo, hi) for each segment of img that maps code or data, slid by
+// slide.  __PAGEZERO is skipped, and so is __LINKEDIT, which in the shared
+// cache is one region shared by every image.
+template <typename Fn>
+inline void for_each_mapped_segment(const image& img, uint64_t slide, Fn&& fn)
+{
+    for (segment_ref seg : img.segments()) {
+        if (seg.vmsize() == 0 || (seg.initprot() == 0 && seg.maxprot() == 0 && seg.vmaddr() == 0) ||
+            seg.name() == "__LINKEDIT")
+            continue;
+        fn(seg.vmaddr() + slide, seg.vmaddr() + seg.vmsize() + slide);
+    }
+}
+
+// One image from dyld_all_image_infos.
+struct loaded_image {
+    struct segment_range {
+        uint64_t lo, hi;
+    };
+
+    uint64_t    load_address = 0;
+    uint64_t    slide = 0;
+    uint64_t    lo = 0, hi = 0;         // extent of segments; empty if the header was not captured
+    std::vector<segment_range> segments;    // mapped segments, sorted, see for_each_mapped_segment()
+    std::string path;
+    std::array<uint8_t, 16> uuid{};
+    bool        has_uuid = false;
+    bool        in_shared_cache = false;
+
+    bool contains(uint64_t address) const
+    {
+        for (const segment_range& r : segments)
+            if (address >= r.lo && address < r.hi)
+                return true;
+        return false;
+    }
+};
+
+class image_snapshot {
+public:
+    // Reads the dyld_all_image_infos at address in snapshot.
+    static image_snapshot read(const memory_snapshot& snapshot, uint64_t address)
+    {
+        image_snapshot s;
+        s._status = s.parse(snapshot, address);
+        return s;
+    }
+
+    // Finds dyld_all_image_infos by its self-pointer.  Returns 0 if there
+    // is none (or the process predates version 9).
+    static uint64_t find_all_image_infos(const memory_snapshot& snapshot)
+    {
+        const layout   l = layout::for_pointer_size(snapshot.pointer_size());
+        const unsigned p = snapshot.pointer_size();
+        for (const memory_snapshot::region& r : snapshot.regions()) {
+            if (r.bytes.size < l.self + p)
+                continue;
+            uint64_t first = (r.address + p - 1) & ~(uint64_t)(p - 1);
+            for (uint64_t a = first; a - r.address <= r.bytes.size - (l.self + p); a += p) {
+                const uint8_t* q = r.bytes.data + (a - r.address);
+                uint32_t       version;
+                memcpy(&version, q, 4);
+                if (version < 9 || version > 64)
+                    continue;
+                uint64_t self = 0;
+                memcpy(&self, q + l.self, p);   // little-endian targets only
+                if (self == a)
+                    return a;
+            }
+        }
+        return 0;
+    }
+
+    bool   valid() const { return _status == status::ok; }
+    status error() const { return _status; }
+
+    uint32_t version() const { return _version; }
+    uint64_t dyld_load_address() const { return _dyld_load_address; }
+    uint64_t shared_cache_slide() const { return _shared_cache_slide; }
+    uint64_t shared_cache_base_address() const { return _shared_cache_base; }
+    const std::array<uint8_t, 16>& shared_cache_uuid() const { return _shared_cache_uuid; }
+    const std::string& error_message() const { return _error_message; }
+
+    // Images in dyld's load order.  dyld itself is not in infoArray.
+    const std::vector<loaded_image>& images() const { return _images; }
+
+    // Index of the image containing address, or -1.
+    int image_for(uint64_t address) const
+    {
+        auto it = std::upper_bound(_by_address.begin(), _by_address.end(), address,
+                                   [](uint64_t a, const range& r) { return a < r.lo; });
+        if (it == _by_address.begin() || address >= (it - 1)->hi)
+            return -1;
+        return (int)(it - 1)->image;
+    }
+
+    // Index of the image with the given UUID, or -1.
+    int image_for_uuid(const uint8_t* uuid) const
+    {
+        for (size_t i = 0; i < _images.size(); ++i)
+            if (_images[i].has_uuid && memcmp(_images[i].uuid.data(), uuid, 16) == 0)
+                return (int)i;
+        return -1;
+    }
+
+private:
+    // Field offsets of dyld_all_image_infos for a target pointer size.
+    struct layout {
+        unsigned info_array_count = 4;
+        unsigned info_array = 8;
+        unsigned dyld_image_load_address;
+        unsigned error_message;
+        unsigned uuid_array_count;
+        unsigned uuid_array;
+        unsigned self;
+        unsigned shared_cache_slide;
+        unsigned shared_cache_uuid;
+        unsigned shared_cache_base;
+        unsigned image_info_size;
+        unsigned uuid_info_size;
+
+        static layout for_pointer_size(unsigned p)
+        {
+            layout   l;
+            // version, infoArrayCount, infoArray, notification, two bools
+            unsigned o = (8 + 2 * p + 2 + p - 1) & ~(p - 1);
+            auto field = [&](unsigned n) { return o + n * p; };
+            l.dyld_image_load_address = field(0);
+            l.error_message           = field(3);
+            l.uuid_array_count        = field(7);
+            l.uuid_array              = field(8);
+            l.self                    = field(9);
+            l.shared_cache_slide      = field(15);
+            l.shared_cache_uuid       = field(16);
+            l.shared_cache_base       = (l.shared_cache_uuid + 16 + p - 1) & ~(p - 1);
+            l.image_info_size         = 3 * p;
+            l.uuid_info_size          = p + 16;
+            return l;
+        }
+    };
+
+    status parse(const memory_snapshot& m, uint64_t address)
+    {
+        if (!m.valid())
+            return m.error();
+        const layout   l = layout::for_pointer_size(m.pointer_size());
+        const unsigned p = m.pointer_size();
+
+        uint32_t count = 0;
+        uint64_t array = 0;
+        if (!m.read_u32(address, _version) || !m.read_u32(address + l.info_array_count, count) ||
+            !m.read_pointer(address + l.info_array, array))
+            return status::truncated;
+        if (_version == 0)
+            return status::bad_magic;
+        if (_version >= 2)
+            m.read_pointer(address + l.dyld_image_load_address, _dyld_load_address);
+        if (_version >= 5) {
+            uint64_t msg = 0;
+            if (m.read_pointer(address + l.error_message, msg))
+                _error_message = std::string(m.read_string(msg));
+        }
+        if (_version >= 12)
+            m.read_pointer(address + l.shared_cache_slide, _shared_cache_slide);
+        if (_version >= 13) {
+            span u = m.read(address + l.shared_cache_uuid, 16);
+            if (u.data)
+                memcpy(_shared_cache_uuid.data(), u.data, 16);
+        }
+        if (_version >= 15)
+            m.read_pointer(address + l.shared_cache_base, _shared_cache_base);
+
+        // infoArray is NULL while dyld is updating it.
+        if (array == 0 && count != 0)
+            return status::unsupported;
+        span infos = m.read(array, (uint64_t)count * l.image_info_size);
+        if (count != 0 && !infos.data)
+            return status::truncated;
+
+        _images.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            loaded_image& img = _images[i];
+            uint64_t      base = array + (uint64_t)i * l.image_info_size;
+            uint64_t      path = 0;
+            m.read_pointer(base, img.load_address);
+            m.read_pointer(base + p, path);
+            img.path = std::string(m.read_string(path));
+            read_header(m, img);
+        }
+
+        // uuidArray covers images outside the shared cache; it fills in
+        // those whose load commands were not captured.
+        uint64_t ucount = 0, uarray = 0;
+        if (_version >= 8 && m.read_pointer(address + l.uuid_array_count, ucount) &&
+            m.read_pointer(address + l.uuid_array, uarray) && uarray != 0) {
+            for (uint64_t i = 0; i < ucount; ++i) {
+                uint64_t base = uarray + i * l.uuid_info_size;
+                uint64_t load = 0;
+                span     uuid = m.read(base + p, 16);
+                if (!m.read_pointer(base, load) || !uuid.data)
+                    break;
+                for (loaded_image& img : _images) {
+                    if (img.load_address == load && !img.has_uuid) {
+                        memcpy(img.uuid.data(), uuid.data, 16);
+                        img.has_uuid = true;
+                    }
+                }
+            }
+        }
+
+        for (uint32_t i = 0; i < count; ++i)
+            for (const loaded_image::segment_range& r : _images[i].segments)
+                _by_address.push_back(range{ r.lo, r.hi, i });
+        std::sort(_by_address.begin(), _by_address.end(),
+                  [](const range& a, const range& b) { return a.lo < b.lo; });
+        return status::ok;
+    }
+
+    static void read_header(const memory_snapshot& m, loaded_image& img)
+    {
+        uint32_t magic = 0, sizeofcmds = 0;
+        if (!m.read_u32(img.load_address, magic) ||
+            !m.read_u32(img.load_address + offsetof(mach_header, sizeofcmds), sizeofcmds))
+            return;
+        size_t hsize = magic == MH_MAGIC_64 ? sizeof(mach_header_64) : sizeof(mach_header);
+        span   bytes = m.read(img.load_address, hsize + (uint64_t)sizeofcmds);
+        if (!bytes.data || ((uintptr_t)bytes.data & 3) != 0)
+            return;
+        image hdr = image::open(bytes);
+        if (!hdr.valid())
+            return;
+
+        img.in_shared_cache = (hdr.flags() & MH_DYLIB_IN_CACHE) != 0;
+        if (const uint8_t* u = hdr.uuid()) {
+            memcpy(img.uuid.data(), u, 16);
+            img.has_uuid = true;
+        }
+        img.slide = img.load_address - hdr.preferred_load_address();
+        uint64_t lo = UINT64_MAX, hi = 0;
+        for_each_mapped_segment(hdr, img.slide, [&](uint64_t b, uint64_t e) {
+            img.segments.push_back(loaded_image::segment_range{ b, e });
+            lo = std::min(lo, b);
+            hi = std::max(hi, e);
+        });
+        std::sort(img.segments.begin(), img.segments.end(),
+                  [](const loaded_image::segment_range& a, const loaded_image::segment_range& b) {
+                      return a.lo < b.lo;
+                  });
+        if (lo < hi) {
+            img.lo = lo;
+            img.hi = hi;
+        }
+    }
+
+    struct range {
+        uint64_t lo, hi;    // one mapped segment
+        uint32_t image;
+    };
+
+    status                    _status = status::truncated;
+    uint32_t                  _version = 0;
+    uint64_t                  _dyld_load_address = 0;
+    uint64_t                  _shared_cache_slide = 0;
+    uint64_t                  _shared_cache_base = 0;
+    std::array<uint8_t, 16>   _shared_cache_uuid{};
+    std::string               _error_message;
+    std::vector<loaded_image> _images;
+    std::vector<range>        _by_address;  // sorted by lo
+};
+
+struct symbolicated_frame {
+    uint64_t         pc = 0;
+    int              image = -1;        // index into image_snapshot::images(), or -1
+    uint64_t         image_offset = 0;  // pc - load address
+    std::string_view symbol;            // empty if no local copy of the image was given
+    uint64_t         symbol_offset = 0; // pc - symbol address
+};
+
+class snapshot_symbolicator {
+public:
+    // snapshot must outlive the symbolicator.
+    explicit snapshot_symbolicator(const image_snapshot& snapshot) : _snapshot(snapshot) {}
+
+    // Registers a local copy of a loaded image, found by its LC_UUID.  The
+    // image's bytes must outlive the symbolicator.  An image whose header
+    // was not captured, known only from uuidArray, is placed by its load
+    // address and the local copy's segments.  Returns false if the image
+    // has no UUID, was not loaded, cannot be placed, or has no usable
+    // symbol table.
+    bool add_local_image(const image& img)
+    {
+        const uint8_t* uuid = img.uuid();
+        if (!uuid)
+            return false;
+        int loaded = _snapshot.image_for_uuid(uuid);
+        if (loaded < 0)
+            return false;
+        const loaded_image& l = _snapshot.images()[loaded];
+        uint64_t slide = l.slide;
+        std::vector<placed> ranges;
+        if (l.segments.empty()) {
+            if (l.load_address == 0)
+                return false;
+            slide = l.load_address - img.preferred_load_address();
+            for_each_mapped_segment(img, slide, [&](uint64_t b, uint64_t e) {
+                ranges.push_back(placed{ b, e, loaded });
+            });
+            if (ranges.empty())
+                return false;
+        }
+        uint32_t id = _index.add_image(img, slide);
+        if (id == UINT32_MAX)
+            return false;
+        if (_by_id.size() <= id)
+            _by_id.resize(id + 1, -1);
+        _by_id[id] = loaded;
+        for (const placed& r : ranges) {
+            auto at = std::upper_bound(_placed.begin(), _placed.end(), r.lo,
+                                       [](uint64_t a, const placed& p) { return a < p.lo; });
+            _placed.insert(at, r);
+        }
+        return true;
+    }
+
+    size_t local_image_count() const { return _index.image_count(); }
+
+    void symbolicate(uint64_t pc, symbolicated_frame& out) const
+    {
+        out = symbolicated_frame();
+        out.pc    = pc;
+        out.image = _snapshot.image_for(pc);
+        if (out.image < 0)
+            out.image = placed_image_for(pc);
+        if (out.image >= 0)
+            out.image_offset = pc - _snapshot.images()[out.image].load_address;
+        symbol_ref r = _index.lookup(pc);
+        if (r.found() && _by_id[r.image] == out.image) {
+            out.symbol        = r.name;
+            out.symbol_offset = pc - r.address;
+        }
+    }
+
+    // Symbolicates n program counters using up to threads workers (0 means
+    // one per CPU).
+    void symbolicate(const uint64_t* pcs, size_t n, symbolicated_frame* out, unsigned threads = 0) const
+    {
+        constexpr size_t block = 4096;
+        const size_t     nblocks = (n + block - 1) / block;
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        if (threads > nblocks)
+            threads = (unsigned)std::max<size_t>(nblocks, 1);
+
+        std::atomic<size_t> next{ 0 };
+        auto worker = [&] {
+            for (;;) {
+                size_t b = next.fetch_add(1, std::memory_order_relaxed);
+                if (b >= nblocks)
+                    return;
+                for (size_t i = b * block, e = std::min(n, i + block); i < e; ++i)
+                    symbolicate(pcs[i], out[i]);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; ++i)
+            pool.emplace_back(worker);
+        worker();
+        for (std::thread& t : pool)
+            t.join();
+    }
+
+private:
+    // A segment of a loaded image placed from its local copy.
+    struct placed {
+        uint64_t lo = 0, hi = 0;
+        int      image = -1;
+    };
+
+    int placed_image_for(uint64_t address) const
+    {
+        auto it = std::upper_bound(_placed.begin(), _placed.end(), address,
+                                   [](uint64_t a, const placed& p) { return a < p.lo; });
+        if (it == _placed.begin() || address >= (it - 1)->hi)
+            return -1;
+        return (it - 1)->image;
+    }
+
+    const image_snapshot& _snapshot;
+    symbol_index          _index;
+    std::vector<int>      _by_id;       // symbol_index id -> loaded image
+    std::vector<placed>   _placed;      // sorted by lo
+};
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_IMAGE_SNAPSHOT__
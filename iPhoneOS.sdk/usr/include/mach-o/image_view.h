@@ -0,0 +1,924 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Typed, bounds-checked, zero-copy views over Mach-O images.
+ *
+ * macho::image wraps a pointer and length (typically an mmap()ed file, see
+ * macho::mapped_file) and validates the header and every load command once,
+ * when it is opened.  After that, iterating load commands, segments and
+ * sections, or looking up LC_UUID, LC_BUILD_VERSION, LC_RPATH,
+ * LC_FUNCTION_STARTS and the other linkedit payloads, reads the mapped bytes
+ * in place with no allocation and no further range checks.
+ *
+ * macho::fat_file does the same for universal files, and hands out a
+ * macho::image for each slice.
+ *
+ * Images are read in host byte order (MH_MAGIC/MH_MAGIC_64); byte-swapped
+ * images are rejected with status::unsupported.  Fat headers are always
+ * big-endian and are decoded as such.
+ *
+ * The code itself uses only POSIX calls and the structure definitions in
+ * <mach-o/loader.h> and <mach-o/fat.h>.  Those headers, as shipped in this
+ * SDK, include <mach/machine.h> and <architecture/byte_order.h>, which
+ * pull in Darwin-only <mach/machine/...> and <libkern/...> headers; they
+ * only build against a Darwin target.  To build elsewhere, put host
+ * copies of those headers ahead of the SDK on the include path.
+ */
+
+#ifndef __MACH_O_IMAGE_VIEW__
+#define __MACH_O_IMAGE_VIEW__
+
+#if defined(__cplusplus)
+
+#include <mach-o/loader.h>
+#include <mach-o/fat.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+namespace macho {
+
+enum class status : int {
+    ok = 0,
+    truncated,          // a structure extends past the end of the data
+    bad_magic,          // not a Mach-O or fat file
+    bad_alignment,      // a structure is not aligned for in-place access
+    bad_load_command,   // a load command's size or contents are inconsistent
+    unsupported,        // byte-swapped image or unknown format
+    io_error,           // mapped_file could not open or map the file
+};
+
+inline const char* status_string(status s)
+{
+    switch (s) {
+    case status::ok:               return "ok";
+    case status::truncated:        return "truncated";
+    case status::bad_magic:        return "bad magic";
+    case status::bad_alignment:    return "misaligned structure";
+    case status::bad_load_command: return "malformed load command";
+    case status::unsupported:      return "unsupported format";
+    case status::io_error:         return "I/O error";
+    }
+    return "unknown";
+}
+
+// A read-only byte range.
+struct span {
+    const uint8_t* data = nullptr;
+    size_t         size = 0;
+
+    span() = default;
+    span(const void* d, size_t n) : data(static_cast<const uint8_t*>(d)), size(n) {}
+
+    bool   empty() const { return size == 0; }
+    const uint8_t* begin() const { return data; }
+    const uint8_t* end() const { return data + size; }
+
+    bool contains(uint64_t offset, uint64_t length) const
+    {
+        return offset <= size && length <= size - offset;
+    }
+
+    span subspan(uint64_t offset, uint64_t length) const
+    {
+        if (!contains(offset, length))
+            return span();
+        return span(data + offset, (size_t)length);
+    }
+
+    // Returns a pointer to a T at offset, or nullptr if it would be out of
+    // range or misaligned.
+    template <typename T>
+    const T* at(uint64_t offset) const
+    {
+        if (!contains(offset, sizeof(T)))
+            return nullptr;
+        const uint8_t* p = data + offset;
+        if (((uintptr_t)p & (alignof(T) - 1)) != 0)
+            return nullptr;
+        return reinterpret_cast<const T*>(p);
+    }
+};
+
+// Reads an unsigned LEB128 value, advancing p.  Sets ok to false and stops
+// at end on malformed input.
+inline uint64_t read_uleb128(const uint8_t*& p, const uint8_t* end, bool& ok)
+{
+    uint64_t result = 0;
+    unsigned shift  = 0;
+    while (p < end) {
+        uint8_t byte = *p++;
+        if (shift < 64)
+            result |= (uint64_t)(byte & 0x7f) << shift;
+        else if (byte & 0x7f) {
+            ok = false;
+            return 0;
+        }
+        shift += 7;
+        if ((byte & 0x80) == 0)
+            return result;
+    }
+    ok = false;
+    return 0;
+}
+
+inline int64_t read_sleb128(const uint8_t*& p, const uint8_t* end, bool& ok)
+{
+    int64_t  result = 0;
+    unsigned shift  = 0;
+    uint8_t  byte   = 0;
+    do {
+        if (p == end) {
+            ok = false;
+            return 0;
+        }
+        byte = *p++;
+        if (shift < 64)
+            result |= (int64_t)((uint64_t)(byte & 0x7f) << shift);
+        shift += 7;
+    } while (byte & 0x80);
+    if (shift < 64 && (byte & 0x40))
+        result |= (int64_t)(~0ULL << shift);
+    return result;
+}
+
+// Packed X.Y.Z version as used by LC_BUILD_VERSION and LC_VERSION_MIN_*.
+struct packed_version {
+    uint32_t raw = 0;
+    unsigned major() const { return raw >> 16; }
+    unsigned minor() const { return (raw >> 8) & 0xff; }
+    unsigned patch() const { return raw & 0xff; }
+};
+
+// Read-only mmap() of a whole file.
+class mapped_file {
+public:
+    mapped_file() = default;
+    explicit mapped_file(const char* path) { open(path); }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file(mapped_file&& o) noexcept : _bytes(o._bytes) { o._bytes = span(); }
+    mapped_file& operator=(mapped_file&& o) noexcept
+    {
+        if (this != &o) {
+            close();
+            _bytes   = o._bytes;
+            o._bytes = span();
+        }
+        return *this;
+    }
+    ~mapped_file() { close(); }
+
+    status open(const char* path)
+    {
+        close();
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return status::io_error;
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            return status::io_error;
+        }
+        if (st.st_size <= 0) {
+            ::close(fd);
+            return st.st_size == 0 ? status::truncated : status::io_error;
+        }
+        void* p = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return status::io_error;
+        _bytes = span(p, (size_t)st.st_size);
+        return status::ok;
+    }
+
+    void close()
+    {
+        if (_bytes.data)
+            ::munmap(const_cast<uint8_t*>(_bytes.data), _bytes.size);
+        _bytes = span();
+    }
+
+    bool valid() const { return _bytes.data != nullptr; }
+    span bytes() const { return _bytes; }
+
+private:
+    span _bytes;
+};
+
+// One load command, already validated by image::open().
+class load_command_ref {
+public:
+    load_command_ref() = default;
+    explicit load_command_ref(const load_command* lc) : _lc(lc) {}
+
+    uint32_t cmd() const { return _lc->cmd; }
+    uint32_t size() const { return _lc->cmdsize; }
+    const load_command* raw() const { return _lc; }
+
+    // The command as a T, or nullptr if cmdsize is too small for one.
+    template <typename T>
+    const T* as() const
+    {
+        return _lc->cmdsize >= sizeof(T) ? reinterpret_cast<const T*>(_lc) : nullptr;
+    }
+
+    // The string at an lc_str offset, bounded by cmdsize.
+    std::string_view string_at(uint32_t offset) const
+    {
+        if (offset >= _lc->cmdsize)
+            return std::string_view();
+        const char* s = reinterpret_cast<const char*>(_lc) + offset;
+        size_t      n = strnlen(s, _lc->cmdsize - offset);
+        return std::string_view(s, n);
+    }
+
+    span payload() const { return span(_lc, _lc->cmdsize); }
+
+private:
+    const load_command* _lc = nullptr;
+};
+
+// Iterates validated load commands.
+class load_command_iterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = load_command_ref;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const load_command_ref*;
+    using reference         = load_command_ref;
+
+    load_command_iterator() = default;
+    load_command_iterator(const uint8_t* p, uint32_t remaining) : _p(p), _remaining(remaining) {}
+
+    load_command_ref operator*() const { return load_command_ref(reinterpret_cast<const load_command*>(_p)); }
+    load_command_iterator& operator++()
+    {
+        _p += reinterpret_cast<const load_command*>(_p)->cmdsize;
+        --_remaining;
+        return *this;
+    }
+    load_command_iterator operator++(int) { load_command_iterator t = *this; ++*this; return t; }
+    bool operator==(const load_command_iterator& o) const { return _remaining == o._remaining; }
+    bool operator!=(const load_command_iterator& o) const { return _remaining != o._remaining; }
+
+private:
+    const uint8_t* _p         = nullptr;
+    uint32_t       _remaining = 0;
+};
+
+template <typename It>
+struct range {
+    It first, last;
+    It begin() const { return first; }
+    It end() const { return last; }
+};
+
+// A section of either width.
+class section_ref {
+public:
+    section_ref() = default;
+    section_ref(const void* s, bool is64) : _s(s), _is64(is64) {}
+
+    std::string_view sectname() const { return fixed(_is64 ? s64()->sectname : s32()->sectname); }
+    std::string_view segname() const { return fixed(_is64 ? s64()->segname : s32()->segname); }
+    uint64_t addr() const { return _is64 ? s64()->addr : s32()->addr; }
+    uint64_t size() const { return _is64 ? s64()->size : s32()->size; }
+    uint32_t offset() const { return _is64 ? s64()->offset : s32()->offset; }
+    uint32_t align() const { return _is64 ? s64()->align : s32()->align; }
+    uint32_t flags() const { return _is64 ? s64()->flags : s32()->flags; }
+    uint32_t type() const { return flags() & SECTION_TYPE; }
+    uint32_t reserved1() const { return _is64 ? s64()->reserved1 : s32()->reserved1; }
+    uint32_t reserved2() const { return _is64 ? s64()->reserved2 : s32()->reserved2; }
+    bool     zerofill() const
+    {
+        uint32_t t = type();
+        return t == S_ZEROFILL || t == S_GB_ZEROFILL || t == S_THREAD_LOCAL_ZEROFILL;
+    }
+    const section*    raw32() const { return _is64 ? nullptr : s32(); }
+    const section_64* raw64() const { return _is64 ? s64() : nullptr; }
+
+private:
+    const void* _s    = nullptr;
+    bool        _is64 = false;
+
+    const section*    s32() const { return static_cast<const section*>(_s); }
+    const section_64* s64() const { return static_cast<const section_64*>(_s); }
+    static std::string_view fixed(const char (&name)[16]) { return std::string_view(name, strnlen(name, 16)); }
+};
+
+class section_iterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = section_ref;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const section_ref*;
+    using reference         = section_ref;
+
+    section_iterator() = default;
+    section_iterator(const uint8_t* p, bool is64) : _p(p), _is64(is64) {}
+
+    section_ref operator*() const { return section_ref(_p, _is64); }
+    section_iterator& operator++()
+    {
+        _p += _is64 ? sizeof(section_64) : sizeof(section);
+        return *this;
+    }
+    section_iterator operator++(int) { section_iterator t = *this; ++*this; return t; }
+    bool operator==(const section_iterator& o) const { return _p == o._p; }
+    bool operator!=(const section_iterator& o) const { return _p != o._p; }
+
+private:
+    const uint8_t* _p    = nullptr;
+    bool           _is64 = false;
+};
+
+// An LC_SEGMENT or LC_SEGMENT_64 command.
+class segment_ref {
+public:
+    segment_ref() = default;
+    segment_ref(const load_command* lc) : _lc(lc), _is64(lc->cmd == LC_SEGMENT_64) {}
+
+    std::string_view name() const { return fixed(_is64 ? s64()->segname : s32()->segname); }
+    uint64_t vmaddr() const { return _is64 ? s64()->vmaddr : s32()->vmaddr; }
+    uint64_t vmsize() const { return _is64 ? s64()->vmsize : s32()->vmsize; }
+    uint64_t fileoff() const { return _is64 ? s64()->fileoff : s32()->fileoff; }
+    uint64_t filesize() const { return _is64 ? s64()->filesize : s32()->filesize; }
+    int32_t  maxprot() const { return _is64 ? s64()->maxprot : s32()->maxprot; }
+    int32_t  initprot() const { return _is64 ? s64()->initprot : s32()->initprot; }
+    uint32_t flags() const { return _is64 ? s64()->flags : s32()->flags; }
+    uint32_t nsects() const { return _is64 ? s64()->nsects : s32()->nsects; }
+
+    range<section_iterator> sections() const
+    {
+        const uint8_t* first = reinterpret_cast<const uint8_t*>(_lc) +
+                               (_is64 ? sizeof(segment_command_64) : sizeof(segment_command));
+        size_t stride = _is64 ? sizeof(section_64) : sizeof(section);
+        return { section_iterator(first, _is64), section_iterator(first + stride * nsects(), _is64) };
+    }
+
+    bool contains_vmaddr(uint64_t addr) const { return addr >= vmaddr() && addr - vmaddr() < vmsize(); }
+
+    const segment_command*    raw32() const { return _is64 ? nullptr : s32(); }
+    const segment_command_64* raw64() const { return _is64 ? s64() : nullptr; }
+
+private:
+    const load_command* _lc   = nullptr;
+    bool                _is64 = false;
+
+    const segment_command*    s32() const { return reinterpret_cast<const segment_command*>(_lc); }
+    const segment_command_64* s64() const { return reinterpret_cast<const segment_command_64*>(_lc); }
+    static std::string_view fixed(const char (&name)[16]) { return std::string_view(name, strnlen(name, 16)); }
+};
+
+// Walks load commands, yielding only those accepted by Filter.
+template <typename Filter, typename Value>
+class filtered_iterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = Value;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const Value*;
+    using reference         = Value;
+
+    filtered_iterator() = default;
+    filtered_iterator(load_command_iterator it, load_command_iterator end) : _it(it), _end(end) { skip(); }
+
+    Value operator*() const { return Filter::make(*_it); }
+    filtered_iterator& operator++()
+    {
+        ++_it;
+        skip();
+        return *this;
+    }
+    filtered_iterator operator++(int) { filtered_iterator t = *this; ++*this; return t; }
+    bool operator==(const filtered_iterator& o) const { return _it == o._it; }
+    bool operator!=(const filtered_iterator& o) const { return _it != o._it; }
+
+private:
+    load_command_iterator _it, _end;
+    void skip()
+    {
+        while (_it != _end && !Filter::accept((*_it).cmd()))
+            ++_it;
+    }
+};
+
+struct segment_filter {
+    static bool accept(uint32_t cmd) { return cmd == LC_SEGMENT || cmd == LC_SEGMENT_64; }
+    static segment_ref make(load_command_ref lc) { return segment_ref(lc.raw()); }
+};
+
+struct rpath_filter {
+    static bool accept(uint32_t cmd) { return cmd == LC_RPATH; }
+    static std::string_view make(load_command_ref lc) { return lc.string_at(lc.as<rpath_command>()->path.offset); }
+};
+
+// A dependent dylib: LC_LOAD_DYLIB, LC_LOAD_WEAK_DYLIB, LC_REEXPORT_DYLIB,
+// LC_LOAD_UPWARD_DYLIB or LC_LAZY_LOAD_DYLIB, in ordinal order.
+struct dylib_ref {
+    uint32_t         cmd;
+    std::string_view path;
+    packed_version   current_version;
+    packed_version   compatibility_version;
+    bool weak() const { return cmd == LC_LOAD_WEAK_DYLIB; }
+    bool reexport() const { return cmd == LC_REEXPORT_DYLIB; }
+    bool upward() const { return cmd == LC_LOAD_UPWARD_DYLIB; }
+};
+
+struct dylib_filter {
+    static bool accept(uint32_t cmd)
+    {
+        return cmd == LC_LOAD_DYLIB || cmd == LC_LOAD_WEAK_DYLIB || cmd == LC_REEXPORT_DYLIB ||
+               cmd == LC_LOAD_UPWARD_DYLIB || cmd == LC_LAZY_LOAD_DYLIB;
+    }
+    static dylib_ref make(load_command_ref lc)
+    {
+        const dylib_command* d = lc.as<dylib_command>();
+        return dylib_ref{ lc.cmd(), lc.string_at(d->dylib.name.offset),
+                          packed_version{ d->dylib.current_version },
+                          packed_version{ d->dylib.compatibility_version } };
+    }
+};
+
+typedef filtered_iterator<segment_filter, segment_ref>      segment_iterator;
+typedef filtered_iterator<rpath_filter, std::string_view>   rpath_iterator;
+typedef filtered_iterator<dylib_filter, dylib_ref>          dylib_iterator;
+
+// LC_BUILD_VERSION, or the equivalent derived from LC_VERSION_MIN_*.
+class build_version_ref {
+public:
+    build_version_ref() = default;
+    build_version_ref(uint32_t platform, uint32_t minos, uint32_t sdk, const build_tool_version* tools, uint32_t ntools)
+        : _platform(platform), _minos{ minos }, _sdk{ sdk }, _tools(tools), _ntools(ntools) {}
+
+    bool           valid() const { return _platform != 0; }
+    uint32_t       platform() const { return _platform; }
+    packed_version minos() const { return _minos; }
+    packed_version sdk() const { return _sdk; }
+    uint32_t       tool_count() const { return _ntools; }
+    const build_tool_version* tools_begin() const { return _tools; }
+    const build_tool_version* tools_end() const { return _tools + _ntools; }
+
+private:
+    uint32_t                  _platform = 0;
+    packed_version            _minos, _sdk;
+    const build_tool_version* _tools  = nullptr;
+    uint32_t                  _ntools = 0;
+};
+
+// Decodes the ULEB128 deltas of LC_FUNCTION_STARTS into absolute addresses.
+class function_start_iterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = uint64_t;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const uint64_t*;
+    using reference         = uint64_t;
+
+    function_start_iterator() = default;
+    function_start_iterator(const uint8_t* p, const uint8_t* end, uint64_t base) : _p(p), _end(end), _addr(base)
+    {
+        advance();
+    }
+
+    uint64_t operator*() const { return _addr; }
+    function_start_iterator& operator++()
+    {
+        advance();
+        return *this;
+    }
+    function_start_iterator operator++(int) { function_start_iterator t = *this; ++*this; return t; }
+    bool operator==(const function_start_iterator& o) const { return _p == o._p && _done == o._done; }
+    bool operator!=(const function_start_iterator& o) const { return !(*this == o); }
+
+private:
+    const uint8_t* _p    = nullptr;
+    const uint8_t* _end  = nullptr;
+    uint64_t       _addr = 0;
+    bool           _done = true;
+
+    void advance()
+    {
+        bool     ok    = true;
+        uint64_t delta = _p < _end ? read_uleb128(_p, _end, ok) : 0;
+        // The table is terminated by a zero delta (or padding).
+        if (!ok || delta == 0) {
+            _p    = nullptr;
+            _end  = nullptr;
+            _done = true;
+            return;
+        }
+        _addr += delta;
+        _done = false;
+    }
+};
+
+class image {
+public:
+    image() = default;
+
+    // Validates the header and every load command.  On failure the image is
+    // left invalid and error() says why.
+    static image open(span bytes)
+    {
+        image img;
+        img._status = img.validate(bytes);
+        if (img._status != status::ok)
+            img._header = nullptr;
+        return img;
+    }
+
+    bool   valid() const { return _header != nullptr; }
+    status error() const { return _status; }
+    span   bytes() const { return _bytes; }
+
+    bool     is64() const { return _is64; }
+    uint32_t magic() const { return _header->magic; }
+    cpu_type_t    cputype() const { return _header->cputype; }
+    cpu_subtype_t cpusubtype() const { return _header->cpusubtype; }
+    uint32_t filetype() const { return _header->filetype; }
+    uint32_t flags() const { return _header->flags; }
+    uint32_t ncmds() const { return _header->ncmds; }
+    const mach_header* header() const { return _header; }
+
+    range<load_command_iterator> load_commands() const
+    {
+        const uint8_t* first = _bytes.data + header_size();
+        return { load_command_iterator(first, _header->ncmds), load_command_iterator(nullptr, 0) };
+    }
+
+    range<segment_iterator> segments() const
+    {
+        auto lcs = load_commands();
+        return { segment_iterator(lcs.first, lcs.last), segment_iterator(lcs.last, lcs.last) };
+    }
+
+    range<rpath_iterator> rpaths() const
+    {
+        auto lcs = load_commands();
+        return { rpath_iterator(lcs.first, lcs.last), rpath_iterator(lcs.last, lcs.last) };
+    }
+
+    range<dylib_iterator> dylibs() const
+    {
+        auto lcs = load_commands();
+        return { dylib_iterator(lcs.first, lcs.last), dylib_iterator(lcs.last, lcs.last) };
+    }
+
+    // First load command with the given cmd, or an empty ref.
+    load_command_ref find_command(uint32_t cmd) const
+    {
+        for (load_command_ref lc : load_commands())
+            if (lc.cmd() == cmd)
+                return lc;
+        return load_command_ref();
+    }
+
+    template <typename T>
+    const T* command(uint32_t cmd) const
+    {
+        load_command_ref lc = find_command(cmd);
+        return lc.raw() ? lc.as<T>() : nullptr;
+    }
+
+    // The 16-byte LC_UUID, or nullptr.
+    const uint8_t* uuid() const
+    {
+        const uuid_command* u = command<uuid_command>(LC_UUID);
+        return u ? u->uuid : nullptr;
+    }
+
+    // The install name from LC_ID_DYLIB, if any.
+    std::string_view install_name() const
+    {
+        load_command_ref lc = find_command(LC_ID_DYLIB);
+        return lc.raw() ? lc.string_at(lc.as<dylib_command>()->dylib.name.offset) : std::string_view();
+    }
+
+    build_version_ref build_version() const
+    {
+        for (load_command_ref lc : load_commands()) {
+            switch (lc.cmd()) {
+            case LC_BUILD_VERSION: {
+                const build_version_command* b = lc.as<build_version_command>();
+                return build_version_ref(b->platform, b->minos, b->sdk,
+                                         reinterpret_cast<const build_tool_version*>(b + 1), b->ntools);
+            }
+            case LC_VERSION_MIN_MACOSX:
+            case LC_VERSION_MIN_IPHONEOS:
+            case LC_VERSION_MIN_TVOS:
+            case LC_VERSION_MIN_WATCHOS: {
+                const version_min_command* v = lc.as<version_min_command>();
+                return build_version_ref(platform_for_version_min(lc.cmd()), v->version, v->sdk, nullptr, 0);
+            }
+            }
+        }
+        return build_version_ref();
+    }
+
+    // The bytes of a linkedit_data_command payload (LC_FUNCTION_STARTS,
+    // LC_CODE_SIGNATURE, LC_DYLD_EXPORTS_TRIE, LC_DYLD_CHAINED_FIXUPS, ...).
+    span linkedit_data(uint32_t cmd) const
+    {
+        const linkedit_data_command* l = command<linkedit_data_command>(cmd);
+        return l ? _bytes.subspan(l->dataoff, l->datasize) : span();
+    }
+
+    range<function_start_iterator> function_starts() const
+    {
+        span s = linkedit_data(LC_FUNCTION_STARTS);
+        return { function_start_iterator(s.begin(), s.end(), preferred_load_address()), function_start_iterator() };
+    }
+
+    // Segment by name, e.g. "__LINKEDIT".  Returns false if absent.
+    bool find_segment(std::string_view name, segment_ref& out) const
+    {
+        for (segment_ref seg : segments()) {
+            if (seg.name() == name) {
+                out = seg;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Section by segment and section name.  Returns false if absent.
+    bool find_section(std::string_view segname, std::string_view sectname, section_ref& out) const
+    {
+        for (segment_ref seg : segments()) {
+            if (seg.name() != segname)
+                continue;
+            for (section_ref sect : seg.sections()) {
+                if (sect.sectname() == sectname) {
+                    out = sect;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // File bytes backing a section (empty for zerofill or out-of-range).
+    span section_data(const section_ref& sect) const
+    {
+        if (sect.zerofill())
+            return span();
+        return _bytes.subspan(sect.offset(), sect.size());
+    }
+
+    // Translates an unslid vmaddr into a file offset.  Returns false if the
+    // address is not backed by file data.
+    bool file_offset_for_vmaddr(uint64_t addr, uint64_t& offset) const
+    {
+        for (segment_ref seg : segments()) {
+            if (addr >= seg.vmaddr() && addr - seg.vmaddr() < seg.filesize()) {
+                offset = seg.fileoff() + (addr - seg.vmaddr());
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // vmaddr of the __TEXT segment (the unslid load address).
+    uint64_t preferred_load_address() const
+    {
+        segment_ref text;
+        return find_segment("__TEXT", text) ? text.vmaddr() : 0;
+    }
+
+private:
+    span               _bytes;
+    const mach_header* _header = nullptr;
+    bool               _is64   = false;
+    status             _status = status::bad_magic;
+
+    size_t header_size() const { return _is64 ? sizeof(mach_header_64) : sizeof(mach_header); }
+
+    static uint32_t platform_for_version_min(uint32_t cmd)
+    {
+        switch (cmd) {
+        case LC_VERSION_MIN_MACOSX:   return PLATFORM_MACOS;
+        case LC_VERSION_MIN_IPHONEOS: return PLATFORM_IOS;
+        case LC_VERSION_MIN_TVOS:     return PLATFORM_TVOS;
+        default:                      return PLATFORM_WATCHOS;
+        }
+    }
+
+    status validate(span bytes)
+    {
+        _bytes = bytes;
+        const uint32_t* magic = bytes.at<uint32_t>(0);
+        if (!magic)
+            return bytes.size < sizeof(uint32_t) ? status::truncated : status::bad_alignment;
+        switch (*magic) {
+        case MH_MAGIC:    _is64 = false; break;
+        case MH_MAGIC_64: _is64 = true;  break;
+        case MH_CIGAM:
+        case MH_CIGAM_64: return status::unsupported;
+        default:          return status::bad_magic;
+        }
+        if (!bytes.contains(0, header_size()))
+            return status::truncated;
+        _header = reinterpret_cast<const mach_header*>(bytes.data);
+
+        uint64_t offset = header_size();
+        if (!bytes.contains(offset, _header->sizeofcmds))
+            return status::truncated;
+        uint64_t end   = offset + _header->sizeofcmds;
+        size_t   align = _is64 ? 8 : 4;
+
+        for (uint32_t i = 0; i < _header->ncmds; ++i) {
+            const load_command* lc = bytes.at<load_command>(offset);
+            if (!lc || offset + sizeof(load_command) > end)
+                return lc ? status::bad_load_command : status::truncated;
+            if (lc->cmdsize < sizeof(load_command) || (lc->cmdsize & (align - 1)) != 0 ||
+                lc->cmdsize > end - offset)
+                return status::bad_load_command;
+            if (!validate_command(load_command_ref(lc)))
+                return status::bad_load_command;
+            offset += lc->cmdsize;
+        }
+        return status::ok;
+    }
+
+    bool validate_command(load_command_ref lc) const
+    {
+        switch (lc.cmd()) {
+        case LC_SEGMENT: {
+            const segment_command* s = lc.as<segment_command>();
+            return s && (uint64_t)s->nsects * sizeof(section) <= lc.size() - sizeof(segment_command);
+        }
+        case LC_SEGMENT_64: {
+            const segment_command_64* s = lc.as<segment_command_64>();
+            return s && (uint64_t)s->nsects * sizeof(section_64) <= lc.size() - sizeof(segment_command_64);
+        }
+        case LC_UUID:
+            return lc.as<uuid_command>() != nullptr;
+        case LC_RPATH:
+            return lc.as<rpath_command>() != nullptr;
+        case LC_ID_DYLIB:
+        case LC_LOAD_DYLIB:
+        case LC_LOAD_WEAK_DYLIB:
+        case LC_REEXPORT_DYLIB:
+        case LC_LOAD_UPWARD_DYLIB:
+        case LC_LAZY_LOAD_DYLIB:
+            return lc.as<dylib_command>() != nullptr;
+        case LC_BUILD_VERSION: {
+            const build_version_command* b = lc.as<build_version_command>();
+            return b && (uint64_t)b->ntools * sizeof(build_tool_version) <= lc.size() - sizeof(*b);
+        }
+        case LC_VERSION_MIN_MACOSX:
+        case LC_VERSION_MIN_IPHONEOS:
+        case LC_VERSION_MIN_TVOS:
+        case LC_VERSION_MIN_WATCHOS:
+            return lc.as<version_min_command>() != nullptr;
+        case LC_SYMTAB:
+            return lc.as<symtab_command>() != nullptr;
+        case LC_DYSYMTAB:
+            return lc.as<dysymtab_command>() != nullptr;
+        case LC_CODE_SIGNATURE:
+        case LC_SEGMENT_SPLIT_INFO:
+        case LC_FUNCTION_STARTS:
+        case LC_DATA_IN_CODE:
+        case LC_DYLIB_CODE_SIGN_DRS:
+        case LC_LINKER_OPTIMIZATION_HINT:
+        case LC_DYLD_EXPORTS_TRIE:
+        case LC_DYLD_CHAINED_FIXUPS:
+            return lc.as<linkedit_data_command>() != nullptr;
+        case LC_DYLD_INFO:
+        case LC_DYLD_INFO_ONLY:
+            return lc.as<dyld_info_command>() != nullptr;
+        default:
+            return true;
+        }
+    }
+};
+
+// One architecture in a universal file.
+struct fat_slice {
+    cpu_type_t    cputype;
+    cpu_subtype_t cpusubtype;
+    uint64_t      offset;
+    uint64_t      size;
+    uint32_t      align;    // power of two
+};
+
+class fat_file {
+public:
+    fat_file() = default;
+
+    // Accepts FAT_MAGIC and FAT_MAGIC_64 files.  A thin Mach-O is presented
+    // as a single slice covering the whole file.
+    static fat_file open(span bytes)
+    {
+        fat_file f;
+        f._status = f.validate(bytes);
+        return f;
+    }
+
+    bool     valid() const { return _status == status::ok; }
+    status   error() const { return _status; }
+    bool     is_fat() const { return _fat; }
+    uint32_t count() const { return _count; }
+
+    fat_slice slice(uint32_t i) const
+    {
+        if (!_fat)
+            return fat_slice{ _thin_cpu, _thin_sub, 0, _bytes.size, 0 };
+        fat_slice s;
+        if (_is64) {
+            const fat_arch_64* a = reinterpret_cast<const fat_arch_64*>(_bytes.data + sizeof(fat_header)) + i;
+            s = fat_slice{ (cpu_type_t)be32(a->cputype), (cpu_subtype_t)be32(a->cpusubtype),
+                           be64(a->offset), be64(a->size), be32(a->align) };
+        } else {
+            const fat_arch* a = reinterpret_cast<const fat_arch*>(_bytes.data + sizeof(fat_header)) + i;
+            s = fat_slice{ (cpu_type_t)be32(a->cputype), (cpu_subtype_t)be32(a->cpusubtype),
+                           be32(a->offset), be32(a->size), be32(a->align) };
+        }
+        return s;
+    }
+
+    span slice_bytes(uint32_t i) const
+    {
+        fat_slice s = slice(i);
+        return _bytes.subspan(s.offset, s.size);
+    }
+
+    image slice_image(uint32_t i) const { return image::open(slice_bytes(i)); }
+
+    // Index of the slice for cputype (and cpusubtype, ignoring capability
+    // bits, unless it is CPU_SUBTYPE_MULTIPLE), or -1.
+    int find(cpu_type_t cputype, cpu_subtype_t cpusubtype = CPU_SUBTYPE_MULTIPLE) const
+    {
+        for (uint32_t i = 0; i < _count; ++i) {
+            fat_slice s = slice(i);
+            if (s.cputype != cputype)
+                continue;
+            if (cpusubtype == CPU_SUBTYPE_MULTIPLE ||
+                ((s.cpusubtype ^ cpusubtype) & ~(cpu_subtype_t)CPU_SUBTYPE_MASK) == 0)
+                return (int)i;
+        }
+        return -1;
+    }
+
+    static uint32_t be32(uint32_t v) { return __builtin_bswap32(v); }
+    static uint64_t be64(uint64_t v) { return __builtin_bswap64(v); }
+
+private:
+    span          _bytes;
+    status        _status = status::bad_magic;
+    bool          _fat    = false;
+    bool          _is64   = false;
+    uint32_t      _count  = 0;
+    cpu_type_t    _thin_cpu = 0;
+    cpu_subtype_t _thin_sub = 0;
+
+    status validate(span bytes)
+    {
+        _bytes = bytes;
+        const fat_header* h = bytes.at<fat_header>(0);
+        if (!h)
+            return status::truncated;
+        if (h->magic == FAT_CIGAM || h->magic == FAT_CIGAM_64) {
+            _fat  = true;
+            _is64 = h->magic == FAT_CIGAM_64;
+            _count = be32(h->nfat_arch);
+            size_t entry = _is64 ? sizeof(fat_arch_64) : sizeof(fat_arch);
+            if (!bytes.contains(sizeof(fat_header), (uint64_t)_count * entry))
+                return status::truncated;
+            for (uint32_t i = 0; i < _count; ++i) {
+                fat_slice s = slice(i);
+                if (!bytes.contains(s.offset, s.size))
+                    return status::truncated;
+                if (s.align > 30)
+                    return status::bad_load_command;
+            }
+            return status::ok;
+        }
+        if (h->magic == FAT_MAGIC || h->magic == FAT_MAGIC_64)
+            return status::unsupported;     // little-endian fat header: not produced by any tool
+
+        image img = image::open(bytes);
+        if (!img.valid())
+            return img.error();
+        _count    = 1;
+        _thin_cpu = img.cputype();
+        _thin_sub = img.cpusubtype();
+        return status::ok;
+    }
+};
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_IMAGE_VIEW__
@@ -0,0 +1,417 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Link-time check of a built image's imports against the SDK's text-based
+ * stubs.
+ *
+ * macho::tbd_index loads every .tbd file under an SDK root for one
+ * architecture.  The files are parsed in parallel with macho::parse_tbd().
+ * For each install name the index keeps a hash set of its exports, plus the
+ * transitive closure of the libraries it re-exports (umbrella frameworks,
+ * libSystem).  The index is built once and only read afterwards, so any
+ * number of images can be checked against it, from any number of threads.
+ *
+ * The linker's $ld$ directives in the stubs are honoured for the image's
+ * deployment target:
+ *   $ld$hide$os<V>$<sym>           sym is not exported when targeting V
+ *   $ld$add$os<V>$<sym>            sym is exported when targeting V
+ *   $ld$install_name$os<V>$<path>  images targeting V record path instead
+ * As in ld64, V must equal the deployment target exactly.
+ *
+ * check_links() reads an image's dependent dylibs and its imports.  Imports
+ * come from the chained fixups import table (LC_DYLD_CHAINED_FIXUPS) if
+ * there is one, and otherwise from the undefined nlist symbols with their
+ * two-level library ordinals.  Each import is resolved in the library its
+ * ordinal names, including that library's re-exports; flat-lookup imports
+ * may resolve in any dependent library (as do all imports of a
+ * flat-namespace image).  Libraries the index does not know (@rpath dylibs,
+ * third-party frameworks, /usr/lib/libsubstrate.dylib) are listed as
+ * unchecked, and imports bound to them are skipped.
+ */
+
+#ifndef __MACH_O_LINK_CHECK__
+#define __MACH_O_LINK_CHECK__
+
+#if defined(__cplusplus)
+
+#include <mach-o/chained_fixups.h>
+#include <mach-o/image_view.h>
+#include <mach-o/nlist.h>
+#include <mach-o/symbol_index.h>
+#include <mach-o/tbd.h>
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace macho {
+
+// The .tbd architecture name for a cputype/cpusubtype, or an empty view.
+inline std::string_view arch_name(cpu_type_t cputype, cpu_subtype_t cpusubtype)
+{
+    cpu_subtype_t sub = cpusubtype & ~(cpu_subtype_t)CPU_SUBTYPE_MASK;
+    switch (cputype) {
+    case CPU_TYPE_ARM64:
+        return sub == CPU_SUBTYPE_ARM64E ? "arm64e" : "arm64";
+    case CPU_TYPE_ARM64_32:
+        return "arm64_32";
+    case CPU_TYPE_ARM:
+        switch (sub) {
+        case CPU_SUBTYPE_ARM_V6:  return "armv6";
+        case CPU_SUBTYPE_ARM_V7S: return "armv7s";
+        case CPU_SUBTYPE_ARM_V7K: return "armv7k";
+        default:                  return "armv7";
+        }
+    case CPU_TYPE_X86_64:
+        return "x86_64";
+    case CPU_TYPE_X86:
+        return "i386";
+    default:
+        return std::string_view();
+    }
+}
+
+class tbd_index {
+public:
+    explicit tbd_index(std::string arch) : _arch(std::move(arch)) {}
+    tbd_index(const tbd_index&) = delete;
+    tbd_index& operator=(const tbd_index&) = delete;
+
+    const std::string& arch() const { return _arch; }
+    size_t library_count() const { return _libraries.size(); }
+
+    // Loads every .tbd file under root, parsing on up to threads workers
+    // (0 means one per CPU), then links re-exports.  Files that fail to
+    // parse are skipped; their count is left in failed, if given.
+    status add_sdk(const char* root, unsigned threads = 0, size_t* failed = nullptr)
+    {
+        std::vector<std::string> paths;
+        if (!list_tbds(root, paths))
+            return status::io_error;
+
+        std::vector<std::vector<tbd_document>> parsed(paths.size());
+        std::vector<status>                    result(paths.size());
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = (unsigned)std::max<size_t>(1, std::min<size_t>(threads, paths.size()));
+        std::atomic<size_t> next{ 0 };
+        auto worker = [&] {
+            for (;;) {
+                size_t i = next.fetch_add(1, std::memory_order_relaxed);
+                if (i >= paths.size())
+                    return;
+                result[i] = load_tbd(paths[i].c_str(), _arch, parsed[i]);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; ++i)
+            pool.emplace_back(worker);
+        worker();
+        for (std::thread& t : pool)
+            t.join();
+
+        size_t bad = 0;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            if (result[i] != status::ok) {
+                ++bad;
+                continue;
+            }
+            for (tbd_document& doc : parsed[i])
+                add(std::move(doc));
+        }
+        if (failed)
+            *failed = bad;
+        finalize();
+        return status::ok;
+    }
+
+    // Adds one library.  Call finalize() once all are added.
+    void add(tbd_document&& doc)
+    {
+        if (doc.install_name.empty())
+            return;
+        _documents.push_back(std::move(doc));
+        tbd_document& d = _documents.back();
+
+        uint32_t id;
+        auto     it = _by_name.find(d.install_name);
+        if (it != _by_name.end()) {
+            id = it->second;    // several documents may describe one library
+        } else {
+            id = (uint32_t)_libraries.size();
+            _libraries.emplace_back();
+            _libraries.back().install_name = d.install_name;
+            _by_name.emplace(d.install_name, id);
+        }
+        library& lib = _libraries[id];
+        for (std::string& r : d.reexported_libraries)
+            lib.reexport_names.push_back(r);
+        for (const tbd_symbol& s : d.exports) {
+            std::string_view name = s.name;
+            if (name.compare(0, 4, "$ld$") != 0) {
+                lib.exports.insert(name);
+                continue;
+            }
+            // $ld$<action>$os<version>$<symbol or path>
+            size_t a = name.find('$', 4);
+            if (a == std::string_view::npos || name.compare(a + 1, 2, "os") != 0)
+                continue;
+            size_t v = name.find('$', a + 3);
+            if (v == std::string_view::npos)
+                continue;
+            std::string_view action  = name.substr(4, a - 4);
+            uint32_t         version = tbd_detail::parse_version(name.substr(a + 3, v - a - 3)).raw;
+            std::string_view target  = name.substr(v + 1);
+            if (action == "hide")
+                lib.hidden.emplace(target, version);
+            else if (action == "add")
+                lib.added.emplace(target, version);
+            else if (action == "install_name")
+                _aliases.emplace(std::string(target), alias{ id, version });
+        }
+    }
+
+    // Resolves re-exports into the closure each library exposes.
+    void finalize()
+    {
+        for (library& lib : _libraries) {
+            lib.reexports.clear();
+            for (const std::string& name : lib.reexport_names) {
+                auto it = _by_name.find(name);
+                if (it != _by_name.end())
+                    lib.reexports.push_back(it->second);
+            }
+        }
+        std::vector<uint32_t> seen(_libraries.size(), UINT32_MAX);
+        for (uint32_t id = 0; id < _libraries.size(); ++id) {
+            std::vector<uint32_t>& closure = _libraries[id].visible;
+            closure.clear();
+            closure.push_back(id);
+            seen[id] = id;
+            for (size_t i = 0; i < closure.size(); ++i) {
+                for (uint32_t r : _libraries[closure[i]].reexports) {
+                    if (seen[r] != id) {
+                        seen[r] = id;
+                        closure.push_back(r);
+                    }
+                }
+            }
+        }
+    }
+
+    // The library with install name path, as seen by an image targeting
+    // target (0 ignores $ld$install_name).  UINT32_MAX if unknown.
+    uint32_t find_library(std::string_view path, packed_version target = packed_version{}) const
+    {
+        if (target.raw) {
+            auto range = _aliases.equal_range(std::string(path));
+            for (auto it = range.first; it != range.second; ++it)
+                if (it->second.version == target.raw)
+                    return it->second.library;
+        }
+        auto it = _by_name.find(std::string(path));
+        return it == _by_name.end() ? UINT32_MAX : it->second;
+    }
+
+    const std::string& install_name(uint32_t library) const { return _libraries[library].install_name; }
+
+    // True if library, or a library it re-exports, exports name to images
+    // targeting target.
+    bool resolves(uint32_t library, std::string_view name, packed_version target = packed_version{}) const
+    {
+        for (uint32_t id : _libraries[library].visible)
+            if (exports(_libraries[id], name, target.raw))
+                return true;
+        return false;
+    }
+
+private:
+    struct library {
+        std::string                                        install_name;
+        std::vector<std::string>                           reexport_names;
+        std::vector<uint32_t>                              reexports;
+        std::vector<uint32_t>                              visible;    // self, then re-exports, transitively
+        std::unordered_set<std::string_view>               exports;
+        std::unordered_multimap<std::string_view, uint32_t> hidden;    // name -> packed version
+        std::unordered_multimap<std::string_view, uint32_t> added;
+    };
+
+    struct alias {
+        uint32_t library;
+        uint32_t version;
+    };
+
+    std::string                                    _arch;
+    std::deque<tbd_document>                       _documents;     // owns the names viewed by library
+    std::vector<library>                           _libraries;
+    std::unordered_map<std::string, uint32_t>      _by_name;
+    std::unordered_multimap<std::string, alias>    _aliases;
+
+    static bool at_version(const std::unordered_multimap<std::string_view, uint32_t>& m, std::string_view name,
+                           uint32_t target)
+    {
+        if (m.empty() || target == 0)
+            return false;
+        auto range = m.equal_range(name);
+        for (auto it = range.first; it != range.second; ++it)
+            if (it->second == target)
+                return true;
+        return false;
+    }
+
+    static bool exports(const library& lib, std::string_view name, uint32_t target)
+    {
+        if (lib.exports.count(name))
+            return !at_version(lib.hidden, name, target);
+        return at_version(lib.added, name, target);
+    }
+
+    static bool list_tbds(const std::string& dir, std::vector<std::string>& out)
+    {
+        DIR* d = ::opendir(dir.c_str());
+        if (!d)
+            return false;
+        while (struct dirent* e = ::readdir(d)) {
+            std::string_view name = e->d_name;
+            if (name == "." || name == "..")
+                continue;
+            std::string path = dir + "/" + e->d_name;
+            struct stat st;
+            if (::lstat(path.c_str(), &st) != 0)
+                continue;
+            // Symlinks (Versions/Current, ...) would only repeat real files.
+            if (S_ISDIR(st.st_mode))
+                list_tbds(path, out);
+            else if (S_ISREG(st.st_mode) && name.size() > 4 && name.substr(name.size() - 4) == ".tbd")
+                out.push_back(std::move(path));
+        }
+        ::closedir(d);
+        return true;
+    }
+};
+
+// One problem found by check_links().
+struct link_issue {
+    std::string symbol;     // empty if the library itself is missing
+    std::string library;    // install name the image expects; empty for flat lookups
+    bool        weak;       // weak import or weak dylib: tolerated at run time
+};
+
+struct link_report {
+    std::string              arch;
+    packed_version           target;
+    std::vector<std::string> unchecked_libraries;   // dependents the index does not cover
+    std::vector<link_issue>  missing;
+    size_t                   imports_checked = 0;
+
+    // False if some strong import or library is missing.
+    bool ok() const
+    {
+        for (const link_issue& m : missing)
+            if (!m.weak)
+                return false;
+        return true;
+    }
+};
+
+// Checks img's imports against index.  target is the deployment target;
+// 0 uses the image's LC_BUILD_VERSION / LC_VERSION_MIN_*.  Returns
+// status::unsupported if index is for another architecture.
+inline status check_links(const image& img, const tbd_index& index, link_report& out,
+                          packed_version target = packed_version{})
+{
+    out = link_report();
+    if (!img.valid())
+        return img.error();
+    out.arch = std::string(arch_name(img.cputype(), img.cpusubtype()));
+    if (out.arch != index.arch())
+        return status::unsupported;
+    out.target = target.raw ? target : img.build_version().minos();
+
+    // Dependent dylibs, by ordinal.
+    std::vector<uint32_t> libs;
+    std::vector<bool>     weak_libs;
+    for (dylib_ref d : img.dylibs()) {
+        uint32_t id = index.find_library(d.path, out.target);
+        libs.push_back(id);
+        weak_libs.push_back(d.weak());
+        if (id == UINT32_MAX)
+            out.unchecked_libraries.emplace_back(d.path);
+    }
+
+    auto check = [&](std::string_view name, int ordinal, bool weak) {
+        if (ordinal > 0) {
+            if ((size_t)ordinal > libs.size()) {
+                out.missing.push_back(link_issue{ std::string(name), std::string(), weak });
+                return;
+            }
+            uint32_t lib = libs[ordinal - 1];
+            if (lib == UINT32_MAX)
+                return;
+            ++out.imports_checked;
+            if (!index.resolves(lib, name, out.target))
+                out.missing.push_back(link_issue{ std::string(name), index.install_name(lib), weak || weak_libs[ordinal - 1] });
+            return;
+        }
+        if (ordinal != BIND_SPECIAL_DYLIB_FLAT_LOOKUP)
+            return;     // self, main executable, weak lookup: not in any stub
+        bool unknown = false;
+        for (uint32_t lib : libs) {
+            if (lib == UINT32_MAX) {
+                unknown = true;
+            } else if (index.resolves(lib, name, out.target)) {
+                ++out.imports_checked;
+                return;
+            }
+        }
+        if (!unknown) {
+            ++out.imports_checked;
+            out.missing.push_back(link_issue{ std::string(name), std::string(), weak });
+        }
+    };
+
+    chained_fixups fixups = chained_fixups::open(img);
+    if (fixups.valid() && fixups.imports_count() != 0) {
+        for (uint32_t i = 0; i < fixups.imports_count(); ++i) {
+            chained_import imp = fixups.import_at(i);
+            check(imp.name, imp.lib_ordinal, imp.weak_import);
+        }
+        return status::ok;
+    }
+
+    symbol_table symbols        = symbol_table::open(img);
+    bool         flat_namespace = (img.flags() & MH_TWOLEVEL) == 0;
+    if (!symbols.valid())
+        return symbols.error();
+    for (uint32_t i = 0; i < symbols.size(); ++i) {
+        uint8_t type = symbols.type(i);
+        if ((type & N_STAB) || (type & N_TYPE) != N_UNDF || !(type & N_EXT) || symbols.value(i) != 0)
+            continue;   // not an import (a common symbol has a size in n_value)
+        uint16_t desc = symbols.desc(i);
+        int      ord  = GET_LIBRARY_ORDINAL(desc);
+        if (flat_namespace)
+            ord = BIND_SPECIAL_DYLIB_FLAT_LOOKUP;
+        else if (ord == SELF_LIBRARY_ORDINAL)
+            ord = BIND_SPECIAL_DYLIB_SELF;
+        else if (ord == DYNAMIC_LOOKUP_ORDINAL)
+            ord = BIND_SPECIAL_DYLIB_FLAT_LOOKUP;
+        else if (ord == EXECUTABLE_ORDINAL)
+            ord = BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE;
+        check(symbols.name(i), ord, (desc & N_WEAK_REF) != 0);
+    }
+    return status::ok;
+}
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_LINK_CHECK__
@@ -0,0 +1,327 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * SHA-256 for the Mach-O tools in this directory.
+ *
+ * On Apple platforms macho::sha256 wraps CC_SHA256_Init/Update/Final from
+ * <CommonCrypto/CommonDigest.h>.  Elsewhere it uses a portable FIPS 180-4
+ * implementation with the same shape, so the tools also run on Linux build
+ * hosts.
+ *
+ * sha256_batch() is the multi-buffer form, in the shape of CC_SHA256(): it
+ * digests many independent messages, such as the 4KB pages of a code
+ * signature.  Messages of equal length are hashed together, one per lane
+ * of a vector register (4 lanes, or 8 with AVX2).  That way the 64 rounds
+ * of several messages overlap, instead of running as one long dependency
+ * chain.  On CPUs with the ARMv8 SHA-2 instructions, CommonCrypto's
+ * hardware path is faster than lanes, so there the batch just loops over
+ * macho::sha256.
+ */
+
+#ifndef __MACH_O_SHA256__
+#define __MACH_O_SHA256__
+
+#if defined(__cplusplus)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__APPLE__)
+#include <CommonCrypto/CommonDigest.h>
+#endif
+
+namespace macho {
+
+namespace sha256_detail {
+
+alignas(64) static constexpr uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static constexpr uint32_t initial[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+inline uint32_t rotr(uint32_t x, unsigned n) { return (x >> n) | (x << (32 - n)); }
+
+inline uint32_t load_be32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+inline void store_be32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+// Runs the compression function over nblocks 64-byte blocks.
+inline void compress(uint32_t state[8], const uint8_t* data, size_t nblocks)
+{
+    for (; nblocks; --nblocks, data += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+            w[i] = load_be32(data + 4 * i);
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+} // namespace sha256_detail
+
+class sha256 {
+public:
+    static constexpr size_t digest_length = 32;
+    static constexpr size_t block_bytes   = 64;
+
+    sha256() { init(); }
+
+#if defined(__APPLE__)
+    void init() { CC_SHA256_Init(&_ctx); }
+
+    void update(const void* data, size_t len)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        while (len) {
+            CC_LONG n = (CC_LONG)(len > 0x40000000 ? 0x40000000 : len);
+            CC_SHA256_Update(&_ctx, p, n);
+            p += n;
+            len -= n;
+        }
+    }
+
+    void final(uint8_t md[digest_length]) { CC_SHA256_Final(md, &_ctx); }
+
+private:
+    CC_SHA256_CTX _ctx;
+#else
+    void init()
+    {
+        memcpy(_state, sha256_detail::initial, sizeof(_state));
+        _length   = 0;
+        _buffered = 0;
+    }
+
+    void update(const void* data, size_t len)
+    {
+        if (len == 0)
+            return;     // data may be null
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        _length += len;
+        if (_buffered) {
+            size_t n = block_bytes - _buffered;
+            if (n > len)
+                n = len;
+            memcpy(_buffer + _buffered, p, n);
+            _buffered += n;
+            p += n;
+            len -= n;
+            if (_buffered < block_bytes)
+                return;
+            sha256_detail::compress(_state, _buffer, 1);
+            _buffered = 0;
+        }
+        size_t blocks = len / block_bytes;
+        sha256_detail::compress(_state, p, blocks);
+        p += blocks * block_bytes;
+        len -= blocks * block_bytes;
+        memcpy(_buffer, p, len);
+        _buffered = len;
+    }
+
+    void final(uint8_t md[digest_length])
+    {
+        uint64_t bits = _length * 8;
+        _buffer[_buffered++] = 0x80;
+        if (_buffered > block_bytes - 8) {
+            memset(_buffer + _buffered, 0, block_bytes - _buffered);
+            sha256_detail::compress(_state, _buffer, 1);
+            _buffered = 0;
+        }
+        memset(_buffer + _buffered, 0, block_bytes - 8 - _buffered);
+        for (int i = 0; i < 8; ++i)
+            _buffer[block_bytes - 1 - i] = (uint8_t)(bits >> (8 * i));
+        sha256_detail::compress(_state, _buffer, 1);
+        for (int i = 0; i < 8; ++i)
+            sha256_detail::store_be32(md + 4 * i, _state[i]);
+        init();
+    }
+
+private:
+    uint32_t _state[8];
+    uint64_t _length;
+    size_t   _buffered;
+    uint8_t  _buffer[block_bytes];
+#endif
+};
+
+// One-shot digest of len bytes.
+inline void sha256_digest(const void* data, size_t len, uint8_t md[sha256::digest_length])
+{
+    sha256 h;
+    h.update(data, len);
+    h.final(md);
+}
+
+#if !(defined(__APPLE__) && defined(__ARM_FEATURE_SHA2))
+#define __MACH_O_SHA256_LANES__ 1
+
+namespace sha256_detail {
+
+#if defined(__AVX2__)
+constexpr unsigned lanes = 8;
+#else
+constexpr unsigned lanes = 4;
+#endif
+typedef uint32_t vec __attribute__((vector_size(lanes * 4)));
+
+inline vec rotr(vec x, unsigned n) { return (x >> n) | (x << (32 - n)); }
+
+// Compresses block[j] into lane j of state, for every lane.
+inline void compress_lanes(vec state[8], const uint8_t* const block[lanes])
+{
+    vec w[64];
+    for (int i = 0; i < 16; ++i)
+        for (unsigned j = 0; j < lanes; ++j)
+            w[i][j] = load_be32(block[j] + 4 * i);
+    for (int i = 16; i < 64; ++i) {
+        vec s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        vec s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    vec a = state[0], b = state[1], c = state[2], d = state[3];
+    vec e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        vec t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        vec t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+// Digests lanes messages that all have length len.
+inline void digest_lanes(const uint8_t* const data[lanes], size_t len, uint8_t* const md[lanes])
+{
+    vec state[8];
+    for (int i = 0; i < 8; ++i)
+        for (unsigned j = 0; j < lanes; ++j)
+            state[i][j] = initial[i];
+
+    size_t         full = len / 64;
+    const uint8_t* block[lanes];
+    for (size_t b = 0; b < full; ++b) {
+        for (unsigned j = 0; j < lanes; ++j)
+            block[j] = data[j] + b * 64;
+        compress_lanes(state, block);
+    }
+
+    // The padded tail is one or two blocks, laid out the same in every lane.
+    size_t  rest  = len - full * 64;
+    size_t  ntail = rest + 9 > 64 ? 2 : 1;
+    uint8_t tail[lanes][128];
+    for (unsigned j = 0; j < lanes; ++j) {
+        if (rest)
+            memcpy(tail[j], data[j] + full * 64, rest);     // data[j] may be null when len is 0
+        tail[j][rest] = 0x80;
+        memset(tail[j] + rest + 1, 0, ntail * 64 - rest - 1);
+        uint64_t bits = (uint64_t)len * 8;
+        for (int i = 0; i < 8; ++i)
+            tail[j][ntail * 64 - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    for (size_t t = 0; t < ntail; ++t) {
+        for (unsigned j = 0; j < lanes; ++j)
+            block[j] = tail[j] + t * 64;
+        compress_lanes(state, block);
+    }
+
+    for (unsigned j = 0; j < lanes; ++j)
+        for (int i = 0; i < 8; ++i)
+            store_be32(md[j] + 4 * i, state[i][j]);
+}
+
+} // namespace sha256_detail
+#endif
+
+// Digests count messages: md[i] = SHA-256(data[i], len[i]).
+inline void sha256_batch(const void* const data[], const size_t len[], size_t count,
+                         uint8_t (*md)[sha256::digest_length])
+{
+    size_t i = 0;
+#if defined(__MACH_O_SHA256_LANES__)
+    using sha256_detail::lanes;
+    while (i + lanes <= count) {
+        bool same = true;
+        for (unsigned j = 1; j < lanes; ++j)
+            same &= len[i + j] == len[i];
+        if (!same) {
+            sha256_digest(data[i], len[i], md[i]);
+            ++i;
+            continue;
+        }
+        const uint8_t* in[lanes];
+        uint8_t*       out[lanes];
+        for (unsigned j = 0; j < lanes; ++j) {
+            in[j]  = static_cast<const uint8_t*>(data[i + j]);
+            out[j] = md[i + j];
+        }
+        sha256_detail::digest_lanes(in, len[i], out);
+        i += lanes;
+    }
+#endif
+    for (; i < count; ++i)
+        sha256_digest(data[i], len[i], md[i]);
+}
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_SHA256__
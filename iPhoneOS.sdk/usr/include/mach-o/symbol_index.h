@@ -0,0 +1,479 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Name and address indexes over the LC_SYMTAB symbol tables of a set of
+ * images.
+ *
+ * macho::symbol_table is a bounds-checked view of one image's nlist or
+ * nlist_64 array and its string table.
+ *
+ * macho::symbol_index covers any number of images:
+ *
+ *  - by name: one open-addressing hash table shared by all images.  Each
+ *    name's length is found with a 16-byte SIMD scan for the terminating
+ *    NUL (SSE2 or NEON; the loads never run past the string table).  The
+ *    name is then hashed a word at a time.  The table keeps the 32-bit hash
+ *    of every entry, so a probe compares a string only when the hashes
+ *    match, and a rehash never touches a string.
+ *
+ *  - by address: each image keeps its defined symbols sorted by address in
+ *    a plain array of addresses (searched branch-free) beside an array of
+ *    symbol numbers.  A sorted table of segment ranges picks the image
+ *    first.
+ *
+ * Indexing is incremental.  add_image() and remove_image() only touch the
+ * image concerned (and the small range table).  The entries of removed
+ * images stay in the name table until they outnumber the live ones; the
+ * table is then rebuilt from the stored hashes.
+ *
+ * Names are returned as views into the image bytes, which must outlive the
+ * index.  Lookups are const and may run concurrently with each other, but
+ * not with add_image()/remove_image().
+ */
+
+#ifndef __MACH_O_SYMBOL_INDEX__
+#define __MACH_O_SYMBOL_INDEX__
+
+#if defined(__cplusplus)
+
+#include <mach-o/image_view.h>
+#include <mach-o/nlist.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace macho {
+
+// Length of the NUL-terminated string at s, reading no more than max bytes.
+// Returns max if there is no terminator.
+inline size_t bounded_strlen(const char* s, size_t max)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= max; i += 16) {
+        __m128i  v    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= max; i += 16) {
+        uint8x16_t v  = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(s + i)), vdupq_n_u8(0));
+        // Narrow each byte to a nibble so the mask fits a 64-bit lane.
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+        if (mask)
+            return i + (size_t)(__builtin_ctzll(mask) >> 2);
+    }
+#endif
+    for (; i < max; ++i)
+        if (s[i] == '\0')
+            return i;
+    return max;
+}
+
+// 32-bit hash of len bytes at s, consumed eight at a time.
+inline uint32_t symbol_hash(const char* s, size_t len)
+{
+    const uint64_t k = 0x9e3779b97f4a7c15ULL;
+    uint64_t       h = len * k;
+    size_t         i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, s + i, len - i);
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// One image's symbol table.
+class symbol_table {
+public:
+    symbol_table() = default;
+
+    static symbol_table open(const image& img)
+    {
+        symbol_table t;
+        t._status = t.validate(img);
+        return t;
+    }
+
+    // A symbol table that is already mapped, such as the __LINKEDIT of an
+    // image loaded by dyld.
+    static symbol_table from_memory(const void* symbols, uint32_t count, const char* strings, uint32_t strsize,
+                                    bool is64)
+    {
+        symbol_table t;
+        t._is64    = is64;
+        t._count   = count;
+        t._symbols = span(symbols, (size_t)count * (is64 ? sizeof(nlist_64) : sizeof(struct nlist)));
+        t._strings = span(strings, strsize);
+        t._status  = status::ok;
+        return t;
+    }
+
+    bool     valid() const { return _status == status::ok; }
+    status   error() const { return _status; }
+    uint32_t size() const { return _count; }
+
+    uint8_t  type(uint32_t i) const { return _is64 ? sym64(i).n_type : sym32(i).n_type; }
+    uint8_t  sect(uint32_t i) const { return _is64 ? sym64(i).n_sect : sym32(i).n_sect; }
+    uint16_t desc(uint32_t i) const { return _is64 ? sym64(i).n_desc : (uint16_t)sym32(i).n_desc; }
+    uint64_t value(uint32_t i) const { return _is64 ? sym64(i).n_value : sym32(i).n_value; }
+    uint32_t strx(uint32_t i) const { return _is64 ? sym64(i).n_un.n_strx : sym32(i).n_un.n_strx; }
+
+    std::string_view name(uint32_t i) const
+    {
+        uint32_t x = strx(i);
+        if (x >= _strings.size)
+            return std::string_view();
+        const char* s = reinterpret_cast<const char*>(_strings.data) + x;
+        return std::string_view(s, bounded_strlen(s, _strings.size - x));
+    }
+
+    bool is_stab(uint32_t i) const { return (type(i) & N_STAB) != 0; }
+    bool is_defined(uint32_t i) const
+    {
+        uint8_t t = type(i);
+        return (t & N_STAB) == 0 && (t & N_TYPE) != N_UNDF;
+    }
+    // Defined in a section, and so has an address worth symbolising to.
+    bool has_address(uint32_t i) const
+    {
+        uint8_t t = type(i);
+        return (t & N_STAB) == 0 && (t & N_TYPE) == N_SECT;
+    }
+
+private:
+    span        _symbols;
+    span        _strings;
+    uint32_t    _count  = 0;
+    bool        _is64   = false;
+    status      _status = status::bad_magic;
+
+    const nlist_64& sym64(uint32_t i) const { return reinterpret_cast<const nlist_64*>(_symbols.data)[i]; }
+    const struct nlist& sym32(uint32_t i) const { return reinterpret_cast<const struct nlist*>(_symbols.data)[i]; }
+
+    status validate(const image& img)
+    {
+        if (!img.valid())
+            return img.error();
+        _is64 = img.is64();
+        const symtab_command* st = img.command<symtab_command>(LC_SYMTAB);
+        if (!st)
+            return status::ok;
+        size_t entry = _is64 ? sizeof(nlist_64) : sizeof(struct nlist);
+        _symbols = img.bytes().subspan(st->symoff, (uint64_t)st->nsyms * entry);
+        _strings = img.bytes().subspan(st->stroff, st->strsize);
+        if ((st->nsyms && _symbols.empty()) || (st->strsize && _strings.empty()))
+            return status::truncated;
+        if (((uintptr_t)_symbols.data & (alignof(nlist_64) - 1)) != 0 && _is64)
+            return status::bad_alignment;
+        _count = st->nsyms;
+        return status::ok;
+    }
+};
+
+// A symbol found by symbol_index.
+struct symbol_ref {
+    uint32_t         image  = UINT32_MAX;   // id returned by add_image
+    uint32_t         index  = 0;            // symbol number in that image
+    uint64_t         address = 0;           // slid address; raw n_value for N_ABS and N_INDR
+    std::string_view name;
+
+    bool found() const { return image != UINT32_MAX; }
+};
+
+class symbol_index {
+public:
+    // Indexes img's symbols, with addresses slid by slide.  Returns an id
+    // for remove_image(), or UINT32_MAX if the symbol table is malformed.
+    uint32_t add_image(const image& img, uint64_t slide = 0)
+    {
+        symbol_table table = symbol_table::open(img);
+        if (!table.valid())
+            return UINT32_MAX;
+
+        uint32_t id = take_slot();
+        entry&   e  = _images[id];
+        e.table = table;
+        e.slide = slide;
+        e.live  = true;
+        e.addresses.clear();
+        e.symbols.clear();
+
+        // Address table: defined section symbols, sorted by address.
+        std::vector<std::pair<uint64_t, uint32_t>> sorted;
+        for (uint32_t i = 0; i < table.size(); ++i)
+            if (table.has_address(i))
+                sorted.emplace_back(table.value(i) + slide, i);
+        std::sort(sorted.begin(), sorted.end());
+        e.addresses.reserve(sorted.size());
+        e.symbols.reserve(sorted.size());
+        for (const auto& s : sorted) {
+            e.addresses.push_back(s.first);
+            e.symbols.push_back(s.second);
+        }
+
+        // One range per segment, ignoring __PAGEZERO and __LINKEDIT.  The
+        // shared cache's __LINKEDIT is shared by every image in it, so a
+        // min/max over all segments would nest the images' ranges.
+        std::vector<range_entry> ranges;
+        for (segment_ref seg : img.segments()) {
+            if (seg.vmsize() == 0 || (seg.initprot() == 0 && seg.maxprot() == 0 && seg.vmaddr() == 0) ||
+                seg.name() == "__LINKEDIT")
+                continue;
+            ranges.push_back(range_entry{ seg.vmaddr() + slide, seg.vmaddr() + seg.vmsize() + slide, id });
+        }
+        add_ranges(ranges);
+
+        // Name table.
+        size_t defined = 0;
+        for (uint32_t i = 0; i < table.size(); ++i)
+            defined += table.is_defined(i);
+        reserve(_used + defined);
+        for (uint32_t i = 0; i < table.size(); ++i) {
+            if (!table.is_defined(i))
+                continue;
+            std::string_view n = table.name(i);
+            insert(slot{ symbol_hash(n.data(), n.size()), id, i });
+        }
+        e.named = defined;
+        _live_names += defined;
+        return id;
+    }
+
+    // Drops an image.  Its name entries are reclaimed lazily.
+    void remove_image(uint32_t id)
+    {
+        if (id >= _images.size() || !_images[id].live)
+            return;
+        entry& e = _images[id];
+        e.live = false;
+        ++e.generation;
+        e.addresses = std::vector<uint64_t>();
+        e.symbols   = std::vector<uint32_t>();
+        _live_names -= e.named;
+        e.named = 0;
+        _free.push_back(id);
+        _ranges.erase(std::remove_if(_ranges.begin(), _ranges.end(),
+                                     [id](const range_entry& r) { return r.image == id; }),
+                      _ranges.end());
+        if (_used - _live_names > _live_names)
+            rehash(_slots.size());
+    }
+
+    // Re-indexes an image whose contents changed.  Returns the new id.
+    uint32_t replace_image(uint32_t id, const image& img, uint64_t slide = 0)
+    {
+        remove_image(id);
+        return add_image(img, slide);
+    }
+
+    // First definition of name, in any image.
+    symbol_ref find(std::string_view name) const
+    {
+        symbol_ref out;
+        for_each_definition(name, [&](const symbol_ref& r) {
+            out = r;
+            return false;
+        });
+        return out;
+    }
+
+    // Calls fn(const symbol_ref&) for each definition of name until fn
+    // returns false.
+    template <typename Fn>
+    void for_each_definition(std::string_view name, Fn&& fn) const
+    {
+        if (_slots.empty())
+            return;
+        uint32_t h    = symbol_hash(name.data(), name.size());
+        size_t   mask = _slots.size() - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            const slot& s = _slots[i];
+            if (s.image == empty_slot)
+                return;
+            if (s.hash != h || !_images[s.image].live || s.generation_mismatch(_images[s.image]))
+                continue;
+            const symbol_table& t = _images[s.image].table;
+            if (t.name(s.symbol) != name)
+                continue;
+            symbol_ref r;
+            r.image   = s.image;
+            r.index   = s.symbol;
+            r.address = t.value(s.symbol);
+            if (t.has_address(s.symbol))
+                r.address += _images[s.image].slide;
+            r.name    = name;
+            if (!fn(r))
+                return;
+        }
+    }
+
+    // Nearest symbol at or below address, within the image containing it.
+    symbol_ref lookup(uint64_t address) const
+    {
+        symbol_ref out;
+        size_t     r = find_range(address);
+        if (r == SIZE_MAX)
+            return out;
+        const entry& e = _images[_ranges[r].image];
+        size_t       n = e.addresses.size();
+        if (n == 0 || address < e.addresses[0])
+            return out;
+
+        // Branch-free binary search for the last address <= target.
+        const uint64_t* base = e.addresses.data();
+        while (n > 1) {
+            size_t half = n / 2;
+            base = (base[half] <= address) ? base + half : base;
+            n -= half;
+        }
+        size_t i  = (size_t)(base - e.addresses.data());
+        out.image   = _ranges[r].image;
+        out.index   = e.symbols[i];
+        out.address = e.addresses[i];
+        out.name    = e.table.name(out.index);
+        return out;
+    }
+
+    // Symbolises n addresses.  Sorting the input first improves locality
+    // but is not required.
+    void lookup(const uint64_t* addresses, size_t n, symbol_ref* out) const
+    {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = lookup(addresses[i]);
+    }
+
+    size_t image_count() const { return _images.size() - _free.size(); }
+    size_t symbol_count() const { return _live_names; }
+
+    const symbol_table* table(uint32_t id) const
+    {
+        return id < _images.size() && _images[id].live ? &_images[id].table : nullptr;
+    }
+
+private:
+    static constexpr uint32_t empty_slot = UINT32_MAX;
+
+    struct entry {
+        symbol_table          table;
+        uint64_t              slide = 0;
+        std::vector<uint64_t> addresses;
+        std::vector<uint32_t> symbols;
+        size_t                named = 0;
+        uint32_t              generation = 0;
+        bool                  live = false;
+    };
+
+    struct slot {
+        uint32_t hash;
+        uint32_t image;
+        uint32_t symbol;
+        uint32_t generation;
+
+        slot() : hash(0), image(empty_slot), symbol(0), generation(0) {}
+        slot(uint32_t h, uint32_t img, uint32_t sym) : hash(h), image(img), symbol(sym), generation(0) {}
+        bool generation_mismatch(const entry& e) const { return generation != e.generation; }
+    };
+
+    struct range_entry {
+        uint64_t lo, hi;
+        uint32_t image;
+    };
+
+    std::vector<entry>       _images;
+    std::vector<uint32_t>    _free;
+    std::vector<range_entry> _ranges;
+    std::vector<slot>        _slots;
+    size_t                   _used = 0;         // occupied slots, live or not
+    size_t                   _live_names = 0;
+
+    uint32_t take_slot()
+    {
+        if (!_free.empty()) {
+            uint32_t id = _free.back();
+            _free.pop_back();
+            return id;
+        }
+        _images.emplace_back();
+        return (uint32_t)(_images.size() - 1);
+    }
+
+    // Merges one image's ranges into the sorted table in linear time.
+    void add_ranges(std::vector<range_entry>& ranges)
+    {
+        auto by_lo = [](const range_entry& a, const range_entry& b) { return a.lo < b.lo; };
+        std::sort(ranges.begin(), ranges.end(), by_lo);
+        size_t mid = _ranges.size();
+        _ranges.insert(_ranges.end(), ranges.begin(), ranges.end());
+        std::inplace_merge(_ranges.begin(), _ranges.begin() + (ptrdiff_t)mid, _ranges.end(), by_lo);
+    }
+
+    size_t find_range(uint64_t address) const
+    {
+        auto it = std::upper_bound(_ranges.begin(), _ranges.end(), address,
+                                   [](uint64_t a, const range_entry& r) { return a < r.lo; });
+        if (it == _ranges.begin())
+            return SIZE_MAX;
+        --it;
+        return address < it->hi ? (size_t)(it - _ranges.begin()) : SIZE_MAX;
+    }
+
+    // Keeps the load factor at or below 1/2.
+    void reserve(size_t n)
+    {
+        size_t want = 16;
+        while (want < n * 2)
+            want <<= 1;
+        if (want > _slots.size())
+            rehash(want);
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<slot> old;
+        old.swap(_slots);
+        _slots.assign(capacity, slot());
+        _used = 0;
+        for (const slot& s : old)
+            if (s.image != empty_slot && _images[s.image].live && !s.generation_mismatch(_images[s.image]))
+                place(s);
+    }
+
+    void insert(slot s)
+    {
+        s.generation = _images[s.image].generation;
+        place(s);
+    }
+
+    void place(const slot& s)
+    {
+        size_t mask = _slots.size() - 1;
+        size_t i    = s.hash & mask;
+        while (_slots[i].image != empty_slot)
+            i = (i + 1) & mask;
+        _slots[i] = s;
+        ++_used;
+    }
+};
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_SYMBOL_INDEX__
@@ -0,0 +1,321 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Reader for text-based dylib stubs (.tbd files) as shipped in the SDK.
+ *
+ * macho::parse_tbd() extracts, for one architecture, the install name,
+ * versions, re-exported libraries and exported symbols of every document in
+ * a .tbd file.  Objective-C class, metaclass, exception type and ivar
+ * entries are expanded into the symbol names the linker sees
+ * (_OBJC_CLASS_$_Foo, ...).  Symbols are tagged with the
+ * EXPORT_SYMBOL_FLAGS_* bits from <mach-o/loader.h>, so the list can be fed
+ * straight to macho::export_trie_builder.
+ *
+ * This handles the subset of YAML that tapi writes (tbd v1 through v4): one
+ * key per line, flow sequences in [ ] that may span several lines, and
+ * "- " list items under exports/reexports.  It is not a general YAML parser.
+ */
+
+#ifndef __MACH_O_TBD__
+#define __MACH_O_TBD__
+
+#if defined(__cplusplus)
+
+#include <mach-o/image_view.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace macho {
+
+struct tbd_symbol {
+    std::string name;
+    uint32_t    flags;      // EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION, EXPORT_SYMBOL_FLAGS_KIND_THREAD_LOCAL
+};
+
+struct tbd_document {
+    int                      version = 1;        // tbd format version
+    std::string              install_name;
+    packed_version           current_version{ 0x10000 };
+    packed_version           compatibility_version{ 0x10000 };
+    std::string              parent_umbrella;
+    std::vector<std::string> reexported_libraries;
+    std::vector<tbd_symbol>  exports;
+};
+
+namespace tbd_detail {
+
+inline std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\r'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+        s.remove_suffix(1);
+    return s;
+}
+
+inline std::string_view unquote(std::string_view s)
+{
+    s = trim(s);
+    if (s.size() >= 2 && (s.front() == '\'' || s.front() == '"') && s.back() == s.front())
+        s = s.substr(1, s.size() - 2);
+    return s;
+}
+
+// Splits a flow sequence "[ a, 'b', c ]" into items.
+template <typename Fn>
+inline void for_each_item(std::string_view value, Fn&& fn)
+{
+    value = trim(value);
+    if (value.empty())
+        return;
+    if (value.front() != '[') {
+        fn(unquote(value));
+        return;
+    }
+    value.remove_prefix(1);
+    size_t close = value.rfind(']');
+    if (close != std::string_view::npos)
+        value = value.substr(0, close);
+    while (!value.empty()) {
+        size_t comma = std::string_view::npos;
+        char   quote = 0;
+        for (size_t i = 0; i < value.size(); ++i) {
+            char c = value[i];
+            if (quote) {
+                if (c == quote)
+                    quote = 0;
+            } else if (c == '\'' || c == '"') {
+                quote = c;
+            } else if (c == ',') {
+                comma = i;
+                break;
+            }
+        }
+        std::string_view item = unquote(value.substr(0, comma));
+        if (!item.empty())
+            fn(item);
+        if (comma == std::string_view::npos)
+            break;
+        value.remove_prefix(comma + 1);
+    }
+}
+
+// "1281.100.1" -> packed X.Y.Z
+inline packed_version parse_version(std::string_view s)
+{
+    s = unquote(s);
+    uint32_t parts[3] = { 0, 0, 0 };
+    for (int i = 0; i < 3 && !s.empty(); ++i) {
+        uint32_t v = 0;
+        size_t   n = 0;
+        while (n < s.size() && s[n] >= '0' && s[n] <= '9')
+            v = v * 10 + (uint32_t)(s[n++] - '0');
+        parts[i] = v;
+        s.remove_prefix(n);
+        if (!s.empty() && s.front() == '.')
+            s.remove_prefix(1);
+        else
+            break;
+    }
+    return packed_version{ (std::min(parts[0], 0xffffu) << 16) | (std::min(parts[1], 0xffu) << 8) |
+                           std::min(parts[2], 0xffu) };
+}
+
+// Matches an arch against an archs: entry ("arm64") or a targets: entry
+// ("arm64-ios", "arm64e-ios-simulator").
+inline bool arch_matches(std::string_view entry, std::string_view arch)
+{
+    size_t dash = entry.find('-');
+    if (dash != std::string_view::npos)
+        entry = entry.substr(0, dash);
+    return entry == arch;
+}
+
+// One "- archs: [...]" block under exports:.
+struct block {
+    bool                    matches = false;
+    bool                    seen_arch = false;
+    std::vector<tbd_symbol> symbols;
+    std::vector<std::string> reexports;
+};
+
+} // namespace tbd_detail
+
+// Parses every document in text, keeping the exports that apply to arch
+// ("arm64", "x86_64", ...; empty keeps all).  Returns status::bad_magic if
+// text does not look like a .tbd file.
+inline status parse_tbd(std::string_view text, std::string_view arch, std::vector<tbd_document>& out)
+{
+    using namespace tbd_detail;
+
+    out.clear();
+    tbd_document*    doc = nullptr;
+    std::string_view section;               // top-level key the current block belongs to
+    block            blk;
+    bool             in_block = false;
+
+    auto flush = [&] {
+        if (in_block && doc && (blk.matches || arch.empty() || !blk.seen_arch)) {
+            for (tbd_symbol& s : blk.symbols)
+                doc->exports.push_back(std::move(s));
+            for (std::string& r : blk.reexports)
+                doc->reexported_libraries.push_back(std::move(r));
+        }
+        blk      = block();
+        in_block = false;
+    };
+
+    auto add_symbols = [&](std::string_view key, std::string_view value) {
+        int v = doc->version;
+        auto add = [&](std::string name, uint32_t flags) { blk.symbols.push_back(tbd_symbol{ std::move(name), flags }); };
+        for_each_item(value, [&](std::string_view item) {
+            if (key == "symbols") {
+                add(std::string(item), EXPORT_SYMBOL_FLAGS_KIND_REGULAR);
+            } else if (key == "weak-def-symbols" || key == "weak-symbols") {
+                add(std::string(item), EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION);
+            } else if (key == "thread-local-symbols") {
+                add(std::string(item), EXPORT_SYMBOL_FLAGS_KIND_THREAD_LOCAL);
+            } else {
+                // Before v3 Objective-C names carried the symbol's leading underscore.
+                if (v < 3 && !item.empty() && item.front() == '_')
+                    item.remove_prefix(1);
+                if (key == "objc-classes") {
+                    add("_OBJC_CLASS_$_" + std::string(item), 0);
+                    add("_OBJC_METACLASS_$_" + std::string(item), 0);
+                } else if (key == "objc-eh-types") {
+                    add("_OBJC_EHTYPE_$_" + std::string(item), 0);
+                } else if (key == "objc-ivars") {
+                    add("_OBJC_IVAR_$_" + std::string(item), 0);
+                }
+            }
+        });
+    };
+
+    while (!text.empty()) {
+        size_t           eol  = text.find('\n');
+        std::string_view line = text.substr(0, eol);
+        text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+
+        std::string_view body = trim(line);
+        if (body.empty() || body.front() == '#')
+            continue;
+
+        if (line.substr(0, 3) == "---") {
+            flush();
+            out.emplace_back();
+            doc = &out.back();
+            std::string_view tag = trim(line.substr(3));
+            if (tag == "!tapi-tbd-v2")
+                doc->version = 2;
+            else if (tag == "!tapi-tbd-v3")
+                doc->version = 3;
+            else if (tag == "!tapi-tbd")
+                doc->version = 4;
+            section = std::string_view();
+            continue;
+        }
+        if (line.substr(0, 3) == "...") {
+            flush();
+            doc     = nullptr;
+            section = std::string_view();
+            continue;
+        }
+        if (!doc)
+            return out.empty() ? status::bad_magic : status::bad_load_command;
+
+        size_t indent = 0;
+        while (indent < line.size() && line[indent] == ' ')
+            ++indent;
+        bool item = body.size() >= 2 && body[0] == '-' && body[1] == ' ';
+        if (item)
+            body = trim(body.substr(2));
+
+        size_t colon = body.find(':');
+        if (colon == std::string_view::npos)
+            continue;
+        std::string_view key   = trim(body.substr(0, colon));
+        std::string_view value = trim(body.substr(colon + 1));
+
+        // Gather the rest of a multi-line flow sequence.
+        std::string joined;
+        if (!value.empty() && value.front() == '[' && value.find(']') == std::string_view::npos) {
+            joined.assign(value.data(), value.size());
+            while (!text.empty()) {
+                size_t           e    = text.find('\n');
+                std::string_view more = text.substr(0, e);
+                text.remove_prefix(e == std::string_view::npos ? text.size() : e + 1);
+                joined.push_back(' ');
+                joined.append(trim(more).data(), trim(more).size());
+                if (more.find(']') != std::string_view::npos)
+                    break;
+            }
+            value = joined;
+        }
+
+        if (indent == 0 && !item) {
+            flush();
+            section = key;
+            if (key == "install-name")
+                doc->install_name = std::string(unquote(value));
+            else if (key == "current-version")
+                doc->current_version = parse_version(value);
+            else if (key == "compatibility-version")
+                doc->compatibility_version = parse_version(value);
+            else if (key == "parent-umbrella" && !value.empty())
+                doc->parent_umbrella = std::string(unquote(value));
+            else if (key == "tbd-version")
+                doc->version = (int)parse_version(value).major();
+            continue;
+        }
+
+        if (section == "parent-umbrella" && key == "umbrella") {
+            doc->parent_umbrella = std::string(unquote(value));
+            continue;
+        }
+        if (section == "reexported-libraries" && key == "libraries") {
+            in_block = true;
+            for_each_item(value, [&](std::string_view lib) { blk.reexports.emplace_back(lib); });
+            continue;
+        }
+        if (section != "exports" && section != "reexports" && section != "reexported-libraries")
+            continue;
+
+        if (item) {
+            flush();
+            in_block = true;
+        }
+        if (key == "archs" || key == "targets") {
+            blk.seen_arch = true;
+            for_each_item(value, [&](std::string_view a) {
+                if (arch_matches(a, arch))
+                    blk.matches = true;
+            });
+        } else if (key == "re-exports") {
+            for_each_item(value, [&](std::string_view lib) { blk.reexports.emplace_back(lib); });
+        } else if (key == "symbols" || key == "weak-def-symbols" || key == "weak-symbols" ||
+                   key == "thread-local-symbols" || key == "objc-classes" || key == "objc-eh-types" ||
+                   key == "objc-ivars") {
+            add_symbols(key, value);
+        }
+    }
+    flush();
+    return out.empty() ? status::bad_magic : status::ok;
+}
+
+inline status load_tbd(const char* path, std::string_view arch, std::vector<tbd_document>& out)
+{
+    mapped_file file;
+    status      s = file.open(path);
+    if (s != status::ok)
+        return s;
+    span bytes = file.bytes();
+    return parse_tbd(std::string_view(reinterpret_cast<const char*>(bytes.data), bytes.size), arch, out);
+}
+
+} // namespace macho
+
+#endif // __cplusplus
+
+#endif // __MACH_O_TBD__
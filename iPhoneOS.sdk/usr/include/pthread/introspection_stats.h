@@ -0,0 +1,466 @@
+/*!
+ * @header
+ *
+ * @abstract
+ * Thread lifecycle telemetry built on pthread_introspection_hook_install().
+ *
+ * @discussion
+ * darwin::thread_telemetry installs a libpthread introspection hook that
+ * counts thread creation and teardown, tracks live threads and the stack
+ * memory they hold, and keeps log2 histograms of stack sizes and thread
+ * lifetimes.  The previously installed hook, if any, is always called, so
+ * the telemetry can coexist with sanitizers and other tools.
+ *
+ * The hook runs in contexts with invalid thread state, so it only touches
+ * lock-free atomics in static storage: no allocation, no locks and no
+ * thread-local storage.  Live threads are tracked in a fixed-size table;
+ * if more than thread_telemetry::max_tracked threads are alive at once the
+ * excess is counted in the dropped field and left out of lifetime data.
+ *
+ * snapshot() is a few hundred relaxed loads and may be called from any
+ * thread at any rate.  Differencing two snapshots with churn_per_second()
+ * gives the thread start rate over the interval, which is the quantity to
+ * alert on when looking for thread explosions.  The creators table
+ * attributes creations to the code that called pthread_create(), decoded
+ * from the creating thread's frame chain with pthread_stack_frame_decode_np().
+ *
+ * This is an introspection facility; as with <pthread/introspection.h>
+ * itself, do not let program behaviour depend on it.
+ */
+
+#ifndef __PTHREAD_INTROSPECTION_STATS__
+#define __PTHREAD_INTROSPECTION_STATS__
+
+#if defined(__cplusplus)
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#if defined(__APPLE__)
+#include <dlfcn.h>
+#include <mach-o/getsect.h>
+#include <pthread/introspection.h>
+#include <pthread/stack_np.h>
+#else
+enum {
+	PTHREAD_INTROSPECTION_THREAD_CREATE = 1,
+	PTHREAD_INTROSPECTION_THREAD_START,
+	PTHREAD_INTROSPECTION_THREAD_TERMINATE,
+	PTHREAD_INTROSPECTION_THREAD_DESTROY,
+};
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace darwin {
+
+/*! @abstract Number of log2 buckets in each histogram.                     */
+static constexpr unsigned thread_telemetry_buckets = 32;
+/*! @abstract Number of distinct thread-creating call sites tracked.        */
+static constexpr unsigned thread_telemetry_sites = 32;
+/*! @abstract Frames recorded per creating call site.                       */
+static constexpr unsigned thread_telemetry_site_depth = 4;
+
+/*!
+ * @abstract A point-in-time copy of the telemetry counters.
+ *
+ * @discussion
+ * stack_histogram[i] counts started threads whose stack size s satisfies
+ * 2^(i+12) <= s < 2^(i+13), with bucket 0 also holding anything smaller than
+ * 4 KiB.  lifetime_histogram[i] counts terminated threads that ran for
+ * [2^i, 2^(i+1)) microseconds, bucket 0 also holding anything under 1 us.
+ */
+struct thread_telemetry_snapshot {
+	uint64_t timestamp_ns;		/* monotonic */
+	uint64_t created;
+	uint64_t started;
+	uint64_t terminated;
+	uint64_t destroyed;
+	uint64_t live;			/* tracked, started and not yet terminated */
+	uint64_t peak_live;
+	uint64_t live_stack_bytes;
+	uint64_t dropped;		/* threads not tracked: table full */
+	uint64_t stack_histogram[thread_telemetry_buckets];
+	uint64_t lifetime_histogram[thread_telemetry_buckets];
+
+	struct creator {
+		uintptr_t frames[thread_telemetry_site_depth];	/* innermost first */
+		uint64_t count;
+	} creators[thread_telemetry_sites];
+};
+
+class thread_telemetry {
+public:
+	/*! @abstract Concurrently live threads whose lifetimes can be tracked. */
+	static constexpr unsigned max_tracked = 4096;
+
+	/*!
+	 * @abstract Installs the hook, once per process.
+	 *
+	 * @discussion
+	 * Threads already running when install() is called are not counted as
+	 * live; their termination is still counted but contributes no lifetime.
+	 * There is no uninstall: another tool may have chained behind this hook.
+	 * Use set_enabled(false) to stop recording.
+	 *
+	 * @result
+	 * true if the hook is installed, false on platforms without
+	 * <pthread/introspection.h>.
+	 */
+	static bool install() {
+#if defined(__APPLE__)
+		state &s = get();
+		bool expected = false;
+		if (s.installed.compare_exchange_strong(expected, true)) {
+			find_libpthread(s);
+			s.enabled.store(true, std::memory_order_relaxed);
+			pthread_introspection_hook_t prev = pthread_introspection_hook_install(&hook);
+			s.previous.store(prev, std::memory_order_release);
+		}
+		return true;
+#else
+		get().enabled.store(true, std::memory_order_relaxed);
+		return false;
+#endif
+	}
+
+	static void set_enabled(bool enabled) {
+		get().enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	/*!
+	 * @abstract Feeds one event into the counters.
+	 *
+	 * @discussion
+	 * This is what the installed hook calls.  It is public so that platforms
+	 * without the introspection hook can drive the telemetry from their own
+	 * pthread_create() interposer.
+	 */
+	static void record(unsigned int event, pthread_t thread, void *addr, size_t size) {
+		record_from(event, thread, addr, size, (uintptr_t)__builtin_frame_address(0));
+	}
+
+	/*! @abstract Copies the current counters.  Lock-free and allocation-free. */
+	static void snapshot(thread_telemetry_snapshot &out) {
+		state &s = get();
+		out.timestamp_ns = now_ns();
+		out.created = s.created.load(std::memory_order_relaxed);
+		out.started = s.started.load(std::memory_order_relaxed);
+		out.terminated = s.terminated.load(std::memory_order_relaxed);
+		out.destroyed = s.destroyed.load(std::memory_order_relaxed);
+		out.live = s.live.load(std::memory_order_relaxed);
+		out.peak_live = s.peak_live.load(std::memory_order_relaxed);
+		out.live_stack_bytes = s.live_stack_bytes.load(std::memory_order_relaxed);
+		out.dropped = s.dropped.load(std::memory_order_relaxed);
+		for (unsigned i = 0; i < thread_telemetry_buckets; i++) {
+			out.stack_histogram[i] = s.stack_histogram[i].load(std::memory_order_relaxed);
+			out.lifetime_histogram[i] = s.lifetime_histogram[i].load(std::memory_order_relaxed);
+		}
+		for (unsigned i = 0; i < thread_telemetry_sites; i++) {
+			for (unsigned f = 0; f < thread_telemetry_site_depth; f++)
+				out.creators[i].frames[f] = s.creators[i].frames[f].load(std::memory_order_relaxed);
+			out.creators[i].count = s.creators[i].count.load(std::memory_order_relaxed);
+		}
+	}
+
+	/*! @abstract Thread starts per second between two snapshots.           */
+	static double churn_per_second(const thread_telemetry_snapshot &before,
+	    const thread_telemetry_snapshot &after) {
+		if (after.timestamp_ns <= before.timestamp_ns)
+			return 0.0;
+		return (double)(after.started - before.started) * 1e9 /
+		    (double)(after.timestamp_ns - before.timestamp_ns);
+	}
+
+private:
+	struct slot {
+		std::atomic<uintptr_t> key;
+		std::atomic<uint64_t> started_ns;
+		std::atomic<uint64_t> stack_size;
+	};
+
+	struct site {
+		std::atomic<uintptr_t> hash;
+		std::atomic<uintptr_t> frames[thread_telemetry_site_depth];
+		std::atomic<uint64_t> count;
+	};
+
+	struct state {
+		std::atomic<bool> installed;
+		std::atomic<bool> enabled;
+#if defined(__APPLE__)
+		std::atomic<pthread_introspection_hook_t> previous;
+		std::atomic<bool> walk_frames;		/* pthread_stack_frame_decode_np() exists */
+		std::atomic<uintptr_t> libpthread_lo, libpthread_hi;	/* its __TEXT */
+#endif
+		std::atomic<uint64_t> created, started, terminated, destroyed;
+		std::atomic<uint64_t> live, peak_live, live_stack_bytes, dropped;
+		std::atomic<uint64_t> stack_histogram[thread_telemetry_buckets];
+		std::atomic<uint64_t> lifetime_histogram[thread_telemetry_buckets];
+		slot table[max_tracked];
+		std::atomic<uint64_t> tracked;		/* slots held or being claimed */
+		std::atomic<unsigned> probe_limit;	/* longest probe of a held slot, plus one */
+		std::atomic<unsigned> sweeps;		/* odd while drained() runs */
+		site creators[thread_telemetry_sites];
+	};
+
+	static constexpr uintptr_t empty_key = 0;
+	static constexpr uintptr_t tombstone_key = 1;
+
+	/* Zero-initialized static storage: no constructor runs in the hook. */
+	static state &get() {
+		static state s;
+		return s;
+	}
+
+	static uint64_t now_ns() {
+#if defined(__APPLE__)
+		return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+	}
+
+	static unsigned bucket(uint64_t v) {
+		if (v <= 1)
+			return 0;
+		unsigned b = 63 - (unsigned)__builtin_clzll(v);
+		return b < thread_telemetry_buckets ? b : thread_telemetry_buckets - 1;
+	}
+
+	static unsigned hash_slot(uintptr_t key) {
+		uint64_t h = (uint64_t)key * 0x9E3779B97F4A7C15ull;
+		return (unsigned)(h >> 40) % max_tracked;
+	}
+
+	/*
+	 * Takes the first free or released slot from the key's home.  Every held
+	 * key lies within probe_limit of its home, so lookups need not stop at
+	 * an empty slot and released slots never need emptying.
+	 */
+	static slot *claim(state &s, uintptr_t key) {
+		unsigned i = hash_slot(key);
+		for (unsigned probe = 0; probe < max_tracked; probe++, i = (i + 1) % max_tracked) {
+			uintptr_t cur = s.table[i].key.load(std::memory_order_relaxed);
+			if (cur == empty_key || cur == tombstone_key) {
+				if (s.table[i].key.compare_exchange_strong(cur, key, std::memory_order_acq_rel)) {
+					unsigned limit = s.probe_limit.load(std::memory_order_relaxed);
+					while (probe + 1 > limit &&
+					    !s.probe_limit.compare_exchange_weak(limit, probe + 1))
+						;
+					return &s.table[i];
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	/*
+	 * An untracked thread, one started before install(), costs probe_limit
+	 * probes.  A miss is only trusted if no drained() overlapped it.
+	 */
+	static slot *lookup(state &s, uintptr_t key) {
+		for (;;) {
+			unsigned sweeps = s.sweeps.load();
+			if (sweeps & 1) {
+				sched_yield();
+				continue;
+			}
+			unsigned i = hash_slot(key);
+			unsigned limit = s.probe_limit.load();
+			for (unsigned probe = 0; probe < limit; probe++, i = (i + 1) % max_tracked) {
+				if (s.table[i].key.load(std::memory_order_acquire) == key)
+					return &s.table[i];
+			}
+			if (s.sweeps.load() == sweeps)
+				return nullptr;
+		}
+	}
+
+	static void release(slot *e) {
+		e->key.store(tombstone_key, std::memory_order_release);
+	}
+
+	/*
+	 * The table has drained: start probe_limit again from zero.  Released
+	 * slots need not be emptied, claims reuse them and lookups are bounded by
+	 * probe_limit rather than by an empty slot.  A claim that raced in either
+	 * raises the limit itself, after the reset, or is seen through tracked
+	 * and gets the old one back.
+	 */
+	static void drained(state &s) {
+		unsigned sweeps = s.sweeps.load();
+		if ((sweeps & 1) || !s.sweeps.compare_exchange_strong(sweeps, sweeps + 1))
+			return;
+		unsigned limit = s.probe_limit.exchange(0);
+		if (s.tracked.load() != 0) {
+			unsigned cur = s.probe_limit.load();
+			while (limit > cur && !s.probe_limit.compare_exchange_weak(cur, limit))
+				;
+		}
+		s.sweeps.store(sweeps + 2);
+	}
+
+	/*
+	 * from is the frame of whoever called into the telemetry; creators are
+	 * attributed from the first frame above it outside libpthread.
+	 */
+	static void record_from(unsigned int event, pthread_t thread, void *addr, size_t size, uintptr_t from) {
+		state &s = get();
+		if (!s.enabled.load(std::memory_order_relaxed))
+			return;
+		(void)addr;
+		uintptr_t key = (uintptr_t)thread;
+		uint64_t now = now_ns();
+
+		switch (event) {
+		case PTHREAD_INTROSPECTION_THREAD_CREATE: {
+			s.created.fetch_add(1, std::memory_order_relaxed);
+			record_creator(s, from);
+			break;
+		}
+		case PTHREAD_INTROSPECTION_THREAD_START: {
+			s.started.fetch_add(1, std::memory_order_relaxed);
+			s.stack_histogram[bucket(size >> 12)].fetch_add(1, std::memory_order_relaxed);
+			s.tracked.fetch_add(1);
+			slot *e = claim(s, key);
+			if (!e) {
+				/* Its termination cannot be matched: keep it out of live. */
+				s.dropped.fetch_add(1, std::memory_order_relaxed);
+				if (s.tracked.fetch_sub(1) == 1)
+					drained(s);
+				break;
+			}
+			e->started_ns.store(now, std::memory_order_relaxed);
+			e->stack_size.store(size, std::memory_order_relaxed);
+			uint64_t live = s.live.fetch_add(1, std::memory_order_relaxed) + 1;
+			uint64_t peak = s.peak_live.load(std::memory_order_relaxed);
+			while (live > peak && !s.peak_live.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+				;
+			s.live_stack_bytes.fetch_add(size, std::memory_order_relaxed);
+			break;
+		}
+		case PTHREAD_INTROSPECTION_THREAD_TERMINATE: {
+			s.terminated.fetch_add(1, std::memory_order_relaxed);
+			slot *e = lookup(s, key);
+			if (!e)
+				break;
+			uint64_t started = e->started_ns.load(std::memory_order_relaxed);
+			uint64_t stack = e->stack_size.load(std::memory_order_relaxed);
+			release(e);
+			s.live.fetch_sub(1, std::memory_order_relaxed);
+			s.live_stack_bytes.fetch_sub(stack, std::memory_order_relaxed);
+			if (s.tracked.fetch_sub(1) == 1)
+				drained(s);
+			uint64_t us = now > started ? (now - started) / 1000 : 0;
+			s.lifetime_histogram[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+			break;
+		}
+		case PTHREAD_INTROSPECTION_THREAD_DESTROY:
+			s.destroyed.fetch_add(1, std::memory_order_relaxed);
+			break;
+		}
+	}
+
+#if defined(__APPLE__)
+	/*
+	 * Runs once, from install(): the hook must not take dyld's lock or pay
+	 * for an availability check on every event.
+	 */
+	static void find_libpthread(state &s) {
+		if (__builtin_available(iOS 12.0, macOS 10.14, *))
+			s.walk_frames.store(true, std::memory_order_relaxed);
+		Dl_info info;
+		if (!dladdr((const void *)&pthread_create, &info) || !info.dli_fbase)
+			return;
+		unsigned long size = 0;
+#if __LP64__
+		uint8_t *text = getsegmentdata((const struct mach_header_64 *)info.dli_fbase, "__TEXT", &size);
+#else
+		uint8_t *text = getsegmentdata((const struct mach_header *)info.dli_fbase, "__TEXT", &size);
+#endif
+		if (!text)
+			return;
+		s.libpthread_lo.store((uintptr_t)text, std::memory_order_relaxed);
+		s.libpthread_hi.store((uintptr_t)text + size, std::memory_order_relaxed);
+	}
+#endif
+
+	/*
+	 * Attributes a creation to the frames above pthread_create().  However
+	 * much of libpthread and of this class got inlined, the walk starts at
+	 * the caller's frame and drops return addresses inside libpthread.
+	 */
+	static void record_creator(state &s, uintptr_t from) {
+		uintptr_t frames[thread_telemetry_site_depth] = {};
+#if defined(__APPLE__)
+		if (s.walk_frames.load(std::memory_order_relaxed)) {
+			pthread_t self = pthread_self();
+			uintptr_t hi = (uintptr_t)pthread_get_stackaddr_np(self);
+			uintptr_t lo = hi - pthread_get_stacksize_np(self);
+			uintptr_t skip_lo = s.libpthread_lo.load(std::memory_order_relaxed);
+			uintptr_t skip_hi = s.libpthread_hi.load(std::memory_order_relaxed);
+			uintptr_t fp = from;
+			unsigned n = 0;
+			for (unsigned depth = 0; n < thread_telemetry_site_depth && depth < 64; depth++) {
+				if (fp < lo || fp >= hi || (fp & (sizeof(void *) - 1)))
+					break;
+				uintptr_t ret = 0;
+				uintptr_t next = pthread_stack_frame_decode_np(fp, &ret);
+				if (ret && (ret < skip_lo || ret >= skip_hi))
+					frames[n++] = ret;
+				if (next <= fp)
+					break;
+				fp = next;
+			}
+		}
+#else
+		(void)from;
+#endif
+		uint64_t fnv = 0xcbf29ce484222325ull;
+		for (unsigned f = 0; f < thread_telemetry_site_depth; f++)
+			fnv = (fnv ^ (uint64_t)frames[f]) * 0x100000001b3ull;
+		uintptr_t h = (uintptr_t)fnv ? (uintptr_t)fnv : 1;
+
+		unsigned i = (unsigned)(h % thread_telemetry_sites);
+		for (unsigned probe = 0; probe < thread_telemetry_sites; probe++, i = (i + 1) % thread_telemetry_sites) {
+			site &st = s.creators[i];
+			uintptr_t cur = st.hash.load(std::memory_order_acquire);
+			if (cur == 0) {
+				if (!st.hash.compare_exchange_strong(cur, h, std::memory_order_acq_rel) && cur != h)
+					continue;
+				if (cur == 0) {
+					for (unsigned f = 0; f < thread_telemetry_site_depth; f++)
+						st.frames[f].store(frames[f], std::memory_order_relaxed);
+				}
+				st.count.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			if (cur == h) {
+				st.count.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+		}
+	}
+
+#if defined(__APPLE__)
+	__attribute__((noinline))
+	static void hook(unsigned int event, pthread_t thread, void *addr, size_t size) {
+		record_from(event, thread, addr, size, (uintptr_t)__builtin_frame_address(0));
+		pthread_introspection_hook_t prev = get().previous.load(std::memory_order_acquire);
+		if (prev)
+			prev(event, thread, addr, size);
+	}
+#endif
+};
+
+} /* namespace darwin */
+
+#endif /* __cplusplus */
+
+#endif /* __PTHREAD_INTROSPECTION_STATS__ */
@@ -0,0 +1,541 @@
+/*!
+ * @header
+ *
+ * @abstract
+ * A work-stealing thread pool in which every task carries a QOS class.
+ *
+ * @discussion
+ * Each worker owns one run queue per QOS class, and the pool keeps one
+ * shared injection queue per class for submissions from threads outside the
+ * pool.  A worker always looks for the highest class first: its own queue,
+ * then the injection queue, then the other workers' queues for that class,
+ * before moving on to the next lower class.  Before running a task the
+ * worker adopts the task's class with pthread_set_qos_class_self_np(), so
+ * the kernel schedules the thread exactly as it would a dedicated thread of
+ * that class.
+ *
+ * A flood of QOS_CLASS_BACKGROUND work can still occupy every worker for the
+ * length of one task.  Set qos_pool::options::reserved_workers to keep some
+ * workers for QOS_CLASS_USER_INITIATED and above only.
+ *
+ * Waiting on a qos_task avoids priority inversion in two ways.  If the task
+ * has not started, the waiting thread claims it and runs it inline at the
+ * waiter's own class.  If it is already running on a worker at a lower
+ * class, the waiter applies pthread_override_qos_class_start_np() to that
+ * worker for the duration of the wait.
+ *
+ * On platforms without <pthread/qos.h> the QOS calls compile to no-ops and
+ * the pool keeps its scheduling order, so it can be exercised off-device.
+ *
+ * This header is C++ only and has no link-time dependencies beyond the C++
+ * runtime and libpthread.
+ */
+
+#ifndef __PTHREAD_QOS_POOL__
+#define __PTHREAD_QOS_POOL__
+
+#if defined(__cplusplus)
+
+#include <pthread.h>
+
+#if defined(__APPLE__)
+#include <pthread/qos.h>
+#else
+enum qos_class_t : unsigned int {
+	QOS_CLASS_USER_INTERACTIVE = 0x21,
+	QOS_CLASS_USER_INITIATED = 0x19,
+	QOS_CLASS_DEFAULT = 0x15,
+	QOS_CLASS_UTILITY = 0x11,
+	QOS_CLASS_BACKGROUND = 0x09,
+	QOS_CLASS_UNSPECIFIED = 0x00,
+};
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace darwin {
+
+/*! @abstract Number of QOS classes the pool schedules.                     */
+static constexpr unsigned qos_levels = 5;
+
+/*! @abstract Maps a qos_class_t to a run-queue level, 0 being the highest. */
+inline unsigned qos_level(qos_class_t qos) {
+	switch (qos) {
+	case QOS_CLASS_USER_INTERACTIVE: return 0;
+	case QOS_CLASS_USER_INITIATED: return 1;
+	case QOS_CLASS_UTILITY: return 3;
+	case QOS_CLASS_BACKGROUND: return 4;
+	default: return 2;
+	}
+}
+
+/*! @abstract The inverse of qos_level().                                   */
+inline qos_class_t qos_class_at(unsigned level) {
+	static const qos_class_t classes[qos_levels] = {
+		QOS_CLASS_USER_INTERACTIVE, QOS_CLASS_USER_INITIATED,
+		QOS_CLASS_DEFAULT, QOS_CLASS_UTILITY, QOS_CLASS_BACKGROUND,
+	};
+	return classes[level < qos_levels ? level : 2];
+}
+
+namespace qos_detail {
+
+/* QOS class the calling thread is running at, as far as the pool knows. */
+inline qos_class_t &current_class() {
+	static thread_local qos_class_t qos = QOS_CLASS_UNSPECIFIED;
+	return qos;
+}
+
+inline qos_class_t self_class() {
+	qos_class_t q = current_class();
+#if defined(__APPLE__)
+	if (q == QOS_CLASS_UNSPECIFIED)
+		q = qos_class_self();
+#endif
+	return q == QOS_CLASS_UNSPECIFIED ? QOS_CLASS_DEFAULT : q;
+}
+
+inline void set_self_class(qos_class_t qos) {
+	if (current_class() == qos)
+		return;
+#if defined(__APPLE__)
+	pthread_set_qos_class_self_np(qos, 0);
+#endif
+	current_class() = qos;
+}
+
+struct override_token {
+#if defined(__APPLE__)
+	pthread_override_t o = nullptr;
+#endif
+};
+
+inline override_token override_start(pthread_t thread, qos_class_t qos) {
+	override_token t;
+#if defined(__APPLE__)
+	t.o = pthread_override_qos_class_start_np(thread, qos, 0);
+#else
+	(void)thread;
+	(void)qos;
+#endif
+	return t;
+}
+
+inline void override_end(override_token &t) {
+#if defined(__APPLE__)
+	if (t.o)
+		pthread_override_qos_class_end_np(t.o);
+	t.o = nullptr;
+#else
+	(void)t;
+#endif
+}
+
+/* Ends the override it started, however the wait that holds it returns. */
+struct override_scope {
+	override_token t;
+	bool active = false;
+
+	override_scope() = default;
+	override_scope(const override_scope &) = delete;
+	override_scope &operator=(const override_scope &) = delete;
+	~override_scope() {
+		if (active)
+			override_end(t);
+	}
+
+	void start(pthread_t thread, qos_class_t qos) {
+		t = override_start(thread, qos);
+		active = true;
+	}
+};
+
+/* This thread's pthread_t, at an address that lives as long as the thread. */
+inline pthread_t *self_thread() {
+	static thread_local pthread_t self = pthread_self();
+	return &self;
+}
+
+inline uint64_t now_ns() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+	    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+enum : int { PENDING, RUNNING, DONE };
+
+struct counters {
+	std::atomic<uint64_t> executed[qos_levels];
+	std::atomic<uint64_t> inlined[qos_levels];
+	std::atomic<uint64_t> stolen[qos_levels];
+	std::atomic<uint64_t> overrides[qos_levels];
+	std::atomic<uint64_t> wait_ns_total[qos_levels];
+	std::atomic<uint64_t> wait_ns_max[qos_levels];
+};
+
+struct task_state {
+	std::function<void()> fn;
+	qos_class_t qos;
+	uint64_t enqueued_ns;
+	std::atomic<int> state{ PENDING };
+	std::atomic<pthread_t *> runner{ nullptr };
+	counters *stats;
+	std::mutex mu;
+	std::condition_variable cv;
+};
+
+} /* namespace qos_detail */
+
+/*!
+ * @abstract A handle to a submitted task.
+ *
+ * @discussion
+ * Handles are cheap to copy.  Dropping every handle does not cancel the task.
+ */
+class qos_task {
+	friend class qos_pool;
+	std::shared_ptr<qos_detail::task_state> s_;
+	explicit qos_task(std::shared_ptr<qos_detail::task_state> s) : s_(std::move(s)) {}
+
+public:
+	qos_task() = default;
+
+	bool valid() const { return s_ != nullptr; }
+	bool done() const { return s_ && s_->state.load(std::memory_order_acquire) == qos_detail::DONE; }
+	qos_class_t qos_class() const { return s_ ? s_->qos : QOS_CLASS_UNSPECIFIED; }
+
+	/*!
+	 * @abstract Blocks until the task has run.
+	 *
+	 * @discussion
+	 * A task that has not started is run inline on the calling thread.  A
+	 * task running on a worker at a lower class than the caller has its
+	 * worker's class overridden until it completes.
+	 */
+	void wait();
+};
+
+/*!
+ * @abstract Per-class counters returned by qos_pool::stats().
+ */
+struct qos_pool_stats {
+	uint64_t executed[qos_levels];		/* tasks run by workers */
+	uint64_t inlined[qos_levels];		/* tasks claimed by a waiter */
+	uint64_t stolen[qos_levels];		/* tasks taken from another worker */
+	uint64_t overrides[qos_levels];		/* overrides applied, by waiter class */
+	uint64_t wait_ns_total[qos_levels];	/* enqueue-to-start latency */
+	uint64_t wait_ns_max[qos_levels];
+};
+
+class qos_pool {
+public:
+	struct options {
+		/*! Number of workers; 0 selects std::thread::hardware_concurrency(). */
+		unsigned threads = 0;
+		/*! Workers that only run USER_INITIATED and USER_INTERACTIVE tasks. */
+		unsigned reserved_workers = 0;
+		/*! Class workers return to while idle.                           */
+		qos_class_t idle_class = QOS_CLASS_UTILITY;
+	};
+
+	qos_pool() : qos_pool(options()) {}
+
+	explicit qos_pool(const options &opt) : opt_(opt) {
+		unsigned n = opt.threads ? opt.threads : std::thread::hardware_concurrency();
+		if (n == 0)
+			n = 1;
+		if (opt_.reserved_workers >= n)
+			opt_.reserved_workers = n - 1;
+		for (unsigned l = 0; l < qos_levels; l++) {
+			queued_[l].store(0);
+			stats_.executed[l].store(0);
+			stats_.inlined[l].store(0);
+			stats_.stolen[l].store(0);
+			stats_.overrides[l].store(0);
+			stats_.wait_ns_total[l].store(0);
+			stats_.wait_ns_max[l].store(0);
+		}
+		workers_.reserve(n);
+		for (unsigned i = 0; i < n; i++)
+			workers_.emplace_back(new worker(i, i < opt_.reserved_workers ? 1 : qos_levels - 1));
+		for (unsigned i = 0; i < n; i++)
+			workers_[i]->thread = std::thread(&qos_pool::run_worker, this, i);
+	}
+
+	qos_pool(const qos_pool &) = delete;
+	qos_pool &operator=(const qos_pool &) = delete;
+
+	/*! @abstract Runs every queued task, then joins the workers.            */
+	~qos_pool() {
+		{
+			std::lock_guard<std::mutex> g(sleep_mu_);
+			stopping_ = true;
+		}
+		sleep_cv_.notify_all();
+		for (auto &w : workers_)
+			w->thread.join();
+	}
+
+	unsigned size() const { return (unsigned)workers_.size(); }
+
+	/*!
+	 * @abstract Queues fn to run at the given class.
+	 *
+	 * @discussion
+	 * Called from a worker, the task goes on that worker's own queue, where
+	 * it is run last-in first-out by the owner and stolen first-in first-out
+	 * by others.  Called from any other thread, it goes on the shared queue.
+	 */
+	template <class F>
+	qos_task submit(qos_class_t qos, F &&fn) {
+		auto s = std::make_shared<qos_detail::task_state>();
+		s->fn = std::forward<F>(fn);
+		s->qos = qos_class_at(qos_level(qos));
+		s->enqueued_ns = qos_detail::now_ns();
+		s->stats = &stats_;
+		unsigned level = qos_level(s->qos);
+
+		worker *self = current_worker();
+		queue &q = self ? self->queues[level] : injected_[level];
+		{
+			std::lock_guard<std::mutex> g(q.mu);
+			q.items.push_back(s);
+		}
+		queued_[level].fetch_add(1, std::memory_order_release);
+		wake(level);
+		return qos_task(std::move(s));
+	}
+
+	/*! @abstract Runs a task at the calling thread's current class.         */
+	template <class F>
+	qos_task submit(F &&fn) { return submit(qos_detail::self_class(), std::forward<F>(fn)); }
+
+	/*! @abstract A consistent-enough copy of the pool counters.             */
+	qos_pool_stats stats() const {
+		qos_pool_stats s;
+		for (unsigned l = 0; l < qos_levels; l++) {
+			s.executed[l] = stats_.executed[l].load(std::memory_order_relaxed);
+			s.inlined[l] = stats_.inlined[l].load(std::memory_order_relaxed);
+			s.stolen[l] = stats_.stolen[l].load(std::memory_order_relaxed);
+			s.overrides[l] = stats_.overrides[l].load(std::memory_order_relaxed);
+			s.wait_ns_total[l] = stats_.wait_ns_total[l].load(std::memory_order_relaxed);
+			s.wait_ns_max[l] = stats_.wait_ns_max[l].load(std::memory_order_relaxed);
+		}
+		return s;
+	}
+
+private:
+	friend class qos_task;
+	typedef std::shared_ptr<qos_detail::task_state> task_ptr;
+
+	struct queue {
+		std::mutex mu;
+		std::deque<task_ptr> items;
+	};
+
+	struct worker {
+		unsigned index;
+		unsigned lowest_level;	/* lowest-priority level this worker serves */
+		pthread_t pthread;
+		std::thread thread;
+		queue queues[qos_levels];
+		worker(unsigned i, unsigned lowest) : index(i), lowest_level(lowest) {}
+	};
+
+	options opt_;
+	std::vector<std::unique_ptr<worker> > workers_;
+	queue injected_[qos_levels];
+	std::atomic<uint64_t> queued_[qos_levels];
+	qos_detail::counters stats_;
+
+	std::mutex sleep_mu_;
+	std::condition_variable sleep_cv_;
+	std::condition_variable reserved_cv_;
+	unsigned sleepers_ = 0;
+	bool stopping_ = false;
+
+	struct tls_slot {
+		const qos_pool *pool;
+		worker *w;
+	};
+
+	static tls_slot &tls() {
+		static thread_local tls_slot slot = { nullptr, nullptr };
+		return slot;
+	}
+
+	worker *current_worker() const {
+		return tls().pool == this ? tls().w : nullptr;
+	}
+
+	void wake(unsigned level) {
+		std::lock_guard<std::mutex> g(sleep_mu_);
+		if (sleepers_ == 0)
+			return;
+		sleep_cv_.notify_one();
+		if (level <= 1)
+			reserved_cv_.notify_one();
+	}
+
+	static task_ptr pop_back(queue &q) {
+		std::lock_guard<std::mutex> g(q.mu);
+		if (q.items.empty())
+			return task_ptr();
+		task_ptr t = std::move(q.items.back());
+		q.items.pop_back();
+		return t;
+	}
+
+	static task_ptr pop_front(queue &q) {
+		std::lock_guard<std::mutex> g(q.mu);
+		if (q.items.empty())
+			return task_ptr();
+		task_ptr t = std::move(q.items.front());
+		q.items.pop_front();
+		return t;
+	}
+
+	/* Finds the highest-class runnable task for worker w, or null. */
+	task_ptr find_work(worker &w, unsigned &level_out) {
+		for (unsigned l = 0; l <= w.lowest_level; l++) {
+			if (queued_[l].load(std::memory_order_acquire) == 0)
+				continue;
+			task_ptr t = pop_back(w.queues[l]);
+			if (!t)
+				t = pop_front(injected_[l]);
+			if (!t) {
+				size_t n = workers_.size();
+				for (size_t k = 1; k < n && !t; k++) {
+					t = pop_front(workers_[(w.index + k) % n]->queues[l]);
+					if (t)
+						stats_.stolen[l].fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+			if (t) {
+				queued_[l].fetch_sub(1, std::memory_order_acq_rel);
+				level_out = l;
+				return t;
+			}
+		}
+		return task_ptr();
+	}
+
+	bool has_eligible_work(const worker &w) const {
+		for (unsigned l = 0; l <= w.lowest_level; l++)
+			if (queued_[l].load(std::memory_order_acquire))
+				return true;
+		return false;
+	}
+
+	void record_start(const qos_detail::task_state &s, unsigned level) {
+		uint64_t waited = qos_detail::now_ns() - s.enqueued_ns;
+		stats_.wait_ns_total[level].fetch_add(waited, std::memory_order_relaxed);
+		uint64_t prev = stats_.wait_ns_max[level].load(std::memory_order_relaxed);
+		while (waited > prev && !stats_.wait_ns_max[level].compare_exchange_weak(prev, waited))
+			;
+	}
+
+	static void finish(qos_detail::task_state &s) {
+		s.fn = nullptr;
+		{
+			std::lock_guard<std::mutex> g(s.mu);
+			s.state.store(qos_detail::DONE, std::memory_order_release);
+		}
+		s.cv.notify_all();
+	}
+
+	void run_worker(unsigned index) {
+		worker &w = *workers_[index];
+		w.pthread = pthread_self();
+		tls().pool = this;
+		tls().w = &w;
+		qos_detail::set_self_class(opt_.idle_class);
+
+		for (;;) {
+			unsigned level;
+			task_ptr t = find_work(w, level);
+			if (t) {
+				int expected = qos_detail::PENDING;
+				/* A waiter may already have claimed and run it inline. */
+				if (!t->state.compare_exchange_strong(expected, qos_detail::RUNNING))
+					continue;
+				t->runner.store(&w.pthread, std::memory_order_release);
+				record_start(*t, level);
+				qos_detail::set_self_class(t->qos);
+				t->fn();
+				finish(*t);
+				stats_.executed[level].fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			qos_detail::set_self_class(opt_.idle_class);
+			std::unique_lock<std::mutex> g(sleep_mu_);
+			if (has_eligible_work(w))
+				continue;
+			if (stopping_)
+				break;
+			sleepers_++;
+			std::condition_variable &cv = w.lowest_level < qos_levels - 1 ? reserved_cv_ : sleep_cv_;
+			cv.wait_for(g, std::chrono::milliseconds(100));
+			sleepers_--;
+		}
+		tls().pool = nullptr;
+		tls().w = nullptr;
+	}
+};
+
+inline void qos_task::wait() {
+	if (!s_)
+		return;
+	qos_detail::task_state &s = *s_;
+	if (s.state.load(std::memory_order_acquire) == qos_detail::DONE)
+		return;
+
+	qos_class_t mine = qos_detail::self_class();
+	int expected = qos_detail::PENDING;
+	if (s.state.compare_exchange_strong(expected, qos_detail::RUNNING)) {
+		/*
+		 * Not started: run it here, at our class.  Its queue entry is
+		 * skipped, and later waiters override this thread.
+		 */
+		s.runner.store(qos_detail::self_thread(), std::memory_order_release);
+		s.stats->inlined[qos_level(s.qos)].fetch_add(1, std::memory_order_relaxed);
+		s.fn();
+		qos_pool::finish(s);
+		return;
+	}
+
+	/*
+	 * Whoever claimed the task publishes itself as runner just after the
+	 * claim; wait out that window rather than block without an override.
+	 */
+	pthread_t *runner;
+	while (!(runner = s.runner.load(std::memory_order_acquire)) &&
+	    s.state.load(std::memory_order_acquire) == qos_detail::RUNNING)
+		std::this_thread::yield();
+
+	qos_detail::override_scope scope;
+	if (runner && qos_level(mine) < qos_level(s.qos) &&
+	    s.state.load(std::memory_order_acquire) != qos_detail::DONE) {
+		scope.start(*runner, mine);
+		s.stats->overrides[qos_level(mine)].fetch_add(1, std::memory_order_relaxed);
+	}
+	std::unique_lock<std::mutex> g(s.mu);
+	s.cv.wait(g, [&] { return s.state.load(std::memory_order_acquire) == qos_detail::DONE; });
+}
+
+} /* namespace darwin */
+
+#endif /* __cplusplus */
+
+#endif /* __PTHREAD_QOS_POOL__ */
@@ -0,0 +1,791 @@
+/*! @header
+ *  An adaptive radix tree (ART) over unsigned integer keys, with the
+ *  ordered-lookup interface of <sys/rbtree.h>.
+ *
+ *  Keys are decomposed into bytes, most significant first, and each level of
+ *  the tree dispatches on one byte.  Interior nodes grow through four sizes
+ *  (4, 16, 48 and 256 children) so sparse levels stay small, single-child
+ *  chains are collapsed into a stored prefix, and a leaf is placed as soon
+ *  as its key is unique.  Lookups therefore cost at most sizeof(Key) node
+ *  visits, independent of the number of keys, and never compare whole keys
+ *  until the final leaf.
+ *
+ *  The operations map onto the rbtree(3) interface as follows:
+ *
+ *      rb_tree_insert_node     insert(key, value)
+ *      rb_tree_find_node       find(key)
+ *      rb_tree_find_node_geq   find_geq(key)
+ *      rb_tree_find_node_leq   find_leq(key)
+ *      rb_tree_iterate         successor(key) / predecessor(key),
+ *                              minimum() / maximum(), scan(lo, hi, fn)
+ *      rb_tree_remove_node     erase(key)
+ *      rb_tree_count           size()
+ *
+ *  As with rbtree(3), lookups return a pointer to the stored entry, or NULL.
+ *  Entry pointers stay valid until that key is erased or the tree is
+ *  cleared.  bulk_load() builds a tree from a sorted range in linear time,
+ *  choosing the smallest node size for each level up front.
+ *
+ *  This header is C++ only and has no link-time dependencies.
+ */
+
+#ifndef _SYS_ARTREE_H_
+#define _SYS_ARTREE_H_
+
+#if defined(__cplusplus)
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace darwin {
+
+template <class Key, class T>
+class art_tree {
+	static_assert(std::is_integral<Key>::value && std::is_unsigned<Key>::value,
+	    "art_tree keys must be unsigned integers");
+
+public:
+	typedef Key key_type;
+	typedef T mapped_type;
+	typedef std::size_t size_type;
+
+	struct alignas(8) entry {
+		Key key;
+		T value;
+	};
+
+private:
+	static constexpr unsigned key_len = sizeof(Key);
+
+	enum : uint8_t { NODE4, NODE16, NODE48, NODE256 };
+
+	struct node {
+		uint8_t type;
+		uint8_t prefix_len;
+		uint16_t count;
+		uint8_t prefix[8];
+	};
+	struct node4 : node {
+		uint8_t keys[4];
+		void *child[4];
+	};
+	struct node16 : node {
+		uint8_t keys[16];
+		void *child[16];
+	};
+	struct node48 : node {
+		uint8_t index[256];	/* slot + 1, or 0 if absent */
+		void *child[48];
+	};
+	struct node256 : node {
+		void *child[256];
+	};
+
+	void *root_ = nullptr;
+	size_type size_ = 0;
+
+	/* Leaves are tagged in the low pointer bit. */
+	static bool is_leaf(const void *p) { return ((uintptr_t)p & 1) != 0; }
+	static entry *as_leaf(const void *p) { return (entry *)((uintptr_t)p & ~(uintptr_t)1); }
+	static void *tag_leaf(entry *e) { return (void *)((uintptr_t)e | 1); }
+
+	static uint8_t byte_at(Key k, unsigned depth) {
+		return (uint8_t)(k >> (8 * (key_len - 1 - depth)));
+	}
+
+public:
+	art_tree() = default;
+	art_tree(const art_tree &) = delete;
+	art_tree &operator=(const art_tree &) = delete;
+	art_tree(art_tree &&o) noexcept : root_(o.root_), size_(o.size_) {
+		o.root_ = nullptr;
+		o.size_ = 0;
+	}
+	art_tree &operator=(art_tree &&o) noexcept {
+		if (this != &o) {
+			clear();
+			std::swap(root_, o.root_);
+			std::swap(size_, o.size_);
+		}
+		return *this;
+	}
+	~art_tree() { clear(); }
+
+	size_type size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	void clear() {
+		if (root_)
+			destroy(root_);
+		root_ = nullptr;
+		size_ = 0;
+	}
+
+	/*! @abstract Exact match, or NULL.                                       */
+	entry *find(Key key) const {
+		const void *n = root_;
+		unsigned depth = 0;
+		while (n) {
+			if (is_leaf(n)) {
+				entry *e = as_leaf(n);
+				return e->key == key ? e : nullptr;
+			}
+			const node *in = static_cast<const node *>(n);
+			for (unsigned i = 0; i < in->prefix_len; i++)
+				if (in->prefix[i] != byte_at(key, depth + i))
+					return nullptr;
+			depth += in->prefix_len;
+			void *const *slot = child_slot(in, byte_at(key, depth));
+			n = slot ? *slot : nullptr;
+			depth++;
+		}
+		return nullptr;
+	}
+
+	/*! @abstract The entry with the least key not less than key, or NULL.    */
+	entry *find_geq(Key key) const { return root_ ? geq(root_, key, 0) : nullptr; }
+
+	/*! @abstract The entry with the greatest key not greater than key, or NULL. */
+	entry *find_leq(Key key) const { return root_ ? leq(root_, key, 0) : nullptr; }
+
+	/*! @abstract The entry following key in order, or NULL.                 */
+	entry *successor(Key key) const {
+		return key == (Key)~(Key)0 ? nullptr : find_geq((Key)(key + 1));
+	}
+
+	/*! @abstract The entry preceding key in order, or NULL.                 */
+	entry *predecessor(Key key) const {
+		return key == 0 ? nullptr : find_leq((Key)(key - 1));
+	}
+
+	entry *minimum() const { return root_ ? leftmost(root_) : nullptr; }
+	entry *maximum() const { return root_ ? rightmost(root_) : nullptr; }
+
+	/*!
+	 *  @abstract Calls fn(const entry &) for every key in [lo, hi], in order.
+	 *  @discussion This walks the tree once and is considerably faster than
+	 *  repeated successor() calls for long ranges.
+	 */
+	template <class F>
+	void scan(Key lo, Key hi, F &&fn) const {
+		if (root_ && lo <= hi)
+			scan_rec(root_, 0, lo, hi, true, true, fn);
+	}
+
+	template <class F>
+	void for_each(F &&fn) const { scan((Key)0, (Key)~(Key)0, fn); }
+
+	/*!
+	 *  @abstract Inserts key if it is not already present.
+	 *  @result The stored entry and whether it was newly inserted.  An
+	 *  existing entry is left untouched.
+	 */
+	std::pair<entry *, bool> insert(Key key, const T &value) {
+		entry *e = nullptr;
+		bool inserted = insert_rec(&root_, key, value, 0, e);
+		if (inserted)
+			size_++;
+		return std::make_pair(e, inserted);
+	}
+
+	/*! @abstract Removes key; returns false if it was not present.          */
+	bool erase(Key key) {
+		if (!root_)
+			return false;
+		bool removed = erase_rec(&root_, key, 0);
+		if (removed)
+			size_--;
+		return removed;
+	}
+
+	/*!
+	 *  @abstract Replaces the contents with a sorted, duplicate-free range.
+	 *  @param first,last Random-access range of std::pair<Key, T> (or
+	 *  anything with .first/.second) in strictly ascending key order.
+	 */
+	template <class RandomIt>
+	void bulk_load(RandomIt first, RandomIt last) {
+		clear();
+		if (first == last)
+			return;
+		root_ = build(first, last, 0);
+		size_ = (size_type)(last - first);
+	}
+
+private:
+	static entry *make_leaf(Key key, const T &value) {
+		return new entry{ key, value };
+	}
+
+	template <class N>
+	static N *make_node(uint8_t type) {
+		N *n = new N();
+		n->type = type;
+		n->prefix_len = 0;
+		n->count = 0;
+		return n;
+	}
+
+	static void destroy(void *p) {
+		if (is_leaf(p)) {
+			delete as_leaf(p);
+			return;
+		}
+		node *n = static_cast<node *>(p);
+		switch (n->type) {
+		case NODE4: {
+			node4 *m = static_cast<node4 *>(n);
+			for (unsigned i = 0; i < m->count; i++)
+				destroy(m->child[i]);
+			delete m;
+			break;
+		}
+		case NODE16: {
+			node16 *m = static_cast<node16 *>(n);
+			for (unsigned i = 0; i < m->count; i++)
+				destroy(m->child[i]);
+			delete m;
+			break;
+		}
+		case NODE48: {
+			node48 *m = static_cast<node48 *>(n);
+			for (unsigned i = 0; i < 256; i++)
+				if (m->index[i])
+					destroy(m->child[m->index[i] - 1]);
+			delete m;
+			break;
+		}
+		default: {
+			node256 *m = static_cast<node256 *>(n);
+			for (unsigned i = 0; i < 256; i++)
+				if (m->child[i])
+					destroy(m->child[i]);
+			delete m;
+			break;
+		}
+		}
+	}
+
+	static int node16_find(const node16 *n, uint8_t b) {
+#if defined(__SSE2__)
+		__m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char)b),
+		    _mm_loadu_si128((const __m128i *)n->keys));
+		unsigned mask = (unsigned)_mm_movemask_epi8(cmp) & ((1u << n->count) - 1);
+		return mask ? __builtin_ctz(mask) : -1;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+		uint8x16_t cmp = vceqq_u8(vdupq_n_u8(b), vld1q_u8(n->keys));
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+		    vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0);
+		if (n->count < 16)
+			mask &= (1ull << (4 * n->count)) - 1;
+		return mask ? (int)(__builtin_ctzll(mask) >> 2) : -1;
+#else
+		for (unsigned i = 0; i < n->count; i++)
+			if (n->keys[i] == b)
+				return (int)i;
+		return -1;
+#endif
+	}
+
+	static void *const *child_slot(const node *n, uint8_t b) {
+		return const_cast<void *const *>(child_slot(const_cast<node *>(n), b));
+	}
+
+	static void **child_slot(node *n, uint8_t b) {
+		switch (n->type) {
+		case NODE4: {
+			node4 *m = static_cast<node4 *>(n);
+			for (unsigned i = 0; i < m->count; i++)
+				if (m->keys[i] == b)
+					return &m->child[i];
+			return nullptr;
+		}
+		case NODE16: {
+			node16 *m = static_cast<node16 *>(n);
+			int i = node16_find(m, b);
+			return i < 0 ? nullptr : &m->child[i];
+		}
+		case NODE48: {
+			node48 *m = static_cast<node48 *>(n);
+			return m->index[b] ? &m->child[m->index[b] - 1] : nullptr;
+		}
+		default: {
+			node256 *m = static_cast<node256 *>(n);
+			return m->child[b] ? &m->child[b] : nullptr;
+		}
+		}
+	}
+
+	/*
+	 * Visits children in byte order within [lo, hi]; fn(byte, child) returns
+	 * false to stop early.  Returns false if stopped.
+	 */
+	template <class F>
+	static bool for_children(const node *n, unsigned lo, unsigned hi, bool reverse, F &&fn) {
+		switch (n->type) {
+		case NODE4:
+		case NODE16: {
+			const uint8_t *keys;
+			void *const *child;
+			if (n->type == NODE4) {
+				keys = static_cast<const node4 *>(n)->keys;
+				child = static_cast<const node4 *>(n)->child;
+			} else {
+				keys = static_cast<const node16 *>(n)->keys;
+				child = static_cast<const node16 *>(n)->child;
+			}
+			for (unsigned j = 0; j < n->count; j++) {
+				unsigned i = reverse ? n->count - 1 - j : j;
+				if (keys[i] < lo || keys[i] > hi)
+					continue;
+				if (!fn(keys[i], child[i]))
+					return false;
+			}
+			return true;
+		}
+		case NODE48: {
+			const node48 *m = static_cast<const node48 *>(n);
+			for (unsigned j = lo; j <= hi; j++) {
+				unsigned b = reverse ? hi - (j - lo) : j;
+				if (m->index[b] && !fn((uint8_t)b, m->child[m->index[b] - 1]))
+					return false;
+			}
+			return true;
+		}
+		default: {
+			const node256 *m = static_cast<const node256 *>(n);
+			for (unsigned j = lo; j <= hi; j++) {
+				unsigned b = reverse ? hi - (j - lo) : j;
+				if (m->child[b] && !fn((uint8_t)b, m->child[b]))
+					return false;
+			}
+			return true;
+		}
+		}
+	}
+
+	static entry *leftmost(const void *p) {
+		while (!is_leaf(p)) {
+			const void *next = nullptr;
+			for_children(static_cast<const node *>(p), 0, 255, false,
+			    [&](uint8_t, void *c) { next = c; return false; });
+			p = next;
+		}
+		return as_leaf(p);
+	}
+
+	static entry *rightmost(const void *p) {
+		while (!is_leaf(p)) {
+			const void *next = nullptr;
+			for_children(static_cast<const node *>(p), 0, 255, true,
+			    [&](uint8_t, void *c) { next = c; return false; });
+			p = next;
+		}
+		return as_leaf(p);
+	}
+
+	static entry *geq(const void *p, Key key, unsigned depth) {
+		if (is_leaf(p)) {
+			entry *e = as_leaf(p);
+			return e->key >= key ? e : nullptr;
+		}
+		const node *n = static_cast<const node *>(p);
+		for (unsigned i = 0; i < n->prefix_len; i++) {
+			uint8_t kb = byte_at(key, depth + i);
+			if (n->prefix[i] > kb)
+				return leftmost(n);
+			if (n->prefix[i] < kb)
+				return nullptr;
+		}
+		depth += n->prefix_len;
+		uint8_t b = byte_at(key, depth);
+		entry *found = nullptr;
+		for_children(n, b, 255, false, [&](uint8_t cb, void *c) {
+			found = cb == b ? geq(c, key, depth + 1) : leftmost(c);
+			return found == nullptr;
+		});
+		return found;
+	}
+
+	static entry *leq(const void *p, Key key, unsigned depth) {
+		if (is_leaf(p)) {
+			entry *e = as_leaf(p);
+			return e->key <= key ? e : nullptr;
+		}
+		const node *n = static_cast<const node *>(p);
+		for (unsigned i = 0; i < n->prefix_len; i++) {
+			uint8_t kb = byte_at(key, depth + i);
+			if (n->prefix[i] < kb)
+				return rightmost(n);
+			if (n->prefix[i] > kb)
+				return nullptr;
+		}
+		depth += n->prefix_len;
+		uint8_t b = byte_at(key, depth);
+		entry *found = nullptr;
+		for_children(n, 0, b, true, [&](uint8_t cb, void *c) {
+			found = cb == b ? leq(c, key, depth + 1) : rightmost(c);
+			return found == nullptr;
+		});
+		return found;
+	}
+
+	template <class F>
+	static void scan_rec(const void *p, unsigned depth, Key lo, Key hi,
+	    bool lo_tight, bool hi_tight, F &fn) {
+		if (is_leaf(p)) {
+			const entry *e = as_leaf(p);
+			if (e->key >= lo && e->key <= hi)
+				fn(*e);
+			return;
+		}
+		const node *n = static_cast<const node *>(p);
+		for (unsigned i = 0; i < n->prefix_len; i++) {
+			uint8_t pb = n->prefix[i];
+			if (lo_tight) {
+				uint8_t lb = byte_at(lo, depth + i);
+				if (pb < lb)
+					return;
+				if (pb > lb)
+					lo_tight = false;
+			}
+			if (hi_tight) {
+				uint8_t hb = byte_at(hi, depth + i);
+				if (pb > hb)
+					return;
+				if (pb < hb)
+					hi_tight = false;
+			}
+		}
+		depth += n->prefix_len;
+		unsigned lb = lo_tight ? byte_at(lo, depth) : 0;
+		unsigned hb = hi_tight ? byte_at(hi, depth) : 255;
+		for_children(n, lb, hb, false, [&](uint8_t cb, void *c) {
+			scan_rec(c, depth + 1, lo, hi, lo_tight && cb == lb, hi_tight && cb == hb, fn);
+			return true;
+		});
+	}
+
+	/* Adds a child to *ref, growing the node if it is full. */
+	static void add_child(void **ref, node *n, uint8_t b, void *child) {
+		switch (n->type) {
+		case NODE4: {
+			node4 *m = static_cast<node4 *>(n);
+			if (m->count < 4) {
+				unsigned i = 0;
+				while (i < m->count && m->keys[i] < b)
+					i++;
+				std::memmove(m->keys + i + 1, m->keys + i, m->count - i);
+				std::memmove(m->child + i + 1, m->child + i, (m->count - i) * sizeof(void *));
+				m->keys[i] = b;
+				m->child[i] = child;
+				m->count++;
+				return;
+			}
+			node16 *g = make_node<node16>(NODE16);
+			copy_header(g, m);
+			std::memcpy(g->keys, m->keys, 4);
+			std::memcpy(g->child, m->child, 4 * sizeof(void *));
+			g->count = 4;
+			*ref = g;
+			delete m;
+			add_child(ref, g, b, child);
+			return;
+		}
+		case NODE16: {
+			node16 *m = static_cast<node16 *>(n);
+			if (m->count < 16) {
+				unsigned i = 0;
+				while (i < m->count && m->keys[i] < b)
+					i++;
+				std::memmove(m->keys + i + 1, m->keys + i, m->count - i);
+				std::memmove(m->child + i + 1, m->child + i, (m->count - i) * sizeof(void *));
+				m->keys[i] = b;
+				m->child[i] = child;
+				m->count++;
+				return;
+			}
+			node48 *g = make_node<node48>(NODE48);
+			copy_header(g, m);
+			for (unsigned i = 0; i < 16; i++) {
+				g->child[i] = m->child[i];
+				g->index[m->keys[i]] = (uint8_t)(i + 1);
+			}
+			g->count = 16;
+			*ref = g;
+			delete m;
+			add_child(ref, g, b, child);
+			return;
+		}
+		case NODE48: {
+			node48 *m = static_cast<node48 *>(n);
+			if (m->count < 48) {
+				unsigned slot = 0;
+				while (m->child[slot])
+					slot++;
+				m->child[slot] = child;
+				m->index[b] = (uint8_t)(slot + 1);
+				m->count++;
+				return;
+			}
+			node256 *g = make_node<node256>(NODE256);
+			copy_header(g, m);
+			for (unsigned i = 0; i < 256; i++)
+				if (m->index[i])
+					g->child[i] = m->child[m->index[i] - 1];
+			g->count = 48;
+			*ref = g;
+			delete m;
+			add_child(ref, g, b, child);
+			return;
+		}
+		default: {
+			node256 *m = static_cast<node256 *>(n);
+			m->child[b] = child;
+			m->count++;
+			return;
+		}
+		}
+	}
+
+	static void copy_header(node *dst, const node *src) {
+		dst->prefix_len = src->prefix_len;
+		std::memcpy(dst->prefix, src->prefix, sizeof(dst->prefix));
+	}
+
+	static bool insert_rec(void **ref, Key key, const T &value, unsigned depth, entry *&out) {
+		void *p = *ref;
+		if (!p) {
+			out = make_leaf(key, value);
+			*ref = tag_leaf(out);
+			return true;
+		}
+
+		if (is_leaf(p)) {
+			entry *e = as_leaf(p);
+			if (e->key == key) {
+				out = e;
+				return false;
+			}
+			/* Lazy expansion: split the leaf at the first differing byte. */
+			node4 *n = make_node<node4>(NODE4);
+			unsigned plen = 0;
+			while (byte_at(e->key, depth + plen) == byte_at(key, depth + plen)) {
+				n->prefix[plen] = byte_at(key, depth + plen);
+				plen++;
+			}
+			n->prefix_len = (uint8_t)plen;
+			out = make_leaf(key, value);
+			add_child(ref, n, byte_at(e->key, depth + plen), p);
+			add_child(ref, n, byte_at(key, depth + plen), tag_leaf(out));
+			*ref = n;
+			return true;
+		}
+
+		node *n = static_cast<node *>(p);
+		unsigned mismatch = 0;
+		while (mismatch < n->prefix_len && n->prefix[mismatch] == byte_at(key, depth + mismatch))
+			mismatch++;
+		if (mismatch < n->prefix_len) {
+			/* The key diverges inside the compressed path: split the prefix. */
+			node4 *parent = make_node<node4>(NODE4);
+			parent->prefix_len = (uint8_t)mismatch;
+			std::memcpy(parent->prefix, n->prefix, mismatch);
+			uint8_t old_byte = n->prefix[mismatch];
+			n->prefix_len = (uint8_t)(n->prefix_len - mismatch - 1);
+			std::memmove(n->prefix, n->prefix + mismatch + 1, n->prefix_len);
+			out = make_leaf(key, value);
+			void *tmp = parent;
+			add_child(&tmp, parent, old_byte, n);
+			add_child(&tmp, parent, byte_at(key, depth + mismatch), tag_leaf(out));
+			*ref = parent;
+			return true;
+		}
+
+		depth += n->prefix_len;
+		uint8_t b = byte_at(key, depth);
+		void **slot = child_slot(n, b);
+		if (slot)
+			return insert_rec(slot, key, value, depth + 1, out);
+		out = make_leaf(key, value);
+		add_child(ref, n, b, tag_leaf(out));
+		return true;
+	}
+
+	/* Removes the child for byte b from *ref, shrinking or collapsing the node. */
+	static void remove_child(void **ref, node *n, uint8_t b) {
+		switch (n->type) {
+		case NODE4: {
+			node4 *m = static_cast<node4 *>(n);
+			unsigned i = 0;
+			while (m->keys[i] != b)
+				i++;
+			std::memmove(m->keys + i, m->keys + i + 1, m->count - i - 1);
+			std::memmove(m->child + i, m->child + i + 1, (m->count - i - 1) * sizeof(void *));
+			m->count--;
+			if (m->count == 1) {
+				void *c = m->child[0];
+				if (!is_leaf(c)) {
+					/* Fold this node's prefix and edge byte into the child. */
+					node *cn = static_cast<node *>(c);
+					uint8_t prefix[8];
+					unsigned len = m->prefix_len;
+					std::memcpy(prefix, m->prefix, len);
+					prefix[len++] = m->keys[0];
+					std::memcpy(prefix + len, cn->prefix, cn->prefix_len);
+					len += cn->prefix_len;
+					std::memcpy(cn->prefix, prefix, len);
+					cn->prefix_len = (uint8_t)len;
+				}
+				*ref = c;
+				delete m;
+			}
+			return;
+		}
+		case NODE16: {
+			node16 *m = static_cast<node16 *>(n);
+			int i = node16_find(m, b);
+			std::memmove(m->keys + i, m->keys + i + 1, m->count - i - 1);
+			std::memmove(m->child + i, m->child + i + 1, (m->count - i - 1) * sizeof(void *));
+			m->count--;
+			if (m->count == 3) {
+				node4 *s = make_node<node4>(NODE4);
+				copy_header(s, m);
+				std::memcpy(s->keys, m->keys, 3);
+				std::memcpy(s->child, m->child, 3 * sizeof(void *));
+				s->count = 3;
+				*ref = s;
+				delete m;
+			}
+			return;
+		}
+		case NODE48: {
+			node48 *m = static_cast<node48 *>(n);
+			m->child[m->index[b] - 1] = nullptr;
+			m->index[b] = 0;
+			m->count--;
+			if (m->count == 12) {
+				node16 *s = make_node<node16>(NODE16);
+				copy_header(s, m);
+				for (unsigned i = 0; i < 256; i++) {
+					if (m->index[i]) {
+						s->keys[s->count] = (uint8_t)i;
+						s->child[s->count] = m->child[m->index[i] - 1];
+						s->count++;
+					}
+				}
+				*ref = s;
+				delete m;
+			}
+			return;
+		}
+		default: {
+			node256 *m = static_cast<node256 *>(n);
+			m->child[b] = nullptr;
+			m->count--;
+			if (m->count == 37) {
+				node48 *s = make_node<node48>(NODE48);
+				copy_header(s, m);
+				for (unsigned i = 0; i < 256; i++) {
+					if (m->child[i]) {
+						s->child[s->count] = m->child[i];
+						s->index[i] = (uint8_t)(s->count + 1);
+						s->count++;
+					}
+				}
+				*ref = s;
+				delete m;
+			}
+			return;
+		}
+		}
+	}
+
+	static bool erase_rec(void **ref, Key key, unsigned depth) {
+		void *p = *ref;
+		if (is_leaf(p)) {
+			entry *e = as_leaf(p);
+			if (e->key != key)
+				return false;
+			delete e;
+			*ref = nullptr;
+			return true;
+		}
+		node *n = static_cast<node *>(p);
+		for (unsigned i = 0; i < n->prefix_len; i++)
+			if (n->prefix[i] != byte_at(key, depth + i))
+				return false;
+		depth += n->prefix_len;
+		uint8_t b = byte_at(key, depth);
+		void **slot = child_slot(n, b);
+		if (!slot || !erase_rec(slot, key, depth + 1))
+			return false;
+		if (*slot == nullptr)
+			remove_child(ref, n, b);
+		return true;
+	}
+
+	template <class RandomIt>
+	static void *build(RandomIt first, RandomIt last, unsigned depth) {
+		if (last - first == 1)
+			return tag_leaf(make_leaf(first->first, first->second));
+
+		/* Sorted input: the common prefix of the extremes is shared by all. */
+		Key lo = first->first, hi = (last - 1)->first;
+		unsigned plen = 0;
+		while (byte_at(lo, depth + plen) == byte_at(hi, depth + plen))
+			plen++;
+		unsigned d = depth + plen;
+
+		unsigned distinct = 0;
+		int prev = -1;
+		for (RandomIt it = first; it != last; ++it) {
+			int b = byte_at(it->first, d);
+			if (b != prev) {
+				distinct++;
+				prev = b;
+			}
+		}
+
+		node *n;
+		if (distinct <= 4)
+			n = make_node<node4>(NODE4);
+		else if (distinct <= 16)
+			n = make_node<node16>(NODE16);
+		else if (distinct <= 48)
+			n = make_node<node48>(NODE48);
+		else
+			n = make_node<node256>(NODE256);
+		n->prefix_len = (uint8_t)plen;
+		for (unsigned i = 0; i < plen; i++)
+			n->prefix[i] = byte_at(lo, depth + i);
+
+		void *ref = n;
+		RandomIt group = first;
+		while (group != last) {
+			uint8_t b = byte_at(group->first, d);
+			RandomIt end = group;
+			while (end != last && byte_at(end->first, d) == b)
+				++end;
+			add_child(&ref, n, b, build(group, end, d + 1));
+			group = end;
+		}
+		return ref;
+	}
+};
+
+} /* namespace darwin */
+
+#endif /* __cplusplus */
+
+#endif /* _SYS_ARTREE_H_ */
@@ -0,0 +1,530 @@
+/*! @header
+ *  A cache-conscious B+tree with the ordered-lookup interface of
+ *  <sys/rbtree.h>.
+ *
+ *  rb_tree_t and tsearch(3) allocate one node per key and follow one pointer
+ *  per comparison, so a lookup in a tree of a few million keys touches twenty
+ *  or more cache lines.  darwin::bptree stores keys contiguously in nodes
+ *  sized to a small number of cache lines; a lookup touches one node per
+ *  level and a range scan walks the linked leaves sequentially.
+ *
+ *  The operations map onto the rbtree(3) interface as follows:
+ *
+ *      rb_tree_insert_node     insert(key, value)
+ *      rb_tree_find_node       find(key)
+ *      rb_tree_find_node_geq   find_geq(key)
+ *      rb_tree_find_node_leq   find_leq(key)
+ *      rb_tree_iterate         ++it / --it, begin(), last()
+ *      rb_tree_remove_node     erase(key)
+ *      rb_tree_count           size()
+ *
+ *  In addition, bulk_load() builds a tree from a sorted range in linear time
+ *  with leaves packed to a caller-chosen fill factor.
+ *
+ *  erase() removes entries from their leaf without merging siblings; the
+ *  separators in the interior remain valid bounds, so lookups and iteration
+ *  are unaffected.  Call bulk_load() on the contents to compact a tree that
+ *  has seen heavy deletion.
+ *
+ *  This header is C++ only and has no link-time dependencies.
+ */
+
+#ifndef _SYS_BPTREE_H_
+#define _SYS_BPTREE_H_
+
+#if defined(__cplusplus)
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace darwin {
+
+template <class Key, class T, class Compare = std::less<Key>, std::size_t NodeBytes = 256>
+class bptree {
+public:
+	typedef Key key_type;
+	typedef T mapped_type;
+	typedef Compare key_compare;
+	typedef std::size_t size_type;
+
+	/*! @abstract Maximum number of entries held by one leaf.                 */
+	static constexpr size_type leaf_capacity =
+	    NodeBytes / (sizeof(Key) + sizeof(T)) < 4 ? 4 : NodeBytes / (sizeof(Key) + sizeof(T));
+	/*! @abstract Maximum number of separators held by one interior node.     */
+	static constexpr size_type inner_capacity =
+	    NodeBytes / (sizeof(Key) + sizeof(void *)) < 4 ? 4 : NodeBytes / (sizeof(Key) + sizeof(void *));
+
+private:
+	struct alignas(64) leaf_node {
+		unsigned count = 0;
+		leaf_node *prev = nullptr;
+		leaf_node *next = nullptr;
+		Key keys[leaf_capacity];
+		T values[leaf_capacity];
+	};
+
+	struct alignas(64) inner_node {
+		unsigned count = 0;	/* number of separators; count + 1 children */
+		Key keys[inner_capacity];
+		void *children[inner_capacity + 1];
+	};
+
+	void *root_ = nullptr;
+	unsigned height_ = 0;		/* 0: root is a leaf */
+	size_type size_ = 0;
+	leaf_node *head_ = nullptr;
+	leaf_node *tail_ = nullptr;
+	Compare comp_;
+
+public:
+	class iterator {
+		friend class bptree;
+		const bptree *tree_ = nullptr;
+		leaf_node *leaf_ = nullptr;
+		unsigned index_ = 0;
+
+		iterator(const bptree *t, leaf_node *l, unsigned i) : tree_(t), leaf_(l), index_(i) {}
+
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef std::pair<const Key &, T &> value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef value_type reference;
+		typedef void pointer;
+
+		iterator() = default;
+
+		const Key &key() const { return leaf_->keys[index_]; }
+		T &value() const { return leaf_->values[index_]; }
+		reference operator*() const { return reference(leaf_->keys[index_], leaf_->values[index_]); }
+
+		iterator &operator++() {
+			if (++index_ >= leaf_->count) {
+				leaf_ = bptree::skip_forward(leaf_->next);
+				index_ = 0;
+			}
+			return *this;
+		}
+		iterator operator++(int) { iterator t = *this; ++*this; return t; }
+
+		/* Decrementing begin() yields end(); decrementing end() yields last(). */
+		iterator &operator--() {
+			if (leaf_ == nullptr) {
+				*this = tree_->last();
+			} else if (index_ == 0) {
+				leaf_ = bptree::skip_backward(leaf_->prev);
+				index_ = leaf_ ? leaf_->count - 1 : 0;
+			} else {
+				--index_;
+			}
+			return *this;
+		}
+		iterator operator--(int) { iterator t = *this; --*this; return t; }
+
+		bool operator==(const iterator &o) const { return leaf_ == o.leaf_ && index_ == o.index_; }
+		bool operator!=(const iterator &o) const { return !(*this == o); }
+	};
+
+	bptree() = default;
+	explicit bptree(const Compare &comp) : comp_(comp) {}
+	bptree(const bptree &) = delete;
+	bptree &operator=(const bptree &) = delete;
+	bptree(bptree &&o) noexcept { steal(o); }
+	bptree &operator=(bptree &&o) noexcept {
+		if (this != &o) {
+			clear();
+			steal(o);
+		}
+		return *this;
+	}
+	~bptree() { clear(); }
+
+	size_type size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	unsigned height() const { return root_ ? height_ + 1 : 0; }
+
+	iterator begin() const { return iterator(this, skip_forward(head_), 0); }
+	iterator end() const { return iterator(this, nullptr, 0); }
+
+	/*! @abstract The greatest entry, or end() if the tree is empty.          */
+	iterator last() const {
+		leaf_node *l = skip_backward(tail_);
+		return iterator(this, l, l ? l->count - 1 : 0);
+	}
+
+	void clear() {
+		if (root_)
+			destroy(root_, height_);
+		root_ = nullptr;
+		head_ = tail_ = nullptr;
+		height_ = 0;
+		size_ = 0;
+	}
+
+	/*! @abstract Exact match, or end().                                      */
+	iterator find(const Key &key) const {
+		iterator it = find_geq(key);
+		if (it != end() && !comp_(key, it.key()))
+			return it;
+		return end();
+	}
+
+	/*! @abstract The least entry whose key is not less than key, or end().   */
+	iterator find_geq(const Key &key) const {
+		if (!root_)
+			return end();
+		leaf_node *l = descend(key);
+		unsigned i = lower_index(l->keys, l->count, key);
+		if (i < l->count)
+			return iterator(this, l, i);
+		l = skip_forward(l->next);
+		return iterator(this, l, 0);
+	}
+
+	/*! @abstract The greatest entry whose key is not greater than key, or end(). */
+	iterator find_leq(const Key &key) const {
+		if (!root_)
+			return end();
+		leaf_node *l = descend(key);
+		unsigned i = upper_index(l->keys, l->count, key);
+		if (i > 0)
+			return iterator(this, l, i - 1);
+		l = skip_backward(l->prev);
+		return iterator(this, l, l ? l->count - 1 : 0);
+	}
+
+	iterator lower_bound(const Key &key) const { return find_geq(key); }
+	iterator upper_bound(const Key &key) const {
+		iterator it = find_geq(key);
+		if (it != end() && !comp_(key, it.key()))
+			++it;
+		return it;
+	}
+
+	/*!
+	 *  @abstract Inserts key if it is not already present.
+	 *  @discussion Like rb_tree_insert_node, an existing entry is left
+	 *  untouched and returned with second set to false.
+	 */
+	std::pair<iterator, bool> insert(const Key &key, const T &value) {
+		if (!root_) {
+			leaf_node *l = new leaf_node;
+			l->keys[0] = key;
+			l->values[0] = value;
+			l->count = 1;
+			root_ = head_ = tail_ = l;
+			height_ = 0;
+			size_ = 1;
+			return std::make_pair(iterator(this, l, 0), true);
+		}
+
+		split_result split;
+		iterator pos;
+		bool inserted = insert_rec(root_, height_, key, value, split, pos);
+		if (split.right) {
+			inner_node *r = new inner_node;
+			r->count = 1;
+			r->keys[0] = split.separator;
+			r->children[0] = root_;
+			r->children[1] = split.right;
+			root_ = r;
+			height_++;
+		}
+		if (inserted)
+			size_++;
+		return std::make_pair(pos, inserted);
+	}
+
+	/*! @abstract Removes key; returns false if it was not present.          */
+	bool erase(const Key &key) {
+		if (!root_)
+			return false;
+		leaf_node *l = descend(key);
+		unsigned i = lower_index(l->keys, l->count, key);
+		if (i >= l->count || comp_(key, l->keys[i]))
+			return false;
+		std::move(l->keys + i + 1, l->keys + l->count, l->keys + i);
+		std::move(l->values + i + 1, l->values + l->count, l->values + i);
+		l->count--;
+		size_--;
+		if (size_ == 0)
+			clear();
+		return true;
+	}
+
+	/*!
+	 *  @abstract Replaces the contents with a sorted, duplicate-free range.
+	 *  @param first,last Range of std::pair<Key, T> (or anything with
+	 *  .first/.second) in strictly ascending key order.
+	 *  @param fill Fraction of each node to populate, in (0, 1].  Values
+	 *  below 1 leave room for later inserts without immediate splits.
+	 */
+	template <class InputIt>
+	void bulk_load(InputIt first, InputIt last, double fill = 1.0) {
+		clear();
+		size_type per_leaf = fill_count(leaf_capacity, fill);
+		size_type per_inner = fill_count(inner_capacity, fill);
+
+		/* Pack leaves left to right. */
+		leaf_node *cur = nullptr;
+		size_type nleaves = 0;
+		for (; first != last; ++first) {
+			if (!cur || cur->count == per_leaf) {
+				leaf_node *l = new leaf_node;
+				l->prev = cur;
+				if (cur)
+					cur->next = l;
+				else
+					head_ = l;
+				cur = l;
+				nleaves++;
+			}
+			cur->keys[cur->count] = first->first;
+			cur->values[cur->count] = first->second;
+			cur->count++;
+			size_++;
+		}
+		tail_ = cur;
+		if (!cur)
+			return;
+
+		/* Avoid an underfull rightmost leaf by rebalancing it with its neighbour. */
+		if (cur->prev && cur->count < per_leaf / 2) {
+			leaf_node *p = cur->prev;
+			unsigned total = p->count + cur->count;
+			unsigned keep = total / 2;
+			unsigned moved = p->count - keep;
+			std::move_backward(cur->keys, cur->keys + cur->count, cur->keys + cur->count + moved);
+			std::move_backward(cur->values, cur->values + cur->count, cur->values + cur->count + moved);
+			std::move(p->keys + keep, p->keys + p->count, cur->keys);
+			std::move(p->values + keep, p->values + p->count, cur->values);
+			p->count = keep;
+			cur->count += moved;
+		}
+
+		/* Build interior levels bottom-up over (first key, node) pairs. */
+		struct entry { Key low; void *node; };
+		entry *level = new entry[nleaves];
+		size_type n = 0;
+		for (leaf_node *l = head_; l; l = l->next)
+			level[n++] = entry{ l->keys[0], l };
+
+		unsigned h = 0;
+		while (n > 1) {
+			size_type fan = per_inner + 1;
+			size_type m = (n + fan - 1) / fan;
+			/* Spread children evenly so no interior node ends up with one child. */
+			size_type base = n / m, extra = n % m, src = 0;
+			for (size_type j = 0; j < m; j++) {
+				size_type take = base + (j < extra ? 1 : 0);
+				inner_node *in = new inner_node;
+				in->count = (unsigned)take - 1;
+				Key low = level[src].low;
+				for (size_type c = 0; c < take; c++) {
+					in->children[c] = level[src + c].node;
+					if (c > 0)
+						in->keys[c - 1] = level[src + c].low;
+				}
+				src += take;
+				level[j] = entry{ low, in };
+			}
+			n = m;
+			h++;
+		}
+		root_ = level[0].node;
+		height_ = h;
+		delete[] level;
+	}
+
+private:
+	struct split_result {
+		void *right = nullptr;
+		Key separator;
+	};
+
+	static size_type fill_count(size_type cap, double fill) {
+		if (!(fill > 0.0) || fill > 1.0)
+			fill = 1.0;
+		size_type n = (size_type)(cap * fill);
+		return n < 2 ? 2 : n;
+	}
+
+	static leaf_node *skip_forward(leaf_node *l) {
+		while (l && l->count == 0)
+			l = l->next;
+		return l;
+	}
+
+	static leaf_node *skip_backward(leaf_node *l) {
+		while (l && l->count == 0)
+			l = l->prev;
+		return l;
+	}
+
+	static constexpr bool linear_search =
+	    std::is_arithmetic<Key>::value && std::is_same<Compare, std::less<Key> >::value;
+
+	/* Index of the first key not less than key. */
+	unsigned lower_index(const Key *keys, unsigned n, const Key &key) const {
+		if (linear_search) {
+			/* Branch-free count over one or two cache lines beats a binary search. */
+			unsigned i = 0;
+			for (unsigned j = 0; j < n; j++)
+				i += comp_(keys[j], key);
+			return i;
+		}
+		return (unsigned)(std::lower_bound(keys, keys + n, key, comp_) - keys);
+	}
+
+	/* Index of the first key greater than key. */
+	unsigned upper_index(const Key *keys, unsigned n, const Key &key) const {
+		if (linear_search) {
+			unsigned i = 0;
+			for (unsigned j = 0; j < n; j++)
+				i += !comp_(key, keys[j]);
+			return i;
+		}
+		return (unsigned)(std::upper_bound(keys, keys + n, key, comp_) - keys);
+	}
+
+	leaf_node *descend(const Key &key) const {
+		void *n = root_;
+		for (unsigned h = height_; h > 0; h--) {
+			inner_node *in = static_cast<inner_node *>(n);
+			n = in->children[upper_index(in->keys, in->count, key)];
+		}
+		return static_cast<leaf_node *>(n);
+	}
+
+	bool insert_rec(void *n, unsigned h, const Key &key, const T &value,
+	    split_result &split, iterator &pos) {
+		if (h == 0) {
+			leaf_node *l = static_cast<leaf_node *>(n);
+			unsigned i = lower_index(l->keys, l->count, key);
+			if (i < l->count && !comp_(key, l->keys[i])) {
+				pos = iterator(this, l, i);
+				return false;
+			}
+			if (l->count < leaf_capacity) {
+				leaf_insert_at(l, i, key, value);
+				pos = iterator(this, l, i);
+				return true;
+			}
+
+			/* Split; sequential appends keep the left leaf full. */
+			leaf_node *r = new leaf_node;
+			unsigned keep = (l->next == nullptr && i == l->count) ?
+			    (unsigned)leaf_capacity : (unsigned)leaf_capacity / 2;
+			std::move(l->keys + keep, l->keys + l->count, r->keys);
+			std::move(l->values + keep, l->values + l->count, r->values);
+			r->count = l->count - keep;
+			l->count = keep;
+			r->next = l->next;
+			r->prev = l;
+			if (l->next)
+				l->next->prev = r;
+			else
+				tail_ = r;
+			l->next = r;
+
+			if (i <= keep && !(keep == leaf_capacity && i == keep)) {
+				leaf_insert_at(l, i, key, value);
+				pos = iterator(this, l, i);
+			} else {
+				leaf_insert_at(r, i - keep, key, value);
+				pos = iterator(this, r, i - keep);
+			}
+			split.right = r;
+			split.separator = r->keys[0];
+			return true;
+		}
+
+		inner_node *in = static_cast<inner_node *>(n);
+		unsigned ci = upper_index(in->keys, in->count, key);
+		split_result child;
+		bool inserted = insert_rec(in->children[ci], h - 1, key, value, child, pos);
+		if (!child.right)
+			return inserted;
+
+		if (in->count < inner_capacity) {
+			inner_insert_at(in, ci, child.separator, child.right);
+			return inserted;
+		}
+
+		/* Split the interior node around its median separator. */
+		inner_node *r = new inner_node;
+		unsigned mid = (unsigned)inner_capacity / 2;
+		Key keys[inner_capacity + 1];
+		void *kids[inner_capacity + 2];
+		std::move(in->keys, in->keys + ci, keys);
+		keys[ci] = child.separator;
+		std::move(in->keys + ci, in->keys + in->count, keys + ci + 1);
+		std::copy(in->children, in->children + ci + 1, kids);
+		kids[ci + 1] = child.right;
+		std::copy(in->children + ci + 1, in->children + in->count + 1, kids + ci + 2);
+		unsigned total = in->count + 1;
+
+		in->count = mid;
+		std::move(keys, keys + mid, in->keys);
+		std::copy(kids, kids + mid + 1, in->children);
+		r->count = total - mid - 1;
+		std::move(keys + mid + 1, keys + total, r->keys);
+		std::copy(kids + mid + 1, kids + total + 1, r->children);
+
+		split.right = r;
+		split.separator = keys[mid];
+		return inserted;
+	}
+
+	static void leaf_insert_at(leaf_node *l, unsigned i, const Key &key, const T &value) {
+		std::move_backward(l->keys + i, l->keys + l->count, l->keys + l->count + 1);
+		std::move_backward(l->values + i, l->values + l->count, l->values + l->count + 1);
+		l->keys[i] = key;
+		l->values[i] = value;
+		l->count++;
+	}
+
+	static void inner_insert_at(inner_node *in, unsigned i, const Key &sep, void *right) {
+		std::move_backward(in->keys + i, in->keys + in->count, in->keys + in->count + 1);
+		std::copy_backward(in->children + i + 1, in->children + in->count + 1, in->children + in->count + 2);
+		in->keys[i] = sep;
+		in->children[i + 1] = right;
+		in->count++;
+	}
+
+	static void destroy(void *n, unsigned h) {
+		if (h == 0) {
+			delete static_cast<leaf_node *>(n);
+			return;
+		}
+		inner_node *in = static_cast<inner_node *>(n);
+		for (unsigned i = 0; i <= in->count; i++)
+			destroy(in->children[i], h - 1);
+		delete in;
+	}
+
+	void steal(bptree &o) {
+		root_ = o.root_;
+		height_ = o.height_;
+		size_ = o.size_;
+		head_ = o.head_;
+		tail_ = o.tail_;
+		comp_ = o.comp_;
+		o.root_ = nullptr;
+		o.head_ = o.tail_ = nullptr;
+		o.height_ = 0;
+		o.size_ = 0;
+	}
+};
+
+} /* namespace darwin */
+
+#endif /* __cplusplus */
+
+#endif /* _SYS_BPTREE_H_ */
@@ -0,0 +1,724 @@
+/*! @header
+ *  A reusable event loop over kqueue(2) with batched change submission and a
+ *  hierarchical timer wheel.
+ *
+ *  darwin::event_loop keeps the desired interest set for every descriptor
+ *  and records changes rather than applying them.  Before each wait the
+ *  changes are coalesced (repeated watch()/modify()/unwatch() calls on one
+ *  descriptor collapse into a single change) and submitted in the same
+ *  kevent64() call that retrieves events, so a loop iteration costs one
+ *  system call no matter how many descriptors were re-armed.  Events are
+ *  drained options::batch at a time.
+ *
+ *  Timers do not use EVFILT_TIMER.  They live in a four-level timer wheel
+ *  of 256 slots per level with options::tick_ns resolution; adding and
+ *  cancelling a timer is O(1) and the kernel only ever sees the timeout of
+ *  the next wait.  A timer fires on the first tick at or after its deadline.
+ *
+ *  post() queues a function from any thread and wakes the loop through an
+ *  EVFILT_USER event.  Everything else must be called on the loop's thread.
+ *
+ *  On Linux the same interface is provided over epoll(7), eventfd(2) and
+ *  timerfd_create(2) so that code using the loop can be tested off-device.
+ *  epoll has no changelist, so there each coalesced change is still one
+ *  epoll_ctl() call.
+ */
+
+#ifndef _SYS_EVENT_LOOP_H_
+#define _SYS_EVENT_LOOP_H_
+
+#if defined(__cplusplus)
+
+#include <sys/types.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <sys/event.h>
+#elif defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#else
+#error "event_loop requires kqueue (Darwin) or epoll (Linux)"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace darwin {
+
+/*! @abstract Interest and readiness bits passed to and from event_loop.   */
+enum : unsigned {
+	EVENT_LOOP_READ = 0x1,
+	EVENT_LOOP_WRITE = 0x2,
+	EVENT_LOOP_EOF = 0x4,		/* output only: peer closed */
+	EVENT_LOOP_ERROR = 0x8,		/* output only: registration or socket error */
+};
+
+/*!
+ *  @abstract A timer wheel with 256 slots per level.
+ *
+ *  @discussion
+ *  Deadlines are expressed in ticks.  Timers due within 256 ticks sit in
+ *  level 0; later ones sit in coarser levels and are cascaded down as the
+ *  wheel turns.  Deadlines beyond 2^32 ticks are clamped.  The wheel is
+ *  usable on its own; event_loop drives it from its wait timeout.
+ */
+class timer_wheel {
+public:
+	typedef uint64_t timer_id;
+	typedef std::function<void()> callback;
+
+	static constexpr unsigned levels = 4;
+	static constexpr unsigned slot_bits = 8;
+	static constexpr unsigned slots = 1u << slot_bits;
+
+	explicit timer_wheel(uint64_t start_tick = 0) : now_(start_tick) {
+		for (unsigned l = 0; l < levels; l++) {
+			for (unsigned s = 0; s < slots; s++)
+				heads_[l][s] = nil;
+			linked_[l] = 0;
+		}
+	}
+
+	uint64_t now() const { return now_; }
+	size_t size() const { return live_; }
+
+	/*! @abstract Schedules cb for now() + delay ticks (at least one).     */
+	timer_id add(uint64_t delay, callback cb, uint64_t repeat = 0) {
+		uint32_t i = alloc();
+		node &n = nodes_[i];
+		n.cb = std::move(cb);
+		n.repeat = repeat;
+		n.expires = now_ + (delay ? delay : 1);
+		n.armed = true;
+		place(i);
+		live_++;
+		return ((uint64_t)n.gen << 32) | i;
+	}
+
+	/*! @abstract Cancels a pending timer; returns false if already gone.  */
+	bool cancel(timer_id id) {
+		uint32_t i = (uint32_t)id;
+		if (i >= nodes_.size() || nodes_[i].gen != (uint32_t)(id >> 32) || !nodes_[i].armed)
+			return false;
+		node &n = nodes_[i];
+		n.armed = false;
+		if (n.linked)
+			unlink(i);
+		/* A timer cancelled from its own callback is freed by advance(). */
+		if (i != firing_)
+			release(i);
+		live_--;
+		return true;
+	}
+
+	/*!
+	 *  @abstract Ticks until the next level-0 expiry or cascade, or
+	 *  UINT64_MAX when no timers are pending.
+	 */
+	uint64_t ticks_until_next() const {
+		if (live_ == 0)
+			return UINT64_MAX;
+		unsigned base = (unsigned)(now_ & (slots - 1));
+		uint64_t next = UINT64_MAX;
+		if (linked_[0] != 0) {
+			for (unsigned d = 1; d <= slots; d++)
+				if (heads_[0][(base + d) & (slots - 1)] != nil) {
+					next = d;
+					break;
+				}
+		}
+		/* A coarser timer may cascade into a slot before that one. */
+		for (unsigned l = 1; l < levels; l++)
+			if (linked_[l] != 0)
+				return next < slots - base ? next : slots - base;
+		return next;
+	}
+
+	/*! @abstract Turns the wheel to tick, firing everything that is due.  */
+	size_t advance(uint64_t tick) {
+		size_t fired = 0;
+		if (live_ == 0) {
+			if (tick > now_)
+				now_ = tick;
+			return 0;
+		}
+		while (now_ < tick) {
+			now_++;
+			unsigned idx = (unsigned)(now_ & (slots - 1));
+			if (idx == 0)
+				cascade(1);
+			uint32_t i;
+			while ((i = heads_[0][idx]) != nil) {
+				unlink(i);
+				/* The callback may add timers and reallocate nodes_. */
+				callback cb = std::move(nodes_[i].cb);
+				firing_ = i;
+				cb();
+				firing_ = nil;
+				node &n = nodes_[i];
+				fired++;
+				if (n.armed && n.repeat) {
+					n.cb = std::move(cb);
+					n.expires = now_ + n.repeat;
+					place(i);
+				} else {
+					if (n.armed)
+						live_--;
+					release(i);
+				}
+			}
+			if (live_ == 0 && now_ < tick)
+				now_ = tick;
+		}
+		return fired;
+	}
+
+private:
+	static constexpr uint32_t nil = UINT32_MAX;
+
+	struct node {
+		callback cb;
+		uint64_t expires = 0;
+		uint64_t repeat = 0;
+		uint32_t prev = nil, next = nil;
+		uint32_t gen = 0;
+		uint8_t level = 0, slot = 0;
+		bool armed = false, linked = false;
+	};
+
+	std::vector<node> nodes_;
+	std::vector<uint32_t> free_;
+	uint32_t heads_[levels][slots];
+	size_t linked_[levels];		/* timers linked into each level */
+	uint64_t now_;
+	size_t live_ = 0;
+	uint32_t firing_ = nil;
+
+	uint32_t alloc() {
+		if (!free_.empty()) {
+			uint32_t i = free_.back();
+			free_.pop_back();
+			return i;
+		}
+		nodes_.emplace_back();
+		return (uint32_t)(nodes_.size() - 1);
+	}
+
+	void release(uint32_t i) {
+		node &n = nodes_[i];
+		n.cb = nullptr;
+		n.armed = false;
+		n.gen++;
+		free_.push_back(i);
+	}
+
+	void place(uint32_t i) {
+		node &n = nodes_[i];
+		uint64_t delta = n.expires > now_ ? n.expires - now_ : 0;
+		uint64_t max = ((uint64_t)1 << (slot_bits * levels)) - 1;
+		if (delta > max) {
+			delta = max;
+			n.expires = now_ + max;
+		}
+		unsigned level = 0;
+		while (level + 1 < levels && delta >= ((uint64_t)1 << (slot_bits * (level + 1))))
+			level++;
+		/* Only cascading places a due timer; it fires in the current tick. */
+		uint64_t at = now_ + delta;
+		unsigned slot = (unsigned)((at >> (slot_bits * level)) & (slots - 1));
+		n.level = (uint8_t)level;
+		n.slot = (uint8_t)slot;
+		n.prev = nil;
+		n.next = heads_[level][slot];
+		if (n.next != nil)
+			nodes_[n.next].prev = i;
+		heads_[level][slot] = i;
+		n.linked = true;
+		linked_[level]++;
+	}
+
+	void unlink(uint32_t i) {
+		node &n = nodes_[i];
+		if (n.prev != nil)
+			nodes_[n.prev].next = n.next;
+		else
+			heads_[n.level][n.slot] = n.next;
+		if (n.next != nil)
+			nodes_[n.next].prev = n.prev;
+		n.prev = n.next = nil;
+		n.linked = false;
+		linked_[n.level]--;
+	}
+
+	void cascade(unsigned level) {
+		if (level >= levels)
+			return;
+		unsigned idx = (unsigned)((now_ >> (slot_bits * level)) & (slots - 1));
+		if (idx == 0)
+			cascade(level + 1);
+		uint32_t i = heads_[level][idx];
+		heads_[level][idx] = nil;
+		while (i != nil) {
+			uint32_t next = nodes_[i].next;
+			nodes_[i].linked = false;
+			linked_[level]--;
+			place(i);
+			i = next;
+		}
+	}
+};
+
+class event_loop {
+public:
+	typedef std::function<void(int fd, unsigned events)> io_callback;
+	typedef timer_wheel::timer_id timer_id;
+
+	struct options {
+		/*! Maximum events drained per wait.                               */
+		unsigned batch = 1024;
+		/*! Timer resolution.                                              */
+		uint64_t tick_ns = 1000000;
+	};
+
+	event_loop() : event_loop(options()) {}
+
+	/*! @abstract Creates the kernel queue; throws std::system_error.      */
+	explicit event_loop(const options &opt)
+	    : opt_(opt), wheel_(0), epoch_ns_(monotonic_ns()) {
+		if (opt_.batch == 0)
+			opt_.batch = 1;
+		if (opt_.tick_ns == 0)
+			opt_.tick_ns = 1;
+		events_.resize(opt_.batch);
+#if defined(__APPLE__)
+		receipts_.resize(opt_.batch);
+		kq_ = kqueue();
+		if (kq_ < 0)
+			throw std::system_error(errno, std::generic_category(), "kqueue");
+		struct kevent64_s ev;
+		EV_SET64(&ev, wake_ident, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0, 0, 0);
+		if (kevent64(kq_, &ev, 1, nullptr, 0, 0, nullptr) < 0) {
+			int e = errno;
+			close(kq_);
+			throw std::system_error(e, std::generic_category(), "kevent64");
+		}
+#else
+		ep_ = epoll_create1(EPOLL_CLOEXEC);
+		wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (ep_ < 0 || wake_fd_ < 0 || timer_fd_ < 0) {
+			int e = errno;
+			close_all();
+			throw std::system_error(e, std::generic_category(), "epoll");
+		}
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.u64 = wake_ident;
+		epoll_ctl(ep_, EPOLL_CTL_ADD, wake_fd_, &ev);
+		ev.data.u64 = timer_ident;
+		epoll_ctl(ep_, EPOLL_CTL_ADD, timer_fd_, &ev);
+#endif
+	}
+
+	event_loop(const event_loop &) = delete;
+	event_loop &operator=(const event_loop &) = delete;
+
+	~event_loop() { close_all(); }
+
+	/*!
+	 *  @abstract Starts watching fd for EVENT_LOOP_READ and/or _WRITE.
+	 *
+	 *  @discussion
+	 *  Replaces any previous registration of fd.  Readiness is level
+	 *  triggered.  The change takes effect at the next wait.
+	 */
+	void watch(int fd, unsigned events, io_callback cb) {
+		if (fd < 0)
+			return;
+		if ((size_t)fd >= fds_.size())
+			fds_.resize((size_t)fd + 1);
+		fd_entry &e = fds_[(size_t)fd];
+		if (e.cb)
+			e.gen++;	/* drop events already queued for the old owner */
+		e.cb = std::move(cb);
+		set_interest(fd, e, events & (EVENT_LOOP_READ | EVENT_LOOP_WRITE));
+	}
+
+	/*! @abstract Changes the interest set of a watched descriptor.        */
+	void modify(int fd, unsigned events) {
+		if (fd < 0 || (size_t)fd >= fds_.size() || !fds_[(size_t)fd].cb)
+			return;
+		set_interest(fd, fds_[(size_t)fd], events & (EVENT_LOOP_READ | EVENT_LOOP_WRITE));
+	}
+
+	/*!
+	 *  @abstract Stops watching fd.
+	 *
+	 *  @discussion
+	 *  Call this before closing the descriptor.  Events for fd already
+	 *  drained in the current batch are discarded.
+	 */
+	void unwatch(int fd) {
+		if (fd < 0 || (size_t)fd >= fds_.size() || !fds_[(size_t)fd].cb)
+			return;
+		fd_entry &e = fds_[(size_t)fd];
+		e.cb = nullptr;
+		e.gen++;
+		set_interest(fd, e, 0);
+	}
+
+	/*! @abstract Runs cb once after delay_ns, then every repeat_ns if set. */
+	timer_id add_timer(uint64_t delay_ns, std::function<void()> cb, uint64_t repeat_ns = 0) {
+		sync_wheel();
+		uint64_t ticks = (delay_ns + opt_.tick_ns - 1) / opt_.tick_ns;
+		uint64_t rep = repeat_ns ? (repeat_ns + opt_.tick_ns - 1) / opt_.tick_ns : 0;
+		return wheel_.add(ticks, std::move(cb), rep);
+	}
+
+	bool cancel_timer(timer_id id) { return wheel_.cancel(id); }
+
+	/*! @abstract Queues fn to run on the loop thread.  Thread-safe.       */
+	void post(std::function<void()> fn) {
+		bool wake;
+		{
+			std::lock_guard<std::mutex> g(post_mu_);
+			wake = posted_.empty();
+			posted_.push_back(std::move(fn));
+		}
+		if (wake)
+			wakeup();
+	}
+
+	/*! @abstract Makes run() return after the current iteration.          */
+	void stop() {
+		post([this] { running_ = false; });
+	}
+
+	/*!
+	 *  @abstract Submits pending changes, waits up to timeout_ns (negative:
+	 *  no limit other than timers) and dispatches what arrived.
+	 *
+	 *  @result Number of I/O callbacks and timers run, or -1 with errno set.
+	 */
+	int run_once(int64_t timeout_ns = -1) {
+		uint64_t until_timer = wheel_.ticks_until_next();
+		uint64_t wait_ns = UINT64_MAX;
+		if (until_timer != UINT64_MAX) {
+			uint64_t due = epoch_ns_ + (wheel_.now() + until_timer) * opt_.tick_ns;
+			uint64_t now = monotonic_ns();
+			wait_ns = due > now ? due - now : 0;
+		}
+		if (timeout_ns >= 0 && (uint64_t)timeout_ns < wait_ns)
+			wait_ns = (uint64_t)timeout_ns;
+		if (has_posted())
+			wait_ns = 0;
+
+		int n = wait(wait_ns);
+		if (n < 0 && errno != EINTR)
+			return -1;
+		int ran = report_failed();
+		ran += n > 0 ? dispatch(n) : 0;
+		ran += (int)sync_wheel();
+		ran += run_posted();
+		return ran;
+	}
+
+	/*! @abstract Runs until stop() is called.                             */
+	void run() {
+		running_ = true;
+		while (running_)
+			run_once();
+	}
+
+	size_t timers() const { return wheel_.size(); }
+	size_t pending_changes() const { return dirty_.size(); }
+
+private:
+	static constexpr uint64_t wake_ident = UINT64_MAX;
+	static constexpr uint64_t timer_ident = UINT64_MAX - 1;
+
+	struct fd_entry {
+		io_callback cb;
+		unsigned want = 0;		/* interest requested by the caller */
+		unsigned registered = 0;	/* interest the kernel knows about */
+		uint32_t gen = 0;
+		bool dirty = false;
+	};
+
+	options opt_;
+	timer_wheel wheel_;
+	uint64_t epoch_ns_;
+	std::vector<fd_entry> fds_;
+	std::vector<int> dirty_;
+	std::vector<uint64_t> failed_;		/* tokens of rejected registrations */
+	bool running_ = false;
+
+	std::mutex post_mu_;
+	std::vector<std::function<void()> > posted_;
+	std::vector<std::function<void()> > running_posted_;
+
+#if defined(__APPLE__)
+	int kq_ = -1;
+	std::vector<struct kevent64_s> changes_;
+	std::vector<struct kevent64_s> receipts_;
+	std::vector<struct kevent64_s> events_;
+#else
+	int ep_ = -1, wake_fd_ = -1, timer_fd_ = -1;
+	std::vector<struct epoll_event> events_;
+#endif
+
+	static uint64_t monotonic_ns() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+	}
+
+	static uint64_t token(int fd, uint32_t gen) {
+		return ((uint64_t)gen << 32) | (uint32_t)fd;
+	}
+
+	void close_all() {
+#if defined(__APPLE__)
+		if (kq_ >= 0)
+			close(kq_);
+		kq_ = -1;
+#else
+		if (ep_ >= 0)
+			close(ep_);
+		if (wake_fd_ >= 0)
+			close(wake_fd_);
+		if (timer_fd_ >= 0)
+			close(timer_fd_);
+		ep_ = wake_fd_ = timer_fd_ = -1;
+#endif
+	}
+
+	void set_interest(int fd, fd_entry &e, unsigned want) {
+		e.want = want;
+		if (!e.dirty) {
+			e.dirty = true;
+			dirty_.push_back(fd);
+		}
+	}
+
+	bool has_posted() {
+		std::lock_guard<std::mutex> g(post_mu_);
+		return !posted_.empty();
+	}
+
+	void wakeup() {
+#if defined(__APPLE__)
+		struct kevent64_s ev;
+		EV_SET64(&ev, wake_ident, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0, 0, 0);
+		kevent64(kq_, &ev, 1, nullptr, 0, 0, nullptr);
+#else
+		uint64_t one = 1;
+		ssize_t r = ::write(wake_fd_, &one, sizeof(one));
+		(void)r;
+#endif
+	}
+
+	size_t sync_wheel() {
+		uint64_t tick = (monotonic_ns() - epoch_ns_) / opt_.tick_ns;
+		return wheel_.advance(tick);
+	}
+
+	/* Delivers EVENT_LOOP_ERROR for registrations the kernel refused. */
+	int report_failed() {
+		int ran = 0;
+		for (size_t i = 0; i < failed_.size(); i++) {
+			uint64_t tok = failed_[i];
+			int fd = (int)(uint32_t)tok;
+			if ((size_t)fd >= fds_.size())
+				continue;
+			fd_entry &e = fds_[(size_t)fd];
+			if (!e.cb || e.gen != (uint32_t)(tok >> 32))
+				continue;
+			io_callback cb = e.cb;
+			cb(fd, EVENT_LOOP_ERROR);
+			ran++;
+		}
+		failed_.clear();
+		return ran;
+	}
+
+	int run_posted() {
+		{
+			std::lock_guard<std::mutex> g(post_mu_);
+			running_posted_.swap(posted_);
+		}
+		int n = (int)running_posted_.size();
+		for (auto &fn : running_posted_)
+			fn();
+		running_posted_.clear();
+		return n;
+	}
+
+#if defined(__APPLE__)
+	void queue_change(int fd, int16_t filter, uint16_t flags, uint32_t gen) {
+		if (changes_.size() == opt_.batch) {
+			/*
+			 * Changelist full: submit it without collecting events.  With
+			 * EV_RECEIPT every change gets its own result back, so a
+			 * refused registration is still reported.
+			 */
+			for (struct kevent64_s &c : changes_)
+				c.flags |= EV_RECEIPT;
+			int n = kevent64(kq_, changes_.data(), (int)changes_.size(),
+			    receipts_.data(), (int)receipts_.size(), 0, nullptr);
+			for (int i = 0; i < n; i++) {
+				const struct kevent64_s &r = receipts_[(size_t)i];
+				if ((r.flags & EV_ERROR) && r.data != 0 && !(r.flags & EV_DELETE))
+					failed_.push_back(r.udata);
+			}
+			changes_.clear();
+		}
+		struct kevent64_s ev;
+		EV_SET64(&ev, (uint64_t)fd, filter, flags, 0, 0, token(fd, gen), 0, 0);
+		changes_.push_back(ev);
+	}
+
+	int wait(uint64_t wait_ns) {
+		for (int fd : dirty_) {
+			fd_entry &e = fds_[(size_t)fd];
+			e.dirty = false;
+			unsigned add = e.want & ~e.registered, del = e.registered & ~e.want;
+			/* Re-adding refreshes udata after a generation change. */
+			unsigned keep = e.want & e.registered;
+			if ((add | keep) & EVENT_LOOP_READ)
+				queue_change(fd, EVFILT_READ, EV_ADD | EV_ENABLE, e.gen);
+			if ((add | keep) & EVENT_LOOP_WRITE)
+				queue_change(fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, e.gen);
+			if (del & EVENT_LOOP_READ)
+				queue_change(fd, EVFILT_READ, EV_DELETE, e.gen);
+			if (del & EVENT_LOOP_WRITE)
+				queue_change(fd, EVFILT_WRITE, EV_DELETE, e.gen);
+			e.registered = e.want;
+		}
+		dirty_.clear();
+
+		struct timespec ts, *tsp = nullptr;
+		if (wait_ns != UINT64_MAX) {
+			ts.tv_sec = (time_t)(wait_ns / 1000000000ull);
+			ts.tv_nsec = (long)(wait_ns % 1000000000ull);
+			tsp = &ts;
+		}
+		int n = kevent64(kq_, changes_.data(), (int)changes_.size(),
+		    events_.data(), (int)events_.size(), 0, tsp);
+		changes_.clear();
+		return n;
+	}
+
+	int dispatch(int n) {
+		int ran = 0;
+		for (int i = 0; i < n; i++) {
+			const struct kevent64_s &ev = events_[(size_t)i];
+			if (ev.filter == EVFILT_USER)
+				continue;
+			int fd = (int)(uint32_t)ev.udata;
+			if ((size_t)fd >= fds_.size())
+				continue;
+			fd_entry &e = fds_[(size_t)fd];
+			if (!e.cb || e.gen != (uint32_t)(ev.udata >> 32))
+				continue;
+			unsigned what;
+			if (ev.flags & EV_ERROR)
+				what = EVENT_LOOP_ERROR;
+			else
+				what = ev.filter == EVFILT_READ ? EVENT_LOOP_READ : EVENT_LOOP_WRITE;
+			if (ev.flags & EV_EOF)
+				what |= EVENT_LOOP_EOF;
+			if ((what & (EVENT_LOOP_READ | EVENT_LOOP_WRITE)) && !(what & e.want))
+				continue;
+			io_callback cb = e.cb;	/* the callback may unwatch itself */
+			cb(fd, what);
+			ran++;
+		}
+		return ran;
+	}
+#else
+	int wait(uint64_t wait_ns) {
+		for (int fd : dirty_) {
+			fd_entry &e = fds_[(size_t)fd];
+			e.dirty = false;
+			struct epoll_event ev = {};
+			ev.events = ((e.want & EVENT_LOOP_READ) ? (uint32_t)(EPOLLIN | EPOLLRDHUP) : 0u) |
+			    ((e.want & EVENT_LOOP_WRITE) ? (uint32_t)EPOLLOUT : 0u);
+			ev.data.u64 = token(fd, e.gen);
+			int op = !e.want ? EPOLL_CTL_DEL : e.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+			if (!e.want && !e.registered)
+				continue;
+			int r = epoll_ctl(ep_, op, fd, &ev);
+			if (r < 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+				r = epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev);
+			if (r < 0 && op != EPOLL_CTL_DEL)
+				failed_.push_back(ev.data.u64);
+			e.registered = e.want;
+		}
+		dirty_.clear();
+
+		int timeout_ms = -1;
+		if (wait_ns == 0) {
+			timeout_ms = 0;
+		} else if (wait_ns != UINT64_MAX) {
+			/* Sub-millisecond deadlines go through the timerfd. */
+			struct itimerspec its = {};
+			its.it_value.tv_sec = (time_t)(wait_ns / 1000000000ull);
+			its.it_value.tv_nsec = (long)(wait_ns % 1000000000ull);
+			timerfd_settime(timer_fd_, 0, &its, nullptr);
+		}
+		return epoll_wait(ep_, events_.data(), (int)events_.size(), timeout_ms);
+	}
+
+	int dispatch(int n) {
+		int ran = 0;
+		for (int i = 0; i < n; i++) {
+			const struct epoll_event &ev = events_[(size_t)i];
+			uint64_t tok = ev.data.u64;
+			if (tok == wake_ident || tok == timer_ident) {
+				uint64_t drain;
+				ssize_t r = ::read(tok == wake_ident ? wake_fd_ : timer_fd_, &drain, sizeof(drain));
+				(void)r;
+				continue;
+			}
+			int fd = (int)(uint32_t)tok;
+			if ((size_t)fd >= fds_.size())
+				continue;
+			fd_entry &e = fds_[(size_t)fd];
+			if (!e.cb || e.gen != (uint32_t)(tok >> 32))
+				continue;
+			unsigned what = 0;
+			if (ev.events & (EPOLLIN | EPOLLPRI))
+				what |= EVENT_LOOP_READ;
+			if (ev.events & EPOLLOUT)
+				what |= EVENT_LOOP_WRITE;
+			if (ev.events & (EPOLLHUP | EPOLLRDHUP))
+				what |= EVENT_LOOP_EOF | (e.want & EVENT_LOOP_READ);
+			if (ev.events & EPOLLERR)
+				what |= EVENT_LOOP_ERROR;
+			what &= e.want | EVENT_LOOP_EOF | EVENT_LOOP_ERROR;
+			if (!what)
+				continue;
+			io_callback cb = e.cb;	/* the callback may unwatch itself */
+			cb(fd, what);
+			ran++;
+		}
+		return ran;
+	}
+#endif
+};
+
+} /* namespace darwin */
+
+#endif /* __cplusplus */
+
+#endif /* _SYS_EVENT_LOOP_H_ */